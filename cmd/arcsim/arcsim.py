@@ -0,0 +1,441 @@
+#!/usr/bin/python
+#
+# Replay an ARC access trace through a model of the ARC and L2ARC, and
+# report the hit rates they would have achieved at other cache sizes.
+#
+# The trace is recorded by the zfs module when it is loaded with
+# zfs_arc_trace_entries set to a non-zero number of records.  Every
+# arc_read() is logged to a ring buffer exported by the raw kstat
+# /proc/spl/kstat/zfs/arc_trace, which only ever holds the most recent
+# records.  Run "arcsim.py -r FILE" to poll the kstat and append new
+# records to FILE for as long as it runs, then simulate with
+# "arcsim.py FILE".  Copies of the kstat itself may be given as well.
+#
+# CDDL HEADER START
+#
+# The contents of this file are subject to the terms of the
+# Common Development and Distribution License, Version 1.0 only
+# (the "License").  You may not use this file except in compliance
+# with the License.
+#
+# You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+# or http://www.opensolaris.org/os/licensing.
+# See the License for the specific language governing permissions
+# and limitations under the License.
+#
+# When distributing Covered Code, include this CDDL HEADER in each
+# file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+# If applicable, add the following below this CDDL HEADER, with the
+# fields enclosed by brackets "[]" replaced with your own identifying
+# information: Portions Copyright [yyyy] [name of copyright owner]
+#
+# CDDL HEADER END
+#
+#
+# The RAM model is the ARC's adaptive replacement policy, sized in bytes:
+# recently used (MRU) and frequently used (MFU) lists, each backed by a
+# ghost list whose hits steer the target size of the MRU.  The L2ARC model
+# is a ring which is fed with the L2-cacheable blocks evicted from the
+# ARC model, approximating the feed thread which writes out blocks nearing
+# the tail of the ARC lists.
+#
+
+
+import sys
+import time
+import getopt
+import re
+import struct
+
+from collections import OrderedDict
+from signal import signal, SIGINT
+
+TRACE_KSTAT = "/proc/spl/kstat/zfs/arc_trace"
+
+# struct arc_trace_rec in include/sys/arc.h
+REC_FORMAT = "=QQQQQIBBH"
+REC_SIZE = struct.calcsize(REC_FORMAT)
+
+# arc_trace_type_t
+TRACE_HIT = 0
+TRACE_IOWAIT = 1
+TRACE_MISS = 2
+TRACE_MRU_GHOST = 3
+TRACE_MFU_GHOST = 4
+TRACE_L2_ONLY = 5
+
+TRACE_PREFETCH = 1 << 0
+TRACE_METADATA = 1 << 1
+TRACE_L2CACHE = 1 << 2
+TRACE_L2HDR = 1 << 3
+
+SUFFIXES = {"K": 1 << 10, "M": 1 << 20, "G": 1 << 30, "T": 1 << 40}
+
+
+def usage():
+    sys.stderr.write("Usage: arcsim.py -r file [-i interval]\n")
+    sys.stderr.write("       arcsim.py [-c sizes] [-l sizes -m size] "
+                     "file ...\n\n")
+    sys.stderr.write("\t -r : Record the kstat trace to file\n")
+    sys.stderr.write("\t -i : Seconds between polls of the kstat "
+                     "(default 1)\n")
+    sys.stderr.write("\t -c : Comma separated ARC sizes to simulate\n")
+    sys.stderr.write("\t -l : Comma separated L2ARC sizes to simulate\n")
+    sys.stderr.write("\t -m : ARC size used for the L2ARC simulation\n")
+    sys.stderr.write("\nSizes take a K, M, G or T suffix.  By default "
+                     "the ARC is simulated at\npowers of two up to the "
+                     "size of all blocks in the trace.\n\n")
+    sys.stderr.write("Examples:\n")
+    sys.stderr.write("\tarcsim.py -r /var/tmp/arc.trace\n")
+    sys.stderr.write("\tarcsim.py -c 1G,2G,4G,8G /var/tmp/arc.trace\n")
+    sys.stderr.write("\tarcsim.py -m 4G -l 64G,128G,256G "
+                     "/var/tmp/arc.trace\n")
+    sys.exit(1)
+
+
+def parse_size(s):
+    s = s.strip().upper()
+    if s and s[-1] in SUFFIXES:
+        return int(float(s[:-1]) * SUFFIXES[s[-1]])
+    return int(s)
+
+
+def prettysize(sz):
+    for suffix in ["", "K", "M", "G", "T"]:
+        if sz < 1024 or suffix == "T":
+            break
+        sz /= 1024.0
+    if suffix == "":
+        return "%d" % sz
+    return "%.4g%s" % (sz, suffix)
+
+
+def decode_raw(data, records):
+    """Decode the records of a binary snapshot of the trace ring."""
+    for off in range(0, len(data) - REC_SIZE + 1, REC_SIZE):
+        rec = struct.unpack(REC_FORMAT, data[off:off + REC_SIZE])
+        if rec[0] != 0:
+            records[rec[0]] = rec
+
+
+def read_trace(f, records):
+    """
+    Read records from either a copy of the kstat, which is a hex dump of
+    the ring, or a file written by record mode with one record per line.
+    The two may be mixed; records are keyed by sequence number.
+    """
+    hexline = re.compile(r"^[0-9a-f]+:((?: [0-9a-f]{2})+)\s*$")
+    raw = bytearray()
+
+    for line in f:
+        m = hexline.match(line)
+        if m:
+            raw.extend(bytearray(int(b, 16) for b in m.group(1).split()))
+            continue
+        if raw:
+            decode_raw(bytes(raw), records)
+            raw = bytearray()
+
+        fields = line.split()
+        if len(fields) != 9 or not fields[0].isdigit():
+            continue
+        rec = tuple(int(x) for x in fields)
+        records[rec[0]] = rec
+
+    if raw:
+        decode_raw(bytes(raw), records)
+
+
+def write_records(f, records, seqs):
+    for seq in seqs:
+        f.write(" ".join("%d" % x for x in records[seq]) + "\n")
+
+
+def record(path, interval):
+    """Poll the kstat, appending records not seen before to path."""
+    last = 0
+
+    try:
+        out = open(path, "a")
+    except IOError as e:
+        sys.stderr.write("Cannot open %s: %s\n" % (path, e))
+        sys.exit(1)
+
+    while True:
+        records = {}
+        try:
+            f = open(TRACE_KSTAT, "r")
+            read_trace(f, records)
+            f.close()
+        except IOError as e:
+            sys.stderr.write("Cannot read %s: %s\n" % (TRACE_KSTAT, e))
+            sys.exit(1)
+
+        seqs = sorted(s for s in records if s > last)
+        if seqs:
+            if last != 0 and seqs[0] != last + 1:
+                sys.stderr.write("Lost %d records, poll more often\n" %
+                                 (seqs[0] - last - 1))
+            write_records(out, records, seqs)
+            out.flush()
+            last = seqs[-1]
+
+        time.sleep(interval)
+
+
+class L2ARC:
+    def __init__(self, size):
+        self.size = size
+        self.used = 0
+        self.blocks = OrderedDict()
+
+    def lookup(self, key):
+        return key in self.blocks
+
+    def feed(self, key, size):
+        if key in self.blocks or size > self.size:
+            return
+        while self.used + size > self.size:
+            self.used -= self.blocks.popitem(last=False)[1]
+        self.blocks[key] = size
+        self.used += size
+
+
+class ARC:
+    """Byte sized adaptive replacement cache."""
+
+    def __init__(self, c, l2arc=None):
+        self.c = c
+        self.p = c // 2
+        self.mru = OrderedDict()
+        self.mfu = OrderedDict()
+        self.mru_ghost = OrderedDict()
+        self.mfu_ghost = OrderedDict()
+        self.size = {"mru": 0, "mfu": 0, "mru_ghost": 0, "mfu_ghost": 0}
+        self.l2arc = l2arc
+        self.l2cache = {}
+
+    def _insert(self, name, key, size):
+        getattr(self, name)[key] = size
+        self.size[name] += size
+
+    def _remove(self, name, key):
+        size = getattr(self, name).pop(key)
+        self.size[name] -= size
+        return size
+
+    def _evict_one(self, name, ghost):
+        key, size = getattr(self, name).popitem(last=False)
+        self.size[name] -= size
+        self._insert(ghost, key, size)
+        if self.l2arc is not None and self.l2cache.pop(key, False):
+            self.l2arc.feed(key, size)
+
+    def _evict(self):
+        while self.size["mru"] + self.size["mfu"] > self.c:
+            if self.mru and (self.size["mru"] > self.p or not self.mfu):
+                self._evict_one("mru", "mru_ghost")
+            else:
+                self._evict_one("mfu", "mfu_ghost")
+
+        while self.mru_ghost and \
+                self.size["mru"] + self.size["mru_ghost"] > self.c:
+            self._remove("mru_ghost", next(iter(self.mru_ghost)))
+        while self.mfu_ghost and \
+                sum(self.size.values()) > 2 * self.c:
+            self._remove("mfu_ghost", next(iter(self.mfu_ghost)))
+
+    def access(self, key, size, prefetch, l2cache):
+        """Returns "hit", "l2hit" or "miss"."""
+        if self.l2arc is not None and l2cache:
+            self.l2cache[key] = True
+
+        if key in self.mru:
+            # A prefetched block is only promoted when it is demanded.
+            if prefetch:
+                self._insert("mru", key, self._remove("mru", key))
+            else:
+                self._insert("mfu", key, self._remove("mru", key))
+            return "hit"
+
+        if key in self.mfu:
+            self._insert("mfu", key, self._remove("mfu", key))
+            return "hit"
+
+        result = "miss"
+        if self.l2arc is not None and self.l2arc.lookup(key):
+            result = "l2hit"
+
+        if key in self.mru_ghost:
+            delta = max(self.size["mfu_ghost"] //
+                        max(self.size["mru_ghost"], 1), 1) * size
+            self.p = min(self.c, self.p + delta)
+            self._remove("mru_ghost", key)
+            self._insert("mfu", key, size)
+        elif key in self.mfu_ghost:
+            delta = max(self.size["mru_ghost"] //
+                        max(self.size["mfu_ghost"], 1), 1) * size
+            self.p = max(0, self.p - delta)
+            self._remove("mfu_ghost", key)
+            self._insert("mfu", key, size)
+        else:
+            self._insert("mru", key, size)
+
+        self._evict()
+        return result
+
+
+class Counts:
+    def __init__(self):
+        self.reads = 0
+        self.hits = 0
+        self.l2hits = 0
+        self.dreads = 0
+        self.dhits = 0
+
+    def add(self, result, prefetch):
+        self.reads += 1
+        if not prefetch:
+            self.dreads += 1
+        if result == "hit":
+            self.hits += 1
+            if not prefetch:
+                self.dhits += 1
+        elif result == "l2hit":
+            self.l2hits += 1
+
+
+def pct(n, d):
+    if d == 0:
+        return "-"
+    return "%.1f" % (100.0 * n / d)
+
+
+def simulate(records, sizes, l2sizes, l2arc_c):
+    seqs = sorted(records)
+    trace = []
+    blocks = {}
+    observed = Counts()
+
+    for seq in seqs:
+        (seq, spa, dva0, dva1, birth, size, rtype, flags, pad) = \
+            records[seq]
+        key = (spa, dva0, dva1, birth)
+        prefetch = bool(flags & TRACE_PREFETCH)
+        trace.append((key, size, prefetch, bool(flags & TRACE_L2CACHE)))
+        blocks[key] = size
+        if rtype in (TRACE_HIT, TRACE_IOWAIT):
+            result = "hit"
+        elif flags & TRACE_L2HDR:
+            result = "l2hit"
+        else:
+            result = "miss"
+        observed.add(result, prefetch)
+
+    footprint = sum(blocks.values())
+    if seqs and seqs[-1] - seqs[0] + 1 != len(seqs):
+        sys.stderr.write("Warning: %d records are missing from the "
+                         "trace\n" % (seqs[-1] - seqs[0] + 1 - len(seqs)))
+
+    sys.stdout.write("%d reads of %d blocks, %s in total\n\n" %
+                     (len(trace), len(blocks), prettysize(footprint)))
+    sys.stdout.write("%-10s %7s %7s\n" % ("arcsize", "hit%", "dhit%"))
+    sys.stdout.write("%-10s %7s %7s\n" % ("observed",
+                     pct(observed.hits, observed.reads),
+                     pct(observed.dhits, observed.dreads)))
+
+    if not sizes:
+        size = 1 << 26
+        while size < footprint:
+            sizes.append(size)
+            size *= 2
+        sizes.append(size)
+
+    for c in sizes:
+        arc = ARC(c)
+        counts = Counts()
+        for (key, size, prefetch, l2cache) in trace:
+            counts.add(arc.access(key, size, prefetch, l2cache), prefetch)
+        sys.stdout.write("%-10s %7s %7s\n" % (prettysize(c),
+                         pct(counts.hits, counts.reads),
+                         pct(counts.dhits, counts.dreads)))
+
+    if not l2sizes:
+        return
+
+    sys.stdout.write("\n%-10s %7s %7s %7s\n" %
+                     ("l2size", "hit%", "l2hit%", "total%"))
+    for l2c in l2sizes:
+        arc = ARC(l2arc_c, L2ARC(l2c))
+        counts = Counts()
+        for (key, size, prefetch, l2cache) in trace:
+            counts.add(arc.access(key, size, prefetch, l2cache), prefetch)
+        sys.stdout.write("%-10s %7s %7s %7s\n" % (prettysize(l2c),
+                         pct(counts.hits, counts.reads),
+                         pct(counts.l2hits, counts.reads - counts.hits),
+                         pct(counts.hits + counts.l2hits, counts.reads)))
+
+
+def sighandler(*args):
+    sys.exit(0)
+
+
+def main():
+    rfile = None
+    interval = 1
+    sizes = []
+    l2sizes = []
+    l2arc_c = None
+
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], "r:i:c:l:m:h")
+    except getopt.error:
+        usage()
+
+    try:
+        for opt, arg in opts:
+            if opt == "-r":
+                rfile = arg
+            elif opt == "-i":
+                interval = float(arg)
+            elif opt == "-c":
+                sizes = [parse_size(s) for s in arg.split(",")]
+            elif opt == "-l":
+                l2sizes = [parse_size(s) for s in arg.split(",")]
+            elif opt == "-m":
+                l2arc_c = parse_size(arg)
+            else:
+                usage()
+    except ValueError:
+        usage()
+
+    signal(SIGINT, sighandler)
+
+    if rfile is not None:
+        if args:
+            usage()
+        record(rfile, interval)
+        return
+
+    if not args or (l2sizes and l2arc_c is None):
+        usage()
+
+    records = {}
+    for path in args:
+        try:
+            f = open(path, "r")
+        except IOError as e:
+            sys.stderr.write("Cannot open %s: %s\n" % (path, e))
+            sys.exit(1)
+        read_trace(f, records)
+        f.close()
+
+    if not records:
+        sys.stderr.write("No records found\n")
+        sys.exit(1)
+
+    simulate(records, sizes, l2sizes, l2arc_c)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,176 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * raidz_test checks every RAID-Z parity implementation this CPU supports
+ * against the scalar code.  For each parity level and a range of widths,
+ * ashifts, sizes and offsets it compares generated parity and rebuilds
+ * every combination of up to nparity failed columns.  The data is derived
+ * from a fixed seed, so a failure can be reproduced exactly.  The exit
+ * status is non-zero if any case mismatches.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/vdev_impl.h>
+#include <sys/vdev_raidz.h>
+
+#define	RAIDZ_TEST_MAXWIDTH	12
+#define	RAIDZ_TEST_SEED		0x5a6f4c52ULL
+#define	RAIDZ_TEST_NELEM(a)	(sizeof (a) / sizeof ((a)[0]))
+
+static const char *raidz_test_impls[] = {
+	"scalar", "ssse3", "avx2", "avx512bw"
+};
+
+static const uint64_t raidz_test_ashifts[] = {
+	SPA_MINBLOCKSHIFT, 12
+};
+
+/* in sectors, SPA_MAXBLOCKSIZE meaning the largest block */
+static const uint64_t raidz_test_sizes[] = {
+	1, 3, 17, SPA_MAXBLOCKSIZE
+};
+
+static int raidz_test_verbose;
+
+static void
+usage(void)
+{
+	(void) fprintf(stderr,
+	    "Usage: raidz_test [-v] [-s seed]\n"
+	    "\t-v\tlist each case as it is run\n"
+	    "\t-s seed\tfill the test blocks from seed\n");
+	exit(2);
+}
+
+/*
+ * Run every size and offset for one layout, returning the number of
+ * mismatches.  Each case gets the next seed.
+ */
+static int
+raidz_test_layout(const char *name, uint64_t nparity, uint64_t dcols,
+    uint64_t ashift, uint64_t *seed)
+{
+	uint64_t size, offset;
+	int failures = 0;
+	int error, s, o;
+
+	for (s = 0; s < RAIDZ_TEST_NELEM(raidz_test_sizes); s++) {
+		size = MIN(raidz_test_sizes[s] << ashift, SPA_MAXBLOCKSIZE);
+
+		for (o = 0; o < 2; o++) {
+			/*
+			 * The second offset starts the map on the last
+			 * column and flips the single parity column swap.
+			 */
+			offset = o * ((1ULL << 20) + ((dcols - 1) << ashift));
+
+			error = vdev_raidz_math_verify(name, nparity, dcols,
+			    ashift, offset, size, (*seed)++);
+
+			if (error != 0 || raidz_test_verbose) {
+				(void) printf("%s: parity=%llu cols=%llu "
+				    "ashift=%llu size=%llu offset=%llu: %s\n",
+				    name, (u_longlong_t)nparity,
+				    (u_longlong_t)dcols, (u_longlong_t)ashift,
+				    (u_longlong_t)size, (u_longlong_t)offset,
+				    error == 0 ? "ok" : "MISMATCH");
+			}
+			if (error != 0)
+				failures++;
+		}
+	}
+
+	return (failures);
+}
+
+/*
+ * Check one implementation over every layout.  All implementations are
+ * fed the same sequence of blocks.
+ */
+static int
+raidz_test_impl(const char *name, uint64_t seed)
+{
+	uint64_t nparity, dcols;
+	int failures = 0;
+	int a;
+
+	for (nparity = 1; nparity <= VDEV_RAIDZ_MAXPARITY; nparity++) {
+		for (dcols = nparity + 1; dcols <= RAIDZ_TEST_MAXWIDTH;
+		    dcols++) {
+			for (a = 0; a < RAIDZ_TEST_NELEM(raidz_test_ashifts);
+			    a++) {
+				failures += raidz_test_layout(name, nparity,
+				    dcols, raidz_test_ashifts[a], &seed);
+			}
+		}
+	}
+
+	return (failures);
+}
+
+int
+main(int argc, char **argv)
+{
+	uint64_t seed = RAIDZ_TEST_SEED;
+	int failures = 0;
+	int i, n, c;
+
+	while ((c = getopt(argc, argv, "vs:")) != -1) {
+		switch (c) {
+		case 'v':
+			raidz_test_verbose++;
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (optind != argc)
+		usage();
+
+	kernel_init(FREAD);
+
+	for (i = 0; i < RAIDZ_TEST_NELEM(raidz_test_impls); i++) {
+		const char *name = raidz_test_impls[i];
+
+		if (vdev_raidz_math_find(name) == NULL) {
+			(void) printf("%-10s skipped, not supported\n", name);
+			continue;
+		}
+
+		n = raidz_test_impl(name, seed);
+		(void) printf("%-10s %s\n", name, n == 0 ? "passed" : "FAILED");
+		failures += n;
+	}
+
+	kernel_fini();
+
+	return (failures == 0 ? 0 : 1);
+}
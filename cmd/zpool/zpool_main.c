@@ -82,6 +82,7 @@ static int zpool_do_replace(int, char **);
 static int zpool_do_split(int, char **);
 
 static int zpool_do_scrub(int, char **);
+static int zpool_do_trim(int, char **);
 
 static int zpool_do_import(int, char **);
 static int zpool_do_export(int, char **);
@@ -138,7 +139,8 @@ typedef enum {
 	HELP_SET,
 	HELP_SPLIT,
 	HELP_REGUID,
-	HELP_REOPEN
+	HELP_REOPEN,
+	HELP_TRIM
 } zpool_help_t;
 
 
@@ -181,6 +183,7 @@ static zpool_command_t command_table[] = {
 	{ "split",	zpool_do_split,		HELP_SPLIT		},
 	{ NULL },
 	{ "scrub",	zpool_do_scrub,		HELP_SCRUB		},
+	{ "trim",	zpool_do_trim,		HELP_TRIM		},
 	{ NULL },
 	{ "import",	zpool_do_import,	HELP_IMPORT		},
 	{ "export",	zpool_do_export,	HELP_EXPORT		},
@@ -235,7 +238,7 @@ get_usage(zpool_help_t idx) {
 		    "[-R root] [-F [-n]]\n"
 		    "\t    <pool | id> [newpool]\n"));
 	case HELP_IOSTAT:
-		return (gettext("\tiostat [-v] [-T d|u] [pool] ... [interval "
+		return (gettext("\tiostat [-vw] [-T d|u] [pool] ... [interval "
 		    "[count]]\n"));
 	case HELP_LABELCLEAR:
 		return (gettext("\tlabelclear [-f] <vdev>\n"));
@@ -255,6 +258,8 @@ get_usage(zpool_help_t idx) {
 		return (gettext("\treopen <pool>\n"));
 	case HELP_SCRUB:
 		return (gettext("\tscrub [-s] <pool> ...\n"));
+	case HELP_TRIM:
+		return (gettext("\ttrim [-s] [-r rate] <pool> ...\n"));
 	case HELP_STATUS:
 		return (gettext("\tstatus [-vx] [-T d|u] [pool] ... [interval "
 		    "[count]]\n"));
@@ -2302,6 +2307,7 @@ error:
 
 typedef struct iostat_cbdata {
 	boolean_t cb_verbose;
+	boolean_t cb_histo;
 	int cb_namewidth;
 	int cb_iteration;
 	zpool_list_t *cb_list;
@@ -2479,6 +2485,151 @@ print_vdev_stats(zpool_handle_t *zhp, const char *name, nvlist_t *oldnv,
 	}
 }
 
+static const char *histo_class_name[ZIO_PRIORITY_NUM_QUEUEABLE] = {
+	"sync_read", "sync_write", "async_read", "async_write", "scrub"
+};
+
+/*
+ * Format a latency in nanoseconds with the largest unit that keeps it
+ * an integer of at least one.
+ */
+static void
+nicetime(uint64_t ns, char *buf, size_t len)
+{
+	const char *units[] = { "ns", "us", "ms", "s" };
+	int u = 0;
+
+	while (ns >= 1000 && u < 3) {
+		ns /= 1000;
+		u++;
+	}
+
+	(void) snprintf(buf, len, "%llu%s", (u_longlong_t)ns, units[u]);
+}
+
+/*
+ * Print a pair of histograms (e.g. queue wait and disk time) for every
+ * i/o class as one table, with a row per bucket and a pair of columns per
+ * class.  Each histogram is an array of ZIO_PRIORITY_NUM_QUEUEABLE rows of
+ * 'buckets' counts.  Rows which are empty across the whole table at either
+ * end are skipped.
+ */
+static void
+print_histo_table(const char *title, const char *col1, const char *col2,
+    uint64_t *new1, uint64_t *old1, uint64_t *new2, uint64_t *old2,
+    int buckets, boolean_t latency)
+{
+	int first = buckets, last = -1;
+	int b, p;
+	char buf[64];
+
+	for (b = 0; b < buckets; b++) {
+		for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+			int i = p * buckets + b;
+
+			if (new1[i] != old1[i] || new2[i] != old2[i]) {
+				first = MIN(first, b);
+				last = MAX(last, b);
+			}
+		}
+	}
+
+	(void) printf("%-8s", title);
+	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++)
+		(void) printf("  %12s", histo_class_name[p]);
+	(void) printf("\n%-8s", "");
+	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++)
+		(void) printf("  %5s  %5s", col1, col2);
+	(void) printf("\n");
+
+	for (b = first; b <= last; b++) {
+		if (latency)
+			nicetime(1ULL << b, buf, sizeof (buf));
+		else
+			zfs_nicenum(1ULL << b, buf, sizeof (buf));
+		(void) printf("%-8s", buf);
+
+		for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+			int i = p * buckets + b;
+
+			print_one_stat(new1[i] - old1[i]);
+			print_one_stat(new2[i] - old2[i]);
+		}
+		(void) printf("\n");
+	}
+}
+
+/*
+ * Print the latency and request size histograms for the given vdev, and
+ * for all vdevs below it in verbose mode.  Like print_vdev_stats(), the
+ * counts are the difference between the old and new configs.
+ */
+static void
+print_vdev_histo(zpool_handle_t *zhp, const char *name, nvlist_t *oldnv,
+    nvlist_t *newnv, iostat_cbdata_t *cb, int depth)
+{
+	static vdev_stat_ex_t zerovsx;
+	vdev_stat_ex_t *oldvsx, *newvsx;
+	nvlist_t **oldchild, **newchild;
+	uint_t c, children, oldchildren = 0;
+	const char *types[] = { ZPOOL_CONFIG_CHILDREN, ZPOOL_CONFIG_L2CACHE };
+	char *vname;
+	int t;
+
+	(void) printf("%*s%s\n", depth, "", name);
+
+	if (nvlist_lookup_uint64_array(newnv, ZPOOL_CONFIG_VDEV_STATS_EX,
+	    (uint64_t **)&newvsx, &c) != 0 ||
+	    c != sizeof (vdev_stat_ex_t) / sizeof (uint64_t)) {
+		(void) printf(gettext("histograms not available\n\n"));
+		return;
+	}
+
+	if (oldnv == NULL || nvlist_lookup_uint64_array(oldnv,
+	    ZPOOL_CONFIG_VDEV_STATS_EX, (uint64_t **)&oldvsx, &c) != 0 ||
+	    c != sizeof (vdev_stat_ex_t) / sizeof (uint64_t))
+		oldvsx = &zerovsx;
+
+	print_histo_table("latency", "wait", "disk",
+	    &newvsx->vsx_queue_histo[0][0], &oldvsx->vsx_queue_histo[0][0],
+	    &newvsx->vsx_disk_histo[0][0], &oldvsx->vsx_disk_histo[0][0],
+	    VDEV_L_HISTO_BUCKETS, B_TRUE);
+	print_histo_table("size", "ind", "agg",
+	    &newvsx->vsx_ind_histo[0][0], &oldvsx->vsx_ind_histo[0][0],
+	    &newvsx->vsx_agg_histo[0][0], &oldvsx->vsx_agg_histo[0][0],
+	    VDEV_RQ_HISTO_BUCKETS, B_FALSE);
+	(void) printf("\n");
+
+	if (!cb->cb_verbose)
+		return;
+
+	for (t = 0; t < sizeof (types) / sizeof (types[0]); t++) {
+		if (nvlist_lookup_nvlist_array(newnv, types[t],
+		    &newchild, &children) != 0)
+			continue;
+
+		if (oldnv != NULL && nvlist_lookup_nvlist_array(oldnv,
+		    types[t], &oldchild, &oldchildren) != 0)
+			continue;
+
+		for (c = 0; c < children; c++) {
+			uint64_t ishole = B_FALSE;
+
+			(void) nvlist_lookup_uint64(newchild[c],
+			    ZPOOL_CONFIG_IS_HOLE, &ishole);
+			if (ishole)
+				continue;
+
+			vname = zpool_vdev_name(g_zfs, zhp, newchild[c],
+			    B_FALSE);
+			print_vdev_histo(zhp, vname, oldnv != NULL &&
+			    c < oldchildren ? oldchild[c] : NULL,
+			    newchild[c], cb, depth + 2);
+			free(vname);
+		}
+	}
+}
+
 static int
 refresh_iostat(zpool_handle_t *zhp, void *data)
 {
@@ -2524,6 +2675,12 @@ print_iostat(zpool_handle_t *zhp, void *data)
 	/*
 	 * Print out the statistics for the pool.
 	 */
+	if (cb->cb_histo) {
+		print_vdev_histo(zhp, zpool_get_name(zhp), oldnvroot,
+		    newnvroot, cb, 0);
+		return (0);
+	}
+
 	print_vdev_stats(zhp, zpool_get_name(zhp), oldnvroot, newnvroot, cb, 0);
 
 	if (cb->cb_verbose)
@@ -2664,9 +2821,10 @@ get_timestamp_arg(char c)
 }
 
 /*
- * zpool iostat [-v] [-T d|u] [pool] ... [interval [count]]
+ * zpool iostat [-vw] [-T d|u] [pool] ... [interval [count]]
  *
  *	-v	Display statistics for individual vdevs
+ *	-w	Display latency and request size histograms
  *	-T	Display a timestamp in date(1) or Unix format
  *
  * This command can be tricky because we want to be able to deal with pool
@@ -2684,10 +2842,11 @@ zpool_do_iostat(int argc, char **argv)
 	unsigned long interval = 0, count = 0;
 	zpool_list_t *list;
 	boolean_t verbose = B_FALSE;
+	boolean_t histo = B_FALSE;
 	iostat_cbdata_t cb;
 
 	/* check options */
-	while ((c = getopt(argc, argv, "T:v")) != -1) {
+	while ((c = getopt(argc, argv, "T:vw")) != -1) {
 		switch (c) {
 		case 'T':
 			get_timestamp_arg(*optarg);
@@ -2695,6 +2854,9 @@ zpool_do_iostat(int argc, char **argv)
 		case 'v':
 			verbose = B_TRUE;
 			break;
+		case 'w':
+			histo = B_TRUE;
+			break;
 		case '?':
 			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
 			    optopt);
@@ -2730,6 +2892,7 @@ zpool_do_iostat(int argc, char **argv)
 	 */
 	cb.cb_list = list;
 	cb.cb_verbose = verbose;
+	cb.cb_histo = histo;
 	cb.cb_iteration = 0;
 	cb.cb_namewidth = 0;
 
@@ -2761,9 +2924,9 @@ zpool_do_iostat(int argc, char **argv)
 
 			/*
 			 * If it's the first time, or verbose mode, print the
-			 * header.
+			 * header.  The histograms carry their own headers.
 			 */
-			if (++cb.cb_iteration == 1 || verbose)
+			if ((++cb.cb_iteration == 1 || verbose) && !histo)
 				print_iostat_header(&cb);
 
 			(void) pool_list_iter(list, B_FALSE, print_iostat, &cb);
@@ -2773,10 +2936,10 @@ zpool_do_iostat(int argc, char **argv)
 			 * verbose mode (which prints a separator for us),
 			 * then print a separator.
 			 */
-			if (npools > 1 && !verbose)
+			if (npools > 1 && !verbose && !histo)
 				print_iostat_separator(&cb);
 
-			if (verbose)
+			if (verbose && !histo)
 				(void) printf("\n");
 		}
 
@@ -3851,6 +4014,82 @@ zpool_do_scrub(int argc, char **argv)
 	return (for_each_pool(argc, argv, B_TRUE, NULL, scrub_callback, &cb));
 }
 
+typedef struct trim_cbdata {
+	boolean_t	cb_start;
+	uint64_t	cb_rate;
+} trim_cbdata_t;
+
+int
+trim_callback(zpool_handle_t *zhp, void *data)
+{
+	trim_cbdata_t *cb = data;
+	int err;
+
+	/*
+	 * Ignore faulted pools.
+	 */
+	if (zpool_get_state(zhp) == POOL_STATE_UNAVAIL) {
+		(void) fprintf(stderr, gettext("cannot trim '%s': pool is "
+		    "currently unavailable\n"), zpool_get_name(zhp));
+		return (1);
+	}
+
+	err = zpool_trim(zhp, cb->cb_start, cb->cb_rate);
+
+	return (err != 0);
+}
+
+/*
+ * zpool trim [-s] [-r rate] <pool> ...
+ *
+ *	-s		Stop.  Stops any in-progress trim.
+ *	-r rate	Limit the discards to rate bytes per second.
+ */
+int
+zpool_do_trim(int argc, char **argv)
+{
+	int c;
+	trim_cbdata_t cb;
+
+	cb.cb_start = B_TRUE;
+	cb.cb_rate = 0;
+
+	/* check options */
+	while ((c = getopt(argc, argv, "sr:")) != -1) {
+		switch (c) {
+		case 's':
+			cb.cb_start = B_FALSE;
+			break;
+		case 'r':
+			if (zfs_nicestrtonum(NULL, optarg, &cb.cb_rate) != 0) {
+				(void) fprintf(stderr,
+				    gettext("invalid rate '%s'\n"), optarg);
+				usage(B_FALSE);
+			}
+			break;
+		case ':':
+			(void) fprintf(stderr, gettext("missing argument for "
+			    "'%c' option\n"), optopt);
+			usage(B_FALSE);
+			break;
+		case '?':
+			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
+			    optopt);
+			usage(B_FALSE);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1) {
+		(void) fprintf(stderr, gettext("missing pool name argument\n"));
+		usage(B_FALSE);
+	}
+
+	return (for_each_pool(argc, argv, B_TRUE, NULL, trim_callback, &cb));
+}
+
 typedef struct status_cbdata {
 	int		cb_count;
 	boolean_t	cb_allpools;
@@ -102,6 +102,7 @@
 #include <sys/zil_impl.h>
 #include <sys/vdev_impl.h>
 #include <sys/vdev_file.h>
+#include <sys/vdev_raidz.h>
 #include <sys/spa_impl.h>
 #include <sys/metaslab_impl.h>
 #include <sys/dsl_prop.h>
@@ -326,6 +327,7 @@ ztest_func_t ztest_ddt_repair;
 ztest_func_t ztest_dmu_snapshot_hold;
 ztest_func_t ztest_spa_rename;
 ztest_func_t ztest_scrub;
+ztest_func_t ztest_trim;
 ztest_func_t ztest_dsl_dataset_promote_busy;
 ztest_func_t ztest_vdev_attach_detach;
 ztest_func_t ztest_vdev_LUN_growth;
@@ -333,6 +335,7 @@ ztest_func_t ztest_vdev_add_remove;
 ztest_func_t ztest_vdev_aux_add_remove;
 ztest_func_t ztest_split_pool;
 ztest_func_t ztest_reguid;
+ztest_func_t ztest_raidz_math;
 ztest_func_t ztest_spa_upgrade;
 
 uint64_t zopt_always = 0ULL * NANOSEC;		/* all the time */
@@ -365,8 +368,10 @@ ztest_info_t ztest_info[] = {
 	{ ztest_ddt_repair,			1,	&zopt_sometimes	},
 	{ ztest_dmu_snapshot_hold,		1,	&zopt_sometimes	},
 	{ ztest_reguid,				1,	&zopt_sometimes },
+	{ ztest_raidz_math,			1,	&zopt_sometimes	},
 	{ ztest_spa_rename,			1,	&zopt_rarely	},
 	{ ztest_scrub,				1,	&zopt_rarely	},
+	{ ztest_trim,				1,	&zopt_sometimes	},
 	{ ztest_spa_upgrade,			1,	&zopt_rarely	},
 	{ ztest_dsl_dataset_promote_busy,	1,	&zopt_rarely	},
 	{ ztest_vdev_attach_detach,		1,	&zopt_sometimes	},
@@ -453,6 +458,8 @@ static int zc_cb_counter = 0;
 
 extern uint64_t metaslab_gang_bang;
 extern uint64_t metaslab_df_alloc_threshold;
+extern int zfs_trim;
+extern int zfs_trim_txg_delay;
 
 enum ztest_object {
 	ZTEST_META_DNODE = 0,
@@ -5048,7 +5055,7 @@ ztest_ddt_repair(ztest_ds_t *zd, uint64_t id)
 	enum zio_checksum checksum = spa_dedup_checksum(spa);
 	dmu_buf_t *db;
 	dmu_tx_t *tx;
-	void *buf;
+	abd_t *abd;
 	blkptr_t blk;
 	int copies = 2 * ZIO_DEDUPDITTO_MIN;
 	int i;
@@ -5129,14 +5136,14 @@ ztest_ddt_repair(ztest_ds_t *zd, uint64_t id)
 	 * Damage the block.  Dedup-ditto will save us when we read it later.
 	 */
 	psize = BP_GET_PSIZE(&blk);
-	buf = zio_buf_alloc(psize);
-	ztest_pattern_set(buf, psize, ~pattern);
+	abd = abd_alloc_linear(psize, B_TRUE);
+	ztest_pattern_set(abd_to_buf(abd), psize, ~pattern);
 
 	(void) zio_wait(zio_rewrite(NULL, spa, 0, &blk,
-	    buf, psize, NULL, NULL, ZIO_PRIORITY_SYNC_WRITE,
+	    abd, psize, NULL, NULL, ZIO_PRIORITY_SYNC_WRITE,
 	    ZIO_FLAG_CANFAIL | ZIO_FLAG_INDUCE_DAMAGE, NULL));
 
-	zio_buf_free(buf, psize);
+	abd_free(abd);
 
 	(void) rw_exit(&ztest_name_lock);
 	umem_free(od, sizeof(ztest_od_t));
@@ -5156,6 +5163,21 @@ ztest_scrub(ztest_ds_t *zd, uint64_t id)
 	(void) spa_scan(spa, POOL_SCAN_SCRUB);
 }
 
+/*
+ * Discard the free space in the pool, stopping it part way some of the time.
+ */
+/* ARGSUSED */
+void
+ztest_trim(ztest_ds_t *zd, uint64_t id)
+{
+	spa_t *spa = ztest_spa;
+
+	(void) spa_trim(spa, ztest_random(2) ? 0 : 64 << 20);
+	(void) poll(NULL, 0, 100); /* wait a moment, then maybe stop it */
+	if (ztest_random(2) == 0)
+		(void) spa_trim_stop(spa);
+}
+
 /*
  * Change the guid for the pool.
  */
@@ -5186,6 +5208,43 @@ ztest_reguid(ztest_ds_t *zd, uint64_t id)
 	VERIFY3U(load, ==, spa_load_guid(spa));
 }
 
+/*
+ * Check a randomly chosen RAID-Z parity implementation against the
+ * scalar code for a random layout, including reconstruction of every
+ * combination of failed columns.
+ */
+/* ARGSUSED */
+void
+ztest_raidz_math(ztest_ds_t *zd, uint64_t id)
+{
+	static const char *impls[] = {
+		"scalar", "ssse3", "avx2", "avx512bw", "fastest"
+	};
+	const char *name = impls[ztest_random(sizeof (impls) /
+	    sizeof (impls[0]))];
+	uint64_t nparity = 1 + ztest_random(VDEV_RAIDZ_MAXPARITY);
+	uint64_t dcols = nparity + 1 + ztest_random(8);
+	uint64_t ashift = SPA_MINBLOCKSHIFT + ztest_random(4);
+	uint64_t offset = ztest_random(1ULL << 20) << ashift;
+	uint64_t size;
+	int error;
+
+	size = (1 + ztest_random(SPA_MAXBLOCKSIZE >> ashift)) << ashift;
+
+	error = vdev_raidz_math_verify(name, nparity, dcols, ashift,
+	    offset, size, ztest_random(-1ULL));
+
+	if (ztest_opts.zo_verbose >= 4) {
+		(void) printf("raidz math %s parity=%llu cols=%llu "
+		    "ashift=%llu size=%llu: %d\n", name,
+		    (u_longlong_t)nparity, (u_longlong_t)dcols,
+		    (u_longlong_t)ashift, (u_longlong_t)size, error);
+	}
+
+	if (error != ENOTSUP)
+		VERIFY0(error);
+}
+
 /*
  * Rename the pool to a different name and then rename it back.
  */
@@ -5622,6 +5681,159 @@ ztest_dataset_close(int d)
 	ztest_zd_fini(zd);
 }
 
+/*
+ * Find a mirror whose children are all readable leaf vdevs.
+ */
+static vdev_t *
+ztest_find_leaf_mirror(vdev_t *vd)
+{
+	vdev_t *mvd;
+	int c;
+
+	if (vd->vdev_ops == &vdev_mirror_ops && vd->vdev_children >= 2) {
+		for (c = 0; c < vd->vdev_children; c++) {
+			vdev_t *cvd = vd->vdev_child[c];
+
+			if (!cvd->vdev_ops->vdev_op_leaf || !vdev_readable(cvd))
+				break;
+		}
+		if (c == vd->vdev_children)
+			return (vd);
+	}
+
+	for (c = 0; c < vd->vdev_children; c++) {
+		if ((mvd = ztest_find_leaf_mirror(vd->vdev_child[c])) != NULL)
+			return (mvd);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Wait briefly for every child of a mirror to have no i/o queued or in
+ * flight.  Once they are idle, store the number of reads each child has
+ * done in reads[], and the number of i/os they have completed or failed
+ * in *total.
+ */
+static boolean_t
+ztest_mirror_idle(vdev_t *mvd, uint64_t *reads, uint64_t *total)
+{
+	int c, wait;
+
+	for (wait = 0; wait < 100; wait++) {
+		for (c = 0; c < mvd->vdev_children; c++) {
+			if (vdev_queue_length(mvd->vdev_child[c]) != 0)
+				break;
+		}
+		if (c == mvd->vdev_children)
+			break;
+		(void) poll(NULL, 0, 1);
+	}
+	if (wait == 100)
+		return (B_FALSE);
+
+	*total = 0;
+	for (c = 0; c < mvd->vdev_children; c++) {
+		vdev_t *cvd = mvd->vdev_child[c];
+		vdev_stat_t *vs = &cvd->vdev_stat;
+
+		mutex_enter(&cvd->vdev_stat_lock);
+		reads[c] = vs->vs_ops[ZIO_TYPE_READ];
+		*total += vs->vs_ops[ZIO_TYPE_READ] +
+		    vs->vs_ops[ZIO_TYPE_WRITE] + vs->vs_read_errors +
+		    vs->vs_write_errors;
+		mutex_exit(&cvd->vdev_stat_lock);
+	}
+
+	return (B_TRUE);
+}
+
+#define	ZTEST_MIRROR_READS	64
+
+/*
+ * A sequential stream of reads to an otherwise idle mirror must stay on
+ * the child which served its first read.  This runs before the test
+ * threads start, but the txg sync thread, a resilver or an async task
+ * may still use the mirror; a stream which overlaps any of their i/o is
+ * retried, and the check is skipped if the mirror never goes quiet.
+ */
+static void
+ztest_mirror_sequential(spa_t *spa)
+{
+	vdev_t *mvd;
+	abd_t *abd;
+	uint64_t *before, *after;
+	uint64_t size, offset, total, done;
+	int attempt, c, i, served, first;
+
+	spa_config_enter(spa, SCL_STATE | SCL_ZIO, FTAG, RW_READER);
+
+	if ((mvd = ztest_find_leaf_mirror(spa->spa_root_vdev)) == NULL) {
+		spa_config_exit(spa, SCL_STATE | SCL_ZIO, FTAG);
+		return;
+	}
+
+	size = 1ULL << mvd->vdev_ashift;
+	abd = abd_alloc_linear(size, B_FALSE);
+	before = umem_alloc(mvd->vdev_children * sizeof (uint64_t),
+	    UMEM_NOFAIL);
+	after = umem_alloc(mvd->vdev_children * sizeof (uint64_t),
+	    UMEM_NOFAIL);
+
+	for (attempt = 0; attempt < 10; attempt++) {
+		offset = P2ALIGN(ztest_random(mvd->vdev_asize -
+		    ZTEST_MIRROR_READS * size), size);
+		first = -1;
+
+		for (i = 0; i < ZTEST_MIRROR_READS; i++) {
+			zio_t *zio;
+
+			if (!ztest_mirror_idle(mvd, before, &total))
+				break;
+
+			zio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+			zio_nowait(zio_vdev_child_io(zio, NULL, mvd,
+			    offset + i * size, abd, size, ZIO_TYPE_READ,
+			    ZIO_PRIORITY_SYNC_READ, ZIO_FLAG_CANFAIL |
+			    ZIO_FLAG_DONT_CACHE, NULL, NULL));
+			if (zio_wait(zio) != 0)
+				break;
+
+			/* Someone else used the mirror; start over. */
+			if (!ztest_mirror_idle(mvd, after, &done) ||
+			    done != total + 1)
+				break;
+
+			served = -1;
+			for (c = 0; c < mvd->vdev_children; c++) {
+				if (after[c] != before[c])
+					served = c;
+			}
+			if (first == -1)
+				first = served;
+			if (served != first) {
+				fatal(0, "sequential read %d from %llu on "
+				    "mirror %llu went to child %d, not %d", i,
+				    (u_longlong_t)offset,
+				    (u_longlong_t)mvd->vdev_id, served, first);
+			}
+		}
+
+		if (i == ZTEST_MIRROR_READS)
+			break;
+	}
+
+	umem_free(after, mvd->vdev_children * sizeof (uint64_t));
+	umem_free(before, mvd->vdev_children * sizeof (uint64_t));
+	abd_free(abd);
+	spa_config_exit(spa, SCL_STATE | SCL_ZIO, FTAG);
+
+	if (ztest_opts.zo_verbose >= 4) {
+		(void) printf("mirror sequential reads %s\n",
+		    attempt < 10 ? "stayed on one child" : "were disturbed");
+	}
+}
+
 /*
  * Kick off threads to run tests on all datasets in parallel.
  */
@@ -5714,6 +5926,12 @@ ztest_run(ztest_shared_t *zs)
 		}
 	}
 
+	/*
+	 * Verify that a sequential read stream keeps to one mirror child.
+	 */
+	txg_wait_synced(spa_get_dsl(spa), 0);
+	ztest_mirror_sequential(spa);
+
 	/*
 	 * If we got any ENOSPC errors on the previous run, destroy something.
 	 */
@@ -6204,6 +6422,13 @@ main(int argc, char **argv)
 		metaslab_df_alloc_threshold =
 		    zs->zs_metaslab_df_alloc_threshold;
 
+		/*
+		 * Automatic discards are off by default; exercise them here,
+		 * with short enough batches to cycle many times per run.
+		 */
+		zfs_trim = 1;
+		zfs_trim_txg_delay = 1 + ztest_random(8);
+
 		if (zs->zs_do_init)
 			ztest_run_init();
 		else
@@ -0,0 +1,23 @@
+dnl #
+dnl # 2.6.39 API change
+dnl # The blk_start_plug() and blk_finish_plug() functions were added so
+dnl # a task can hold back the bios it submits and hand them to the device
+dnl # driver as a single batch.
+dnl #
+AC_DEFUN([ZFS_AC_KERNEL_BLK_PLUG], [
+	AC_MSG_CHECKING([whether struct blk_plug is available])
+	ZFS_LINUX_TRY_COMPILE([
+		#include <linux/blkdev.h>
+	],[
+		struct blk_plug plug;
+
+		blk_start_plug(&plug);
+		blk_finish_plug(&plug);
+	],[
+		AC_MSG_RESULT(yes)
+		AC_DEFINE(HAVE_BLK_PLUG, 1,
+		          [struct blk_plug is available])
+	],[
+		AC_MSG_RESULT(no)
+	])
+])
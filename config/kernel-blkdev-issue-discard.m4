@@ -0,0 +1,22 @@
+dnl #
+dnl # 2.6.35 API change
+dnl # The blkdev_issue_discard() function gained a flags argument.  Only
+dnl # the five argument form is used to discard freed space on leaf vdevs.
+dnl #
+AC_DEFUN([ZFS_AC_KERNEL_BLKDEV_ISSUE_DISCARD], [
+	AC_MSG_CHECKING([whether blkdev_issue_discard() wants 5 args])
+	ZFS_LINUX_TRY_COMPILE([
+		#include <linux/blkdev.h>
+	],[
+		struct block_device *bdev = NULL;
+		int error;
+
+		error = blkdev_issue_discard(bdev, 0, 0, GFP_NOFS, 0);
+	],[
+		AC_MSG_RESULT(yes)
+		AC_DEFINE(HAVE_BLKDEV_ISSUE_DISCARD, 1,
+		          [blkdev_issue_discard() wants 5 args])
+	],[
+		AC_MSG_RESULT(no)
+	])
+])
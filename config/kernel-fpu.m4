@@ -0,0 +1,19 @@
+dnl #
+dnl # 4.2 API change
+dnl # The kernel_fpu_begin() and kernel_fpu_end() declarations moved from
+dnl # asm/i387.h to asm/fpu/api.h.
+dnl #
+AC_DEFUN([ZFS_AC_KERNEL_FPU], [
+	AC_MSG_CHECKING([whether asm/fpu/api.h exists])
+	ZFS_LINUX_TRY_COMPILE([
+		#include <asm/fpu/api.h>
+	],[
+		kernel_fpu_begin();
+		kernel_fpu_end();
+	],[
+		AC_MSG_RESULT(yes)
+		AC_DEFINE(HAVE_FPU_API_H, 1, [kernel has asm/fpu/api.h])
+	],[
+		AC_MSG_RESULT(no)
+	])
+])
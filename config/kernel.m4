@@ -32,6 +32,9 @@ AC_DEFUN([ZFS_AC_CONFIG_KERNEL], [
 	ZFS_AC_KERNEL_BLK_QUEUE_IO_OPT
 	ZFS_AC_KERNEL_BLK_QUEUE_NONROT
 	ZFS_AC_KERNEL_BLK_QUEUE_DISCARD
+	ZFS_AC_KERNEL_BLKDEV_ISSUE_DISCARD
+	ZFS_AC_KERNEL_BLK_PLUG
+	ZFS_AC_KERNEL_FPU
 	ZFS_AC_KERNEL_BLK_FETCH_REQUEST
 	ZFS_AC_KERNEL_BLK_REQUEUE_REQUEST
 	ZFS_AC_KERNEL_BLK_RQ_BYTES
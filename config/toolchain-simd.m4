@@ -0,0 +1,121 @@
+dnl #
+dnl # Checks if the assembler supports the x86 SIMD instructions used by
+dnl # the vectorized checksum, SHA-256 and RAID-Z code.  Each is only built when
+dnl # the toolchain can assemble it, and only used when the CPU has it.
+dnl #
+AC_DEFUN([ZFS_AC_CONFIG_ALWAYS_TOOLCHAIN_SIMD], [
+	ZFS_AC_CONFIG_TOOLCHAIN_CAN_BUILD_SSE2
+	ZFS_AC_CONFIG_TOOLCHAIN_CAN_BUILD_SSSE3
+	ZFS_AC_CONFIG_TOOLCHAIN_CAN_BUILD_AVX2
+	ZFS_AC_CONFIG_TOOLCHAIN_CAN_BUILD_AVX512F
+	ZFS_AC_CONFIG_TOOLCHAIN_CAN_BUILD_AVX512BW
+	ZFS_AC_CONFIG_TOOLCHAIN_CAN_BUILD_SHA_NI
+])
+
+AC_DEFUN([ZFS_AC_CONFIG_TOOLCHAIN_CAN_BUILD_SSE2], [
+	AC_MSG_CHECKING([whether host toolchain supports SSE2])
+
+	AC_LINK_IFELSE([AC_LANG_SOURCE([[
+		int main(void)
+		{
+			__asm__ __volatile__("pxor %xmm0, %xmm1");
+			return (0);
+		}
+	]])], [
+		AC_MSG_RESULT([yes])
+		AC_DEFINE([HAVE_SSE2], 1,
+		    [Define if host toolchain supports SSE2])
+	], [
+		AC_MSG_RESULT([no])
+	])
+])
+
+AC_DEFUN([ZFS_AC_CONFIG_TOOLCHAIN_CAN_BUILD_SSSE3], [
+	AC_MSG_CHECKING([whether host toolchain supports SSSE3])
+
+	AC_LINK_IFELSE([AC_LANG_SOURCE([[
+		int main(void)
+		{
+			__asm__ __volatile__("pshufb %xmm0, %xmm1");
+			return (0);
+		}
+	]])], [
+		AC_MSG_RESULT([yes])
+		AC_DEFINE([HAVE_SSSE3], 1,
+		    [Define if host toolchain supports SSSE3])
+	], [
+		AC_MSG_RESULT([no])
+	])
+])
+
+AC_DEFUN([ZFS_AC_CONFIG_TOOLCHAIN_CAN_BUILD_AVX2], [
+	AC_MSG_CHECKING([whether host toolchain supports AVX2])
+
+	AC_LINK_IFELSE([AC_LANG_SOURCE([[
+		int main(void)
+		{
+			__asm__ __volatile__("vpmovzxdq %xmm0, %ymm1");
+			return (0);
+		}
+	]])], [
+		AC_MSG_RESULT([yes])
+		AC_DEFINE([HAVE_AVX2], 1,
+		    [Define if host toolchain supports AVX2])
+	], [
+		AC_MSG_RESULT([no])
+	])
+])
+
+AC_DEFUN([ZFS_AC_CONFIG_TOOLCHAIN_CAN_BUILD_AVX512F], [
+	AC_MSG_CHECKING([whether host toolchain supports AVX512F])
+
+	AC_LINK_IFELSE([AC_LANG_SOURCE([[
+		int main(void)
+		{
+			__asm__ __volatile__("vpmovzxdq %ymm0, %zmm1");
+			return (0);
+		}
+	]])], [
+		AC_MSG_RESULT([yes])
+		AC_DEFINE([HAVE_AVX512F], 1,
+		    [Define if host toolchain supports AVX512F])
+	], [
+		AC_MSG_RESULT([no])
+	])
+])
+
+AC_DEFUN([ZFS_AC_CONFIG_TOOLCHAIN_CAN_BUILD_AVX512BW], [
+	AC_MSG_CHECKING([whether host toolchain supports AVX512BW])
+
+	AC_LINK_IFELSE([AC_LANG_SOURCE([[
+		int main(void)
+		{
+			__asm__ __volatile__("vpshufb %zmm0, %zmm1, %zmm2");
+			return (0);
+		}
+	]])], [
+		AC_MSG_RESULT([yes])
+		AC_DEFINE([HAVE_AVX512BW], 1,
+		    [Define if host toolchain supports AVX512BW])
+	], [
+		AC_MSG_RESULT([no])
+	])
+])
+
+AC_DEFUN([ZFS_AC_CONFIG_TOOLCHAIN_CAN_BUILD_SHA_NI], [
+	AC_MSG_CHECKING([whether host toolchain supports SHA-NI])
+
+	AC_LINK_IFELSE([AC_LANG_SOURCE([[
+		int main(void)
+		{
+			__asm__ __volatile__("sha256rnds2 %xmm0, %xmm1, %xmm2");
+			return (0);
+		}
+	]])], [
+		AC_MSG_RESULT([yes])
+		AC_DEFINE([HAVE_SHA_NI], 1,
+		    [Define if host toolchain supports SHA-NI])
+	], [
+		AC_MSG_RESULT([no])
+	])
+])
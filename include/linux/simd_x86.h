@@ -0,0 +1,242 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Helpers for code using x86 SIMD instructions.
+ *
+ * zfs_<ext>_available() reports whether both the CPU and the operating
+ * system support the extension.  Vector registers may only be touched
+ * between kfpu_begin() and kfpu_end(), which save and restore the user
+ * FPU state in the kernel and do nothing in user space.  Code between
+ * them must not sleep.
+ */
+
+#ifndef _SIMD_X86_H
+#define	_SIMD_X86_H
+
+#if defined(__x86_64) || defined(__x86_64__)
+
+#include <sys/types.h>
+
+#if defined(_KERNEL)
+#include <asm/cpufeature.h>
+#if defined(HAVE_FPU_API_H)
+#include <asm/fpu/api.h>
+#else
+#include <asm/i387.h>
+#endif
+
+#define	kfpu_begin()	kernel_fpu_begin()
+#define	kfpu_end()	kernel_fpu_end()
+
+static inline boolean_t
+zfs_sse2_available(void)
+{
+	return (!!boot_cpu_has(X86_FEATURE_XMM2));
+}
+
+static inline boolean_t
+zfs_ssse3_available(void)
+{
+	return (!!boot_cpu_has(X86_FEATURE_SSSE3));
+}
+
+static inline boolean_t
+zfs_sse4_1_available(void)
+{
+	return (!!boot_cpu_has(X86_FEATURE_XMM4_1));
+}
+
+static inline boolean_t
+zfs_shani_available(void)
+{
+#if defined(X86_FEATURE_SHA_NI)
+	return (!!boot_cpu_has(X86_FEATURE_SHA_NI));
+#else
+	return (B_FALSE);
+#endif
+}
+
+static inline boolean_t
+zfs_avx2_available(void)
+{
+#if defined(X86_FEATURE_AVX2)
+	return (!!boot_cpu_has(X86_FEATURE_AVX2));
+#else
+	return (B_FALSE);
+#endif
+}
+
+static inline boolean_t
+zfs_avx512f_available(void)
+{
+#if defined(X86_FEATURE_AVX512F)
+	return (!!boot_cpu_has(X86_FEATURE_AVX512F));
+#else
+	return (B_FALSE);
+#endif
+}
+
+static inline boolean_t
+zfs_avx512bw_available(void)
+{
+#if defined(X86_FEATURE_AVX512BW)
+	return (!!boot_cpu_has(X86_FEATURE_AVX512BW));
+#else
+	return (B_FALSE);
+#endif
+}
+
+#else /* _KERNEL */
+
+#define	kfpu_begin()	do {} while (0)
+#define	kfpu_end()	do {} while (0)
+
+#define	CPUID_1_EDX_SSE2	(1U << 26)
+#define	CPUID_1_ECX_SSSE3	(1U << 9)
+#define	CPUID_1_ECX_SSE4_1	(1U << 19)
+#define	CPUID_1_ECX_OSXSAVE	(1U << 27)
+#define	CPUID_1_ECX_AVX		(1U << 28)
+#define	CPUID_7_EBX_AVX2	(1U << 5)
+#define	CPUID_7_EBX_AVX512F	(1U << 16)
+#define	CPUID_7_EBX_SHA		(1U << 29)
+#define	CPUID_7_EBX_AVX512BW	(1U << 30)
+
+#define	XCR0_YMM		0x06ULL	/* SSE and AVX state */
+#define	XCR0_ZMM		0xe6ULL	/* plus opmask and upper ZMM state */
+
+static inline void
+__simd_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+	__asm__ __volatile__("cpuid"
+	    : "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+	    : "a" (leaf), "c" (subleaf));
+}
+
+static inline uint64_t
+__simd_xgetbv(void)
+{
+	uint32_t eax, edx;
+
+	/* xgetbv, spelled out for old assemblers */
+	__asm__ __volatile__(".byte 0x0f, 0x01, 0xd0"
+	    : "=a" (eax), "=d" (edx) : "c" (0));
+
+	return (((uint64_t)edx << 32) | eax);
+}
+
+static inline boolean_t
+__simd_os_state(uint64_t mask)
+{
+	uint32_t regs[4];
+
+	__simd_cpuid(1, 0, regs);
+	if ((regs[2] & (CPUID_1_ECX_OSXSAVE | CPUID_1_ECX_AVX)) !=
+	    (CPUID_1_ECX_OSXSAVE | CPUID_1_ECX_AVX))
+		return (B_FALSE);
+
+	return ((__simd_xgetbv() & mask) == mask);
+}
+
+static inline boolean_t
+zfs_sse2_available(void)
+{
+	uint32_t regs[4];
+
+	__simd_cpuid(1, 0, regs);
+	return (!!(regs[3] & CPUID_1_EDX_SSE2));
+}
+
+static inline boolean_t
+zfs_ssse3_available(void)
+{
+	uint32_t regs[4];
+
+	__simd_cpuid(1, 0, regs);
+	return (!!(regs[2] & CPUID_1_ECX_SSSE3));
+}
+
+static inline boolean_t
+zfs_sse4_1_available(void)
+{
+	uint32_t regs[4];
+
+	__simd_cpuid(1, 0, regs);
+	return (!!(regs[2] & CPUID_1_ECX_SSE4_1));
+}
+
+static inline boolean_t
+zfs_shani_available(void)
+{
+	uint32_t regs[4];
+
+	__simd_cpuid(0, 0, regs);
+	if (regs[0] < 7)
+		return (B_FALSE);
+
+	__simd_cpuid(7, 0, regs);
+	return (!!(regs[1] & CPUID_7_EBX_SHA));
+}
+
+static inline boolean_t
+zfs_avx2_available(void)
+{
+	uint32_t regs[4];
+
+	__simd_cpuid(0, 0, regs);
+	if (regs[0] < 7)
+		return (B_FALSE);
+
+	__simd_cpuid(7, 0, regs);
+	return ((regs[1] & CPUID_7_EBX_AVX2) && __simd_os_state(XCR0_YMM));
+}
+
+static inline boolean_t
+zfs_avx512f_available(void)
+{
+	uint32_t regs[4];
+
+	__simd_cpuid(0, 0, regs);
+	if (regs[0] < 7)
+		return (B_FALSE);
+
+	__simd_cpuid(7, 0, regs);
+	return ((regs[1] & CPUID_7_EBX_AVX512F) && __simd_os_state(XCR0_ZMM));
+}
+
+static inline boolean_t
+zfs_avx512bw_available(void)
+{
+	uint32_t regs[4];
+
+	__simd_cpuid(0, 0, regs);
+	if (regs[0] < 7)
+		return (B_FALSE);
+
+	__simd_cpuid(7, 0, regs);
+	return ((regs[1] & CPUID_7_EBX_AVX512BW) && __simd_os_state(XCR0_ZMM));
+}
+
+#endif /* _KERNEL */
+
+#endif /* __x86_64 */
+
+#endif /* _SIMD_X86_H */
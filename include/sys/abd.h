@@ -0,0 +1,199 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_ABD_H
+#define	_SYS_ABD_H
+
+#include <sys/zfs_context.h>
+#include <sys/refcount.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum abd_flags {
+	ABD_FLAG_LINEAR	= 1 << 0,	/* is buffer linear (or scattered)? */
+	ABD_FLAG_OWNER	= 1 << 1,	/* does it own its data buffers? */
+	ABD_FLAG_META	= 1 << 2,	/* does this represent FS metadata? */
+	ABD_FLAG_GANG	= 1 << 3	/* is this a chain of other ABDs? */
+} abd_flags_t;
+
+/*
+ * An ABD (ARC buffer data) describes a data buffer which is either a
+ * single linear allocation, or a scattered array of fixed size chunks.
+ * A scattered ABD avoids the need for large physically (or virtually)
+ * contiguous allocations, which fragment memory and, in the kernel,
+ * force the use of the slow and limited vmalloc address space.
+ *
+ * An ABD may also be a "view" of a subrange of another ABD, in which
+ * case it does not own the underlying data and holds a reference on
+ * its parent until it is released with abd_put().
+ *
+ * A gang ABD chains other (non-gang) ABDs end to end through their
+ * abd_gang_link, so that discontiguous buffers can be presented as a
+ * single ABD without copying.  The gang owns its children and releases
+ * them when it is freed.
+ */
+typedef struct abd {
+	abd_flags_t	abd_flags;
+	uint_t		abd_size;	/* excludes scattered abd_offset */
+	struct abd	*abd_parent;
+	refcount_t	abd_children;
+	list_node_t	abd_gang_link;	/* link in parent gang's chain */
+	union {
+		struct abd_scatter {
+			uint_t	abd_offset;
+			uint_t	abd_chunk_size;
+			void	*abd_chunks[1];	/* actually variable-length */
+		} abd_scatter;
+		struct abd_linear {
+			void	*abd_buf;
+		} abd_linear;
+		struct abd_gang {
+			list_t	abd_gang_chain;
+		} abd_gang;
+	} abd_u;
+} abd_t;
+
+typedef int abd_iter_func_t(void *buf, size_t len, void *private);
+typedef int abd_iter_func2_t(void *bufa, void *bufb, size_t len, void *private);
+
+extern int zfs_abd_scatter_enabled;
+
+static inline boolean_t
+abd_is_linear(abd_t *abd)
+{
+	return ((abd->abd_flags & ABD_FLAG_LINEAR) != 0 ? B_TRUE : B_FALSE);
+}
+
+static inline boolean_t
+abd_is_gang(abd_t *abd)
+{
+	return ((abd->abd_flags & ABD_FLAG_GANG) != 0 ? B_TRUE : B_FALSE);
+}
+
+/*
+ * Allocations and deallocations
+ */
+
+abd_t *abd_alloc(size_t size, boolean_t is_metadata);
+abd_t *abd_alloc_linear(size_t size, boolean_t is_metadata);
+abd_t *abd_alloc_for_io(size_t size, boolean_t is_metadata);
+abd_t *abd_alloc_sametype(abd_t *sabd, size_t size);
+abd_t *abd_alloc_gang(void);
+void abd_free(abd_t *abd);
+abd_t *abd_get_offset(abd_t *sabd, size_t off);
+abd_t *abd_get_offset_size(abd_t *sabd, size_t off, size_t size);
+abd_t *abd_get_from_buf(void *buf, size_t size);
+abd_t *abd_get_zeros(size_t size);
+void abd_put(abd_t *abd);
+
+/*
+ * Gang ABDs
+ */
+
+void abd_gang_add(abd_t *pabd, abd_t *cabd);
+abd_t *abd_gang_get_offset(abd_t *abd, size_t *off);
+abd_t *abd_gang_next(abd_t *abd, abd_t *cabd);
+
+/*
+ * Conversion to and from a normal buffer
+ */
+
+void *abd_to_buf(abd_t *abd);
+void *abd_borrow_buf(abd_t *abd, size_t n);
+void *abd_borrow_buf_copy(abd_t *abd, size_t n);
+void abd_return_buf(abd_t *abd, void *buf, size_t n);
+void abd_return_buf_copy(abd_t *abd, void *buf, size_t n);
+void abd_take_ownership_of_buf(abd_t *abd, boolean_t is_metadata);
+void abd_release_ownership_of_buf(abd_t *abd);
+
+/*
+ * ABD operations
+ */
+
+int abd_iterate_func(abd_t *abd, size_t off, size_t size,
+    abd_iter_func_t *func, void *private);
+int abd_iterate_func2(abd_t *dabd, abd_t *sabd, size_t doff, size_t soff,
+    size_t size, abd_iter_func2_t *func, void *private);
+void abd_copy_off(abd_t *dabd, abd_t *sabd, size_t doff, size_t soff,
+    size_t size);
+void abd_copy_from_buf_off(abd_t *abd, const void *buf, size_t off,
+    size_t size);
+void abd_copy_to_buf_off(void *buf, abd_t *abd, size_t off, size_t size);
+int abd_cmp(abd_t *dabd, abd_t *sabd, size_t size);
+int abd_cmp_buf_off(abd_t *abd, const void *buf, size_t off, size_t size);
+void abd_zero_off(abd_t *abd, size_t off, size_t size);
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+struct bio;
+
+unsigned int abd_nr_pages_off(abd_t *abd, unsigned int size, size_t off);
+unsigned int abd_scatter_bio_map_off(struct bio *bio, abd_t *abd,
+    unsigned int io_size, size_t off);
+#endif
+
+/*
+ * Wrappers for calls with offsets of 0
+ */
+
+static inline void
+abd_copy(abd_t *dabd, abd_t *sabd, size_t size)
+{
+	abd_copy_off(dabd, sabd, 0, 0, size);
+}
+
+static inline void
+abd_copy_from_buf(abd_t *abd, const void *buf, size_t size)
+{
+	abd_copy_from_buf_off(abd, buf, 0, size);
+}
+
+static inline void
+abd_copy_to_buf(void *buf, abd_t *abd, size_t size)
+{
+	abd_copy_to_buf_off(buf, abd, 0, size);
+}
+
+static inline int
+abd_cmp_buf(abd_t *abd, const void *buf, size_t size)
+{
+	return (abd_cmp_buf_off(abd, buf, 0, size));
+}
+
+static inline void
+abd_zero(abd_t *abd, size_t size)
+{
+	abd_zero_off(abd, 0, size);
+}
+
+/*
+ * Module lifecycle
+ */
+
+void abd_init(void);
+void abd_fini(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* _SYS_ABD_H */
@@ -41,6 +41,7 @@ extern "C" {
 typedef struct arc_buf_hdr arc_buf_hdr_t;
 typedef struct arc_buf arc_buf_t;
 typedef struct arc_prune arc_prune_t;
+typedef struct arc_os_stats arc_os_stats_t;
 typedef void arc_done_func_t(zio_t *zio, arc_buf_t *buf, void *private);
 typedef void arc_prune_func_t(int64_t bytes, void *private);
 typedef int arc_evict_func_t(void *private);
@@ -81,6 +82,35 @@ typedef enum arc_buf_contents {
 #define	ARC_L2CACHE	(1 << 5)	/* cache in L2ARC */
 #define	ARC_L2COMPRESS	(1 << 6)	/* compress in L2ARC */
 
+/*
+ * Records of the ARC access trace, exported as the raw kstat zfs/arc_trace
+ * when zfs_arc_trace_entries is set.  The layout is shared with arcsim.py.
+ */
+typedef enum arc_trace_type {
+	ARC_TRACE_HIT,			/* block was cached */
+	ARC_TRACE_IOWAIT,		/* block was being read */
+	ARC_TRACE_MISS,			/* block was not cached */
+	ARC_TRACE_MRU_GHOST,		/* block was in the MRU ghost list */
+	ARC_TRACE_MFU_GHOST,		/* block was in the MFU ghost list */
+	ARC_TRACE_L2_ONLY		/* block was only in the L2ARC */
+} arc_trace_type_t;
+
+#define	ARC_TRACE_PREFETCH	(1 << 0)	/* read is a prefetch */
+#define	ARC_TRACE_METADATA	(1 << 1)	/* block is metadata */
+#define	ARC_TRACE_L2CACHE	(1 << 2)	/* block may be cached in L2ARC */
+#define	ARC_TRACE_L2HDR		(1 << 3)	/* block is cached in L2ARC */
+
+typedef struct arc_trace_rec {
+	uint64_t	atr_seq;	/* sequence number, 0 if unused */
+	uint64_t	atr_spa;	/* load guid of the pool */
+	dva_t		atr_dva;
+	uint64_t	atr_birth;
+	uint32_t	atr_size;	/* logical size */
+	uint8_t		atr_type;	/* arc_trace_type_t */
+	uint8_t		atr_flags;
+	uint16_t	atr_pad;
+} arc_trace_rec_t;
+
 /*
  * The following breakdows of arc_size exist for kstat only.
  */
@@ -113,17 +143,21 @@ int arc_referenced(arc_buf_t *buf);
 #endif
 
 int arc_read(zio_t *pio, spa_t *spa, const blkptr_t *bp,
-    arc_done_func_t *done, void *private, int priority, int flags,
+    arc_done_func_t *done, void *private, zio_priority_t priority, int flags,
     uint32_t *arc_flags, const zbookmark_t *zb);
 zio_t *arc_write(zio_t *pio, spa_t *spa, uint64_t txg,
     blkptr_t *bp, arc_buf_t *buf, boolean_t l2arc, boolean_t l2arc_compress,
     const zio_prop_t *zp, arc_done_func_t *ready, arc_done_func_t *done,
-    void *private, int priority, int zio_flags, const zbookmark_t *zb);
+    void *private, zio_priority_t priority, int zio_flags,
+    const zbookmark_t *zb);
 
 arc_prune_t *arc_add_prune_callback(arc_prune_func_t *func, void *private);
 void arc_remove_prune_callback(arc_prune_t *p);
 void arc_freed(spa_t *spa, const blkptr_t *bp);
 
+arc_os_stats_t *arc_os_stats_register(spa_t *spa, uint64_t objset);
+void arc_os_stats_unregister(arc_os_stats_t *aos);
+
 void arc_set_callback(arc_buf_t *buf, arc_evict_func_t *func, void *private);
 int arc_buf_evict(arc_buf_t *buf);
 
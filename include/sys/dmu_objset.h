@@ -83,6 +83,7 @@ struct objset {
 	dnode_handle_t os_userused_dnode;
 	dnode_handle_t os_groupused_dnode;
 	zilog_t *os_zil;
+	arc_os_stats_t *os_arc_stats;
 
 	/* can change, under dsl_dir's locks: */
 	uint8_t os_checksum;
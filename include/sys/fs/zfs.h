@@ -502,6 +502,7 @@ typedef struct zpool_rewind_policy {
 #define	ZPOOL_CONFIG_DTL		"DTL"
 #define	ZPOOL_CONFIG_SCAN_STATS		"scan_stats"	/* not stored on disk */
 #define	ZPOOL_CONFIG_VDEV_STATS		"vdev_stats"	/* not stored on disk */
+#define	ZPOOL_CONFIG_VDEV_STATS_EX	"vdev_stats_ex"	/* not stored on disk */
 #define	ZPOOL_CONFIG_WHOLE_DISK		"whole_disk"
 #define	ZPOOL_CONFIG_ERRCOUNT		"error_count"
 #define	ZPOOL_CONFIG_NOT_PRESENT	"not_present"
@@ -666,6 +667,22 @@ typedef enum zio_type {
 	ZIO_TYPES
 } zio_type_t;
 
+/*
+ * I/O priorities.  Each queueable priority is a separate class with its
+ * own queue in the vdev I/O scheduler; see vdev_queue.c.  Also needed to
+ * interpret the extended vdev statistics below.
+ */
+typedef enum zio_priority {
+	ZIO_PRIORITY_SYNC_READ,
+	ZIO_PRIORITY_SYNC_WRITE,	/* ZIL */
+	ZIO_PRIORITY_ASYNC_READ,	/* prefetch */
+	ZIO_PRIORITY_ASYNC_WRITE,	/* spa_sync() */
+	ZIO_PRIORITY_SCRUB,		/* asynchronous scrub/resilver reads */
+	ZIO_PRIORITY_NUM_QUEUEABLE,
+
+	ZIO_PRIORITY_NOW		/* non-queued i/os (e.g. free) */
+} zio_priority_t;
+
 /*
  * Pool statistics.  Note: all fields should be 64-bit because this
  * is passed between kernel and userland as an nvlist uint64 array.
@@ -719,6 +736,31 @@ typedef struct vdev_stat {
 	uint64_t	vs_scan_processed;	/* scan processed bytes	*/
 } vdev_stat_t;
 
+/*
+ * Extended vdev statistics: log2 histograms kept by the I/O scheduler of
+ * each leaf vdev, one row per I/O class.  Bucket b counts values in
+ * [2^b, 2^(b+1)); the last bucket also counts everything larger.  For
+ * interior vdevs these are the sums over their leaves.  Like vdev_stat_t
+ * this is passed to userland as an nvlist uint64 array.
+ */
+#define	VDEV_L_HISTO_BUCKETS	37	/* latency in ns, up to ~68s */
+#define	VDEV_RQ_HISTO_BUCKETS	18	/* request size, up to 128K */
+
+typedef struct vdev_stat_ex {
+	/* time spent waiting in the vdev queue */
+	uint64_t vsx_queue_histo[ZIO_PRIORITY_NUM_QUEUEABLE]
+	    [VDEV_L_HISTO_BUCKETS];
+	/* time from issue to completion by the device */
+	uint64_t vsx_disk_histo[ZIO_PRIORITY_NUM_QUEUEABLE]
+	    [VDEV_L_HISTO_BUCKETS];
+	/* size of each i/o as queued, before aggregation */
+	uint64_t vsx_ind_histo[ZIO_PRIORITY_NUM_QUEUEABLE]
+	    [VDEV_RQ_HISTO_BUCKETS];
+	/* size of each i/o as issued, after aggregation */
+	uint64_t vsx_agg_histo[ZIO_PRIORITY_NUM_QUEUEABLE]
+	    [VDEV_RQ_HISTO_BUCKETS];
+} vdev_stat_ex_t;
+
 /*
  * DDT statistics.  Note: all fields should be 64-bit because this
  * is passed between kernel and userland as an nvlist uint64 array.
@@ -837,6 +879,7 @@ typedef enum zfs_ioc {
 	ZFS_IOC_SEND_NEW,
 	ZFS_IOC_SEND_SPACE,
 	ZFS_IOC_CLONE,
+	ZFS_IOC_POOL_TRIM,
 	ZFS_IOC_LAST
 } zfs_ioc_t;
 
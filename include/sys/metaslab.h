@@ -44,6 +44,8 @@ extern void metaslab_fini(metaslab_t *msp);
 extern void metaslab_sync(metaslab_t *msp, uint64_t txg);
 extern void metaslab_sync_done(metaslab_t *msp, uint64_t txg);
 extern void metaslab_sync_reassess(metaslab_group_t *mg);
+extern void metaslab_trim_all(metaslab_t *msp, uint64_t rate,
+    boolean_t *stop);
 
 #define	METASLAB_HINTBP_FAVOR	0x0
 #define	METASLAB_HINTBP_AVOID	0x1
@@ -51,6 +53,7 @@ extern void metaslab_sync_reassess(metaslab_group_t *mg);
 #define	METASLAB_GANG_CHILD	0x4
 #define	METASLAB_GANG_AVOID	0x8
 #define	METASLAB_FASTWRITE	0x10
+#define	METASLAB_ASYNC_ALLOC	0x20
 
 extern int metaslab_alloc(spa_t *spa, metaslab_class_t *mc, uint64_t psize,
     blkptr_t *bp, int ncopies, uint64_t txg, blkptr_t *hintbp, int flags);
@@ -60,6 +63,7 @@ extern int metaslab_claim(spa_t *spa, const blkptr_t *bp, uint64_t txg);
 extern void metaslab_check_free(spa_t *spa, const blkptr_t *bp);
 extern void metaslab_fastwrite_mark(spa_t *spa, const blkptr_t *bp);
 extern void metaslab_fastwrite_unmark(spa_t *spa, const blkptr_t *bp);
+extern void metaslab_alloc_throttle_done(spa_t *spa, const blkptr_t *bp);
 
 extern metaslab_class_t *metaslab_class_create(spa_t *spa,
     space_map_ops_t *ops);
@@ -52,6 +52,17 @@ struct metaslab_class {
 	kmutex_t		mc_fastwrite_lock;
 };
 
+/*
+ * Per top-level vdev allocation throttle statistics, exported as the
+ * named kstat zfs:0:vdev_alloc-<guid>.
+ */
+typedef struct metaslab_group_stats {
+	kstat_named_t		mgs_queue_depth;
+	kstat_named_t		mgs_max_queue_depth;
+	kstat_named_t		mgs_allocs;
+	kstat_named_t		mgs_throttled;
+} metaslab_group_stats_t;
+
 struct metaslab_group {
 	kmutex_t		mg_lock;
 	avl_tree_t		mg_metaslab_tree;
@@ -64,8 +75,28 @@ struct metaslab_group {
 	vdev_t			*mg_vd;
 	metaslab_group_t	*mg_prev;
 	metaslab_group_t	*mg_next;
+
+	/*
+	 * Asynchronous write allocations made from this group whose
+	 * writes have not yet completed (see metaslab_group_throttled()).
+	 */
+	uint64_t		mg_alloc_queue_depth;
+	uint64_t		mg_alloc_total;
+	uint64_t		mg_alloc_throttled;
+	kstat_t			*mg_ksp;
+	metaslab_group_stats_t	mg_stats;
 };
 
+/*
+ * With zfs_trim set, freed space leaving the defer maps waits in the
+ * metaslab's trim maps before it is discarded and allocatable again (see
+ * metaslab_trim_sync_done()).
+ */
+#define	MS_TRIM_NEW	0	/* left the defer maps since the last batch */
+#define	MS_TRIM_AGED	1	/* to be discarded by the next batch */
+#define	MS_TRIM_ISSUED	2	/* being discarded by the last batch */
+#define	MS_TRIM_STAGES	3
+
 /*
  * Each metaslab maintains an in-core free map (ms_map) that contains the
  * current list of free segments. As blocks are allocated, the allocated
@@ -98,8 +129,11 @@ struct metaslab {
 	space_map_t	*ms_allocmap[TXG_SIZE];	/* allocated this txg	*/
 	space_map_t	*ms_freemap[TXG_SIZE];	/* freed this txg	*/
 	space_map_t	*ms_defermap[TXG_DEFER_SIZE];	/* deferred frees */
+	space_map_t	*ms_trimmap[MS_TRIM_STAGES]; /* waiting for discard */
 	space_map_t	*ms_map;	/* in-core free space map	*/
 	int64_t		ms_deferspace;	/* sum of ms_defermap[] space	*/
+	int64_t		ms_trimspace;	/* sum of ms_trimmap[] space	*/
+	boolean_t	ms_trimming;	/* free space out for zpool trim */
 	uint64_t	ms_weight;	/* weight vs. others in group	*/
 	metaslab_group_t *ms_group;	/* metaslab group		*/
 	avl_node_t	ms_group_node;	/* node in metaslab group tree	*/
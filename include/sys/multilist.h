@@ -0,0 +1,99 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_SYS_MULTILIST_H
+#define	_SYS_MULTILIST_H
+
+#include <sys/zfs_context.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+typedef list_node_t multilist_node_t;
+typedef struct multilist multilist_t;
+typedef struct multilist_sublist multilist_sublist_t;
+typedef unsigned int multilist_sublist_index_func_t(multilist_t *, void *);
+
+#define	MULTILIST_ALIGN	64
+#define	MULTILIST_PAD	\
+	(P2NPHASE(sizeof (kmutex_t) + sizeof (list_t), (MULTILIST_ALIGN)))
+
+/*
+ * Each sublist is padded out to a cache line so that sublists which are
+ * locked by different CPUs do not share (and bounce) the same line.
+ */
+struct multilist_sublist {
+	kmutex_t	mls_lock;
+	list_t		mls_list;
+#ifdef _KERNEL
+	unsigned char	mls_pad[MULTILIST_PAD];
+#endif
+};
+
+/*
+ * A multilist is a list which has been split into a number of
+ * independently locked sublists.  An object is always placed on the
+ * sublist selected by ml_index_func, which must return the same index
+ * for a given object for as long as it remains on the multilist.  This
+ * allows concurrent inserts and removes of different objects to proceed
+ * without serializing on a single lock.  The price is that there is no
+ * total ordering across the whole multilist, only within each sublist.
+ */
+struct multilist {
+	size_t				ml_offset;
+	uint64_t			ml_num_sublists;
+	multilist_sublist_t		*ml_sublists;
+	multilist_sublist_index_func_t	*ml_index_func;
+};
+
+void multilist_create(multilist_t *, size_t, size_t, unsigned int,
+    multilist_sublist_index_func_t *);
+void multilist_destroy(multilist_t *);
+
+void multilist_insert(multilist_t *, void *);
+void multilist_remove(multilist_t *, void *);
+int  multilist_is_empty(multilist_t *);
+
+unsigned int multilist_get_num_sublists(multilist_t *);
+unsigned int multilist_get_random_index(multilist_t *);
+
+multilist_sublist_t *multilist_sublist_lock(multilist_t *, unsigned int);
+void multilist_sublist_unlock(multilist_sublist_t *);
+
+void multilist_sublist_insert_head(multilist_sublist_t *, void *);
+void multilist_sublist_insert_tail(multilist_sublist_t *, void *);
+void multilist_sublist_insert_after(multilist_sublist_t *, void *, void *);
+void multilist_sublist_remove(multilist_sublist_t *, void *);
+
+void *multilist_sublist_head(multilist_sublist_t *);
+void *multilist_sublist_tail(multilist_sublist_t *);
+void *multilist_sublist_next(multilist_sublist_t *, void *);
+void *multilist_sublist_prev(multilist_sublist_t *, void *);
+
+void multilist_link_init(multilist_node_t *);
+int  multilist_link_active(multilist_node_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* _SYS_MULTILIST_H */
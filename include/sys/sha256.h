@@ -0,0 +1,76 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_SHA256_H
+#define	_SYS_SHA256_H
+
+#include <sys/types.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define	SHA256_BLOCK_SIZE	64
+
+/*
+ * A SHA-256 compression function.  transform() folds nblocks consecutive
+ * 64 byte blocks of buf into the eight word state H.
+ */
+typedef struct sha256_ops {
+	void (*transform)(uint32_t *H, const void *buf, uint64_t nblocks);
+	boolean_t (*valid)(void);
+	const char *name;
+} sha256_ops_t;
+
+/*
+ * A multi-buffer compression function hashing SHA256_MB_LANES independent
+ * messages side by side.  transform() folds nblocks blocks from each of
+ * data[0] .. data[SHA256_MB_LANES - 1] into the state H, which holds word
+ * w of lane l in H[w * SHA256_MB_LANES + l].
+ */
+#define	SHA256_MB_LANES		8
+
+typedef struct sha256_mb_ops {
+	void (*transform)(uint32_t *H, const uint8_t **data, uint64_t nblocks);
+	boolean_t (*valid)(void);
+	const char *name;
+} sha256_mb_ops_t;
+
+extern const uint32_t SHA256_K[64];
+
+#if defined(__x86_64) && defined(HAVE_SHA_NI)
+extern const sha256_ops_t sha256_shani_ops;
+#endif
+#if defined(__x86_64) && defined(HAVE_AVX2)
+extern const sha256_mb_ops_t sha256_avx2_mb_ops;
+#endif
+
+extern void sha256_init(void);
+extern void sha256_fini(void);
+extern int sha256_impl_set(const char *);
+extern int sha256_mb_impl_set(const char *);
+extern int sha256_mb_width(void);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_SHA256_H */
@@ -0,0 +1,53 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_SHA512_H
+#define	_SYS_SHA512_H
+
+#include <sys/types.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define	SHA512_BLOCK_SIZE	128
+#define	SHA512_256_DIGEST_SIZE	32
+
+/*
+ * Incremental SHA-512/256 state.  sc_count is the number of message bytes
+ * seen so far, of which the last sc_count % SHA512_BLOCK_SIZE are still
+ * waiting in sc_buf.
+ */
+typedef struct sha512_ctx {
+	uint64_t	sc_H[8];
+	uint64_t	sc_count;
+	uint8_t		sc_buf[SHA512_BLOCK_SIZE];
+} sha512_ctx_t;
+
+extern void sha512_256_init(sha512_ctx_t *);
+extern void sha512_update(sha512_ctx_t *, const void *, size_t);
+extern void sha512_256_final(sha512_ctx_t *, void *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_SHA512_H */
@@ -0,0 +1,55 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_SKEIN_H
+#define	_SYS_SKEIN_H
+
+#include <sys/types.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define	SKEIN_512_BLOCK_SIZE	64
+#define	SKEIN_512_256_DIGEST_SIZE	32
+
+/*
+ * Incremental Skein-512 state: the chaining value, the tweak of the next
+ * block and up to one block of buffered message bytes.  The last block of
+ * each stage has to be flagged as final, so a full block stays buffered
+ * until more of the message arrives.
+ */
+typedef struct skein_ctx {
+	uint64_t	sc_X[8];
+	uint64_t	sc_T[2];
+	uint8_t		sc_buf[SKEIN_512_BLOCK_SIZE];
+	size_t		sc_bcnt;
+} skein_ctx_t;
+
+extern void skein_512_256_init(skein_ctx_t *, const void *, size_t);
+extern void skein_512_update(skein_ctx_t *, const void *, size_t);
+extern void skein_512_256_final(skein_ctx_t *, void *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_SKEIN_H */
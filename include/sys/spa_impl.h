@@ -109,9 +109,23 @@ typedef enum spa_proc_state {
 
 typedef struct spa_taskqs {
 	uint_t stqs_count;
+	uint_t stqs_cpus;	/* CPUs sharing each taskq, 0 if not per-CPU */
 	taskq_t **stqs_taskq;
 } spa_taskqs_t;
 
+/*
+ * Discards issued to leaf vdevs, exported as the trim-<pool> kstat.  Auto
+ * discards cover space as it is freed, manual ones come from "zpool trim".
+ */
+typedef struct spa_trim_stats {
+	kstat_named_t	sts_auto_extents;
+	kstat_named_t	sts_auto_bytes;
+	kstat_named_t	sts_manual_extents;
+	kstat_named_t	sts_manual_bytes;
+	kstat_named_t	sts_failed_extents;
+	kstat_named_t	sts_failed_bytes;
+} spa_trim_stats_t;
+
 struct spa {
 	/*
 	 * Fields protected by spa_namespace_lock.
@@ -218,6 +232,9 @@ struct spa {
 	uint64_t	spa_ddt_stat_object;	/* DDT statistics */
 	uint64_t	spa_dedup_ditto;	/* dedup ditto threshold */
 	uint64_t	spa_dedup_checksum;	/* default dedup checksum */
+	zio_cksum_salt_t spa_cksum_salt;	/* salt for salted checksums */
+	kmutex_t	spa_cksum_tmpls_lock;	/* protects spa_cksum_tmpls */
+	void		*spa_cksum_tmpls[ZIO_CHECKSUM_FUNCTIONS];
 	uint64_t	spa_dspace;		/* dspace in normal class */
 	kmutex_t	spa_vdev_top_lock;	/* dueling offline/remove */
 	kmutex_t	spa_proc_lock;		/* protects spa_proc* */
@@ -236,6 +253,23 @@ struct spa {
 	uint64_t	spa_deadman_calls;	/* number of deadman calls */
 	uint64_t	spa_sync_starttime;	/* starting time fo spa_sync */
 	uint64_t	spa_deadman_synctime;	/* deadman expiration timer */
+	zio_t		*spa_trim_zio;		/* batch of auto discards */
+	kmutex_t	spa_trim_lock;		/* protects spa_trim_* below */
+	kcondvar_t	spa_trim_cv;		/* batch done, thread exited */
+	boolean_t	spa_trim_batch;		/* discards in flight */
+	boolean_t	spa_trim_release;	/* last batch is done */
+	boolean_t	spa_trim_drain;		/* unloading, hold nothing */
+	kthread_t	*spa_trim_thread;	/* "zpool trim" thread */
+	metaslab_t	*spa_trim_ms;		/* metaslab it is trimming */
+	boolean_t	spa_trim_stop;		/* stop the trim thread */
+	uint64_t	spa_trim_rate;		/* bytes/sec, 0 is unlimited */
+	spa_trim_stats_t spa_trim_stats;	/* discard counters */
+	kstat_t		*spa_trim_ksp;		/* spa_trim_stats kstat */
+	uint64_t	spa_write_issue_queued;	/* write issue tasks waiting */
+	kmutex_t	spa_cksum_batch_lock;	/* protects spa_cksum_batch */
+	int		spa_cksum_batch_count;	/* writes waiting for SHA-256 */
+	uint64_t	spa_cksum_batch_wait;	/* issue tasks left to wait */
+	zio_t		*spa_cksum_batch[ZIO_CHECKSUM_BATCH_MAX];
 	/*
 	 * spa_refcnt & spa_config_lock must be the last elements
 	 * because refcount_t changes size based on compilation options.
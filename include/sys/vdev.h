@@ -82,6 +82,7 @@ extern void vdev_deadman(vdev_t *vd);
 
 
 extern void vdev_get_stats(vdev_t *vd, vdev_stat_t *vs);
+extern void vdev_get_stats_ex(vdev_t *vd, vdev_stat_ex_t *vsx);
 extern void vdev_clear_stats(vdev_t *vd);
 extern void vdev_stat_update(zio_t *zio, uint64_t psize);
 extern void vdev_scan_stat_init(vdev_t *vd);
@@ -117,6 +118,9 @@ extern void vdev_queue_init(vdev_t *vd);
 extern void vdev_queue_fini(vdev_t *vd);
 extern zio_t *vdev_queue_io(zio_t *zio);
 extern void vdev_queue_io_done(zio_t *zio);
+extern int vdev_queue_length(vdev_t *vd);
+extern uint64_t vdev_queue_next_offset(vdev_t *vd);
+extern void vdev_queue_add_stats_ex(vdev_t *vd, vdev_stat_ex_t *vsx);
 
 extern void vdev_config_dirty(vdev_t *vd);
 extern void vdev_config_clean(vdev_t *vd);
@@ -40,6 +40,8 @@ typedef struct vdev_disk {
 extern int vdev_disk_physio(struct block_device *, caddr_t,
 			    size_t, uint64_t, int);
 extern int vdev_disk_read_rootlabel(char *, char *, nvlist_t **);
+extern void vdev_disk_init(void);
+extern void vdev_disk_fini(void);
 
 #endif /* _KERNEL */
 #endif /* _SYS_VDEV_DISK_H */
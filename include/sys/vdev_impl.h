@@ -34,11 +34,20 @@
 #include <sys/vdev.h>
 #include <sys/dkio.h>
 #include <sys/uberblock_impl.h>
+#include <sys/abd.h>
 
 #ifdef	__cplusplus
 extern "C" {
 #endif
 
+/*
+ * Discard a range of a leaf vdev.  Like DKIOCFLUSHWRITECACHE this is issued
+ * as a ZIO_TYPE_IOCTL zio; the range is carried in io_offset and io_size.
+ */
+#ifndef DKIOCFREE
+#define	DKIOCFREE	(DKIOC|50)
+#endif
+
 /*
  * Virtual device descriptors.
  *
@@ -50,7 +59,6 @@ extern "C" {
  * Forward declarations that lots of things need.
  */
 typedef struct vdev_queue vdev_queue_t;
-typedef struct vdev_io vdev_io_t;
 typedef struct vdev_cache vdev_cache_t;
 typedef struct vdev_cache_entry vdev_cache_entry_t;
 
@@ -84,7 +92,7 @@ typedef const struct vdev_ops {
  * Virtual device properties
  */
 struct vdev_cache_entry {
-	char		*ve_data;
+	abd_t		*ve_abd;
 	uint64_t	ve_offset;
 	uint64_t	ve_lastused;
 	avl_node_t	ve_offset_node;
@@ -100,22 +108,24 @@ struct vdev_cache {
 	kmutex_t	vc_lock;
 };
 
+typedef struct vdev_queue_class {
+	uint32_t	vqc_active;	/* issued and not yet done */
+	avl_tree_t	vqc_queued_tree; /* waiting, sorted by offset */
+} vdev_queue_class_t;
+
 struct vdev_queue {
-	avl_tree_t	vq_deadline_tree;
-	avl_tree_t	vq_read_tree;
-	avl_tree_t	vq_write_tree;
-	avl_tree_t	vq_pending_tree;
-	hrtime_t	vq_io_complete_ts;
+	vdev_t		*vq_vdev;
+	vdev_queue_class_t vq_class[ZIO_PRIORITY_NUM_QUEUEABLE];
+	avl_tree_t	vq_active_tree;	/* all issued i/os, by offset */
+	uint64_t	vq_last_offset;	/* offset of the last issued i/o */
+	uint64_t	vq_next_offset;	/* offset following the last i/o */
+	hrtime_t	vq_io_complete_ts; /* time last i/o completed */
 	hrtime_t	vq_io_delta_ts;
-	list_t		vq_io_list;
+	vdev_stat_ex_t	vq_stat_ex;	/* latency and size histograms */
+	kstat_t		*vq_ksp;	/* vq_stat_ex as a named kstat */
 	kmutex_t	vq_lock;
 };
 
-struct vdev_io {
-	char		vi_buffer[SPA_MAXBLOCKSIZE]; /* Must be first */
-	list_node_t	vi_node;
-};
-
 /*
  * Virtual device descriptor
  */
@@ -148,6 +158,7 @@ struct vdev {
 	boolean_t	vdev_reopening;	/* reopen in progress?		*/
 	int		vdev_open_error; /* error on last open		*/
 	kthread_t	*vdev_open_thread; /* thread opening children	*/
+	boolean_t	vdev_nonrot;	/* true if solid state		*/
 	uint64_t	vdev_crtxg;	/* txg when top-level was added */
 
 	/*
@@ -192,6 +203,7 @@ struct vdev {
 	uint64_t	vdev_unspare;	/* unspare when resilvering done */
 	hrtime_t	vdev_last_try;	/* last reopen time		*/
 	boolean_t	vdev_nowritecache; /* true if flushwritecache failed */
+	boolean_t	vdev_notrim;	/* true if trim failed		*/
 	boolean_t	vdev_checkremove; /* temporary online test	*/
 	boolean_t	vdev_forcefault; /* force online fault		*/
 	boolean_t	vdev_splitting;	/* split or repair in progress  */
@@ -325,6 +337,12 @@ extern uint64_t vdev_default_asize(vdev_t *vd, uint64_t psize);
 extern uint64_t vdev_get_min_asize(vdev_t *vd);
 extern void vdev_set_min_asize(vdev_t *vd);
 
+/*
+ * RAID-Z geometry
+ */
+extern void vdev_raidz_child_range(vdev_t *vd, uint64_t c,
+    uint64_t *start, uint64_t *end);
+
 /*
  * zdb uses this tunable, so it must be declared here to make lint happy.
  */
@@ -0,0 +1,121 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_VDEV_RAIDZ_H
+#define	_SYS_VDEV_RAIDZ_H
+
+#include <sys/types.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define	VDEV_RAIDZ_MUL_2(x)	(((x) << 1) ^ (((x) & 0x80) ? 0x1d : 0))
+#define	VDEV_RAIDZ_MUL_4(x)	(VDEV_RAIDZ_MUL_2(VDEV_RAIDZ_MUL_2(x)))
+
+/*
+ * We provide a mechanism to perform the field multiplication operation on a
+ * 64-bit value all at once rather than a byte at a time. This works by
+ * creating a mask from the top bit in each byte and using that to
+ * conditionally apply the XOR of 0x1d.
+ */
+#define	VDEV_RAIDZ_64MUL_2(x, mask) \
+{ \
+	(mask) = (x) & 0x8080808080808080ULL; \
+	(mask) = ((mask) << 1) - ((mask) >> 7); \
+	(x) = (((x) << 1) & 0xfefefefefefefefeULL) ^ \
+	    ((mask) & 0x1d1d1d1d1d1d1d1dULL); \
+}
+
+#define	VDEV_RAIDZ_64MUL_4(x, mask) \
+{ \
+	VDEV_RAIDZ_64MUL_2((x), mask); \
+	VDEV_RAIDZ_64MUL_2((x), mask); \
+}
+
+/*
+ * RAID-Z math implementations.  Every operation works on whole buffers
+ * of size bytes; the SIMD versions require size to be a non-zero
+ * multiple of blocksize and the vdev_raidz_*() wrappers below hand any
+ * remainder to the scalar code.  Field multiplication by a constant c
+ * uses vdev_raidz_mul_lt[c]: the products of c with the low nibbles
+ * 0..15 followed by the products with the high nibbles 0x00..0xf0.
+ */
+typedef struct raidz_math_ops {
+	/* dst ^= src */
+	void (*xor_buf)(void *dst, const void *src, size_t size);
+	/* dst = 2 * dst + src */
+	void (*mul2_xor)(void *dst, const void *src, size_t size);
+	/* p ^= src, q = 2 * q + src */
+	void (*gen_pq)(void *p, void *q, const void *src, size_t size);
+	/* p ^= src, q = 2 * q + src, r = 4 * r + src */
+	void (*gen_pqr)(void *p, void *q, void *r, const void *src,
+	    size_t size);
+	/* dst = c * src */
+	void (*mul)(void *dst, const void *src, uint8_t c, size_t size);
+	/* dst = dst + c * src */
+	void (*mul_xor)(void *dst, const void *src, uint8_t c, size_t size);
+	boolean_t (*valid)(void);
+	size_t blocksize;
+	const char *name;
+} raidz_math_ops_t;
+
+extern uint8_t vdev_raidz_mul_lt[256][32];
+
+#if defined(__x86_64) && defined(HAVE_SSSE3)
+extern const raidz_math_ops_t vdev_raidz_ssse3_ops;
+#endif
+
+#if defined(__x86_64) && defined(HAVE_AVX2)
+extern const raidz_math_ops_t vdev_raidz_avx2_ops;
+#endif
+
+#if defined(__x86_64) && defined(HAVE_AVX512BW)
+extern const raidz_math_ops_t vdev_raidz_avx512bw_ops;
+#endif
+
+extern const raidz_math_ops_t *vdev_raidz_math_get(void);
+extern const raidz_math_ops_t *vdev_raidz_math_find(const char *name);
+
+extern void vdev_raidz_xor(const raidz_math_ops_t *, void *, const void *,
+    size_t);
+extern void vdev_raidz_mul2_xor(const raidz_math_ops_t *, void *,
+    const void *, size_t);
+extern void vdev_raidz_gen_pq(const raidz_math_ops_t *, void *, void *,
+    const void *, size_t);
+extern void vdev_raidz_gen_pqr(const raidz_math_ops_t *, void *, void *,
+    void *, const void *, size_t);
+extern void vdev_raidz_mul(const raidz_math_ops_t *, void *, const void *,
+    uint8_t, size_t);
+extern void vdev_raidz_mul_xor(const raidz_math_ops_t *, void *,
+    const void *, uint8_t, size_t);
+
+extern void vdev_raidz_math_init(void);
+extern void vdev_raidz_math_fini(void);
+extern int vdev_raidz_impl_set(const char *);
+extern int vdev_raidz_math_verify(const char *, uint64_t, uint64_t,
+    uint64_t, uint64_t, uint64_t, uint64_t);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_VDEV_RAIDZ_H */
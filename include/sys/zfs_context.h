@@ -445,6 +445,7 @@ extern void	system_taskq_fini(void);
 typedef struct vnode {
 	uint64_t	v_size;
 	int		v_fd;
+	int		v_dfd;		/* O_DIRECT descriptor, or -1 */
 	char		*v_path;
 } vnode_t;
 
@@ -514,13 +515,19 @@ typedef struct vsecattr {
 
 #define	CRCREAT		0
 
+#define	F_FREESP	11
+
 extern int fop_getattr(vnode_t *vp, vattr_t *vap);
+extern int fop_space(vnode_t *vp, int cmd, struct flock *bfp, int flag,
+    offset_t offset);
 
 #define	VOP_CLOSE(vp, f, c, o, cr, ct)	vn_close(vp)
 #define	VOP_PUTPAGE(vp, of, sz, fl, cr, ct)	0
 #define	VOP_GETATTR(vp, vap, fl, cr, ct)  fop_getattr((vp), (vap));
 
 #define	VOP_FSYNC(vp, f, cr, ct)	fsync((vp)->v_fd)
+#define	VOP_SPACE(vp, cmd, bfp, fl, off, cr, ct) \
+	fop_space((vp), (cmd), (bfp), (fl), (off))
 
 #define	VN_RELE(vp)	vn_close(vp)
 
@@ -532,6 +539,10 @@ extern int vn_rdwr(int uio, vnode_t *vp, void *addr, ssize_t len,
     offset_t offset, int x1, int x2, rlim64_t x3, void *x4, ssize_t *residp);
 extern void vn_close(vnode_t *vp);
 
+typedef void vn_aio_done_t(void *arg, int error, ssize_t resid);
+extern int vn_aio_rdwr(int uio, vnode_t *vp, void *addr, ssize_t len,
+    offset_t offset, vn_aio_done_t *func, void *arg);
+
 #define	vn_remove(path, x1, x2)		remove(path)
 #define	vn_rename(from, to, seg)	rename((from), (to))
 #define	vn_is_readonly(vp)		B_FALSE
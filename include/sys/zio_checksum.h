@@ -32,15 +32,27 @@ extern "C" {
 #endif
 
 /*
- * Signature for checksum functions.
+ * Signature for checksum functions.  ctx_template is the pool's context
+ * template for the checksum, or NULL if it has none.
  */
 typedef void zio_checksum_t(const void *data, uint64_t size, zio_cksum_t *zcp);
+typedef void zio_abd_checksum_t(abd_t *abd, uint64_t size,
+    const void *ctx_template, zio_cksum_t *zcp);
+
+/*
+ * Salted checksums precompute the part of their state which depends only
+ * on the pool's salt once per pool, as a context template.
+ */
+typedef void *zio_checksum_tmpl_init_t(const zio_cksum_salt_t *salt);
+typedef void zio_checksum_tmpl_free_t(void *ctx_template);
 
 /*
  * Information about each checksum function.
  */
 typedef const struct zio_checksum_info {
-	zio_checksum_t	*ci_func[2]; /* checksum function for each byteorder */
+	zio_abd_checksum_t *ci_func[2]; /* checksum function per byteorder */
+	zio_checksum_tmpl_init_t *ci_tmpl_init;	/* salted: make template */
+	zio_checksum_tmpl_free_t *ci_tmpl_free;	/* salted: free template */
 	int		ci_correctable;	/* number of correctable bits	*/
 	int		ci_eck;		/* uses zio embedded checksum? */
 	int		ci_dedup;	/* strong enough for dedup? */
@@ -62,9 +74,15 @@ extern zio_checksum_info_t zio_checksum_table[ZIO_CHECKSUM_FUNCTIONS];
  * Checksum routines.
  */
 extern zio_checksum_t zio_checksum_SHA256;
+extern void zio_checksum_SHA256_multi(void **, uint64_t *, zio_cksum_t *,
+    int);
 
+extern void zio_checksum_template_init(enum zio_checksum checksum,
+    spa_t *spa);
+extern void zio_checksum_templates_free(spa_t *spa);
 extern void zio_checksum_compute(zio_t *zio, enum zio_checksum checksum,
-    void *data, uint64_t size);
+    abd_t *abd, uint64_t size);
+extern void zio_checksum_compute_batch(zio_t **zios, int n);
 extern int zio_checksum_error(zio_t *zio, zio_bad_cksum_t *out);
 extern enum zio_checksum spa_dedup_checksum(spa_t *spa);
 
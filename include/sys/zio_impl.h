@@ -73,6 +73,8 @@ enum zio_stage {
 	ZIO_STAGE_DONE			= 1 << 20	/* RWFCI */
 };
 
+#define	ZIO_STAGES	21	/* highbit(ZIO_STAGE_DONE) */
+
 #define	ZIO_INTERLOCK_STAGES			\
 	(ZIO_STAGE_READY |			\
 	ZIO_STAGE_DONE)
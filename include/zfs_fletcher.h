@@ -39,12 +39,67 @@ extern "C" {
 
 void fletcher_2_native(const void *, uint64_t, zio_cksum_t *);
 void fletcher_2_byteswap(const void *, uint64_t, zio_cksum_t *);
+void fletcher_2_incremental_native(const void *, uint64_t,
+    zio_cksum_t *);
+void fletcher_2_incremental_byteswap(const void *, uint64_t,
+    zio_cksum_t *);
 void fletcher_4_native(const void *, uint64_t, zio_cksum_t *);
 void fletcher_4_byteswap(const void *, uint64_t, zio_cksum_t *);
 void fletcher_4_incremental_native(const void *, uint64_t,
     zio_cksum_t *);
 void fletcher_4_incremental_byteswap(const void *, uint64_t,
     zio_cksum_t *);
+void fletcher_4_init(void);
+void fletcher_4_fini(void);
+int fletcher_4_impl_set(const char *);
+
+/*
+ * Vectorized fletcher 4 implementations.  Each implementation keeps
+ * nlanes independent running sums, lane j consuming the 32-bit words
+ * j, j + nlanes, j + 2 * nlanes, ... of the buffer.  The lanes are
+ * folded back into the scalar checksum by zfs_fletcher.c, so every
+ * implementation produces results identical to the scalar code.
+ *
+ * The compute functions require size to be a non-zero multiple of
+ * blocksize; any remainder is handled by the scalar code.
+ */
+#define	FLETCHER_4_MAX_LANES	8
+
+typedef struct fletcher_4_ctx {
+	uint64_t	a[FLETCHER_4_MAX_LANES];
+	uint64_t	b[FLETCHER_4_MAX_LANES];
+	uint64_t	c[FLETCHER_4_MAX_LANES];
+	uint64_t	d[FLETCHER_4_MAX_LANES];
+} fletcher_4_ctx_t;
+
+typedef void (*fletcher_4_compute_f)(fletcher_4_ctx_t *, const void *,
+    uint64_t);
+typedef boolean_t (*fletcher_4_valid_f)(void);
+
+typedef struct fletcher_4_ops {
+	fletcher_4_compute_f	compute_native;
+	fletcher_4_compute_f	compute_byteswap;
+	fletcher_4_valid_f	valid;
+	uint_t			nlanes;		/* running sums per step */
+	uint_t			blocksize;	/* bytes per loop iteration */
+	const char		*name;
+} fletcher_4_ops_t;
+
+#if defined(__x86_64) && defined(HAVE_SSE2)
+extern const fletcher_4_ops_t fletcher_4_sse2_ops;
+#endif
+
+#if defined(__x86_64) && defined(HAVE_SSE2) && defined(HAVE_SSSE3)
+extern const fletcher_4_ops_t fletcher_4_ssse3_ops;
+#endif
+
+#if defined(__x86_64) && defined(HAVE_AVX2)
+extern const fletcher_4_ops_t fletcher_4_avx2_ops;
+#endif
+
+#if defined(__x86_64) && defined(HAVE_AVX512F) && defined(HAVE_AVX2)
+extern const fletcher_4_ops_t fletcher_4_avx512f_ops;
+#endif
 
 #ifdef	__cplusplus
 }
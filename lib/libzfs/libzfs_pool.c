@@ -1955,6 +1955,43 @@ zpool_scan(zpool_handle_t *zhp, pool_scan_func_t func)
 	}
 }
 
+/*
+ * Start or stop discarding the free space in the pool.  The rate limits
+ * the discards to that many bytes per second, 0 means no limit.
+ */
+int
+zpool_trim(zpool_handle_t *zhp, boolean_t start, uint64_t rate)
+{
+	zfs_cmd_t zc = {"\0"};
+	char msg[1024];
+	libzfs_handle_t *hdl = zhp->zpool_hdl;
+
+	(void) strlcpy(zc.zc_name, zhp->zpool_name, sizeof (zc.zc_name));
+	zc.zc_cookie = start;
+	zc.zc_obj = rate;
+
+	if (zfs_ioctl(hdl, ZFS_IOC_POOL_TRIM, &zc) == 0 ||
+	    (errno == ENOENT && !start))
+		return (0);
+
+	if (start) {
+		(void) snprintf(msg, sizeof (msg),
+		    dgettext(TEXT_DOMAIN, "cannot trim %s"), zc.zc_name);
+	} else {
+		(void) snprintf(msg, sizeof (msg),
+		    dgettext(TEXT_DOMAIN, "cannot cancel trimming %s"),
+		    zc.zc_name);
+	}
+
+	if (errno == EBUSY) {
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "a trim is already in progress"));
+		return (zfs_error(hdl, EZFS_BUSY, msg));
+	}
+
+	return (zpool_standard_error(hdl, errno, msg));
+}
+
 /*
  * Find a vdev that matches the search criteria specified. We use the
  * the nvpair name to determine how we should look for the device.
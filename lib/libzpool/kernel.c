@@ -38,6 +38,11 @@
 #include <sys/utsname.h>
 #include <sys/time.h>
 #include <sys/systeminfo.h>
+#include <zfs_fletcher.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+#endif
 
 /*
  * Emulation of kernel services in userland.
@@ -608,9 +613,24 @@ vn_open(char *path, int x1, int flags, int mode, vnode_t **vpp, int x2, int x3)
 	*vpp = vp = umem_zalloc(sizeof (vnode_t), UMEM_NOFAIL);
 
 	vp->v_fd = fd;
+	vp->v_dfd = -1;
 	vp->v_size = st.st_size;
 	vp->v_path = spa_strdup(path);
 
+#ifdef __linux__
+	/*
+	 * Regular files get a second, O_DIRECT, descriptor which is used by
+	 * vn_aio_rdwr() for aligned i/o.  Not every file system supports
+	 * O_DIRECT, in which case all i/o goes through the page cache.
+	 */
+	if (S_ISREG(st.st_mode)) {
+		vp->v_dfd = open64(path, ((flags - FREAD) &
+		    ~(O_CREAT | O_EXCL | O_TRUNC)) | O_DIRECT);
+		if (vp->v_dfd != -1)
+			(void) fcntl(vp->v_dfd, F_SETFD, FD_CLOEXEC);
+	}
+#endif
+
 	return (0);
 }
 
@@ -683,11 +703,247 @@ vn_rdwr(int uio, vnode_t *vp, void *addr, ssize_t len, offset_t offset,
 void
 vn_close(vnode_t *vp)
 {
+	if (vp->v_dfd != -1)
+		close(vp->v_dfd);
 	close(vp->v_fd);
 	spa_strfree(vp->v_path);
 	umem_free(vp, sizeof (vnode_t));
 }
 
+/*
+ * Asynchronous i/o is submitted with Linux native AIO and reaped by a
+ * single completion thread, which runs the callbacks.  When AIO is not
+ * available vn_aio_rdwr() fails with ENOTSUP and the caller falls back
+ * to vn_rdwr().  Writes are split in two, as in vn_rdwr(), so a killed
+ * process can leave a partial write behind.
+ */
+#define	VN_AIO_EVENTS		1024
+#define	VN_AIO_DIRECT_ALIGN	512
+
+typedef struct vn_aio {
+	struct iocb	va_iocb[2];
+	int		va_nr;		/* iocbs in this request */
+	uint32_t	va_pending;	/* iocbs not yet completed */
+	uint64_t	va_done;	/* bytes transferred */
+	uint32_t	va_error;
+	ssize_t		va_len;
+	vnode_t		*va_vp;
+	vn_aio_done_t	*va_func;
+	void		*va_arg;
+} vn_aio_t;
+
+#ifdef __linux__
+static aio_context_t vn_aio_ctx;
+static kthread_t *vn_aio_thread;
+static kmutex_t vn_aio_lock;
+static kcondvar_t vn_aio_cv;
+static boolean_t vn_aio_exit;
+
+static void
+vn_aio_complete(vn_aio_t *va, struct iocb *iocb, int64_t res)
+{
+	/*
+	 * The file system may need more alignment for O_DIRECT than we
+	 * checked for, in which case redo the i/o through the page cache.
+	 */
+	if (res == -EINVAL && iocb->aio_fildes == va->va_vp->v_dfd) {
+		if (iocb->aio_lio_opcode == IOCB_CMD_PREAD)
+			res = pread64(va->va_vp->v_fd, (void *)iocb->aio_buf,
+			    iocb->aio_nbytes, iocb->aio_offset);
+		else
+			res = pwrite64(va->va_vp->v_fd, (void *)iocb->aio_buf,
+			    iocb->aio_nbytes, iocb->aio_offset);
+		if (res == -1)
+			res = -errno;
+	}
+
+	if (res < 0)
+		(void) atomic_cas_32(&va->va_error, 0, -res);
+	else
+		atomic_add_64(&va->va_done, res);
+
+	if (atomic_dec_32_nv(&va->va_pending) == 0) {
+		va->va_func(va->va_arg, va->va_error, va->va_len - va->va_done);
+		umem_free(va, sizeof (vn_aio_t));
+	}
+}
+
+static void
+vn_aio_reap(void *arg)
+{
+	struct io_event events[16];
+	struct timespec ts;
+	int i, n;
+
+	while (!vn_aio_exit) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 100 * (NANOSEC / MILLISEC);
+
+		n = syscall(__NR_io_getevents, vn_aio_ctx, 1,
+		    sizeof (events) / sizeof (events[0]), events, &ts);
+
+		for (i = 0; i < n; i++)
+			vn_aio_complete((vn_aio_t *)(uintptr_t)events[i].data,
+			    (struct iocb *)(uintptr_t)events[i].obj,
+			    (int64_t)events[i].res);
+	}
+
+	mutex_enter(&vn_aio_lock);
+	vn_aio_thread = NULL;
+	cv_broadcast(&vn_aio_cv);
+	mutex_exit(&vn_aio_lock);
+
+	thread_exit();
+}
+
+static void
+vn_aio_init(void)
+{
+	mutex_init(&vn_aio_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&vn_aio_cv, NULL, CV_DEFAULT, NULL);
+
+	vn_aio_ctx = 0;
+	vn_aio_exit = B_FALSE;
+	if (syscall(__NR_io_setup, VN_AIO_EVENTS, &vn_aio_ctx) != 0) {
+		vn_aio_ctx = 0;
+		return;
+	}
+
+	vn_aio_thread = thread_create(NULL, 0, vn_aio_reap, NULL, 0, &p0,
+	    TS_RUN, 0);
+}
+
+static void
+vn_aio_fini(void)
+{
+	if (vn_aio_ctx != 0) {
+		mutex_enter(&vn_aio_lock);
+		vn_aio_exit = B_TRUE;
+		while (vn_aio_thread != NULL)
+			cv_wait(&vn_aio_cv, &vn_aio_lock);
+		mutex_exit(&vn_aio_lock);
+
+		(void) syscall(__NR_io_destroy, vn_aio_ctx);
+		vn_aio_ctx = 0;
+	}
+
+	cv_destroy(&vn_aio_cv);
+	mutex_destroy(&vn_aio_lock);
+}
+
+static void
+vn_aio_prep(vn_aio_t *va, int i, int fd, int uio, void *addr, ssize_t len,
+    offset_t offset)
+{
+	struct iocb *iocb = &va->va_iocb[i];
+
+	bzero(iocb, sizeof (struct iocb));
+	iocb->aio_data = (uintptr_t)va;
+	iocb->aio_lio_opcode = (uio == UIO_READ) ?
+	    IOCB_CMD_PREAD : IOCB_CMD_PWRITE;
+	iocb->aio_fildes = fd;
+	iocb->aio_buf = (uintptr_t)addr;
+	iocb->aio_nbytes = len;
+	iocb->aio_offset = offset;
+}
+
+int
+vn_aio_rdwr(int uio, vnode_t *vp, void *addr, ssize_t len, offset_t offset,
+    vn_aio_done_t *func, void *arg)
+{
+	struct iocb *iocbs[2];
+	vn_aio_t *va;
+	ssize_t split;
+	int fd, i, n, nr;
+
+	if (vn_aio_ctx == 0)
+		return (ENOTSUP);
+
+	/*
+	 * Use the O_DIRECT descriptor when the buffer, length and offset
+	 * are all suitably aligned, the page cache otherwise.
+	 */
+	if (vp->v_dfd != -1 &&
+	    IS_P2ALIGNED(addr, VN_AIO_DIRECT_ALIGN) &&
+	    IS_P2ALIGNED(len, VN_AIO_DIRECT_ALIGN) &&
+	    IS_P2ALIGNED(offset, VN_AIO_DIRECT_ALIGN))
+		fd = vp->v_dfd;
+	else
+		fd = vp->v_fd;
+
+	va = umem_zalloc(sizeof (vn_aio_t), UMEM_NOFAIL);
+	va->va_len = len;
+	va->va_vp = vp;
+	va->va_func = func;
+	va->va_arg = arg;
+
+	if (uio == UIO_READ) {
+		vn_aio_prep(va, 0, fd, uio, addr, len, offset);
+		va->va_nr = 1;
+	} else {
+		int sectors = len >> SPA_MINBLOCKSHIFT;
+		split = (sectors > 1 ? 1 + rand() % (sectors - 1) : 0) <<
+		    SPA_MINBLOCKSHIFT;
+		if (split == 0) {
+			vn_aio_prep(va, 0, fd, uio, addr, len, offset);
+			va->va_nr = 1;
+		} else {
+			vn_aio_prep(va, 0, fd, uio, addr, split, offset);
+			vn_aio_prep(va, 1, fd, uio, (char *)addr + split,
+			    len - split, offset + split);
+			va->va_nr = 2;
+		}
+	}
+
+	/*
+	 * Once submitted the request may complete and be freed at any time,
+	 * so only the iocbs which were not accepted can be touched below.
+	 */
+	nr = va->va_pending = va->va_nr;
+	for (i = 0; i < nr; i++)
+		iocbs[i] = &va->va_iocb[i];
+
+	n = syscall(__NR_io_submit, vn_aio_ctx, nr, iocbs);
+	if (n <= 0) {
+		int error = (n == 0) ? EAGAIN : errno;
+
+		umem_free(va, sizeof (vn_aio_t));
+		return (error);
+	}
+
+	/*
+	 * Only part of a split write was accepted, complete the rest here.
+	 */
+	for (i = n; i < nr; i++) {
+		struct iocb *iocb = &va->va_iocb[i];
+		ssize_t rc = pwrite64(vp->v_fd, (void *)(uintptr_t)
+		    iocb->aio_buf, iocb->aio_nbytes, iocb->aio_offset);
+
+		vn_aio_complete(va, iocb, rc == -1 ? -errno : rc);
+	}
+
+	return (0);
+}
+#else
+static void
+vn_aio_init(void)
+{
+}
+
+static void
+vn_aio_fini(void)
+{
+}
+
+/* ARGSUSED */
+int
+vn_aio_rdwr(int uio, vnode_t *vp, void *addr, ssize_t len, offset_t offset,
+    vn_aio_done_t *func, void *arg)
+{
+	return (ENOTSUP);
+}
+#endif /* __linux__ */
+
 /*
  * At a minimum we need to update the size since vdev_reopen()
  * will no longer call vn_openat().
@@ -708,6 +964,27 @@ fop_getattr(vnode_t *vp, vattr_t *vap)
 	return (0);
 }
 
+/*
+ * Only F_FREESP is supported, by punching a hole over the range.
+ */
+/* ARGSUSED */
+int
+fop_space(vnode_t *vp, int cmd, struct flock *bfp, int flag, offset_t offset)
+{
+#ifdef FALLOC_FL_PUNCH_HOLE
+	if (cmd != F_FREESP || bfp->l_whence != 0)
+		return (EINVAL);
+
+	if (fallocate(vp->v_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+	    bfp->l_start, bfp->l_len) == -1)
+		return (errno);
+
+	return (0);
+#else
+	return (ENOTSUP);
+#endif
+}
+
 /*
  * =========================================================================
  * Figure out which debugging statements to print
@@ -1060,7 +1337,9 @@ kernel_init(int mode)
 
 	thread_init();
 	system_taskq_init();
+	vn_aio_init();
 
+	fletcher_4_init();
 	spa_init(mode);
 
 	tsd_create(&rrw_tsd_key, rrw_tsd_destroy);
@@ -1070,7 +1349,9 @@ void
 kernel_fini(void)
 {
 	spa_fini();
+	fletcher_4_fini();
 
+	vn_aio_fini();
 	system_taskq_fini();
 	thread_fini();
 
@@ -123,6 +123,25 @@
  *
  * For both cached and uncached data, both fletcher checksums are much faster
  * than sha-256, and slower than 'off', which doesn't touch the data at all.
+ *
+ * ---------------------
+ * Vectorized Fletcher-4
+ * ---------------------
+ *
+ * fletcher-4 is a strictly serial computation, but it can be split into
+ * N interleaved streams, lane j summing the words j, j + N, j + 2N, ...
+ * Each lane is itself an ordinary fletcher-4 sum, and the four final
+ * sums are linear combinations of the per-lane sums with coefficients
+ * depending only on N and j (see fletcher_4_fold()).  Likewise, the sum
+ * of a buffer can be appended to a running sum with coefficients that
+ * only depend on the number of words appended (fletcher_4_combine()).
+ * Both are exact in 64-bit modular arithmetic, so the SIMD versions
+ * return exactly the same checksums as the scalar loop.
+ *
+ * When the module is loaded each supported implementation is verified
+ * against the scalar code and timed, and the fastest one is used.  The
+ * measured rates and the current choice are in zfs:0:fletcher_4_bench,
+ * and the zfs_fletcher_4_impl module option overrides the choice.
  */
 
 #include <sys/types.h>
@@ -130,6 +149,7 @@
 #include <sys/byteorder.h>
 #include <sys/zio.h>
 #include <sys/spa.h>
+#include <zfs_fletcher.h>
 
 void
 fletcher_2_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
@@ -166,42 +186,53 @@ fletcher_2_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
 }
 
 void
-fletcher_4_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+fletcher_2_incremental_native(const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
 {
-	const uint32_t *ip = buf;
-	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
-	uint64_t a, b, c, d;
+	const uint64_t *ip = buf;
+	const uint64_t *ipend = ip + (size / sizeof (uint64_t));
+	uint64_t a0, b0, a1, b1;
 
-	for (a = b = c = d = 0; ip < ipend; ip++) {
-		a += ip[0];
-		b += a;
-		c += b;
-		d += c;
+	a0 = zcp->zc_word[0];
+	a1 = zcp->zc_word[1];
+	b0 = zcp->zc_word[2];
+	b1 = zcp->zc_word[3];
+
+	for (; ip < ipend; ip += 2) {
+		a0 += ip[0];
+		a1 += ip[1];
+		b0 += a0;
+		b1 += a1;
 	}
 
-	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
+	ZIO_SET_CHECKSUM(zcp, a0, a1, b0, b1);
 }
 
 void
-fletcher_4_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+fletcher_2_incremental_byteswap(const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
 {
-	const uint32_t *ip = buf;
-	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
-	uint64_t a, b, c, d;
+	const uint64_t *ip = buf;
+	const uint64_t *ipend = ip + (size / sizeof (uint64_t));
+	uint64_t a0, b0, a1, b1;
 
-	for (a = b = c = d = 0; ip < ipend; ip++) {
-		a += BSWAP_32(ip[0]);
-		b += a;
-		c += b;
-		d += c;
+	a0 = zcp->zc_word[0];
+	a1 = zcp->zc_word[1];
+	b0 = zcp->zc_word[2];
+	b1 = zcp->zc_word[3];
+
+	for (; ip < ipend; ip += 2) {
+		a0 += BSWAP_64(ip[0]);
+		a1 += BSWAP_64(ip[1]);
+		b0 += a0;
+		b1 += a1;
 	}
 
-	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
+	ZIO_SET_CHECKSUM(zcp, a0, a1, b0, b1);
 }
 
-void
-fletcher_4_incremental_native(const void *buf, uint64_t size,
-    zio_cksum_t *zcp)
+static void
+fletcher_4_scalar_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
 {
 	const uint32_t *ip = buf;
 	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
@@ -222,9 +253,8 @@ fletcher_4_incremental_native(const void *buf, uint64_t size,
 	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
 }
 
-void
-fletcher_4_incremental_byteswap(const void *buf, uint64_t size,
-    zio_cksum_t *zcp)
+static void
+fletcher_4_scalar_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
 {
 	const uint32_t *ip = buf;
 	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
@@ -245,11 +275,447 @@ fletcher_4_incremental_byteswap(const void *buf, uint64_t size,
 	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
 }
 
+static boolean_t
+fletcher_4_scalar_valid(void)
+{
+	return (B_TRUE);
+}
+
+/*
+ * The scalar implementation has no compute functions; it is the loop
+ * above applied to the whole buffer.
+ */
+static const fletcher_4_ops_t fletcher_4_scalar_ops = {
+	.compute_native = NULL,
+	.compute_byteswap = NULL,
+	.valid = fletcher_4_scalar_valid,
+	.nlanes = 1,
+	.blocksize = sizeof (uint32_t),
+	.name = "scalar"
+};
+
+static const fletcher_4_ops_t *fletcher_4_impls[] = {
+	&fletcher_4_scalar_ops,
+#if defined(__x86_64) && defined(HAVE_SSE2)
+	&fletcher_4_sse2_ops,
+#endif
+#if defined(__x86_64) && defined(HAVE_SSE2) && defined(HAVE_SSSE3)
+	&fletcher_4_ssse3_ops,
+#endif
+#if defined(__x86_64) && defined(HAVE_AVX2)
+	&fletcher_4_avx2_ops,
+#endif
+#if defined(__x86_64) && defined(HAVE_AVX512F) && defined(HAVE_AVX2)
+	&fletcher_4_avx512f_ops,
+#endif
+};
+
+#define	FLETCHER_4_NIMPLS	\
+	(sizeof (fletcher_4_impls) / sizeof (fletcher_4_impls[0]))
+
+/*
+ * Buffers smaller than this are not worth the cost of folding the lanes
+ * and are always checksummed by the scalar loop.
+ */
+#define	FLETCHER_4_SIMD_MIN	128
+
+/*
+ * fletcher_4_impl is the implementation in use.  fletcher_4_fastest is
+ * the benchmark winner, used unless the user selected a specific one.
+ */
+static const fletcher_4_ops_t *fletcher_4_impl = &fletcher_4_scalar_ops;
+static const fletcher_4_ops_t *fletcher_4_fastest = &fletcher_4_scalar_ops;
+static boolean_t fletcher_4_impl_user = B_FALSE;
+
+/*
+ * Fold the per-lane sums of an nlanes wide computation started from zero
+ * into the sums a single scalar pass over the same words would produce.
+ * With N lanes, the words seen by lane j are those at positions
+ * N * i + j, and expanding the scalar sums over those positions gives:
+ *
+ *	A = sum(a[j])
+ *	B = sum(N * b[j] - j * a[j])
+ *	C = sum(N^2 * c[j] + (N * (1 - 2j) - N^2) / 2 * b[j] +
+ *	    j * (j - 1) / 2 * a[j])
+ *	D = sum(N^3 * d[j] + N^2 * (1 - N - j) * c[j] +
+ *	    (N^3 + 3N^2 * j + 3N * j^2 - 3N^2 - 6N * j + 2N) / 6 * b[j] -
+ *	    j * (j - 1) * (j - 2) / 6 * a[j])
+ *
+ * All divisions are exact; the coefficients are small signed values and
+ * the products wrap exactly like the scalar additions do.
+ */
+static void
+fletcher_4_fold(const fletcher_4_ctx_t *ctx, uint_t nlanes, zio_cksum_t *zcp)
+{
+	int64_t n = nlanes;
+	uint64_t a = 0, b = 0, c = 0, d = 0;
+	int64_t j;
+
+	for (j = 0; j < n; j++) {
+		a += ctx->a[j];
+		b += (uint64_t)n * ctx->b[j] - (uint64_t)j * ctx->a[j];
+		c += (uint64_t)(n * n) * ctx->c[j] +
+		    (uint64_t)((n * (1 - 2 * j) - n * n) / 2) * ctx->b[j] +
+		    (uint64_t)(j * (j - 1) / 2) * ctx->a[j];
+		d += (uint64_t)(n * n * n) * ctx->d[j] +
+		    (uint64_t)(n * n * (1 - n - j)) * ctx->c[j] +
+		    (uint64_t)((n * n * n + 3 * n * n * j + 3 * n * j * j -
+		    3 * n * n - 6 * n * j + 2 * n) / 6) * ctx->b[j] -
+		    (uint64_t)(j * (j - 1) * (j - 2) / 6) * ctx->a[j];
+	}
+
+	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
+}
+
+/*
+ * Append the sums of nwords words, computed from zero, to the running
+ * sums in zcp.  Continuing the scalar loop from (A, B, C, D) adds A to
+ * b once per word, B and A to c, and so on, which gives:
+ *
+ *	D' = D + d + n * C + n(n + 1)/2 * B + n(n + 1)(n + 2)/6 * A
+ *	C' = C + c + n * B + n(n + 1)/2 * A
+ *	B' = B + b + n * A
+ *	A' = A + a
+ *
+ * The binomial coefficients are computed exactly by dividing out 2 and 3
+ * before multiplying, so they are correct modulo 2^64 for any n.
+ */
+static void
+fletcher_4_combine(zio_cksum_t *zcp, const zio_cksum_t *part,
+    uint64_t nwords)
+{
+	uint64_t f[3] = { nwords, nwords + 1, nwords + 2 };
+	uint64_t n1, n2, n3;
+	uint64_t a, b, c, d;
+	int i;
+
+	n1 = nwords;
+	n2 = (nwords % 2 == 0) ? (nwords / 2) * (nwords + 1) :
+	    nwords * ((nwords + 1) / 2);
+
+	for (i = 0; i < 3; i++) {
+		if (f[i] % 3 == 0) {
+			f[i] /= 3;
+			break;
+		}
+	}
+	for (i = 0; i < 3; i++) {
+		if (f[i] % 2 == 0) {
+			f[i] /= 2;
+			break;
+		}
+	}
+	n3 = f[0] * f[1] * f[2];
+
+	a = zcp->zc_word[0];
+	b = zcp->zc_word[1];
+	c = zcp->zc_word[2];
+	d = zcp->zc_word[3];
+
+	ZIO_SET_CHECKSUM(zcp,
+	    a + part->zc_word[0],
+	    b + part->zc_word[1] + n1 * a,
+	    c + part->zc_word[2] + n1 * b + n2 * a,
+	    d + part->zc_word[3] + n1 * c + n2 * b + n3 * a);
+}
+
+/*
+ * Continue the running checksum in zcp over buf using the given
+ * implementation.  The SIMD code handles the largest multiple of its
+ * block size; the remaining words go through the scalar loop.
+ */
+static void
+fletcher_4_compute(const fletcher_4_ops_t *ops, const void *buf,
+    uint64_t size, zio_cksum_t *zcp, boolean_t byteswap)
+{
+	uint64_t simd = 0;
+
+	if (ops->compute_native != NULL && size >= FLETCHER_4_SIMD_MIN)
+		simd = P2ALIGN(size, (uint64_t)ops->blocksize);
+
+	if (simd != 0) {
+		fletcher_4_ctx_t ctx;
+		zio_cksum_t part;
+
+		bzero(&ctx, sizeof (ctx));
+		if (byteswap)
+			ops->compute_byteswap(&ctx, buf, simd);
+		else
+			ops->compute_native(&ctx, buf, simd);
+
+		fletcher_4_fold(&ctx, ops->nlanes, &part);
+		fletcher_4_combine(zcp, &part, simd / sizeof (uint32_t));
+
+		buf = (const char *)buf + simd;
+		size -= simd;
+	}
+
+	if (byteswap)
+		fletcher_4_scalar_byteswap(buf, size, zcp);
+	else
+		fletcher_4_scalar_native(buf, size, zcp);
+}
+
+void
+fletcher_4_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	fletcher_4_compute(fletcher_4_impl, buf, size, zcp, B_FALSE);
+}
+
+void
+fletcher_4_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	fletcher_4_compute(fletcher_4_impl, buf, size, zcp, B_TRUE);
+}
+
+void
+fletcher_4_incremental_native(const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
+{
+	fletcher_4_compute(fletcher_4_impl, buf, size, zcp, B_FALSE);
+}
+
+void
+fletcher_4_incremental_byteswap(const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
+{
+	fletcher_4_compute(fletcher_4_impl, buf, size, zcp, B_TRUE);
+}
+
+/*
+ * Select the implementation by name: "fastest" reverts to the benchmark
+ * winner, anything else must name an implementation usable on this CPU.
+ * Before fletcher_4_init() has run the choice is only recorded.
+ */
+int
+fletcher_4_impl_set(const char *name)
+{
+	const fletcher_4_ops_t *ops = NULL;
+	size_t len;
+	int i;
+
+	/* module parameters arrive with a trailing newline */
+	len = strlen(name);
+	while (len > 0 && (name[len - 1] == '\n' || name[len - 1] == ' '))
+		len--;
+
+	if (len == strlen("fastest") && strncmp(name, "fastest", len) == 0) {
+		fletcher_4_impl_user = B_FALSE;
+		fletcher_4_impl = fletcher_4_fastest;
+		return (0);
+	}
+
+	for (i = 0; i < FLETCHER_4_NIMPLS; i++) {
+		if (len == strlen(fletcher_4_impls[i]->name) &&
+		    strncmp(name, fletcher_4_impls[i]->name, len) == 0) {
+			ops = fletcher_4_impls[i];
+			break;
+		}
+	}
+
+	if (ops == NULL || !ops->valid())
+		return (EINVAL);
+
+	fletcher_4_impl_user = B_TRUE;
+	fletcher_4_impl = ops;
+	return (0);
+}
+
+/*
+ * Benchmark results, in MB/s, for the native and byteswap variants of
+ * each implementation, followed by the name of the one in use.
+ */
+#define	FLETCHER_4_BENCH_SIZE	(128 * 1024)
+#define	FLETCHER_4_BENCH_NS	(1000 * 1000)	/* 1ms per variant */
+
+static kstat_t *fletcher_4_ksp;
+static kstat_named_t fletcher_4_kstat_data[2 * FLETCHER_4_NIMPLS + 1];
+
+static int
+fletcher_4_kstat_update(kstat_t *ksp, int rw)
+{
+	kstat_named_t *ks = &fletcher_4_kstat_data[2 * FLETCHER_4_NIMPLS];
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	(void) strlcpy(ks->value.c, fletcher_4_impl->name,
+	    sizeof (ks->value.c));
+
+	return (0);
+}
+
+static uint64_t
+fletcher_4_bench(const fletcher_4_ops_t *ops, const void *buf,
+    boolean_t byteswap)
+{
+	zio_cksum_t zc;
+	uint64_t bytes = 0;
+	hrtime_t start, elapsed;
+	int i;
+
+	start = gethrtime();
+	do {
+		for (i = 0; i < 8; i++) {
+			ZIO_SET_CHECKSUM(&zc, 0, 0, 0, 0);
+			fletcher_4_compute(ops, buf, FLETCHER_4_BENCH_SIZE,
+			    &zc, byteswap);
+		}
+		bytes += 8 * FLETCHER_4_BENCH_SIZE;
+		elapsed = gethrtime() - start;
+	} while (elapsed < FLETCHER_4_BENCH_NS);
+
+	return ((bytes * 1000) / elapsed);
+}
+
+/*
+ * Check an implementation against the scalar code, over the whole
+ * buffer from zero and over an unaligned length continuing from
+ * non-zero sums so the tail and combine steps are covered too.
+ */
+static boolean_t
+fletcher_4_verify(const fletcher_4_ops_t *ops, const void *buf)
+{
+	uint64_t sizes[2] = { FLETCHER_4_BENCH_SIZE,
+	    FLETCHER_4_BENCH_SIZE - 3 * sizeof (uint32_t) };
+	zio_cksum_t expect, actual;
+	int i, bswap;
+
+	for (i = 0; i < 2; i++) {
+		for (bswap = 0; bswap < 2; bswap++) {
+			ZIO_SET_CHECKSUM(&expect, i, i << 8, i << 16, i << 24);
+			actual = expect;
+			fletcher_4_compute(&fletcher_4_scalar_ops, buf,
+			    sizes[i], &expect, bswap);
+			fletcher_4_compute(ops, buf, sizes[i], &actual, bswap);
+			if (!ZIO_CHECKSUM_EQUAL(expect, actual))
+				return (B_FALSE);
+		}
+	}
+
+	return (B_TRUE);
+}
+
+void
+fletcher_4_init(void)
+{
+	const fletcher_4_ops_t *fastest = &fletcher_4_scalar_ops;
+	uint64_t rate, fastest_rate = 0;
+	kstat_named_t *ks;
+	uint32_t *buf;
+	int i;
+
+	buf = kmem_alloc(FLETCHER_4_BENCH_SIZE, KM_SLEEP);
+	for (i = 0; i < FLETCHER_4_BENCH_SIZE / sizeof (uint32_t); i++)
+		buf[i] = (uint32_t)(i * 2654435761U);
+
+	for (i = 0; i < FLETCHER_4_NIMPLS; i++) {
+		const fletcher_4_ops_t *ops = fletcher_4_impls[i];
+
+		ks = &fletcher_4_kstat_data[2 * i];
+		ks[0].data_type = KSTAT_DATA_UINT64;
+		ks[1].data_type = KSTAT_DATA_UINT64;
+		(void) snprintf(ks[0].name, KSTAT_STRLEN, "%s_native",
+		    ops->name);
+		(void) snprintf(ks[1].name, KSTAT_STRLEN, "%s_byteswap",
+		    ops->name);
+		ks[0].value.ui64 = ks[1].value.ui64 = 0;
+
+		if (!ops->valid())
+			continue;
+
+		if (!fletcher_4_verify(ops, buf)) {
+			cmn_err(CE_WARN, "fletcher_4 %s implementation "
+			    "returned incorrect results, disabled", ops->name);
+			continue;
+		}
+
+		/* byteswapped pools are rare, pick by the native rate */
+		rate = ks[0].value.ui64 = fletcher_4_bench(ops, buf, B_FALSE);
+		ks[1].value.ui64 = fletcher_4_bench(ops, buf, B_TRUE);
+		if (rate > fastest_rate) {
+			fastest_rate = rate;
+			fastest = ops;
+		}
+	}
+
+	kmem_free(buf, FLETCHER_4_BENCH_SIZE);
+
+	fletcher_4_fastest = fastest;
+	if (!fletcher_4_impl_user)
+		fletcher_4_impl = fastest;
+
+	ks = &fletcher_4_kstat_data[2 * FLETCHER_4_NIMPLS];
+	ks->data_type = KSTAT_DATA_CHAR;
+	(void) strlcpy(ks->name, "selected", KSTAT_STRLEN);
+
+	fletcher_4_ksp = kstat_create("zfs", 0, "fletcher_4_bench", "misc",
+	    KSTAT_TYPE_NAMED, 0, KSTAT_FLAG_VIRTUAL);
+	if (fletcher_4_ksp != NULL) {
+		fletcher_4_ksp->ks_data = fletcher_4_kstat_data;
+		fletcher_4_ksp->ks_ndata = 2 * FLETCHER_4_NIMPLS + 1;
+		fletcher_4_ksp->ks_data_size = sizeof (fletcher_4_kstat_data);
+		fletcher_4_ksp->ks_update = fletcher_4_kstat_update;
+		kstat_install(fletcher_4_ksp);
+	}
+}
+
+void
+fletcher_4_fini(void)
+{
+	if (fletcher_4_ksp != NULL) {
+		kstat_delete(fletcher_4_ksp);
+		fletcher_4_ksp = NULL;
+	}
+
+	fletcher_4_impl = fletcher_4_fastest = &fletcher_4_scalar_ops;
+	fletcher_4_impl_user = B_FALSE;
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+static int
+fletcher_4_param_set(const char *val, struct kernel_param *kp)
+{
+	return (-fletcher_4_impl_set(val));
+}
+
+static int
+fletcher_4_param_get(char *buffer, struct kernel_param *kp)
+{
+	int i, cnt = 0;
+
+	cnt += sprintf(buffer + cnt, fletcher_4_impl_user ?
+	    "fastest " : "[fastest] ");
+	for (i = 0; i < FLETCHER_4_NIMPLS; i++) {
+		const fletcher_4_ops_t *ops = fletcher_4_impls[i];
+
+		if (!ops->valid())
+			continue;
+		cnt += sprintf(buffer + cnt,
+		    (fletcher_4_impl_user && ops == fletcher_4_impl) ?
+		    "[%s] " : "%s ", ops->name);
+	}
+
+	return (cnt);
+}
+#endif
+
 #if defined(_KERNEL) && defined(HAVE_SPL)
 EXPORT_SYMBOL(fletcher_2_native);
 EXPORT_SYMBOL(fletcher_2_byteswap);
+EXPORT_SYMBOL(fletcher_2_incremental_native);
+EXPORT_SYMBOL(fletcher_2_incremental_byteswap);
 EXPORT_SYMBOL(fletcher_4_native);
 EXPORT_SYMBOL(fletcher_4_byteswap);
 EXPORT_SYMBOL(fletcher_4_incremental_native);
 EXPORT_SYMBOL(fletcher_4_incremental_byteswap);
+EXPORT_SYMBOL(fletcher_4_init);
+EXPORT_SYMBOL(fletcher_4_fini);
+EXPORT_SYMBOL(fletcher_4_impl_set);
+
+module_param_call(zfs_fletcher_4_impl, fletcher_4_param_set,
+    fletcher_4_param_get, NULL, 0644);
+MODULE_PARM_DESC(zfs_fletcher_4_impl, "Select fletcher 4 implementation");
 #endif
@@ -0,0 +1,122 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AVX-512F fletcher 4 implementation.  Eight 64-bit lanes per
+ * accumulator are kept in %zmm0-%zmm3 and each loop iteration widens
+ * eight input words, one per lane.  AVX-512F has no byte shuffle, so
+ * the byteswap variant uses the AVX2 vpshufb before widening; the
+ * implementation is therefore only offered when AVX2 is present too.
+ */
+
+#if defined(__x86_64) && defined(HAVE_AVX512F) && defined(HAVE_AVX2)
+
+#include <sys/types.h>
+#include <linux/simd_x86.h>
+#include <zfs_fletcher.h>
+
+#define	FLETCHER_4_AVX512_LOAD						\
+	"vmovdqu64 0(%[ctx]), %%zmm0\n"					\
+	"vmovdqu64 64(%[ctx]), %%zmm1\n"				\
+	"vmovdqu64 128(%[ctx]), %%zmm2\n"				\
+	"vmovdqu64 192(%[ctx]), %%zmm3\n"
+
+#define	FLETCHER_4_AVX512_STEP						\
+	"vpaddq	%%zmm4, %%zmm0, %%zmm0\n"				\
+	"vpaddq	%%zmm0, %%zmm1, %%zmm1\n"				\
+	"vpaddq	%%zmm1, %%zmm2, %%zmm2\n"				\
+	"vpaddq	%%zmm2, %%zmm3, %%zmm3\n"				\
+	"add	$32, %[ip]\n"						\
+	"cmp	%[end], %[ip]\n"					\
+	"jb	1b\n"
+
+#define	FLETCHER_4_AVX512_STORE						\
+	"vmovdqu64 %%zmm0, 0(%[ctx])\n"					\
+	"vmovdqu64 %%zmm1, 64(%[ctx])\n"				\
+	"vmovdqu64 %%zmm2, 128(%[ctx])\n"				\
+	"vmovdqu64 %%zmm3, 192(%[ctx])\n"				\
+	"vzeroupper\n"
+
+static void
+fletcher_4_avx512f_native(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + size;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    FLETCHER_4_AVX512_LOAD
+	    "1:\n"
+	    "vpmovzxdq (%[ip]), %%zmm4\n"
+	    FLETCHER_4_AVX512_STEP
+	    FLETCHER_4_AVX512_STORE
+	    : [ip] "+r" (ip)
+	    : [ctx] "r" (ctx), [end] "r" (ipend)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4");
+	kfpu_end();
+}
+
+static const uint8_t fletcher_4_avx512f_mask[32] = {
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+
+static void
+fletcher_4_avx512f_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + size;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    FLETCHER_4_AVX512_LOAD
+	    "vmovdqu (%[mask]), %%ymm5\n"
+	    "1:\n"
+	    "vmovdqu (%[ip]), %%ymm4\n"
+	    "vpshufb %%ymm5, %%ymm4, %%ymm4\n"
+	    "vpmovzxdq %%ymm4, %%zmm4\n"
+	    FLETCHER_4_AVX512_STEP
+	    FLETCHER_4_AVX512_STORE
+	    : [ip] "+r" (ip)
+	    : [ctx] "r" (ctx), [end] "r" (ipend),
+	    [mask] "r" (fletcher_4_avx512f_mask)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5");
+	kfpu_end();
+}
+
+static boolean_t
+fletcher_4_avx512f_valid(void)
+{
+	return (zfs_avx512f_available() && zfs_avx2_available());
+}
+
+const fletcher_4_ops_t fletcher_4_avx512f_ops = {
+	.compute_native = fletcher_4_avx512f_native,
+	.compute_byteswap = fletcher_4_avx512f_byteswap,
+	.valid = fletcher_4_avx512f_valid,
+	.nlanes = 8,
+	.blocksize = 32,
+	.name = "avx512f"
+};
+
+#endif /* __x86_64 && HAVE_AVX512F && HAVE_AVX2 */
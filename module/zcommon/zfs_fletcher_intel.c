@@ -0,0 +1,118 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AVX2 fletcher 4 implementation.  Four 64-bit lanes per accumulator
+ * are kept in %ymm0-%ymm3 and vpmovzxdq widens four input words
+ * straight from memory, one word per lane, on each loop iteration.
+ */
+
+#if defined(__x86_64) && defined(HAVE_AVX2)
+
+#include <sys/types.h>
+#include <linux/simd_x86.h>
+#include <zfs_fletcher.h>
+
+#define	FLETCHER_4_AVX2_LOAD						\
+	"vmovdqu 0(%[ctx]), %%ymm0\n"					\
+	"vmovdqu 64(%[ctx]), %%ymm1\n"					\
+	"vmovdqu 128(%[ctx]), %%ymm2\n"					\
+	"vmovdqu 192(%[ctx]), %%ymm3\n"
+
+#define	FLETCHER_4_AVX2_STEP						\
+	"vpaddq	%%ymm4, %%ymm0, %%ymm0\n"				\
+	"vpaddq	%%ymm0, %%ymm1, %%ymm1\n"				\
+	"vpaddq	%%ymm1, %%ymm2, %%ymm2\n"				\
+	"vpaddq	%%ymm2, %%ymm3, %%ymm3\n"				\
+	"add	$16, %[ip]\n"						\
+	"cmp	%[end], %[ip]\n"					\
+	"jb	1b\n"
+
+#define	FLETCHER_4_AVX2_STORE						\
+	"vmovdqu %%ymm0, 0(%[ctx])\n"					\
+	"vmovdqu %%ymm1, 64(%[ctx])\n"					\
+	"vmovdqu %%ymm2, 128(%[ctx])\n"					\
+	"vmovdqu %%ymm3, 192(%[ctx])\n"					\
+	"vzeroupper\n"
+
+static void
+fletcher_4_avx2_native(fletcher_4_ctx_t *ctx, const void *buf, uint64_t size)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + size;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    FLETCHER_4_AVX2_LOAD
+	    "1:\n"
+	    "vpmovzxdq (%[ip]), %%ymm4\n"
+	    FLETCHER_4_AVX2_STEP
+	    FLETCHER_4_AVX2_STORE
+	    : [ip] "+r" (ip)
+	    : [ctx] "r" (ctx), [end] "r" (ipend)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4");
+	kfpu_end();
+}
+
+static const uint8_t fletcher_4_avx2_mask[16] = {
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+
+static void
+fletcher_4_avx2_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + size;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    FLETCHER_4_AVX2_LOAD
+	    "vmovdqu (%[mask]), %%xmm5\n"
+	    "1:\n"
+	    "vmovdqu (%[ip]), %%xmm4\n"
+	    "vpshufb %%xmm5, %%xmm4, %%xmm4\n"
+	    "vpmovzxdq %%xmm4, %%ymm4\n"
+	    FLETCHER_4_AVX2_STEP
+	    FLETCHER_4_AVX2_STORE
+	    : [ip] "+r" (ip)
+	    : [ctx] "r" (ctx), [end] "r" (ipend),
+	    [mask] "r" (fletcher_4_avx2_mask)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5");
+	kfpu_end();
+}
+
+static boolean_t
+fletcher_4_avx2_valid(void)
+{
+	return (zfs_avx2_available());
+}
+
+const fletcher_4_ops_t fletcher_4_avx2_ops = {
+	.compute_native = fletcher_4_avx2_native,
+	.compute_byteswap = fletcher_4_avx2_byteswap,
+	.valid = fletcher_4_avx2_valid,
+	.nlanes = 4,
+	.blocksize = 16,
+	.name = "avx2"
+};
+
+#endif /* __x86_64 && HAVE_AVX2 */
@@ -0,0 +1,177 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SSE2 and SSSE3 fletcher 4 implementations.  Both keep two 64-bit
+ * lanes per accumulator in %xmm0-%xmm3 and consume 16 bytes per loop
+ * iteration: words 0 and 2 go to lane 0, words 1 and 3 to lane 1.
+ * SSSE3 only differs in using pshufb to byteswap the input.
+ */
+
+#if defined(__x86_64) && defined(HAVE_SSE2)
+
+#include <sys/types.h>
+#include <linux/simd_x86.h>
+#include <zfs_fletcher.h>
+
+#define	FLETCHER_4_SSE_LOAD						\
+	"movdqu	0(%[ctx]), %%xmm0\n"					\
+	"movdqu	64(%[ctx]), %%xmm1\n"					\
+	"movdqu	128(%[ctx]), %%xmm2\n"					\
+	"movdqu	192(%[ctx]), %%xmm3\n"					\
+	"pxor	%%xmm7, %%xmm7\n"
+
+/* Widen the four words in %xmm4 and add them to both lanes. */
+#define	FLETCHER_4_SSE_STEP						\
+	"movdqa	%%xmm4, %%xmm5\n"					\
+	"punpckldq %%xmm7, %%xmm4\n"					\
+	"punpckhdq %%xmm7, %%xmm5\n"					\
+	"paddq	%%xmm4, %%xmm0\n"					\
+	"paddq	%%xmm0, %%xmm1\n"					\
+	"paddq	%%xmm1, %%xmm2\n"					\
+	"paddq	%%xmm2, %%xmm3\n"					\
+	"paddq	%%xmm5, %%xmm0\n"					\
+	"paddq	%%xmm0, %%xmm1\n"					\
+	"paddq	%%xmm1, %%xmm2\n"					\
+	"paddq	%%xmm2, %%xmm3\n"					\
+	"add	$16, %[ip]\n"						\
+	"cmp	%[end], %[ip]\n"					\
+	"jb	1b\n"
+
+#define	FLETCHER_4_SSE_STORE						\
+	"movdqu	%%xmm0, 0(%[ctx])\n"					\
+	"movdqu	%%xmm1, 64(%[ctx])\n"					\
+	"movdqu	%%xmm2, 128(%[ctx])\n"					\
+	"movdqu	%%xmm3, 192(%[ctx])\n"
+
+static void
+fletcher_4_sse2_native(fletcher_4_ctx_t *ctx, const void *buf, uint64_t size)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + size;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    FLETCHER_4_SSE_LOAD
+	    "1:\n"
+	    "movdqu	(%[ip]), %%xmm4\n"
+	    FLETCHER_4_SSE_STEP
+	    FLETCHER_4_SSE_STORE
+	    : [ip] "+r" (ip)
+	    : [ctx] "r" (ctx), [end] "r" (ipend)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+	    "xmm7");
+	kfpu_end();
+}
+
+static void
+fletcher_4_sse2_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + size;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    FLETCHER_4_SSE_LOAD
+	    "1:\n"
+	    "movdqu	(%[ip]), %%xmm4\n"
+	    /* swap the 16-bit halves, then the bytes within each half */
+	    "movdqa	%%xmm4, %%xmm5\n"
+	    "pslld	$16, %%xmm4\n"
+	    "psrld	$16, %%xmm5\n"
+	    "por	%%xmm5, %%xmm4\n"
+	    "movdqa	%%xmm4, %%xmm5\n"
+	    "psllw	$8, %%xmm4\n"
+	    "psrlw	$8, %%xmm5\n"
+	    "por	%%xmm5, %%xmm4\n"
+	    FLETCHER_4_SSE_STEP
+	    FLETCHER_4_SSE_STORE
+	    : [ip] "+r" (ip)
+	    : [ctx] "r" (ctx), [end] "r" (ipend)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+	    "xmm7");
+	kfpu_end();
+}
+
+static boolean_t
+fletcher_4_sse2_valid(void)
+{
+	return (zfs_sse2_available());
+}
+
+const fletcher_4_ops_t fletcher_4_sse2_ops = {
+	.compute_native = fletcher_4_sse2_native,
+	.compute_byteswap = fletcher_4_sse2_byteswap,
+	.valid = fletcher_4_sse2_valid,
+	.nlanes = 2,
+	.blocksize = 16,
+	.name = "sse2"
+};
+
+#if defined(HAVE_SSSE3)
+
+static const uint8_t fletcher_4_ssse3_mask[16] = {
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+
+static void
+fletcher_4_ssse3_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + size;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    FLETCHER_4_SSE_LOAD
+	    "movdqu	(%[mask]), %%xmm6\n"
+	    "1:\n"
+	    "movdqu	(%[ip]), %%xmm4\n"
+	    "pshufb	%%xmm6, %%xmm4\n"
+	    FLETCHER_4_SSE_STEP
+	    FLETCHER_4_SSE_STORE
+	    : [ip] "+r" (ip)
+	    : [ctx] "r" (ctx), [end] "r" (ipend),
+	    [mask] "r" (fletcher_4_ssse3_mask)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+	    "xmm6", "xmm7");
+	kfpu_end();
+}
+
+static boolean_t
+fletcher_4_ssse3_valid(void)
+{
+	return (zfs_sse2_available() && zfs_ssse3_available());
+}
+
+const fletcher_4_ops_t fletcher_4_ssse3_ops = {
+	.compute_native = fletcher_4_sse2_native,
+	.compute_byteswap = fletcher_4_ssse3_byteswap,
+	.valid = fletcher_4_ssse3_valid,
+	.nlanes = 2,
+	.blocksize = 16,
+	.name = "ssse3"
+};
+
+#endif /* HAVE_SSSE3 */
+
+#endif /* __x86_64 && HAVE_SSE2 */
@@ -34,6 +34,7 @@
 
 #include "zfs_prop.h"
 #include "zfs_deleg.h"
+#include "zfs_fletcher.h"
 
 #if defined(_KERNEL)
 #include <sys/systm.h>
@@ -68,6 +69,8 @@ zfs_prop_init(void)
 		{ "fletcher2",	ZIO_CHECKSUM_FLETCHER_2 },
 		{ "fletcher4",	ZIO_CHECKSUM_FLETCHER_4 },
 		{ "sha256",	ZIO_CHECKSUM_SHA256 },
+		{ "sha512",	ZIO_CHECKSUM_SHA512 },
+		{ "skein",	ZIO_CHECKSUM_SKEIN },
 		{ NULL }
 	};
 
@@ -78,6 +81,12 @@ zfs_prop_init(void)
 		{ "sha256",	ZIO_CHECKSUM_SHA256 },
 		{ "sha256,verify",
 				ZIO_CHECKSUM_SHA256 | ZIO_CHECKSUM_VERIFY },
+		{ "sha512",	ZIO_CHECKSUM_SHA512 },
+		{ "sha512,verify",
+				ZIO_CHECKSUM_SHA512 | ZIO_CHECKSUM_VERIFY },
+		{ "skein",	ZIO_CHECKSUM_SKEIN },
+		{ "skein,verify",
+				ZIO_CHECKSUM_SKEIN | ZIO_CHECKSUM_VERIFY },
 		{ NULL }
 	};
 
@@ -97,6 +106,26 @@ zfs_prop_init(void)
 		{ "gzip-9",	ZIO_COMPRESS_GZIP_9 },
 		{ "zle",	ZIO_COMPRESS_ZLE },
 		{ "lz4",	ZIO_COMPRESS_LZ4 },
+		{ "zstd",	ZIO_COMPRESS_ZSTD_3 },	/* zstd default */
+		{ "zstd-1",	ZIO_COMPRESS_ZSTD_1 },
+		{ "zstd-2",	ZIO_COMPRESS_ZSTD_2 },
+		{ "zstd-3",	ZIO_COMPRESS_ZSTD_3 },
+		{ "zstd-4",	ZIO_COMPRESS_ZSTD_4 },
+		{ "zstd-5",	ZIO_COMPRESS_ZSTD_5 },
+		{ "zstd-6",	ZIO_COMPRESS_ZSTD_6 },
+		{ "zstd-7",	ZIO_COMPRESS_ZSTD_7 },
+		{ "zstd-8",	ZIO_COMPRESS_ZSTD_8 },
+		{ "zstd-9",	ZIO_COMPRESS_ZSTD_9 },
+		{ "zstd-10",	ZIO_COMPRESS_ZSTD_10 },
+		{ "zstd-11",	ZIO_COMPRESS_ZSTD_11 },
+		{ "zstd-12",	ZIO_COMPRESS_ZSTD_12 },
+		{ "zstd-13",	ZIO_COMPRESS_ZSTD_13 },
+		{ "zstd-14",	ZIO_COMPRESS_ZSTD_14 },
+		{ "zstd-15",	ZIO_COMPRESS_ZSTD_15 },
+		{ "zstd-16",	ZIO_COMPRESS_ZSTD_16 },
+		{ "zstd-17",	ZIO_COMPRESS_ZSTD_17 },
+		{ "zstd-18",	ZIO_COMPRESS_ZSTD_18 },
+		{ "zstd-19",	ZIO_COMPRESS_ZSTD_19 },
 		{ NULL }
 	};
 
@@ -209,17 +238,17 @@ zfs_prop_init(void)
 	zprop_register_index(ZFS_PROP_CHECKSUM, "checksum",
 	    ZIO_CHECKSUM_DEFAULT, PROP_INHERIT, ZFS_TYPE_FILESYSTEM |
 	    ZFS_TYPE_VOLUME,
-	    "on | off | fletcher2 | fletcher4 | sha256", "CHECKSUM",
-	    checksum_table);
+	    "on | off | fletcher2 | fletcher4 | sha256 | sha512 | skein",
+	    "CHECKSUM", checksum_table);
 	zprop_register_index(ZFS_PROP_DEDUP, "dedup", ZIO_CHECKSUM_OFF,
 	    PROP_INHERIT, ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
-	    "on | off | verify | sha256[,verify]", "DEDUP",
-	    dedup_table);
+	    "on | off | verify | sha256[,verify] | sha512[,verify] | "
+	    "skein[,verify]", "DEDUP", dedup_table);
 	zprop_register_index(ZFS_PROP_COMPRESSION, "compression",
 	    ZIO_COMPRESS_DEFAULT, PROP_INHERIT,
 	    ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
-	    "on | off | lzjb | gzip | gzip-[1-9] | zle | lz4", "COMPRESS",
-	    compress_table);
+	    "on | off | lzjb | gzip | gzip-[1-9] | zle | lz4 | "
+	    "zstd | zstd-[1-19]", "COMPRESS", compress_table);
 	zprop_register_index(ZFS_PROP_SNAPDIR, "snapdir", ZFS_SNAPDIR_HIDDEN,
 	    PROP_INHERIT, ZFS_TYPE_FILESYSTEM,
 	    "hidden | visible", "SNAPDIR", snapdir_table);
@@ -633,8 +662,19 @@ zfs_prop_align_right(zfs_prop_t prop)
 
 #if defined(_KERNEL) && defined(HAVE_SPL)
 
-static int zcommon_init(void) { return 0; }
-static int zcommon_fini(void) { return 0; }
+static int
+zcommon_init(void)
+{
+	fletcher_4_init();
+	return (0);
+}
+
+static int
+zcommon_fini(void)
+{
+	fletcher_4_fini();
+	return (0);
+}
 
 spl_module_init(zcommon_init);
 spl_module_exit(zcommon_fini);
@@ -0,0 +1,1248 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * ARC buffer data (ABD).
+ *
+ * ABDs are an abstract data structure for the ARC which can use two
+ * different ways of storing the underlying data:
+ *
+ * (a) Linear buffer. In this case, all the data in the ABD is stored in one
+ *     contiguous buffer in memory (from a zio_[data_]buf_* kmem cache).
+ *
+ *         +-------------------+
+ *         | ABD (linear)      |
+ *         |   abd_flags = ... |
+ *         |   abd_size = ...  |     +--------------------------------+
+ *         |   abd_buf ------------->| raw buffer of size abd_size    |
+ *         +-------------------+     +--------------------------------+
+ *              no abd_chunks
+ *
+ * (b) Scattered buffer. In this case, the data in the ABD is split into
+ *     equal-sized chunks (from the abd_chunk_cache kmem_cache), with pointers
+ *     to the chunks recorded in an array at the end of the ABD structure.
+ *
+ *         +-------------------+
+ *         | ABD (scattered)   |
+ *         |   abd_flags = ... |
+ *         |   abd_size = ...  |
+ *         |   abd_offset = 0  |                           +-----------+
+ *         |   abd_chunks[0] ----------------------------->| chunk 0   |
+ *         |   abd_chunks[1] ---------------------+        +-----------+
+ *         |   ...             |                  |        +-----------+
+ *         |   abd_chunks[N-1] ---------+         +------->| chunk 1   |
+ *         +-------------------+        |                  +-----------+
+ *                                      |                      ...
+ *                                      |                  +-----------+
+ *                                      +----------------->| chunk N-1 |
+ *                                                         +-----------+
+ *
+ * (c) Gang buffer. In this case, the ABD is a chain of other linear or
+ *     scattered ABDs, linked through their abd_gang_link, whose contents
+ *     are presented back to back.  The gang owns its children and frees
+ *     (or puts) them when it is itself freed.
+ *
+ *         +-------------------+      +---------+      +---------+
+ *         | ABD (gang)        |      | ABD     |      | ABD     |
+ *         |   abd_gang_chain ------->|  child  |----->|  child  | ...
+ *         +-------------------+      +---------+      +---------+
+ *
+ *     Gang ABDs let vdev_queue aggregate adjacent I/Os into a single
+ *     device request without copying each child's data into (or out of)
+ *     a bounce buffer.  Holes in an aggregated write are filled from a
+ *     shared, read-only zero ABD (see abd_get_zeros()).
+ *
+ * Using a large proportion of scattered ABDs decreases ARC fragmentation
+ * since when we are at the limit of allocatable space, using equal-size
+ * chunks will allow us to quickly reclaim enough space for a new large
+ * allocation (assuming it is also scattered).  In the kernel the chunks
+ * are exactly one page each and are never backed by vmalloc(), so a
+ * scattered ABD can also be handed directly to the block layer.
+ *
+ * In addition to directly allocating a linear or scattered ABD, it is also
+ * possible to create an ABD by requesting the "sub-ABD" starting at an offset
+ * within an existing ABD.  In linear buffers this is simple (set abd_buf of
+ * the new ABD to the starting point within the original raw buffer), but
+ * scattered ABDs are a little more complex.  The new ABD makes a copy of the
+ * relevant abd_chunks pointers (but not the underlying data).  However, to
+ * provide arbitrary rather than only chunk-aligned starting offsets, it also
+ * tracks an abd_offset field which represents the starting point of the data
+ * within the first chunk in abd_chunks.  For both linear and scattered ABDs,
+ * creating an offset ABD marks the original ABD as the offset's parent, and
+ * the original ABD's abd_children refcount is incremented.  This data allows
+ * us to ensure the root ABD isn't deleted before its children.
+ *
+ * Most consumers should never need to know what type of ABD they're using --
+ * the ABD public API ensures that it's possible to transparently switch from
+ * using a linear ABD to a scattered one when doing so would be beneficial.
+ *
+ * If you need to use the data within an ABD directly, if you know it's linear
+ * (because you allocated it) you can use abd_to_buf() to access the
+ * underlying raw buffer.  Otherwise, you should use one of the abd_borrow_buf*
+ * functions which will allocate a raw buffer if necessary.  Use the
+ * abd_return_buf* functions to return any raw buffers that are no longer
+ * necessary when you're done using them.
+ *
+ * There are a variety of ABD APIs that implement basic buffer operations:
+ * compare, copy, read, write, and fill with zeroes.  If you need a custom
+ * function which progressively accesses the whole ABD, use the
+ * abd_iterate_* functions.
+ */
+
+#include <sys/abd.h>
+#include <sys/zio.h>
+#include <sys/zfs_context.h>
+#if defined(_KERNEL) && defined(HAVE_SPL)
+#include <linux/bio.h>
+#endif
+
+typedef struct abd_stats {
+	kstat_named_t abdstat_struct_size;
+	kstat_named_t abdstat_scatter_cnt;
+	kstat_named_t abdstat_scatter_data_size;
+	kstat_named_t abdstat_scatter_chunk_waste;
+	kstat_named_t abdstat_linear_cnt;
+	kstat_named_t abdstat_linear_data_size;
+} abd_stats_t;
+
+static abd_stats_t abd_stats = {
+	/* Amount of memory occupied by all of the abd_t struct allocations */
+	{ "struct_size",			KSTAT_DATA_UINT64 },
+	/*
+	 * The number of scatter ABDs which are currently allocated, excluding
+	 * ABDs which don't own their data (for instance the ones which were
+	 * allocated through abd_get_offset()).
+	 */
+	{ "scatter_cnt",			KSTAT_DATA_UINT64 },
+	/* Amount of data stored in all scatter ABDs tracked by scatter_cnt */
+	{ "scatter_data_size",			KSTAT_DATA_UINT64 },
+	/*
+	 * The amount of space wasted at the end of the last chunk across all
+	 * scatter ABDs tracked by scatter_cnt.
+	 */
+	{ "scatter_chunk_waste",		KSTAT_DATA_UINT64 },
+	/*
+	 * The number of linear ABDs which are currently allocated, excluding
+	 * ABDs which don't own their data (for instance the ones which were
+	 * allocated through abd_get_offset() and abd_get_from_buf()).  If an
+	 * ABD takes ownership of its buf then it will become tracked.
+	 */
+	{ "linear_cnt",				KSTAT_DATA_UINT64 },
+	/* Amount of data stored in all linear ABDs tracked by linear_cnt */
+	{ "linear_data_size",			KSTAT_DATA_UINT64 }
+};
+
+#define	ABDSTAT(stat)		(abd_stats.stat.value.ui64)
+#define	ABDSTAT_INCR(stat, val) \
+	atomic_add_64(&abd_stats.stat.value.ui64, (val))
+#define	ABDSTAT_BUMP(stat)	ABDSTAT_INCR(stat, 1)
+#define	ABDSTAT_BUMPDOWN(stat)	ABDSTAT_INCR(stat, -1)
+
+/*
+ * It is possible to make all future ABDs be linear by setting this to 0.
+ * Existing scattered ABDs are unaffected.
+ */
+int zfs_abd_scatter_enabled = B_TRUE;
+
+/*
+ * Allocations no larger than this are always made linear.  A scattered
+ * ABD carries a chunk pointer array and wastes the tail of its last
+ * chunk, which is not worth it for small buffers.
+ */
+size_t zfs_abd_scatter_min_size = 512 * 3;
+
+/*
+ * The size of the chunks ABD allocates.  This is fixed at the page size
+ * so that each chunk maps onto exactly one page for the block layer.
+ * It is set by abd_init() because PAGESIZE is not a constant in user space.
+ */
+static size_t zfs_abd_chunk_size;
+
+static kmem_cache_t *abd_chunk_cache;
+static kstat_t *abd_ksp;
+
+/*
+ * A scattered ABD of SPA_MAXBLOCKSIZE whose chunks all point at the same
+ * zero-filled page.  Views of it are handed out by abd_get_zeros() and
+ * must only ever be read from.
+ */
+static abd_t *abd_zero_scatter;
+static void *abd_zero_page;
+
+static abd_t *abd_alloc_struct(size_t chunkcnt);
+static void abd_free_struct(abd_t *abd);
+
+static void *
+abd_alloc_chunk(void)
+{
+	void *c = kmem_cache_alloc(abd_chunk_cache, KM_PUSHPAGE);
+	ASSERT3P(c, !=, NULL);
+	return (c);
+}
+
+static void
+abd_free_chunk(void *c)
+{
+	kmem_cache_free(abd_chunk_cache, c);
+}
+
+void
+abd_init(void)
+{
+	size_t i, n;
+
+	zfs_abd_chunk_size = PAGESIZE;
+
+	/*
+	 * The chunks must come from the kmem (not vmem) backed slabs so
+	 * that they are directly mapped and page aligned.
+	 */
+	abd_chunk_cache = kmem_cache_create("abd_chunk", zfs_abd_chunk_size,
+	    zfs_abd_chunk_size, NULL, NULL, NULL, NULL, NULL, KMC_KMEM);
+
+	abd_zero_page = abd_alloc_chunk();
+	bzero(abd_zero_page, zfs_abd_chunk_size);
+
+	n = SPA_MAXBLOCKSIZE / zfs_abd_chunk_size;
+	abd_zero_scatter = abd_alloc_struct(n);
+	abd_zero_scatter->abd_flags = 0;
+	abd_zero_scatter->abd_size = SPA_MAXBLOCKSIZE;
+	abd_zero_scatter->abd_parent = NULL;
+	refcount_create(&abd_zero_scatter->abd_children);
+	abd_zero_scatter->abd_u.abd_scatter.abd_offset = 0;
+	abd_zero_scatter->abd_u.abd_scatter.abd_chunk_size =
+	    zfs_abd_chunk_size;
+	for (i = 0; i < n; i++)
+		abd_zero_scatter->abd_u.abd_scatter.abd_chunks[i] =
+		    abd_zero_page;
+
+	abd_ksp = kstat_create("zfs", 0, "abdstats", "misc", KSTAT_TYPE_NAMED,
+	    sizeof (abd_stats) / sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	if (abd_ksp != NULL) {
+		abd_ksp->ks_data = &abd_stats;
+		kstat_install(abd_ksp);
+	}
+}
+
+void
+abd_fini(void)
+{
+	if (abd_ksp != NULL) {
+		kstat_delete(abd_ksp);
+		abd_ksp = NULL;
+	}
+
+	refcount_destroy(&abd_zero_scatter->abd_children);
+	abd_free_struct(abd_zero_scatter);
+	abd_zero_scatter = NULL;
+	abd_free_chunk(abd_zero_page);
+	abd_zero_page = NULL;
+
+	kmem_cache_destroy(abd_chunk_cache);
+	abd_chunk_cache = NULL;
+}
+
+static inline size_t
+abd_chunkcnt_for_bytes(size_t size)
+{
+	return (P2ROUNDUP(size, zfs_abd_chunk_size) / zfs_abd_chunk_size);
+}
+
+static inline size_t
+abd_scatter_chunkcnt(abd_t *abd)
+{
+	ASSERT(!abd_is_linear(abd));
+	return (abd_chunkcnt_for_bytes(
+	    abd->abd_u.abd_scatter.abd_offset + abd->abd_size));
+}
+
+static inline void
+abd_verify(abd_t *abd)
+{
+	ASSERT3U(abd->abd_size, >, 0);
+	ASSERT3U(abd->abd_size, <=, SPA_MAXBLOCKSIZE);
+	ASSERT3U(abd->abd_flags, ==, abd->abd_flags & (ABD_FLAG_LINEAR |
+	    ABD_FLAG_OWNER | ABD_FLAG_META | ABD_FLAG_GANG));
+	ASSERT(abd->abd_parent == NULL ||
+	    !(abd->abd_flags & ABD_FLAG_OWNER));
+	ASSERT(!(abd->abd_flags & ABD_FLAG_META) ||
+	    (abd->abd_flags & ABD_FLAG_OWNER));
+	if (abd_is_linear(abd)) {
+		ASSERT3P(abd->abd_u.abd_linear.abd_buf, !=, NULL);
+	} else if (abd_is_gang(abd)) {
+		list_t *chain = &abd->abd_u.abd_gang.abd_gang_chain;
+		abd_t *cabd;
+		size_t size = 0;
+
+		for (cabd = list_head(chain); cabd != NULL;
+		    cabd = list_next(chain, cabd)) {
+			ASSERT(!abd_is_gang(cabd));
+			size += cabd->abd_size;
+		}
+		ASSERT3U(size, ==, abd->abd_size);
+	} else {
+		size_t n;
+		int i;
+
+		ASSERT3U(abd->abd_u.abd_scatter.abd_offset, <,
+		    zfs_abd_chunk_size);
+		n = abd_scatter_chunkcnt(abd);
+		for (i = 0; i < n; i++) {
+			ASSERT3P(
+			    abd->abd_u.abd_scatter.abd_chunks[i], !=, NULL);
+		}
+	}
+}
+
+/*
+ * Never allocate less than a whole abd_t, even for linear ABDs which have
+ * no chunk array, so that every field of the structure is addressable.
+ */
+static inline size_t
+abd_scatter_size(size_t chunkcnt)
+{
+	return (MAX(sizeof (abd_t),
+	    offsetof(abd_t, abd_u.abd_scatter.abd_chunks) +
+	    chunkcnt * sizeof (void *)));
+}
+
+static abd_t *
+abd_alloc_struct(size_t chunkcnt)
+{
+	size_t size = abd_scatter_size(chunkcnt);
+	abd_t *abd = kmem_alloc(size, KM_PUSHPAGE);
+
+	ASSERT3P(abd, !=, NULL);
+	list_link_init(&abd->abd_gang_link);
+	ABDSTAT_INCR(abdstat_struct_size, size);
+
+	return (abd);
+}
+
+static void
+abd_free_struct(abd_t *abd)
+{
+	size_t chunkcnt = (abd_is_linear(abd) || abd_is_gang(abd)) ?
+	    0 : abd_scatter_chunkcnt(abd);
+	size_t size = abd_scatter_size(chunkcnt);
+
+	kmem_free(abd, size);
+	ABDSTAT_INCR(abdstat_struct_size, -size);
+}
+
+/*
+ * Allocate an ABD, along with its own underlying data buffers.  Use this if
+ * you don't care whether the ABD is linear or not.
+ */
+abd_t *
+abd_alloc(size_t size, boolean_t is_metadata)
+{
+	abd_t *abd;
+	size_t i, n;
+
+	if (!zfs_abd_scatter_enabled || size <= zfs_abd_scatter_min_size)
+		return (abd_alloc_linear(size, is_metadata));
+
+	VERIFY3U(size, <=, SPA_MAXBLOCKSIZE);
+
+	n = abd_chunkcnt_for_bytes(size);
+	abd = abd_alloc_struct(n);
+
+	abd->abd_flags = ABD_FLAG_OWNER;
+	if (is_metadata)
+		abd->abd_flags |= ABD_FLAG_META;
+	abd->abd_size = size;
+	abd->abd_parent = NULL;
+	refcount_create(&abd->abd_children);
+
+	abd->abd_u.abd_scatter.abd_offset = 0;
+	abd->abd_u.abd_scatter.abd_chunk_size = zfs_abd_chunk_size;
+
+	for (i = 0; i < n; i++)
+		abd->abd_u.abd_scatter.abd_chunks[i] = abd_alloc_chunk();
+
+	ABDSTAT_BUMP(abdstat_scatter_cnt);
+	ABDSTAT_INCR(abdstat_scatter_data_size, size);
+	ABDSTAT_INCR(abdstat_scatter_chunk_waste,
+	    n * zfs_abd_chunk_size - size);
+
+	return (abd);
+}
+
+static void
+abd_free_scatter(abd_t *abd)
+{
+	size_t i, n = abd_scatter_chunkcnt(abd);
+
+	for (i = 0; i < n; i++)
+		abd_free_chunk(abd->abd_u.abd_scatter.abd_chunks[i]);
+
+	refcount_destroy(&abd->abd_children);
+	ABDSTAT_BUMPDOWN(abdstat_scatter_cnt);
+	ABDSTAT_INCR(abdstat_scatter_data_size, -(int)abd->abd_size);
+	ABDSTAT_INCR(abdstat_scatter_chunk_waste,
+	    abd->abd_size - n * zfs_abd_chunk_size);
+
+	abd_free_struct(abd);
+}
+
+/*
+ * Allocate an ABD that must be linear, along with its own underlying data
+ * buffer.  Only use this when it would be very annoying to write your ABD
+ * consumer with a scattered ABD.
+ */
+abd_t *
+abd_alloc_linear(size_t size, boolean_t is_metadata)
+{
+	abd_t *abd = abd_alloc_struct(0);
+
+	VERIFY3U(size, <=, SPA_MAXBLOCKSIZE);
+
+	abd->abd_flags = ABD_FLAG_LINEAR | ABD_FLAG_OWNER;
+	if (is_metadata)
+		abd->abd_flags |= ABD_FLAG_META;
+	abd->abd_size = size;
+	abd->abd_parent = NULL;
+	refcount_create(&abd->abd_children);
+
+	if (is_metadata) {
+		abd->abd_u.abd_linear.abd_buf = zio_buf_alloc(size);
+	} else {
+		abd->abd_u.abd_linear.abd_buf = zio_data_buf_alloc(size);
+	}
+
+	ABDSTAT_BUMP(abdstat_linear_cnt);
+	ABDSTAT_INCR(abdstat_linear_data_size, size);
+
+	return (abd);
+}
+
+static void
+abd_free_linear(abd_t *abd)
+{
+	if (abd->abd_flags & ABD_FLAG_META) {
+		zio_buf_free(abd->abd_u.abd_linear.abd_buf, abd->abd_size);
+	} else {
+		zio_data_buf_free(abd->abd_u.abd_linear.abd_buf, abd->abd_size);
+	}
+
+	refcount_destroy(&abd->abd_children);
+	ABDSTAT_BUMPDOWN(abdstat_linear_cnt);
+	ABDSTAT_INCR(abdstat_linear_data_size, -(int)abd->abd_size);
+
+	abd_free_struct(abd);
+}
+
+/*
+ * Allocate an empty gang ABD.  Children are appended with abd_gang_add()
+ * and are released along with the gang by abd_free().
+ */
+abd_t *
+abd_alloc_gang(void)
+{
+	abd_t *abd = abd_alloc_struct(0);
+
+	abd->abd_flags = ABD_FLAG_GANG | ABD_FLAG_OWNER;
+	abd->abd_size = 0;
+	abd->abd_parent = NULL;
+	refcount_create(&abd->abd_children);
+	list_create(&abd->abd_u.abd_gang.abd_gang_chain, sizeof (abd_t),
+	    offsetof(abd_t, abd_gang_link));
+
+	return (abd);
+}
+
+static void
+abd_free_gang(abd_t *abd)
+{
+	list_t *chain = &abd->abd_u.abd_gang.abd_gang_chain;
+	abd_t *cabd;
+
+	while ((cabd = list_remove_head(chain)) != NULL) {
+		if (cabd->abd_flags & ABD_FLAG_OWNER)
+			abd_free(cabd);
+		else
+			abd_put(cabd);
+	}
+	list_destroy(chain);
+
+	refcount_destroy(&abd->abd_children);
+	abd_free_struct(abd);
+}
+
+/*
+ * Free an ABD.  Only use this on ABDs allocated with abd_alloc(),
+ * abd_alloc_linear() or abd_alloc_gang(), or on ABDs which have taken
+ * ownership of their buffer with abd_take_ownership_of_buf().
+ */
+void
+abd_free(abd_t *abd)
+{
+	ASSERT3P(abd->abd_parent, ==, NULL);
+	ASSERT(abd->abd_flags & ABD_FLAG_OWNER);
+	if (abd_is_gang(abd)) {
+		abd_free_gang(abd);
+		return;
+	}
+
+	abd_verify(abd);
+	if (abd_is_linear(abd))
+		abd_free_linear(abd);
+	else
+		abd_free_scatter(abd);
+}
+
+/*
+ * Append cabd to the end of the gang ABD pabd.  The gang takes over
+ * cabd: it is freed with abd_free() if it owns its data and released
+ * with abd_put() otherwise when the gang is freed.  A child may only
+ * belong to one gang at a time, so a buffer shared between I/Os should
+ * be added as a view from abd_get_offset_size().
+ */
+void
+abd_gang_add(abd_t *pabd, abd_t *cabd)
+{
+	ASSERT(abd_is_gang(pabd));
+	ASSERT(!abd_is_gang(cabd));
+	ASSERT(!list_link_active(&cabd->abd_gang_link));
+	abd_verify(cabd);
+
+	list_insert_tail(&pabd->abd_u.abd_gang.abd_gang_chain, cabd);
+	pabd->abd_size += cabd->abd_size;
+	ASSERT3U(pabd->abd_size, <=, SPA_MAXBLOCKSIZE);
+}
+
+/*
+ * Return the child of a gang ABD which holds offset *off, and convert
+ * *off to an offset within that child.  Returns NULL if *off is at or
+ * past the end of the gang.
+ */
+abd_t *
+abd_gang_get_offset(abd_t *abd, size_t *off)
+{
+	list_t *chain = &abd->abd_u.abd_gang.abd_gang_chain;
+	abd_t *cabd;
+
+	ASSERT(abd_is_gang(abd));
+	for (cabd = list_head(chain); cabd != NULL;
+	    cabd = list_next(chain, cabd)) {
+		if (*off < cabd->abd_size)
+			return (cabd);
+		*off -= cabd->abd_size;
+	}
+
+	return (NULL);
+}
+
+/*
+ * Return the child following cabd in a gang ABD, or NULL.
+ */
+abd_t *
+abd_gang_next(abd_t *abd, abd_t *cabd)
+{
+	ASSERT(abd_is_gang(abd));
+	return (list_next(&abd->abd_u.abd_gang.abd_gang_chain, cabd));
+}
+
+/*
+ * Allocate an ABD of the same format (same metadata flag, same scatterize
+ * setting) as another ABD.
+ */
+abd_t *
+abd_alloc_sametype(abd_t *sabd, size_t size)
+{
+	boolean_t is_metadata = (sabd->abd_flags & ABD_FLAG_META) != 0;
+	ASSERT(!abd_is_gang(sabd));
+	if (abd_is_linear(sabd)) {
+		return (abd_alloc_linear(size, is_metadata));
+	} else {
+		return (abd_alloc(size, is_metadata));
+	}
+}
+
+/*
+ * If we're going to use this ABD for doing I/O using the block layer, the
+ * consumer of the ABD data doesn't care if it's scattered or not, and we
+ * don't plan to store this ABD in memory for a long period of time, we
+ * should allocate the ABD type that requires the least data copying to do
+ * the I/O.  Both vdev_disk and vdev_file can consume scattered buffers
+ * directly, so there is nothing to be gained from a linear ABD here.
+ */
+abd_t *
+abd_alloc_for_io(size_t size, boolean_t is_metadata)
+{
+	return (abd_alloc(size, is_metadata));
+}
+
+/*
+ * Allocate a new ABD to point to offset off of sabd.  It shares the
+ * underlying buffer data with sabd.  Use abd_put() to free.  sabd must not
+ * be freed while any derived ABDs exist.
+ */
+static abd_t *
+abd_get_offset_impl(abd_t *sabd, size_t off, size_t size)
+{
+	abd_t *abd;
+
+	abd_verify(sabd);
+	ASSERT(!abd_is_gang(sabd));
+	ASSERT3U(off, <=, sabd->abd_size);
+	ASSERT3U(size, >, 0);
+	ASSERT3U(off + size, <=, sabd->abd_size);
+
+	if (abd_is_linear(sabd)) {
+		abd = abd_alloc_struct(0);
+
+		/*
+		 * Even if this buf is filesystem metadata, we only track that
+		 * if we own the underlying data buffer, which is not true in
+		 * this case.  Therefore, we don't ever use ABD_FLAG_META here.
+		 */
+		abd->abd_flags = ABD_FLAG_LINEAR;
+
+		abd->abd_u.abd_linear.abd_buf =
+		    (char *)sabd->abd_u.abd_linear.abd_buf + off;
+	} else {
+		size_t new_offset = sabd->abd_u.abd_scatter.abd_offset + off;
+		size_t chunkcnt = abd_chunkcnt_for_bytes(
+		    (new_offset % zfs_abd_chunk_size) + size);
+
+		abd = abd_alloc_struct(chunkcnt);
+
+		/*
+		 * Even if this buf is filesystem metadata, we only track that
+		 * if we own the underlying data buffer, which is not true in
+		 * this case.  Therefore, we don't ever use ABD_FLAG_META here.
+		 */
+		abd->abd_flags = 0;
+
+		abd->abd_u.abd_scatter.abd_offset =
+		    new_offset % zfs_abd_chunk_size;
+		abd->abd_u.abd_scatter.abd_chunk_size = zfs_abd_chunk_size;
+
+		/* Copy the scatterlist starting at the correct offset */
+		(void) memcpy(&abd->abd_u.abd_scatter.abd_chunks,
+		    &sabd->abd_u.abd_scatter.abd_chunks[new_offset /
+		    zfs_abd_chunk_size],
+		    chunkcnt * sizeof (void *));
+	}
+
+	abd->abd_size = size;
+	abd->abd_parent = sabd;
+	refcount_create(&abd->abd_children);
+	(void) refcount_add_many(&sabd->abd_children, abd->abd_size, abd);
+
+	return (abd);
+}
+
+abd_t *
+abd_get_offset(abd_t *sabd, size_t off)
+{
+	return (abd_get_offset_impl(sabd, off, sabd->abd_size - off));
+}
+
+abd_t *
+abd_get_offset_size(abd_t *sabd, size_t off, size_t size)
+{
+	return (abd_get_offset_impl(sabd, off, size));
+}
+
+/*
+ * Allocate a linear ABD structure for buf.  You must free this with
+ * abd_put() since the resulting ABD doesn't own its own buffer.
+ */
+abd_t *
+abd_get_from_buf(void *buf, size_t size)
+{
+	abd_t *abd = abd_alloc_struct(0);
+
+	VERIFY3U(size, <=, SPA_MAXBLOCKSIZE);
+
+	/*
+	 * Even if this buf is filesystem metadata, we only track that if we
+	 * own the underlying data buffer, which is not true in this case.
+	 * Therefore, we don't ever use ABD_FLAG_META here.
+	 */
+	abd->abd_flags = ABD_FLAG_LINEAR;
+	abd->abd_size = size;
+	abd->abd_parent = NULL;
+	refcount_create(&abd->abd_children);
+
+	abd->abd_u.abd_linear.abd_buf = buf;
+
+	return (abd);
+}
+
+/*
+ * Return a read-only ABD of size zero bytes, for use as the source of
+ * writes which only need to put zeros on disk.  Release with abd_put().
+ */
+abd_t *
+abd_get_zeros(size_t size)
+{
+	ASSERT3P(abd_zero_scatter, !=, NULL);
+	ASSERT3U(size, <=, SPA_MAXBLOCKSIZE);
+	return (abd_get_offset_size(abd_zero_scatter, 0, size));
+}
+
+/*
+ * Free an ABD allocated from abd_get_offset() or abd_get_from_buf().  Will
+ * not free the underlying scatterlist or buffer.
+ */
+void
+abd_put(abd_t *abd)
+{
+	abd_verify(abd);
+	ASSERT(!(abd->abd_flags & ABD_FLAG_OWNER));
+
+	if (abd->abd_parent != NULL) {
+		(void) refcount_remove_many(&abd->abd_parent->abd_children,
+		    abd->abd_size, abd);
+	}
+
+	refcount_destroy(&abd->abd_children);
+	abd_free_struct(abd);
+}
+
+/*
+ * Get the raw buffer associated with a linear ABD.
+ */
+void *
+abd_to_buf(abd_t *abd)
+{
+	ASSERT(abd_is_linear(abd));
+	abd_verify(abd);
+	return (abd->abd_u.abd_linear.abd_buf);
+}
+
+/*
+ * Borrow a raw buffer from an ABD without copying the contents of the ABD
+ * into the buffer.  If the ABD is scattered, this will allocate a raw buffer
+ * whose contents are undefined.  To copy over the existing data in the ABD,
+ * use abd_borrow_buf_copy() instead.
+ */
+void *
+abd_borrow_buf(abd_t *abd, size_t n)
+{
+	void *buf;
+
+	abd_verify(abd);
+	ASSERT3U(abd->abd_size, >=, n);
+	if (abd_is_linear(abd)) {
+		buf = abd_to_buf(abd);
+	} else {
+		buf = zio_buf_alloc(n);
+	}
+	(void) refcount_add_many(&abd->abd_children, n, buf);
+
+	return (buf);
+}
+
+void *
+abd_borrow_buf_copy(abd_t *abd, size_t n)
+{
+	void *buf = abd_borrow_buf(abd, n);
+	if (!abd_is_linear(abd)) {
+		abd_copy_to_buf(buf, abd, n);
+	}
+	return (buf);
+}
+
+/*
+ * Return a borrowed raw buffer to an ABD.  If the ABD is scattered, this will
+ * not change the contents of the ABD and will ASSERT that you didn't modify
+ * the buffer since it was borrowed.  If you want any changes you made to buf
+ * to be copied back to abd, use abd_return_buf_copy() instead.
+ */
+void
+abd_return_buf(abd_t *abd, void *buf, size_t n)
+{
+	abd_verify(abd);
+	ASSERT3U(abd->abd_size, >=, n);
+	if (abd_is_linear(abd)) {
+		ASSERT3P(buf, ==, abd_to_buf(abd));
+	} else {
+		ASSERT0(abd_cmp_buf(abd, buf, n));
+		zio_buf_free(buf, n);
+	}
+	(void) refcount_remove_many(&abd->abd_children, n, buf);
+}
+
+void
+abd_return_buf_copy(abd_t *abd, void *buf, size_t n)
+{
+	if (!abd_is_linear(abd)) {
+		abd_copy_from_buf(abd, buf, n);
+	}
+	abd_return_buf(abd, buf, n);
+}
+
+/*
+ * Give this ABD ownership of the buffer that it's storing.  Can only be used
+ * on linear ABDs which were allocated via abd_get_from_buf(), or ones
+ * allocated with abd_alloc_linear() which subsequently released ownership of
+ * their buf with abd_release_ownership_of_buf().  The buffer must have been
+ * allocated with zio_buf_alloc() if is_metadata, else zio_data_buf_alloc().
+ */
+void
+abd_take_ownership_of_buf(abd_t *abd, boolean_t is_metadata)
+{
+	ASSERT(abd_is_linear(abd));
+	ASSERT(!(abd->abd_flags & ABD_FLAG_OWNER));
+	abd_verify(abd);
+
+	abd->abd_flags |= ABD_FLAG_OWNER;
+	if (is_metadata) {
+		abd->abd_flags |= ABD_FLAG_META;
+	}
+
+	ABDSTAT_BUMP(abdstat_linear_cnt);
+	ABDSTAT_INCR(abdstat_linear_data_size, abd->abd_size);
+}
+
+void
+abd_release_ownership_of_buf(abd_t *abd)
+{
+	ASSERT(abd_is_linear(abd));
+	ASSERT(abd->abd_flags & ABD_FLAG_OWNER);
+	abd_verify(abd);
+
+	abd->abd_flags &= ~ABD_FLAG_OWNER;
+	/* Disable this flag since we no longer own the data buffer */
+	abd->abd_flags &= ~ABD_FLAG_META;
+
+	ABDSTAT_BUMPDOWN(abdstat_linear_cnt);
+	ABDSTAT_INCR(abdstat_linear_data_size, -(int)abd->abd_size);
+}
+
+struct abd_iter {
+	abd_t		*iter_abd;	/* ABD being iterated through */
+	size_t		iter_pos;	/* position (relative to abd_offset) */
+	void		*iter_mapaddr;	/* addr corresponding to iter_pos */
+	size_t		iter_mapsize;	/* length of data valid at mapaddr */
+};
+
+/*
+ * Initialize the abd_iter.
+ */
+static void
+abd_iter_init(struct abd_iter *aiter, abd_t *abd)
+{
+	abd_verify(abd);
+	aiter->iter_abd = abd;
+	aiter->iter_pos = 0;
+	aiter->iter_mapaddr = NULL;
+	aiter->iter_mapsize = 0;
+}
+
+/*
+ * Advance the iterator by a certain amount.  Cannot be called when a chunk
+ * is in use.  This can be safely called when the aiter has already been
+ * exhausted, in which case this does nothing.
+ */
+static void
+abd_iter_advance(struct abd_iter *aiter, size_t amount)
+{
+	ASSERT3P(aiter->iter_mapaddr, ==, NULL);
+	ASSERT0(aiter->iter_mapsize);
+
+	/* There's nothing left to advance to, so do nothing */
+	if (aiter->iter_pos == aiter->iter_abd->abd_size)
+		return;
+
+	aiter->iter_pos += amount;
+}
+
+/*
+ * Map the current chunk into aiter.  This can be safely called when the
+ * aiter has already been exhausted, in which case this does nothing.  The
+ * chunks are never highmem or vmalloc pages, so no kernel mapping needs to
+ * be set up.
+ */
+static void
+abd_iter_map(struct abd_iter *aiter)
+{
+	abd_t *abd = aiter->iter_abd;
+	void *paddr;
+	size_t pos = aiter->iter_pos;
+	size_t offset = 0;
+
+	ASSERT3P(aiter->iter_mapaddr, ==, NULL);
+	ASSERT0(aiter->iter_mapsize);
+
+	/* There's nothing left to iterate over, so do nothing */
+	if (aiter->iter_pos == abd->abd_size)
+		return;
+
+	/*
+	 * For a gang ABD, map from the child holding iter_pos.  The mapping
+	 * never extends past the end of that child.
+	 */
+	if (abd_is_gang(abd)) {
+		abd = abd_gang_get_offset(abd, &pos);
+		ASSERT3P(abd, !=, NULL);
+	}
+
+	/* Panic if someone has changed zfs_abd_chunk_size */
+	ASSERT(abd_is_linear(abd) || zfs_abd_chunk_size ==
+	    abd->abd_u.abd_scatter.abd_chunk_size);
+
+	if (abd_is_linear(abd)) {
+		offset = pos;
+		aiter->iter_mapsize = abd->abd_size - offset;
+		paddr = abd->abd_u.abd_linear.abd_buf;
+	} else {
+		size_t index, chunk_offset;
+
+		offset = pos + abd->abd_u.abd_scatter.abd_offset;
+		index = offset / zfs_abd_chunk_size;
+		chunk_offset = offset % zfs_abd_chunk_size;
+		offset = chunk_offset;
+		aiter->iter_mapsize = MIN(zfs_abd_chunk_size - chunk_offset,
+		    abd->abd_size - pos);
+		paddr = abd->abd_u.abd_scatter.abd_chunks[index];
+	}
+	aiter->iter_mapaddr = (char *)paddr + offset;
+}
+
+/*
+ * Unmap the current chunk from aiter.  This can be safely called when the
+ * aiter has already been exhausted, in which case this does nothing.
+ */
+static void
+abd_iter_unmap(struct abd_iter *aiter)
+{
+	/* There's nothing left to unmap, so do nothing */
+	if (aiter->iter_pos == aiter->iter_abd->abd_size)
+		return;
+
+	ASSERT3P(aiter->iter_mapaddr, !=, NULL);
+	ASSERT3U(aiter->iter_mapsize, >, 0);
+
+	aiter->iter_mapaddr = NULL;
+	aiter->iter_mapsize = 0;
+}
+
+/*
+ * Call func on each contiguous segment of the range [off, off + size) of
+ * the ABD, stopping early if func returns non-zero.
+ */
+int
+abd_iterate_func(abd_t *abd, size_t off, size_t size,
+    abd_iter_func_t *func, void *private)
+{
+	int ret = 0;
+	struct abd_iter aiter;
+
+	abd_verify(abd);
+	ASSERT3U(off + size, <=, abd->abd_size);
+
+	abd_iter_init(&aiter, abd);
+	abd_iter_advance(&aiter, off);
+
+	while (size > 0) {
+		size_t len;
+
+		abd_iter_map(&aiter);
+
+		len = MIN(aiter.iter_mapsize, size);
+		ASSERT3U(len, >, 0);
+
+		ret = func(aiter.iter_mapaddr, len, private);
+
+		abd_iter_unmap(&aiter);
+
+		if (ret != 0)
+			break;
+
+		size -= len;
+		abd_iter_advance(&aiter, len);
+	}
+
+	return (ret);
+}
+
+struct buf_arg {
+	void *arg_buf;
+};
+
+static int
+abd_copy_to_buf_off_cb(void *buf, size_t size, void *private)
+{
+	struct buf_arg *ba_ptr = private;
+
+	(void) memcpy(ba_ptr->arg_buf, buf, size);
+	ba_ptr->arg_buf = (char *)ba_ptr->arg_buf + size;
+
+	return (0);
+}
+
+/*
+ * Copy abd to buf. (off is the offset in abd.)
+ */
+void
+abd_copy_to_buf_off(void *buf, abd_t *abd, size_t off, size_t size)
+{
+	struct buf_arg ba_ptr = { buf };
+
+	(void) abd_iterate_func(abd, off, size, abd_copy_to_buf_off_cb,
+	    &ba_ptr);
+}
+
+static int
+abd_cmp_buf_off_cb(void *buf, size_t size, void *private)
+{
+	int ret;
+	struct buf_arg *ba_ptr = private;
+
+	ret = memcmp(buf, ba_ptr->arg_buf, size);
+	ba_ptr->arg_buf = (char *)ba_ptr->arg_buf + size;
+
+	return (ret);
+}
+
+/*
+ * Compare the contents of abd to buf. (off is the offset in abd.)
+ */
+int
+abd_cmp_buf_off(abd_t *abd, const void *buf, size_t off, size_t size)
+{
+	struct buf_arg ba_ptr = { (void *) buf };
+
+	return (abd_iterate_func(abd, off, size, abd_cmp_buf_off_cb, &ba_ptr));
+}
+
+static int
+abd_copy_from_buf_off_cb(void *buf, size_t size, void *private)
+{
+	struct buf_arg *ba_ptr = private;
+
+	(void) memcpy(buf, ba_ptr->arg_buf, size);
+	ba_ptr->arg_buf = (char *)ba_ptr->arg_buf + size;
+
+	return (0);
+}
+
+/*
+ * Copy from buf to abd. (off is the offset in abd.)
+ */
+void
+abd_copy_from_buf_off(abd_t *abd, const void *buf, size_t off, size_t size)
+{
+	struct buf_arg ba_ptr = { (void *) buf };
+
+	(void) abd_iterate_func(abd, off, size, abd_copy_from_buf_off_cb,
+	    &ba_ptr);
+}
+
+/*ARGSUSED*/
+static int
+abd_zero_off_cb(void *buf, size_t size, void *private)
+{
+	(void) memset(buf, 0, size);
+	return (0);
+}
+
+/*
+ * Zero out the abd from a particular offset to the end.
+ */
+void
+abd_zero_off(abd_t *abd, size_t off, size_t size)
+{
+	(void) abd_iterate_func(abd, off, size, abd_zero_off_cb, NULL);
+}
+
+/*
+ * Iterate over two ABDs and call func incrementally on the two ABDs' data in
+ * equal-sized chunks (passed to func as raw buffers).  func could be called
+ * many times during this iteration.
+ */
+int
+abd_iterate_func2(abd_t *dabd, abd_t *sabd, size_t doff, size_t soff,
+    size_t size, abd_iter_func2_t *func, void *private)
+{
+	int ret = 0;
+	struct abd_iter daiter, saiter;
+
+	abd_verify(dabd);
+	abd_verify(sabd);
+
+	ASSERT3U(doff + size, <=, dabd->abd_size);
+	ASSERT3U(soff + size, <=, sabd->abd_size);
+
+	abd_iter_init(&daiter, dabd);
+	abd_iter_init(&saiter, sabd);
+	abd_iter_advance(&daiter, doff);
+	abd_iter_advance(&saiter, soff);
+
+	while (size > 0) {
+		size_t dlen, slen, len;
+
+		abd_iter_map(&daiter);
+		abd_iter_map(&saiter);
+
+		dlen = MIN(daiter.iter_mapsize, size);
+		slen = MIN(saiter.iter_mapsize, size);
+		len = MIN(dlen, slen);
+		ASSERT(dlen > 0 || slen > 0);
+
+		ret = func(daiter.iter_mapaddr, saiter.iter_mapaddr, len,
+		    private);
+
+		abd_iter_unmap(&saiter);
+		abd_iter_unmap(&daiter);
+
+		if (ret != 0)
+			break;
+
+		size -= len;
+		abd_iter_advance(&daiter, len);
+		abd_iter_advance(&saiter, len);
+	}
+
+	return (ret);
+}
+
+/*ARGSUSED*/
+static int
+abd_copy_off_cb(void *dbuf, void *sbuf, size_t size, void *private)
+{
+	(void) memcpy(dbuf, sbuf, size);
+	return (0);
+}
+
+/*
+ * Copy from sabd to dabd starting from soff and doff.
+ */
+void
+abd_copy_off(abd_t *dabd, abd_t *sabd, size_t doff, size_t soff, size_t size)
+{
+	(void) abd_iterate_func2(dabd, sabd, doff, soff, size,
+	    abd_copy_off_cb, NULL);
+}
+
+/*ARGSUSED*/
+static int
+abd_cmp_cb(void *bufa, void *bufb, size_t size, void *private)
+{
+	return (memcmp(bufa, bufb, size));
+}
+
+/*
+ * Compares the first size bytes of two ABDs.
+ */
+int
+abd_cmp(abd_t *dabd, abd_t *sabd, size_t size)
+{
+	return (abd_iterate_func2(dabd, sabd, 0, 0, size, abd_cmp_cb, NULL));
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+/*
+ * Return the number of pages spanned by [off, off + size) of a scattered
+ * ABD.  Every chunk is exactly one page, so this is simply the number of
+ * chunks the range touches.
+ */
+unsigned int
+abd_nr_pages_off(abd_t *abd, unsigned int size, size_t off)
+{
+	size_t pos;
+
+	ASSERT(!abd_is_linear(abd));
+	ASSERT(!abd_is_gang(abd));
+	ASSERT3U(zfs_abd_chunk_size, ==, PAGE_SIZE);
+
+	pos = abd->abd_u.abd_scatter.abd_offset + off;
+	return ((pos + size + PAGE_SIZE - 1) / PAGE_SIZE - pos / PAGE_SIZE);
+}
+
+/*
+ * Add the pages backing [off, off + io_size) of a scattered ABD to bio,
+ * stopping when the bio is full.  Returns the number of bytes which could
+ * not be mapped and must be placed in a further bio.
+ */
+unsigned int
+abd_scatter_bio_map_off(struct bio *bio, abd_t *abd,
+    unsigned int io_size, size_t off)
+{
+	struct abd_iter aiter;
+	int i;
+
+	ASSERT(!abd_is_linear(abd));
+	ASSERT(!abd_is_gang(abd));
+	ASSERT3U(io_size, <=, abd->abd_size - off);
+
+	abd_iter_init(&aiter, abd);
+	abd_iter_advance(&aiter, off);
+
+	for (i = 0; i < bio->bi_max_vecs; i++) {
+		struct page *pg;
+		size_t len, pgoff;
+
+		if (io_size <= 0)
+			break;
+
+		abd_iter_map(&aiter);
+
+		pg = virt_to_page(aiter.iter_mapaddr);
+		pgoff = offset_in_page(aiter.iter_mapaddr);
+		len = MIN(io_size, aiter.iter_mapsize);
+
+		abd_iter_unmap(&aiter);
+
+		if (bio_add_page(bio, pg, len, pgoff) != len)
+			break;
+
+		io_size -= len;
+		abd_iter_advance(&aiter, len);
+	}
+
+	return (io_size);
+}
+#endif /* _KERNEL && HAVE_SPL */
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+EXPORT_SYMBOL(abd_alloc);
+EXPORT_SYMBOL(abd_alloc_linear);
+EXPORT_SYMBOL(abd_alloc_gang);
+EXPORT_SYMBOL(abd_free);
+EXPORT_SYMBOL(abd_get_offset);
+EXPORT_SYMBOL(abd_get_offset_size);
+EXPORT_SYMBOL(abd_get_from_buf);
+EXPORT_SYMBOL(abd_get_zeros);
+EXPORT_SYMBOL(abd_put);
+EXPORT_SYMBOL(abd_gang_add);
+EXPORT_SYMBOL(abd_gang_get_offset);
+EXPORT_SYMBOL(abd_gang_next);
+EXPORT_SYMBOL(abd_to_buf);
+EXPORT_SYMBOL(abd_borrow_buf);
+EXPORT_SYMBOL(abd_borrow_buf_copy);
+EXPORT_SYMBOL(abd_return_buf);
+EXPORT_SYMBOL(abd_return_buf_copy);
+EXPORT_SYMBOL(abd_copy_off);
+EXPORT_SYMBOL(abd_copy_from_buf_off);
+EXPORT_SYMBOL(abd_copy_to_buf_off);
+EXPORT_SYMBOL(abd_zero_off);
+
+module_param(zfs_abd_scatter_enabled, int, 0644);
+MODULE_PARM_DESC(zfs_abd_scatter_enabled,
+	"Toggle whether ABD allocations must be linear.");
+#endif
@@ -92,11 +92,17 @@
  * buf_hash_remove() expects the appropriate hash mutex to be
  * already held before it is invoked.
  *
- * Each arc state also has a mutex which is used to protect the
- * buffer list associated with the state.  When attempting to
- * obtain a hash table lock while holding an arc list lock you
- * must use: mutex_tryenter() to avoid deadlock.  Also note that
- * the active state mutex must be held before the ghost state mutex.
+ * Each arc state also has a set of sublist mutexes which are used to
+ * protect the buffer lists associated with the state.  Rather than a
+ * single list per buffer type, each state keeps a multilist_t which is
+ * split into a number of independently locked sublists.  A header
+ * always lives on the sublist selected by hashing its identity (see
+ * arc_state_multilist_index_func()), so inserts and removes of
+ * unrelated buffers by different CPUs do not serialize on one lock.
+ * When attempting to obtain a hash table lock while holding a sublist
+ * lock you must use: mutex_tryenter() to avoid deadlock.  Also note
+ * that an active state sublist lock must be held before a ghost state
+ * sublist lock.
  *
  * Arc buffers may have an associated eviction callback function.
  * This function will be invoked prior to removing the buffer (e.g.
@@ -132,6 +138,7 @@
 #include <sys/zio_compress.h>
 #include <sys/zfs_context.h>
 #include <sys/arc.h>
+#include <sys/multilist.h>
 #include <sys/vdev.h>
 #include <sys/vdev_impl.h>
 #ifdef _KERNEL
@@ -147,6 +154,7 @@
 
 static kmutex_t		arc_reclaim_thr_lock;
 static kcondvar_t	arc_reclaim_thr_cv;	/* used to signal reclaim thr */
+static kcondvar_t	arc_reclaim_waiters_cv;	/* waiting for reclaim thr */
 static uint8_t		arc_thread_exit;
 
 /* number of bytes to prune from caches when at arc_meta_limit is reached */
@@ -166,6 +174,32 @@ int zfs_arc_p_min_shift = 4;
 /* log2(fraction of arc to reclaim) */
 int zfs_arc_shrink_shift = 5;
 
+/*
+ * The reclaim thread evicts until the ARC is (arc_c >> this shift) below
+ * its target, so that allocations find free space without evicting.
+ */
+int zfs_arc_evict_headroom_shift = 10;
+
+/*
+ * Allocations only wait for the reclaim thread once the ARC has overflowed
+ * its target by more than (arc_c >> this shift), or one maximum sized
+ * block, whichever is larger.
+ */
+int zfs_arc_overflow_shift = 8;
+
+/*
+ * Resize the header hash table as the ARC grows and shrinks: it is doubled
+ * once the average chain length exceeds two, and halved (but never below
+ * its initial size) once the average drops under one eighth.
+ */
+int zfs_arc_hash_resize = 1;
+
+/*
+ * Number of records kept by the ARC access trace; zero disables it.  This
+ * is only read when the module is loaded.
+ */
+int zfs_arc_trace_entries = 0;
+
 /*
  * minimum lifespan of a prefetch block in clock ticks
  * (initialized in arc_init())
@@ -178,6 +212,19 @@ int zfs_arc_memory_throttle_disable = 1;
 /* disable duplicate buffer eviction */
 int zfs_disable_dup_eviction = 0;
 
+/*
+ * Number of sublists used for each of the arc state lists.  When zero
+ * (the default) one sublist per CPU is used.
+ */
+int zfs_arc_num_sublists_per_state = 0;
+
+/*
+ * Keep user data blocks in the ARC in the compressed form in which they
+ * were read from disk.  The decompressed copy handed to consumers is only
+ * kept while it is referenced.
+ */
+int zfs_compressed_arc_enabled = 1;
+
 static int arc_dead;
 
 /* expiration time for arc_no_grow */
@@ -228,10 +275,10 @@ unsigned long zfs_arc_meta_limit = 0;
  */
 
 typedef struct arc_state {
-	list_t	arcs_list[ARC_BUFC_NUMTYPES];	/* list of evictable buffers */
+	/* lists of evictable buffers */
+	multilist_t arcs_list[ARC_BUFC_NUMTYPES];
 	uint64_t arcs_lsize[ARC_BUFC_NUMTYPES];	/* amount of evictable data */
 	uint64_t arcs_size;	/* total amount of data in this state */
-	kmutex_t arcs_mtx;
 } arc_state_t;
 
 /* The 6 states: */
@@ -253,12 +300,16 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_prefetch_data_misses;
 	kstat_named_t arcstat_prefetch_metadata_hits;
 	kstat_named_t arcstat_prefetch_metadata_misses;
+	kstat_named_t arcstat_hits_lsize;
+	kstat_named_t arcstat_hits_psize;
+	kstat_named_t arcstat_misses_lsize;
+	kstat_named_t arcstat_misses_psize;
 	kstat_named_t arcstat_mru_hits;
 	kstat_named_t arcstat_mru_ghost_hits;
 	kstat_named_t arcstat_mfu_hits;
 	kstat_named_t arcstat_mfu_ghost_hits;
 	kstat_named_t arcstat_deleted;
-	kstat_named_t arcstat_recycle_miss;
+	kstat_named_t arcstat_evict_wait;
 	kstat_named_t arcstat_mutex_miss;
 	kstat_named_t arcstat_evict_skip;
 	kstat_named_t arcstat_evict_l2_cached;
@@ -269,6 +320,10 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_hash_collisions;
 	kstat_named_t arcstat_hash_chains;
 	kstat_named_t arcstat_hash_chain_max;
+	kstat_named_t arcstat_hash_buckets;
+	kstat_named_t arcstat_hash_locks;
+	kstat_named_t arcstat_hash_resizes;
+	kstat_named_t arcstat_hash_resize_pending;
 	kstat_named_t arcstat_p;
 	kstat_named_t arcstat_c;
 	kstat_named_t arcstat_c_min;
@@ -277,6 +332,8 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_hdr_size;
 	kstat_named_t arcstat_data_size;
 	kstat_named_t arcstat_other_size;
+	kstat_named_t arcstat_compressed_size;
+	kstat_named_t arcstat_uncompressed_size;
 	kstat_named_t arcstat_anon_size;
 	kstat_named_t arcstat_anon_evict_data;
 	kstat_named_t arcstat_anon_evict_metadata;
@@ -306,6 +363,7 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_l2_evict_reading;
 	kstat_named_t arcstat_l2_free_on_write;
 	kstat_named_t arcstat_l2_abort_lowmem;
+	kstat_named_t arcstat_l2_write_throttled;
 	kstat_named_t arcstat_l2_cksum_bad;
 	kstat_named_t arcstat_l2_io_error;
 	kstat_named_t arcstat_l2_size;
@@ -314,6 +372,16 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_l2_compress_successes;
 	kstat_named_t arcstat_l2_compress_zeros;
 	kstat_named_t arcstat_l2_compress_failures;
+	kstat_named_t arcstat_l2_log_blk_writes;
+	kstat_named_t arcstat_l2_rebuild_successes;
+	kstat_named_t arcstat_l2_rebuild_unsupported;
+	kstat_named_t arcstat_l2_rebuild_io_errors;
+	kstat_named_t arcstat_l2_rebuild_cksum_errors;
+	kstat_named_t arcstat_l2_rebuild_lowmem;
+	kstat_named_t arcstat_l2_rebuild_log_blks;
+	kstat_named_t arcstat_l2_rebuild_bufs;
+	kstat_named_t arcstat_l2_rebuild_bufs_precached;
+	kstat_named_t arcstat_l2_rebuild_size;
 	kstat_named_t arcstat_memory_throttle_count;
 	kstat_named_t arcstat_duplicate_buffers;
 	kstat_named_t arcstat_duplicate_buffers_size;
@@ -340,12 +408,16 @@ static arc_stats_t arc_stats = {
 	{ "prefetch_data_misses",	KSTAT_DATA_UINT64 },
 	{ "prefetch_metadata_hits",	KSTAT_DATA_UINT64 },
 	{ "prefetch_metadata_misses",	KSTAT_DATA_UINT64 },
+	{ "hits_lsize",			KSTAT_DATA_UINT64 },
+	{ "hits_psize",			KSTAT_DATA_UINT64 },
+	{ "misses_lsize",		KSTAT_DATA_UINT64 },
+	{ "misses_psize",		KSTAT_DATA_UINT64 },
 	{ "mru_hits",			KSTAT_DATA_UINT64 },
 	{ "mru_ghost_hits",		KSTAT_DATA_UINT64 },
 	{ "mfu_hits",			KSTAT_DATA_UINT64 },
 	{ "mfu_ghost_hits",		KSTAT_DATA_UINT64 },
 	{ "deleted",			KSTAT_DATA_UINT64 },
-	{ "recycle_miss",		KSTAT_DATA_UINT64 },
+	{ "evict_wait",			KSTAT_DATA_UINT64 },
 	{ "mutex_miss",			KSTAT_DATA_UINT64 },
 	{ "evict_skip",			KSTAT_DATA_UINT64 },
 	{ "evict_l2_cached",		KSTAT_DATA_UINT64 },
@@ -356,6 +428,10 @@ static arc_stats_t arc_stats = {
 	{ "hash_collisions",		KSTAT_DATA_UINT64 },
 	{ "hash_chains",		KSTAT_DATA_UINT64 },
 	{ "hash_chain_max",		KSTAT_DATA_UINT64 },
+	{ "hash_buckets",		KSTAT_DATA_UINT64 },
+	{ "hash_locks",			KSTAT_DATA_UINT64 },
+	{ "hash_resizes",		KSTAT_DATA_UINT64 },
+	{ "hash_resize_pending",	KSTAT_DATA_UINT64 },
 	{ "p",				KSTAT_DATA_UINT64 },
 	{ "c",				KSTAT_DATA_UINT64 },
 	{ "c_min",			KSTAT_DATA_UINT64 },
@@ -364,6 +440,8 @@ static arc_stats_t arc_stats = {
 	{ "hdr_size",			KSTAT_DATA_UINT64 },
 	{ "data_size",			KSTAT_DATA_UINT64 },
 	{ "other_size",			KSTAT_DATA_UINT64 },
+	{ "compressed_size",		KSTAT_DATA_UINT64 },
+	{ "uncompressed_size",		KSTAT_DATA_UINT64 },
 	{ "anon_size",			KSTAT_DATA_UINT64 },
 	{ "anon_evict_data",		KSTAT_DATA_UINT64 },
 	{ "anon_evict_metadata",	KSTAT_DATA_UINT64 },
@@ -393,6 +471,7 @@ static arc_stats_t arc_stats = {
 	{ "l2_evict_reading",		KSTAT_DATA_UINT64 },
 	{ "l2_free_on_write",		KSTAT_DATA_UINT64 },
 	{ "l2_abort_lowmem",		KSTAT_DATA_UINT64 },
+	{ "l2_write_throttled",		KSTAT_DATA_UINT64 },
 	{ "l2_cksum_bad",		KSTAT_DATA_UINT64 },
 	{ "l2_io_error",		KSTAT_DATA_UINT64 },
 	{ "l2_size",			KSTAT_DATA_UINT64 },
@@ -401,6 +480,16 @@ static arc_stats_t arc_stats = {
 	{ "l2_compress_successes",	KSTAT_DATA_UINT64 },
 	{ "l2_compress_zeros",		KSTAT_DATA_UINT64 },
 	{ "l2_compress_failures",	KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_writes",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_successes",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_unsupported",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_io_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_cksum_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_lowmem",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_log_blks",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs_precached",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_size",		KSTAT_DATA_UINT64 },
 	{ "memory_throttle_count",	KSTAT_DATA_UINT64 },
 	{ "duplicate_buffers",		KSTAT_DATA_UINT64 },
 	{ "duplicate_buffers_size",	KSTAT_DATA_UINT64 },
@@ -454,6 +543,89 @@ static arc_stats_t arc_stats = {
 		}							\
 	}
 
+/*
+ * Per-objset statistics.  Every open objset registers an arc_os_stats_t,
+ * exported as the kstat zfs/<pool>/objset-0x<id>, which breaks down the
+ * ARC's resident size and hit/miss counts for the blocks of that objset.
+ * Each header holds a reference on the entry of the objset its block
+ * belongs to, so hits are accounted without a lookup, and an entry
+ * outlives the objset for as long as any of its blocks remain cached.
+ * Resident sizes are logical block sizes of headers in arc_mru/arc_mfu.
+ */
+typedef struct arc_os_kstats {
+	kstat_named_t aoss_data_mru_size;
+	kstat_named_t aoss_data_mfu_size;
+	kstat_named_t aoss_metadata_mru_size;
+	kstat_named_t aoss_metadata_mfu_size;
+	kstat_named_t aoss_demand_data_hits;
+	kstat_named_t aoss_demand_data_misses;
+	kstat_named_t aoss_demand_metadata_hits;
+	kstat_named_t aoss_demand_metadata_misses;
+	kstat_named_t aoss_prefetch_data_hits;
+	kstat_named_t aoss_prefetch_data_misses;
+	kstat_named_t aoss_prefetch_metadata_hits;
+	kstat_named_t aoss_prefetch_metadata_misses;
+	kstat_named_t aoss_l2_hits;
+	kstat_named_t aoss_l2_misses;
+} arc_os_kstats_t;
+
+static arc_os_kstats_t arc_os_kstats_template = {
+	{ "data_mru_size",		KSTAT_DATA_UINT64 },
+	{ "data_mfu_size",		KSTAT_DATA_UINT64 },
+	{ "metadata_mru_size",		KSTAT_DATA_UINT64 },
+	{ "metadata_mfu_size",		KSTAT_DATA_UINT64 },
+	{ "demand_data_hits",		KSTAT_DATA_UINT64 },
+	{ "demand_data_misses",		KSTAT_DATA_UINT64 },
+	{ "demand_metadata_hits",	KSTAT_DATA_UINT64 },
+	{ "demand_metadata_misses",	KSTAT_DATA_UINT64 },
+	{ "prefetch_data_hits",		KSTAT_DATA_UINT64 },
+	{ "prefetch_data_misses",	KSTAT_DATA_UINT64 },
+	{ "prefetch_metadata_hits",	KSTAT_DATA_UINT64 },
+	{ "prefetch_metadata_misses",	KSTAT_DATA_UINT64 },
+	{ "l2_hits",			KSTAT_DATA_UINT64 },
+	{ "l2_misses",			KSTAT_DATA_UINT64 }
+};
+
+struct arc_os_stats {
+	/* protected by the hash bucket lock */
+	arc_os_stats_t	*aos_next;
+	uint64_t	aos_spa;	/* load guid of the pool */
+	uint64_t	aos_objset;
+	uint64_t	aos_refcnt;
+
+	/* protected by arc_os_stats_kstat_lock */
+	uint64_t	aos_opens;
+	kstat_t		*aos_ksp;
+
+	/* updated atomically */
+	arc_os_kstats_t	aos_stats;
+};
+
+#define	AOS_HASH_BUCKETS	256
+#define	AOS_HASH(spa, os)	\
+	((((spa) >> 16) ^ (os)) & (AOS_HASH_BUCKETS - 1))
+
+static arc_os_stats_t *arc_os_stats_table[AOS_HASH_BUCKETS];
+static kmutex_t arc_os_stats_locks[AOS_HASH_BUCKETS];
+static kmutex_t arc_os_stats_kstat_lock;
+
+#define	AOSSTAT_BUMP(aos, stat)	\
+	atomic_inc_64(&(aos)->aos_stats.aoss_##stat.value.ui64)
+
+#define	AOSSTAT_CONDSTAT(aos, cond1, stat1, notstat1, cond2, stat2, \
+    notstat2, stat)							\
+	if ((aos) != NULL && (cond1)) {					\
+		if (cond2)						\
+			AOSSTAT_BUMP(aos, stat1##_##stat2##_##stat);	\
+		else							\
+			AOSSTAT_BUMP(aos, stat1##_##notstat2##_##stat);	\
+	} else if ((aos) != NULL) {					\
+		if (cond2)						\
+			AOSSTAT_BUMP(aos, notstat1##_##stat2##_##stat);	\
+		else							\
+			AOSSTAT_BUMP(aos, notstat1##_##notstat2##_##stat); \
+	}
+
 kstat_t			*arc_ksp;
 static arc_state_t	*arc_anon;
 static arc_state_t	*arc_mru;
@@ -482,9 +654,15 @@ static arc_state_t	*arc_l2c_only;
 #define	arc_meta_limit	ARCSTAT(arcstat_meta_limit)
 #define	arc_meta_max	ARCSTAT(arcstat_meta_max)
 
+/*
+ * Buffers compressed by the L2ARC itself use LZ4, but a block cached in
+ * its on-disk compressed form is written out with whatever algorithm it
+ * was compressed with.
+ */
 #define	L2ARC_IS_VALID_COMPRESS(_c_) \
-	((_c_) == ZIO_COMPRESS_LZ4 || (_c_) == ZIO_COMPRESS_EMPTY)
+	((_c_) > ZIO_COMPRESS_OFF && (_c_) < ZIO_COMPRESS_FUNCTIONS)
 
+typedef struct l2arc_dev l2arc_dev_t;
 typedef struct l2arc_buf_hdr l2arc_buf_hdr_t;
 
 typedef struct arc_callback arc_callback_t;
@@ -506,40 +684,79 @@ struct arc_write_callback {
 	arc_buf_t	*awcb_buf;
 };
 
+/*
+ * Headers are split into two parts.  The L1 part describes a block which
+ * is held in memory (or is a ghost of one) and is only present in headers
+ * allocated from hdr_full_cache.  A block which is only cached on an
+ * L2ARC device is described by a header from hdr_l2only_cache, which
+ * stops short of the L1 part; with a large L2ARC these make up the bulk
+ * of the headers, so keeping them small matters.  b_l1hdr must therefore
+ * remain the last member of arc_buf_hdr_t.
+ */
+typedef struct l1arc_buf_hdr {
+	kmutex_t		b_freeze_lock;
+
+	arc_buf_t		*b_buf;
+	uint32_t		b_datacnt;
+
+	/* compressed copy of the block, as read from disk */
+	abd_t			*b_pdata;
+	uint64_t		b_psize;
+	enum zio_compress	b_compress;
+
+	arc_callback_t		*b_acb;
+	kcondvar_t		b_cv;
+
+	/* protected by arc state sublist mutex */
+	multilist_node_t	b_arc_node;
+
+	/* updated atomically */
+	clock_t			b_arc_access;
+
+	/* self protecting */
+	refcount_t		b_refcnt;
+
+	/* temporary buffer holder for in-flight L2ARC data */
+	void			*b_tmp_cdata;
+} l1arc_buf_hdr_t;
+
+struct l2arc_buf_hdr {
+	/* protected by arc_buf_hdr  mutex */
+	l2arc_dev_t		*b_dev;		/* L2ARC device */
+	uint64_t		b_daddr;	/* disk address, offset byte */
+	/* compression applied to buffer data */
+	enum zio_compress	b_compress;
+	/* real alloc'd buffer size depending on b_compress applied */
+	int			b_asize;
+
+	/* protected by l2arc_buflist_mtx */
+	list_node_t		b_l2node;
+};
+
 struct arc_buf_hdr {
 	/* protected by hash lock */
 	dva_t			b_dva;
 	uint64_t		b_birth;
-	uint64_t		b_cksum0;
-
-	kmutex_t		b_freeze_lock;
 	zio_cksum_t		*b_freeze_cksum;
 
 	arc_buf_hdr_t		*b_hash_next;
-	arc_buf_t		*b_buf;
 	uint32_t		b_flags;
-	uint32_t		b_datacnt;
-
-	arc_callback_t		*b_acb;
-	kcondvar_t		b_cv;
 
 	/* immutable */
 	arc_buf_contents_t	b_type;
 	uint64_t		b_size;
 	uint64_t		b_spa;
 
-	/* protected by arc state mutex */
+	/* protected by arc state sublist mutex */
 	arc_state_t		*b_state;
-	list_node_t		b_arc_node;
 
-	/* updated atomically */
-	clock_t			b_arc_access;
+	/* protected by hash lock, set while anonymous or a ghost */
+	arc_os_stats_t		*b_os_stats;
 
-	/* self protecting */
-	refcount_t		b_refcnt;
-
-	l2arc_buf_hdr_t		*b_l2hdr;
-	list_node_t		b_l2node;
+	/* valid if ARC_HAS_L2HDR is set */
+	l2arc_buf_hdr_t		b_l2hdr;
+	/* valid if ARC_HAS_L1HDR is set, must be last */
+	l1arc_buf_hdr_t		b_l1hdr;
 };
 
 static list_t arc_prune_list;
@@ -577,6 +794,8 @@ static boolean_t l2arc_write_eligible(uint64_t spa_guid, arc_buf_hdr_t *ab);
 #define	ARC_L2_WRITING		(1 << 16)	/* L2ARC write in progress */
 #define	ARC_L2_EVICTED		(1 << 17)	/* evicted during I/O */
 #define	ARC_L2_WRITE_HEAD	(1 << 18)	/* head of write list */
+#define	ARC_HAS_L1HDR		(1 << 19)	/* hdr has an L1 part */
+#define	ARC_HAS_L2HDR		(1 << 20)	/* hdr has an L2 part */
 
 #define	HDR_IN_HASH_TABLE(hdr)	((hdr)->b_flags & ARC_IN_HASH_TABLE)
 #define	HDR_IO_IN_PROGRESS(hdr)	((hdr)->b_flags & ARC_IO_IN_PROGRESS)
@@ -587,47 +806,70 @@ static boolean_t l2arc_write_eligible(uint64_t spa_guid, arc_buf_hdr_t *ab);
 #define	HDR_FREE_IN_PROGRESS(hdr)	((hdr)->b_flags & ARC_FREE_IN_PROGRESS)
 #define	HDR_L2CACHE(hdr)	((hdr)->b_flags & ARC_L2CACHE)
 #define	HDR_L2_READING(hdr)	((hdr)->b_flags & ARC_IO_IN_PROGRESS &&	\
-				    (hdr)->b_l2hdr != NULL)
+				    (hdr)->b_flags & ARC_HAS_L2HDR)
 #define	HDR_L2_WRITING(hdr)	((hdr)->b_flags & ARC_L2_WRITING)
 #define	HDR_L2_EVICTED(hdr)	((hdr)->b_flags & ARC_L2_EVICTED)
 #define	HDR_L2_WRITE_HEAD(hdr)	((hdr)->b_flags & ARC_L2_WRITE_HEAD)
+#define	HDR_HAS_L1HDR(hdr)	((hdr)->b_flags & ARC_HAS_L1HDR)
+#define	HDR_HAS_L2HDR(hdr)	((hdr)->b_flags & ARC_HAS_L2HDR)
 
 /*
  * Other sizes
  */
 
-#define	HDR_SIZE ((int64_t)sizeof (arc_buf_hdr_t))
-#define	L2HDR_SIZE ((int64_t)sizeof (l2arc_buf_hdr_t))
+#define	HDR_FULL_SIZE ((int64_t)sizeof (arc_buf_hdr_t))
+#define	HDR_L2ONLY_SIZE ((int64_t)offsetof(arc_buf_hdr_t, b_l1hdr))
 
 /*
  * Hash table routines
  */
 
+/*
+ * The hash table is striped across a power-of-two number of locks which is
+ * fixed at init time and scales with the number of CPUs.  The table itself
+ * is resized on the fly by buf_hash_resize() as the number of headers
+ * changes.  The table always has at least as many buckets as there are
+ * locks, so a header's lock depends only on its hash value and never changes
+ * across a resize.  Each lock carries the table and mask which are current
+ * for its stripe; a resize migrates one stripe at a time under its lock, so
+ * lookups remain correct while the rehash is in progress.
+ */
 #define	HT_LOCK_ALIGN	64
-#define	HT_LOCK_PAD	(P2NPHASE(sizeof (kmutex_t), (HT_LOCK_ALIGN)))
+#define	HT_LOCK_SIZE	(sizeof (kmutex_t) + sizeof (arc_buf_hdr_t **) + \
+	sizeof (uint64_t))
+#define	HT_LOCK_PAD	(P2NPHASE(HT_LOCK_SIZE, (HT_LOCK_ALIGN)))
 
 struct ht_lock {
 	kmutex_t	ht_lock;
+	arc_buf_hdr_t	**ht_table;	/* table current for this stripe */
+	uint64_t	ht_mask;	/* mask current for this stripe */
 #ifdef _KERNEL
 	unsigned char	pad[HT_LOCK_PAD];
 #endif
 };
 
-#define	BUF_LOCKS 256
+#define	BUF_LOCKS_MIN		256
+#define	BUF_LOCKS_PER_CPU	32
+
 typedef struct buf_hash_table {
 	uint64_t ht_mask;
 	arc_buf_hdr_t **ht_table;
-	struct ht_lock ht_locks[BUF_LOCKS];
+	uint64_t ht_min_size;		/* never shrink below this */
+	uint64_t ht_nlocks;
+	struct ht_lock *ht_locks;
+	uint32_t ht_resizing;		/* resize task dispatched */
 } buf_hash_table_t;
 
 static buf_hash_table_t buf_hash_table;
 
-#define	BUF_HASH_INDEX(spa, dva, birth) \
-	(buf_hash(spa, dva, birth) & buf_hash_table.ht_mask)
-#define	BUF_HASH_LOCK_NTRY(idx) (buf_hash_table.ht_locks[idx & (BUF_LOCKS-1)])
-#define	BUF_HASH_LOCK(idx)	(&(BUF_HASH_LOCK_NTRY(idx).ht_lock))
-#define	HDR_LOCK(hdr) \
-	(BUF_HASH_LOCK(BUF_HASH_INDEX(hdr->b_spa, &hdr->b_dva, hdr->b_birth)))
+#define	BUF_HASH_LOCK_NTRY(hash) \
+	(buf_hash_table.ht_locks[(hash) & (buf_hash_table.ht_nlocks - 1)])
+#define	BUF_HASH_LOCK(hash)	(&(BUF_HASH_LOCK_NTRY(hash).ht_lock))
+#define	BUF_HASH_BUCKET(hash) \
+	(&BUF_HASH_LOCK_NTRY(hash).ht_table[(hash) & \
+	BUF_HASH_LOCK_NTRY(hash).ht_mask])
+#define	HDR_HASH(hdr)	(buf_hash(hdr->b_spa, &hdr->b_dva, hdr->b_birth))
+#define	HDR_LOCK(hdr)	(BUF_HASH_LOCK(HDR_HASH(hdr)))
 
 uint64_t zfs_crc64_table[256];
 
@@ -636,6 +878,8 @@ uint64_t zfs_crc64_table[256];
  */
 
 #define	L2ARC_WRITE_SIZE	(8 * 1024 * 1024)	/* initial write max */
+#define	L2ARC_WRITE_LIMIT	(16 * L2ARC_WRITE_SIZE)	/* adaptive ceiling */
+#define	L2ARC_WRITE_TARGET_MS	50			/* write latency goal */
 #define	L2ARC_HEADROOM		2			/* num of writes */
 /*
  * If we discover during ARC scan any buffers to be compressed, we boost
@@ -648,6 +892,16 @@ uint64_t zfs_crc64_table[256];
 #define	l2arc_writes_sent	ARCSTAT(arcstat_l2_writes_sent)
 #define	l2arc_writes_done	ARCSTAT(arcstat_l2_writes_done)
 
+/*
+ * Values of l2arc_norw.  With L2ARC_NORW_AUTO reads are only held off on
+ * devices which cannot complete even the smallest write pass within
+ * l2arc_write_target_ms, since reads queued behind those writes would
+ * stall for longer than a read from the pool.
+ */
+#define	L2ARC_NORW_NEVER	0
+#define	L2ARC_NORW_ALWAYS	1
+#define	L2ARC_NORW_AUTO		2
+
 /*
  * L2ARC Performance Tunables
  */
@@ -657,15 +911,107 @@ unsigned long l2arc_headroom = L2ARC_HEADROOM;		/* # of dev writes */
 unsigned long l2arc_headroom_boost = L2ARC_HEADROOM_BOOST;
 unsigned long l2arc_feed_secs = L2ARC_FEED_SECS;	/* interval seconds */
 unsigned long l2arc_feed_min_ms = L2ARC_FEED_MIN_MS;	/* min interval msecs */
+unsigned long l2arc_write_limit = L2ARC_WRITE_LIMIT;	/* max adaptive size */
+unsigned long l2arc_write_target_ms = L2ARC_WRITE_TARGET_MS; /* 0 disables */
 int l2arc_noprefetch = B_TRUE;			/* don't cache prefetch bufs */
 int l2arc_nocompress = B_FALSE;			/* don't compress bufs */
 int l2arc_feed_again = B_TRUE;			/* turbo warmup */
-int l2arc_norw = B_FALSE;			/* no reads during writes */
+int l2arc_norw = L2ARC_NORW_NEVER;		/* no reads during writes */
+int l2arc_rebuild_enabled = B_TRUE;		/* restore contents on import */
+
+/*
+ * L2ARC Persistence
+ *
+ * The on-disk structures below are all stored in native byte order; a
+ * device written by a host of the other endianness is simply not
+ * rebuilt.
+ */
+#define	L2ARC_DEV_HDR_MAGIC	0x4c32415243484452ULL	/* "L2ARCHDR" */
+#define	L2ARC_LOG_BLK_MAGIC	0x4c324152434c4f47ULL	/* "L2ARCLOG" */
+#define	L2ARC_PERSIST_VERSION	1ULL
+
+/* device header flags */
+#define	L2ARC_DEV_HDR_FIRST	(1ULL << 0)	/* first sweep not completed */
+
+/* number of buffers described by a single log block */
+#define	L2ARC_LOG_BLK_ENTRIES	1022
+
+/*
+ * Points to a log block on the device.  The checksum is a fletcher4 of
+ * the first lbp_asize bytes of the block, which is how a log block that
+ * has since been overwritten is told apart from the one we expect.
+ */
+typedef struct l2arc_log_blkptr {
+	uint64_t		lbp_daddr;	/* device address, 0 if none */
+	uint64_t		lbp_asize;	/* allocated size on device */
+	zio_cksum_t		lbp_cksum;	/* fletcher4 of the block */
+} l2arc_log_blkptr_t;
+
+/*
+ * A single buffer on the device.  le_prop is encoded by the
+ * L2ARC_LE_* macros below.
+ */
+typedef struct l2arc_log_ent_phys {
+	dva_t			le_dva;		/* dva of the buffer */
+	uint64_t		le_birth;	/* birth txg of the buffer */
+	zio_cksum_t		le_freeze_cksum; /* b_freeze_cksum */
+	uint64_t		le_prop;	/* sizes, compression, type */
+	uint64_t		le_daddr;	/* device address of the data */
+} l2arc_log_ent_phys_t;
+
+#define	L2ARC_LE_LSIZE(le)	\
+	BF64_GET_SB((le)->le_prop, 0, 16, SPA_MINBLOCKSHIFT, 1)
+#define	L2ARC_LE_SET_LSIZE(le, x)	\
+	BF64_SET_SB((le)->le_prop, 0, 16, SPA_MINBLOCKSHIFT, 1, x)
+#define	L2ARC_LE_ASIZE(le)	BF64_GET((le)->le_prop, 16, 24)
+#define	L2ARC_LE_SET_ASIZE(le, x)	BF64_SET((le)->le_prop, 16, 24, x)
+#define	L2ARC_LE_COMPRESS(le)	BF64_GET((le)->le_prop, 40, 8)
+#define	L2ARC_LE_SET_COMPRESS(le, x)	BF64_SET((le)->le_prop, 40, 8, x)
+#define	L2ARC_LE_TYPE(le)	BF64_GET((le)->le_prop, 48, 8)
+#define	L2ARC_LE_SET_TYPE(le, x)	BF64_SET((le)->le_prop, 48, 8, x)
+#define	L2ARC_LE_L2COMPRESS(le)	BF64_GET((le)->le_prop, 56, 1)
+#define	L2ARC_LE_SET_L2COMPRESS(le, x)	BF64_SET((le)->le_prop, 56, 1, x)
+
+/*
+ * A log block.  Only the header and the first lb_nents entries are
+ * written out, rounded up to the device's allocation size.
+ */
+typedef struct l2arc_log_blk_phys {
+	uint64_t		lb_magic;	/* L2ARC_LOG_BLK_MAGIC */
+	uint64_t		lb_nents;	/* number of valid entries */
+	l2arc_log_blkptr_t	lb_prev;	/* previous log block */
+	l2arc_log_ent_phys_t	lb_entries[L2ARC_LOG_BLK_ENTRIES];
+} l2arc_log_blk_phys_t;
+
+#define	L2ARC_LOG_BLK_SIZE	(sizeof (l2arc_log_blk_phys_t))
+#define	L2ARC_LOG_BLK_PSIZE(nents)	\
+	offsetof(l2arc_log_blk_phys_t, lb_entries[nents])
+
+/*
+ * The device header is stored at the start of the device, right after
+ * the front vdev labels, and is protected by an embedded label checksum
+ * (ZIO_CHECKSUM_LABEL) just like the labels themselves.
+ */
+typedef struct l2arc_dev_hdr_phys {
+	uint64_t		dh_magic;	/* L2ARC_DEV_HDR_MAGIC */
+	uint64_t		dh_version;	/* L2ARC_PERSIST_VERSION */
+	uint64_t		dh_spa_guid;	/* pool the device belongs to */
+	uint64_t		dh_vdev_guid;	/* the cache vdev itself */
+	uint64_t		dh_flags;	/* L2ARC_DEV_HDR_* */
+	uint64_t		dh_start;	/* l2ad_start */
+	uint64_t		dh_end;		/* l2ad_end */
+	uint64_t		dh_hand;	/* l2ad_hand */
+	uint64_t		dh_evict;	/* l2ad_evict */
+	l2arc_log_blkptr_t	dh_last_lbp;	/* most recent log block */
+} l2arc_dev_hdr_phys_t;
+
+#define	L2ARC_DEV_HDR_PSIZE	\
+	(sizeof (l2arc_dev_hdr_phys_t) + sizeof (zio_eck_t))
 
 /*
  * L2ARC Internals
  */
-typedef struct l2arc_dev {
+struct l2arc_dev {
 	vdev_t			*l2ad_vdev;	/* vdev */
 	spa_t			*l2ad_spa;	/* spa */
 	uint64_t		l2ad_hand;	/* next write location */
@@ -676,17 +1022,35 @@ typedef struct l2arc_dev {
 	boolean_t		l2ad_writing;	/* currently writing */
 	list_t			*l2ad_buflist;	/* buffer list */
 	list_node_t		l2ad_node;	/* device list node */
-} l2arc_dev_t;
+	/* persistence, protected by the feed thread or the rebuild thread */
+	uint64_t		l2ad_dev_hdr_asize; /* size of device header */
+	l2arc_log_blk_phys_t	*l2ad_log_blk;	/* log block being filled */
+	l2arc_log_blkptr_t	l2ad_log_last;	/* last log block written */
+	boolean_t		l2ad_log_dirty;	/* device header needs update */
+	/* protected by l2arc_dev_mtx */
+	boolean_t		l2ad_rebuild;	/* rebuild in progress */
+	boolean_t		l2ad_rebuild_cancel; /* stop the rebuild */
+	/* feed thread control, protected by l2ad_feed_lock */
+	kmutex_t		l2ad_feed_lock;
+	kcondvar_t		l2ad_feed_cv;
+	boolean_t		l2ad_feed_running; /* feed thread exists */
+	boolean_t		l2ad_feed_exit;	/* feed thread should exit */
+	/* write throttle, owned by the feed thread */
+	uint64_t		l2ad_write_size; /* adaptive bytes per pass */
+	hrtime_t		l2ad_write_lat;	/* duration of last write */
+	uint64_t		l2ad_read_bytes; /* read since last pass */
+	boolean_t		l2ad_norw;	/* no reads during writes */
+};
 
 static list_t L2ARC_dev_list;			/* device list */
 static list_t *l2arc_dev_list;			/* device list pointer */
 static kmutex_t l2arc_dev_mtx;			/* device list mutex */
-static l2arc_dev_t *l2arc_dev_last;		/* last device used */
 static kmutex_t l2arc_buflist_mtx;		/* mutex for all buflists */
 static list_t L2ARC_free_on_write;		/* free after write buf list */
 static list_t *l2arc_free_on_write;		/* free after write list ptr */
 static kmutex_t l2arc_free_on_write_mtx;	/* mutex for list */
 static uint64_t l2arc_ndev;			/* number of devices */
+static kcondvar_t l2arc_rebuild_cv;		/* rebuild thread exited */
 
 typedef struct l2arc_read_callback {
 	arc_buf_t		*l2rcb_buf;		/* read buffer */
@@ -702,18 +1066,6 @@ typedef struct l2arc_write_callback {
 	arc_buf_hdr_t	*l2wcb_head;		/* head of write buflist */
 } l2arc_write_callback_t;
 
-struct l2arc_buf_hdr {
-	/* protected by arc_buf_hdr  mutex */
-	l2arc_dev_t		*b_dev;		/* L2ARC device */
-	uint64_t		b_daddr;	/* disk address, offset byte */
-	/* compression applied to buffer data */
-	enum zio_compress	b_compress;
-	/* real alloc'd buffer size depending on b_compress applied */
-	int			b_asize;
-	/* temporary buffer holder for in-flight compressed data */
-	void			*b_tmp_cdata;
-};
-
 typedef struct l2arc_data_free {
 	/* protected by l2arc_free_on_write_mtx */
 	void		*l2df_data;
@@ -722,19 +1074,23 @@ typedef struct l2arc_data_free {
 	list_node_t	l2df_list_node;
 } l2arc_data_free_t;
 
-static kmutex_t l2arc_feed_thr_lock;
-static kcondvar_t l2arc_feed_thr_cv;
-static uint8_t l2arc_thread_exit;
+static boolean_t l2arc_feed_enabled;		/* between start and stop */
 
 static void l2arc_read_done(zio_t *zio);
 static void l2arc_hdr_stat_add(void);
 static void l2arc_hdr_stat_remove(void);
 
-static boolean_t l2arc_compress_buf(l2arc_buf_hdr_t *l2hdr);
+static boolean_t l2arc_compress_buf(arc_buf_hdr_t *ab);
 static void l2arc_decompress_zio(zio_t *zio, arc_buf_hdr_t *hdr,
     enum zio_compress c);
 static void l2arc_release_cdata_buf(arc_buf_hdr_t *ab);
 
+static uint64_t l2arc_log_blk_overhead(l2arc_dev_t *dev, uint64_t write_sz);
+static void l2arc_log_blk_append(l2arc_dev_t *dev, arc_buf_hdr_t *ab,
+    zio_t *pio);
+static void l2arc_log_blk_commit(l2arc_dev_t *dev, zio_t *pio);
+static void l2arc_dev_hdr_update(l2arc_dev_t *dev);
+
 static uint64_t
 buf_hash(uint64_t spa, const dva_t *dva, uint64_t birth)
 {
@@ -768,18 +1124,35 @@ buf_discard_identity(arc_buf_hdr_t *hdr)
 	hdr->b_dva.dva_word[0] = 0;
 	hdr->b_dva.dva_word[1] = 0;
 	hdr->b_birth = 0;
-	hdr->b_cksum0 = 0;
+}
+
+/*
+ * Select the sublist of an arc state list for the given header.  The
+ * sublist must not change while the header is on the list, so it is
+ * derived from the header's identity which is only ever modified while
+ * the header is anonymous (and hence not on any list).  Hashing the
+ * identity also spreads the headers evenly over the sublists.
+ */
+static unsigned int
+arc_state_multilist_index_func(multilist_t *ml, void *obj)
+{
+	arc_buf_hdr_t *hdr = obj;
+
+	ASSERT(!BUF_EMPTY(hdr));
+
+	return ((unsigned int)(buf_hash(hdr->b_spa, &hdr->b_dva,
+	    hdr->b_birth) % multilist_get_num_sublists(ml)));
 }
 
 static arc_buf_hdr_t *
 buf_hash_find(uint64_t spa, const dva_t *dva, uint64_t birth, kmutex_t **lockp)
 {
-	uint64_t idx = BUF_HASH_INDEX(spa, dva, birth);
-	kmutex_t *hash_lock = BUF_HASH_LOCK(idx);
+	uint64_t hash = buf_hash(spa, dva, birth);
+	kmutex_t *hash_lock = BUF_HASH_LOCK(hash);
 	arc_buf_hdr_t *buf;
 
 	mutex_enter(hash_lock);
-	for (buf = buf_hash_table.ht_table[idx]; buf != NULL;
+	for (buf = *BUF_HASH_BUCKET(hash); buf != NULL;
 	    buf = buf->b_hash_next) {
 		if (BUF_EQUAL(spa, dva, birth, buf)) {
 			*lockp = hash_lock;
@@ -800,22 +1173,23 @@ buf_hash_find(uint64_t spa, const dva_t *dva, uint64_t birth, kmutex_t **lockp)
 static arc_buf_hdr_t *
 buf_hash_insert(arc_buf_hdr_t *buf, kmutex_t **lockp)
 {
-	uint64_t idx = BUF_HASH_INDEX(buf->b_spa, &buf->b_dva, buf->b_birth);
-	kmutex_t *hash_lock = BUF_HASH_LOCK(idx);
-	arc_buf_hdr_t *fbuf;
+	uint64_t hash = HDR_HASH(buf);
+	kmutex_t *hash_lock = BUF_HASH_LOCK(hash);
+	arc_buf_hdr_t *fbuf, **bucket;
 	uint32_t i;
 
 	ASSERT(!HDR_IN_HASH_TABLE(buf));
 	*lockp = hash_lock;
 	mutex_enter(hash_lock);
-	for (fbuf = buf_hash_table.ht_table[idx], i = 0; fbuf != NULL;
+	bucket = BUF_HASH_BUCKET(hash);
+	for (fbuf = *bucket, i = 0; fbuf != NULL;
 	    fbuf = fbuf->b_hash_next, i++) {
 		if (BUF_EQUAL(buf->b_spa, &buf->b_dva, buf->b_birth, fbuf))
 			return (fbuf);
 	}
 
-	buf->b_hash_next = buf_hash_table.ht_table[idx];
-	buf_hash_table.ht_table[idx] = buf;
+	buf->b_hash_next = *bucket;
+	*bucket = buf;
 	buf->b_flags |= ARC_IN_HASH_TABLE;
 
 	/* collect some hash table performance data */
@@ -836,13 +1210,13 @@ buf_hash_insert(arc_buf_hdr_t *buf, kmutex_t **lockp)
 static void
 buf_hash_remove(arc_buf_hdr_t *buf)
 {
-	arc_buf_hdr_t *fbuf, **bufp;
-	uint64_t idx = BUF_HASH_INDEX(buf->b_spa, &buf->b_dva, buf->b_birth);
+	arc_buf_hdr_t *fbuf, **bufp, **bucket;
+	uint64_t hash = HDR_HASH(buf);
 
-	ASSERT(MUTEX_HELD(BUF_HASH_LOCK(idx)));
+	ASSERT(MUTEX_HELD(BUF_HASH_LOCK(hash)));
 	ASSERT(HDR_IN_HASH_TABLE(buf));
 
-	bufp = &buf_hash_table.ht_table[idx];
+	bucket = bufp = BUF_HASH_BUCKET(hash);
 	while ((fbuf = *bufp) != buf) {
 		ASSERT(fbuf != NULL);
 		bufp = &fbuf->b_hash_next;
@@ -854,15 +1228,122 @@ buf_hash_remove(arc_buf_hdr_t *buf)
 	/* collect some hash table performance data */
 	ARCSTAT_BUMPDOWN(arcstat_hash_elements);
 
-	if (buf_hash_table.ht_table[idx] &&
-	    buf_hash_table.ht_table[idx]->b_hash_next == NULL)
+	if (*bucket && (*bucket)->b_hash_next == NULL)
 		ARCSTAT_BUMPDOWN(arcstat_hash_chains);
 }
 
+/*
+ * Rehash every header into a new table of nsize buckets.  Stripes are
+ * migrated one at a time while holding their lock: all buckets belonging
+ * to a stripe in the old table are emptied into the new one and the
+ * stripe is then switched over.  Lookups and inserts against stripes which
+ * have not been migrated yet continue to use the old table.
+ */
+static void
+buf_hash_resize(void *arg)
+{
+	uint64_t nsize = (uint64_t)(uintptr_t)arg;
+	uint64_t osize = buf_hash_table.ht_mask + 1;
+	uint64_t nmask = nsize - 1;
+	uint64_t nlocks = buf_hash_table.ht_nlocks;
+	arc_buf_hdr_t **otable = buf_hash_table.ht_table;
+	arc_buf_hdr_t **ntable, *hdr;
+	uint64_t l, idx, len;
+
+	ASSERT(ISP2(nsize));
+	ASSERT3U(nsize, >=, nlocks);
+
+	ntable = vmem_zalloc(nsize * sizeof (void *), KM_SLEEP);
+	ARCSTAT(arcstat_hash_chain_max) = 0;
+
+	for (l = 0; l < nlocks; l++) {
+		struct ht_lock *htl = &buf_hash_table.ht_locks[l];
+
+		mutex_enter(&htl->ht_lock);
+		ASSERT3P(htl->ht_table, ==, otable);
+
+		for (idx = l; idx < osize; idx += nlocks) {
+			if (otable[idx] != NULL &&
+			    otable[idx]->b_hash_next != NULL)
+				ARCSTAT_BUMPDOWN(arcstat_hash_chains);
+
+			while ((hdr = otable[idx]) != NULL) {
+				arc_buf_hdr_t **bucket =
+				    &ntable[HDR_HASH(hdr) & nmask];
+
+				otable[idx] = hdr->b_hash_next;
+				hdr->b_hash_next = *bucket;
+				*bucket = hdr;
+			}
+		}
+
+		for (idx = l; idx < nsize; idx += nlocks) {
+			for (hdr = ntable[idx], len = 0; hdr != NULL;
+			    hdr = hdr->b_hash_next)
+				len++;
+
+			if (len > 1) {
+				ARCSTAT_BUMP(arcstat_hash_chains);
+				ARCSTAT_MAX(arcstat_hash_chain_max, len - 1);
+			}
+		}
+
+		htl->ht_table = ntable;
+		htl->ht_mask = nmask;
+		mutex_exit(&htl->ht_lock);
+
+		ARCSTAT_BUMPDOWN(arcstat_hash_resize_pending);
+	}
+
+	buf_hash_table.ht_table = ntable;
+	buf_hash_table.ht_mask = nmask;
+	vmem_free(otable, osize * sizeof (void *));
+
+	ARCSTAT(arcstat_hash_buckets) = nsize;
+	ARCSTAT_BUMP(arcstat_hash_resizes);
+
+	membar_producer();
+	buf_hash_table.ht_resizing = 0;
+}
+
+/*
+ * Called periodically by the reclaim thread to decide whether the hash
+ * table should be resized.  The resize itself runs from system_taskq so
+ * that it does not hold up eviction.
+ */
+static void
+buf_hash_resize_check(void)
+{
+	uint64_t size = buf_hash_table.ht_mask + 1;
+	uint64_t elements = ARCSTAT(arcstat_hash_elements);
+	uint64_t nsize;
+
+	if (!zfs_arc_hash_resize || buf_hash_table.ht_resizing)
+		return;
+
+	if (elements > size * 2)
+		nsize = size << 1;
+	else if (elements < size / 8 && size > buf_hash_table.ht_min_size)
+		nsize = size >> 1;
+	else
+		return;
+
+	if (atomic_cas_32(&buf_hash_table.ht_resizing, 0, 1) != 0)
+		return;
+
+	ARCSTAT(arcstat_hash_resize_pending) = buf_hash_table.ht_nlocks;
+	if (taskq_dispatch(system_taskq, buf_hash_resize,
+	    (void *)(uintptr_t)nsize, TQ_NOSLEEP) == 0) {
+		ARCSTAT(arcstat_hash_resize_pending) = 0;
+		buf_hash_table.ht_resizing = 0;
+	}
+}
+
 /*
  * Global data structures and functions for the buf kmem cache.
  */
-static kmem_cache_t *hdr_cache;
+static kmem_cache_t *hdr_full_cache;
+static kmem_cache_t *hdr_l2only_cache;
 static kmem_cache_t *buf_cache;
 
 static void
@@ -870,6 +1351,10 @@ buf_fini(void)
 {
 	int i;
 
+	/* wait for any in-flight resize to finish with the table */
+	while (buf_hash_table.ht_resizing)
+		delay(1);
+
 #if defined(_KERNEL) && defined(HAVE_SPL)
 	/* Large allocations which do not require contiguous pages
 	 * should be using vmem_free() in the linux kernel */
@@ -879,9 +1364,12 @@ buf_fini(void)
 	kmem_free(buf_hash_table.ht_table,
 	    (buf_hash_table.ht_mask + 1) * sizeof (void *));
 #endif
-	for (i = 0; i < BUF_LOCKS; i++)
+	for (i = 0; i < buf_hash_table.ht_nlocks; i++)
 		mutex_destroy(&buf_hash_table.ht_locks[i].ht_lock);
-	kmem_cache_destroy(hdr_cache);
+	kmem_free(buf_hash_table.ht_locks,
+	    buf_hash_table.ht_nlocks * sizeof (struct ht_lock));
+	kmem_cache_destroy(hdr_full_cache);
+	kmem_cache_destroy(hdr_l2only_cache);
 	kmem_cache_destroy(buf_cache);
 }
 
@@ -891,17 +1379,30 @@ buf_fini(void)
  */
 /* ARGSUSED */
 static int
-hdr_cons(void *vbuf, void *unused, int kmflag)
+hdr_full_cons(void *vbuf, void *unused, int kmflag)
+{
+	arc_buf_hdr_t *buf = vbuf;
+
+	bzero(buf, HDR_FULL_SIZE);
+	refcount_create(&buf->b_l1hdr.b_refcnt);
+	cv_init(&buf->b_l1hdr.b_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&buf->b_l1hdr.b_freeze_lock, NULL, MUTEX_DEFAULT, NULL);
+	multilist_link_init(&buf->b_l1hdr.b_arc_node);
+	list_link_init(&buf->b_l2hdr.b_l2node);
+	arc_space_consume(HDR_FULL_SIZE, ARC_SPACE_HDRS);
+
+	return (0);
+}
+
+/* ARGSUSED */
+static int
+hdr_l2only_cons(void *vbuf, void *unused, int kmflag)
 {
 	arc_buf_hdr_t *buf = vbuf;
 
-	bzero(buf, sizeof (arc_buf_hdr_t));
-	refcount_create(&buf->b_refcnt);
-	cv_init(&buf->b_cv, NULL, CV_DEFAULT, NULL);
-	mutex_init(&buf->b_freeze_lock, NULL, MUTEX_DEFAULT, NULL);
-	list_link_init(&buf->b_arc_node);
-	list_link_init(&buf->b_l2node);
-	arc_space_consume(sizeof (arc_buf_hdr_t), ARC_SPACE_HDRS);
+	bzero(buf, HDR_L2ONLY_SIZE);
+	list_link_init(&buf->b_l2hdr.b_l2node);
+	arc_space_consume(HDR_L2ONLY_SIZE, ARC_SPACE_HDRS);
 
 	return (0);
 }
@@ -925,15 +1426,25 @@ buf_cons(void *vbuf, void *unused, int kmflag)
  */
 /* ARGSUSED */
 static void
-hdr_dest(void *vbuf, void *unused)
+hdr_full_dest(void *vbuf, void *unused)
 {
 	arc_buf_hdr_t *buf = vbuf;
 
 	ASSERT(BUF_EMPTY(buf));
-	refcount_destroy(&buf->b_refcnt);
-	cv_destroy(&buf->b_cv);
-	mutex_destroy(&buf->b_freeze_lock);
-	arc_space_return(sizeof (arc_buf_hdr_t), ARC_SPACE_HDRS);
+	refcount_destroy(&buf->b_l1hdr.b_refcnt);
+	cv_destroy(&buf->b_l1hdr.b_cv);
+	mutex_destroy(&buf->b_l1hdr.b_freeze_lock);
+	arc_space_return(HDR_FULL_SIZE, ARC_SPACE_HDRS);
+}
+
+/* ARGSUSED */
+static void
+hdr_l2only_dest(void *vbuf, void *unused)
+{
+	ASSERTV(arc_buf_hdr_t *buf = vbuf);
+
+	ASSERT(BUF_EMPTY(buf));
+	arc_space_return(HDR_L2ONLY_SIZE, ARC_SPACE_HDRS);
 }
 
 /* ARGSUSED */
@@ -951,14 +1462,24 @@ buf_init(void)
 {
 	uint64_t *ct;
 	uint64_t hsize = 1ULL << 12;
+	uint64_t nlocks;
 	int i, j;
 
+	/*
+	 * Scale the number of hash locks with the number of CPUs to keep
+	 * contention down; the lock count must be a power of two.
+	 */
+	nlocks = MAX(BUF_LOCKS_MIN, max_ncpus * BUF_LOCKS_PER_CPU);
+	if (!ISP2(nlocks))
+		nlocks = 1ULL << highbit(nlocks);
+	buf_hash_table.ht_nlocks = nlocks;
+
 	/*
 	 * The hash table is big enough to fill all of physical memory
 	 * with an average 64K block size.  The table will take up
 	 * totalmem*sizeof(void*)/64K (eg. 128KB/GB with 8-byte pointers).
 	 */
-	while (hsize * 65536 < physmem * PAGESIZE)
+	while (hsize * 65536 < physmem * PAGESIZE || hsize < nlocks)
 		hsize <<= 1;
 retry:
 	buf_hash_table.ht_mask = hsize - 1;
@@ -972,13 +1493,20 @@ retry:
 	    kmem_zalloc(hsize * sizeof (void*), KM_NOSLEEP);
 #endif
 	if (buf_hash_table.ht_table == NULL) {
-		ASSERT(hsize > (1ULL << 8));
+		ASSERT(hsize > nlocks);
 		hsize >>= 1;
 		goto retry;
 	}
-
-	hdr_cache = kmem_cache_create("arc_buf_hdr_t", sizeof (arc_buf_hdr_t),
-	    0, hdr_cons, hdr_dest, NULL, NULL, NULL, 0);
+	buf_hash_table.ht_min_size = hsize;
+	buf_hash_table.ht_resizing = 0;
+	ARCSTAT(arcstat_hash_buckets) = hsize;
+	ARCSTAT(arcstat_hash_locks) = nlocks;
+
+	hdr_full_cache = kmem_cache_create("arc_buf_hdr_t_full", HDR_FULL_SIZE,
+	    0, hdr_full_cons, hdr_full_dest, NULL, NULL, NULL, 0);
+	hdr_l2only_cache = kmem_cache_create("arc_buf_hdr_t_l2only",
+	    HDR_L2ONLY_SIZE, 0, hdr_l2only_cons, hdr_l2only_dest, NULL,
+	    NULL, NULL, 0);
 	buf_cache = kmem_cache_create("arc_buf_t", sizeof (arc_buf_t),
 	    0, buf_cons, buf_dest, NULL, NULL, NULL, 0);
 
@@ -986,9 +1514,13 @@ retry:
 		for (ct = zfs_crc64_table + i, *ct = i, j = 8; j > 0; j--)
 			*ct = (*ct >> 1) ^ (-(*ct & 1) & ZFS_CRC64_POLY);
 
-	for (i = 0; i < BUF_LOCKS; i++) {
+	buf_hash_table.ht_locks =
+	    kmem_zalloc(nlocks * sizeof (struct ht_lock), KM_SLEEP);
+	for (i = 0; i < nlocks; i++) {
 		mutex_init(&buf_hash_table.ht_locks[i].ht_lock,
 		    NULL, MUTEX_DEFAULT, NULL);
+		buf_hash_table.ht_locks[i].ht_table = buf_hash_table.ht_table;
+		buf_hash_table.ht_locks[i].ht_mask = buf_hash_table.ht_mask;
 	}
 }
 
@@ -1002,16 +1534,16 @@ arc_cksum_verify(arc_buf_t *buf)
 	if (!(zfs_flags & ZFS_DEBUG_MODIFY))
 		return;
 
-	mutex_enter(&buf->b_hdr->b_freeze_lock);
+	mutex_enter(&buf->b_hdr->b_l1hdr.b_freeze_lock);
 	if (buf->b_hdr->b_freeze_cksum == NULL ||
 	    (buf->b_hdr->b_flags & ARC_IO_ERROR)) {
-		mutex_exit(&buf->b_hdr->b_freeze_lock);
+		mutex_exit(&buf->b_hdr->b_l1hdr.b_freeze_lock);
 		return;
 	}
 	fletcher_2_native(buf->b_data, buf->b_hdr->b_size, &zc);
 	if (!ZIO_CHECKSUM_EQUAL(*buf->b_hdr->b_freeze_cksum, zc))
 		panic("buffer modified while frozen!");
-	mutex_exit(&buf->b_hdr->b_freeze_lock);
+	mutex_exit(&buf->b_hdr->b_l1hdr.b_freeze_lock);
 }
 
 static int
@@ -1020,10 +1552,10 @@ arc_cksum_equal(arc_buf_t *buf)
 	zio_cksum_t zc;
 	int equal;
 
-	mutex_enter(&buf->b_hdr->b_freeze_lock);
+	mutex_enter(&buf->b_hdr->b_l1hdr.b_freeze_lock);
 	fletcher_2_native(buf->b_data, buf->b_hdr->b_size, &zc);
 	equal = ZIO_CHECKSUM_EQUAL(*buf->b_hdr->b_freeze_cksum, zc);
-	mutex_exit(&buf->b_hdr->b_freeze_lock);
+	mutex_exit(&buf->b_hdr->b_l1hdr.b_freeze_lock);
 
 	return (equal);
 }
@@ -1034,16 +1566,16 @@ arc_cksum_compute(arc_buf_t *buf, boolean_t force)
 	if (!force && !(zfs_flags & ZFS_DEBUG_MODIFY))
 		return;
 
-	mutex_enter(&buf->b_hdr->b_freeze_lock);
+	mutex_enter(&buf->b_hdr->b_l1hdr.b_freeze_lock);
 	if (buf->b_hdr->b_freeze_cksum != NULL) {
-		mutex_exit(&buf->b_hdr->b_freeze_lock);
+		mutex_exit(&buf->b_hdr->b_l1hdr.b_freeze_lock);
 		return;
 	}
 	buf->b_hdr->b_freeze_cksum = kmem_alloc(sizeof (zio_cksum_t),
 	                                        KM_PUSHPAGE);
 	fletcher_2_native(buf->b_data, buf->b_hdr->b_size,
 	    buf->b_hdr->b_freeze_cksum);
-	mutex_exit(&buf->b_hdr->b_freeze_lock);
+	mutex_exit(&buf->b_hdr->b_l1hdr.b_freeze_lock);
 }
 
 void
@@ -1057,13 +1589,13 @@ arc_buf_thaw(arc_buf_t *buf)
 		arc_cksum_verify(buf);
 	}
 
-	mutex_enter(&buf->b_hdr->b_freeze_lock);
+	mutex_enter(&buf->b_hdr->b_l1hdr.b_freeze_lock);
 	if (buf->b_hdr->b_freeze_cksum != NULL) {
 		kmem_free(buf->b_hdr->b_freeze_cksum, sizeof (zio_cksum_t));
 		buf->b_hdr->b_freeze_cksum = NULL;
 	}
 
-	mutex_exit(&buf->b_hdr->b_freeze_lock);
+	mutex_exit(&buf->b_hdr->b_l1hdr.b_freeze_lock);
 }
 
 void
@@ -1083,30 +1615,46 @@ arc_buf_freeze(arc_buf_t *buf)
 	mutex_exit(hash_lock);
 }
 
+/*
+ * The amount of cached data held by a header: its decompressed buffers
+ * plus the compressed copy of the block, if one is being kept.
+ */
+static uint64_t
+arc_hdr_size(arc_buf_hdr_t *ab)
+{
+	uint64_t size;
+
+	if (!HDR_HAS_L1HDR(ab))
+		return (0);
+
+	size = ab->b_l1hdr.b_datacnt * ab->b_size;
+	if (ab->b_l1hdr.b_pdata != NULL)
+		size += ab->b_l1hdr.b_psize;
+	return (size);
+}
+
 static void
 add_reference(arc_buf_hdr_t *ab, kmutex_t *hash_lock, void *tag)
 {
 	ASSERT(MUTEX_HELD(hash_lock));
+	ASSERT(HDR_HAS_L1HDR(ab));
 
-	if ((refcount_add(&ab->b_refcnt, tag) == 1) &&
-	    (ab->b_state != arc_anon)) {
-		uint64_t delta = ab->b_size * ab->b_datacnt;
-		list_t *list = &ab->b_state->arcs_list[ab->b_type];
+	if ((refcount_add(&ab->b_l1hdr.b_refcnt, tag) == 1) &&
+	    (ab->b_state != arc_anon) && (ab->b_state != arc_l2c_only)) {
+		uint64_t delta = arc_hdr_size(ab);
+		multilist_t *list = &ab->b_state->arcs_list[ab->b_type];
 		uint64_t *size = &ab->b_state->arcs_lsize[ab->b_type];
 
-		ASSERT(!MUTEX_HELD(&ab->b_state->arcs_mtx));
-		mutex_enter(&ab->b_state->arcs_mtx);
-		ASSERT(list_link_active(&ab->b_arc_node));
-		list_remove(list, ab);
+		ASSERT(multilist_link_active(&ab->b_l1hdr.b_arc_node));
+		multilist_remove(list, ab);
 		if (GHOST_STATE(ab->b_state)) {
-			ASSERT0(ab->b_datacnt);
-			ASSERT3P(ab->b_buf, ==, NULL);
+			ASSERT0(ab->b_l1hdr.b_datacnt);
+			ASSERT3P(ab->b_l1hdr.b_buf, ==, NULL);
 			delta = ab->b_size;
 		}
 		ASSERT(delta > 0);
 		ASSERT3U(*size, >=, delta);
 		atomic_add_64(size, -delta);
-		mutex_exit(&ab->b_state->arcs_mtx);
 		/* remove the prefetch flag if we get a reference */
 		if (ab->b_flags & ARC_PREFETCH)
 			ab->b_flags &= ~ARC_PREFETCH;
@@ -1121,40 +1669,224 @@ remove_reference(arc_buf_hdr_t *ab, kmutex_t *hash_lock, void *tag)
 
 	ASSERT(state == arc_anon || MUTEX_HELD(hash_lock));
 	ASSERT(!GHOST_STATE(state));
+	ASSERT(HDR_HAS_L1HDR(ab));
 
-	if (((cnt = refcount_remove(&ab->b_refcnt, tag)) == 0) &&
+	if (((cnt = refcount_remove(&ab->b_l1hdr.b_refcnt, tag)) == 0) &&
 	    (state != arc_anon)) {
 		uint64_t *size = &state->arcs_lsize[ab->b_type];
 
-		ASSERT(!MUTEX_HELD(&state->arcs_mtx));
-		mutex_enter(&state->arcs_mtx);
-		ASSERT(!list_link_active(&ab->b_arc_node));
-		list_insert_head(&state->arcs_list[ab->b_type], ab);
-		ASSERT(ab->b_datacnt > 0);
-		atomic_add_64(size, ab->b_size * ab->b_datacnt);
-		mutex_exit(&state->arcs_mtx);
+		ASSERT(!multilist_link_active(&ab->b_l1hdr.b_arc_node));
+		multilist_insert(&state->arcs_list[ab->b_type], ab);
+		ASSERT(ab->b_l1hdr.b_datacnt > 0 ||
+		    ab->b_l1hdr.b_pdata != NULL);
+		atomic_add_64(size, arc_hdr_size(ab));
 	}
 	return (cnt);
 }
 
+/*
+ * Find the statistics entry of an objset and take a reference on it.
+ * Entries are only created by arc_os_stats_register(), so blocks of an
+ * objset which has never been opened are not accounted.
+ */
+static arc_os_stats_t *
+arc_os_stats_lookup(uint64_t spa, uint64_t objset)
+{
+	uint64_t idx = AOS_HASH(spa, objset);
+	arc_os_stats_t *aos;
+
+	mutex_enter(&arc_os_stats_locks[idx]);
+	for (aos = arc_os_stats_table[idx]; aos != NULL; aos = aos->aos_next) {
+		if (aos->aos_spa == spa && aos->aos_objset == objset) {
+			atomic_inc_64(&aos->aos_refcnt);
+			break;
+		}
+	}
+	mutex_exit(&arc_os_stats_locks[idx]);
+
+	return (aos);
+}
+
+/*
+ * Drop a reference taken by arc_os_stats_lookup().  Only the final
+ * release needs the bucket lock, to keep lookups from finding an entry
+ * which is about to be freed.
+ */
+static void
+arc_os_stats_rele(arc_os_stats_t *aos)
+{
+	uint64_t idx = AOS_HASH(aos->aos_spa, aos->aos_objset);
+	arc_os_stats_t **aosp;
+	uint64_t refcnt;
+
+	while ((refcnt = aos->aos_refcnt) > 1) {
+		if (atomic_cas_64(&aos->aos_refcnt, refcnt, refcnt - 1) ==
+		    refcnt)
+			return;
+	}
+
+	mutex_enter(&arc_os_stats_locks[idx]);
+	if (atomic_dec_64_nv(&aos->aos_refcnt) != 0) {
+		mutex_exit(&arc_os_stats_locks[idx]);
+		return;
+	}
+	for (aosp = &arc_os_stats_table[idx]; *aosp != aos;
+	    aosp = &(*aosp)->aos_next)
+		ASSERT(*aosp != NULL);
+	*aosp = aos->aos_next;
+	mutex_exit(&arc_os_stats_locks[idx]);
+
+	ASSERT0(aos->aos_opens);
+	ASSERT3P(aos->aos_ksp, ==, NULL);
+	kmem_free(aos, sizeof (arc_os_stats_t));
+}
+
+/*
+ * Called when an objset is opened; returns its statistics entry, creating
+ * it and its kstat as needed.  The kstat only exists while the objset is
+ * open, but the counters persist as long as any of its blocks are cached.
+ */
+arc_os_stats_t *
+arc_os_stats_register(spa_t *spa, uint64_t objset)
+{
+	uint64_t guid = spa_load_guid(spa);
+	uint64_t idx = AOS_HASH(guid, objset);
+	arc_os_stats_t *aos, *naos;
+	char module[KSTAT_STRLEN], name[KSTAT_STRLEN];
+
+	if ((aos = arc_os_stats_lookup(guid, objset)) == NULL) {
+		naos = kmem_zalloc(sizeof (arc_os_stats_t), KM_SLEEP);
+		naos->aos_spa = guid;
+		naos->aos_objset = objset;
+		naos->aos_refcnt = 1;
+		naos->aos_stats = arc_os_kstats_template;
+
+		mutex_enter(&arc_os_stats_locks[idx]);
+		for (aos = arc_os_stats_table[idx]; aos != NULL;
+		    aos = aos->aos_next) {
+			if (aos->aos_spa == guid && aos->aos_objset == objset) {
+				atomic_inc_64(&aos->aos_refcnt);
+				break;
+			}
+		}
+		if (aos == NULL) {
+			naos->aos_next = arc_os_stats_table[idx];
+			arc_os_stats_table[idx] = naos;
+			aos = naos;
+			naos = NULL;
+		}
+		mutex_exit(&arc_os_stats_locks[idx]);
+
+		if (naos != NULL)
+			kmem_free(naos, sizeof (arc_os_stats_t));
+	}
+
+	/*
+	 * The kstat is created and destroyed under a lock of its own, which
+	 * is never taken from the ARC's eviction paths, as both may sleep
+	 * waiting for memory.
+	 */
+	mutex_enter(&arc_os_stats_kstat_lock);
+	if (aos->aos_opens++ == 0) {
+		(void) snprintf(module, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+		(void) snprintf(name, KSTAT_STRLEN, "objset-0x%llx",
+		    (u_longlong_t)objset);
+		aos->aos_ksp = kstat_create(module, 0, name, "misc",
+		    KSTAT_TYPE_NAMED, sizeof (arc_os_kstats_t) /
+		    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+		if (aos->aos_ksp != NULL) {
+			aos->aos_ksp->ks_data = &aos->aos_stats;
+			kstat_install(aos->aos_ksp);
+		}
+	}
+	mutex_exit(&arc_os_stats_kstat_lock);
+
+	return (aos);
+}
+
+void
+arc_os_stats_unregister(arc_os_stats_t *aos)
+{
+	mutex_enter(&arc_os_stats_kstat_lock);
+	ASSERT3U(aos->aos_opens, >, 0);
+	if (--aos->aos_opens == 0 && aos->aos_ksp != NULL) {
+		kstat_delete(aos->aos_ksp);
+		aos->aos_ksp = NULL;
+	}
+	mutex_exit(&arc_os_stats_kstat_lock);
+
+	arc_os_stats_rele(aos);
+}
+
+/*
+ * Associate a header with the statistics of the objset its block belongs
+ * to.  This is done while the header is anonymous or a ghost, so that
+ * its resident size is accounted when it next changes state.
+ */
+static void
+arc_hdr_set_os_stats(arc_buf_hdr_t *hdr, uint64_t objset)
+{
+	ASSERT(hdr->b_state == arc_anon || GHOST_STATE(hdr->b_state));
+
+	if (hdr->b_os_stats != NULL) {
+		if (hdr->b_os_stats->aos_objset == objset)
+			return;
+		arc_os_stats_rele(hdr->b_os_stats);
+	}
+	hdr->b_os_stats = arc_os_stats_lookup(hdr->b_spa, objset);
+}
+
+static void
+arc_os_stats_resident(arc_buf_hdr_t *hdr, arc_state_t *state, int64_t delta)
+{
+	arc_os_kstats_t *aoss = &hdr->b_os_stats->aos_stats;
+	kstat_named_t *ks;
+
+	if (state == arc_mru) {
+		ks = (hdr->b_type == ARC_BUFC_METADATA) ?
+		    &aoss->aoss_metadata_mru_size : &aoss->aoss_data_mru_size;
+	} else if (state == arc_mfu) {
+		ks = (hdr->b_type == ARC_BUFC_METADATA) ?
+		    &aoss->aoss_metadata_mfu_size : &aoss->aoss_data_mfu_size;
+	} else {
+		return;
+	}
+
+	atomic_add_64(&ks->value.ui64, delta);
+}
+
 /*
  * Move the supplied buffer to the indicated state.  The mutex
  * for the buffer must be held by the caller.
+ *
+ * Headers in the arc_l2c_only state are never placed on a list, as
+ * nothing is ever evicted from that state; this also allows them to
+ * be L2-only headers which do not carry a b_arc_node.
  */
 static void
 arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 {
 	arc_state_t *old_state = ab->b_state;
-	int64_t refcnt = refcount_count(&ab->b_refcnt);
+	int64_t refcnt = 0;
+	uint32_t datacnt = 0;
 	uint64_t from_delta, to_delta;
 
 	ASSERT(MUTEX_HELD(hash_lock));
 	ASSERT(new_state != old_state);
-	ASSERT(refcnt == 0 || ab->b_datacnt > 0);
-	ASSERT(ab->b_datacnt == 0 || !GHOST_STATE(new_state));
-	ASSERT(ab->b_datacnt <= 1 || old_state != arc_anon);
+	if (HDR_HAS_L1HDR(ab)) {
+		refcnt = refcount_count(&ab->b_l1hdr.b_refcnt);
+		datacnt = ab->b_l1hdr.b_datacnt;
+		ASSERT(ab->b_l1hdr.b_pdata == NULL ||
+		    !GHOST_STATE(new_state));
+	} else {
+		ASSERT(old_state == arc_l2c_only ||
+		    new_state == arc_l2c_only);
+	}
+	ASSERT(refcnt == 0 || datacnt > 0);
+	ASSERT(datacnt == 0 || !GHOST_STATE(new_state));
+	ASSERT(datacnt <= 1 || old_state != arc_anon);
 
-	from_delta = to_delta = ab->b_datacnt * ab->b_size;
+	from_delta = to_delta = arc_hdr_size(ab);
 
 	/*
 	 * If this buffer is evictable, transfer it from the
@@ -1162,49 +1894,42 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 	 */
 	if (refcnt == 0) {
 		if (old_state != arc_anon) {
-			int use_mutex = !MUTEX_HELD(&old_state->arcs_mtx);
 			uint64_t *size = &old_state->arcs_lsize[ab->b_type];
 
-			if (use_mutex)
-				mutex_enter(&old_state->arcs_mtx);
-
-			ASSERT(list_link_active(&ab->b_arc_node));
-			list_remove(&old_state->arcs_list[ab->b_type], ab);
-
 			/*
 			 * If prefetching out of the ghost cache,
 			 * we will have a non-zero datacnt.
 			 */
-			if (GHOST_STATE(old_state) && ab->b_datacnt == 0) {
+			if (GHOST_STATE(old_state) && datacnt == 0) {
 				/* ghost elements have a ghost size */
-				ASSERT(ab->b_buf == NULL);
+				ASSERT(!HDR_HAS_L1HDR(ab) ||
+				    ab->b_l1hdr.b_buf == NULL);
 				from_delta = ab->b_size;
 			}
-			ASSERT3U(*size, >=, from_delta);
-			atomic_add_64(size, -from_delta);
-
-			if (use_mutex)
-				mutex_exit(&old_state->arcs_mtx);
+			if (old_state != arc_l2c_only) {
+				ASSERT(multilist_link_active(
+				    &ab->b_l1hdr.b_arc_node));
+				multilist_remove(
+				    &old_state->arcs_list[ab->b_type], ab);
+				ASSERT3U(*size, >=, from_delta);
+				atomic_add_64(size, -from_delta);
+			}
 		}
 		if (new_state != arc_anon) {
-			int use_mutex = !MUTEX_HELD(&new_state->arcs_mtx);
 			uint64_t *size = &new_state->arcs_lsize[ab->b_type];
 
-			if (use_mutex)
-				mutex_enter(&new_state->arcs_mtx);
-
-			list_insert_head(&new_state->arcs_list[ab->b_type], ab);
-
 			/* ghost elements have a ghost size */
 			if (GHOST_STATE(new_state)) {
-				ASSERT(ab->b_datacnt == 0);
-				ASSERT(ab->b_buf == NULL);
+				ASSERT(datacnt == 0);
+				ASSERT(!HDR_HAS_L1HDR(ab) ||
+				    ab->b_l1hdr.b_buf == NULL);
 				to_delta = ab->b_size;
 			}
-			atomic_add_64(size, to_delta);
-
-			if (use_mutex)
-				mutex_exit(&new_state->arcs_mtx);
+			if (new_state != arc_l2c_only) {
+				multilist_insert(
+				    &new_state->arcs_list[ab->b_type], ab);
+				atomic_add_64(size, to_delta);
+			}
 		}
 	}
 
@@ -1221,6 +1946,11 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 	}
 	ab->b_state = new_state;
 
+	if (ab->b_os_stats != NULL) {
+		arc_os_stats_resident(ab, old_state, -ab->b_size);
+		arc_os_stats_resident(ab, new_state, ab->b_size);
+	}
+
 	/* adjust l2arc hdr stats */
 	if (new_state == arc_l2c_only)
 		l2arc_hdr_stat_add();
@@ -1291,25 +2021,25 @@ arc_buf_alloc(spa_t *spa, int size, void *tag, arc_buf_contents_t type)
 	arc_buf_t *buf;
 
 	ASSERT3U(size, >, 0);
-	hdr = kmem_cache_alloc(hdr_cache, KM_PUSHPAGE);
+	hdr = kmem_cache_alloc(hdr_full_cache, KM_PUSHPAGE);
 	ASSERT(BUF_EMPTY(hdr));
 	hdr->b_size = size;
 	hdr->b_type = type;
 	hdr->b_spa = spa_load_guid(spa);
 	hdr->b_state = arc_anon;
-	hdr->b_arc_access = 0;
+	hdr->b_l1hdr.b_arc_access = 0;
 	buf = kmem_cache_alloc(buf_cache, KM_PUSHPAGE);
 	buf->b_hdr = hdr;
 	buf->b_data = NULL;
 	buf->b_efunc = NULL;
 	buf->b_private = NULL;
 	buf->b_next = NULL;
-	hdr->b_buf = buf;
+	hdr->b_l1hdr.b_buf = buf;
 	arc_get_data_buf(buf);
-	hdr->b_datacnt = 1;
-	hdr->b_flags = 0;
-	ASSERT(refcount_is_zero(&hdr->b_refcnt));
-	(void) refcount_add(&hdr->b_refcnt, tag);
+	hdr->b_l1hdr.b_datacnt = 1;
+	hdr->b_flags = ARC_HAS_L1HDR;
+	ASSERT(refcount_is_zero(&hdr->b_l1hdr.b_refcnt));
+	(void) refcount_add(&hdr->b_l1hdr.b_refcnt, tag);
 
 	return (buf);
 }
@@ -1342,8 +2072,8 @@ arc_return_buf(arc_buf_t *buf, void *tag)
 	arc_buf_hdr_t *hdr = buf->b_hdr;
 
 	ASSERT(buf->b_data != NULL);
-	(void) refcount_add(&hdr->b_refcnt, tag);
-	(void) refcount_remove(&hdr->b_refcnt, arc_onloan_tag);
+	(void) refcount_add(&hdr->b_l1hdr.b_refcnt, tag);
+	(void) refcount_remove(&hdr->b_l1hdr.b_refcnt, arc_onloan_tag);
 
 	atomic_add_64(&arc_loaned_bytes, -hdr->b_size);
 }
@@ -1356,8 +2086,8 @@ arc_loan_inuse_buf(arc_buf_t *buf, void *tag)
 
 	ASSERT(buf->b_data != NULL);
 	hdr = buf->b_hdr;
-	(void) refcount_add(&hdr->b_refcnt, arc_onloan_tag);
-	(void) refcount_remove(&hdr->b_refcnt, tag);
+	(void) refcount_add(&hdr->b_l1hdr.b_refcnt, arc_onloan_tag);
+	(void) refcount_remove(&hdr->b_l1hdr.b_refcnt, tag);
 	buf->b_efunc = NULL;
 	buf->b_private = NULL;
 
@@ -1378,8 +2108,8 @@ arc_buf_clone(arc_buf_t *from)
 	buf->b_data = NULL;
 	buf->b_efunc = NULL;
 	buf->b_private = NULL;
-	buf->b_next = hdr->b_buf;
-	hdr->b_buf = buf;
+	buf->b_next = hdr->b_l1hdr.b_buf;
+	hdr->b_l1hdr.b_buf = buf;
 	arc_get_data_buf(buf);
 	bcopy(from->b_data, buf->b_data, size);
 
@@ -1393,7 +2123,7 @@ arc_buf_clone(arc_buf_t *from)
 		ARCSTAT_BUMP(arcstat_duplicate_buffers);
 		ARCSTAT_INCR(arcstat_duplicate_buffers_size, size);
 	}
-	hdr->b_datacnt += 1;
+	hdr->b_l1hdr.b_datacnt += 1;
 	return (buf);
 }
 
@@ -1423,6 +2153,9 @@ arc_buf_add_ref(arc_buf_t *buf, void* tag)
 	add_reference(hdr, hash_lock, tag);
 	DTRACE_PROBE1(arc__hit, arc_buf_hdr_t *, hdr);
 	arc_access(hdr, hash_lock);
+	AOSSTAT_CONDSTAT(hdr->b_os_stats, !(hdr->b_flags & ARC_PREFETCH),
+	    demand, prefetch, hdr->b_type != ARC_BUFC_METADATA,
+	    data, metadata, hits);
 	mutex_exit(hash_lock);
 	ARCSTAT_BUMP(arcstat_hits);
 	ARCSTAT_CONDSTAT(!(hdr->b_flags & ARC_PREFETCH),
@@ -1453,8 +2186,108 @@ arc_buf_data_free(arc_buf_hdr_t *hdr, void (*free_func)(void *, size_t),
 	}
 }
 
+/*
+ * Attach the compressed copy of a block to its header.  The copy is
+ * accounted for as part of the header's state just like its
+ * decompressed buffers are.
+ */
+static void
+arc_hdr_set_pdata(arc_buf_hdr_t *hdr, abd_t *pdata, uint64_t psize,
+    enum zio_compress c)
+{
+	arc_state_t *state = hdr->b_state;
+
+	ASSERT3P(hdr->b_l1hdr.b_pdata, ==, NULL);
+	ASSERT3U(hdr->b_type, ==, ARC_BUFC_DATA);
+	ASSERT(state == arc_mru || state == arc_mfu);
+
+	hdr->b_l1hdr.b_pdata = pdata;
+	hdr->b_l1hdr.b_psize = psize;
+	hdr->b_l1hdr.b_compress = c;
+
+	atomic_add_64(&state->arcs_size, psize);
+	if (multilist_link_active(&hdr->b_l1hdr.b_arc_node)) {
+		ASSERT(refcount_is_zero(&hdr->b_l1hdr.b_refcnt));
+		atomic_add_64(&state->arcs_lsize[hdr->b_type], psize);
+	}
+	ARCSTAT_INCR(arcstat_data_size, psize);
+	ARCSTAT_INCR(arcstat_compressed_size, psize);
+	ARCSTAT_INCR(arcstat_uncompressed_size, hdr->b_size);
+	atomic_add_64(&arc_size, psize);
+}
+
+/*
+ * Free the compressed copy of a block.  Returns the number of bytes
+ * released.
+ */
+static uint64_t
+arc_hdr_free_pdata(arc_buf_hdr_t *hdr)
+{
+	arc_state_t *state = hdr->b_state;
+	uint64_t psize = hdr->b_l1hdr.b_psize;
+
+	ASSERT(hdr->b_l1hdr.b_pdata != NULL);
+	ASSERT(!GHOST_STATE(state));
+
+	if (multilist_link_active(&hdr->b_l1hdr.b_arc_node)) {
+		ASSERT(refcount_is_zero(&hdr->b_l1hdr.b_refcnt));
+		ASSERT3U(state->arcs_lsize[hdr->b_type], >=, psize);
+		atomic_add_64(&state->arcs_lsize[hdr->b_type], -psize);
+	}
+	ASSERT3U(state->arcs_size, >=, psize);
+	atomic_add_64(&state->arcs_size, -psize);
+	ARCSTAT_INCR(arcstat_data_size, -psize);
+	ARCSTAT_INCR(arcstat_compressed_size, -psize);
+	ARCSTAT_INCR(arcstat_uncompressed_size, -hdr->b_size);
+	atomic_add_64(&arc_size, -psize);
+
+	/*
+	 * The L2ARC feed takes a private copy of the compressed data
+	 * while holding the hash lock, so it can be freed immediately.
+	 */
+	abd_free(hdr->b_l1hdr.b_pdata);
+	hdr->b_l1hdr.b_pdata = NULL;
+	hdr->b_l1hdr.b_psize = 0;
+	hdr->b_l1hdr.b_compress = ZIO_COMPRESS_OFF;
+
+	return (psize);
+}
+
+/*
+ * Give a header which only holds the compressed copy of its block a
+ * decompressed buffer again.  The caller must hold a reference on the
+ * header so that it cannot be evicted while the buffer is allocated.
+ */
+static arc_buf_t *
+arc_buf_alloc_decompress(arc_buf_hdr_t *hdr)
+{
+	arc_buf_t *buf;
+
+	ASSERT(hdr->b_l1hdr.b_pdata != NULL);
+	ASSERT3P(hdr->b_l1hdr.b_buf, ==, NULL);
+	ASSERT0(hdr->b_l1hdr.b_datacnt);
+	ASSERT(!refcount_is_zero(&hdr->b_l1hdr.b_refcnt));
+
+	buf = kmem_cache_alloc(buf_cache, KM_PUSHPAGE);
+	buf->b_hdr = hdr;
+	buf->b_data = NULL;
+	buf->b_efunc = NULL;
+	buf->b_private = NULL;
+	buf->b_next = NULL;
+	hdr->b_l1hdr.b_buf = buf;
+	hdr->b_l1hdr.b_datacnt = 1;
+	arc_get_data_buf(buf);
+
+	/* the compressed copy was checksummed when it was read */
+	VERIFY0(zio_decompress_data(hdr->b_l1hdr.b_compress,
+	    hdr->b_l1hdr.b_pdata, buf->b_data, hdr->b_l1hdr.b_psize,
+	    hdr->b_size));
+
+	return (buf);
+}
+
 static void
-arc_buf_destroy(arc_buf_t *buf, boolean_t recycle, boolean_t all)
+arc_buf_destroy(arc_buf_t *buf, boolean_t all)
 {
 	arc_buf_t **bufp;
 
@@ -1466,23 +2299,21 @@ arc_buf_destroy(arc_buf_t *buf, boolean_t recycle, boolean_t all)
 
 		arc_cksum_verify(buf);
 
-		if (!recycle) {
-			if (type == ARC_BUFC_METADATA) {
-				arc_buf_data_free(buf->b_hdr, zio_buf_free,
-				    buf->b_data, size);
-				arc_space_return(size, ARC_SPACE_DATA);
-			} else {
-				ASSERT(type == ARC_BUFC_DATA);
-				arc_buf_data_free(buf->b_hdr,
-				    zio_data_buf_free, buf->b_data, size);
-				ARCSTAT_INCR(arcstat_data_size, -size);
-				atomic_add_64(&arc_size, -size);
-			}
+		if (type == ARC_BUFC_METADATA) {
+			arc_buf_data_free(buf->b_hdr, zio_buf_free,
+			    buf->b_data, size);
+			arc_space_return(size, ARC_SPACE_DATA);
+		} else {
+			ASSERT(type == ARC_BUFC_DATA);
+			arc_buf_data_free(buf->b_hdr,
+			    zio_data_buf_free, buf->b_data, size);
+			ARCSTAT_INCR(arcstat_data_size, -size);
+			atomic_add_64(&arc_size, -size);
 		}
-		if (list_link_active(&buf->b_hdr->b_arc_node)) {
+		if (multilist_link_active(&buf->b_hdr->b_l1hdr.b_arc_node)) {
 			uint64_t *cnt = &state->arcs_lsize[type];
 
-			ASSERT(refcount_is_zero(&buf->b_hdr->b_refcnt));
+			ASSERT(refcount_is_zero(&buf->b_hdr->b_l1hdr.b_refcnt));
 			ASSERT(state != arc_anon);
 
 			ASSERT3U(*cnt, >=, size);
@@ -1496,13 +2327,13 @@ arc_buf_destroy(arc_buf_t *buf, boolean_t recycle, boolean_t all)
 		 * If we're destroying a duplicate buffer make sure
 		 * that the appropriate statistics are updated.
 		 */
-		if (buf->b_hdr->b_datacnt > 1 &&
+		if (buf->b_hdr->b_l1hdr.b_datacnt > 1 &&
 		    buf->b_hdr->b_type == ARC_BUFC_DATA) {
 			ARCSTAT_BUMPDOWN(arcstat_duplicate_buffers);
 			ARCSTAT_INCR(arcstat_duplicate_buffers_size, -size);
 		}
-		ASSERT(buf->b_hdr->b_datacnt > 0);
-		buf->b_hdr->b_datacnt -= 1;
+		ASSERT(buf->b_hdr->b_l1hdr.b_datacnt > 0);
+		buf->b_hdr->b_l1hdr.b_datacnt -= 1;
 	}
 
 	/* only remove the buf if requested */
@@ -1510,7 +2341,8 @@ arc_buf_destroy(arc_buf_t *buf, boolean_t recycle, boolean_t all)
 		return;
 
 	/* remove the buf from the hdr list */
-	for (bufp = &buf->b_hdr->b_buf; *bufp != buf; bufp = &(*bufp)->b_next)
+	for (bufp = &buf->b_hdr->b_l1hdr.b_buf; *bufp != buf;
+	    bufp = &(*bufp)->b_next)
 		continue;
 	*bufp = buf->b_next;
 	buf->b_next = NULL;
@@ -1522,16 +2354,83 @@ arc_buf_destroy(arc_buf_t *buf, boolean_t recycle, boolean_t all)
 	kmem_cache_free(buf_cache, buf);
 }
 
+/*
+ * Move a header between hdr_full_cache and hdr_l2only_cache, returning
+ * the new copy.  Only headers which are cached on an L2ARC device and
+ * hold no data in memory are ever moved, and the caller must hold the
+ * hash lock.  The new copy takes the place of the old one in both the
+ * hash table and the L2ARC device's buffer list.
+ */
+static arc_buf_hdr_t *
+arc_hdr_realloc(arc_buf_hdr_t *hdr, kmem_cache_t *old, kmem_cache_t *new)
+{
+	arc_buf_hdr_t *nhdr, *fhdr, **hdrp;
+	l2arc_dev_t *dev = hdr->b_l2hdr.b_dev;
+	uint64_t hash = HDR_HASH(hdr);
+
+	ASSERT(MUTEX_HELD(BUF_HASH_LOCK(hash)));
+	ASSERT(HDR_IN_HASH_TABLE(hdr));
+	ASSERT(HDR_HAS_L2HDR(hdr));
+	ASSERT3P(hdr->b_state, ==, arc_l2c_only);
+	ASSERT((old == hdr_full_cache && new == hdr_l2only_cache) ||
+	    (old == hdr_l2only_cache && new == hdr_full_cache));
+
+	nhdr = kmem_cache_alloc(new, KM_PUSHPAGE);
+	bcopy(hdr, nhdr, HDR_L2ONLY_SIZE);
+	list_link_init(&nhdr->b_l2hdr.b_l2node);
+
+	if (new == hdr_full_cache) {
+		nhdr->b_flags |= ARC_HAS_L1HDR;
+	} else {
+		ASSERT(refcount_is_zero(&hdr->b_l1hdr.b_refcnt));
+		ASSERT0(hdr->b_l1hdr.b_datacnt);
+		ASSERT3P(hdr->b_l1hdr.b_buf, ==, NULL);
+		ASSERT3P(hdr->b_l1hdr.b_pdata, ==, NULL);
+		ASSERT3P(hdr->b_l1hdr.b_acb, ==, NULL);
+		ASSERT3P(hdr->b_l1hdr.b_tmp_cdata, ==, NULL);
+		ASSERT(!multilist_link_active(&hdr->b_l1hdr.b_arc_node));
+		nhdr->b_flags &= ~ARC_HAS_L1HDR;
+	}
+
+	/* swap the new header into the old one's place on its hash chain */
+	hdrp = BUF_HASH_BUCKET(hash);
+	while ((fhdr = *hdrp) != hdr) {
+		ASSERT(fhdr != NULL);
+		hdrp = &fhdr->b_hash_next;
+	}
+	*hdrp = nhdr;
+
+	mutex_enter(&l2arc_buflist_mtx);
+	list_insert_after(dev->l2ad_buflist, hdr, nhdr);
+	list_remove(dev->l2ad_buflist, hdr);
+	mutex_exit(&l2arc_buflist_mtx);
+
+	/*
+	 * The old header's identity and checksum now belong to the new
+	 * one; clear them before handing the old header back to its cache.
+	 */
+	buf_discard_identity(hdr);
+	hdr->b_spa = 0;
+	hdr->b_flags = 0;
+	hdr->b_hash_next = NULL;
+	hdr->b_freeze_cksum = NULL;
+	hdr->b_state = NULL;
+	hdr->b_os_stats = NULL;
+	kmem_cache_free(old, hdr);
+
+	return (nhdr);
+}
+
 static void
 arc_hdr_destroy(arc_buf_hdr_t *hdr)
 {
-	l2arc_buf_hdr_t *l2hdr = hdr->b_l2hdr;
-
-	ASSERT(refcount_is_zero(&hdr->b_refcnt));
-	ASSERT3P(hdr->b_state, ==, arc_anon);
+	if (HDR_HAS_L1HDR(hdr)) {
+		ASSERT(refcount_is_zero(&hdr->b_l1hdr.b_refcnt));
+		ASSERT3P(hdr->b_state, ==, arc_anon);
+	}
 	ASSERT(!HDR_IO_IN_PROGRESS(hdr));
 
-	if (l2hdr != NULL) {
+	if (HDR_HAS_L2HDR(hdr)) {
 		boolean_t buflist_held = MUTEX_HELD(&l2arc_buflist_mtx);
 		/*
 		 * To prevent arc_free() and l2arc_evict() from
@@ -1541,59 +2440,69 @@ arc_hdr_destroy(arc_buf_hdr_t *hdr)
 		 * header while we are waiting on l2arc_buflist_mtx.
 		 *
 		 * The hdr may be removed from l2ad_buflist before we
-		 * grab l2arc_buflist_mtx, so b_l2hdr is rechecked.
+		 * grab l2arc_buflist_mtx, so ARC_HAS_L2HDR is rechecked.
 		 */
-		if (!buflist_held) {
+		if (!buflist_held)
 			mutex_enter(&l2arc_buflist_mtx);
-			l2hdr = hdr->b_l2hdr;
-		}
 
-		if (l2hdr != NULL) {
+		if (HDR_HAS_L2HDR(hdr)) {
+			l2arc_buf_hdr_t *l2hdr = &hdr->b_l2hdr;
+
 			list_remove(l2hdr->b_dev->l2ad_buflist, hdr);
 			ARCSTAT_INCR(arcstat_l2_size, -hdr->b_size);
 			ARCSTAT_INCR(arcstat_l2_asize, -l2hdr->b_asize);
-			kmem_free(l2hdr, sizeof (l2arc_buf_hdr_t));
-			arc_space_return(L2HDR_SIZE, ARC_SPACE_L2HDRS);
 			if (hdr->b_state == arc_l2c_only)
 				l2arc_hdr_stat_remove();
-			hdr->b_l2hdr = NULL;
+			hdr->b_flags &= ~ARC_HAS_L2HDR;
 		}
 
 		if (!buflist_held)
 			mutex_exit(&l2arc_buflist_mtx);
 	}
 
-	if (!BUF_EMPTY(hdr)) {
-		ASSERT(!HDR_IN_HASH_TABLE(hdr));
-		buf_discard_identity(hdr);
+	if (!BUF_EMPTY(hdr)) {
+		ASSERT(!HDR_IN_HASH_TABLE(hdr));
+		buf_discard_identity(hdr);
+	}
+	if (hdr->b_freeze_cksum != NULL) {
+		kmem_free(hdr->b_freeze_cksum, sizeof (zio_cksum_t));
+		hdr->b_freeze_cksum = NULL;
+	}
+	ASSERT3P(hdr->b_hash_next, ==, NULL);
+	if (hdr->b_os_stats != NULL) {
+		arc_os_stats_rele(hdr->b_os_stats);
+		hdr->b_os_stats = NULL;
+	}
+
+	if (!HDR_HAS_L1HDR(hdr)) {
+		kmem_cache_free(hdr_l2only_cache, hdr);
+		return;
 	}
-	while (hdr->b_buf) {
-		arc_buf_t *buf = hdr->b_buf;
+
+	if (hdr->b_l1hdr.b_pdata != NULL)
+		(void) arc_hdr_free_pdata(hdr);
+	while (hdr->b_l1hdr.b_buf) {
+		arc_buf_t *buf = hdr->b_l1hdr.b_buf;
 
 		if (buf->b_efunc) {
 			mutex_enter(&arc_eviction_mtx);
 			mutex_enter(&buf->b_evict_lock);
 			ASSERT(buf->b_hdr != NULL);
-			arc_buf_destroy(hdr->b_buf, FALSE, FALSE);
-			hdr->b_buf = buf->b_next;
+			arc_buf_destroy(hdr->b_l1hdr.b_buf, FALSE);
+			hdr->b_l1hdr.b_buf = buf->b_next;
 			buf->b_hdr = &arc_eviction_hdr;
 			buf->b_next = arc_eviction_list;
 			arc_eviction_list = buf;
 			mutex_exit(&buf->b_evict_lock);
 			mutex_exit(&arc_eviction_mtx);
 		} else {
-			arc_buf_destroy(hdr->b_buf, FALSE, TRUE);
+			arc_buf_destroy(hdr->b_l1hdr.b_buf, TRUE);
 		}
 	}
-	if (hdr->b_freeze_cksum != NULL) {
-		kmem_free(hdr->b_freeze_cksum, sizeof (zio_cksum_t));
-		hdr->b_freeze_cksum = NULL;
-	}
 
-	ASSERT(!list_link_active(&hdr->b_arc_node));
-	ASSERT3P(hdr->b_hash_next, ==, NULL);
-	ASSERT3P(hdr->b_acb, ==, NULL);
-	kmem_cache_free(hdr_cache, hdr);
+	ASSERT(!multilist_link_active(&hdr->b_l1hdr.b_arc_node));
+	ASSERT3P(hdr->b_l1hdr.b_acb, ==, NULL);
+	kmem_cache_free(hdr_full_cache, hdr);
 }
 
 void
@@ -1613,10 +2522,12 @@ arc_buf_free(arc_buf_t *buf, void *tag)
 		ASSERT3P(hash_lock, ==, HDR_LOCK(hdr));
 
 		(void) remove_reference(hdr, hash_lock, tag);
-		if (hdr->b_datacnt > 1) {
-			arc_buf_destroy(buf, FALSE, TRUE);
+		if (hdr->b_l1hdr.b_datacnt > 1 ||
+		    (hdr->b_l1hdr.b_pdata != NULL &&
+		    refcount_is_zero(&hdr->b_l1hdr.b_refcnt))) {
+			arc_buf_destroy(buf, TRUE);
 		} else {
-			ASSERT(buf == hdr->b_buf);
+			ASSERT(buf == hdr->b_l1hdr.b_buf);
 			ASSERT(buf->b_efunc == NULL);
 			hdr->b_flags |= ARC_BUF_AVAILABLE;
 		}
@@ -1630,14 +2541,14 @@ arc_buf_free(arc_buf_t *buf, void *tag)
 		 */
 		mutex_enter(&arc_eviction_mtx);
 		(void) remove_reference(hdr, NULL, tag);
-		ASSERT(refcount_is_zero(&hdr->b_refcnt));
+		ASSERT(refcount_is_zero(&hdr->b_l1hdr.b_refcnt));
 		destroy_hdr = !HDR_IO_IN_PROGRESS(hdr);
 		mutex_exit(&arc_eviction_mtx);
 		if (destroy_hdr)
 			arc_hdr_destroy(hdr);
 	} else {
 		if (remove_reference(hdr, NULL, tag) > 0)
-			arc_buf_destroy(buf, FALSE, TRUE);
+			arc_buf_destroy(buf, TRUE);
 		else
 			arc_hdr_destroy(hdr);
 	}
@@ -1651,7 +2562,7 @@ arc_buf_remove_ref(arc_buf_t *buf, void* tag)
 	boolean_t no_callback = (buf->b_efunc == NULL);
 
 	if (hdr->b_state == arc_anon) {
-		ASSERT(hdr->b_datacnt == 1);
+		ASSERT(hdr->b_l1hdr.b_datacnt == 1);
 		arc_buf_free(buf, tag);
 		return (no_callback);
 	}
@@ -1664,16 +2575,22 @@ arc_buf_remove_ref(arc_buf_t *buf, void* tag)
 	ASSERT(buf->b_data != NULL);
 
 	(void) remove_reference(hdr, hash_lock, tag);
-	if (hdr->b_datacnt > 1) {
+	if (hdr->b_l1hdr.b_datacnt > 1 ||
+	    (hdr->b_l1hdr.b_pdata != NULL &&
+	    refcount_is_zero(&hdr->b_l1hdr.b_refcnt))) {
+		/*
+		 * A block which is also cached in compressed form does
+		 * not need to keep an unreferenced decompressed copy.
+		 */
 		if (no_callback)
-			arc_buf_destroy(buf, FALSE, TRUE);
+			arc_buf_destroy(buf, TRUE);
 	} else if (no_callback) {
-		ASSERT(hdr->b_buf == buf && buf->b_next == NULL);
+		ASSERT(hdr->b_l1hdr.b_buf == buf && buf->b_next == NULL);
 		ASSERT(buf->b_efunc == NULL);
 		hdr->b_flags |= ARC_BUF_AVAILABLE;
 	}
-	ASSERT(no_callback || hdr->b_datacnt > 1 ||
-	    refcount_is_zero(&hdr->b_refcnt));
+	ASSERT(no_callback || hdr->b_l1hdr.b_datacnt > 1 ||
+	    refcount_is_zero(&hdr->b_l1hdr.b_refcnt));
 	mutex_exit(hash_lock);
 	return (no_callback);
 }
@@ -1688,7 +2605,8 @@ arc_buf_size(arc_buf_t *buf)
  * Called from the DMU to determine if the current buffer should be
  * evicted. In order to ensure proper locking, the eviction must be initiated
  * from the DMU. Return true if the buffer is associated with user data and
- * duplicate buffers still exist.
+ * duplicate buffers still exist, or if the block is also cached in its
+ * compressed form (the decompressed copy can be recreated from it).
  */
 boolean_t
 arc_buf_eviction_needed(arc_buf_t *buf)
@@ -1696,9 +2614,6 @@ arc_buf_eviction_needed(arc_buf_t *buf)
 	arc_buf_hdr_t *hdr;
 	boolean_t evict_needed = B_FALSE;
 
-	if (zfs_disable_dup_eviction)
-		return (B_FALSE);
-
 	mutex_enter(&buf->b_evict_lock);
 	hdr = buf->b_hdr;
 	if (hdr == NULL) {
@@ -1719,7 +2634,10 @@ arc_buf_eviction_needed(arc_buf_t *buf)
 		return (B_TRUE);
 	}
 
-	if (hdr->b_datacnt > 1 && hdr->b_type == ARC_BUFC_DATA)
+	if (hdr->b_l1hdr.b_pdata != NULL)
+		evict_needed = B_TRUE;
+	else if (!zfs_disable_dup_eviction && hdr->b_l1hdr.b_datacnt > 1 &&
+	    hdr->b_type == ARC_BUFC_DATA)
 		evict_needed = B_TRUE;
 
 	mutex_exit(&buf->b_evict_lock);
@@ -1727,77 +2645,57 @@ arc_buf_eviction_needed(arc_buf_t *buf)
 }
 
 /*
- * Evict buffers from list until we've removed the specified number of
- * bytes.  Move the removed buffers to the appropriate evict state.
- * If the recycle flag is set, then attempt to "recycle" a buffer:
- * - look for a buffer to evict that is `bytes' long.
- * - return the data block from this buffer rather than freeing it.
- * This flag is used by callers that are trying to make space for a
- * new buffer in a full arc cache.
+ * Evict buffers from one sublist of the given state until we've removed
+ * the specified number of bytes.  Move the removed buffers to the
+ * appropriate evict state.
  *
- * This function makes a "best effort".  It skips over any buffers
- * it can't get a hash_lock on, and so may not catch all candidates.
- * It may also return without evicting as much space as requested.
+ * Returns the number of bytes evicted from the sublist.
  */
-static void *
-arc_evict(arc_state_t *state, uint64_t spa, int64_t bytes, boolean_t recycle,
-    arc_buf_contents_t type)
+static uint64_t
+arc_evict_sublist(arc_state_t *state, unsigned int idx, uint64_t spa,
+    int64_t bytes, arc_buf_contents_t type, uint64_t *skipped,
+    uint64_t *missed)
 {
 	arc_state_t *evicted_state;
-	uint64_t bytes_evicted = 0, skipped = 0, missed = 0;
+	multilist_sublist_t *mls;
+	uint64_t bytes_evicted = 0;
 	arc_buf_hdr_t *ab, *ab_prev = NULL;
-	list_t *list = &state->arcs_list[type];
 	kmutex_t *hash_lock;
 	boolean_t have_lock;
-	void *stolen = NULL;
-
-	ASSERT(state == arc_mru || state == arc_mfu);
 
 	evicted_state = (state == arc_mru) ? arc_mru_ghost : arc_mfu_ghost;
 
-	mutex_enter(&state->arcs_mtx);
-	mutex_enter(&evicted_state->arcs_mtx);
+	mls = multilist_sublist_lock(&state->arcs_list[type], idx);
 
-	for (ab = list_tail(list); ab; ab = ab_prev) {
-		ab_prev = list_prev(list, ab);
+	for (ab = multilist_sublist_tail(mls); ab; ab = ab_prev) {
+		ab_prev = multilist_sublist_prev(mls, ab);
 		/* prefetch buffers have a minimum lifespan */
 		if (HDR_IO_IN_PROGRESS(ab) ||
 		    (spa && ab->b_spa != spa) ||
 		    (ab->b_flags & (ARC_PREFETCH|ARC_INDIRECT) &&
-		    ddi_get_lbolt() - ab->b_arc_access <
+		    ddi_get_lbolt() - ab->b_l1hdr.b_arc_access <
 		    zfs_arc_min_prefetch_lifespan)) {
-			skipped++;
+			(*skipped)++;
 			continue;
 		}
-		/* "lookahead" for better eviction candidate */
-		if (recycle && ab->b_size != bytes &&
-		    ab_prev && ab_prev->b_size == bytes)
-			continue;
 		hash_lock = HDR_LOCK(ab);
 		have_lock = MUTEX_HELD(hash_lock);
 		if (have_lock || mutex_tryenter(hash_lock)) {
-			ASSERT0(refcount_count(&ab->b_refcnt));
-			ASSERT(ab->b_datacnt > 0);
-			while (ab->b_buf) {
-				arc_buf_t *buf = ab->b_buf;
+			ASSERT0(refcount_count(&ab->b_l1hdr.b_refcnt));
+			ASSERT(ab->b_l1hdr.b_datacnt > 0 ||
+			    ab->b_l1hdr.b_pdata != NULL);
+			while (ab->b_l1hdr.b_buf) {
+				arc_buf_t *buf = ab->b_l1hdr.b_buf;
 				if (!mutex_tryenter(&buf->b_evict_lock)) {
-					missed += 1;
+					(*missed)++;
 					break;
 				}
-				if (buf->b_data) {
+				if (buf->b_data)
 					bytes_evicted += ab->b_size;
-					if (recycle && ab->b_type == type &&
-					    ab->b_size == bytes &&
-					    !HDR_L2_WRITING(ab)) {
-						stolen = buf->b_data;
-						recycle = FALSE;
-					}
-				}
 				if (buf->b_efunc) {
 					mutex_enter(&arc_eviction_mtx);
-					arc_buf_destroy(buf,
-					    buf->b_data == stolen, FALSE);
-					ab->b_buf = buf->b_next;
+					arc_buf_destroy(buf, FALSE);
+					ab->b_l1hdr.b_buf = buf->b_next;
 					buf->b_hdr = &arc_eviction_hdr;
 					buf->b_next = arc_eviction_list;
 					arc_eviction_list = buf;
@@ -1805,12 +2703,11 @@ arc_evict(arc_state_t *state, uint64_t spa, int64_t bytes, boolean_t recycle,
 					mutex_exit(&buf->b_evict_lock);
 				} else {
 					mutex_exit(&buf->b_evict_lock);
-					arc_buf_destroy(buf,
-					    buf->b_data == stolen, TRUE);
+					arc_buf_destroy(buf, TRUE);
 				}
 			}
 
-			if (ab->b_l2hdr) {
+			if (HDR_HAS_L2HDR(ab)) {
 				ARCSTAT_INCR(arcstat_evict_l2_cached,
 				    ab->b_size);
 			} else {
@@ -1824,7 +2721,9 @@ arc_evict(arc_state_t *state, uint64_t spa, int64_t bytes, boolean_t recycle,
 				}
 			}
 
-			if (ab->b_datacnt == 0) {
+			if (ab->b_l1hdr.b_datacnt == 0) {
+				if (ab->b_l1hdr.b_pdata != NULL)
+					bytes_evicted += arc_hdr_free_pdata(ab);
 				arc_change_state(evicted_state, ab, hash_lock);
 				ASSERT(HDR_IN_HASH_TABLE(ab));
 				ab->b_flags |= ARC_IN_HASH_TABLE;
@@ -1836,12 +2735,74 @@ arc_evict(arc_state_t *state, uint64_t spa, int64_t bytes, boolean_t recycle,
 			if (bytes >= 0 && bytes_evicted >= bytes)
 				break;
 		} else {
-			missed += 1;
+			(*missed)++;
 		}
 	}
 
-	mutex_exit(&evicted_state->arcs_mtx);
-	mutex_exit(&state->arcs_mtx);
+	multilist_sublist_unlock(mls);
+
+	return (bytes_evicted);
+}
+
+/*
+ * Evict buffers from list until we've removed the specified number of
+ * bytes.  Move the removed buffers to the appropriate evict state.
+ * Returns the number of bytes evicted.
+ *
+ * The list is made up of a number of sublists.  They are visited in a
+ * round-robin fashion starting from a random sublist, and only one
+ * sublist lock is held at a time.  The eviction is spread over all of
+ * the sublists so that the oldest buffers of every sublist go first.
+ *
+ * This function makes a "best effort".  It skips over any buffers
+ * it can't get a hash_lock on, and so may not catch all candidates.
+ * It may also return without evicting as much space as requested.
+ */
+static uint64_t
+arc_evict(arc_state_t *state, uint64_t spa, int64_t bytes,
+    arc_buf_contents_t type)
+{
+	multilist_t *ml = &state->arcs_list[type];
+	unsigned int num_sublists = multilist_get_num_sublists(ml);
+	unsigned int idx = multilist_get_random_index(ml);
+	uint64_t bytes_evicted = 0, skipped = 0, missed = 0;
+	int64_t share;
+	int i, pass;
+
+	ASSERT(state == arc_mru || state == arc_mfu);
+
+	/*
+	 * Each sublist is asked for at least a maximum sized block so
+	 * that small requests are not over-satisfied by every sublist
+	 * giving up one buffer.  Whatever the first pass could not
+	 * evict is taken from any sublist on the second pass.
+	 */
+	if (bytes < 0)
+		share = bytes;
+	else
+		share = MAX(bytes / num_sublists, SPA_MAXBLOCKSIZE);
+
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < num_sublists; i++) {
+			int64_t want = share;
+
+			if (bytes >= 0) {
+				if (bytes_evicted >= bytes)
+					break;
+				want = MIN(share, bytes - bytes_evicted);
+			}
+
+			bytes_evicted += arc_evict_sublist(state, idx, spa,
+			    want, type, &skipped, &missed);
+
+			if (++idx >= num_sublists)
+				idx = 0;
+		}
+
+		if (bytes < 0 || bytes_evicted >= bytes)
+			break;
+		share = bytes - bytes_evicted;
+	}
 
 	if (bytes_evicted < bytes)
 		dprintf("only evicted %lld bytes from %x\n",
@@ -1876,30 +2837,29 @@ arc_evict(arc_state_t *state, uint64_t spa, int64_t bytes, boolean_t recycle,
 		}
 	}
 
-	return (stolen);
+	return (bytes_evicted);
 }
 
 /*
- * Remove buffers from list until we've removed the specified number of
- * bytes.  Destroy the buffers that are removed.
+ * Remove buffers from one sublist of a ghost state until we've removed
+ * the specified number of bytes.  Destroy the buffers that are removed.
+ * Returns the number of bytes deleted.
  */
-static void
-arc_evict_ghost(arc_state_t *state, uint64_t spa, int64_t bytes,
-    arc_buf_contents_t type)
+static uint64_t
+arc_evict_ghost_sublist(arc_state_t *state, multilist_t *ml, unsigned int idx,
+    uint64_t spa, int64_t bytes, uint64_t *bufs_skipped)
 {
 	arc_buf_hdr_t *ab, *ab_prev;
 	arc_buf_hdr_t marker;
-	list_t *list = &state->arcs_list[type];
+	multilist_sublist_t *mls;
 	kmutex_t *hash_lock;
 	uint64_t bytes_deleted = 0;
-	uint64_t bufs_skipped = 0;
 
-	ASSERT(GHOST_STATE(state));
-	bzero(&marker, sizeof(marker));
-top:
-	mutex_enter(&state->arcs_mtx);
-	for (ab = list_tail(list); ab; ab = ab_prev) {
-		ab_prev = list_prev(list, ab);
+	bzero(&marker, sizeof (marker));
+
+	mls = multilist_sublist_lock(ml, idx);
+	for (ab = multilist_sublist_tail(mls); ab; ab = ab_prev) {
+		ab_prev = multilist_sublist_prev(mls, ab);
 		if (spa && ab->b_spa != spa)
 			continue;
 
@@ -1913,16 +2873,21 @@ top:
 			continue;
 		if (mutex_tryenter(hash_lock)) {
 			ASSERT(!HDR_IO_IN_PROGRESS(ab));
-			ASSERT(ab->b_buf == NULL);
+			ASSERT(ab->b_l1hdr.b_buf == NULL);
 			ARCSTAT_BUMP(arcstat_deleted);
 			bytes_deleted += ab->b_size;
 
-			if (ab->b_l2hdr != NULL) {
+			if (HDR_HAS_L2HDR(ab)) {
 				/*
 				 * This buffer is cached on the 2nd Level ARC;
-				 * don't destroy the header.
+				 * don't destroy the header.  Unless it is
+				 * still being written, trade it for the
+				 * smaller L2-only header.
 				 */
 				arc_change_state(arc_l2c_only, ab, hash_lock);
+				if (!HDR_L2_WRITING(ab))
+					(void) arc_hdr_realloc(ab,
+					    hdr_full_cache, hdr_l2only_cache);
 				mutex_exit(hash_lock);
 			} else {
 				arc_change_state(arc_anon, ab, hash_lock);
@@ -1939,21 +2904,59 @@ top:
 			 * hash lock to become available. Once its
 			 * available, restart from where we left off.
 			 */
-			list_insert_after(list, ab, &marker);
-			mutex_exit(&state->arcs_mtx);
+			multilist_sublist_insert_after(mls, ab, &marker);
+			multilist_sublist_unlock(mls);
 			mutex_enter(hash_lock);
 			mutex_exit(hash_lock);
-			mutex_enter(&state->arcs_mtx);
-			ab_prev = list_prev(list, &marker);
-			list_remove(list, &marker);
+			mls = multilist_sublist_lock(ml, idx);
+			ab_prev = multilist_sublist_prev(mls, &marker);
+			multilist_sublist_remove(mls, &marker);
 		} else
-			bufs_skipped += 1;
+			*bufs_skipped += 1;
+	}
+	multilist_sublist_unlock(mls);
+
+	return (bytes_deleted);
+}
+
+/*
+ * Remove buffers from list until we've removed the specified number of
+ * bytes.  Destroy the buffers that are removed.  As in arc_evict() the
+ * sublists are visited round-robin starting from a random one.
+ */
+static void
+arc_evict_ghost(arc_state_t *state, uint64_t spa, int64_t bytes,
+    arc_buf_contents_t type)
+{
+	multilist_t *ml = &state->arcs_list[type];
+	unsigned int num_sublists, idx;
+	uint64_t bytes_deleted = 0;
+	uint64_t bufs_skipped = 0;
+	int i;
+
+	ASSERT(GHOST_STATE(state));
+top:
+	num_sublists = multilist_get_num_sublists(ml);
+	idx = multilist_get_random_index(ml);
+	for (i = 0; i < num_sublists; i++) {
+		int64_t want = -1;
+
+		if (bytes >= 0) {
+			if (bytes_deleted >= bytes)
+				break;
+			want = bytes - bytes_deleted;
+		}
+
+		bytes_deleted += arc_evict_ghost_sublist(state, ml, idx, spa,
+		    want, &bufs_skipped);
+
+		if (++idx >= num_sublists)
+			idx = 0;
 	}
-	mutex_exit(&state->arcs_mtx);
 
-	if (list == &state->arcs_list[ARC_BUFC_DATA] &&
+	if (ml == &state->arcs_list[ARC_BUFC_DATA] &&
 	    (bytes < 0 || bytes_deleted < bytes)) {
-		list = &state->arcs_list[ARC_BUFC_METADATA];
+		ml = &state->arcs_list[ARC_BUFC_METADATA];
 		goto top;
 	}
 
@@ -1967,28 +2970,61 @@ top:
 		    (longlong_t)bytes_deleted, state);
 }
 
-static void
+/*
+ * The size the reclaim thread evicts down to.  It is kept a little below
+ * arc_c so that the allocations which follow find free space, rather
+ * than each one pushing the ARC over its target and waiting for eviction.
+ */
+static uint64_t
+arc_reclaim_target(void)
+{
+	uint64_t headroom = arc_c >> zfs_arc_evict_headroom_shift;
+
+	return (MAX(arc_c - headroom, arc_c_min));
+}
+
+/*
+ * Returns B_TRUE once the ARC has grown so far past its target that
+ * allocations must wait for the reclaim thread to catch up.
+ */
+static boolean_t
+arc_is_overflowing(void)
+{
+	uint64_t overflow = MAX(SPA_MAXBLOCKSIZE,
+	    arc_c >> zfs_arc_overflow_shift);
+
+	return (arc_size >= arc_c + overflow);
+}
+
+/*
+ * Evict from the MRU and MFU states, and their ghost lists, until the
+ * ARC is back within its reclaim target.  Returns the number of bytes
+ * evicted from the MRU and MFU states.
+ */
+static uint64_t
 arc_adjust(void)
 {
+	uint64_t target = arc_reclaim_target();
+	uint64_t total_evicted = 0;
 	int64_t adjustment, delta;
 
 	/*
 	 * Adjust MRU size
 	 */
 
-	adjustment = MIN((int64_t)(arc_size - arc_c),
+	adjustment = MIN((int64_t)(arc_size - target),
 	    (int64_t)(arc_anon->arcs_size + arc_mru->arcs_size + arc_meta_used -
 	    arc_p));
 
 	if (adjustment > 0 && arc_mru->arcs_lsize[ARC_BUFC_DATA] > 0) {
 		delta = MIN(arc_mru->arcs_lsize[ARC_BUFC_DATA], adjustment);
-		(void) arc_evict(arc_mru, 0, delta, FALSE, ARC_BUFC_DATA);
+		total_evicted += arc_evict(arc_mru, 0, delta, ARC_BUFC_DATA);
 		adjustment -= delta;
 	}
 
 	if (adjustment > 0 && arc_mru->arcs_lsize[ARC_BUFC_METADATA] > 0) {
 		delta = MIN(arc_mru->arcs_lsize[ARC_BUFC_METADATA], adjustment);
-		(void) arc_evict(arc_mru, 0, delta, FALSE,
+		total_evicted += arc_evict(arc_mru, 0, delta,
 		    ARC_BUFC_METADATA);
 	}
 
@@ -1996,18 +3032,18 @@ arc_adjust(void)
 	 * Adjust MFU size
 	 */
 
-	adjustment = arc_size - arc_c;
+	adjustment = arc_size - target;
 
 	if (adjustment > 0 && arc_mfu->arcs_lsize[ARC_BUFC_DATA] > 0) {
 		delta = MIN(adjustment, arc_mfu->arcs_lsize[ARC_BUFC_DATA]);
-		(void) arc_evict(arc_mfu, 0, delta, FALSE, ARC_BUFC_DATA);
+		total_evicted += arc_evict(arc_mfu, 0, delta, ARC_BUFC_DATA);
 		adjustment -= delta;
 	}
 
 	if (adjustment > 0 && arc_mfu->arcs_lsize[ARC_BUFC_METADATA] > 0) {
 		int64_t delta = MIN(adjustment,
 		    arc_mfu->arcs_lsize[ARC_BUFC_METADATA]);
-		(void) arc_evict(arc_mfu, 0, delta, FALSE,
+		total_evicted += arc_evict(arc_mfu, 0, delta,
 		    ARC_BUFC_METADATA);
 	}
 
@@ -2029,6 +3065,8 @@ arc_adjust(void)
 		delta = MIN(arc_mfu_ghost->arcs_size, adjustment);
 		arc_evict_ghost(arc_mfu_ghost, 0, delta, ARC_BUFC_DATA);
 	}
+
+	return (total_evicted);
 }
 
 /*
@@ -2108,13 +3146,13 @@ arc_adjust_meta(int64_t adjustment, boolean_t may_prune)
 
 	if (adjustment > 0 && arc_mru->arcs_lsize[ARC_BUFC_METADATA] > 0) {
 		delta = MIN(arc_mru->arcs_lsize[ARC_BUFC_METADATA], adjustment);
-		arc_evict(arc_mru, 0, delta, FALSE, ARC_BUFC_METADATA);
+		(void) arc_evict(arc_mru, 0, delta, ARC_BUFC_METADATA);
 		adjustment -= delta;
 	}
 
 	if (adjustment > 0 && arc_mfu->arcs_lsize[ARC_BUFC_METADATA] > 0) {
 		delta = MIN(arc_mfu->arcs_lsize[ARC_BUFC_METADATA], adjustment);
-		arc_evict(arc_mfu, 0, delta, FALSE, ARC_BUFC_METADATA);
+		(void) arc_evict(arc_mfu, 0, delta, ARC_BUFC_METADATA);
 		adjustment -= delta;
 	}
 
@@ -2134,23 +3172,23 @@ arc_flush(spa_t *spa)
 	if (spa)
 		guid = spa_load_guid(spa);
 
-	while (list_head(&arc_mru->arcs_list[ARC_BUFC_DATA])) {
-		(void) arc_evict(arc_mru, guid, -1, FALSE, ARC_BUFC_DATA);
+	while (!multilist_is_empty(&arc_mru->arcs_list[ARC_BUFC_DATA])) {
+		(void) arc_evict(arc_mru, guid, -1, ARC_BUFC_DATA);
 		if (spa)
 			break;
 	}
-	while (list_head(&arc_mru->arcs_list[ARC_BUFC_METADATA])) {
-		(void) arc_evict(arc_mru, guid, -1, FALSE, ARC_BUFC_METADATA);
+	while (!multilist_is_empty(&arc_mru->arcs_list[ARC_BUFC_METADATA])) {
+		(void) arc_evict(arc_mru, guid, -1, ARC_BUFC_METADATA);
 		if (spa)
 			break;
 	}
-	while (list_head(&arc_mfu->arcs_list[ARC_BUFC_DATA])) {
-		(void) arc_evict(arc_mfu, guid, -1, FALSE, ARC_BUFC_DATA);
+	while (!multilist_is_empty(&arc_mfu->arcs_list[ARC_BUFC_DATA])) {
+		(void) arc_evict(arc_mfu, guid, -1, ARC_BUFC_DATA);
 		if (spa)
 			break;
 	}
-	while (list_head(&arc_mfu->arcs_list[ARC_BUFC_METADATA])) {
-		(void) arc_evict(arc_mfu, guid, -1, FALSE, ARC_BUFC_METADATA);
+	while (!multilist_is_empty(&arc_mfu->arcs_list[ARC_BUFC_METADATA])) {
+		(void) arc_evict(arc_mfu, guid, -1, ARC_BUFC_METADATA);
 		if (spa)
 			break;
 	}
@@ -2186,8 +3224,10 @@ arc_shrink(uint64_t bytes)
 		ASSERT((int64_t)arc_p >= 0);
 	}
 
-	if (arc_size > arc_c)
-		arc_adjust();
+	/*
+	 * The eviction itself is left to the reclaim thread, which
+	 * callers wake once the new target has been set.
+	 */
 }
 
 static void
@@ -2218,26 +3258,44 @@ arc_kmem_reap_now(arc_reclaim_strategy_t strat, uint64_t bytes)
 	}
 
 	kmem_cache_reap_now(buf_cache);
-	kmem_cache_reap_now(hdr_cache);
+	kmem_cache_reap_now(hdr_full_cache);
+	kmem_cache_reap_now(hdr_l2only_cache);
+}
+
+/*
+ * Wake the reclaim thread without waiting for it.  A wakeup which races
+ * with the thread going to sleep is only delayed until its next timeout.
+ */
+static void
+arc_reclaim_wakeup(void)
+{
+	cv_signal(&arc_reclaim_thr_cv);
 }
 
 /*
- * Unlike other ZFS implementations this thread is only responsible for
- * adapting the target ARC size on Linux.  The responsibility for memory
- * reclamation has been entirely delegated to the arc_shrinker_func()
- * which is registered with the VM.  To reflect this change in behavior
- * the arc_reclaim thread has been renamed to arc_adapt.
+ * The reclaim thread performs all eviction needed to keep the ARC within
+ * its target size.  It is woken by allocations as soon as the ARC reaches
+ * its target and by the arc_shrinker_func() once the VM has lowered that
+ * target, and evicts down to slightly below the target ahead of demand.
+ * Allocating threads only block, on arc_reclaim_waiters_cv, once the ARC
+ * has overflowed its target by a wide margin, which means they are adding
+ * data faster than this thread can evict it.
+ *
+ * arc_reclaim_thr_lock is not held while evicting, so that allocations
+ * and the shrinker can post new work without stalling behind eviction.
  */
 static void
-arc_adapt_thread(void)
+arc_reclaim_thread(void)
 {
 	callb_cpr_t		cpr;
 	int64_t			prune;
+	uint64_t		evicted;
 
 	CALLB_CPR_INIT(&cpr, &arc_reclaim_thr_lock, callb_generic_cpr, FTAG);
 
 	mutex_enter(&arc_reclaim_thr_lock);
 	while (arc_thread_exit == 0) {
+		mutex_exit(&arc_reclaim_thr_lock);
 #ifndef _KERNEL
 		arc_reclaim_strategy_t	last_reclaim = ARC_RECLAIM_CONS;
 
@@ -2276,17 +3334,28 @@ arc_adapt_thread(void)
 		if (prune > 0)
 			arc_adjust_meta(prune, B_TRUE);
 
-		arc_adjust();
+		evicted = arc_adjust();
+
+		buf_hash_resize_check();
+
+		mutex_enter(&arc_reclaim_thr_lock);
 
 		if (arc_eviction_list != NULL)
 			arc_do_user_evicts();
 
-		/* block until needed, or one second, whichever is shorter */
-		CALLB_CPR_SAFE_BEGIN(&cpr);
-		(void) cv_timedwait_interruptible(&arc_reclaim_thr_cv,
-		    &arc_reclaim_thr_lock, (ddi_get_lbolt() + hz));
-		CALLB_CPR_SAFE_END(&cpr, &arc_reclaim_thr_lock);
+		/*
+		 * Keep going while there is more to evict and progress is
+		 * being made.  Otherwise release any waiting allocations and
+		 * block until needed, or one second, whichever is shorter.
+		 */
+		if (arc_size <= arc_reclaim_target() || evicted == 0) {
+			cv_broadcast(&arc_reclaim_waiters_cv);
 
+			CALLB_CPR_SAFE_BEGIN(&cpr);
+			(void) cv_timedwait_interruptible(&arc_reclaim_thr_cv,
+			    &arc_reclaim_thr_lock, (ddi_get_lbolt() + hz));
+			CALLB_CPR_SAFE_END(&cpr, &arc_reclaim_thr_lock);
+		}
 
 		/* Allow the module options to be changed */
 		if (zfs_arc_max > 64 << 20 &&
@@ -2309,6 +3378,7 @@ arc_adapt_thread(void)
 	}
 
 	arc_thread_exit = 0;
+	cv_broadcast(&arc_reclaim_waiters_cv);
 	cv_broadcast(&arc_reclaim_thr_cv);
 	CALLB_CPR_EXIT(&cpr);		/* drops arc_reclaim_thr_lock */
 	thread_exit();
@@ -2383,7 +3453,7 @@ arc_evictable_memory(void) {
 static int
 __arc_shrinker_func(struct shrinker *shrink, struct shrink_control *sc)
 {
-	uint64_t pages;
+	uint64_t pages, bytes;
 
 	/* The arc is considered warm once reclaim has occurred */
 	if (unlikely(arc_warm == B_FALSE))
@@ -2403,14 +3473,16 @@ __arc_shrinker_func(struct shrinker *shrink, struct shrink_control *sc)
 		return (-1);
 
 	/*
-	 * Evict the requested number of pages by shrinking arc_c the
-	 * requested amount.  If there is nothing left to evict just
-	 * reap whatever we can from the various arc slabs.
+	 * Lower arc_c by exactly the number of pages the VM asked for,
+	 * limited to what is actually evictable, and let the reclaim
+	 * thread evict down to the new target.  If there is nothing left
+	 * to evict just reap whatever we can from the various arc slabs.
 	 */
-	if (pages > 0) {
-		arc_kmem_reap_now(ARC_RECLAIM_AGGR, ptob(sc->nr_to_scan));
+	bytes = MIN(ptob(sc->nr_to_scan), ptob(pages));
+	if (bytes > 0) {
+		arc_kmem_reap_now(ARC_RECLAIM_AGGR, bytes);
 	} else {
-		arc_kmem_reap_now(ARC_RECLAIM_CONS, ptob(sc->nr_to_scan));
+		arc_kmem_reap_now(ARC_RECLAIM_CONS, 0);
 	}
 
 	/*
@@ -2418,16 +3490,23 @@ __arc_shrinker_func(struct shrinker *shrink, struct shrink_control *sc)
 	 * increase in memory pressure.  This occurs because the kswapd
 	 * threads were unable to asynchronously keep enough free memory
 	 * available.  In this case set arc_no_grow to briefly pause arc
-	 * growth to avoid compounding the memory pressure.
+	 * growth to avoid compounding the memory pressure, and give the
+	 * reclaim thread up to a tenth of a second to release the memory
+	 * before the allocation which triggered reclaim is retried.
+	 * kswapd only posts the new target and returns.
 	 */
+	cv_signal(&arc_reclaim_thr_cv);
 	if (current_is_kswapd()) {
 		ARCSTAT_BUMP(arcstat_memory_indirect_count);
 	} else {
 		arc_no_grow = B_TRUE;
 		arc_grow_time = ddi_get_lbolt() + (zfs_arc_grow_retry * hz);
 		ARCSTAT_BUMP(arcstat_memory_direct_count);
+		if (bytes > 0 && arc_size > arc_c) {
+			(void) cv_timedwait(&arc_reclaim_waiters_cv,
+			    &arc_reclaim_thr_lock, ddi_get_lbolt() + hz / 10);
+		}
 	}
-
 	mutex_exit(&arc_reclaim_thr_lock);
 
 	return (-1);
@@ -2485,10 +3564,11 @@ arc_adapt(int bytes, arc_state_t *state)
 		return;
 
 	/*
-	 * If we're within (2 * maxblocksize) bytes of the target
-	 * cache size, increment the target cache size
+	 * If we're within (2 * maxblocksize) bytes of the size the
+	 * reclaim thread keeps the cache at, increment the target
+	 * cache size
 	 */
-	if (arc_size > arc_c - (2ULL << SPA_MAXBLOCKSHIFT)) {
+	if (arc_size > arc_reclaim_target() - (2ULL << SPA_MAXBLOCKSHIFT)) {
 		atomic_add_64(&arc_c, (int64_t)bytes);
 		if (arc_c > arc_c_max)
 			arc_c = arc_c_max;
@@ -2501,8 +3581,8 @@ arc_adapt(int bytes, arc_state_t *state)
 }
 
 /*
- * Check if the cache has reached its limits and eviction is required
- * prior to insert.
+ * Check if the cache has reached its limits and the reclaim thread
+ * should be evicting.
  */
 static int
 arc_evict_needed(arc_buf_contents_t type)
@@ -2513,31 +3593,15 @@ arc_evict_needed(arc_buf_contents_t type)
 	if (arc_no_grow)
 		return (1);
 
-	return (arc_size > arc_c);
+	return (arc_size > arc_reclaim_target());
 }
 
 /*
- * The buffer, supplied as the first argument, needs a data block.
- * So, if we are at cache max, determine which cache should be victimized.
- * We have the following cases:
- *
- * 1. Insert for MRU, p > sizeof(arc_anon + arc_mru) ->
- * In this situation if we're out of space, but the resident size of the MFU is
- * under the limit, victimize the MFU cache to satisfy this insertion request.
- *
- * 2. Insert for MRU, p <= sizeof(arc_anon + arc_mru) ->
- * Here, we've used up all of the available space for the MRU, so we need to
- * evict from our own cache instead.  Evict from the set of resident MRU
- * entries.
- *
- * 3. Insert for MFU (c - p) > sizeof(arc_mfu) ->
- * c minus p represents the MFU space in the cache, since p is the size of the
- * cache that is dedicated to the MRU.  In this situation there's still space on
- * the MFU side, so the MRU side needs to be victimized.
- *
- * 4. Insert for MFU (c - p) < sizeof(arc_mfu) ->
- * MFU's resident set is consuming more space than it has been allotted.  In
- * this situation, we must victimize our own cache, the MFU, for this insertion.
+ * The buffer, supplied as the first argument, needs a data block.  The
+ * block is always freshly allocated; making room for it is the job of
+ * the reclaim thread, which is woken here once the cache has reached its
+ * target size.  Only when the cache has overflowed its target by a wide
+ * margin does the caller wait for the reclaim thread to catch up.
  */
 static void
 arc_get_data_buf(arc_buf_t *buf)
@@ -2549,66 +3613,45 @@ arc_get_data_buf(arc_buf_t *buf)
 	arc_adapt(size, state);
 
 	/*
-	 * We have not yet reached cache maximum size,
-	 * just allocate a new buffer.
+	 * If arc_size has grown past the overflow limit we must be adding
+	 * data faster than the reclaim thread can evict it.  Wait for it
+	 * to catch up rather than compounding the problem.  The reclaim
+	 * thread may be unable to get below the limit (e.g. because the
+	 * remaining buffers are not evictable), and it releases all waiters
+	 * whenever it stops making progress, so this is not a loop.
 	 */
-	if (!arc_evict_needed(type)) {
-		if (type == ARC_BUFC_METADATA) {
-			buf->b_data = zio_buf_alloc(size);
-			arc_space_consume(size, ARC_SPACE_DATA);
-		} else {
-			ASSERT(type == ARC_BUFC_DATA);
-			buf->b_data = zio_data_buf_alloc(size);
-			ARCSTAT_INCR(arcstat_data_size, size);
-			atomic_add_64(&arc_size, size);
+	if (arc_is_overflowing()) {
+		mutex_enter(&arc_reclaim_thr_lock);
+		if (arc_is_overflowing()) {
+			ARCSTAT_BUMP(arcstat_evict_wait);
+			cv_signal(&arc_reclaim_thr_cv);
+			cv_wait(&arc_reclaim_waiters_cv, &arc_reclaim_thr_lock);
 		}
-		goto out;
+		mutex_exit(&arc_reclaim_thr_lock);
 	}
 
-	/*
-	 * If we are prefetching from the mfu ghost list, this buffer
-	 * will end up on the mru list; so steal space from there.
-	 */
-	if (state == arc_mfu_ghost)
-		state = buf->b_hdr->b_flags & ARC_PREFETCH ? arc_mru : arc_mfu;
-	else if (state == arc_mru_ghost)
-		state = arc_mru;
-
-	if (state == arc_mru || state == arc_anon) {
-		uint64_t mru_used = arc_anon->arcs_size + arc_mru->arcs_size;
-		state = (arc_mfu->arcs_lsize[type] >= size &&
-		    arc_p > mru_used) ? arc_mfu : arc_mru;
+	if (type == ARC_BUFC_METADATA) {
+		buf->b_data = zio_buf_alloc(size);
+		arc_space_consume(size, ARC_SPACE_DATA);
 	} else {
-		/* MFU cases */
-		uint64_t mfu_space = arc_c - arc_p;
-		state =  (arc_mru->arcs_lsize[type] >= size &&
-		    mfu_space > arc_mfu->arcs_size) ? arc_mru : arc_mfu;
+		ASSERT(type == ARC_BUFC_DATA);
+		buf->b_data = zio_data_buf_alloc(size);
+		ARCSTAT_INCR(arcstat_data_size, size);
+		atomic_add_64(&arc_size, size);
 	}
 
-	if ((buf->b_data = arc_evict(state, 0, size, TRUE, type)) == NULL) {
-		if (type == ARC_BUFC_METADATA) {
-			buf->b_data = zio_buf_alloc(size);
-			arc_space_consume(size, ARC_SPACE_DATA);
-
-			/*
-			 * If we are unable to recycle an existing meta buffer
-			 * signal the reclaim thread.  It will notify users
-			 * via the prune callback to drop references.  The
-			 * prune callback in run in the context of the reclaim
-			 * thread to avoid deadlocking on the hash_lock.
-			 */
-			cv_signal(&arc_reclaim_thr_cv);
-		} else {
-			ASSERT(type == ARC_BUFC_DATA);
-			buf->b_data = zio_data_buf_alloc(size);
-			ARCSTAT_INCR(arcstat_data_size, size);
-			atomic_add_64(&arc_size, size);
-		}
+	/*
+	 * Wake the reclaim thread as soon as the cache reaches its limits
+	 * so that it evicts ahead of the allocations which follow.  This
+	 * also covers metadata over arc_meta_limit, where the reclaim
+	 * thread notifies users via the prune callback to drop references;
+	 * that is done in its context to avoid deadlocking on the hash_lock.
+	 */
+	if (arc_evict_needed(type))
+		arc_reclaim_wakeup();
 
-		ARCSTAT_BUMP(arcstat_recycle_miss);
-	}
 	ASSERT(buf->b_data != NULL);
-out:
+
 	/*
 	 * Update the state size.  Note that ghost states have a
 	 * "ghost size" and so don't need to be updated.
@@ -2617,8 +3660,8 @@ out:
 		arc_buf_hdr_t *hdr = buf->b_hdr;
 
 		atomic_add_64(&hdr->b_state->arcs_size, size);
-		if (list_link_active(&hdr->b_arc_node)) {
-			ASSERT(refcount_is_zero(&hdr->b_refcnt));
+		if (multilist_link_active(&hdr->b_l1hdr.b_arc_node)) {
+			ASSERT(refcount_is_zero(&hdr->b_l1hdr.b_refcnt));
 			atomic_add_64(&hdr->b_state->arcs_lsize[type], size);
 		}
 		/*
@@ -2649,8 +3692,8 @@ arc_access(arc_buf_hdr_t *buf, kmutex_t *hash_lock)
 		 * to the MRU state.
 		 */
 
-		ASSERT(buf->b_arc_access == 0);
-		buf->b_arc_access = ddi_get_lbolt();
+		ASSERT(buf->b_l1hdr.b_arc_access == 0);
+		buf->b_l1hdr.b_arc_access = ddi_get_lbolt();
 		DTRACE_PROBE1(new_state__mru, arc_buf_hdr_t *, buf);
 		arc_change_state(arc_mru, buf, hash_lock);
 
@@ -2666,13 +3709,14 @@ arc_access(arc_buf_hdr_t *buf, kmutex_t *hash_lock)
 		 *   another prefetch (to make it less likely to be evicted).
 		 */
 		if ((buf->b_flags & ARC_PREFETCH) != 0) {
-			if (refcount_count(&buf->b_refcnt) == 0) {
-				ASSERT(list_link_active(&buf->b_arc_node));
+			if (refcount_count(&buf->b_l1hdr.b_refcnt) == 0) {
+				ASSERT(multilist_link_active(
+				    &buf->b_l1hdr.b_arc_node));
 			} else {
 				buf->b_flags &= ~ARC_PREFETCH;
 				ARCSTAT_BUMP(arcstat_mru_hits);
 			}
-			buf->b_arc_access = now;
+			buf->b_l1hdr.b_arc_access = now;
 			return;
 		}
 
@@ -2681,13 +3725,13 @@ arc_access(arc_buf_hdr_t *buf, kmutex_t *hash_lock)
 		 * but it is still in the cache. Move it to the MFU
 		 * state.
 		 */
-		if (now > buf->b_arc_access + ARC_MINTIME) {
+		if (now > buf->b_l1hdr.b_arc_access + ARC_MINTIME) {
 			/*
 			 * More than 125ms have passed since we
 			 * instantiated this buffer.  Move it to the
 			 * most frequently used state.
 			 */
-			buf->b_arc_access = now;
+			buf->b_l1hdr.b_arc_access = now;
 			DTRACE_PROBE1(new_state__mfu, arc_buf_hdr_t *, buf);
 			arc_change_state(arc_mfu, buf, hash_lock);
 		}
@@ -2702,7 +3746,7 @@ arc_access(arc_buf_hdr_t *buf, kmutex_t *hash_lock)
 
 		if (buf->b_flags & ARC_PREFETCH) {
 			new_state = arc_mru;
-			if (refcount_count(&buf->b_refcnt) > 0)
+			if (refcount_count(&buf->b_l1hdr.b_refcnt) > 0)
 				buf->b_flags &= ~ARC_PREFETCH;
 			DTRACE_PROBE1(new_state__mru, arc_buf_hdr_t *, buf);
 		} else {
@@ -2710,7 +3754,7 @@ arc_access(arc_buf_hdr_t *buf, kmutex_t *hash_lock)
 			DTRACE_PROBE1(new_state__mfu, arc_buf_hdr_t *, buf);
 		}
 
-		buf->b_arc_access = ddi_get_lbolt();
+		buf->b_l1hdr.b_arc_access = ddi_get_lbolt();
 		arc_change_state(new_state, buf, hash_lock);
 
 		ARCSTAT_BUMP(arcstat_mru_ghost_hits);
@@ -2725,11 +3769,12 @@ arc_access(arc_buf_hdr_t *buf, kmutex_t *hash_lock)
 		 * the head of the list now.
 		 */
 		if ((buf->b_flags & ARC_PREFETCH) != 0) {
-			ASSERT(refcount_count(&buf->b_refcnt) == 0);
-			ASSERT(list_link_active(&buf->b_arc_node));
+			ASSERT(refcount_count(&buf->b_l1hdr.b_refcnt) == 0);
+			ASSERT(multilist_link_active(
+			    &buf->b_l1hdr.b_arc_node));
 		}
 		ARCSTAT_BUMP(arcstat_mfu_hits);
-		buf->b_arc_access = ddi_get_lbolt();
+		buf->b_l1hdr.b_arc_access = ddi_get_lbolt();
 	} else if (buf->b_state == arc_mfu_ghost) {
 		arc_state_t	*new_state = arc_mfu;
 		/*
@@ -2743,11 +3788,11 @@ arc_access(arc_buf_hdr_t *buf, kmutex_t *hash_lock)
 			 * This is a prefetch access...
 			 * move this block back to the MRU state.
 			 */
-			ASSERT0(refcount_count(&buf->b_refcnt));
+			ASSERT0(refcount_count(&buf->b_l1hdr.b_refcnt));
 			new_state = arc_mru;
 		}
 
-		buf->b_arc_access = ddi_get_lbolt();
+		buf->b_l1hdr.b_arc_access = ddi_get_lbolt();
 		DTRACE_PROBE1(new_state__mfu, arc_buf_hdr_t *, buf);
 		arc_change_state(new_state, buf, hash_lock);
 
@@ -2757,7 +3802,7 @@ arc_access(arc_buf_hdr_t *buf, kmutex_t *hash_lock)
 		 * This buffer is on the 2nd Level ARC.
 		 */
 
-		buf->b_arc_access = ddi_get_lbolt();
+		buf->b_l1hdr.b_arc_access = ddi_get_lbolt();
 		DTRACE_PROBE1(new_state__mfu, arc_buf_hdr_t *, buf);
 		arc_change_state(arc_mfu, buf, hash_lock);
 	} else {
@@ -2798,10 +3843,29 @@ arc_read_done(zio_t *zio)
 	kmutex_t	*hash_lock;
 	arc_callback_t	*callback_list, *acb;
 	int		freeable = FALSE;
+	abd_t		*pdata = NULL;
 
 	buf = zio->io_private;
 	hdr = buf->b_hdr;
 
+	/*
+	 * The block was read in its compressed form; decompress it into
+	 * the buffer and hold on to the compressed copy, which is attached
+	 * to the header below once it is known to be cacheable.  Otherwise
+	 * the data was read straight into the buffer through a linear ABD
+	 * wrapping it, which is no longer needed.
+	 */
+	if (zio->io_flags & ZIO_FLAG_RAW) {
+		pdata = zio->io_abd;
+		if (zio->io_error == 0 &&
+		    zio_decompress_data(BP_GET_COMPRESS(zio->io_bp), pdata,
+		    buf->b_data, zio->io_size, hdr->b_size) != 0)
+			zio->io_error = EIO;
+	} else if (zio->io_abd != NULL) {
+		abd_put(zio->io_abd);
+	}
+	zio->io_abd = zio->io_orig_abd = NULL;
+
 	/*
 	 * The hdr was inserted into hash-table and removed from lists
 	 * prior to starting I/O.  We should find this header, since
@@ -2822,7 +3886,7 @@ arc_read_done(zio_t *zio)
 		hdr->b_flags &= ~ARC_L2CACHE;
 
 	/* byteswap if necessary */
-	callback_list = hdr->b_acb;
+	callback_list = hdr->b_l1hdr.b_acb;
 	ASSERT(callback_list != NULL);
 	if (BP_SHOULD_BYTESWAP(zio->io_bp) && zio->io_error == 0) {
 		dmu_object_byteswap_t bswap =
@@ -2833,7 +3897,15 @@ arc_read_done(zio_t *zio)
 		    dmu_ot_byteswap[bswap].ob_func(buf->b_data, hdr->b_size);
 	}
 
-	arc_cksum_compute(buf, B_FALSE);
+	/*
+	 * Headers holding only a compressed copy have no buffer to
+	 * checksum when they are written to the L2ARC, so always
+	 * compute the checksum for those up front.  The same goes for
+	 * headers which are still cached on an L2ARC device but whose
+	 * checksum was dropped when the L2ARC copy failed to verify.
+	 */
+	arc_cksum_compute(buf, (pdata != NULL || HDR_HAS_L2HDR(hdr)) &&
+	    zio->io_error == 0);
 
 	if (hash_lock && zio->io_error == 0 && hdr->b_state == arc_anon) {
 		/*
@@ -2845,6 +3917,16 @@ arc_read_done(zio_t *zio)
 		arc_access(hdr, hash_lock);
 	}
 
+	if (pdata != NULL) {
+		if (hash_lock && zio->io_error == 0 &&
+		    (hdr->b_state == arc_mru || hdr->b_state == arc_mfu)) {
+			arc_hdr_set_pdata(hdr, pdata, zio->io_size,
+			    BP_GET_COMPRESS(zio->io_bp));
+		} else {
+			abd_free(pdata);
+		}
+	}
+
 	/* create copies of the data buffer for the callers */
 	abuf = buf;
 	for (acb = callback_list; acb; acb = acb->acb_next) {
@@ -2857,16 +3939,21 @@ arc_read_done(zio_t *zio)
 			abuf = NULL;
 		}
 	}
-	hdr->b_acb = NULL;
+	hdr->b_l1hdr.b_acb = NULL;
 	hdr->b_flags &= ~ARC_IO_IN_PROGRESS;
 	ASSERT(!HDR_BUF_AVAILABLE(hdr));
 	if (abuf == buf) {
 		ASSERT(buf->b_efunc == NULL);
-		ASSERT(hdr->b_datacnt == 1);
-		hdr->b_flags |= ARC_BUF_AVAILABLE;
+		ASSERT(hdr->b_l1hdr.b_datacnt == 1);
+		/* nobody wants the decompressed copy of a prefetch yet */
+		if (hdr->b_l1hdr.b_pdata != NULL)
+			arc_buf_destroy(buf, TRUE);
+		else
+			hdr->b_flags |= ARC_BUF_AVAILABLE;
 	}
 
-	ASSERT(refcount_is_zero(&hdr->b_refcnt) || callback_list != NULL);
+	ASSERT(refcount_is_zero(&hdr->b_l1hdr.b_refcnt) ||
+	    callback_list != NULL);
 
 	if (zio->io_error != 0) {
 		hdr->b_flags |= ARC_IO_ERROR;
@@ -2874,7 +3961,7 @@ arc_read_done(zio_t *zio)
 			arc_change_state(arc_anon, hdr, hash_lock);
 		if (HDR_IN_HASH_TABLE(hdr))
 			buf_hash_remove(hdr);
-		freeable = refcount_is_zero(&hdr->b_refcnt);
+		freeable = refcount_is_zero(&hdr->b_l1hdr.b_refcnt);
 	}
 
 	/*
@@ -2882,7 +3969,7 @@ arc_read_done(zio_t *zio)
 	 * that the hdr (and hence the cv) might be freed before we get to
 	 * the cv_broadcast().
 	 */
-	cv_broadcast(&hdr->b_cv);
+	cv_broadcast(&hdr->b_l1hdr.b_cv);
 
 	if (hash_lock) {
 		mutex_exit(hash_lock);
@@ -2894,7 +3981,7 @@ arc_read_done(zio_t *zio)
 		 * in the cache).
 		 */
 		ASSERT3P(hdr->b_state, ==, arc_anon);
-		freeable = refcount_is_zero(&hdr->b_refcnt);
+		freeable = refcount_is_zero(&hdr->b_l1hdr.b_refcnt);
 	}
 
 	/* execute each callback and free its structure */
@@ -2915,6 +4002,87 @@ arc_read_done(zio_t *zio)
 		arc_hdr_destroy(hdr);
 }
 
+/*
+ * The access trace logs every arc_read() to a ring buffer, which is
+ * exported as-is through a raw kstat so that arcsim.py can replay the
+ * workload against other cache sizes.  A record is cleared before it is
+ * rewritten and its sequence number is set last, so readers can discard
+ * records caught half written.
+ */
+static arc_trace_rec_t *arc_trace_buf;
+static uint64_t arc_trace_nrecs;
+static uint64_t arc_trace_seq;
+static kstat_t *arc_trace_ksp;
+
+static void
+arc_trace(arc_buf_hdr_t *hdr, arc_trace_type_t type, uint32_t arc_flags)
+{
+	arc_trace_rec_t *atr;
+	uint64_t seq;
+	uint8_t flags = 0;
+
+	if (arc_trace_buf == NULL)
+		return;
+
+	if (arc_flags & ARC_PREFETCH)
+		flags |= ARC_TRACE_PREFETCH;
+	if (arc_flags & ARC_L2CACHE)
+		flags |= ARC_TRACE_L2CACHE;
+	if (hdr->b_type == ARC_BUFC_METADATA)
+		flags |= ARC_TRACE_METADATA;
+	if (HDR_HAS_L2HDR(hdr))
+		flags |= ARC_TRACE_L2HDR;
+
+	seq = atomic_inc_64_nv(&arc_trace_seq);
+	atr = &arc_trace_buf[(seq - 1) % arc_trace_nrecs];
+
+	atr->atr_seq = 0;
+	membar_producer();
+	atr->atr_spa = hdr->b_spa;
+	atr->atr_dva = hdr->b_dva;
+	atr->atr_birth = hdr->b_birth;
+	atr->atr_size = hdr->b_size;
+	atr->atr_type = type;
+	atr->atr_flags = flags;
+	membar_producer();
+	atr->atr_seq = seq;
+}
+
+static void
+arc_trace_init(void)
+{
+	size_t size;
+
+	if (zfs_arc_trace_entries <= 0)
+		return;
+
+	arc_trace_nrecs = zfs_arc_trace_entries;
+	size = arc_trace_nrecs * sizeof (arc_trace_rec_t);
+	arc_trace_buf = vmem_zalloc(size, KM_SLEEP);
+
+	arc_trace_ksp = kstat_create("zfs", 0, "arc_trace", "misc",
+	    KSTAT_TYPE_RAW, 1, KSTAT_FLAG_VIRTUAL);
+	if (arc_trace_ksp != NULL) {
+		arc_trace_ksp->ks_data = arc_trace_buf;
+		arc_trace_ksp->ks_data_size = size;
+		kstat_install(arc_trace_ksp);
+	}
+}
+
+static void
+arc_trace_fini(void)
+{
+	if (arc_trace_ksp != NULL) {
+		kstat_delete(arc_trace_ksp);
+		arc_trace_ksp = NULL;
+	}
+	if (arc_trace_buf != NULL) {
+		vmem_free(arc_trace_buf,
+		    arc_trace_nrecs * sizeof (arc_trace_rec_t));
+		arc_trace_buf = NULL;
+	}
+}
+
 /*
  * "Read" the block at the specified DVA (in bp) via the
  * cache.  If the block is found in the cache, invoke the provided
@@ -2935,7 +4103,7 @@ arc_read_done(zio_t *zio)
  */
 int
 arc_read(zio_t *pio, spa_t *spa, const blkptr_t *bp, arc_done_func_t *done,
-    void *private, int priority, int zio_flags, uint32_t *arc_flags,
+    void *private, zio_priority_t priority, int zio_flags, uint32_t *arc_flags,
     const zbookmark_t *zb)
 {
 	arc_buf_hdr_t *hdr;
@@ -2943,18 +4111,25 @@ arc_read(zio_t *pio, spa_t *spa, const blkptr_t *bp, arc_done_func_t *done,
 	kmutex_t *hash_lock;
 	zio_t *rzio;
 	uint64_t guid = spa_load_guid(spa);
+	boolean_t traced = B_FALSE;
 
 top:
 	hdr = buf_hash_find(guid, BP_IDENTITY(bp), BP_PHYSICAL_BIRTH(bp),
 	    &hash_lock);
-	if (hdr && hdr->b_datacnt > 0) {
+	if (hdr != NULL && HDR_HAS_L1HDR(hdr) &&
+	    (hdr->b_l1hdr.b_datacnt > 0 || hdr->b_l1hdr.b_pdata != NULL)) {
+		uint64_t psize;
 
 		*arc_flags |= ARC_CACHED;
 
 		if (HDR_IO_IN_PROGRESS(hdr)) {
+			if (!traced) {
+				arc_trace(hdr, ARC_TRACE_IOWAIT, *arc_flags);
+				traced = B_TRUE;
+			}
 
 			if (*arc_flags & ARC_WAIT) {
-				cv_wait(&hdr->b_cv, hash_lock);
+				cv_wait(&hdr->b_l1hdr.b_cv, hash_lock);
 				mutex_exit(hash_lock);
 				goto top;
 			}
@@ -2972,8 +4147,8 @@ top:
 					    spa, NULL, NULL, NULL, zio_flags);
 
 				ASSERT(acb->acb_done != NULL);
-				acb->acb_next = hdr->b_acb;
-				hdr->b_acb = acb;
+				acb->acb_next = hdr->b_l1hdr.b_acb;
+				hdr->b_l1hdr.b_acb = acb;
 				add_reference(hdr, hash_lock, private);
 				mutex_exit(hash_lock);
 				return (0);
@@ -2989,12 +4164,14 @@ top:
 			/*
 			 * If this block is already in use, create a new
 			 * copy of the data so that we will be guaranteed
-			 * that arc_release() will always succeed.
+			 * that arc_release() will always succeed.  If only
+			 * the compressed copy is cached, decompress it.
 			 */
-			buf = hdr->b_buf;
-			ASSERT(buf);
-			ASSERT(buf->b_data);
-			if (HDR_BUF_AVAILABLE(hdr)) {
+			buf = hdr->b_l1hdr.b_buf;
+			if (buf == NULL) {
+				buf = arc_buf_alloc_decompress(hdr);
+			} else if (HDR_BUF_AVAILABLE(hdr)) {
+				ASSERT(buf->b_data);
 				ASSERT(buf->b_efunc == NULL);
 				hdr->b_flags &= ~ARC_BUF_AVAILABLE;
 			} else {
@@ -3002,7 +4179,7 @@ top:
 			}
 
 		} else if (*arc_flags & ARC_PREFETCH &&
-		    refcount_count(&hdr->b_refcnt) == 0) {
+		    refcount_count(&hdr->b_l1hdr.b_refcnt) == 0) {
 			hdr->b_flags |= ARC_PREFETCH;
 		}
 		DTRACE_PROBE1(arc__hit, arc_buf_hdr_t *, hdr);
@@ -3011,11 +4188,20 @@ top:
 			hdr->b_flags |= ARC_L2CACHE;
 		if (*arc_flags & ARC_L2COMPRESS)
 			hdr->b_flags |= ARC_L2COMPRESS;
+		psize = (hdr->b_l1hdr.b_pdata != NULL) ?
+		    hdr->b_l1hdr.b_psize : hdr->b_size;
+		if (!traced)
+			arc_trace(hdr, ARC_TRACE_HIT, *arc_flags);
+		AOSSTAT_CONDSTAT(hdr->b_os_stats,
+		    !(hdr->b_flags & ARC_PREFETCH), demand, prefetch,
+		    hdr->b_type != ARC_BUFC_METADATA, data, metadata, hits);
 		mutex_exit(hash_lock);
 		ARCSTAT_BUMP(arcstat_hits);
 		ARCSTAT_CONDSTAT(!(hdr->b_flags & ARC_PREFETCH),
 		    demand, prefetch, hdr->b_type != ARC_BUFC_METADATA,
 		    data, metadata, hits);
+		ARCSTAT_INCR(arcstat_hits_lsize, BP_GET_LSIZE(bp));
+		ARCSTAT_INCR(arcstat_hits_psize, psize);
 
 		if (done)
 			done(NULL, buf, private);
@@ -3024,7 +4210,9 @@ top:
 		arc_callback_t	*acb;
 		vdev_t *vd = NULL;
 		uint64_t addr = -1;
-		boolean_t devw = B_FALSE;
+		l2arc_dev_t *l2dev = NULL;
+		boolean_t norw = B_FALSE;
+		arc_trace_type_t trace_type = ARC_TRACE_MISS;
 
 		if (hdr == NULL) {
 			/* this block is not in the cache */
@@ -3034,7 +4222,8 @@ top:
 			hdr = buf->b_hdr;
 			hdr->b_dva = *BP_IDENTITY(bp);
 			hdr->b_birth = BP_PHYSICAL_BIRTH(bp);
-			hdr->b_cksum0 = bp->blk_cksum.zc_word[0];
+			if (zb != NULL)
+				arc_hdr_set_os_stats(hdr, zb->zb_objset);
 			exists = buf_hash_insert(hdr, &hash_lock);
 			if (exists) {
 				/* somebody beat us to the hash insert */
@@ -3059,8 +4248,28 @@ top:
 			/* this block is in the ghost cache */
 			ASSERT(GHOST_STATE(hdr->b_state));
 			ASSERT(!HDR_IO_IN_PROGRESS(hdr));
-			ASSERT0(refcount_count(&hdr->b_refcnt));
-			ASSERT(hdr->b_buf == NULL);
+
+			if (hdr->b_state == arc_mru_ghost)
+				trace_type = ARC_TRACE_MRU_GHOST;
+			else if (hdr->b_state == arc_mfu_ghost)
+				trace_type = ARC_TRACE_MFU_GHOST;
+			else
+				trace_type = ARC_TRACE_L2_ONLY;
+
+			/*
+			 * The block is coming back into memory, so an
+			 * L2-only header needs its L1 part restored.
+			 */
+			if (!HDR_HAS_L1HDR(hdr))
+				hdr = arc_hdr_realloc(hdr, hdr_l2only_cache,
+				    hdr_full_cache);
+
+			ASSERT0(refcount_count(&hdr->b_l1hdr.b_refcnt));
+			ASSERT(hdr->b_l1hdr.b_buf == NULL);
+
+			/* headers rebuilt from a persistent L2ARC have none */
+			if (hdr->b_os_stats == NULL && zb != NULL)
+				arc_hdr_set_os_stats(hdr, zb->zb_objset);
 
 			/* if this is a prefetch, we don't have a reference */
 			if (*arc_flags & ARC_PREFETCH)
@@ -3077,9 +4286,9 @@ top:
 			buf->b_efunc = NULL;
 			buf->b_private = NULL;
 			buf->b_next = NULL;
-			hdr->b_buf = buf;
-			ASSERT(hdr->b_datacnt == 0);
-			hdr->b_datacnt = 1;
+			hdr->b_l1hdr.b_buf = buf;
+			ASSERT(hdr->b_l1hdr.b_datacnt == 0);
+			hdr->b_l1hdr.b_datacnt = 1;
 			arc_get_data_buf(buf);
 			arc_access(hdr, hash_lock);
 		}
@@ -3090,14 +4299,15 @@ top:
 		acb->acb_done = done;
 		acb->acb_private = private;
 
-		ASSERT(hdr->b_acb == NULL);
-		hdr->b_acb = acb;
+		ASSERT(hdr->b_l1hdr.b_acb == NULL);
+		hdr->b_l1hdr.b_acb = acb;
 		hdr->b_flags |= ARC_IO_IN_PROGRESS;
 
-		if (HDR_L2CACHE(hdr) && hdr->b_l2hdr != NULL &&
-		    (vd = hdr->b_l2hdr->b_dev->l2ad_vdev) != NULL) {
-			devw = hdr->b_l2hdr->b_dev->l2ad_writing;
-			addr = hdr->b_l2hdr->b_daddr;
+		if (HDR_L2CACHE(hdr) && HDR_HAS_L2HDR(hdr) &&
+		    (vd = hdr->b_l2hdr.b_dev->l2ad_vdev) != NULL) {
+			l2dev = hdr->b_l2hdr.b_dev;
+			norw = l2dev->l2ad_norw && l2dev->l2ad_writing;
+			addr = hdr->b_l2hdr.b_daddr;
 			/*
 			 * Lock out device removal.
 			 */
@@ -3106,6 +4316,11 @@ top:
 				vd = NULL;
 		}
 
+		if (!traced)
+			arc_trace(hdr, trace_type, *arc_flags);
+		AOSSTAT_CONDSTAT(hdr->b_os_stats,
+		    !(hdr->b_flags & ARC_PREFETCH), demand, prefetch,
+		    hdr->b_type != ARC_BUFC_METADATA, data, metadata, misses);
 		mutex_exit(hash_lock);
 
 		ASSERT3U(hdr->b_size, ==, size);
@@ -3115,8 +4330,10 @@ top:
 		ARCSTAT_CONDSTAT(!(hdr->b_flags & ARC_PREFETCH),
 		    demand, prefetch, hdr->b_type != ARC_BUFC_METADATA,
 		    data, metadata, misses);
+		ARCSTAT_INCR(arcstat_misses_lsize, size);
+		ARCSTAT_INCR(arcstat_misses_psize, BP_GET_PSIZE(bp));
 
-		if (vd != NULL && l2arc_ndev != 0 && !(l2arc_norw && devw)) {
+		if (vd != NULL && l2arc_ndev != 0 && !norw) {
 			/*
 			 * Read from the L2ARC if the following are true:
 			 * 1. The L2ARC vdev was previously cached.
@@ -3126,13 +4343,15 @@ top:
 			 *    also have invalidated the vdev.
 			 * 5. This isn't prefetch and l2arc_noprefetch is set.
 			 */
-			if (hdr->b_l2hdr != NULL &&
+			if (HDR_HAS_L2HDR(hdr) &&
 			    !HDR_L2_WRITING(hdr) && !HDR_L2_EVICTED(hdr) &&
 			    !(l2arc_noprefetch && HDR_PREFETCH(hdr))) {
 				l2arc_read_callback_t *cb;
 
 				DTRACE_PROBE1(l2arc__hit, arc_buf_hdr_t *, hdr);
 				ARCSTAT_BUMP(arcstat_l2_hits);
+				if (hdr->b_os_stats != NULL)
+					AOSSTAT_BUMP(hdr->b_os_stats, l2_hits);
 
 				cb = kmem_zalloc(sizeof (l2arc_read_callback_t),
 				    KM_PUSHPAGE);
@@ -3141,7 +4360,7 @@ top:
 				cb->l2rcb_bp = *bp;
 				cb->l2rcb_zb = *zb;
 				cb->l2rcb_flags = zio_flags;
-				cb->l2rcb_compress = hdr->b_l2hdr->b_compress;
+				cb->l2rcb_compress = hdr->b_l2hdr.b_compress;
 
 				/*
 				 * l2arc read.  The SCL_L2ARC lock will be
@@ -3149,7 +4368,7 @@ top:
 				 * Issue a null zio if the underlying buffer
 				 * was squashed to zero size by compression.
 				 */
-				if (hdr->b_l2hdr->b_compress ==
+				if (hdr->b_l2hdr.b_compress ==
 				    ZIO_COMPRESS_EMPTY) {
 					rzio = zio_null(pio, spa, vd,
 					    l2arc_read_done, cb,
@@ -3159,8 +4378,10 @@ top:
 					    ZIO_FLAG_DONT_RETRY);
 				} else {
 					rzio = zio_read_phys(pio, vd, addr,
-					    hdr->b_l2hdr->b_asize,
-					    buf->b_data, ZIO_CHECKSUM_OFF,
+					    hdr->b_l2hdr.b_asize,
+					    abd_get_from_buf(buf->b_data,
+					    hdr->b_l2hdr.b_asize),
+					    ZIO_CHECKSUM_OFF,
 					    l2arc_read_done, cb, priority,
 					    zio_flags | ZIO_FLAG_DONT_CACHE |
 					    ZIO_FLAG_CANFAIL |
@@ -3170,7 +4391,9 @@ top:
 				DTRACE_PROBE2(l2arc__read, vdev_t *, vd,
 				    zio_t *, rzio);
 				ARCSTAT_INCR(arcstat_l2_read_bytes,
-				    hdr->b_l2hdr->b_asize);
+				    hdr->b_l2hdr.b_asize);
+				atomic_add_64(&l2dev->l2ad_read_bytes,
+				    hdr->b_l2hdr.b_asize);
 
 				if (*arc_flags & ARC_NOWAIT) {
 					zio_nowait(rzio);
@@ -3186,6 +4409,10 @@ top:
 				DTRACE_PROBE1(l2arc__miss,
 				    arc_buf_hdr_t *, hdr);
 				ARCSTAT_BUMP(arcstat_l2_misses);
+				if (hdr->b_os_stats != NULL) {
+					AOSSTAT_BUMP(hdr->b_os_stats,
+					    l2_misses);
+				}
 				if (HDR_L2_WRITING(hdr))
 					ARCSTAT_BUMP(arcstat_l2_rw_clash);
 				spa_config_exit(spa, SCL_L2ARC, vd);
@@ -3197,11 +4424,32 @@ top:
 				DTRACE_PROBE1(l2arc__miss,
 				    arc_buf_hdr_t *, hdr);
 				ARCSTAT_BUMP(arcstat_l2_misses);
+				if (hdr->b_os_stats != NULL) {
+					AOSSTAT_BUMP(hdr->b_os_stats,
+					    l2_misses);
+				}
 			}
 		}
 
-		rzio = zio_read(pio, spa, bp, buf->b_data, size,
-		    arc_read_done, buf, priority, zio_flags, zb);
+		if (zfs_compressed_arc_enabled &&
+		    hdr->b_type == ARC_BUFC_DATA &&
+		    BP_GET_COMPRESS(bp) != ZIO_COMPRESS_OFF &&
+		    !BP_IS_GANG(bp) && !BP_SHOULD_BYTESWAP(bp)) {
+			/*
+			 * Read the block as it is stored on disk so that
+			 * the compressed copy can be cached as well;
+			 * arc_read_done() decompresses it into buf.
+			 */
+			uint64_t psize = BP_GET_PSIZE(bp);
+
+			rzio = zio_read(pio, spa, bp,
+			    abd_alloc(psize, B_FALSE), psize, arc_read_done,
+			    buf, priority, zio_flags | ZIO_FLAG_RAW, zb);
+		} else {
+			rzio = zio_read(pio, spa, bp,
+			    abd_get_from_buf(buf->b_data, size), size,
+			    arc_read_done, buf, priority, zio_flags, zb);
+		}
 
 		if (*arc_flags & ARC_WAIT)
 			return (zio_wait(rzio));
@@ -3248,7 +4496,8 @@ arc_set_callback(arc_buf_t *buf, arc_evict_func_t *func, void *private)
 {
 	ASSERT(buf->b_hdr != NULL);
 	ASSERT(buf->b_hdr->b_state != arc_anon);
-	ASSERT(!refcount_is_zero(&buf->b_hdr->b_refcnt) || func == NULL);
+	ASSERT(!refcount_is_zero(&buf->b_hdr->b_l1hdr.b_refcnt) ||
+	    func == NULL);
 	ASSERT(buf->b_efunc == NULL);
 	ASSERT(!HDR_BUF_AVAILABLE(buf->b_hdr));
 
@@ -3271,13 +4520,20 @@ arc_freed(spa_t *spa, const blkptr_t *bp)
 	if (hdr == NULL)
 		return;
 	if (HDR_BUF_AVAILABLE(hdr)) {
-		arc_buf_t *buf = hdr->b_buf;
+		arc_buf_t *buf = hdr->b_l1hdr.b_buf;
 		add_reference(hdr, hash_lock, FTAG);
 		hdr->b_flags &= ~ARC_BUF_AVAILABLE;
 		mutex_exit(hash_lock);
 
 		arc_release(buf, FTAG);
 		(void) arc_buf_remove_ref(buf, FTAG);
+	} else if (HDR_HAS_L1HDR(hdr) && hdr->b_l1hdr.b_datacnt == 0 &&
+	    hdr->b_l1hdr.b_pdata != NULL &&
+	    refcount_is_zero(&hdr->b_l1hdr.b_refcnt)) {
+		/* only the compressed copy is cached, just drop it */
+		arc_change_state(arc_anon, hdr, hash_lock);
+		mutex_exit(hash_lock);
+		arc_hdr_destroy(hdr);
 	} else {
 		mutex_exit(hash_lock);
 	}
@@ -3321,40 +4577,40 @@ arc_buf_evict(arc_buf_t *buf)
 	hdr = buf->b_hdr;
 	ASSERT3P(hash_lock, ==, HDR_LOCK(hdr));
 
-	ASSERT3U(refcount_count(&hdr->b_refcnt), <, hdr->b_datacnt);
+	ASSERT3U(refcount_count(&hdr->b_l1hdr.b_refcnt), <,
+	    hdr->b_l1hdr.b_datacnt);
 	ASSERT(hdr->b_state == arc_mru || hdr->b_state == arc_mfu);
 
 	/*
 	 * Pull this buffer off of the hdr
 	 */
-	bufp = &hdr->b_buf;
+	bufp = &hdr->b_l1hdr.b_buf;
 	while (*bufp != buf)
 		bufp = &(*bufp)->b_next;
 	*bufp = buf->b_next;
 
 	ASSERT(buf->b_data != NULL);
-	arc_buf_destroy(buf, FALSE, FALSE);
+	arc_buf_destroy(buf, FALSE);
 
-	if (hdr->b_datacnt == 0) {
+	/*
+	 * If the compressed copy of the block is being kept the header
+	 * stays where it is; the decompressed buffer can be recreated
+	 * from it on the next access.
+	 */
+	if (hdr->b_l1hdr.b_datacnt == 0 && hdr->b_l1hdr.b_pdata == NULL) {
 		arc_state_t *old_state = hdr->b_state;
 		arc_state_t *evicted_state;
 
-		ASSERT(hdr->b_buf == NULL);
-		ASSERT(refcount_is_zero(&hdr->b_refcnt));
+		ASSERT(hdr->b_l1hdr.b_buf == NULL);
+		ASSERT(refcount_is_zero(&hdr->b_l1hdr.b_refcnt));
 
 		evicted_state =
 		    (old_state == arc_mru) ? arc_mru_ghost : arc_mfu_ghost;
 
-		mutex_enter(&old_state->arcs_mtx);
-		mutex_enter(&evicted_state->arcs_mtx);
-
 		arc_change_state(evicted_state, hdr, hash_lock);
 		ASSERT(HDR_IN_HASH_TABLE(hdr));
 		hdr->b_flags |= ARC_IN_HASH_TABLE;
 		hdr->b_flags &= ~ARC_BUF_AVAILABLE;
-
-		mutex_exit(&evicted_state->arcs_mtx);
-		mutex_exit(&old_state->arcs_mtx);
 	}
 	mutex_exit(hash_lock);
 	mutex_exit(&buf->b_evict_lock);
@@ -3379,8 +4635,6 @@ arc_release(arc_buf_t *buf, void *tag)
 {
 	arc_buf_hdr_t *hdr;
 	kmutex_t *hash_lock = NULL;
-	l2arc_buf_hdr_t *l2hdr;
-	uint64_t buf_size = 0;
 
 	/*
 	 * It would be nice to assert that if it's DMU metadata (level >
@@ -3392,7 +4646,7 @@ arc_release(arc_buf_t *buf, void *tag)
 	hdr = buf->b_hdr;
 
 	/* this buffer is not on any list */
-	ASSERT(refcount_count(&hdr->b_refcnt) > 0);
+	ASSERT(refcount_count(&hdr->b_l1hdr.b_refcnt) > 0);
 
 	if (hdr->b_state == arc_anon) {
 		/* this buffer is already released */
@@ -3404,17 +4658,21 @@ arc_release(arc_buf_t *buf, void *tag)
 		ASSERT3P(hash_lock, ==, HDR_LOCK(hdr));
 	}
 
-	l2hdr = hdr->b_l2hdr;
-	if (l2hdr) {
+	if (HDR_HAS_L2HDR(hdr)) {
+		l2arc_buf_hdr_t *l2hdr = &hdr->b_l2hdr;
+
 		mutex_enter(&l2arc_buflist_mtx);
-		hdr->b_l2hdr = NULL;
-		buf_size = hdr->b_size;
+		ARCSTAT_INCR(arcstat_l2_asize, -l2hdr->b_asize);
+		ARCSTAT_INCR(arcstat_l2_size, -hdr->b_size);
+		list_remove(l2hdr->b_dev->l2ad_buflist, hdr);
+		hdr->b_flags &= ~ARC_HAS_L2HDR;
+		mutex_exit(&l2arc_buflist_mtx);
 	}
 
 	/*
 	 * Do we have more than one buf?
 	 */
-	if (hdr->b_datacnt > 1) {
+	if (hdr->b_l1hdr.b_datacnt > 1) {
 		arc_buf_hdr_t *nhdr;
 		arc_buf_t **bufp;
 		uint64_t blksz = hdr->b_size;
@@ -3422,13 +4680,13 @@ arc_release(arc_buf_t *buf, void *tag)
 		arc_buf_contents_t type = hdr->b_type;
 		uint32_t flags = hdr->b_flags;
 
-		ASSERT(hdr->b_buf != buf || buf->b_next != NULL);
+		ASSERT(hdr->b_l1hdr.b_buf != buf || buf->b_next != NULL);
 		/*
 		 * Pull the data off of this hdr and attach it to
 		 * a new anonymous hdr.
 		 */
 		(void) remove_reference(hdr, hash_lock, tag);
-		bufp = &hdr->b_buf;
+		bufp = &hdr->b_l1hdr.b_buf;
 		while (*bufp != buf)
 			bufp = &(*bufp)->b_next;
 		*bufp = buf->b_next;
@@ -3436,7 +4694,7 @@ arc_release(arc_buf_t *buf, void *tag)
 
 		ASSERT3U(hdr->b_state->arcs_size, >=, hdr->b_size);
 		atomic_add_64(&hdr->b_state->arcs_size, -hdr->b_size);
-		if (refcount_is_zero(&hdr->b_refcnt)) {
+		if (refcount_is_zero(&hdr->b_l1hdr.b_refcnt)) {
 			uint64_t *size = &hdr->b_state->arcs_lsize[hdr->b_type];
 			ASSERT3U(*size, >=, hdr->b_size);
 			atomic_add_64(size, -hdr->b_size);
@@ -3451,34 +4709,36 @@ arc_release(arc_buf_t *buf, void *tag)
 			ARCSTAT_INCR(arcstat_duplicate_buffers_size,
 			    -hdr->b_size);
 		}
-		hdr->b_datacnt -= 1;
+		hdr->b_l1hdr.b_datacnt -= 1;
 		arc_cksum_verify(buf);
 
 		mutex_exit(hash_lock);
 
-		nhdr = kmem_cache_alloc(hdr_cache, KM_PUSHPAGE);
+		nhdr = kmem_cache_alloc(hdr_full_cache, KM_PUSHPAGE);
 		nhdr->b_size = blksz;
 		nhdr->b_spa = spa;
 		nhdr->b_type = type;
-		nhdr->b_buf = buf;
+		nhdr->b_l1hdr.b_buf = buf;
 		nhdr->b_state = arc_anon;
-		nhdr->b_arc_access = 0;
-		nhdr->b_flags = flags & ARC_L2_WRITING;
-		nhdr->b_l2hdr = NULL;
-		nhdr->b_datacnt = 1;
+		nhdr->b_l1hdr.b_arc_access = 0;
+		nhdr->b_flags = (flags & ARC_L2_WRITING) | ARC_HAS_L1HDR;
+		nhdr->b_l1hdr.b_datacnt = 1;
 		nhdr->b_freeze_cksum = NULL;
-		(void) refcount_add(&nhdr->b_refcnt, tag);
+		(void) refcount_add(&nhdr->b_l1hdr.b_refcnt, tag);
 		buf->b_hdr = nhdr;
 		mutex_exit(&buf->b_evict_lock);
 		atomic_add_64(&arc_anon->arcs_size, blksz);
 	} else {
 		mutex_exit(&buf->b_evict_lock);
-		ASSERT(refcount_count(&hdr->b_refcnt) == 1);
-		ASSERT(!list_link_active(&hdr->b_arc_node));
+		ASSERT(refcount_count(&hdr->b_l1hdr.b_refcnt) == 1);
+		ASSERT(!multilist_link_active(&hdr->b_l1hdr.b_arc_node));
 		ASSERT(!HDR_IO_IN_PROGRESS(hdr));
 		if (hdr->b_state != arc_anon)
 			arc_change_state(arc_anon, hdr, hash_lock);
-		hdr->b_arc_access = 0;
+		hdr->b_l1hdr.b_arc_access = 0;
+		/* the compressed copy no longer matches what will be written */
+		if (hdr->b_l1hdr.b_pdata != NULL)
+			(void) arc_hdr_free_pdata(hdr);
 		if (hash_lock)
 			mutex_exit(hash_lock);
 
@@ -3487,15 +4747,6 @@ arc_release(arc_buf_t *buf, void *tag)
 	}
 	buf->b_efunc = NULL;
 	buf->b_private = NULL;
-
-	if (l2hdr) {
-		ARCSTAT_INCR(arcstat_l2_asize, -l2hdr->b_asize);
-		list_remove(l2hdr->b_dev->l2ad_buflist, hdr);
-		kmem_free(l2hdr, sizeof (l2arc_buf_hdr_t));
-		arc_space_return(L2HDR_SIZE, ARC_SPACE_L2HDRS);
-		ARCSTAT_INCR(arcstat_l2_size, -buf_size);
-		mutex_exit(&l2arc_buflist_mtx);
-	}
 }
 
 int
@@ -3527,7 +4778,7 @@ arc_referenced(arc_buf_t *buf)
 	int referenced;
 
 	mutex_enter(&buf->b_evict_lock);
-	referenced = (refcount_count(&buf->b_hdr->b_refcnt));
+	referenced = (refcount_count(&buf->b_hdr->b_l1hdr.b_refcnt));
 	mutex_exit(&buf->b_evict_lock);
 	return (referenced);
 }
@@ -3540,7 +4791,7 @@ arc_write_ready(zio_t *zio)
 	arc_buf_t *buf = callback->awcb_buf;
 	arc_buf_hdr_t *hdr = buf->b_hdr;
 
-	ASSERT(!refcount_is_zero(&buf->b_hdr->b_refcnt));
+	ASSERT(!refcount_is_zero(&buf->b_hdr->b_l1hdr.b_refcnt));
 	callback->awcb_ready(zio, buf, callback->awcb_private);
 
 	/*
@@ -3550,12 +4801,12 @@ arc_write_ready(zio_t *zio)
 	 * accounting for any re-write attempt.
 	 */
 	if (HDR_IO_IN_PROGRESS(hdr)) {
-		mutex_enter(&hdr->b_freeze_lock);
+		mutex_enter(&hdr->b_l1hdr.b_freeze_lock);
 		if (hdr->b_freeze_cksum != NULL) {
 			kmem_free(hdr->b_freeze_cksum, sizeof (zio_cksum_t));
 			hdr->b_freeze_cksum = NULL;
 		}
-		mutex_exit(&hdr->b_freeze_lock);
+		mutex_exit(&hdr->b_l1hdr.b_freeze_lock);
 	}
 	arc_cksum_compute(buf, B_FALSE);
 	hdr->b_flags |= ARC_IO_IN_PROGRESS;
@@ -3568,12 +4819,13 @@ arc_write_done(zio_t *zio)
 	arc_buf_t *buf = callback->awcb_buf;
 	arc_buf_hdr_t *hdr = buf->b_hdr;
 
-	ASSERT(hdr->b_acb == NULL);
+	ASSERT(hdr->b_l1hdr.b_acb == NULL);
+
+	abd_put(zio->io_abd);
 
 	if (zio->io_error == 0) {
 		hdr->b_dva = *BP_IDENTITY(zio->io_bp);
 		hdr->b_birth = BP_PHYSICAL_BIRTH(zio->io_bp);
-		hdr->b_cksum0 = zio->io_bp->blk_cksum.zc_word[0];
 	} else {
 		ASSERT(BUF_EMPTY(hdr));
 	}
@@ -3603,7 +4855,9 @@ arc_write_done(zio_t *zio)
 				if (!BP_EQUAL(&zio->io_bp_orig, zio->io_bp))
 					panic("bad overwrite, hdr=%p exists=%p",
 					    (void *)hdr, (void *)exists);
-				ASSERT(refcount_is_zero(&exists->b_refcnt));
+				ASSERT(!HDR_HAS_L1HDR(exists) ||
+				    refcount_is_zero(
+				    &exists->b_l1hdr.b_refcnt));
 				arc_change_state(arc_anon, exists, hash_lock);
 				mutex_exit(hash_lock);
 				arc_hdr_destroy(exists);
@@ -3611,7 +4865,7 @@ arc_write_done(zio_t *zio)
 				ASSERT3P(exists, ==, NULL);
 			} else {
 				/* Dedup */
-				ASSERT(hdr->b_datacnt == 1);
+				ASSERT(hdr->b_l1hdr.b_datacnt == 1);
 				ASSERT(hdr->b_state == arc_anon);
 				ASSERT(BP_GET_DEDUP(zio->io_bp));
 				ASSERT(BP_GET_LEVEL(zio->io_bp) == 0);
@@ -3626,7 +4880,7 @@ arc_write_done(zio_t *zio)
 		hdr->b_flags &= ~ARC_IO_IN_PROGRESS;
 	}
 
-	ASSERT(!refcount_is_zero(&hdr->b_refcnt));
+	ASSERT(!refcount_is_zero(&hdr->b_l1hdr.b_refcnt));
 	callback->awcb_done(zio, buf, callback->awcb_private);
 
 	kmem_free(callback, sizeof (arc_write_callback_t));
@@ -3636,7 +4890,8 @@ zio_t *
 arc_write(zio_t *pio, spa_t *spa, uint64_t txg,
     blkptr_t *bp, arc_buf_t *buf, boolean_t l2arc, boolean_t l2arc_compress,
     const zio_prop_t *zp, arc_done_func_t *ready, arc_done_func_t *done,
-    void *private, int priority, int zio_flags, const zbookmark_t *zb)
+    void *private, zio_priority_t priority, int zio_flags,
+    const zbookmark_t *zb)
 {
 	arc_buf_hdr_t *hdr = buf->b_hdr;
 	arc_write_callback_t *callback;
@@ -3646,18 +4901,20 @@ arc_write(zio_t *pio, spa_t *spa, uint64_t txg,
 	ASSERT(done != NULL);
 	ASSERT(!HDR_IO_ERROR(hdr));
 	ASSERT((hdr->b_flags & ARC_IO_IN_PROGRESS) == 0);
-	ASSERT(hdr->b_acb == NULL);
+	ASSERT(hdr->b_l1hdr.b_acb == NULL);
 	if (l2arc)
 		hdr->b_flags |= ARC_L2CACHE;
 	if (l2arc_compress)
 		hdr->b_flags |= ARC_L2COMPRESS;
+	arc_hdr_set_os_stats(hdr, zb->zb_objset);
 	callback = kmem_zalloc(sizeof (arc_write_callback_t), KM_PUSHPAGE);
 	callback->awcb_ready = ready;
 	callback->awcb_done = done;
 	callback->awcb_private = private;
 	callback->awcb_buf = buf;
 
-	zio = zio_write(pio, spa, txg, bp, buf->b_data, hdr->b_size, zp,
+	zio = zio_write(pio, spa, txg, bp,
+	    abd_get_from_buf(buf->b_data, hdr->b_size), hdr->b_size, zp,
 	    arc_write_ready, arc_write_done, callback, priority, zio_flags, zb);
 
 	return (zio);
@@ -3799,11 +5056,25 @@ arc_kstat_update(kstat_t *ksp, int rw)
 	return (0);
 }
 
+static void
+arc_state_multilist_create(multilist_t *ml)
+{
+	multilist_create(ml, sizeof (arc_buf_hdr_t),
+	    offsetof(arc_buf_hdr_t, b_l1hdr.b_arc_node),
+	    zfs_arc_num_sublists_per_state, arc_state_multilist_index_func);
+}
+
 void
 arc_init(void)
 {
+	int i;
+
 	mutex_init(&arc_reclaim_thr_lock, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&arc_reclaim_thr_cv, NULL, CV_DEFAULT, NULL);
+	cv_init(&arc_reclaim_waiters_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&arc_os_stats_kstat_lock, NULL, MUTEX_DEFAULT, NULL);
+	for (i = 0; i < AOS_HASH_BUCKETS; i++)
+		mutex_init(&arc_os_stats_locks[i], NULL, MUTEX_DEFAULT, NULL);
 
 	/* Convert seconds to clock ticks */
 	zfs_arc_min_prefetch_lifespan = 1 * hz;
@@ -3868,33 +5139,15 @@ arc_init(void)
 	arc_l2c_only = &ARC_l2c_only;
 	arc_size = 0;
 
-	mutex_init(&arc_anon->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mru->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mru_ghost->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mfu->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mfu_ghost->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_l2c_only->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-
-	list_create(&arc_mru->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mru->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mru_ghost->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mru_ghost->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu_ghost->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu_ghost->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_l2c_only->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_l2c_only->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
+	if (zfs_arc_num_sublists_per_state < 1)
+		zfs_arc_num_sublists_per_state = MAX(max_ncpus, 1);
+
+	for (i = 0; i < ARC_BUFC_NUMTYPES; i++) {
+		arc_state_multilist_create(&arc_mru->arcs_list[i]);
+		arc_state_multilist_create(&arc_mru_ghost->arcs_list[i]);
+		arc_state_multilist_create(&arc_mfu->arcs_list[i]);
+		arc_state_multilist_create(&arc_mfu_ghost->arcs_list[i]);
+	}
 
 	buf_init();
 
@@ -3915,7 +5168,9 @@ arc_init(void)
 		kstat_install(arc_ksp);
 	}
 
-	(void) thread_create(NULL, 0, arc_adapt_thread, NULL, 0, &p0,
+	arc_trace_init();
+
+	(void) thread_create(NULL, 0, arc_reclaim_thread, NULL, 0, &p0,
 	    TS_RUN, minclsyspri);
 
 	arc_dead = FALSE;
@@ -3932,6 +5187,7 @@ void
 arc_fini(void)
 {
 	arc_prune_t *p;
+	int i;
 
 	mutex_enter(&arc_reclaim_thr_lock);
 #ifdef _KERNEL
@@ -3939,6 +5195,7 @@ arc_fini(void)
 #endif /* _KERNEL */
 
 	arc_thread_exit = 1;
+	cv_signal(&arc_reclaim_thr_cv);
 	while (arc_thread_exit != 0)
 		cv_wait(&arc_reclaim_thr_cv, &arc_reclaim_thr_lock);
 	mutex_exit(&arc_reclaim_thr_lock);
@@ -3952,6 +5209,8 @@ arc_fini(void)
 		arc_ksp = NULL;
 	}
 
+	arc_trace_fini();
+
 	mutex_enter(&arc_prune_mtx);
 	while ((p = list_head(&arc_prune_list)) != NULL) {
 		list_remove(&arc_prune_list, p);
@@ -3966,27 +5225,25 @@ arc_fini(void)
 	mutex_destroy(&arc_eviction_mtx);
 	mutex_destroy(&arc_reclaim_thr_lock);
 	cv_destroy(&arc_reclaim_thr_cv);
+	cv_destroy(&arc_reclaim_waiters_cv);
 
-	list_destroy(&arc_mru->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mru_ghost->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mfu->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mfu_ghost->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mru->arcs_list[ARC_BUFC_DATA]);
-	list_destroy(&arc_mru_ghost->arcs_list[ARC_BUFC_DATA]);
-	list_destroy(&arc_mfu->arcs_list[ARC_BUFC_DATA]);
-	list_destroy(&arc_mfu_ghost->arcs_list[ARC_BUFC_DATA]);
-
-	mutex_destroy(&arc_anon->arcs_mtx);
-	mutex_destroy(&arc_mru->arcs_mtx);
-	mutex_destroy(&arc_mru_ghost->arcs_mtx);
-	mutex_destroy(&arc_mfu->arcs_mtx);
-	mutex_destroy(&arc_mfu_ghost->arcs_mtx);
-	mutex_destroy(&arc_l2c_only->arcs_mtx);
+	for (i = 0; i < ARC_BUFC_NUMTYPES; i++) {
+		multilist_destroy(&arc_mru->arcs_list[i]);
+		multilist_destroy(&arc_mru_ghost->arcs_list[i]);
+		multilist_destroy(&arc_mfu->arcs_list[i]);
+		multilist_destroy(&arc_mfu_ghost->arcs_list[i]);
+	}
 
 	mutex_destroy(&zfs_write_limit_lock);
 
 	buf_fini();
 
+	for (i = 0; i < AOS_HASH_BUCKETS; i++) {
+		ASSERT3P(arc_os_stats_table[i], ==, NULL);
+		mutex_destroy(&arc_os_stats_locks[i]);
+	}
+	mutex_destroy(&arc_os_stats_kstat_lock);
+
 	ASSERT(arc_loaned_bytes == 0);
 }
 
@@ -4108,10 +5365,41 @@ arc_fini(void)
  * 8. If an ARC buffer is written (and dirtied) which also exists in the
  * L2ARC, the now stale L2ARC buffer is immediately dropped.
  *
+ * 9. Along with the buffers themselves, each write pass appends a log
+ * block to the device which records the identity and location of every
+ * buffer written by it.  Log blocks are chained backwards in time, and
+ * a small device header at the start of the device points to the most
+ * recent one.  When the pool is imported the chain is walked from a
+ * background thread and the L2ARC headers are recreated (in the
+ * ARC_l2c_only state) without any of the cached data being read, so the
+ * device is warm again long before the feed thread could refill it:
+ *
+ *	+--------+---------------------------------------------------+
+ *	| device | buf buf LOG1 buf buf buf LOG2 buf LOG3 ... (free) |
+ *	| header |                                                   |
+ *	+--------+---------------------------------------------------+
+ *
+ *	device header -> LOG3 -> LOG2 -> LOG1	(dh_last_lbp, lb_prev)
+ *
+ * Log blocks and the device header are checksummed, and every restored
+ * header keeps the checksum of its buffer (b_freeze_cksum) so that a
+ * buffer which was overwritten after its log block was written simply
+ * reads as an L2ARC checksum miss and is fetched from the pool instead.
+ *
+ * 10. Every cache device is fed by its own l2arc_feed_thread(), and how
+ * much is written to it per interval adapts to the device.  Write passes
+ * which complete well within l2arc_write_target_ms let the write size grow
+ * towards l2arc_write_limit, while slower passes shrink it, so a fast
+ * device is fed much more quickly than a slow one.  Bytes read from a
+ * device since its last pass are taken off its next write, leaving read
+ * bandwidth to a device which is busy serving hits.
+ *
  * The performance of the L2ARC can be tweaked by a number of tunables, which
  * may be necessary for different workloads:
  *
- *	l2arc_write_max		max write bytes per interval
+ *	l2arc_write_max		initial write bytes per interval
+ *	l2arc_write_limit	max adaptive write bytes per interval
+ *	l2arc_write_target_ms	write pass latency to adapt to, 0 disables
  *	l2arc_write_boost	extra write bytes during device warmup
  *	l2arc_noprefetch	skip caching prefetched buffers
  *	l2arc_nocompress	skip compressing buffers
@@ -4122,6 +5410,10 @@ arc_fini(void)
  *				since more compressed buffers are likely to
  *				be present
  *	l2arc_feed_secs		seconds between L2ARC writing
+ *	l2arc_norw		hold off reads during writes: never, always,
+ *				or only on devices too slow to meet
+ *				l2arc_write_target_ms
+ *	l2arc_rebuild_enabled	restore the L2ARC contents on pool import
  *
  * Tunables may be removed or added as future performance improvements are
  * integrated, and also may become zpool properties.
@@ -4146,30 +5438,42 @@ l2arc_write_eligible(uint64_t spa_guid, arc_buf_hdr_t *ab)
 	 * 3. has an I/O in progress (it may be an incomplete read).
 	 * 4. is flagged not eligible (zfs property).
 	 */
-	if (ab->b_spa != spa_guid || ab->b_l2hdr != NULL ||
+	if (ab->b_spa != spa_guid || HDR_HAS_L2HDR(ab) ||
 	    HDR_IO_IN_PROGRESS(ab) || !HDR_L2CACHE(ab))
 		return (B_FALSE);
 
 	return (B_TRUE);
 }
 
+/*
+ * Returns how much to write to a device in this pass: its adaptive write
+ * size, less whatever has been read from it since the last pass so that
+ * a device busy serving reads is fed more gently.
+ */
 static uint64_t
-l2arc_write_size(void)
+l2arc_write_size(l2arc_dev_t *dev)
 {
-	uint64_t size;
+	uint64_t size, read;
 
 	/*
 	 * Make sure our globals have meaningful values in case the user
 	 * altered them.
 	 */
-	size = l2arc_write_max;
-	if (size == 0) {
+	if (l2arc_write_max == 0) {
 		cmn_err(CE_NOTE, "Bad value for l2arc_write_max, value must "
 		    "be greater than zero, resetting it to the default (%d)",
 		    L2ARC_WRITE_SIZE);
-		size = l2arc_write_max = L2ARC_WRITE_SIZE;
+		l2arc_write_max = L2ARC_WRITE_SIZE;
 	}
 
+	size = dev->l2ad_write_size;
+	if (l2arc_write_target_ms == 0 || size == 0)
+		size = l2arc_write_max;
+
+	read = dev->l2ad_read_bytes;
+	atomic_add_64(&dev->l2ad_read_bytes, -read);
+	size -= MIN(read, size - size / 4);
+
 	if (arc_warm == B_FALSE)
 		size += l2arc_write_boost;
 
@@ -4177,6 +5481,47 @@ l2arc_write_size(void)
 
 }
 
+/*
+ * Adapts a device's write size to how long its last write pass took.
+ * Passes which finish well inside l2arc_write_target_ms grow the size
+ * additively, up to l2arc_write_limit; passes which overrun it shrink the
+ * size by a quarter, down to an eighth of l2arc_write_max.  A fast device
+ * therefore ends up being fed far more per interval than a slow one.
+ */
+static void
+l2arc_write_adapt(l2arc_dev_t *dev, uint64_t wanted, uint64_t wrote)
+{
+	hrtime_t target = (hrtime_t)l2arc_write_target_ms *
+	    (NANOSEC / MILLISEC);
+	uint64_t min = MAX(l2arc_write_max >> 3, SPA_MAXBLOCKSIZE);
+	uint64_t max = MAX(l2arc_write_limit, l2arc_write_max);
+	uint64_t size = dev->l2ad_write_size;
+	boolean_t slow = B_FALSE;
+
+	if (target == 0) {
+		size = l2arc_write_max;
+	} else if (dev->l2ad_write_lat > target) {
+		ARCSTAT_BUMP(arcstat_l2_write_throttled);
+		slow = (size <= min);
+		size -= size / 4;
+	} else if (wrote > wanted / 2 && dev->l2ad_write_lat < target / 2) {
+		size += l2arc_write_max / 4;
+	}
+	dev->l2ad_write_size = MIN(MAX(size, min), max);
+
+	switch (l2arc_norw) {
+	case L2ARC_NORW_NEVER:
+		dev->l2ad_norw = B_FALSE;
+		break;
+	case L2ARC_NORW_AUTO:
+		dev->l2ad_norw = slow;
+		break;
+	default:
+		dev->l2ad_norw = B_TRUE;
+		break;
+	}
+}
+
 static clock_t
 l2arc_write_interval(clock_t began, uint64_t wanted, uint64_t wrote)
 {
@@ -4202,76 +5547,15 @@ l2arc_write_interval(clock_t began, uint64_t wanted, uint64_t wrote)
 static void
 l2arc_hdr_stat_add(void)
 {
-	ARCSTAT_INCR(arcstat_l2_hdr_size, HDR_SIZE);
-	ARCSTAT_INCR(arcstat_hdr_size, -HDR_SIZE);
+	ARCSTAT_INCR(arcstat_l2_hdr_size, HDR_L2ONLY_SIZE);
+	ARCSTAT_INCR(arcstat_hdr_size, -HDR_L2ONLY_SIZE);
 }
 
 static void
 l2arc_hdr_stat_remove(void)
 {
-	ARCSTAT_INCR(arcstat_l2_hdr_size, -HDR_SIZE);
-	ARCSTAT_INCR(arcstat_hdr_size, HDR_SIZE);
-}
-
-/*
- * Cycle through L2ARC devices.  This is how L2ARC load balances.
- * If a device is returned, this also returns holding the spa config lock.
- */
-static l2arc_dev_t *
-l2arc_dev_get_next(void)
-{
-	l2arc_dev_t *first, *next = NULL;
-
-	/*
-	 * Lock out the removal of spas (spa_namespace_lock), then removal
-	 * of cache devices (l2arc_dev_mtx).  Once a device has been selected,
-	 * both locks will be dropped and a spa config lock held instead.
-	 */
-	mutex_enter(&spa_namespace_lock);
-	mutex_enter(&l2arc_dev_mtx);
-
-	/* if there are no vdevs, there is nothing to do */
-	if (l2arc_ndev == 0)
-		goto out;
-
-	first = NULL;
-	next = l2arc_dev_last;
-	do {
-		/* loop around the list looking for a non-faulted vdev */
-		if (next == NULL) {
-			next = list_head(l2arc_dev_list);
-		} else {
-			next = list_next(l2arc_dev_list, next);
-			if (next == NULL)
-				next = list_head(l2arc_dev_list);
-		}
-
-		/* if we have come back to the start, bail out */
-		if (first == NULL)
-			first = next;
-		else if (next == first)
-			break;
-
-	} while (vdev_is_dead(next->l2ad_vdev));
-
-	/* if we were unable to find any usable vdevs, return NULL */
-	if (vdev_is_dead(next->l2ad_vdev))
-		next = NULL;
-
-	l2arc_dev_last = next;
-
-out:
-	mutex_exit(&l2arc_dev_mtx);
-
-	/*
-	 * Grab the config lock to prevent the 'next' device from being
-	 * removed while we are writing to it.
-	 */
-	if (next != NULL)
-		spa_config_enter(next->l2ad_spa, SCL_L2ARC, next, RW_READER);
-	mutex_exit(&spa_namespace_lock);
-
-	return (next);
+	ARCSTAT_INCR(arcstat_l2_hdr_size, -HDR_L2ONLY_SIZE);
+	ARCSTAT_INCR(arcstat_hdr_size, HDR_L2ONLY_SIZE);
 }
 
 /*
@@ -4298,6 +5582,20 @@ l2arc_do_free_on_write(void)
 	mutex_exit(&l2arc_free_on_write_mtx);
 }
 
+/*
+ * Release the ABD of a single buffer write to a cache device.  A private
+ * copy of uncompressed data is freed here; compressed data belongs to the
+ * header and is released by l2arc_write_done().
+ */
+static void
+l2arc_write_buf_done(zio_t *zio)
+{
+	if (zio->io_abd->abd_flags & ABD_FLAG_OWNER)
+		abd_free(zio->io_abd);
+	else
+		abd_put(zio->io_abd);
+}
+
 /*
  * A write to a cache device has completed.  Update all headers to allow
  * reads from these buffers to begin.
@@ -4345,13 +5643,12 @@ l2arc_write_done(zio_t *zio)
 			continue;
 		}
 
-		abl2 = ab->b_l2hdr;
+		abl2 = &ab->b_l2hdr;
 
 		/*
 		 * Release the temporary compressed buffer as soon as possible.
 		 */
-		if (abl2->b_compress != ZIO_COMPRESS_OFF)
-			l2arc_release_cdata_buf(ab);
+		l2arc_release_cdata_buf(ab);
 
 		if (zio->io_error != 0) {
 			/*
@@ -4359,9 +5656,7 @@ l2arc_write_done(zio_t *zio)
 			 */
 			list_remove(buflist, ab);
 			ARCSTAT_INCR(arcstat_l2_asize, -abl2->b_asize);
-			ab->b_l2hdr = NULL;
-			kmem_free(abl2, sizeof (l2arc_buf_hdr_t));
-			arc_space_return(L2HDR_SIZE, ARC_SPACE_L2HDRS);
+			ab->b_flags &= ~ARC_HAS_L2HDR;
 			ARCSTAT_INCR(arcstat_l2_size, -ab->b_size);
 		}
 
@@ -4375,7 +5670,8 @@ l2arc_write_done(zio_t *zio)
 
 	atomic_inc_64(&l2arc_writes_done);
 	list_remove(buflist, head);
-	kmem_cache_free(hdr_cache, head);
+	head->b_flags = 0;
+	kmem_cache_free(hdr_l2only_cache, head);
 	mutex_exit(&l2arc_buflist_mtx);
 
 	l2arc_do_free_on_write();
@@ -4416,7 +5712,6 @@ l2arc_read_done(zio_t *zio)
 	 */
 	if (cb->l2rcb_compress != ZIO_COMPRESS_OFF)
 		l2arc_decompress_zio(zio, hdr, cb->l2rcb_compress);
-	ASSERT(zio->io_data != NULL);
 
 	/*
 	 * Check this survived the L2ARC journey.
@@ -4439,21 +5734,41 @@ l2arc_read_done(zio_t *zio)
 		} else {
 			zio->io_error = EIO;
 		}
-		if (!equal)
+		if (!equal) {
 			ARCSTAT_BUMP(arcstat_l2_cksum_bad);
 
+			/*
+			 * A header restored from a log block carries the
+			 * checksum which was logged for it.  Let the read
+			 * from the primary storage recompute it rather
+			 * than trust a value the device cannot back up.
+			 */
+			mutex_enter(&hdr->b_l1hdr.b_freeze_lock);
+			if (hdr->b_freeze_cksum != NULL) {
+				kmem_free(hdr->b_freeze_cksum,
+				    sizeof (zio_cksum_t));
+				hdr->b_freeze_cksum = NULL;
+			}
+			mutex_exit(&hdr->b_l1hdr.b_freeze_lock);
+		}
+
 		/*
 		 * If there's no waiter, issue an async i/o to the primary
 		 * storage now.  If there *is* a waiter, the caller must
 		 * issue the i/o in a context where it's OK to block.
 		 */
+		if (zio->io_abd != NULL) {
+			abd_put(zio->io_abd);
+			zio->io_abd = zio->io_orig_abd = NULL;
+		}
 		if (zio->io_waiter == NULL) {
 			zio_t *pio = zio_unique_parent(zio);
 
 			ASSERT(!pio || pio->io_child_type == ZIO_CHILD_LOGICAL);
 
 			zio_nowait(zio_read(pio, cb->l2rcb_spa, &cb->l2rcb_bp,
-			    buf->b_data, zio->io_size, arc_read_done, buf,
+			    abd_get_from_buf(buf->b_data, zio->io_size),
+			    zio->io_size, arc_read_done, buf,
 			    zio->io_priority, cb->l2rcb_flags, &cb->l2rcb_zb));
 		}
 	}
@@ -4468,38 +5783,32 @@ l2arc_read_done(zio_t *zio)
  * performance.
  *
  * Currently the metadata lists are hit first, MFU then MRU, followed by
- * the data lists.  This function returns a locked list, and also returns
- * the lock pointer.
+ * the data lists.  This function returns the multilist; the caller is
+ * expected to walk and lock each of its sublists in turn.
  */
-static list_t *
-l2arc_list_locked(int list_num, kmutex_t **lock)
+static multilist_t *
+l2arc_list(int list_num)
 {
-	list_t *list = NULL;
+	multilist_t *ml = NULL;
 
 	ASSERT(list_num >= 0 && list_num <= 3);
 
 	switch (list_num) {
 	case 0:
-		list = &arc_mfu->arcs_list[ARC_BUFC_METADATA];
-		*lock = &arc_mfu->arcs_mtx;
+		ml = &arc_mfu->arcs_list[ARC_BUFC_METADATA];
 		break;
 	case 1:
-		list = &arc_mru->arcs_list[ARC_BUFC_METADATA];
-		*lock = &arc_mru->arcs_mtx;
+		ml = &arc_mru->arcs_list[ARC_BUFC_METADATA];
 		break;
 	case 2:
-		list = &arc_mfu->arcs_list[ARC_BUFC_DATA];
-		*lock = &arc_mfu->arcs_mtx;
+		ml = &arc_mfu->arcs_list[ARC_BUFC_DATA];
 		break;
 	case 3:
-		list = &arc_mru->arcs_list[ARC_BUFC_DATA];
-		*lock = &arc_mru->arcs_mtx;
+		ml = &arc_mru->arcs_list[ARC_BUFC_DATA];
 		break;
 	}
 
-	ASSERT(!(MUTEX_HELD(*lock)));
-	mutex_enter(*lock);
-	return (list);
+	return (ml);
 }
 
 /*
@@ -4569,9 +5878,9 @@ top:
 			continue;
 		}
 
-		if (!all && ab->b_l2hdr != NULL &&
-		    (ab->b_l2hdr->b_daddr > taddr ||
-		    ab->b_l2hdr->b_daddr < dev->l2ad_hand)) {
+		if (!all && HDR_HAS_L2HDR(ab) &&
+		    (ab->b_l2hdr.b_daddr > taddr ||
+		    ab->b_l2hdr.b_daddr < dev->l2ad_hand)) {
 			/*
 			 * We've evicted to the target address,
 			 * or the end of the device.
@@ -4611,12 +5920,10 @@ top:
 			/*
 			 * Tell ARC this no longer exists in L2ARC.
 			 */
-			if (ab->b_l2hdr != NULL) {
-				abl2 = ab->b_l2hdr;
+			if (HDR_HAS_L2HDR(ab)) {
+				abl2 = &ab->b_l2hdr;
 				ARCSTAT_INCR(arcstat_l2_asize, -abl2->b_asize);
-				ab->b_l2hdr = NULL;
-				kmem_free(abl2, sizeof (l2arc_buf_hdr_t));
-				arc_space_return(L2HDR_SIZE, ARC_SPACE_L2HDRS);
+				ab->b_flags &= ~ARC_HAS_L2HDR;
 				ARCSTAT_INCR(arcstat_l2_size, -ab->b_size);
 			}
 			list_remove(buflist, ab);
@@ -4651,16 +5958,17 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
     boolean_t *headroom_boost)
 {
 	arc_buf_hdr_t *ab, *ab_prev, *head;
-	list_t *list;
+	multilist_sublist_t *mls;
 	uint64_t write_asize, write_psize, write_sz, headroom,
 	    buf_compress_minsz;
 	void *buf_data;
-	kmutex_t *list_lock = NULL;
 	boolean_t full;
 	l2arc_write_callback_t *cb;
 	zio_t *pio, *wzio;
 	uint64_t guid = spa_load_guid(spa);
+	unsigned int num_sublists, start;
 	int try;
+	hrtime_t begin;
 	const boolean_t do_headroom_boost = *headroom_boost;
 
 	ASSERT(dev->l2ad_vdev != NULL);
@@ -4671,7 +5979,7 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 	pio = NULL;
 	write_sz = write_asize = write_psize = 0;
 	full = B_FALSE;
-	head = kmem_cache_alloc(hdr_cache, KM_PUSHPAGE);
+	head = kmem_cache_alloc(hdr_l2only_cache, KM_PUSHPAGE);
 	head->b_flags |= ARC_L2_WRITE_HEAD;
 
 	/*
@@ -4683,11 +5991,25 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 	/*
 	 * Copy buffers for L2ARC writing.
 	 */
+	headroom = target_sz * l2arc_headroom;
+	if (do_headroom_boost)
+		headroom = (headroom * l2arc_headroom_boost) / 100;
+	num_sublists = zfs_arc_num_sublists_per_state;
+	headroom = MAX(headroom / num_sublists, SPA_MAXBLOCKSIZE);
+	start = spa_get_random(num_sublists);
+
 	mutex_enter(&l2arc_buflist_mtx);
-	for (try = 0; try <= 3; try++) {
+	for (try = 0; try < 4 * num_sublists; try++) {
 		uint64_t passed_sz = 0;
 
-		list = l2arc_list_locked(try, &list_lock);
+		/*
+		 * Each of the four lists is made up of a number of
+		 * sublists which are scanned in turn, starting from a
+		 * random one.  The headroom is shared between them since
+		 * each holds a roughly equal slice of its state.
+		 */
+		mls = multilist_sublist_lock(l2arc_list(try / num_sublists),
+		    (start + try) % num_sublists);
 
 		/*
 		 * L2ARC fast warmup.
@@ -4696,13 +6018,9 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 		 * head of the ARC lists rather than the tail.
 		 */
 		if (arc_warm == B_FALSE)
-			ab = list_head(list);
+			ab = multilist_sublist_head(mls);
 		else
-			ab = list_tail(list);
-
-		headroom = target_sz * l2arc_headroom;
-		if (do_headroom_boost)
-			headroom = (headroom * l2arc_headroom_boost) / 100;
+			ab = multilist_sublist_tail(mls);
 
 		for (; ab; ab = ab_prev) {
 			l2arc_buf_hdr_t *l2hdr;
@@ -4710,9 +6028,9 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 			uint64_t buf_sz;
 
 			if (arc_warm == B_FALSE)
-				ab_prev = list_next(list, ab);
+				ab_prev = multilist_sublist_next(mls, ab);
 			else
-				ab_prev = list_prev(list, ab);
+				ab_prev = multilist_sublist_prev(mls, ab);
 
 			hash_lock = HDR_LOCK(ab);
 			if (!mutex_tryenter(hash_lock)) {
@@ -4759,45 +6077,66 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 			}
 
 			/*
-			 * Create and add a new L2ARC header.
+			 * Fill in the header's L2ARC part.
 			 */
-			l2hdr = kmem_zalloc(sizeof (l2arc_buf_hdr_t),
-			    KM_PUSHPAGE);
+			l2hdr = &ab->b_l2hdr;
 			l2hdr->b_dev = dev;
-			arc_space_consume(L2HDR_SIZE, ARC_SPACE_L2HDRS);
+			l2hdr->b_daddr = 0;
 
 			ab->b_flags |= ARC_L2_WRITING;
 
 			/*
 			 * Temporarily stash the data buffer in b_tmp_cdata.
 			 * The subsequent write step will pick it up from
-			 * there. This is because can't access ab->b_buf
+			 * there. This is because can't access ab->b_l1hdr.b_buf
 			 * without holding the hash_lock, which we in turn
 			 * can't access without holding the ARC list locks
 			 * (which we want to avoid during compression/writing)
+			 *
+			 * A block cached in its compressed form is written
+			 * out as is.  The compressed copy may be freed as
+			 * soon as the hash_lock is dropped, so take a
+			 * private copy of it which is released like any
+			 * other L2ARC compression buffer.
 			 */
-			l2hdr->b_compress = ZIO_COMPRESS_OFF;
-			l2hdr->b_asize = ab->b_size;
-			l2hdr->b_tmp_cdata = ab->b_buf->b_data;
+			if (ab->b_l1hdr.b_pdata != NULL) {
+				l2hdr->b_compress = ab->b_l1hdr.b_compress;
+				l2hdr->b_asize = ab->b_l1hdr.b_psize;
+				ab->b_l1hdr.b_tmp_cdata =
+				    zio_data_buf_alloc(ab->b_size);
+				abd_copy_to_buf(ab->b_l1hdr.b_tmp_cdata,
+				    ab->b_l1hdr.b_pdata,
+				    ab->b_l1hdr.b_psize);
+			} else {
+				l2hdr->b_compress = ZIO_COMPRESS_OFF;
+				l2hdr->b_asize = ab->b_size;
+				ab->b_l1hdr.b_tmp_cdata =
+				    ab->b_l1hdr.b_buf->b_data;
+			}
 
 			buf_sz = ab->b_size;
-			ab->b_l2hdr = l2hdr;
+			ab->b_flags |= ARC_HAS_L2HDR;
 
 			list_insert_head(dev->l2ad_buflist, ab);
 
 			/*
 			 * Compute and store the buffer cksum before
 			 * writing.  On debug the cksum is verified first.
+			 * The cksum of a compressed-only block was taken
+			 * when it was read.
 			 */
-			arc_cksum_verify(ab->b_buf);
-			arc_cksum_compute(ab->b_buf, B_TRUE);
+			if (ab->b_l1hdr.b_buf != NULL) {
+				arc_cksum_verify(ab->b_l1hdr.b_buf);
+				arc_cksum_compute(ab->b_l1hdr.b_buf, B_TRUE);
+			}
+			ASSERT(ab->b_freeze_cksum != NULL);
 
 			mutex_exit(hash_lock);
 
 			write_sz += buf_sz;
 		}
 
-		mutex_exit(list_lock);
+		multilist_sublist_unlock(mls);
 
 		if (full == B_TRUE)
 			break;
@@ -4807,7 +6146,9 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 	if (pio == NULL) {
 		ASSERT0(write_sz);
 		mutex_exit(&l2arc_buflist_mtx);
-		kmem_cache_free(hdr_cache, head);
+		dev->l2ad_write_lat = 0;
+		head->b_flags = 0;
+		kmem_cache_free(hdr_l2only_cache, head);
 		return (0);
 	}
 
@@ -4825,14 +6166,15 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 		 * We shouldn't need to lock the buffer here, since we flagged
 		 * it as ARC_L2_WRITING in the previous step, but we must take
 		 * care to only access its L2 cache parameters. In particular,
-		 * ab->b_buf may be invalid by now due to ARC eviction.
+		 * ab->b_l1hdr.b_buf may be invalid by now due to ARC eviction.
 		 */
-		l2hdr = ab->b_l2hdr;
+		l2hdr = &ab->b_l2hdr;
 		l2hdr->b_daddr = dev->l2ad_hand;
 
 		if (!l2arc_nocompress && (ab->b_flags & ARC_L2COMPRESS) &&
+		    l2hdr->b_compress == ZIO_COMPRESS_OFF &&
 		    l2hdr->b_asize >= buf_compress_minsz) {
-			if (l2arc_compress_buf(l2hdr)) {
+			if (l2arc_compress_buf(ab)) {
 				/*
 				 * If compression succeeded, enable headroom
 				 * boost on the next scan cycle.
@@ -4845,17 +6187,33 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 		 * Pick up the buffer data we had previously stashed away
 		 * (and now potentially also compressed).
 		 */
-		buf_data = l2hdr->b_tmp_cdata;
+		buf_data = ab->b_l1hdr.b_tmp_cdata;
 		buf_sz = l2hdr->b_asize;
 
 		/* Compression may have squashed the buffer to zero length. */
 		if (buf_sz != 0) {
 			uint64_t buf_p_sz;
+			abd_t *abd;
+
+			/*
+			 * Uncompressed data is still the ARC buffer itself,
+			 * which its consumer may release and modify as soon
+			 * as l2arc_buflist_mtx is dropped, while this write
+			 * (possibly aggregated with its neighbours) is in
+			 * flight.  Write it from a private copy instead.
+			 */
+			if (l2hdr->b_compress == ZIO_COMPRESS_OFF) {
+				abd = abd_alloc_for_io(buf_sz,
+				    ab->b_type == ARC_BUFC_METADATA);
+				abd_copy_from_buf(abd, buf_data, buf_sz);
+			} else {
+				abd = abd_get_from_buf(buf_data, buf_sz);
+			}
 
 			wzio = zio_write_phys(pio, dev->l2ad_vdev,
-			    dev->l2ad_hand, buf_sz, buf_data, ZIO_CHECKSUM_OFF,
-			    NULL, NULL, ZIO_PRIORITY_ASYNC_WRITE,
-			    ZIO_FLAG_CANFAIL, B_FALSE);
+			    dev->l2ad_hand, buf_sz, abd, ZIO_CHECKSUM_OFF,
+			    l2arc_write_buf_done, NULL,
+			    ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL, B_FALSE);
 
 			DTRACE_PROBE2(l2arc__write, vdev_t *, dev->l2ad_vdev,
 			    zio_t *, wzio);
@@ -4869,8 +6227,18 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 			write_psize += buf_p_sz;
 			dev->l2ad_hand += buf_p_sz;
 		}
+
+		/*
+		 * Record the buffer in the log so that it can be found
+		 * again after the pool is exported or the system reboots.
+		 */
+		l2arc_log_blk_append(dev, ab, pio);
 	}
 
+	/* Write out the log block describing the rest of this pass. */
+	if (dev->l2ad_log_blk->lb_nents > 0)
+		l2arc_log_blk_commit(dev, pio);
+
 	mutex_exit(&l2arc_buflist_mtx);
 
 	ASSERT3U(write_asize, <=, target_sz);
@@ -4884,25 +6252,36 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
 	 * Bump device hand to the device start if it is approaching the end.
 	 * l2arc_evict() will already have evicted ahead for this case.
 	 */
-	if (dev->l2ad_hand >= (dev->l2ad_end - target_sz)) {
+	if (dev->l2ad_hand >= (dev->l2ad_end - target_sz -
+	    l2arc_log_blk_overhead(dev, target_sz))) {
 		vdev_space_update(dev->l2ad_vdev,
 		    dev->l2ad_end - dev->l2ad_hand, 0, 0);
 		dev->l2ad_hand = dev->l2ad_start;
 		dev->l2ad_evict = dev->l2ad_start;
 		dev->l2ad_first = B_FALSE;
+		dev->l2ad_log_dirty = B_TRUE;
 	}
 
 	dev->l2ad_writing = B_TRUE;
+	begin = gethrtime();
 	(void) zio_wait(pio);
+	dev->l2ad_write_lat = gethrtime() - begin;
 	dev->l2ad_writing = B_FALSE;
 
+	/*
+	 * Only point the device header at the new log blocks once they
+	 * (and the buffers they describe) have been written.
+	 */
+	if (dev->l2ad_log_dirty)
+		l2arc_dev_hdr_update(dev);
+
 	return (write_asize);
 }
 
 /*
  * Compresses an L2ARC buffer.
- * The data to be compressed must be prefilled in l2hdr->b_tmp_cdata and its
- * size in l2hdr->b_asize. This routine tries to compress the data and
+ * The data to be compressed must be prefilled in b_l1hdr.b_tmp_cdata and its
+ * size in b_l2hdr.b_asize. This routine tries to compress the data and
  * depending on the compression result there are three possible outcomes:
  * *) The buffer was incompressible. The original l2hdr contents were left
  *    untouched and are ready for writing to an L2 device.
@@ -4913,31 +6292,34 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz,
  *    data buffer which holds the compressed data to be written, and b_asize
  *    tells us how much data there is. b_compress is set to the appropriate
  *    compression algorithm. Once writing is done, invoke
- *    l2arc_release_cdata_buf on this l2hdr to free this temporary buffer.
+ *    l2arc_release_cdata_buf on this hdr to free this temporary buffer.
  *
  * Returns B_TRUE if compression succeeded, or B_FALSE if it didn't (the
  * buffer was incompressible).
  */
 static boolean_t
-l2arc_compress_buf(l2arc_buf_hdr_t *l2hdr)
+l2arc_compress_buf(arc_buf_hdr_t *ab)
 {
+	l2arc_buf_hdr_t *l2hdr = &ab->b_l2hdr;
+	abd_t *abd;
 	void *cdata;
 	size_t csize, len;
 
 	ASSERT(l2hdr->b_compress == ZIO_COMPRESS_OFF);
-	ASSERT(l2hdr->b_tmp_cdata != NULL);
+	ASSERT(ab->b_l1hdr.b_tmp_cdata != NULL);
 
 	len = l2hdr->b_asize;
 	cdata = zio_data_buf_alloc(len);
-	csize = zio_compress_data(ZIO_COMPRESS_LZ4, l2hdr->b_tmp_cdata,
-	    cdata, l2hdr->b_asize);
+	abd = abd_get_from_buf(ab->b_l1hdr.b_tmp_cdata, len);
+	csize = zio_compress_data(ZIO_COMPRESS_LZ4, abd, cdata, len);
+	abd_put(abd);
 
 	if (csize == 0) {
 		/* zero block, indicate that there's nothing to write */
 		zio_data_buf_free(cdata, len);
 		l2hdr->b_compress = ZIO_COMPRESS_EMPTY;
 		l2hdr->b_asize = 0;
-		l2hdr->b_tmp_cdata = NULL;
+		ab->b_l1hdr.b_tmp_cdata = NULL;
 		ARCSTAT_BUMP(arcstat_l2_compress_zeros);
 		return (B_TRUE);
 	} else if (csize > 0 && csize < len) {
@@ -4947,7 +6329,7 @@ l2arc_compress_buf(l2arc_buf_hdr_t *l2hdr)
 		 */
 		l2hdr->b_compress = ZIO_COMPRESS_LZ4;
 		l2hdr->b_asize = csize;
-		l2hdr->b_tmp_cdata = cdata;
+		ab->b_l1hdr.b_tmp_cdata = cdata;
 		ARCSTAT_BUMP(arcstat_l2_compress_successes);
 		return (B_TRUE);
 	} else {
@@ -4963,7 +6345,7 @@ l2arc_compress_buf(l2arc_buf_hdr_t *l2hdr)
 
 /*
  * Decompresses a zio read back from an l2arc device. On success, the
- * underlying zio's io_data buffer is overwritten by the uncompressed
+ * underlying zio's io_abd buffer is overwritten by the uncompressed
  * version. On decompression error (corrupt compressed stream), the
  * zio->io_error value is set to signal an I/O error.
  *
@@ -4992,14 +6374,13 @@ l2arc_decompress_zio(zio_t *zio, arc_buf_hdr_t *hdr, enum zio_compress c)
 	if (c == ZIO_COMPRESS_EMPTY) {
 		/*
 		 * An empty buffer results in a null zio, which means we
-		 * need to fill its io_data after we're done restoring the
+		 * need to fill its io_abd after we're done restoring the
 		 * buffer's contents.
 		 */
-		ASSERT(hdr->b_buf != NULL);
-		bzero(hdr->b_buf->b_data, hdr->b_size);
-		zio->io_data = zio->io_orig_data = hdr->b_buf->b_data;
+		ASSERT(hdr->b_l1hdr.b_buf != NULL);
+		bzero(hdr->b_l1hdr.b_buf->b_data, hdr->b_size);
 	} else {
-		ASSERT(zio->io_data != NULL);
+		ASSERT(zio->io_abd != NULL);
 		/*
 		 * We copy the compressed data from the start of the arc buffer
 		 * (the zio_read will have pulled in only what we need, the
@@ -5012,9 +6393,9 @@ l2arc_decompress_zio(zio_t *zio, arc_buf_hdr_t *hdr, enum zio_compress c)
 		 */
 		csize = zio->io_size;
 		cdata = zio_data_buf_alloc(csize);
-		bcopy(zio->io_data, cdata, csize);
-		if (zio_decompress_data(c, cdata, zio->io_data, csize,
-		    hdr->b_size) != 0)
+		abd_copy_to_buf(cdata, zio->io_abd, csize);
+		if (zio_decompress_data_buf(c, cdata, abd_to_buf(zio->io_abd),
+		    csize, hdr->b_size) != 0)
 			zio->io_error = EIO;
 		zio_data_buf_free(cdata, csize);
 	}
@@ -5032,70 +6413,514 @@ l2arc_decompress_zio(zio_t *zio, arc_buf_hdr_t *hdr, enum zio_compress c)
 static void
 l2arc_release_cdata_buf(arc_buf_hdr_t *ab)
 {
-	l2arc_buf_hdr_t *l2hdr = ab->b_l2hdr;
+	l2arc_buf_hdr_t *l2hdr = &ab->b_l2hdr;
 
-	if (l2hdr->b_compress == ZIO_COMPRESS_LZ4) {
+	if (l2hdr->b_compress != ZIO_COMPRESS_OFF &&
+	    l2hdr->b_compress != ZIO_COMPRESS_EMPTY) {
 		/*
 		 * If the data was compressed, then we've allocated a
 		 * temporary buffer for it, so now we need to release it.
 		 */
-		ASSERT(l2hdr->b_tmp_cdata != NULL);
-		zio_data_buf_free(l2hdr->b_tmp_cdata, ab->b_size);
+		ASSERT(ab->b_l1hdr.b_tmp_cdata != NULL);
+		zio_data_buf_free(ab->b_l1hdr.b_tmp_cdata, ab->b_size);
+	}
+	ab->b_l1hdr.b_tmp_cdata = NULL;
+}
+
+/*
+ * Returns the most space the log blocks describing a write of write_sz
+ * bytes can take up on the device.  Each buffer is at least
+ * SPA_MINBLOCKSIZE bytes, so this bounds the number of log entries.
+ */
+static uint64_t
+l2arc_log_blk_overhead(l2arc_dev_t *dev, uint64_t write_sz)
+{
+	uint64_t nents, nblks;
+
+	nents = (write_sz + SPA_MINBLOCKSIZE - 1) >> SPA_MINBLOCKSHIFT;
+	nblks = (nents + L2ARC_LOG_BLK_ENTRIES - 1) / L2ARC_LOG_BLK_ENTRIES;
+
+	return (nblks * vdev_psize_to_asize(dev->l2ad_vdev,
+	    L2ARC_LOG_BLK_SIZE));
+}
+
+static void
+l2arc_log_blk_write_done(zio_t *zio)
+{
+	abd_free(zio->io_abd);
+}
+
+/*
+ * Adds a buffer which is being written to the device to the log block
+ * currently being assembled, committing the log block once it is full.
+ * Buffers whose checksum has already been thawed away cannot be verified
+ * when read back, and buffers from a txg that has not synced may not
+ * survive a crash, so those are left out.
+ */
+static void
+l2arc_log_blk_append(l2arc_dev_t *dev, arc_buf_hdr_t *ab, zio_t *pio)
+{
+	l2arc_log_blk_phys_t *lb = dev->l2ad_log_blk;
+	l2arc_buf_hdr_t *l2hdr = &ab->b_l2hdr;
+	l2arc_log_ent_phys_t *le;
+
+	ASSERT(MUTEX_HELD(&l2arc_buflist_mtx));
+	ASSERT3U(lb->lb_nents, <, L2ARC_LOG_BLK_ENTRIES);
+
+	le = &lb->lb_entries[lb->lb_nents];
+
+	/*
+	 * Blocks born in a txg which has not yet synced may be rewritten
+	 * with different contents under the same identity if that txg is
+	 * lost, so only blocks which are already on stable storage are
+	 * logged.
+	 */
+	if (ab->b_birth > spa_last_synced_txg(dev->l2ad_spa))
+		return;
+
+	mutex_enter(&ab->b_l1hdr.b_freeze_lock);
+	if (ab->b_freeze_cksum == NULL) {
+		mutex_exit(&ab->b_l1hdr.b_freeze_lock);
+		return;
+	}
+	le->le_freeze_cksum = *ab->b_freeze_cksum;
+	mutex_exit(&ab->b_l1hdr.b_freeze_lock);
+
+	le->le_dva = ab->b_dva;
+	le->le_birth = ab->b_birth;
+	le->le_daddr = l2hdr->b_daddr;
+	le->le_prop = 0;
+	L2ARC_LE_SET_LSIZE(le, ab->b_size);
+	L2ARC_LE_SET_ASIZE(le, l2hdr->b_asize);
+	L2ARC_LE_SET_COMPRESS(le, l2hdr->b_compress);
+	L2ARC_LE_SET_TYPE(le, ab->b_type);
+	L2ARC_LE_SET_L2COMPRESS(le, (ab->b_flags & ARC_L2COMPRESS) != 0);
+
+	if (++lb->lb_nents == L2ARC_LOG_BLK_ENTRIES)
+		l2arc_log_blk_commit(dev, pio);
+}
+
+/*
+ * Writes the log block being assembled out at the device hand, linking
+ * it to the previously written one, and starts a new, empty one.
+ */
+static void
+l2arc_log_blk_commit(l2arc_dev_t *dev, zio_t *pio)
+{
+	l2arc_log_blk_phys_t *lb = dev->l2ad_log_blk;
+	uint64_t psize, asize;
+	abd_t *abd;
+	void *data;
+
+	ASSERT(lb->lb_nents > 0);
+
+	lb->lb_magic = L2ARC_LOG_BLK_MAGIC;
+	lb->lb_prev = dev->l2ad_log_last;
+
+	psize = L2ARC_LOG_BLK_PSIZE(lb->lb_nents);
+	asize = vdev_psize_to_asize(dev->l2ad_vdev, psize);
+	ASSERT3U(dev->l2ad_hand + asize, <=, dev->l2ad_end);
+
+	abd = abd_alloc_linear(asize, B_TRUE);
+	data = abd_to_buf(abd);
+	bcopy(lb, data, psize);
+	bzero((char *)data + psize, asize - psize);
+
+	dev->l2ad_log_last.lbp_daddr = dev->l2ad_hand;
+	dev->l2ad_log_last.lbp_asize = asize;
+	fletcher_4_native(data, asize, &dev->l2ad_log_last.lbp_cksum);
+
+	(void) zio_nowait(zio_write_phys(pio, dev->l2ad_vdev, dev->l2ad_hand,
+	    asize, abd, ZIO_CHECKSUM_OFF, l2arc_log_blk_write_done, NULL,
+	    ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL, B_FALSE));
+
+	dev->l2ad_hand += asize;
+	vdev_space_update(dev->l2ad_vdev, asize, 0, 0);
+	dev->l2ad_log_dirty = B_TRUE;
+	ARCSTAT_BUMP(arcstat_l2_log_blk_writes);
+
+	bzero(lb, psize);
+}
+
+/*
+ * Writes the device header, which records where the most recent log
+ * block is and where the device hand was at the time.
+ */
+static void
+l2arc_dev_hdr_update(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *dh;
+	uint64_t asize = dev->l2ad_dev_hdr_asize;
+	abd_t *abd;
+	int err;
+
+	dh = zio_buf_alloc(asize);
+	bzero(dh, asize);
+
+	dh->dh_magic = L2ARC_DEV_HDR_MAGIC;
+	dh->dh_version = L2ARC_PERSIST_VERSION;
+	dh->dh_spa_guid = spa_guid(dev->l2ad_spa);
+	dh->dh_vdev_guid = dev->l2ad_vdev->vdev_guid;
+	dh->dh_flags = dev->l2ad_first ? L2ARC_DEV_HDR_FIRST : 0;
+	dh->dh_start = dev->l2ad_start;
+	dh->dh_end = dev->l2ad_end;
+	dh->dh_hand = dev->l2ad_hand;
+	dh->dh_evict = dev->l2ad_evict;
+	dh->dh_last_lbp = dev->l2ad_log_last;
+
+	abd = abd_get_from_buf(dh, asize);
+	err = zio_wait(zio_write_phys(NULL, dev->l2ad_vdev,
+	    VDEV_LABEL_START_SIZE, asize, abd, ZIO_CHECKSUM_LABEL, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL, B_FALSE));
+	abd_put(abd);
+
+	zio_buf_free(dh, asize);
+
+	/* On error leave it dirty, the next write pass will try again. */
+	if (err == 0)
+		dev->l2ad_log_dirty = B_FALSE;
+}
+
+/*
+ * Takes the config lock on behalf of the rebuild thread.  Cache devices
+ * are removed with the config lock held as writer, so rather than
+ * blocking on it we poll, giving up once the device is being removed.
+ */
+static boolean_t
+l2arc_rebuild_enter(l2arc_dev_t *dev)
+{
+	boolean_t cancel;
+
+	for (;;) {
+		mutex_enter(&l2arc_dev_mtx);
+		cancel = dev->l2ad_rebuild_cancel;
+		mutex_exit(&l2arc_dev_mtx);
+
+		if (cancel)
+			return (B_FALSE);
+
+		if (spa_config_tryenter(dev->l2ad_spa, SCL_L2ARC, dev,
+		    RW_READER))
+			return (B_TRUE);
+
+		delay(1);
+	}
+}
+
+/*
+ * Recreates the L2ARC header of a buffer recorded in a log block, in the
+ * ARC_l2c_only state.  Buffers which have been cached again in the
+ * meantime are left alone.
+ */
+static void
+l2arc_hdr_restore(const l2arc_log_ent_phys_t *le, l2arc_dev_t *dev,
+    uint64_t guid)
+{
+	arc_buf_hdr_t *hdr, *exists;
+	l2arc_buf_hdr_t *l2hdr;
+	kmutex_t *hash_lock;
+
+	hdr = kmem_cache_alloc(hdr_l2only_cache, KM_PUSHPAGE);
+	ASSERT(BUF_EMPTY(hdr));
+	hdr->b_dva = le->le_dva;
+	hdr->b_birth = le->le_birth;
+	hdr->b_spa = guid;
+	hdr->b_size = L2ARC_LE_LSIZE(le);
+	hdr->b_type = L2ARC_LE_TYPE(le);
+	hdr->b_state = arc_anon;
+	hdr->b_flags = ARC_L2CACHE;
+	if (L2ARC_LE_L2COMPRESS(le))
+		hdr->b_flags |= ARC_L2COMPRESS;
+
+	exists = buf_hash_insert(hdr, &hash_lock);
+	if (exists != NULL) {
+		mutex_exit(hash_lock);
+		buf_discard_identity(hdr);
+		hdr->b_flags = 0;
+		kmem_cache_free(hdr_l2only_cache, hdr);
+		ARCSTAT_BUMP(arcstat_l2_rebuild_bufs_precached);
+		return;
+	}
+
+	hdr->b_freeze_cksum = kmem_alloc(sizeof (zio_cksum_t), KM_PUSHPAGE);
+	*hdr->b_freeze_cksum = le->le_freeze_cksum;
+
+	l2hdr = &hdr->b_l2hdr;
+	l2hdr->b_dev = dev;
+	l2hdr->b_daddr = le->le_daddr;
+	l2hdr->b_compress = L2ARC_LE_COMPRESS(le);
+	l2hdr->b_asize = L2ARC_LE_ASIZE(le);
+	hdr->b_flags |= ARC_HAS_L2HDR;
+
+	arc_change_state(arc_l2c_only, hdr, hash_lock);
+
+	/*
+	 * The log is walked from the newest buffer to the oldest, so
+	 * adding to the tail keeps the buflist in write order.
+	 */
+	mutex_enter(&l2arc_buflist_mtx);
+	list_insert_tail(dev->l2ad_buflist, hdr);
+	mutex_exit(&l2arc_buflist_mtx);
+
+	ARCSTAT_INCR(arcstat_l2_size, hdr->b_size);
+	ARCSTAT_INCR(arcstat_l2_asize, l2hdr->b_asize);
+	ARCSTAT_BUMP(arcstat_l2_rebuild_bufs);
+	ARCSTAT_INCR(arcstat_l2_rebuild_size, hdr->b_size);
+
+	mutex_exit(hash_lock);
+}
+
+/*
+ * Checks that a log entry describes something we are able to cache, in
+ * a part of the device which has not been overwritten since: either
+ * below the hand in the current sweep, or past the point eviction had
+ * reached in the previous one.
+ */
+static boolean_t
+l2arc_log_ent_valid(const l2arc_log_ent_phys_t *le, l2arc_dev_t *dev,
+    uint64_t evict)
+{
+	uint64_t daddr = le->le_daddr;
+	uint64_t asize = L2ARC_LE_ASIZE(le);
+
+	if (L2ARC_LE_TYPE(le) >= ARC_BUFC_NUMTYPES ||
+	    L2ARC_LE_COMPRESS(le) >= ZIO_COMPRESS_FUNCTIONS ||
+	    L2ARC_LE_LSIZE(le) > SPA_MAXBLOCKSIZE ||
+	    asize > L2ARC_LE_LSIZE(le))
+		return (B_FALSE);
+
+	if (daddr >= dev->l2ad_start && daddr + asize <= dev->l2ad_hand)
+		return (B_TRUE);
+
+	return (!dev->l2ad_first && daddr >= evict &&
+	    daddr + asize <= dev->l2ad_end);
+}
+
+/*
+ * Restores the contents of a cache device from its log blocks.  Returns
+ * zero if the whole usable part of the log was restored.
+ */
+static int
+l2arc_dev_rebuild(l2arc_dev_t *dev)
+{
+	vdev_t *vd = dev->l2ad_vdev;
+	spa_t *spa = dev->l2ad_spa;
+	uint64_t guid = spa_load_guid(spa);
+	uint64_t asize = dev->l2ad_dev_hdr_asize;
+	int flags = ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_CACHE |
+	    ZIO_FLAG_DONT_RETRY | ZIO_FLAG_SPECULATIVE;
+	l2arc_dev_hdr_phys_t *dh;
+	l2arc_log_blk_phys_t *lb;
+	l2arc_log_blkptr_t lbp;
+	abd_t *abd;
+	zio_cksum_t cksum;
+	uint64_t prev_daddr, evict;
+	boolean_t wrapped = B_FALSE;
+	int err, i;
+
+	if (!l2arc_rebuild_enter(dev))
+		return (EINTR);
+
+	dh = zio_buf_alloc(asize);
+	abd = abd_get_from_buf(dh, asize);
+	err = zio_wait(zio_read_phys(NULL, vd, VDEV_LABEL_START_SIZE, asize,
+	    abd, ZIO_CHECKSUM_LABEL, NULL, NULL, ZIO_PRIORITY_SYNC_READ, flags,
+	    B_FALSE));
+	abd_put(abd);
+	spa_config_exit(spa, SCL_L2ARC, dev);
+
+	if (err != 0 && err != ECKSUM) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_io_errors);
+		zio_buf_free(dh, asize);
+		return (err);
+	}
+
+	/*
+	 * A device which has never been written to, or was last used by
+	 * something else, has no usable header.
+	 */
+	if (err != 0 || dh->dh_magic != L2ARC_DEV_HDR_MAGIC ||
+	    dh->dh_version != L2ARC_PERSIST_VERSION ||
+	    dh->dh_spa_guid != spa_guid(spa) ||
+	    dh->dh_vdev_guid != vd->vdev_guid ||
+	    dh->dh_start != dev->l2ad_start || dh->dh_end != dev->l2ad_end ||
+	    dh->dh_hand < dh->dh_start || dh->dh_evict < dh->dh_hand ||
+	    dh->dh_evict > dh->dh_end) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_unsupported);
+		zio_buf_free(dh, asize);
+		return (ENOTSUP);
+	}
+
+	/*
+	 * Carry on writing where we left off, rather than from the start
+	 * of the device over the buffers we are about to restore, and
+	 * extend the existing chain of log blocks.
+	 */
+	dev->l2ad_hand = dh->dh_hand;
+	dev->l2ad_evict = dh->dh_hand;
+	dev->l2ad_first = (dh->dh_flags & L2ARC_DEV_HDR_FIRST) != 0;
+	dev->l2ad_log_last = dh->dh_last_lbp;
+	vdev_space_update(vd, (dev->l2ad_first ? dev->l2ad_hand :
+	    dev->l2ad_end) - dev->l2ad_start, 0, 0);
+
+	evict = dh->dh_evict;
+	lbp = dh->dh_last_lbp;
+	zio_buf_free(dh, asize);
+
+	prev_daddr = dev->l2ad_hand;
+	while (lbp.lbp_daddr != 0) {
+		if (lbp.lbp_daddr < dev->l2ad_start ||
+		    lbp.lbp_daddr + lbp.lbp_asize > dev->l2ad_end ||
+		    lbp.lbp_asize < L2ARC_LOG_BLK_PSIZE(1) ||
+		    lbp.lbp_asize > SPA_MAXBLOCKSIZE ||
+		    P2PHASE(lbp.lbp_asize, SPA_MINBLOCKSIZE) != 0)
+			break;
+
+		/*
+		 * Going back in time the log blocks are found further and
+		 * further down the device, until we get to where the hand
+		 * last wrapped around.  Of the previous sweep only the part
+		 * beyond the point eviction had reached is still intact.
+		 */
+		if (lbp.lbp_daddr + lbp.lbp_asize > prev_daddr) {
+			if (wrapped || dev->l2ad_first)
+				break;
+			wrapped = B_TRUE;
+		}
+		if (wrapped && lbp.lbp_daddr < evict)
+			break;
+
+		/* Don't push the ARC out of memory for the sake of this. */
+		if (arc_no_grow) {
+			ARCSTAT_BUMP(arcstat_l2_rebuild_lowmem);
+			break;
+		}
+
+		if (!l2arc_rebuild_enter(dev))
+			return (EINTR);
+
+		lb = zio_buf_alloc(lbp.lbp_asize);
+		abd = abd_get_from_buf(lb, lbp.lbp_asize);
+		err = zio_wait(zio_read_phys(NULL, vd, lbp.lbp_daddr,
+		    lbp.lbp_asize, abd, ZIO_CHECKSUM_OFF, NULL, NULL,
+		    ZIO_PRIORITY_ASYNC_READ, flags, B_FALSE));
+		abd_put(abd);
+
+		if (err == 0) {
+			fletcher_4_native(lb, lbp.lbp_asize, &cksum);
+			if (!ZIO_CHECKSUM_EQUAL(cksum, lbp.lbp_cksum) ||
+			    lb->lb_magic != L2ARC_LOG_BLK_MAGIC ||
+			    lb->lb_nents == 0 ||
+			    lb->lb_nents > L2ARC_LOG_BLK_ENTRIES ||
+			    L2ARC_LOG_BLK_PSIZE(lb->lb_nents) > lbp.lbp_asize)
+				err = ECKSUM;
+		}
+
+		if (err == 0) {
+			for (i = lb->lb_nents - 1; i >= 0; i--) {
+				if (l2arc_log_ent_valid(&lb->lb_entries[i],
+				    dev, evict))
+					l2arc_hdr_restore(&lb->lb_entries[i],
+					    dev, guid);
+			}
+		}
+		spa_config_exit(spa, SCL_L2ARC, dev);
+
+		if (err != 0) {
+			if (err == ECKSUM) {
+				ARCSTAT_BUMP(arcstat_l2_rebuild_cksum_errors);
+			} else {
+				ARCSTAT_BUMP(arcstat_l2_rebuild_io_errors);
+			}
+			zio_buf_free(lb, lbp.lbp_asize);
+			return (err);
+		}
+
+		ARCSTAT_BUMP(arcstat_l2_rebuild_log_blks);
+		prev_daddr = lbp.lbp_daddr;
+		asize = lbp.lbp_asize;
+		lbp = lb->lb_prev;
+		zio_buf_free(lb, asize);
 	}
-	l2hdr->b_tmp_cdata = NULL;
+
+	return (0);
+}
+
+/*
+ * Rebuilds a newly added cache device in the background, so that pool
+ * import is not held up by it.  The feed thread leaves the device alone
+ * until this is done.
+ */
+static void
+l2arc_dev_rebuild_thread(l2arc_dev_t *dev)
+{
+	if (l2arc_dev_rebuild(dev) == 0)
+		ARCSTAT_BUMP(arcstat_l2_rebuild_successes);
+
+	mutex_enter(&l2arc_dev_mtx);
+	dev->l2ad_rebuild = B_FALSE;
+	cv_broadcast(&l2arc_rebuild_cv);
+	mutex_exit(&l2arc_dev_mtx);
+
+	thread_exit();
 }
 
 /*
  * This thread feeds the L2ARC at regular intervals.  This is the beating
- * heart of the L2ARC.
+ * heart of the L2ARC.  Each cache device has its own feed thread so that
+ * every device is written at a rate suited to it and a slow device does
+ * not hold up the others.
  */
 static void
-l2arc_feed_thread(void)
+l2arc_feed_thread(l2arc_dev_t *dev)
 {
 	callb_cpr_t cpr;
-	l2arc_dev_t *dev;
-	spa_t *spa;
+	spa_t *spa = dev->l2ad_spa;
 	uint64_t size, wrote;
 	clock_t begin, next = ddi_get_lbolt();
 	boolean_t headroom_boost = B_FALSE;
+	boolean_t rebuild;
 
-	CALLB_CPR_INIT(&cpr, &l2arc_feed_thr_lock, callb_generic_cpr, FTAG);
+	ASSERT(spa != NULL);
 
-	mutex_enter(&l2arc_feed_thr_lock);
+	CALLB_CPR_INIT(&cpr, &dev->l2ad_feed_lock, callb_generic_cpr, FTAG);
 
-	while (l2arc_thread_exit == 0) {
+	mutex_enter(&dev->l2ad_feed_lock);
+
+	while (dev->l2ad_feed_exit == B_FALSE) {
 		CALLB_CPR_SAFE_BEGIN(&cpr);
-		(void) cv_timedwait_interruptible(&l2arc_feed_thr_cv,
-		    &l2arc_feed_thr_lock, next);
-		CALLB_CPR_SAFE_END(&cpr, &l2arc_feed_thr_lock);
+		(void) cv_timedwait_interruptible(&dev->l2ad_feed_cv,
+		    &dev->l2ad_feed_lock, next);
+		CALLB_CPR_SAFE_END(&cpr, &dev->l2ad_feed_lock);
 		next = ddi_get_lbolt() + hz;
 
+		if (dev->l2ad_feed_exit || !l2arc_feed_enabled)
+			continue;
+
 		/*
-		 * Quick check for L2ARC devices.
+		 * Leave the device alone until it has been rebuilt.
 		 */
 		mutex_enter(&l2arc_dev_mtx);
-		if (l2arc_ndev == 0) {
-			mutex_exit(&l2arc_dev_mtx);
-			continue;
-		}
+		rebuild = dev->l2ad_rebuild;
 		mutex_exit(&l2arc_dev_mtx);
+		if (rebuild)
+			continue;
+
 		begin = ddi_get_lbolt();
 
 		/*
-		 * This selects the next l2arc device to write to, and in
-		 * doing so the next spa to feed from: dev->l2ad_spa.   This
-		 * will return NULL if there are now no l2arc devices or if
-		 * they are all faulted.
-		 *
-		 * If a device is returned, its spa's config lock is also
-		 * held to prevent device removal.  l2arc_dev_get_next()
-		 * will grab and release l2arc_dev_mtx.
+		 * Hold the config lock to prevent the device from being
+		 * removed while we are writing to it.  It is removed with
+		 * the config lock held as writer, and the remover waits for
+		 * this thread, so only try for it.
 		 */
-		if ((dev = l2arc_dev_get_next()) == NULL)
+		if (!spa_config_tryenter(spa, SCL_L2ARC, dev, RW_READER))
 			continue;
 
-		spa = dev->l2ad_spa;
-		ASSERT(spa != NULL);
+		if (vdev_is_dead(dev->l2ad_vdev)) {
+			spa_config_exit(spa, SCL_L2ARC, dev);
+			continue;
+		}
 
 		/*
 		 * If the pool is read-only then force the feed thread to
@@ -5118,17 +6943,20 @@ l2arc_feed_thread(void)
 
 		ARCSTAT_BUMP(arcstat_l2_feeds);
 
-		size = l2arc_write_size();
+		size = l2arc_write_size(dev);
 
 		/*
-		 * Evict L2ARC buffers that will be overwritten.
+		 * Evict L2ARC buffers that will be overwritten, by the
+		 * buffers themselves or by the log blocks describing them.
 		 */
-		l2arc_evict(dev, size, B_FALSE);
+		l2arc_evict(dev, size + l2arc_log_blk_overhead(dev, size),
+		    B_FALSE);
 
 		/*
 		 * Write ARC buffers.
 		 */
 		wrote = l2arc_write_buffers(spa, dev, size, &headroom_boost);
+		l2arc_write_adapt(dev, size, wrote);
 
 		/*
 		 * Calculate interval between writes.
@@ -5137,12 +6965,26 @@ l2arc_feed_thread(void)
 		spa_config_exit(spa, SCL_L2ARC, dev);
 	}
 
-	l2arc_thread_exit = 0;
-	cv_broadcast(&l2arc_feed_thr_cv);
-	CALLB_CPR_EXIT(&cpr);		/* drops l2arc_feed_thr_lock */
+	dev->l2ad_feed_running = B_FALSE;
+	cv_broadcast(&dev->l2ad_feed_cv);
+	CALLB_CPR_EXIT(&cpr);		/* drops dev->l2ad_feed_lock */
 	thread_exit();
 }
 
+/*
+ * Tells a device's feed thread to exit and waits for it to do so.
+ */
+static void
+l2arc_feed_stop(l2arc_dev_t *dev)
+{
+	mutex_enter(&dev->l2ad_feed_lock);
+	dev->l2ad_feed_exit = B_TRUE;
+	cv_signal(&dev->l2ad_feed_cv);
+	while (dev->l2ad_feed_running)
+		cv_wait(&dev->l2ad_feed_cv, &dev->l2ad_feed_lock);
+	mutex_exit(&dev->l2ad_feed_lock);
+}
+
 boolean_t
 l2arc_vdev_present(vdev_t *vd)
 {
@@ -5176,21 +7018,37 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	adddev = kmem_zalloc(sizeof (l2arc_dev_t), KM_SLEEP);
 	adddev->l2ad_spa = spa;
 	adddev->l2ad_vdev = vd;
-	adddev->l2ad_start = VDEV_LABEL_START_SIZE;
+	/* the device header lives between the labels and the buffers */
+	adddev->l2ad_dev_hdr_asize = vdev_psize_to_asize(vd,
+	    L2ARC_DEV_HDR_PSIZE);
+	adddev->l2ad_start = VDEV_LABEL_START_SIZE +
+	    adddev->l2ad_dev_hdr_asize;
 	adddev->l2ad_end = VDEV_LABEL_START_SIZE + vdev_get_min_asize(vd);
 	adddev->l2ad_hand = adddev->l2ad_start;
 	adddev->l2ad_evict = adddev->l2ad_start;
 	adddev->l2ad_first = B_TRUE;
 	adddev->l2ad_writing = B_FALSE;
+	adddev->l2ad_write_size = l2arc_write_max;
+	adddev->l2ad_norw = (l2arc_norw == L2ARC_NORW_ALWAYS);
+	mutex_init(&adddev->l2ad_feed_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&adddev->l2ad_feed_cv, NULL, CV_DEFAULT, NULL);
+	adddev->l2ad_log_blk = zio_buf_alloc(L2ARC_LOG_BLK_SIZE);
+	bzero(adddev->l2ad_log_blk, L2ARC_LOG_BLK_SIZE);
 	list_link_init(&adddev->l2ad_node);
 
+	/*
+	 * Only restore the device's contents if we will also be keeping
+	 * them up to date; there is no point for a read-only import.
+	 */
+	adddev->l2ad_rebuild = l2arc_rebuild_enabled && spa_writeable(spa);
+
 	/*
 	 * This is a list of all ARC buffers that are still valid on the
 	 * device.
 	 */
 	adddev->l2ad_buflist = kmem_zalloc(sizeof (list_t), KM_SLEEP);
-	list_create(adddev->l2ad_buflist, sizeof (arc_buf_hdr_t),
-	    offsetof(arc_buf_hdr_t, b_l2node));
+	list_create(adddev->l2ad_buflist, HDR_L2ONLY_SIZE,
+	    offsetof(arc_buf_hdr_t, b_l2hdr.b_l2node));
 
 	vdev_space_update(vd, 0, 0, adddev->l2ad_end - adddev->l2ad_hand);
 
@@ -5201,6 +7059,16 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	list_insert_head(l2arc_dev_list, adddev);
 	atomic_inc_64(&l2arc_ndev);
 	mutex_exit(&l2arc_dev_mtx);
+
+	if (adddev->l2ad_rebuild)
+		(void) thread_create(NULL, 0, l2arc_dev_rebuild_thread, adddev,
+		    0, &p0, TS_RUN, minclsyspri);
+
+	if (l2arc_feed_enabled) {
+		adddev->l2ad_feed_running = B_TRUE;
+		(void) thread_create(NULL, 0, l2arc_feed_thread, adddev,
+		    0, &p0, TS_RUN, minclsyspri);
+	}
 }
 
 /*
@@ -5228,29 +7096,39 @@ l2arc_remove_vdev(vdev_t *vd)
 	 * Remove device from global list
 	 */
 	list_remove(l2arc_dev_list, remdev);
-	l2arc_dev_last = NULL;		/* may have been invalidated */
 	atomic_dec_64(&l2arc_ndev);
+
+	/*
+	 * Stop a rebuild which is still running and wait for it to go.
+	 */
+	remdev->l2ad_rebuild_cancel = B_TRUE;
+	while (remdev->l2ad_rebuild)
+		cv_wait(&l2arc_rebuild_cv, &l2arc_dev_mtx);
 	mutex_exit(&l2arc_dev_mtx);
 
+	l2arc_feed_stop(remdev);
+
 	/*
 	 * Clear all buflists and ARC references.  L2ARC device flush.
 	 */
 	l2arc_evict(remdev, 0, B_TRUE);
 	list_destroy(remdev->l2ad_buflist);
 	kmem_free(remdev->l2ad_buflist, sizeof (list_t));
+	zio_buf_free(remdev->l2ad_log_blk, L2ARC_LOG_BLK_SIZE);
+	mutex_destroy(&remdev->l2ad_feed_lock);
+	cv_destroy(&remdev->l2ad_feed_cv);
 	kmem_free(remdev, sizeof (l2arc_dev_t));
 }
 
 void
 l2arc_init(void)
 {
-	l2arc_thread_exit = 0;
+	l2arc_feed_enabled = B_FALSE;
 	l2arc_ndev = 0;
 	l2arc_writes_sent = 0;
 	l2arc_writes_done = 0;
 
-	mutex_init(&l2arc_feed_thr_lock, NULL, MUTEX_DEFAULT, NULL);
-	cv_init(&l2arc_feed_thr_cv, NULL, CV_DEFAULT, NULL);
+	cv_init(&l2arc_rebuild_cv, NULL, CV_DEFAULT, NULL);
 	mutex_init(&l2arc_dev_mtx, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&l2arc_buflist_mtx, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&l2arc_free_on_write_mtx, NULL, MUTEX_DEFAULT, NULL);
@@ -5274,8 +7152,7 @@ l2arc_fini(void)
 
 	l2arc_do_free_on_write();
 
-	mutex_destroy(&l2arc_feed_thr_lock);
-	cv_destroy(&l2arc_feed_thr_cv);
+	cv_destroy(&l2arc_rebuild_cv);
 	mutex_destroy(&l2arc_dev_mtx);
 	mutex_destroy(&l2arc_buflist_mtx);
 	mutex_destroy(&l2arc_free_on_write_mtx);
@@ -5284,28 +7161,24 @@ l2arc_fini(void)
 	list_destroy(l2arc_free_on_write);
 }
 
+/*
+ * Feed threads are started for cache devices added between l2arc_start()
+ * and l2arc_stop().  Once stopped, running feed threads no longer write;
+ * they exit when their devices are removed as the pools are unloaded.
+ */
 void
 l2arc_start(void)
 {
 	if (!(spa_mode_global & FWRITE))
 		return;
 
-	(void) thread_create(NULL, 0, l2arc_feed_thread, NULL, 0, &p0,
-	    TS_RUN, minclsyspri);
+	l2arc_feed_enabled = B_TRUE;
 }
 
 void
 l2arc_stop(void)
 {
-	if (!(spa_mode_global & FWRITE))
-		return;
-
-	mutex_enter(&l2arc_feed_thr_lock);
-	cv_signal(&l2arc_feed_thr_cv);	/* kick thread out of startup */
-	l2arc_thread_exit = 1;
-	while (l2arc_thread_exit != 0)
-		cv_wait(&l2arc_feed_thr_cv, &l2arc_feed_thr_lock);
-	mutex_exit(&l2arc_feed_thr_lock);
+	l2arc_feed_enabled = B_FALSE;
 }
 
 #if defined(_KERNEL) && defined(HAVE_SPL)
@@ -5333,6 +7206,21 @@ MODULE_PARM_DESC(zfs_arc_grow_retry, "Seconds before growing arc size");
 module_param(zfs_arc_shrink_shift, int, 0644);
 MODULE_PARM_DESC(zfs_arc_shrink_shift, "log2(fraction of arc to reclaim)");
 
+module_param(zfs_arc_evict_headroom_shift, int, 0644);
+MODULE_PARM_DESC(zfs_arc_evict_headroom_shift,
+	"log2(fraction of arc kept free below target by reclaim thread)");
+
+module_param(zfs_arc_overflow_shift, int, 0644);
+MODULE_PARM_DESC(zfs_arc_overflow_shift,
+	"log2(fraction of arc overflow before allocations wait)");
+
+module_param(zfs_arc_hash_resize, int, 0644);
+MODULE_PARM_DESC(zfs_arc_hash_resize, "Resize the arc hash table on demand");
+
+module_param(zfs_arc_trace_entries, int, 0444);
+MODULE_PARM_DESC(zfs_arc_trace_entries,
+	"Number of arc_read() records kept in the access trace");
+
 module_param(zfs_arc_p_min_shift, int, 0644);
 MODULE_PARM_DESC(zfs_arc_p_min_shift, "arc_c shift to calc min/max arc_p");
 
@@ -5345,6 +7233,14 @@ MODULE_PARM_DESC(zfs_arc_memory_throttle_disable, "disable memory throttle");
 module_param(zfs_arc_min_prefetch_lifespan, int, 0644);
 MODULE_PARM_DESC(zfs_arc_min_prefetch_lifespan, "Min life of prefetch block");
 
+module_param(zfs_arc_num_sublists_per_state, int, 0444);
+MODULE_PARM_DESC(zfs_arc_num_sublists_per_state,
+	"Number of sublists used in each of the ARC state lists");
+
+module_param(zfs_compressed_arc_enabled, int, 0644);
+MODULE_PARM_DESC(zfs_compressed_arc_enabled,
+	"Cache user data in its on-disk compressed form");
+
 module_param(l2arc_write_max, ulong, 0644);
 MODULE_PARM_DESC(l2arc_write_max, "Max write bytes per interval");
 
@@ -5373,6 +7269,17 @@ module_param(l2arc_feed_again, int, 0644);
 MODULE_PARM_DESC(l2arc_feed_again, "Turbo L2ARC warmup");
 
 module_param(l2arc_norw, int, 0644);
-MODULE_PARM_DESC(l2arc_norw, "No reads during writes");
+MODULE_PARM_DESC(l2arc_norw, "No reads during writes (0 never, 1 always, "
+	"2 slow devices)");
+
+module_param(l2arc_write_limit, ulong, 0644);
+MODULE_PARM_DESC(l2arc_write_limit, "Max adaptive write bytes per interval");
+
+module_param(l2arc_write_target_ms, ulong, 0644);
+MODULE_PARM_DESC(l2arc_write_target_ms,
+	"Target L2ARC write pass latency in ms, 0 to disable adaptation");
+
+module_param(l2arc_rebuild_enabled, int, 0644);
+MODULE_PARM_DESC(l2arc_rebuild_enabled, "Rebuild the L2ARC on pool import");
 
 #endif
@@ -269,6 +269,8 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 	os->os_dsl_dataset = ds;
 	os->os_spa = spa;
 	os->os_rootbp = bp;
+	os->os_arc_stats = arc_os_stats_register(spa,
+	    ds ? ds->ds_object : DMU_META_OBJSET);
 	if (!BP_IS_HOLE(os->os_rootbp)) {
 		uint32_t aflags = ARC_WAIT;
 		zbookmark_t zb;
@@ -285,6 +287,7 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 		    arc_getbuf_func, &os->os_phys_buf,
 		    ZIO_PRIORITY_SYNC_READ, ZIO_FLAG_CANFAIL, &aflags, &zb);
 		if (err != 0) {
+			arc_os_stats_unregister(os->os_arc_stats);
 			kmem_free(os, sizeof (objset_t));
 			/* convert checksum errors into IO errors */
 			if (err == ECKSUM)
@@ -367,6 +370,7 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 		if (err != 0) {
 			VERIFY(arc_buf_remove_ref(os->os_phys_buf,
 			    &os->os_phys_buf));
+			arc_os_stats_unregister(os->os_arc_stats);
 			kmem_free(os, sizeof (objset_t));
 			return (err);
 		}
@@ -615,6 +619,7 @@ dmu_objset_evict(objset_t *os)
 	ASSERT3P(list_head(&os->os_dnodes), ==, NULL);
 
 	VERIFY(arc_buf_remove_ref(os->os_phys_buf, &os->os_phys_buf));
+	arc_os_stats_unregister(os->os_arc_stats);
 
 	/*
 	 * This is a barrier to prevent the objset from going away in
@@ -857,6 +857,28 @@ dsl_pool_willuse_space(dsl_pool_t *dp, int64_t space, dmu_tx_t *tx)
 	}
 }
 
+/*
+ * Returns the amount of dirty data not yet synced, as a percentage of the
+ * current per-txg write limit.  This is only a hint for the I/O scheduler
+ * (see vdev_queue_max_async_writes()) so it is read without locks.
+ */
+uint64_t
+dsl_pool_dirty_pct(dsl_pool_t *dp)
+{
+	uint64_t write_limit = (zfs_write_limit_override ?
+	    zfs_write_limit_override : dp->dp_write_limit);
+	uint64_t dirty = 0;
+	int i;
+
+	if (write_limit == 0)
+		return (0);
+
+	for (i = 0; i < TXG_SIZE; i++)
+		dirty += dp->dp_space_towrite[i];
+
+	return (dirty * 100 / write_limit);
+}
+
 /* ARGSUSED */
 static int
 upgrade_clones_cb(dsl_pool_t *dp, dsl_dataset_t *hds, void *arg)
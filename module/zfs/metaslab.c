@@ -28,6 +28,7 @@
 #include <sys/dmu_tx.h>
 #include <sys/space_map.h>
 #include <sys/metaslab_impl.h>
+#include <sys/spa_impl.h>
 #include <sys/vdev_impl.h>
 #include <sys/zio.h>
 
@@ -63,11 +64,33 @@ int zfs_condense_pct = 200;
  */
 int zfs_mg_alloc_failures;
 
+/*
+ * Asynchronous writes are steered away from a top-level vdev once the
+ * number of them allocated on it but not yet written reaches this
+ * percentage of zfs_vdev_async_write_max_active, as long as some other
+ * vdev in the class still has room.  Zero disables the throttle.
+ */
+int zfs_mg_queue_depth_pct = 1000;
+
 /*
  * Metaslab debugging: when set, keeps all space maps in core to verify frees.
  */
 int metaslab_debug = 0;
 
+/*
+ * When zfs_trim is set, freed space is discarded (TRIM/UNMAP) in a batch
+ * every zfs_trim_txg_delay txgs, once it has been out of the defer maps
+ * for at least that many txgs.  Until then "zpool import -F" can still
+ * rewind to a txg which uses it.  Extents smaller than zfs_trim_min_extent
+ * are not worth a command of their own and are left for "zpool trim".
+ * All discards are split at zfs_trim_max_extent to bound how long each
+ * one occupies the device.
+ */
+int zfs_trim = 0;
+int zfs_trim_txg_delay = 32;
+int zfs_trim_min_extent = 32 << 10;
+int zfs_trim_max_extent = 128 << 20;
+
 /*
  * Minimum size which forces the dynamic allocator to change
  * it's allocation strategy.  Once the space map cannot satisfy
@@ -100,6 +123,8 @@ int metaslab_prefetch_limit = SPA_DVAS_PER_BP;
  */
 int metaslab_smo_bonus_pct = 150;
 
+extern uint32_t zfs_vdev_async_write_max_active;
+
 /*
  * ==========================================================================
  * Metaslab classes
@@ -222,10 +247,42 @@ metaslab_compare(const void *x1, const void *x2)
 	return (0);
 }
 
+static metaslab_group_stats_t metaslab_group_stats_template = {
+	{ "queue_depth",		KSTAT_DATA_UINT64 },
+	{ "max_queue_depth",		KSTAT_DATA_UINT64 },
+	{ "allocs",			KSTAT_DATA_UINT64 },
+	{ "throttled",			KSTAT_DATA_UINT64 },
+};
+
+static uint64_t
+metaslab_group_max_queue_depth(void)
+{
+	return (MAX(1, (uint64_t)zfs_vdev_async_write_max_active *
+	    zfs_mg_queue_depth_pct / 100));
+}
+
+static int
+metaslab_group_kstat_update(kstat_t *ksp, int rw)
+{
+	metaslab_group_t *mg = ksp->ks_private;
+	metaslab_group_stats_t *mgs = ksp->ks_data;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	mgs->mgs_queue_depth.value.ui64 = mg->mg_alloc_queue_depth;
+	mgs->mgs_max_queue_depth.value.ui64 = metaslab_group_max_queue_depth();
+	mgs->mgs_allocs.value.ui64 = mg->mg_alloc_total;
+	mgs->mgs_throttled.value.ui64 = mg->mg_alloc_throttled;
+
+	return (0);
+}
+
 metaslab_group_t *
 metaslab_group_create(metaslab_class_t *mc, vdev_t *vd)
 {
 	metaslab_group_t *mg;
+	char name[KSTAT_STRLEN];
 
 	mg = kmem_zalloc(sizeof (metaslab_group_t), KM_PUSHPAGE);
 	mutex_init(&mg->mg_lock, NULL, MUTEX_DEFAULT, NULL);
@@ -235,6 +292,22 @@ metaslab_group_create(metaslab_class_t *mc, vdev_t *vd)
 	mg->mg_class = mc;
 	mg->mg_activation_count = 0;
 
+	bcopy(&metaslab_group_stats_template, &mg->mg_stats,
+	    sizeof (metaslab_group_stats_t));
+
+	(void) snprintf(name, KSTAT_STRLEN, "vdev_alloc-%llx",
+	    (u_longlong_t)vd->vdev_guid);
+
+	mg->mg_ksp = kstat_create("zfs", 0, name, "misc", KSTAT_TYPE_NAMED,
+	    sizeof (metaslab_group_stats_t) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (mg->mg_ksp != NULL) {
+		mg->mg_ksp->ks_data = &mg->mg_stats;
+		mg->mg_ksp->ks_private = mg;
+		mg->mg_ksp->ks_update = metaslab_group_kstat_update;
+		kstat_install(mg->mg_ksp);
+	}
+
 	return (mg);
 }
 
@@ -249,6 +322,10 @@ metaslab_group_destroy(metaslab_group_t *mg)
 	 * because we're done, and possibly removing the vdev.
 	 */
 	ASSERT(mg->mg_activation_count <= 0);
+	ASSERT0(mg->mg_alloc_queue_depth);
+
+	if (mg->mg_ksp != NULL)
+		kstat_delete(mg->mg_ksp);
 
 	avl_destroy(&mg->mg_metaslab_tree);
 	mutex_destroy(&mg->mg_lock);
@@ -317,6 +394,35 @@ metaslab_group_passivate(metaslab_group_t *mg)
 	mg->mg_next = NULL;
 }
 
+/*
+ * Determine whether an asynchronous write should pass over this group
+ * because too many of the writes already allocated on it are still
+ * queued, and some other group in the class can take it instead.
+ */
+static boolean_t
+metaslab_group_throttled(metaslab_group_t *mg)
+{
+	metaslab_group_t *mgp;
+	uint64_t qmax;
+
+	if (zfs_mg_queue_depth_pct == 0)
+		return (B_FALSE);
+
+	qmax = metaslab_group_max_queue_depth();
+	if (mg->mg_alloc_queue_depth < qmax)
+		return (B_FALSE);
+
+	for (mgp = mg->mg_next; mgp != mg; mgp = mgp->mg_next) {
+		if (mgp->mg_alloc_queue_depth < qmax &&
+		    vdev_allocatable(mgp->mg_vd)) {
+			atomic_inc_64(&mg->mg_alloc_throttled);
+			return (B_TRUE);
+		}
+	}
+
+	return (B_FALSE);
+}
+
 static void
 metaslab_group_add(metaslab_group_t *mg, metaslab_t *msp)
 {
@@ -783,8 +889,12 @@ metaslab_fini(metaslab_t *msp)
 	metaslab_group_t *mg = msp->ms_group;
 	int t;
 
+	/*
+	 * Space still waiting for a discard is counted as deferred.
+	 */
 	vdev_space_update(mg->mg_vd,
-	    -msp->ms_smo.smo_alloc, 0, -msp->ms_map->sm_size);
+	    -msp->ms_smo.smo_alloc - msp->ms_trimspace, -msp->ms_trimspace,
+	    -msp->ms_map->sm_size);
 
 	metaslab_group_remove(mg, msp);
 
@@ -806,6 +916,12 @@ metaslab_fini(metaslab_t *msp)
 		kmem_free(msp->ms_defermap[t], sizeof (*msp->ms_defermap[t]));
 	}
 
+	for (t = 0; t < MS_TRIM_STAGES; t++) {
+		space_map_vacate(msp->ms_trimmap[t], NULL, NULL);
+		space_map_destroy(msp->ms_trimmap[t]);
+		kmem_free(msp->ms_trimmap[t], sizeof (*msp->ms_trimmap[t]));
+	}
+
 	ASSERT0(msp->ms_deferspace);
 
 	mutex_exit(&msp->ms_lock);
@@ -830,6 +946,12 @@ metaslab_weight(metaslab_t *msp)
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
 
+	/*
+	 * Nothing can be allocated while the free space is being trimmed.
+	 */
+	if (msp->ms_trimming)
+		return (0);
+
 	/*
 	 * The baseline weight is the metaslab's free space.
 	 */
@@ -924,6 +1046,9 @@ metaslab_activate(metaslab_t *msp, uint64_t activation_weight)
 			for (t = 0; t < TXG_DEFER_SIZE; t++)
 				space_map_walk(msp->ms_defermap[t],
 				    space_map_claim, sm);
+			for (t = 0; t < MS_TRIM_STAGES; t++)
+				space_map_walk(msp->ms_trimmap[t],
+				    space_map_claim, sm);
 
 		}
 
@@ -1063,6 +1188,10 @@ metaslab_condense(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
 		space_map_walk(msp->ms_defermap[t],
 		    space_map_remove, &condense_map);
 
+	for (t = 0; t < MS_TRIM_STAGES; t++)
+		space_map_walk(msp->ms_trimmap[t],
+		    space_map_remove, &condense_map);
+
 	for (t = 1; t < TXG_CONCURRENT_STATES; t++)
 		space_map_walk(msp->ms_allocmap[(txg + t) & TXG_MASK],
 		    space_map_remove, &condense_map);
@@ -1164,7 +1293,7 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 
 	mutex_enter(&msp->ms_lock);
 
-	if (sm->sm_loaded && spa_sync_pass(spa) == 1 &&
+	if (sm->sm_loaded && spa_sync_pass(spa) == 1 && !msp->ms_trimming &&
 	    metaslab_should_condense(msp)) {
 		metaslab_condense(msp, txg, tx);
 	} else {
@@ -1202,6 +1331,272 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	dmu_tx_commit(tx);
 }
 
+static void
+metaslab_trim_done(zio_t *zio)
+{
+	spa_trim_stats_t *sts = &zio->io_spa->spa_trim_stats;
+	boolean_t manual = (boolean_t)(uintptr_t)zio->io_private;
+
+	if (zio->io_error == ENOTSUP)
+		return;
+
+	if (zio->io_error != 0) {
+		atomic_inc_64(&sts->sts_failed_extents.value.ui64);
+		atomic_add_64(&sts->sts_failed_bytes.value.ui64, zio->io_size);
+	} else if (manual) {
+		atomic_inc_64(&sts->sts_manual_extents.value.ui64);
+		atomic_add_64(&sts->sts_manual_bytes.value.ui64, zio->io_size);
+	} else {
+		atomic_inc_64(&sts->sts_auto_extents.value.ui64);
+		atomic_add_64(&sts->sts_auto_bytes.value.ui64, zio->io_size);
+	}
+}
+
+static uint64_t
+metaslab_trim_max_extent(metaslab_t *msp)
+{
+	uint64_t align = 1ULL << msp->ms_map->sm_shift;
+
+	return (MAX(P2ALIGN((uint64_t)zfs_trim_max_extent, align), align));
+}
+
+/*
+ * Each chunk of a manual trim holds SCL_ZIO until its discards are done,
+ * so the vdevs cannot be closed underneath them.
+ */
+static void
+metaslab_trim_chunk_done(zio_t *zio)
+{
+	spa_config_exit(zio->io_spa, SCL_ZIO, zio);
+}
+
+/*
+ * Discard the segments of a trim map that are worth a command of their own.
+ */
+static void
+metaslab_trim_issue(metaslab_t *msp, space_map_t *map, zio_t *pio)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+	avl_tree_t *t = &map->sm_root;
+	uint64_t max = metaslab_trim_max_extent(msp);
+	space_seg_t *ss;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	for (ss = avl_first(t); ss != NULL; ss = AVL_NEXT(t, ss)) {
+		uint64_t start, len;
+
+		if (ss->ss_end - ss->ss_start < zfs_trim_min_extent)
+			continue;
+
+		for (start = ss->ss_start; start < ss->ss_end; start += len) {
+			len = MIN(ss->ss_end - start, max);
+			zio_nowait(zio_trim(pio, vd->vdev_spa, vd, start, len,
+			    metaslab_trim_done, (void *)B_FALSE,
+			    ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_PROPAGATE |
+			    ZIO_FLAG_DONT_RETRY));
+		}
+	}
+}
+
+/*
+ * Called from metaslab_sync_done() before the oldest deferred frees go back
+ * to the allocator.  With zfs_trim set they go into the newest trim map
+ * instead.  Every zfs_trim_txg_delay txgs spa_sync() starts a batch of
+ * discards in spa_trim_zio: the aged map is discarded and the maps move
+ * one stage on.  The space of a batch goes back to the allocator in the
+ * first txg after spa_sync() has seen the batch finish, so nothing can be
+ * allocated over a discard in flight.  Space is discarded no sooner than
+ * zfs_trim_txg_delay txgs after it leaves the defer maps, and adjacent
+ * frees from those txgs are discarded as one extent.
+ *
+ * A passivated group is being removed or offlined, and spa_trim_drain is
+ * set while the pool is unloaded; then the space is handed back without
+ * waiting.  Returns the change in ms_trimspace.
+ */
+static int64_t
+metaslab_trim_sync_done(metaslab_t *msp, space_map_t *defer_map,
+    space_map_func_t *release)
+{
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
+	space_map_t **tm = msp->ms_trimmap;
+	space_map_t *sm = msp->ms_map;
+	boolean_t hold;
+	int64_t delta = 0;
+	space_map_t *issued;
+	int t;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	hold = (zfs_trim && msp->ms_group->mg_activation_count > 0 &&
+	    !spa->spa_trim_drain);
+
+	if (spa->spa_trim_release) {
+		delta -= tm[MS_TRIM_ISSUED]->sm_space;
+		space_map_vacate(tm[MS_TRIM_ISSUED], release, sm);
+	}
+
+	if (!hold) {
+		for (t = MS_TRIM_NEW; t <= MS_TRIM_AGED; t++) {
+			delta -= tm[t]->sm_space;
+			space_map_vacate(tm[t], release, sm);
+		}
+	}
+
+	if (spa->spa_trim_zio != NULL) {
+		ASSERT0(tm[MS_TRIM_ISSUED]->sm_space);
+		metaslab_trim_issue(msp, tm[MS_TRIM_AGED], spa->spa_trim_zio);
+		issued = tm[MS_TRIM_ISSUED];
+		tm[MS_TRIM_ISSUED] = tm[MS_TRIM_AGED];
+		tm[MS_TRIM_AGED] = tm[MS_TRIM_NEW];
+		tm[MS_TRIM_NEW] = issued;
+	}
+
+	if (hold) {
+		delta += defer_map->sm_space;
+		space_map_vacate(defer_map, space_map_add, tm[MS_TRIM_NEW]);
+	}
+
+	return (delta);
+}
+
+/*
+ * Discard all of the free space in a metaslab for "zpool trim".  The free
+ * segments are taken out of ms_map while the discards are in flight so
+ * nothing can be allocated over them.  ms_trimming keeps the metaslab from
+ * being selected for allocation, condensed, or unloaded while its in-core
+ * map is missing those segments.  When rate is non-zero the discards are
+ * issued no faster than rate bytes per second.
+ *
+ * The caller keeps the metaslab from being freed (see spa_trim_thread()),
+ * but its vdev can change underneath us: attach and detach move the group
+ * to a new top-level vdev, and removing or offlining a log device
+ * passivates it.  So the config lock is only taken to issue each chunk,
+ * never across the rate limit delay or a wait for I/O, and a passivated
+ * group ends the trim of this metaslab.
+ */
+void
+metaslab_trim_all(metaslab_t *msp, uint64_t rate, boolean_t *stop)
+{
+	metaslab_group_t *mg = msp->ms_group;
+	spa_t *spa = mg->mg_class->mc_spa;
+	space_map_t *sm = msp->ms_map;
+	uint64_t max = metaslab_trim_max_extent(msp);
+	hrtime_t start_time = gethrtime();
+	uint64_t bytes = 0;
+	space_map_t trim_map;
+	space_seg_t *ss;
+	boolean_t loaded, gone = B_FALSE;
+	zio_t *zio, *cio;
+	vdev_t *vd;
+	int t;
+
+	mutex_enter(&msp->ms_lock);
+
+	/*
+	 * A metaslab which is still being added has nothing to trim yet.
+	 */
+	if (msp->ms_freemap[0] == NULL || msp->ms_trimming) {
+		mutex_exit(&msp->ms_lock);
+		return;
+	}
+
+	space_map_load_wait(sm);
+	loaded = sm->sm_loaded;
+	if (!loaded) {
+		if (space_map_load(sm, mg->mg_class->mc_ops, SM_FREE,
+		    &msp->ms_smo, spa_meta_objset(spa)) != 0) {
+			mutex_exit(&msp->ms_lock);
+			return;
+		}
+		for (t = 0; t < TXG_DEFER_SIZE; t++)
+			space_map_walk(msp->ms_defermap[t],
+			    space_map_claim, sm);
+		for (t = 0; t < MS_TRIM_STAGES; t++)
+			space_map_walk(msp->ms_trimmap[t],
+			    space_map_claim, sm);
+	}
+
+	space_map_create(&trim_map, sm->sm_start, sm->sm_size,
+	    sm->sm_shift, sm->sm_lock);
+	space_map_walk(sm, space_map_add, &trim_map);
+	space_map_walk(&trim_map, space_map_claim, sm);
+	msp->ms_trimming = B_TRUE;
+	metaslab_group_sort(mg, msp, metaslab_weight(msp));
+
+	mutex_exit(&msp->ms_lock);
+
+	zio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+
+	for (ss = avl_first(&trim_map.sm_root); ss != NULL && !*stop && !gone;
+	    ss = AVL_NEXT(&trim_map.sm_root, ss)) {
+		uint64_t start, len;
+
+		for (start = ss->ss_start; start < ss->ss_end && !*stop;
+		    start += len) {
+			len = MIN(ss->ss_end - start, max);
+
+			if (rate != 0) {
+				hrtime_t due = start_time +
+				    (bytes / rate) * NANOSEC +
+				    ((bytes % rate) * NANOSEC) / rate;
+				hrtime_t now = gethrtime();
+
+				if (due > now)
+					delay(MAX(NSEC_TO_TICK(due - now), 1));
+			}
+
+			spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+			if (mg->mg_activation_count <= 0) {
+				spa_config_exit(spa, SCL_CONFIG, FTAG);
+				gone = B_TRUE;
+				break;
+			}
+			vd = mg->mg_vd;
+
+			cio = zio_null(zio, spa, NULL, metaslab_trim_chunk_done,
+			    NULL, ZIO_FLAG_CANFAIL);
+			spa_config_enter(spa, SCL_ZIO, cio, RW_READER);
+			zio_nowait(zio_trim(cio, spa, vd, start, len,
+			    metaslab_trim_done, (void *)B_TRUE,
+			    ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_PROPAGATE |
+			    ZIO_FLAG_DONT_RETRY));
+			zio_nowait(cio);
+			spa_config_exit(spa, SCL_CONFIG, FTAG);
+
+			bytes += len;
+		}
+	}
+
+	(void) zio_wait(zio);
+
+	mutex_enter(&msp->ms_lock);
+
+	space_map_vacate(&trim_map, space_map_free, sm);
+	space_map_destroy(&trim_map);
+	msp->ms_trimming = B_FALSE;
+
+	/*
+	 * If we loaded the map only to trim it, unload it again once no
+	 * allocations are pending, as metaslab_sync_done() would.
+	 */
+	if (!loaded && (msp->ms_weight & METASLAB_ACTIVE_MASK) == 0 &&
+	    !metaslab_debug) {
+		boolean_t evictable = B_TRUE;
+
+		for (t = 0; t < TXG_SIZE; t++)
+			if (msp->ms_allocmap[t]->sm_space != 0)
+				evictable = B_FALSE;
+
+		if (evictable)
+			space_map_unload(sm);
+	}
+
+	metaslab_group_sort(mg, msp, metaslab_weight(msp));
+
+	mutex_exit(&msp->ms_lock);
+}
+
 /*
  * Called after a transaction group has completely synced to mark
  * all of the metaslab's free space as usable.
@@ -1216,7 +1611,8 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	space_map_t *defer_map = msp->ms_defermap[txg % TXG_DEFER_SIZE];
 	metaslab_group_t *mg = msp->ms_group;
 	vdev_t *vd = mg->mg_vd;
-	int64_t alloc_delta, defer_delta;
+	space_map_func_t *release;
+	int64_t alloc_delta, defer_delta, trim_delta;
 	int t;
 
 	ASSERT(!vd->vdev_ishole);
@@ -1247,6 +1643,13 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 			    sm->sm_size, sm->sm_shift, sm->sm_lock);
 		}
 
+		for (t = 0; t < MS_TRIM_STAGES; t++) {
+			msp->ms_trimmap[t] = kmem_zalloc(sizeof (space_map_t),
+			    KM_PUSHPAGE);
+			space_map_create(msp->ms_trimmap[t], sm->sm_start,
+			    sm->sm_size, sm->sm_shift, sm->sm_lock);
+		}
+
 		freed_map = msp->ms_freemap[TXG_CLEAN(txg) & TXG_MASK];
 		defer_map = msp->ms_defermap[txg % TXG_DEFER_SIZE];
 
@@ -1256,27 +1659,34 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	alloc_delta = smosync->smo_alloc - smo->smo_alloc;
 	defer_delta = freed_map->sm_space - defer_map->sm_space;
 
-	vdev_space_update(vd, alloc_delta + defer_delta, defer_delta, 0);
-
 	ASSERT(msp->ms_allocmap[txg & TXG_MASK]->sm_space == 0);
 	ASSERT(msp->ms_freemap[txg & TXG_MASK]->sm_space == 0);
 
 	/*
 	 * If there's a space_map_load() in progress, wait for it to complete
 	 * so that we have a consistent view of the in-core space map.
-	 * Then, add defer_map (oldest deferred frees) to this map and
-	 * transfer freed_map (this txg's frees) to defer_map.
+	 * Then, add defer_map (oldest deferred frees) to this map, unless
+	 * it is held for a discard, and transfer freed_map (this txg's
+	 * frees) to defer_map.
 	 */
 	space_map_load_wait(sm);
-	space_map_vacate(defer_map, sm->sm_loaded ? space_map_free : NULL, sm);
+	release = sm->sm_loaded ? space_map_free : NULL;
+	trim_delta = metaslab_trim_sync_done(msp, defer_map, release);
+	space_map_vacate(defer_map, release, sm);
 	space_map_vacate(freed_map, space_map_add, defer_map);
 
+	vdev_space_update(vd, alloc_delta + defer_delta + trim_delta,
+	    defer_delta + trim_delta, 0);
+
 	*smo = *smosync;
 
 	msp->ms_deferspace += defer_delta;
 	ASSERT3S(msp->ms_deferspace, >=, 0);
 	ASSERT3S(msp->ms_deferspace, <=, sm->sm_size);
-	if (msp->ms_deferspace != 0) {
+	msp->ms_trimspace += trim_delta;
+	ASSERT3S(msp->ms_trimspace, >=, 0);
+	ASSERT3S(msp->ms_trimspace, <=, sm->sm_size);
+	if (msp->ms_deferspace != 0 || msp->ms_trimspace != 0) {
 		/*
 		 * Keep syncing this metaslab until all deferred frees
 		 * are back in circulation.
@@ -1289,7 +1699,8 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	 * future allocations have synced.  (If we unloaded it now and then
 	 * loaded a moment later, the map wouldn't reflect those allocations.)
 	 */
-	if (sm->sm_loaded && (msp->ms_weight & METASLAB_ACTIVE_MASK) == 0) {
+	if (sm->sm_loaded && (msp->ms_weight & METASLAB_ACTIVE_MASK) == 0 &&
+	    !msp->ms_trimming) {
 		int evictable = 1;
 
 		for (t = 1; t < TXG_CONCURRENT_STATES; t++)
@@ -1594,6 +2005,16 @@ top:
 		if (!allocatable)
 			goto next;
 
+		/*
+		 * Steer asynchronous writes away from vdevs which already
+		 * have a deep queue of them, on the first pass only.
+		 */
+		if ((flags & METASLAB_ASYNC_ALLOC) && dshift == 3 &&
+		    metaslab_group_throttled(mg)) {
+			all_zero = B_FALSE;
+			goto next;
+		}
+
 		/*
 		 * Avoid writing single-copy data to a failing vdev
 		 */
@@ -1828,6 +2249,16 @@ metaslab_alloc(spa_t *spa, metaslab_class_t *mc, uint64_t psize, blkptr_t *bp,
 	ASSERT(error == 0);
 	ASSERT(BP_GET_NDVAS(bp) == ndvas);
 
+	if (flags & METASLAB_ASYNC_ALLOC) {
+		for (d = 0; d < ndvas; d++) {
+			metaslab_group_t *mg = vdev_lookup_top(spa,
+			    DVA_GET_VDEV(&dva[d]))->vdev_mg;
+
+			atomic_inc_64(&mg->mg_alloc_queue_depth);
+			atomic_inc_64(&mg->mg_alloc_total);
+		}
+	}
+
 	spa_config_exit(spa, SCL_ALLOC, FTAG);
 
 	BP_SET_BIRTH(bp, txg, txg);
@@ -1928,6 +2359,32 @@ void metaslab_fastwrite_unmark(spa_t *spa, const blkptr_t *bp)
 	spa_config_exit(spa, SCL_VDEV, FTAG);
 }
 
+/*
+ * The writes of a block allocated with METASLAB_ASYNC_ALLOC have
+ * completed, so it no longer counts against its vdevs' queue depth.
+ */
+void
+metaslab_alloc_throttle_done(spa_t *spa, const blkptr_t *bp)
+{
+	const dva_t *dva = bp->blk_dva;
+	int ndvas = BP_GET_NDVAS(bp);
+	int d;
+	vdev_t *vd;
+
+	ASSERT(!BP_IS_HOLE(bp));
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+
+	for (d = 0; d < ndvas; d++) {
+		if ((vd = vdev_lookup_top(spa, DVA_GET_VDEV(&dva[d]))) == NULL)
+			continue;
+		ASSERT3U(vd->vdev_mg->mg_alloc_queue_depth, >, 0);
+		atomic_dec_64(&vd->vdev_mg->mg_alloc_queue_depth);
+	}
+
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+}
+
 static void
 checkmap(space_map_t *sm, uint64_t off, uint64_t size)
 {
@@ -1964,6 +2421,8 @@ metaslab_check_free(spa_t *spa, const blkptr_t *bp)
 			checkmap(ms->ms_freemap[j], off, size);
 		for (j = 0; j < TXG_DEFER_SIZE; j++)
 			checkmap(ms->ms_defermap[j], off, size);
+		for (j = 0; j < MS_TRIM_STAGES; j++)
+			checkmap(ms->ms_trimmap[j], off, size);
 	}
 	spa_config_exit(spa, SCL_VDEV, FTAG);
 }
@@ -1971,4 +2430,20 @@ metaslab_check_free(spa_t *spa, const blkptr_t *bp)
 #if defined(_KERNEL) && defined(HAVE_SPL)
 module_param(metaslab_debug, int, 0644);
 MODULE_PARM_DESC(metaslab_debug, "keep space maps in core to verify frees");
+
+module_param(zfs_mg_queue_depth_pct, int, 0644);
+MODULE_PARM_DESC(zfs_mg_queue_depth_pct,
+	"Async writes queued per vdev, as % of async_write_max_active");
+
+module_param(zfs_trim, int, 0644);
+MODULE_PARM_DESC(zfs_trim, "Discard space on leaf vdevs as it is freed");
+
+module_param(zfs_trim_txg_delay, int, 0644);
+MODULE_PARM_DESC(zfs_trim_txg_delay, "Txgs between batches of discards");
+
+module_param(zfs_trim_min_extent, int, 0644);
+MODULE_PARM_DESC(zfs_trim_min_extent, "Min size of a freed extent to discard");
+
+module_param(zfs_trim_max_extent, int, 0644);
+MODULE_PARM_DESC(zfs_trim_max_extent, "Max size of a single discard");
 #endif /* _KERNEL && HAVE_SPL */
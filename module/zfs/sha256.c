@@ -26,13 +26,18 @@
 #include <sys/zfs_context.h>
 #include <sys/zio.h>
 #include <sys/zio_checksum.h>
+#include <sys/sha256.h>
 
 /*
  * SHA-256 checksum, as specified in FIPS 180-3, available at:
  * http://csrc.nist.gov/publications/PubsFIPS.html
  *
- * This is a very compact implementation of SHA-256.
- * It is designed to be simple and portable, not to be fast.
+ * The portable compression function below is designed to be simple,
+ * not fast.  Faster implementations using processor extensions are
+ * checked against it and benchmarked by sha256_init(), which selects
+ * the fastest for zio_checksum_SHA256().  A multi-buffer implementation
+ * hashes several blocks side by side for zio_checksum_SHA256_multi(),
+ * and is only selected when that beats hashing them one at a time.
  */
 
 /*
@@ -51,7 +56,7 @@
 #define	sigma0(x)	(Rot32(x, 7) ^ Rot32(x, 18) ^ ((x) >> 3))
 #define	sigma1(x)	(Rot32(x, 17) ^ Rot32(x, 19) ^ ((x) >> 10))
 
-static const uint32_t SHA256_K[64] = {
+const uint32_t SHA256_K[64] = {
 	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
 	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
 	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
@@ -96,19 +101,76 @@ SHA256Transform(uint32_t *H, const uint8_t *cp)
 	H[4] += e; H[5] += f; H[6] += g; H[7] += h;
 }
 
-void
-zio_checksum_SHA256(const void *buf, uint64_t size, zio_cksum_t *zcp)
+static void
+sha256_generic_transform(uint32_t *H, const void *buf, uint64_t nblocks)
+{
+	const uint8_t *cp = buf;
+
+	for (; nblocks > 0; nblocks--, cp += SHA256_BLOCK_SIZE)
+		SHA256Transform(H, cp);
+}
+
+static boolean_t
+sha256_generic_valid(void)
+{
+	return (B_TRUE);
+}
+
+static const sha256_ops_t sha256_generic_ops = {
+	.transform = sha256_generic_transform,
+	.valid = sha256_generic_valid,
+	.name = "generic"
+};
+
+static const sha256_ops_t *sha256_impls[] = {
+	&sha256_generic_ops,
+#if defined(__x86_64) && defined(HAVE_SHA_NI)
+	&sha256_shani_ops,
+#endif
+};
+
+static const sha256_mb_ops_t *sha256_mb_impls[] = {
+#if defined(__x86_64) && defined(HAVE_AVX2)
+	&sha256_avx2_mb_ops,
+#endif
+	NULL
+};
+
+#define	SHA256_NIMPLS	(sizeof (sha256_impls) / sizeof (sha256_impls[0]))
+#define	SHA256_MB_NIMPLS	\
+	(sizeof (sha256_mb_impls) / sizeof (sha256_mb_impls[0]) - 1)
+
+/*
+ * sha256_impl is the compression function in use and sha256_mb_impl the
+ * multi-buffer one, NULL when buffers are hashed one at a time.  The
+ * _fastest variables hold the benchmark winners, used unless the user
+ * selected a specific implementation.
+ */
+static const sha256_ops_t *sha256_impl = &sha256_generic_ops;
+static const sha256_ops_t *sha256_fastest = &sha256_generic_ops;
+static boolean_t sha256_impl_user = B_FALSE;
+static const sha256_mb_ops_t *sha256_mb_impl = NULL;
+static const sha256_mb_ops_t *sha256_mb_fastest = NULL;
+static boolean_t sha256_mb_impl_user = B_FALSE;
+
+static const uint32_t sha256_H0[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+/*
+ * Pad the final partial block of a size byte message, whose full blocks
+ * have already been folded into H, and store the digest in zcp.
+ */
+static void
+sha256_final(const sha256_ops_t *ops, uint32_t *H, const uint8_t *tail,
+    uint64_t size, zio_cksum_t *zcp)
 {
-	uint32_t H[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
-	    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
 	uint8_t pad[128];
 	int i, padsize;
 
-	for (i = 0; i < (size & ~63ULL); i += 64)
-		SHA256Transform(H, (uint8_t *)buf + i);
-
-	for (padsize = 0; i < size; i++)
-		pad[padsize++] = *((uint8_t *)buf + i);
+	for (padsize = 0; padsize < (size & 63); padsize++)
+		pad[padsize] = tail[padsize];
 
 	for (pad[padsize++] = 0x80; (padsize & 63) != 56; padsize++)
 		pad[padsize] = 0;
@@ -116,8 +178,7 @@ zio_checksum_SHA256(const void *buf, uint64_t size, zio_cksum_t *zcp)
 	for (i = 56; i >= 0; i -= 8)
 		pad[padsize++] = (size << 3) >> i;
 
-	for (i = 0; i < padsize; i += 64)
-		SHA256Transform(H, pad + i);
+	ops->transform(H, pad, padsize / SHA256_BLOCK_SIZE);
 
 	ZIO_SET_CHECKSUM(zcp,
 	    (uint64_t)H[0] << 32 | H[1],
@@ -125,3 +186,486 @@ zio_checksum_SHA256(const void *buf, uint64_t size, zio_cksum_t *zcp)
 	    (uint64_t)H[4] << 32 | H[5],
 	    (uint64_t)H[6] << 32 | H[7]);
 }
+
+static void
+sha256_compute(const sha256_ops_t *ops, const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
+{
+	uint64_t nblocks = size / SHA256_BLOCK_SIZE;
+	uint32_t H[8];
+
+	bcopy(sha256_H0, H, sizeof (H));
+	ops->transform(H, buf, nblocks);
+	sha256_final(ops, H, (const uint8_t *)buf + nblocks *
+	    SHA256_BLOCK_SIZE, size, zcp);
+}
+
+/*
+ * Hash up to SHA256_MB_LANES buffers with the multi-buffer function.
+ * While at least two lanes have full blocks left all lanes advance by
+ * the shortest of them; lanes with nothing left are pointed at the data
+ * of a busy lane and have their state put back afterwards.  Whatever one
+ * lane has left over, and every final block, goes through ops.
+ */
+static void
+sha256_compute_mb(const sha256_mb_ops_t *mb, const sha256_ops_t *ops,
+    void *const *bufs, const uint64_t *sizes, zio_cksum_t *zcps, int n)
+{
+	uint32_t H[8 * SHA256_MB_LANES], save[8 * SHA256_MB_LANES];
+	uint32_t lane[8];
+	const uint8_t *data[SHA256_MB_LANES], *cp;
+	uint64_t left[SHA256_MB_LANES], step;
+	int busy, first, l, w;
+
+	ASSERT3S(n, <=, SHA256_MB_LANES);
+
+	for (l = 0; l < SHA256_MB_LANES; l++) {
+		for (w = 0; w < 8; w++)
+			H[w * SHA256_MB_LANES + l] = sha256_H0[w];
+		data[l] = (l < n) ? bufs[l] : NULL;
+		left[l] = (l < n) ? sizes[l] / SHA256_BLOCK_SIZE : 0;
+	}
+
+	for (;;) {
+		busy = 0;
+		first = -1;
+		step = UINT64_MAX;
+		for (l = 0; l < SHA256_MB_LANES; l++) {
+			if (left[l] == 0)
+				continue;
+			if (first < 0)
+				first = l;
+			step = MIN(step, left[l]);
+			busy++;
+		}
+
+		if (busy < 2)
+			break;
+
+		bcopy(H, save, sizeof (H));
+		for (l = 0; l < SHA256_MB_LANES; l++) {
+			if (left[l] == 0)
+				data[l] = data[first];
+		}
+
+		mb->transform(H, data, step);
+
+		for (l = 0; l < SHA256_MB_LANES; l++) {
+			if (left[l] == 0) {
+				for (w = 0; w < 8; w++) {
+					H[w * SHA256_MB_LANES + l] =
+					    save[w * SHA256_MB_LANES + l];
+				}
+				continue;
+			}
+			data[l] += step * SHA256_BLOCK_SIZE;
+			left[l] -= step;
+		}
+	}
+
+	for (l = 0; l < n; l++) {
+		for (w = 0; w < 8; w++)
+			lane[w] = H[w * SHA256_MB_LANES + l];
+
+		cp = (const uint8_t *)bufs[l] + (sizes[l] / SHA256_BLOCK_SIZE -
+		    left[l]) * SHA256_BLOCK_SIZE;
+		ops->transform(lane, cp, left[l]);
+		sha256_final(ops, lane, cp + left[l] * SHA256_BLOCK_SIZE,
+		    sizes[l], &zcps[l]);
+	}
+}
+
+void
+zio_checksum_SHA256(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	sha256_compute(sha256_impl, buf, size, zcp);
+}
+
+/*
+ * Checksum n buffers at once, storing the checksum of bufs[i] in zcps[i].
+ * The result is the same as n calls to zio_checksum_SHA256().
+ */
+void
+zio_checksum_SHA256_multi(void **bufs, uint64_t *sizes, zio_cksum_t *zcps,
+    int n)
+{
+	const sha256_mb_ops_t *mb = sha256_mb_impl;
+	const sha256_ops_t *ops = sha256_impl;
+	int i, cnt;
+
+	if (mb == NULL) {
+		for (i = 0; i < n; i++)
+			sha256_compute(ops, bufs[i], sizes[i], &zcps[i]);
+		return;
+	}
+
+	for (i = 0; i < n; i += cnt) {
+		cnt = MIN(n - i, SHA256_MB_LANES);
+		sha256_compute_mb(mb, ops, &bufs[i], &sizes[i], &zcps[i], cnt);
+	}
+}
+
+/*
+ * The number of buffers worth collecting for zio_checksum_SHA256_multi(),
+ * or 1 if hashing them one at a time is just as fast.
+ */
+int
+sha256_mb_width(void)
+{
+	return (sha256_mb_impl != NULL ? SHA256_MB_LANES : 1);
+}
+
+static size_t
+sha256_name_len(const char *name)
+{
+	size_t len = strlen(name);
+
+	/* module parameters arrive with a trailing newline */
+	while (len > 0 && (name[len - 1] == '\n' || name[len - 1] == ' '))
+		len--;
+
+	return (len);
+}
+
+#define	SHA256_NAME_EQ(name, len, str)	\
+	((len) == strlen(str) && strncmp((name), (str), (len)) == 0)
+
+/*
+ * Select the compression function by name: "fastest" reverts to the
+ * benchmark winner, anything else must name an implementation usable on
+ * this CPU.  Before sha256_init() has run the choice is only recorded.
+ */
+int
+sha256_impl_set(const char *name)
+{
+	size_t len = sha256_name_len(name);
+	int i;
+
+	if (SHA256_NAME_EQ(name, len, "fastest")) {
+		sha256_impl_user = B_FALSE;
+		sha256_impl = sha256_fastest;
+		return (0);
+	}
+
+	for (i = 0; i < SHA256_NIMPLS; i++) {
+		const sha256_ops_t *ops = sha256_impls[i];
+
+		if (SHA256_NAME_EQ(name, len, ops->name) && ops->valid()) {
+			sha256_impl_user = B_TRUE;
+			sha256_impl = ops;
+			return (0);
+		}
+	}
+
+	return (EINVAL);
+}
+
+/*
+ * As sha256_impl_set() for the multi-buffer function, where "off"
+ * hashes batched buffers one at a time.
+ */
+int
+sha256_mb_impl_set(const char *name)
+{
+	size_t len = sha256_name_len(name);
+	int i;
+
+	if (SHA256_NAME_EQ(name, len, "fastest")) {
+		sha256_mb_impl_user = B_FALSE;
+		sha256_mb_impl = sha256_mb_fastest;
+		return (0);
+	}
+
+	if (SHA256_NAME_EQ(name, len, "off")) {
+		sha256_mb_impl_user = B_TRUE;
+		sha256_mb_impl = NULL;
+		return (0);
+	}
+
+	for (i = 0; i < SHA256_MB_NIMPLS; i++) {
+		const sha256_mb_ops_t *mb = sha256_mb_impls[i];
+
+		if (SHA256_NAME_EQ(name, len, mb->name) && mb->valid()) {
+			sha256_mb_impl_user = B_TRUE;
+			sha256_mb_impl = mb;
+			return (0);
+		}
+	}
+
+	return (EINVAL);
+}
+
+/*
+ * Benchmark results, in MB/s, for each compression function and each
+ * multi-buffer function, followed by the names of those in use.
+ */
+#define	SHA256_BENCH_SIZE	(128 * 1024)
+#define	SHA256_BENCH_NS		(1000 * 1000)	/* 1ms per implementation */
+#define	SHA256_NSTATS		(SHA256_NIMPLS + SHA256_MB_NIMPLS + 2)
+
+static kstat_t *sha256_ksp;
+static kstat_named_t sha256_kstat_data[SHA256_NSTATS];
+
+static int
+sha256_kstat_update(kstat_t *ksp, int rw)
+{
+	kstat_named_t *ks = &sha256_kstat_data[SHA256_NSTATS - 2];
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	(void) strlcpy(ks[0].value.c, sha256_impl->name,
+	    sizeof (ks[0].value.c));
+	(void) strlcpy(ks[1].value.c, sha256_mb_impl != NULL ?
+	    sha256_mb_impl->name : "off", sizeof (ks[1].value.c));
+
+	return (0);
+}
+
+/*
+ * Rate of ops, or of mb if it is not NULL, hashing SHA256_MB_LANES
+ * equally sized pieces of buf.
+ */
+static uint64_t
+sha256_bench(const sha256_ops_t *ops, const sha256_mb_ops_t *mb,
+    uint8_t *buf)
+{
+	uint64_t size = SHA256_BENCH_SIZE / SHA256_MB_LANES;
+	void *bufs[SHA256_MB_LANES];
+	uint64_t sizes[SHA256_MB_LANES];
+	zio_cksum_t zcps[SHA256_MB_LANES];
+	uint64_t bytes = 0;
+	hrtime_t start, elapsed;
+	int l;
+
+	for (l = 0; l < SHA256_MB_LANES; l++) {
+		bufs[l] = buf + l * size;
+		sizes[l] = size;
+	}
+
+	start = gethrtime();
+	do {
+		if (mb != NULL) {
+			sha256_compute_mb(mb, ops, bufs, sizes, zcps,
+			    SHA256_MB_LANES);
+		} else {
+			for (l = 0; l < SHA256_MB_LANES; l++)
+				sha256_compute(ops, bufs[l], size, &zcps[l]);
+		}
+		bytes += SHA256_BENCH_SIZE;
+		elapsed = gethrtime() - start;
+	} while (elapsed < SHA256_BENCH_NS);
+
+	return ((bytes * 1000) / elapsed);
+}
+
+/*
+ * Check an implementation against the generic code over every length
+ * around the padding boundaries and a few longer ones.  Multi-buffer
+ * functions are given buffers of different lengths, so lanes drop out
+ * at different points.
+ */
+static boolean_t
+sha256_verify(const sha256_ops_t *ops, const sha256_mb_ops_t *mb,
+    uint8_t *buf)
+{
+	uint64_t sizes[SHA256_MB_LANES + 1];
+	void *bufs[SHA256_MB_LANES + 1];
+	zio_cksum_t expect[SHA256_MB_LANES + 1], actual[SHA256_MB_LANES + 1];
+	uint64_t size;
+	int i, n;
+
+	for (size = 0; size < 4 * SHA256_BLOCK_SIZE + 4096; size++) {
+		if (size > 4 * SHA256_BLOCK_SIZE)
+			size += 511;
+		for (i = 0; i <= SHA256_MB_LANES; i++) {
+			bufs[i] = buf + i * 13;
+			sizes[i] = size + (size * i) % 217;
+			sha256_compute(&sha256_generic_ops, bufs[i],
+			    sizes[i], &expect[i]);
+		}
+
+		if (mb != NULL) {
+			n = 1 + size % SHA256_MB_LANES;
+			sha256_compute_mb(mb, ops, bufs, sizes, actual, n);
+		} else {
+			n = 1;
+			sha256_compute(ops, bufs[0], sizes[0], &actual[0]);
+		}
+
+		for (i = 0; i < n; i++) {
+			if (!ZIO_CHECKSUM_EQUAL(expect[i], actual[i]))
+				return (B_FALSE);
+		}
+	}
+
+	return (B_TRUE);
+}
+
+void
+sha256_init(void)
+{
+	const sha256_ops_t *fastest = &sha256_generic_ops;
+	const sha256_mb_ops_t *mb_fastest = NULL;
+	uint64_t rate, fastest_rate = 0;
+	kstat_named_t *ks;
+	uint8_t *buf;
+	int i;
+
+	buf = kmem_alloc(SHA256_BENCH_SIZE, KM_SLEEP);
+	for (i = 0; i < SHA256_BENCH_SIZE; i++)
+		buf[i] = (uint8_t)((i * 2654435761U) >> 24);
+
+	for (i = 0; i < SHA256_NIMPLS; i++) {
+		const sha256_ops_t *ops = sha256_impls[i];
+
+		ks = &sha256_kstat_data[i];
+		ks->data_type = KSTAT_DATA_UINT64;
+		(void) strlcpy(ks->name, ops->name, KSTAT_STRLEN);
+		ks->value.ui64 = 0;
+
+		if (!ops->valid())
+			continue;
+
+		if (!sha256_verify(ops, NULL, buf)) {
+			cmn_err(CE_WARN, "sha256 %s implementation "
+			    "returned incorrect results, disabled", ops->name);
+			continue;
+		}
+
+		rate = ks->value.ui64 = sha256_bench(ops, NULL, buf);
+		if (rate > fastest_rate) {
+			fastest_rate = rate;
+			fastest = ops;
+		}
+	}
+
+	/* a multi-buffer function must beat the fastest single buffer one */
+	for (i = 0; i < SHA256_MB_NIMPLS; i++) {
+		const sha256_mb_ops_t *mb = sha256_mb_impls[i];
+
+		ks = &sha256_kstat_data[SHA256_NIMPLS + i];
+		ks->data_type = KSTAT_DATA_UINT64;
+		(void) snprintf(ks->name, KSTAT_STRLEN, "%s_mb", mb->name);
+		ks->value.ui64 = 0;
+
+		if (!mb->valid())
+			continue;
+
+		if (!sha256_verify(fastest, mb, buf)) {
+			cmn_err(CE_WARN, "sha256 %s multi-buffer "
+			    "implementation returned incorrect results, "
+			    "disabled", mb->name);
+			continue;
+		}
+
+		rate = ks->value.ui64 = sha256_bench(fastest, mb, buf);
+		if (rate > fastest_rate) {
+			fastest_rate = rate;
+			mb_fastest = mb;
+		}
+	}
+
+	kmem_free(buf, SHA256_BENCH_SIZE);
+
+	sha256_fastest = fastest;
+	if (!sha256_impl_user)
+		sha256_impl = fastest;
+	sha256_mb_fastest = mb_fastest;
+	if (!sha256_mb_impl_user)
+		sha256_mb_impl = mb_fastest;
+
+	ks = &sha256_kstat_data[SHA256_NSTATS - 2];
+	ks[0].data_type = ks[1].data_type = KSTAT_DATA_CHAR;
+	(void) strlcpy(ks[0].name, "selected", KSTAT_STRLEN);
+	(void) strlcpy(ks[1].name, "selected_mb", KSTAT_STRLEN);
+
+	sha256_ksp = kstat_create("zfs", 0, "sha256_bench", "misc",
+	    KSTAT_TYPE_NAMED, 0, KSTAT_FLAG_VIRTUAL);
+	if (sha256_ksp != NULL) {
+		sha256_ksp->ks_data = sha256_kstat_data;
+		sha256_ksp->ks_ndata = SHA256_NSTATS;
+		sha256_ksp->ks_data_size = sizeof (sha256_kstat_data);
+		sha256_ksp->ks_update = sha256_kstat_update;
+		kstat_install(sha256_ksp);
+	}
+}
+
+void
+sha256_fini(void)
+{
+	if (sha256_ksp != NULL) {
+		kstat_delete(sha256_ksp);
+		sha256_ksp = NULL;
+	}
+
+	sha256_impl = sha256_fastest = &sha256_generic_ops;
+	sha256_impl_user = B_FALSE;
+	sha256_mb_impl = sha256_mb_fastest = NULL;
+	sha256_mb_impl_user = B_FALSE;
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+static int
+sha256_impl_param_set(const char *val, struct kernel_param *kp)
+{
+	return (-sha256_impl_set(val));
+}
+
+static int
+sha256_impl_param_get(char *buffer, struct kernel_param *kp)
+{
+	int i, cnt = 0;
+
+	cnt += sprintf(buffer + cnt, sha256_impl_user ?
+	    "fastest " : "[fastest] ");
+	for (i = 0; i < SHA256_NIMPLS; i++) {
+		const sha256_ops_t *ops = sha256_impls[i];
+
+		if (!ops->valid())
+			continue;
+		cnt += sprintf(buffer + cnt,
+		    (sha256_impl_user && ops == sha256_impl) ?
+		    "[%s] " : "%s ", ops->name);
+	}
+
+	return (cnt);
+}
+
+static int
+sha256_mb_impl_param_set(const char *val, struct kernel_param *kp)
+{
+	return (-sha256_mb_impl_set(val));
+}
+
+static int
+sha256_mb_impl_param_get(char *buffer, struct kernel_param *kp)
+{
+	int i, cnt = 0;
+
+	cnt += sprintf(buffer + cnt, sha256_mb_impl_user ?
+	    "fastest " : "[fastest] ");
+	cnt += sprintf(buffer + cnt, (sha256_mb_impl_user &&
+	    sha256_mb_impl == NULL) ? "[off] " : "off ");
+	for (i = 0; i < SHA256_MB_NIMPLS; i++) {
+		const sha256_mb_ops_t *mb = sha256_mb_impls[i];
+
+		if (!mb->valid())
+			continue;
+		cnt += sprintf(buffer + cnt,
+		    (sha256_mb_impl_user && mb == sha256_mb_impl) ?
+		    "[%s] " : "%s ", mb->name);
+	}
+
+	return (cnt);
+}
+
+module_param_call(zfs_sha256_impl, sha256_impl_param_set,
+    sha256_impl_param_get, NULL, 0644);
+MODULE_PARM_DESC(zfs_sha256_impl, "Select SHA-256 implementation");
+
+module_param_call(zfs_sha256_mb_impl, sha256_mb_impl_param_set,
+    sha256_mb_impl_param_get, NULL, 0644);
+MODULE_PARM_DESC(zfs_sha256_mb_impl,
+    "Select multi-buffer SHA-256 implementation");
+#endif
@@ -0,0 +1,202 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Multi-buffer SHA-256 using AVX2.  Each 32-bit lane of a %ymm register
+ * belongs to a different message, so eight independent blocks are
+ * compressed by one pass of the round function.  The working variables
+ * a-h live in %ymm0-%ymm7 and the sixteen word message schedule, already
+ * transposed into lane order, in a small buffer on the stack which is
+ * rewritten in place for each further group of sixteen rounds.
+ */
+
+#if defined(__x86_64) && defined(HAVE_AVX2)
+
+#include <sys/types.h>
+#include <sys/sha256.h>
+#include <linux/simd_x86.h>
+
+/* x ^= ror(v, n), where m = 32 - n, using %ymm10 as scratch */
+#define	AVX2_XOR_ROR(v, n, m, x)					\
+	"vpsrld	$" n ", " v ", %%ymm10\n"				\
+	"vpxor	%%ymm10, " x ", " x "\n"				\
+	"vpslld	$" m ", " v ", %%ymm10\n"				\
+	"vpxor	%%ymm10, " x ", " x "\n"
+
+/*
+ * One round: T1 = h + SIGMA1(e) + Ch(e, f, g) + K[t] + W[t] is added to
+ * d, and h becomes T1 + SIGMA0(a) + Maj(a, b, c).  The caller renames
+ * the registers rather than moving the variables along.
+ */
+#define	AVX2_ROUND(a, b, c, d, e, f, g, h, koff, woff)			\
+	"vpxor	%%ymm8, %%ymm8, %%ymm8\n"				\
+	AVX2_XOR_ROR("%%" e, "6", "26", "%%ymm8")			\
+	AVX2_XOR_ROR("%%" e, "11", "21", "%%ymm8")			\
+	AVX2_XOR_ROR("%%" e, "25", "7", "%%ymm8")			\
+	"vpxor	%%" g ", %%" f ", %%ymm9\n"				\
+	"vpand	%%" e ", %%ymm9, %%ymm9\n"				\
+	"vpxor	%%" g ", %%ymm9, %%ymm9\n"				\
+	"vpaddd	%%ymm9, %%ymm8, %%ymm8\n"				\
+	"vpaddd	%%" h ", %%ymm8, %%ymm8\n"				\
+	"vpbroadcastd " koff "(%[k]), %%ymm9\n"			\
+	"vpaddd	%%ymm9, %%ymm8, %%ymm8\n"				\
+	"vpaddd	" woff "(%[w]), %%ymm8, %%ymm8\n"			\
+	"vpaddd	%%ymm8, %%" d ", %%" d "\n"				\
+	"vpxor	%%ymm9, %%ymm9, %%ymm9\n"				\
+	AVX2_XOR_ROR("%%" a, "2", "30", "%%ymm9")			\
+	AVX2_XOR_ROR("%%" a, "13", "19", "%%ymm9")			\
+	AVX2_XOR_ROR("%%" a, "22", "10", "%%ymm9")			\
+	"vpaddd	%%ymm9, %%ymm8, %%ymm8\n"				\
+	"vpxor	%%" a ", %%" b ", %%ymm9\n"				\
+	"vpand	%%" c ", %%ymm9, %%ymm9\n"				\
+	"vpand	%%" a ", %%" b ", %%ymm10\n"				\
+	"vpxor	%%ymm10, %%ymm9, %%ymm9\n"				\
+	"vpaddd	%%ymm9, %%ymm8, %%" h "\n"
+
+/*
+ * W[t] = sigma1(W[t - 2]) + W[t - 7] + sigma0(W[t - 15]) + W[t - 16],
+ * with the sixteen entry schedule at byte offsets w, w1, w9 and w14
+ * holding W[t - 16], W[t - 15], W[t - 7] and W[t - 2].
+ */
+#define	AVX2_SCHEDULE(w, w1, w9, w14)					\
+	"vmovdqu " w1 "(%[w]), %%ymm8\n"				\
+	"vpsrld	$3, %%ymm8, %%ymm9\n"					\
+	AVX2_XOR_ROR("%%ymm8", "7", "25", "%%ymm9")			\
+	AVX2_XOR_ROR("%%ymm8", "18", "14", "%%ymm9")			\
+	"vmovdqu " w14 "(%[w]), %%ymm8\n"				\
+	"vpsrld	$10, %%ymm8, %%ymm11\n"					\
+	AVX2_XOR_ROR("%%ymm8", "17", "15", "%%ymm11")			\
+	AVX2_XOR_ROR("%%ymm8", "19", "13", "%%ymm11")			\
+	"vpaddd	%%ymm11, %%ymm9, %%ymm9\n"				\
+	"vpaddd	" w9 "(%[w]), %%ymm9, %%ymm9\n"				\
+	"vpaddd	" w "(%[w]), %%ymm9, %%ymm9\n"				\
+	"vmovdqu %%ymm9, " w "(%[w])\n"
+
+#define	AVX2_STATE(op)							\
+	op("0", "ymm0") op("32", "ymm1") op("64", "ymm2")		\
+	op("96", "ymm3") op("128", "ymm4") op("160", "ymm5")		\
+	op("192", "ymm6") op("224", "ymm7")
+
+#define	AVX2_LOAD(off, r)	"vmovdqu " off "(%[H]), %%" r "\n"
+#define	AVX2_ADD(off, r)	"vpaddd " off "(%[H]), %%" r ", %%" r "\n"
+#define	AVX2_STORE(off, r)	"vmovdqu %%" r ", " off "(%[H])\n"
+
+static void
+sha256_avx2_mb_transform(uint32_t *H, const uint8_t **data, uint64_t nblocks)
+{
+	uint32_t W[16 * SHA256_MB_LANES];
+	const uint8_t *cp;
+	const uint32_t *k;
+	uint64_t b, n;
+	int t, l;
+
+	kfpu_begin();
+	for (b = 0; b < nblocks; b++) {
+		for (l = 0; l < SHA256_MB_LANES; l++) {
+			cp = data[l] + b * SHA256_BLOCK_SIZE;
+			for (t = 0; t < 16; t++, cp += 4) {
+				W[t * SHA256_MB_LANES + l] = (cp[0] << 24) |
+				    (cp[1] << 16) | (cp[2] << 8) | cp[3];
+			}
+		}
+
+		__asm__ __volatile__(
+		    AVX2_STATE(AVX2_LOAD)
+		    "mov	%[K], %[k]\n"
+		    "mov	$4, %[n]\n"
+		    "1:\n"
+		    AVX2_ROUND("ymm0", "ymm1", "ymm2", "ymm3",
+		    "ymm4", "ymm5", "ymm6", "ymm7", "0", "0")
+		    AVX2_ROUND("ymm7", "ymm0", "ymm1", "ymm2",
+		    "ymm3", "ymm4", "ymm5", "ymm6", "4", "32")
+		    AVX2_ROUND("ymm6", "ymm7", "ymm0", "ymm1",
+		    "ymm2", "ymm3", "ymm4", "ymm5", "8", "64")
+		    AVX2_ROUND("ymm5", "ymm6", "ymm7", "ymm0",
+		    "ymm1", "ymm2", "ymm3", "ymm4", "12", "96")
+		    AVX2_ROUND("ymm4", "ymm5", "ymm6", "ymm7",
+		    "ymm0", "ymm1", "ymm2", "ymm3", "16", "128")
+		    AVX2_ROUND("ymm3", "ymm4", "ymm5", "ymm6",
+		    "ymm7", "ymm0", "ymm1", "ymm2", "20", "160")
+		    AVX2_ROUND("ymm2", "ymm3", "ymm4", "ymm5",
+		    "ymm6", "ymm7", "ymm0", "ymm1", "24", "192")
+		    AVX2_ROUND("ymm1", "ymm2", "ymm3", "ymm4",
+		    "ymm5", "ymm6", "ymm7", "ymm0", "28", "224")
+		    AVX2_ROUND("ymm0", "ymm1", "ymm2", "ymm3",
+		    "ymm4", "ymm5", "ymm6", "ymm7", "32", "256")
+		    AVX2_ROUND("ymm7", "ymm0", "ymm1", "ymm2",
+		    "ymm3", "ymm4", "ymm5", "ymm6", "36", "288")
+		    AVX2_ROUND("ymm6", "ymm7", "ymm0", "ymm1",
+		    "ymm2", "ymm3", "ymm4", "ymm5", "40", "320")
+		    AVX2_ROUND("ymm5", "ymm6", "ymm7", "ymm0",
+		    "ymm1", "ymm2", "ymm3", "ymm4", "44", "352")
+		    AVX2_ROUND("ymm4", "ymm5", "ymm6", "ymm7",
+		    "ymm0", "ymm1", "ymm2", "ymm3", "48", "384")
+		    AVX2_ROUND("ymm3", "ymm4", "ymm5", "ymm6",
+		    "ymm7", "ymm0", "ymm1", "ymm2", "52", "416")
+		    AVX2_ROUND("ymm2", "ymm3", "ymm4", "ymm5",
+		    "ymm6", "ymm7", "ymm0", "ymm1", "56", "448")
+		    AVX2_ROUND("ymm1", "ymm2", "ymm3", "ymm4",
+		    "ymm5", "ymm6", "ymm7", "ymm0", "60", "480")
+		    "add	$64, %[k]\n"
+		    "dec	%[n]\n"
+		    "jz	2f\n"
+		    AVX2_SCHEDULE("0", "32", "288", "448")
+		    AVX2_SCHEDULE("32", "64", "320", "480")
+		    AVX2_SCHEDULE("64", "96", "352", "0")
+		    AVX2_SCHEDULE("96", "128", "384", "32")
+		    AVX2_SCHEDULE("128", "160", "416", "64")
+		    AVX2_SCHEDULE("160", "192", "448", "96")
+		    AVX2_SCHEDULE("192", "224", "480", "128")
+		    AVX2_SCHEDULE("224", "256", "0", "160")
+		    AVX2_SCHEDULE("256", "288", "32", "192")
+		    AVX2_SCHEDULE("288", "320", "64", "224")
+		    AVX2_SCHEDULE("320", "352", "96", "256")
+		    AVX2_SCHEDULE("352", "384", "128", "288")
+		    AVX2_SCHEDULE("384", "416", "160", "320")
+		    AVX2_SCHEDULE("416", "448", "192", "352")
+		    AVX2_SCHEDULE("448", "480", "224", "384")
+		    AVX2_SCHEDULE("480", "0", "256", "416")
+		    "jmp	1b\n"
+		    "2:\n"
+		    AVX2_STATE(AVX2_ADD)
+		    AVX2_STATE(AVX2_STORE)
+		    "vzeroupper\n"
+		    : [k] "=&r" (k), [n] "=&r" (n)
+		    : [H] "r" (H), [w] "r" (W), [K] "r" (SHA256_K)
+		    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4",
+		    "xmm5", "xmm6", "xmm7", "xmm8", "xmm9", "xmm10", "xmm11");
+	}
+	kfpu_end();
+}
+
+static boolean_t
+sha256_avx2_mb_valid(void)
+{
+	return (zfs_avx2_available());
+}
+
+const sha256_mb_ops_t sha256_avx2_mb_ops = {
+	.transform = sha256_avx2_mb_transform,
+	.valid = sha256_avx2_mb_valid,
+	.name = "avx2"
+};
+
+#endif /* __x86_64 && HAVE_AVX2 */
@@ -0,0 +1,139 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SHA-256 compression using the Intel SHA extensions.  The state is kept
+ * as ABEF in %xmm1 and CDGH in %xmm2, the order sha256rnds2 wants, and
+ * the message schedule rotates through %xmm3-%xmm6 four words at a time.
+ * Each sha256rnds2 performs two rounds with the message plus constant
+ * words taken from the low half of %xmm0.
+ */
+
+#if defined(__x86_64) && defined(HAVE_SHA_NI)
+
+#include <sys/types.h>
+#include <sys/sha256.h>
+#include <linux/simd_x86.h>
+
+static const uint8_t sha256_shani_flip[16] = {
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+
+/* four rounds with the message words in w, advancing the constants */
+#define	SHANI_ROUNDS4(w)						\
+	"movdqu	(%[k]), %%xmm0\n"					\
+	"paddd	%%" w ", %%xmm0\n"					\
+	"sha256rnds2 %%xmm0, %%xmm1, %%xmm2\n"				\
+	"pshufd	$0x0e, %%xmm0, %%xmm0\n"				\
+	"sha256rnds2 %%xmm0, %%xmm2, %%xmm1\n"				\
+	"add	$16, %[k]\n"
+
+/* w0 = W[t - 16 .. t - 13] becomes W[t .. t + 3] */
+#define	SHANI_SCHEDULE(w0, w1, w2, w3)					\
+	"sha256msg1 %%" w1 ", %%" w0 "\n"				\
+	"movdqa	%%" w3 ", %%xmm7\n"					\
+	"palignr $4, %%" w2 ", %%xmm7\n"				\
+	"paddd	%%xmm7, %%" w0 "\n"					\
+	"sha256msg2 %%" w3 ", %%" w0 "\n"
+
+static void
+sha256_shani_transform(uint32_t *H, const void *buf, uint64_t nblocks)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + nblocks * SHA256_BLOCK_SIZE;
+	const uint32_t *k;
+	uint64_t n;
+
+	if (nblocks == 0)
+		return;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "movdqu	(%[flip]), %%xmm8\n"
+	    "movdqu	0(%[H]), %%xmm1\n"
+	    "movdqu	16(%[H]), %%xmm2\n"
+	    "pshufd	$0xb1, %%xmm1, %%xmm1\n"
+	    "pshufd	$0x1b, %%xmm2, %%xmm2\n"
+	    "movdqa	%%xmm1, %%xmm7\n"
+	    "palignr $8, %%xmm2, %%xmm1\n"
+	    "pblendw $0xf0, %%xmm7, %%xmm2\n"
+	    "1:\n"
+	    "movdqa	%%xmm1, %%xmm9\n"
+	    "movdqa	%%xmm2, %%xmm10\n"
+	    "mov	%[K], %[k]\n"
+	    "movdqu	0(%[ip]), %%xmm3\n"
+	    "pshufb	%%xmm8, %%xmm3\n"
+	    "movdqu	16(%[ip]), %%xmm4\n"
+	    "pshufb	%%xmm8, %%xmm4\n"
+	    "movdqu	32(%[ip]), %%xmm5\n"
+	    "pshufb	%%xmm8, %%xmm5\n"
+	    "movdqu	48(%[ip]), %%xmm6\n"
+	    "pshufb	%%xmm8, %%xmm6\n"
+	    SHANI_ROUNDS4("xmm3")
+	    SHANI_ROUNDS4("xmm4")
+	    SHANI_ROUNDS4("xmm5")
+	    SHANI_ROUNDS4("xmm6")
+	    "mov	$3, %[n]\n"
+	    "2:\n"
+	    SHANI_SCHEDULE("xmm3", "xmm4", "xmm5", "xmm6")
+	    SHANI_ROUNDS4("xmm3")
+	    SHANI_SCHEDULE("xmm4", "xmm5", "xmm6", "xmm3")
+	    SHANI_ROUNDS4("xmm4")
+	    SHANI_SCHEDULE("xmm5", "xmm6", "xmm3", "xmm4")
+	    SHANI_ROUNDS4("xmm5")
+	    SHANI_SCHEDULE("xmm6", "xmm3", "xmm4", "xmm5")
+	    SHANI_ROUNDS4("xmm6")
+	    "dec	%[n]\n"
+	    "jnz	2b\n"
+	    "paddd	%%xmm9, %%xmm1\n"
+	    "paddd	%%xmm10, %%xmm2\n"
+	    "add	$64, %[ip]\n"
+	    "cmp	%[end], %[ip]\n"
+	    "jb	1b\n"
+	    "pshufd	$0x1b, %%xmm1, %%xmm1\n"
+	    "pshufd	$0xb1, %%xmm2, %%xmm2\n"
+	    "movdqa	%%xmm1, %%xmm7\n"
+	    "pblendw $0xf0, %%xmm2, %%xmm1\n"
+	    "palignr $8, %%xmm7, %%xmm2\n"
+	    "movdqu	%%xmm1, 0(%[H])\n"
+	    "movdqu	%%xmm2, 16(%[H])\n"
+	    : [ip] "+r" (ip), [k] "=&r" (k), [n] "=&r" (n)
+	    : [H] "r" (H), [end] "r" (ipend), [K] "r" (SHA256_K),
+	    [flip] "r" (sha256_shani_flip)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+	    "xmm6", "xmm7", "xmm8", "xmm9", "xmm10");
+	kfpu_end();
+}
+
+static boolean_t
+sha256_shani_valid(void)
+{
+	return (zfs_shani_available() && zfs_ssse3_available() &&
+	    zfs_sse4_1_available());
+}
+
+const sha256_ops_t sha256_shani_ops = {
+	.transform = sha256_shani_transform,
+	.valid = sha256_shani_valid,
+	.name = "shani"
+};
+
+#endif /* __x86_64 && HAVE_SHA_NI */
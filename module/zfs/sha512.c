@@ -0,0 +1,183 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/sha512.h>
+
+/*
+ * SHA-512/256 checksum, as specified in FIPS 180-4, available at:
+ * http://csrc.nist.gov/publications/PubsFIPS.html
+ *
+ * SHA-512 works on 64-bit words and runs 80 rounds over 128 byte blocks,
+ * so on 64-bit processors it hashes noticeably faster than SHA-256.  The
+ * SHA-512/256 variant starts from its own initial values and keeps only
+ * the first 256 bits of the result, which exactly fills a zio_cksum_t.
+ */
+
+#define	Ch(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define	Maj(x, y, z)	(((x) & (y)) ^ ((z) & ((x) ^ (y))))
+#define	Rot64(x, s)	(((x) >> s) | ((x) << (64 - s)))
+#define	SIGMA0(x)	(Rot64(x, 28) ^ Rot64(x, 34) ^ Rot64(x, 39))
+#define	SIGMA1(x)	(Rot64(x, 14) ^ Rot64(x, 18) ^ Rot64(x, 41))
+#define	sigma0(x)	(Rot64(x, 1) ^ Rot64(x, 8) ^ ((x) >> 7))
+#define	sigma1(x)	(Rot64(x, 19) ^ Rot64(x, 61) ^ ((x) >> 6))
+
+static const uint64_t SHA512_K[80] = {
+	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
+	0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+	0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+	0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+	0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+	0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
+	0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+	0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+	0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+	0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
+	0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
+	0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+	0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+	0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+	0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
+	0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
+	0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+	0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+	0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+	0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
+	0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+	0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+	0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+	0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+	0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
+	0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
+	0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+	0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+	0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+	0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+	0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
+	0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+	0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+	0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+static const uint64_t SHA512_256_H0[8] = {
+	0x22312194fc2bf72cULL, 0x9f555fa3c84c64c2ULL,
+	0x2393b86b6f53b151ULL, 0x963877195940eabdULL,
+	0x96283ee2a88effe3ULL, 0xbe5e1e2553863992ULL,
+	0x2b0199fc2c85b8aaULL, 0x0eb72ddc81c52ca2ULL
+};
+
+static void
+SHA512Transform(uint64_t *H, const uint8_t *cp)
+{
+	uint64_t a, b, c, d, e, f, g, h, T1, T2, W[80];
+	int t;
+
+	for (t = 0; t < 16; t++, cp += 8) {
+		bcopy(cp, &W[t], sizeof (uint64_t));
+		W[t] = BE_64(W[t]);
+	}
+
+	for (t = 16; t < 80; t++)
+		W[t] = sigma1(W[t - 2]) + W[t - 7] +
+		    sigma0(W[t - 15]) + W[t - 16];
+
+	a = H[0]; b = H[1]; c = H[2]; d = H[3];
+	e = H[4]; f = H[5]; g = H[6]; h = H[7];
+
+	for (t = 0; t < 80; t++) {
+		T1 = h + SIGMA1(e) + Ch(e, f, g) + SHA512_K[t] + W[t];
+		T2 = SIGMA0(a) + Maj(a, b, c);
+		h = g; g = f; f = e; e = d + T1;
+		d = c; c = b; b = a; a = T1 + T2;
+	}
+
+	H[0] += a; H[1] += b; H[2] += c; H[3] += d;
+	H[4] += e; H[5] += f; H[6] += g; H[7] += h;
+}
+
+void
+sha512_256_init(sha512_ctx_t *ctx)
+{
+	bcopy(SHA512_256_H0, ctx->sc_H, sizeof (ctx->sc_H));
+	ctx->sc_count = 0;
+}
+
+void
+sha512_update(sha512_ctx_t *ctx, const void *buf, size_t size)
+{
+	const uint8_t *cp = buf;
+	size_t used = ctx->sc_count % SHA512_BLOCK_SIZE;
+	size_t n;
+
+	ctx->sc_count += size;
+
+	if (used != 0) {
+		n = MIN(size, SHA512_BLOCK_SIZE - used);
+		bcopy(cp, ctx->sc_buf + used, n);
+		cp += n;
+		size -= n;
+		if (used + n < SHA512_BLOCK_SIZE)
+			return;
+		SHA512Transform(ctx->sc_H, ctx->sc_buf);
+	}
+
+	for (; size >= SHA512_BLOCK_SIZE; size -= SHA512_BLOCK_SIZE,
+	    cp += SHA512_BLOCK_SIZE)
+		SHA512Transform(ctx->sc_H, cp);
+
+	if (size != 0)
+		bcopy(cp, ctx->sc_buf, size);
+}
+
+/*
+ * Pad the message and store the 32 byte digest, in the usual big-endian
+ * byte order, at digest.
+ */
+void
+sha512_256_final(sha512_ctx_t *ctx, void *digest)
+{
+	uint8_t *out = digest;
+	size_t used = ctx->sc_count % SHA512_BLOCK_SIZE;
+	uint64_t bits = ctx->sc_count << 3;
+	int i;
+
+	ctx->sc_buf[used++] = 0x80;
+	if (used > SHA512_BLOCK_SIZE - 16) {
+		bzero(ctx->sc_buf + used, SHA512_BLOCK_SIZE - used);
+		SHA512Transform(ctx->sc_H, ctx->sc_buf);
+		used = 0;
+	}
+
+	/* The high 64 bits of the 128-bit message length are always zero */
+	bzero(ctx->sc_buf + used, SHA512_BLOCK_SIZE - 8 - used);
+	for (i = 0; i < 8; i++)
+		ctx->sc_buf[SHA512_BLOCK_SIZE - 1 - i] = bits >> (8 * i);
+	SHA512Transform(ctx->sc_H, ctx->sc_buf);
+
+	for (i = 0; i < SHA512_256_DIGEST_SIZE; i++)
+		out[i] = ctx->sc_H[i / 8] >> (56 - 8 * (i % 8));
+}
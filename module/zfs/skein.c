@@ -0,0 +1,236 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/skein.h>
+
+/*
+ * Skein-512 hash function, version 1.3, as specified in "The Skein Hash
+ * Function Family", available at: http://www.skein-hash.info/
+ *
+ * Skein chains the Threefish-512 tweakable block cipher through Unique
+ * Block Iteration (UBI): each 64 byte block is encrypted under the
+ * chaining value, with a tweak holding the number of bytes processed so
+ * far and the type of the data, and the result is xored with the block to
+ * give the next chaining value.  An optional key is hashed first and the
+ * output length is bound in by a configuration block, after which the
+ * message and finally an output counter are put through UBI.
+ */
+
+#define	SKEIN_KS_PARITY		0x1bd11bdaa9fc1a22ULL
+#define	SKEIN_SCHEMA_VER	0x0000000133414853ULL	/* "SHA3", v1 */
+#define	SKEIN_CFG_STR_LEN	32
+
+#define	SKEIN_T1_FIRST		(1ULL << 62)
+#define	SKEIN_T1_FINAL		(1ULL << 63)
+#define	SKEIN_T1_TYPE(t)	((uint64_t)(t) << 56)
+
+#define	SKEIN_TYPE_KEY		0
+#define	SKEIN_TYPE_CFG		4
+#define	SKEIN_TYPE_MSG		48
+#define	SKEIN_TYPE_OUT		63
+
+#define	RotL64(x, s)	(((x) << (s)) | ((x) >> (64 - (s))))
+
+/* One Threefish-512 round: four MIX operations on the given word pairs */
+#define	R512(p0, p1, p2, p3, p4, p5, p6, p7, r0, r1, r2, r3)		\
+	X##p0 += X##p1; X##p1 = RotL64(X##p1, r0) ^ X##p0;		\
+	X##p2 += X##p3; X##p3 = RotL64(X##p3, r1) ^ X##p2;		\
+	X##p4 += X##p5; X##p5 = RotL64(X##p5, r2) ^ X##p4;		\
+	X##p6 += X##p7; X##p7 = RotL64(X##p7, r3) ^ X##p6;
+
+/* Inject subkey s */
+#define	I512(s)								\
+	X0 += ks[((s) + 0) % 9];					\
+	X1 += ks[((s) + 1) % 9];					\
+	X2 += ks[((s) + 2) % 9];					\
+	X3 += ks[((s) + 3) % 9];					\
+	X4 += ks[((s) + 4) % 9];					\
+	X5 += ks[((s) + 5) % 9] + ts[((s) + 0) % 3];			\
+	X6 += ks[((s) + 6) % 9] + ts[((s) + 1) % 3];			\
+	X7 += ks[((s) + 7) % 9] + (s);
+
+/*
+ * Eight rounds and the two subkey injections following them.  The word
+ * permutation between rounds is folded into the choice of MIX pairs.
+ */
+#define	R512_8(s)							\
+	R512(0, 1, 2, 3, 4, 5, 6, 7, 46, 36, 19, 37)			\
+	R512(2, 1, 4, 7, 6, 5, 0, 3, 33, 27, 14, 42)			\
+	R512(4, 1, 6, 3, 0, 5, 2, 7, 17, 49, 36, 39)			\
+	R512(6, 1, 0, 7, 2, 5, 4, 3, 44, 9, 54, 56)			\
+	I512(s)								\
+	R512(0, 1, 2, 3, 4, 5, 6, 7, 39, 30, 34, 24)			\
+	R512(2, 1, 4, 7, 6, 5, 0, 3, 13, 50, 10, 17)			\
+	R512(4, 1, 6, 3, 0, 5, 2, 7, 25, 29, 39, 43)			\
+	R512(6, 1, 0, 7, 2, 5, 4, 3, 8, 35, 56, 22)			\
+	I512((s) + 1)
+
+/*
+ * Put nblocks blocks through UBI, advancing the tweak position by bcnt
+ * bytes per block.  Only the first block of a stage has SKEIN_T1_FIRST.
+ */
+static void
+skein_512_process(skein_ctx_t *ctx, const uint8_t *cp, size_t nblocks,
+    size_t bcnt)
+{
+	uint64_t X0, X1, X2, X3, X4, X5, X6, X7;
+	uint64_t ks[9], ts[3], w[8];
+	int i;
+
+	for (; nblocks > 0; nblocks--, cp += SKEIN_512_BLOCK_SIZE) {
+		ctx->sc_T[0] += bcnt;
+
+		ks[8] = SKEIN_KS_PARITY;
+		for (i = 0; i < 8; i++) {
+			ks[i] = ctx->sc_X[i];
+			ks[8] ^= ks[i];
+			bcopy(cp + 8 * i, &w[i], sizeof (uint64_t));
+			w[i] = LE_64(w[i]);
+		}
+		ts[0] = ctx->sc_T[0];
+		ts[1] = ctx->sc_T[1];
+		ts[2] = ts[0] ^ ts[1];
+
+		X0 = w[0]; X1 = w[1]; X2 = w[2]; X3 = w[3];
+		X4 = w[4]; X5 = w[5]; X6 = w[6]; X7 = w[7];
+
+		I512(0)
+		R512_8(1)
+		R512_8(3)
+		R512_8(5)
+		R512_8(7)
+		R512_8(9)
+		R512_8(11)
+		R512_8(13)
+		R512_8(15)
+		R512_8(17)
+
+		ctx->sc_X[0] = X0 ^ w[0]; ctx->sc_X[1] = X1 ^ w[1];
+		ctx->sc_X[2] = X2 ^ w[2]; ctx->sc_X[3] = X3 ^ w[3];
+		ctx->sc_X[4] = X4 ^ w[4]; ctx->sc_X[5] = X5 ^ w[5];
+		ctx->sc_X[6] = X6 ^ w[6]; ctx->sc_X[7] = X7 ^ w[7];
+
+		ctx->sc_T[1] &= ~SKEIN_T1_FIRST;
+	}
+}
+
+static void
+skein_512_start(skein_ctx_t *ctx, int type)
+{
+	ctx->sc_T[0] = 0;
+	ctx->sc_T[1] = SKEIN_T1_FIRST | SKEIN_T1_TYPE(type);
+	ctx->sc_bcnt = 0;
+}
+
+/*
+ * Process the buffered tail of a stage as its final block.
+ */
+static void
+skein_512_finish(skein_ctx_t *ctx)
+{
+	ctx->sc_T[1] |= SKEIN_T1_FINAL;
+	bzero(ctx->sc_buf + ctx->sc_bcnt,
+	    SKEIN_512_BLOCK_SIZE - ctx->sc_bcnt);
+	skein_512_process(ctx, ctx->sc_buf, 1, ctx->sc_bcnt);
+}
+
+void
+skein_512_update(skein_ctx_t *ctx, const void *buf, size_t size)
+{
+	const uint8_t *cp = buf;
+	size_t n;
+
+	if (ctx->sc_bcnt + size > SKEIN_512_BLOCK_SIZE) {
+		if (ctx->sc_bcnt != 0) {
+			n = SKEIN_512_BLOCK_SIZE - ctx->sc_bcnt;
+			bcopy(cp, ctx->sc_buf + ctx->sc_bcnt, n);
+			cp += n;
+			size -= n;
+			skein_512_process(ctx, ctx->sc_buf, 1,
+			    SKEIN_512_BLOCK_SIZE);
+			ctx->sc_bcnt = 0;
+		}
+
+		/* Keep at least one byte back for the final block */
+		if (size > SKEIN_512_BLOCK_SIZE) {
+			n = (size - 1) / SKEIN_512_BLOCK_SIZE;
+			skein_512_process(ctx, cp, n, SKEIN_512_BLOCK_SIZE);
+			cp += n * SKEIN_512_BLOCK_SIZE;
+			size -= n * SKEIN_512_BLOCK_SIZE;
+		}
+	}
+
+	bcopy(cp, ctx->sc_buf + ctx->sc_bcnt, size);
+	ctx->sc_bcnt += size;
+}
+
+/*
+ * Start a Skein-512 hash with a 256-bit output, keyed with the keylen
+ * bytes at key if keylen is not zero.
+ */
+void
+skein_512_256_init(skein_ctx_t *ctx, const void *key, size_t keylen)
+{
+	uint64_t cfg[SKEIN_512_BLOCK_SIZE / 8];
+	int i, j;
+
+	bzero(ctx->sc_X, sizeof (ctx->sc_X));
+	if (keylen != 0) {
+		skein_512_start(ctx, SKEIN_TYPE_KEY);
+		skein_512_update(ctx, key, keylen);
+		skein_512_finish(ctx);
+	}
+
+	bzero(cfg, sizeof (cfg));
+	cfg[0] = SKEIN_SCHEMA_VER;
+	cfg[1] = SKEIN_512_256_DIGEST_SIZE * 8;
+	skein_512_start(ctx, SKEIN_TYPE_CFG);
+	for (i = 0; i < SKEIN_512_BLOCK_SIZE; i++) {
+		j = i / 8;
+		ctx->sc_buf[i] = cfg[j] >> (8 * (i % 8));
+	}
+	ctx->sc_bcnt = SKEIN_CFG_STR_LEN;
+	skein_512_finish(ctx);
+
+	skein_512_start(ctx, SKEIN_TYPE_MSG);
+}
+
+/*
+ * Finish the message and store the 32 byte digest at digest.
+ */
+void
+skein_512_256_final(skein_ctx_t *ctx, void *digest)
+{
+	uint8_t *out = digest;
+	int i;
+
+	skein_512_finish(ctx);
+
+	/* A single output block, with counter 0, covers 256 bits */
+	skein_512_start(ctx, SKEIN_TYPE_OUT);
+	bzero(ctx->sc_buf, sizeof (ctx->sc_buf));
+	ctx->sc_bcnt = sizeof (uint64_t);
+	skein_512_finish(ctx);
+
+	for (i = 0; i < SKEIN_512_256_DIGEST_SIZE; i++)
+		out[i] = ctx->sc_X[i / 8] >> (8 * (i % 8));
+}
@@ -139,12 +139,27 @@ static inline int spa_load_impl(spa_t *spa, uint64_t, nvlist_t *config,
     spa_load_state_t state, spa_import_type_t type, boolean_t mosconfig,
     char **ereport);
 static void spa_vdev_resilver_done(spa_t *spa);
+static void spa_trim_batch_wait(spa_t *spa);
+static void spa_trim_batch_done(zio_t *zio);
+static void spa_trim_wait_group(spa_t *spa, metaslab_group_t *mg);
+
+extern int zfs_trim_txg_delay;
 
 uint_t		zio_taskq_batch_pct = 100;	/* 1 thread per cpu in pset */
 id_t		zio_taskq_psrset_bind = PS_NONE;
 boolean_t	zio_taskq_sysdc = B_TRUE;	/* use SDC scheduling class */
 uint_t		zio_taskq_basedc = 80;		/* base duty cycle */
 
+/*
+ * When zio_taskq_percpu is non-zero every multi-threaded zio taskq is
+ * replicated, one copy for each group of zio_taskq_percpu CPUs, and
+ * tasks are dispatched to the copy for the CPU doing the dispatch.
+ * Setting it to 1 gives per-CPU taskqs, setting it to the number of
+ * CPUs in a NUMA node gives roughly per-node taskqs.  Only pools
+ * activated after it is changed are affected.
+ */
+uint_t		zio_taskq_percpu = 0;
+
 boolean_t	spa_create_process = B_TRUE;	/* no process ==> no sysdc */
 
 /*
@@ -818,10 +833,13 @@ spa_taskqs_init(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 	uint_t value = ztip->zti_value;
 	uint_t count = ztip->zti_count;
 	spa_taskqs_t *tqs = &spa->spa_zio_taskq[t][q];
+	uint_t cpus = MIN(zio_taskq_percpu, max_ncpus);
 	char name[32];
 	uint_t i, flags = 0;
 	boolean_t batch = B_FALSE;
 
+	tqs->stqs_cpus = 0;
+
 	if (mode == ZTI_MODE_NULL) {
 		tqs->stqs_count = 0;
 		tqs->stqs_taskq = NULL;
@@ -830,6 +848,29 @@ spa_taskqs_init(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 
 	ASSERT3U(count, >, 0);
 
+	/*
+	 * Replicate the taskq for each group of CPUs, spreading the threads
+	 * the table asks for across the copies.  Single threaded taskqs are
+	 * left alone since they exist to serialize their tasks.
+	 */
+	if (cpus > 0 && !(mode == ZTI_MODE_FIXED && value * count == 1)) {
+		uint_t ncopies = howmany(max_ncpus, cpus);
+		uint_t threads;
+
+		if (mode == ZTI_MODE_FIXED)
+			threads = howmany(value * count, ncopies);
+		else if (mode == ZTI_MODE_BATCH)
+			threads = cpus * zio_taskq_batch_pct / 100;
+		else
+			threads = cpus * value / 100;
+
+		batch = (mode == ZTI_MODE_BATCH);
+		tqs->stqs_cpus = cpus;
+		count = ncopies;
+		mode = ZTI_MODE_FIXED;
+		value = MAX(threads, 1);
+	}
+
 	tqs->stqs_count = count;
 	tqs->stqs_taskq = kmem_alloc(count * sizeof (taskq_t *), KM_SLEEP);
 
@@ -882,6 +923,34 @@ spa_taskqs_init(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 	}
 }
 
+/*
+ * Choose the taskq to dispatch to.  Per-CPU taskqs are chosen by the CPU
+ * we are running on.  Otherwise a type may have multiple discrete taskqs
+ * to avoid lock contention on the taskq itself, in which case we choose
+ * one at random by using the low bits of gethrtime().
+ */
+static taskq_t *
+spa_taskq_select(spa_taskqs_t *tqs)
+{
+	uint_t i;
+
+	ASSERT3P(tqs->stqs_taskq, !=, NULL);
+	ASSERT3U(tqs->stqs_count, !=, 0);
+
+	if (tqs->stqs_count == 1)
+		return (tqs->stqs_taskq[0]);
+
+	if (tqs->stqs_cpus != 0) {
+		kpreempt_disable();
+		i = CPU_SEQID / tqs->stqs_cpus;
+		kpreempt_enable();
+	} else {
+		i = ((uint64_t)gethrtime()) % tqs->stqs_count;
+	}
+
+	return (tqs->stqs_taskq[i % tqs->stqs_count]);
+}
+
 static void
 spa_taskqs_fini(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 {
@@ -904,27 +973,13 @@ spa_taskqs_fini(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 
 /*
  * Dispatch a task to the appropriate taskq for the ZFS I/O type and priority.
- * Note that a type may have multiple discrete taskqs to avoid lock contention
- * on the taskq itself. In that case we choose which taskq at random by using
- * the low bits of gethrtime().
  */
 void
 spa_taskq_dispatch_ent(spa_t *spa, zio_type_t t, zio_taskq_type_t q,
     task_func_t *func, void *arg, uint_t flags, taskq_ent_t *ent)
 {
-	spa_taskqs_t *tqs = &spa->spa_zio_taskq[t][q];
-	taskq_t *tq;
-
-	ASSERT3P(tqs->stqs_taskq, !=, NULL);
-	ASSERT3U(tqs->stqs_count, !=, 0);
-
-	if (tqs->stqs_count == 1) {
-		tq = tqs->stqs_taskq[0];
-	} else {
-		tq = tqs->stqs_taskq[((uint64_t)gethrtime()) % tqs->stqs_count];
-	}
-
-	taskq_dispatch_ent(tq, func, arg, flags, ent);
+	taskq_dispatch_ent(spa_taskq_select(&spa->spa_zio_taskq[t][q]),
+	    func, arg, flags, ent);
 }
 
 /*
@@ -934,19 +989,9 @@ void
 spa_taskq_dispatch_sync(spa_t *spa, zio_type_t t, zio_taskq_type_t q,
     task_func_t *func, void *arg, uint_t flags)
 {
-	spa_taskqs_t *tqs = &spa->spa_zio_taskq[t][q];
-	taskq_t *tq;
+	taskq_t *tq = spa_taskq_select(&spa->spa_zio_taskq[t][q]);
 	taskqid_t id;
 
-	ASSERT3P(tqs->stqs_taskq, !=, NULL);
-	ASSERT3U(tqs->stqs_count, !=, 0);
-
-	if (tqs->stqs_count == 1) {
-		tq = tqs->stqs_taskq[0];
-	} else {
-		tq = tqs->stqs_taskq[((uint64_t)gethrtime()) % tqs->stqs_count];
-	}
-
 	id = taskq_dispatch(tq, func, arg, flags);
 	if (id)
 		taskq_wait_id(tq, id);
@@ -1034,6 +1079,45 @@ spa_thread(void *arg)
 }
 #endif
 
+static spa_trim_stats_t spa_trim_stats_template = {
+	{ "auto_extents",	KSTAT_DATA_UINT64 },
+	{ "auto_bytes",		KSTAT_DATA_UINT64 },
+	{ "manual_extents",	KSTAT_DATA_UINT64 },
+	{ "manual_bytes",	KSTAT_DATA_UINT64 },
+	{ "failed_extents",	KSTAT_DATA_UINT64 },
+	{ "failed_bytes",	KSTAT_DATA_UINT64 },
+};
+
+static void
+spa_trim_stats_create(spa_t *spa)
+{
+	char name[KSTAT_STRLEN];
+
+	bcopy(&spa_trim_stats_template, &spa->spa_trim_stats,
+	    sizeof (spa_trim_stats_t));
+
+	(void) snprintf(name, KSTAT_STRLEN, "trim-%s", spa_name(spa));
+	name[KSTAT_STRLEN-1] = '\0';
+
+	spa->spa_trim_ksp = kstat_create("zfs", 0, name, "misc",
+	    KSTAT_TYPE_NAMED, sizeof (spa_trim_stats_t) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+
+	if (spa->spa_trim_ksp != NULL) {
+		spa->spa_trim_ksp->ks_data = &spa->spa_trim_stats;
+		kstat_install(spa->spa_trim_ksp);
+	}
+}
+
+static void
+spa_trim_stats_destroy(spa_t *spa)
+{
+	if (spa->spa_trim_ksp != NULL) {
+		kstat_delete(spa->spa_trim_ksp);
+		spa->spa_trim_ksp = NULL;
+	}
+}
+
 /*
  * Activate an uninitialized pool.
  */
@@ -1097,6 +1181,8 @@ spa_activate(spa_t *spa, int mode)
 	avl_create(&spa->spa_errlist_last,
 	    spa_error_entry_compare, sizeof (spa_error_entry_t),
 	    offsetof(spa_error_entry_t, se_avl));
+
+	spa_trim_stats_create(spa);
 }
 
 /*
@@ -1120,6 +1206,8 @@ spa_deactivate(spa_t *spa)
 
 	taskq_cancel_id(system_taskq, spa->spa_deadman_tqid);
 
+	spa_trim_stats_destroy(spa);
+
 	for (t = 0; t < ZIO_TYPES; t++) {
 		for (q = 0; q < ZIO_TASKQ_TYPES; q++) {
 			spa_taskqs_fini(spa, t, q);
@@ -1233,13 +1321,26 @@ spa_unload(spa_t *spa)
 	spa_async_suspend(spa);
 
 	/*
-	 * Stop syncing.
+	 * Stop any "zpool trim" in progress.
+	 */
+	(void) spa_trim_stop(spa);
+
+	/*
+	 * Stop syncing.  The last txgs hand back the space held for
+	 * automatic discards, as they do the deferred frees.
 	 */
 	if (spa->spa_sync_on) {
+		spa->spa_trim_drain = B_TRUE;
 		txg_sync_stop(spa->spa_dsl_pool);
 		spa->spa_sync_on = B_FALSE;
+		spa->spa_trim_drain = B_FALSE;
 	}
 
+	/*
+	 * Wait for the last batch of automatic discards.
+	 */
+	spa_trim_batch_wait(spa);
+
 	/*
 	 * Wait for any outstanding async I/O to complete.
 	 */
@@ -1261,6 +1362,8 @@ spa_unload(spa_t *spa)
 
 	ddt_unload(spa);
 
+	zio_checksum_templates_free(spa);
+
 	spa_config_enter(spa, SCL_ALL, FTAG, RW_WRITER);
 
 	/*
@@ -1852,7 +1955,7 @@ spa_load_verify_done(zio_t *zio)
 		else
 			atomic_add_64(&sle->sle_data_count, 1);
 	}
-	zio_data_buf_free(zio->io_data, zio->io_size);
+	abd_free(zio->io_abd);
 }
 
 /*ARGSUSED*/
@@ -1863,7 +1966,7 @@ spa_load_verify_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 	if (bp != NULL) {
 		zio_t *rio = arg;
 		size_t size = BP_GET_PSIZE(bp);
-		void *data = zio_data_buf_alloc(size);
+		abd_t *data = abd_alloc_for_io(size, B_FALSE);
 
 		zio_nowait(zio_read(rio, spa, bp, data, size,
 		    spa_load_verify_done, rio->io_private, ZIO_PRIORITY_SCRUB,
@@ -2465,6 +2568,21 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 	if (error != 0 && error != ENOENT)
 		return (spa_vdev_err(rvd, VDEV_AUX_CORRUPT_DATA, EIO));
 
+	/*
+	 * Load the salt for salted checksums.  Pools created before it
+	 * existed get a new one, which is written out when a salted
+	 * checksum is first activated.
+	 */
+	error = zap_lookup(spa->spa_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_CHECKSUM_SALT, 1, sizeof (spa->spa_cksum_salt.zcs_bytes),
+	    spa->spa_cksum_salt.zcs_bytes);
+	if (error == ENOENT) {
+		(void) random_get_pseudo_bytes(spa->spa_cksum_salt.zcs_bytes,
+		    sizeof (spa->spa_cksum_salt.zcs_bytes));
+	} else if (error != 0) {
+		return (spa_vdev_err(rvd, VDEV_AUX_CORRUPT_DATA, EIO));
+	}
+
 	/*
 	 * Load the persistent error log.  If we have an older pool, this will
 	 * not be present.
@@ -3569,6 +3687,15 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 		cmn_err(CE_PANIC, "failed to add pool version");
 	}
 
+	(void) random_get_pseudo_bytes(spa->spa_cksum_salt.zcs_bytes,
+	    sizeof (spa->spa_cksum_salt.zcs_bytes));
+	if (zap_add(spa->spa_meta_objset,
+	    DMU_POOL_DIRECTORY_OBJECT, DMU_POOL_CHECKSUM_SALT,
+	    1, sizeof (spa->spa_cksum_salt.zcs_bytes),
+	    spa->spa_cksum_salt.zcs_bytes, tx) != 0) {
+		cmn_err(CE_PANIC, "failed to add checksum salt");
+	}
+
 	/* Newly created pools with the right version are always deflated. */
 	if (version >= SPA_VERSION_RAIDZ_DEFLATE) {
 		spa->spa_deflate = TRUE;
@@ -5313,6 +5440,15 @@ spa_vdev_remove(spa_t *spa, uint64_t guid, boolean_t unspare)
 		spa_vdev_config_exit(spa, NULL,
 		    txg + TXG_CONCURRENT_STATES + TXG_DEFER_SIZE, 0, FTAG);
 
+		/*
+		 * Let "zpool trim" finish with this vdev's metaslabs.  Then
+		 * let the last batch of automatic discards finish and sync,
+		 * so that the space it held is no longer allocated.
+		 */
+		spa_trim_wait_group(spa, mg);
+		spa_trim_batch_wait(spa);
+		txg_wait_synced(spa_get_dsl(spa), 0);
+
 		/*
 		 * Attempt to evacuate the vdev.
 		 */
@@ -5555,6 +5691,152 @@ spa_scan(spa_t *spa, pool_scan_func_t func)
 	return (dsl_scan(spa->spa_dsl_pool, func));
 }
 
+/*
+ * ==========================================================================
+ * SPA TRIM
+ * ==========================================================================
+ */
+
+static void
+spa_trim_batch_wait(spa_t *spa)
+{
+	mutex_enter(&spa->spa_trim_lock);
+	while (spa->spa_trim_batch)
+		cv_wait(&spa->spa_trim_cv, &spa->spa_trim_lock);
+	mutex_exit(&spa->spa_trim_lock);
+}
+
+static void
+spa_trim_batch_done(zio_t *zio)
+{
+	spa_t *spa = zio->io_spa;
+
+	spa_config_exit(spa, SCL_ZIO, zio);
+
+	mutex_enter(&spa->spa_trim_lock);
+	ASSERT(spa->spa_trim_batch);
+	spa->spa_trim_batch = B_FALSE;
+	cv_broadcast(&spa->spa_trim_cv);
+	mutex_exit(&spa->spa_trim_lock);
+}
+
+/*
+ * Wait until "zpool trim" is done with any metaslab of this group.  The
+ * group must already be passivated, which stops the trim of its current
+ * metaslab after one chunk and keeps the thread from starting another.
+ */
+static void
+spa_trim_wait_group(spa_t *spa, metaslab_group_t *mg)
+{
+	mutex_enter(&spa->spa_trim_lock);
+	while (spa->spa_trim_ms != NULL && spa->spa_trim_ms->ms_group == mg)
+		cv_wait(&spa->spa_trim_cv, &spa->spa_trim_lock);
+	mutex_exit(&spa->spa_trim_lock);
+}
+
+/*
+ * Discard the free space of every metaslab in the pool, one metaslab at a
+ * time.  The config lock is only held to pick the next metaslab, and
+ * metaslab_trim_all() takes it again just to issue each chunk, so devices
+ * can still be added, attached and removed while this runs.  The metaslab
+ * being trimmed is published in spa_trim_ms; removing a log device waits
+ * for it with spa_trim_wait_group() before freeing the vdev's metaslabs.
+ */
+static void
+spa_trim_thread(spa_t *spa)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+	uint64_t c = 0, m = 0;
+
+	while (!spa->spa_trim_stop) {
+		metaslab_t *msp;
+		vdev_t *vd;
+
+		spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+		if (c >= rvd->vdev_children) {
+			spa_config_exit(spa, SCL_CONFIG, FTAG);
+			break;
+		}
+
+		vd = rvd->vdev_child[c];
+		if (vd->vdev_ishole || vd->vdev_ms == NULL ||
+		    m >= vd->vdev_ms_count) {
+			spa_config_exit(spa, SCL_CONFIG, FTAG);
+			c++;
+			m = 0;
+			continue;
+		}
+
+		msp = vd->vdev_ms[m++];
+		if (vd->vdev_mg->mg_activation_count <= 0) {
+			spa_config_exit(spa, SCL_CONFIG, FTAG);
+			continue;
+		}
+
+		mutex_enter(&spa->spa_trim_lock);
+		spa->spa_trim_ms = msp;
+		mutex_exit(&spa->spa_trim_lock);
+		spa_config_exit(spa, SCL_CONFIG, FTAG);
+
+		metaslab_trim_all(msp, spa->spa_trim_rate, &spa->spa_trim_stop);
+
+		mutex_enter(&spa->spa_trim_lock);
+		spa->spa_trim_ms = NULL;
+		cv_broadcast(&spa->spa_trim_cv);
+		mutex_exit(&spa->spa_trim_lock);
+	}
+
+	mutex_enter(&spa->spa_trim_lock);
+	spa->spa_trim_thread = NULL;
+	cv_broadcast(&spa->spa_trim_cv);
+	mutex_exit(&spa->spa_trim_lock);
+
+	thread_exit();
+}
+
+/*
+ * Start discarding all free space in the pool, at most rate bytes per
+ * second (0 means no limit).
+ */
+int
+spa_trim(spa_t *spa, uint64_t rate)
+{
+	if (!spa_writeable(spa))
+		return (EROFS);
+
+	mutex_enter(&spa->spa_trim_lock);
+	if (spa->spa_trim_thread != NULL) {
+		mutex_exit(&spa->spa_trim_lock);
+		return (EBUSY);
+	}
+	spa->spa_trim_stop = B_FALSE;
+	spa->spa_trim_rate = rate;
+	spa->spa_trim_thread = thread_create(NULL, 0, spa_trim_thread, spa,
+	    0, &p0, TS_RUN, minclsyspri);
+	mutex_exit(&spa->spa_trim_lock);
+
+	return (0);
+}
+
+/*
+ * Stop a "zpool trim" and wait for the discards it has issued.
+ */
+int
+spa_trim_stop(spa_t *spa)
+{
+	mutex_enter(&spa->spa_trim_lock);
+	if (spa->spa_trim_thread == NULL) {
+		mutex_exit(&spa->spa_trim_lock);
+		return (ENOENT);
+	}
+	spa->spa_trim_stop = B_TRUE;
+	while (spa->spa_trim_thread != NULL)
+		cv_wait(&spa->spa_trim_cv, &spa->spa_trim_lock);
+	mutex_exit(&spa->spa_trim_lock);
+
+	return (0);
+}
+
 /*
  * ==========================================================================
  * SPA async task processing
@@ -6102,6 +6384,7 @@ spa_sync(spa_t *spa, uint64_t txg)
 	vdev_t *rvd = spa->spa_root_vdev;
 	vdev_t *vd;
 	dmu_tx_t *tx;
+	boolean_t batch;
 	int error;
 	int c;
 
@@ -6299,11 +6582,37 @@ spa_sync(spa_t *spa, uint64_t txg)
 	dsl_pool_sync_done(dp, txg);
 
 	/*
-	 * Update usable space statistics.
+	 * Update usable space statistics.  Every zfs_trim_txg_delay txgs the
+	 * metaslabs start a batch of automatic discards in spa_trim_zio.  The
+	 * space discarded by the last batch goes back to the allocator once
+	 * that batch is done, which it must be before the next one starts.
+	 * While the pool is being unloaded no batch is started, and all the
+	 * held space is handed back as soon as possible.
 	 */
+	batch = (!spa->spa_trim_drain &&
+	    txg % MAX(zfs_trim_txg_delay, 1) == 0);
+	if (batch || spa->spa_trim_drain)
+		spa_trim_batch_wait(spa);
+	if (batch) {
+		spa->spa_trim_zio = zio_root(spa, spa_trim_batch_done, NULL,
+		    ZIO_FLAG_CANFAIL);
+		spa_config_enter(spa, SCL_ZIO, spa->spa_trim_zio, RW_READER);
+	}
+	mutex_enter(&spa->spa_trim_lock);
+	spa->spa_trim_release = !spa->spa_trim_batch;
+	mutex_exit(&spa->spa_trim_lock);
+
 	while ((vd = txg_list_remove(&spa->spa_vdev_txg_list, TXG_CLEAN(txg))))
 		vdev_sync_done(vd, txg);
 
+	if (spa->spa_trim_zio != NULL) {
+		mutex_enter(&spa->spa_trim_lock);
+		spa->spa_trim_batch = B_TRUE;
+		mutex_exit(&spa->spa_trim_lock);
+		zio_nowait(spa->spa_trim_zio);
+		spa->spa_trim_zio = NULL;
+	}
+
 	spa_update_dspace(spa);
 
 	/*
@@ -6538,6 +6847,8 @@ EXPORT_SYMBOL(spa_l2cache_drop);
 /* scanning */
 EXPORT_SYMBOL(spa_scan);
 EXPORT_SYMBOL(spa_scan_stop);
+EXPORT_SYMBOL(spa_trim);
+EXPORT_SYMBOL(spa_trim_stop);
 
 /* spa syncing */
 EXPORT_SYMBOL(spa_sync); /* only for DMU use */
@@ -6550,4 +6861,7 @@ EXPORT_SYMBOL(spa_prop_clear_bootfs);
 
 /* asynchronous event notification */
 EXPORT_SYMBOL(spa_event_notify);
+
+module_param(zio_taskq_percpu, uint, 0644);
+MODULE_PARM_DESC(zio_taskq_percpu, "CPUs per zio taskq copy, 0 to disable");
 #endif
@@ -926,16 +926,16 @@ vdev_probe_done(zio_t *zio)
 			vps->vps_readable = 1;
 		if (zio->io_error == 0 && spa_writeable(spa)) {
 			zio_nowait(zio_write_phys(vd->vdev_probe_zio, vd,
-			    zio->io_offset, zio->io_size, zio->io_data,
+			    zio->io_offset, zio->io_size, zio->io_abd,
 			    ZIO_CHECKSUM_OFF, vdev_probe_done, vps,
 			    ZIO_PRIORITY_SYNC_WRITE, vps->vps_flags, B_TRUE));
 		} else {
-			zio_buf_free(zio->io_data, zio->io_size);
+			abd_free(zio->io_abd);
 		}
 	} else if (zio->io_type == ZIO_TYPE_WRITE) {
 		if (zio->io_error == 0)
 			vps->vps_writeable = 1;
-		zio_buf_free(zio->io_data, zio->io_size);
+		abd_free(zio->io_abd);
 	} else if (zio->io_type == ZIO_TYPE_NULL) {
 		zio_t *pio;
 
@@ -1050,7 +1050,7 @@ vdev_probe(vdev_t *vd, zio_t *zio)
 		zio_nowait(zio_read_phys(pio, vd,
 		    vdev_label_offset(vd->vdev_psize, l,
 		    offsetof(vdev_label_t, vl_pad2)),
-		    VDEV_PAD_SIZE, zio_buf_alloc(VDEV_PAD_SIZE),
+		    VDEV_PAD_SIZE, abd_alloc_for_io(VDEV_PAD_SIZE, B_TRUE),
 		    ZIO_CHECKSUM_OFF, vdev_probe_done, vps,
 		    ZIO_PRIORITY_SYNC_READ, vps->vps_flags, B_TRUE));
 	}
@@ -1105,16 +1105,23 @@ vdev_open_children(vdev_t *vd)
 		for (c = 0; c < children; c++)
 			vd->vdev_child[c]->vdev_open_error =
 			    vdev_open(vd->vdev_child[c]);
-		return;
+	} else {
+		tq = taskq_create("vdev_open", children, minclsyspri,
+		    children, children, TASKQ_PREPOPULATE);
+
+		for (c = 0; c < children; c++)
+			VERIFY(taskq_dispatch(tq, vdev_open_child,
+			    vd->vdev_child[c], TQ_SLEEP) != 0);
+
+		taskq_destroy(tq);
 	}
-	tq = taskq_create("vdev_open", children, minclsyspri,
-	    children, children, TASKQ_PREPOPULATE);
 
+	/*
+	 * An interior vdev is only non-rotational if all of its children are.
+	 */
+	vd->vdev_nonrot = B_TRUE;
 	for (c = 0; c < children; c++)
-		VERIFY(taskq_dispatch(tq, vdev_open_child, vd->vdev_child[c],
-		    TQ_SLEEP) != 0);
-
-	taskq_destroy(tq);
+		vd->vdev_nonrot &= vd->vdev_child[c]->vdev_nonrot;
 }
 
 /*
@@ -2530,6 +2537,32 @@ vdev_get_stats(vdev_t *vd, vdev_stat_t *vs)
 	}
 }
 
+static void
+vdev_get_stats_ex_impl(vdev_t *vd, vdev_stat_ex_t *vsx)
+{
+	int c;
+
+	if (vd->vdev_ops->vdev_op_leaf) {
+		vdev_queue_add_stats_ex(vd, vsx);
+		return;
+	}
+
+	for (c = 0; c < vd->vdev_children; c++)
+		vdev_get_stats_ex_impl(vd->vdev_child[c], vsx);
+}
+
+/*
+ * Get the latency and request size histograms for the given vdev.  Only
+ * leaf vdevs keep them; for interior vdevs they are summed over all of
+ * the leaves below.
+ */
+void
+vdev_get_stats_ex(vdev_t *vd, vdev_stat_ex_t *vsx)
+{
+	bzero(vsx, sizeof (*vsx));
+	vdev_get_stats_ex_impl(vd, vsx);
+}
+
 void
 vdev_clear_stats(vdev_t *vd)
 {
@@ -3208,17 +3241,17 @@ vdev_deadman(vdev_t *vd)
 		vdev_queue_t *vq = &vd->vdev_queue;
 
 		mutex_enter(&vq->vq_lock);
-		if (avl_numnodes(&vq->vq_pending_tree) > 0) {
+		if (avl_numnodes(&vq->vq_active_tree) > 0) {
 			spa_t *spa = vd->vdev_spa;
 			zio_t *fio;
 			uint64_t delta;
 
 			/*
-			 * Look at the head of all the pending queues,
-			 * if any I/O has been outstanding for longer than
+			 * Look at the head of the active queue, if
+			 * any I/O has been outstanding for longer than
 			 * the spa_deadman_synctime we log a zevent.
 			 */
-			fio = avl_first(&vq->vq_pending_tree);
+			fio = avl_first(&vq->vq_active_tree);
 			delta = gethrtime() - fio->io_timestamp;
 			if (delta > spa_deadman_synctime(spa)) {
 				zfs_dbgmsg("SLOW IO: zio timestamp %lluns, "
@@ -27,6 +27,7 @@
 
 #include <sys/zfs_context.h>
 #include <sys/spa.h>
+#include <sys/spa_impl.h>
 #include <sys/vdev_disk.h>
 #include <sys/vdev_impl.h>
 #include <sys/fs/zfs.h>
@@ -49,6 +50,43 @@ typedef struct dio_request {
         struct bio		*dr_bio[0];	/* Attached bio's */
 } dio_request_t;
 
+/*
+ * Nearly every zio fits in the default number of bio's, so dio_request's
+ * of that size come from a kmem cache rather than a fresh allocation.
+ */
+#define	VDEV_DISK_DIO_BIOS	16
+
+static kmem_cache_t *vdev_disk_dio_cache;
+
+/*
+ * Bio submission statistics.  bios / zios is the average number of bio's
+ * built per zio and bvecs / bios the average number of bio_vec's in each.
+ * plugged counts the zios submitted while the block layer was plugged,
+ * either by the vdev queue draining a batch or because the zio needed
+ * more than one bio.
+ */
+typedef struct vdev_disk_stats {
+	kstat_named_t	vds_zios;
+	kstat_named_t	vds_bios;
+	kstat_named_t	vds_bvecs;
+	kstat_named_t	vds_plugged;
+	kstat_named_t	vds_dio_realloc;
+} vdev_disk_stats_t;
+
+static vdev_disk_stats_t vdev_disk_stats = {
+	{ "zios",		KSTAT_DATA_UINT64 },
+	{ "bios",		KSTAT_DATA_UINT64 },
+	{ "bvecs",		KSTAT_DATA_UINT64 },
+	{ "plugged",		KSTAT_DATA_UINT64 },
+	{ "dio_realloc",	KSTAT_DATA_UINT64 },
+};
+
+#define	VDSTAT_INCR(stat, val) \
+	atomic_add_64(&vdev_disk_stats.stat.value.ui64, (val))
+#define	VDSTAT_BUMP(stat)	VDSTAT_INCR(stat, 1)
+
+static kstat_t *vdev_disk_ksp;
+
 
 #ifdef HAVE_OPEN_BDEV_EXCLUSIVE
 static fmode_t
@@ -296,8 +334,16 @@ skip_open:
 	/*  Determine the physical block size */
 	block_size = vdev_bdev_block_size(vd->vd_bdev);
 
-	/* Clear the nowritecache bit, causes vdev_reopen() to try again. */
+	/* Clear the nowritecache and notrim bits, vdev_reopen() tries again */
 	v->vdev_nowritecache = B_FALSE;
+	v->vdev_notrim = B_FALSE;
+
+	/* Inform the mirror read selection whether seeks are free */
+#ifdef HAVE_BLK_QUEUE_NONROT
+	v->vdev_nonrot = blk_queue_nonrot(bdev_get_queue(vd->vd_bdev));
+#else
+	v->vdev_nonrot = B_FALSE;
+#endif
 
 	/* Physical volume size in bytes */
 	*psize = bdev_capacity(vd->vd_bdev);
@@ -333,19 +379,19 @@ vdev_disk_close(vdev_t *v)
 static dio_request_t *
 vdev_disk_dio_alloc(int bio_count)
 {
+	size_t size = sizeof(dio_request_t) + sizeof(struct bio *) * bio_count;
 	dio_request_t *dr;
-	int i;
 
-	dr = kmem_zalloc(sizeof(dio_request_t) +
-	                 sizeof(struct bio *) * bio_count, KM_PUSHPAGE);
+	if (bio_count == VDEV_DISK_DIO_BIOS)
+		dr = kmem_cache_alloc(vdev_disk_dio_cache, KM_PUSHPAGE);
+	else
+		dr = kmem_alloc(size, KM_PUSHPAGE);
+
 	if (dr) {
+		bzero(dr, size);
 		init_completion(&dr->dr_comp);
 		atomic_set(&dr->dr_ref, 0);
 		dr->dr_bio_count = bio_count;
-		dr->dr_error = 0;
-
-		for (i = 0; i < dr->dr_bio_count; i++)
-			dr->dr_bio[i] = NULL;
 	}
 
 	return dr;
@@ -360,8 +406,11 @@ vdev_disk_dio_free(dio_request_t *dr)
 		if (dr->dr_bio[i])
 			bio_put(dr->dr_bio[i]);
 
-	kmem_free(dr, sizeof(dio_request_t) +
-	          sizeof(struct bio *) * dr->dr_bio_count);
+	if (dr->dr_bio_count == VDEV_DISK_DIO_BIOS)
+		kmem_cache_free(vdev_disk_dio_cache, dr);
+	else
+		kmem_free(dr, sizeof(dio_request_t) +
+		          sizeof(struct bio *) * dr->dr_bio_count);
 }
 
 static int
@@ -493,15 +542,77 @@ bio_map(struct bio *bio, void *bio_ptr, unsigned int bio_size)
         return bio_size;
 }
 
+/*
+ * Linear buffers are mapped page by page, scattered buffers are mapped
+ * directly from their chunk pages without an intermediate copy.  Gang
+ * buffers (aggregated I/O from vdev_queue) are mapped child by child
+ * into the same bio, so an aggregate is still submitted without a copy.
+ */
+static unsigned long
+bio_nr_pages_abd(abd_t *abd, unsigned int bio_size, size_t off)
+{
+	if (abd_is_gang(abd)) {
+		unsigned long nr_pages = 0;
+		abd_t *cabd;
+
+		for (cabd = abd_gang_get_offset(abd, &off);
+		    cabd != NULL && bio_size > 0;
+		    cabd = abd_gang_next(abd, cabd)) {
+			unsigned int len = MIN(bio_size, cabd->abd_size - off);
+
+			nr_pages += bio_nr_pages_abd(cabd, len, off);
+			bio_size -= len;
+			off = 0;
+		}
+
+		return (MIN(nr_pages, BIO_MAX_PAGES));
+	}
+
+	if (abd_is_linear(abd))
+		return (bio_nr_pages((char *)abd_to_buf(abd) + off, bio_size));
+	else
+		return (abd_nr_pages_off(abd, bio_size, off));
+}
+
+static unsigned int
+bio_map_abd(struct bio *bio, abd_t *abd, unsigned int bio_size, size_t off)
+{
+	if (abd_is_gang(abd)) {
+		abd_t *cabd;
+
+		for (cabd = abd_gang_get_offset(abd, &off);
+		    cabd != NULL && bio_size > 0;
+		    cabd = abd_gang_next(abd, cabd)) {
+			unsigned int len = MIN(bio_size, cabd->abd_size - off);
+			unsigned int left = bio_map_abd(bio, cabd, len, off);
+
+			bio_size -= len - left;
+			if (left > 0)
+				break;
+			off = 0;
+		}
+
+		return (bio_size);
+	}
+
+	if (abd_is_linear(abd))
+		return (bio_map(bio, (char *)abd_to_buf(abd) + off, bio_size));
+	else
+		return (abd_scatter_bio_map_off(bio, abd, bio_size, off));
+}
+
 static int
-__vdev_disk_physio(struct block_device *bdev, zio_t *zio, caddr_t kbuf_ptr,
+__vdev_disk_physio(struct block_device *bdev, zio_t *zio, abd_t *abd,
                    size_t kbuf_size, uint64_t kbuf_offset, int flags)
 {
         dio_request_t *dr;
-	caddr_t bio_ptr;
-	uint64_t bio_offset;
-	int bio_size, bio_count = 16;
-	int i = 0, error = 0;
+	size_t abd_offset;
+	uint64_t bio_offset, bvecs = 0;
+	int bio_size, bio_count = VDEV_DISK_DIO_BIOS;
+	int i = 0, nr_bios, error = 0;
+#ifdef HAVE_BLK_PLUG
+	struct blk_plug plug;
+#endif
 
 	ASSERT3U(kbuf_offset + kbuf_size, <=, bdev->bd_inode->i_size);
 
@@ -510,6 +621,8 @@ retry:
 	if (dr == NULL)
 		return ENOMEM;
 
+	bvecs = 0;
+
 	if (zio && !(zio->io_flags & (ZIO_FLAG_IO_RETRY | ZIO_FLAG_TRYHARD)))
 			bio_set_flags_failfast(bdev, &flags);
 
@@ -523,7 +636,7 @@ retry:
 	 * their volume block size to match the maximum request size and
 	 * the common case will be one bio per vdev IO request.
 	 */
-	bio_ptr    = kbuf_ptr;
+	abd_offset = 0;
 	bio_offset = kbuf_offset;
 	bio_size   = kbuf_size;
 	for (i = 0; i <= dr->dr_bio_count; i++) {
@@ -540,11 +653,12 @@ retry:
 		if (dr->dr_bio_count == i) {
 			vdev_disk_dio_free(dr);
 			bio_count *= 2;
+			VDSTAT_BUMP(vds_dio_realloc);
 			goto retry;
 		}
 
 		dr->dr_bio[i] = bio_alloc(GFP_NOIO,
-		                          bio_nr_pages(bio_ptr, bio_size));
+		    bio_nr_pages_abd(abd, bio_size, abd_offset));
 		if (dr->dr_bio[i] == NULL) {
 			vdev_disk_dio_free(dr);
 			return ENOMEM;
@@ -560,22 +674,47 @@ retry:
 		dr->dr_bio[i]->bi_private = dr;
 
 		/* Remaining size is returned to become the new size */
-		bio_size = bio_map(dr->dr_bio[i], bio_ptr, bio_size);
+		bio_size = bio_map_abd(dr->dr_bio[i], abd, bio_size,
+		    abd_offset);
 
 		/* Advance in buffer and construct another bio if needed */
-		bio_ptr    += dr->dr_bio[i]->bi_size;
+		abd_offset += dr->dr_bio[i]->bi_size;
 		bio_offset += dr->dr_bio[i]->bi_size;
+		bvecs += dr->dr_bio[i]->bi_vcnt;
 	}
+	nr_bios = i;
+
+	VDSTAT_BUMP(vds_zios);
+	VDSTAT_INCR(vds_bios, nr_bios);
+	VDSTAT_INCR(vds_bvecs, bvecs);
 
 	/* Extra reference to protect dio_request during submit_bio */
 	vdev_disk_dio_get(dr);
 	if (zio)
 		zio->io_delay = jiffies_64;
 
+#ifdef HAVE_BLK_PLUG
+	/*
+	 * A zio split over several bio's is plugged so they are dispatched
+	 * together.  This nests inside the plug held by vdev_queue_io_done()
+	 * when the zio is part of a batch, in which case everything goes
+	 * out when that batch is finished.
+	 */
+	if (nr_bios > 1)
+		blk_start_plug(&plug);
+
+	if (current->plug != NULL)
+		VDSTAT_BUMP(vds_plugged);
+#endif
+
 	/* Submit all bio's associated with this dio */
-	for (i = 0; i < dr->dr_bio_count; i++)
-		if (dr->dr_bio[i])
-			submit_bio(dr->dr_rw, dr->dr_bio[i]);
+	for (i = 0; i < nr_bios; i++)
+		submit_bio(dr->dr_rw, dr->dr_bio[i]);
+
+#ifdef HAVE_BLK_PLUG
+	if (nr_bios > 1)
+		blk_finish_plug(&plug);
+#endif
 
 	/*
 	 * On synchronous blocking requests we wait for all bio the completion
@@ -600,8 +739,15 @@ int
 vdev_disk_physio(struct block_device *bdev, caddr_t kbuf,
 		 size_t size, uint64_t offset, int flags)
 {
+	abd_t *abd;
+	int error;
+
 	bio_set_flags_failfast(bdev, &flags);
-	return __vdev_disk_physio(bdev, NULL, kbuf, size, offset, flags);
+	abd = abd_get_from_buf(kbuf, size);
+	error = __vdev_disk_physio(bdev, NULL, abd, size, offset, flags);
+	abd_put(abd);
+
+	return (error);
 }
 
 BIO_END_IO_PROTO(vdev_disk_io_flush_completion, bio, size, rc)
@@ -645,6 +791,31 @@ vdev_disk_io_flush(struct block_device *bdev, zio_t *zio)
 	return 0;
 }
 
+/*
+ * blkdev_issue_discard() waits for the discard to complete, so it is run
+ * from an issue taskq rather than in the context which issued the zio.
+ */
+static void
+vdev_disk_io_trim(void *arg)
+{
+	zio_t *zio = arg;
+	vdev_t *v = zio->io_vd;
+	vdev_disk_t *vd = v->vdev_tsd;
+
+#ifdef HAVE_BLKDEV_ISSUE_DISCARD
+	zio->io_error = -blkdev_issue_discard(vd->vd_bdev,
+	    zio->io_offset >> 9, zio->io_size >> 9, GFP_NOFS, 0);
+#else
+	zio->io_error = ENOTSUP;
+#endif
+	if (zio->io_error == EOPNOTSUPP || zio->io_error == ENOTSUP) {
+		zio->io_error = ENOTSUP;
+		v->vdev_notrim = B_TRUE;
+	}
+
+	zio_interrupt(zio);
+}
+
 static int
 vdev_disk_io_start(zio_t *zio)
 {
@@ -681,6 +852,18 @@ vdev_disk_io_start(zio_t *zio)
 
 			break;
 
+		case DKIOCFREE:
+
+			if (v->vdev_notrim) {
+				zio->io_error = ENOTSUP;
+				break;
+			}
+
+			spa_taskq_dispatch_ent(zio->io_spa, ZIO_TYPE_FREE,
+			    ZIO_TASKQ_ISSUE, vdev_disk_io_trim, zio, 0,
+			    &zio->io_tqent);
+			return ZIO_PIPELINE_STOP;
+
 		default:
 			zio->io_error = ENOTSUP;
 		}
@@ -700,7 +883,7 @@ vdev_disk_io_start(zio_t *zio)
 		return ZIO_PIPELINE_CONTINUE;
 	}
 
-	error = __vdev_disk_physio(vd->vd_bdev, zio, zio->io_data,
+	error = __vdev_disk_physio(vd->vd_bdev, zio, zio->io_abd,
 		                   zio->io_size, zio->io_offset, flags);
 	if (error) {
 		zio->io_error = error;
@@ -835,5 +1018,33 @@ vdev_disk_read_rootlabel(char *devpath, char *devid, nvlist_t **config)
 	return 0;
 }
 
+void
+vdev_disk_init(void)
+{
+	vdev_disk_dio_cache = kmem_cache_create("vdev_disk_dio_cache",
+	    sizeof (dio_request_t) + sizeof (struct bio *) * VDEV_DISK_DIO_BIOS,
+	    0, NULL, NULL, NULL, NULL, NULL, 0);
+
+	vdev_disk_ksp = kstat_create("zfs", 0, "vdev_disk_stats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (vdev_disk_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (vdev_disk_ksp != NULL) {
+		vdev_disk_ksp->ks_data = &vdev_disk_stats;
+		kstat_install(vdev_disk_ksp);
+	}
+}
+
+void
+vdev_disk_fini(void)
+{
+	if (vdev_disk_ksp != NULL) {
+		kstat_delete(vdev_disk_ksp);
+		vdev_disk_ksp = NULL;
+	}
+
+	kmem_cache_destroy(vdev_disk_dio_cache);
+	vdev_disk_dio_cache = NULL;
+}
+
 module_param(zfs_vdev_scheduler, charp, 0644);
 MODULE_PARM_DESC(zfs_vdev_scheduler, "I/O scheduler");
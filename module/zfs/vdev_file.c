@@ -105,6 +105,15 @@ vdev_file_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
 #endif
 
 skip_open:
+	/*
+	 * The backing device of a file is unknown and the page cache hides
+	 * most seeks, so rotational optimizations are not applied to files.
+	 */
+	vd->vdev_nonrot = B_TRUE;
+
+	/* Clear the notrim bit, causes vdev_reopen() to try again. */
+	vd->vdev_notrim = B_FALSE;
+
 	/*
 	 * Determine the physical size of the file.
 	 */
@@ -147,18 +156,123 @@ vdev_file_io_strategy(void *arg)
 	vdev_t *vd = zio->io_vd;
 	vdev_file_t *vf = vd->vdev_tsd;
 	ssize_t resid;
+	void *buf;
+
+	if (zio->io_type == ZIO_TYPE_READ)
+		buf = abd_borrow_buf(zio->io_abd, zio->io_size);
+	else
+		buf = abd_borrow_buf_copy(zio->io_abd, zio->io_size);
 
 	zio->io_error = vn_rdwr(zio->io_type == ZIO_TYPE_READ ?
-	    UIO_READ : UIO_WRITE, vf->vf_vnode, zio->io_data,
+	    UIO_READ : UIO_WRITE, vf->vf_vnode, buf,
 	    zio->io_size, zio->io_offset, UIO_SYSSPACE,
 	    0, RLIM64_INFINITY, kcred, &resid);
 
+	if (zio->io_type == ZIO_TYPE_READ)
+		abd_return_buf_copy(zio->io_abd, buf, zio->io_size);
+	else
+		abd_return_buf(zio->io_abd, buf, zio->io_size);
+
+	if (resid != 0 && zio->io_error == 0)
+		zio->io_error = ENOSPC;
+
+	zio_interrupt(zio);
+}
+
+#ifndef _KERNEL
+/*
+ * In userland reads and writes are submitted asynchronously, so the number
+ * in flight is bounded by the vdev queue rather than the taskq threads.
+ */
+typedef struct vdev_file_aio {
+	zio_t		*vfa_zio;
+	void		*vfa_buf;
+} vdev_file_aio_t;
+
+static void
+vdev_file_aio_done(void *arg, int error, ssize_t resid)
+{
+	vdev_file_aio_t *vfa = arg;
+	zio_t *zio = vfa->vfa_zio;
+
+	if (zio->io_type == ZIO_TYPE_READ)
+		abd_return_buf_copy(zio->io_abd, vfa->vfa_buf, zio->io_size);
+	else
+		abd_return_buf(zio->io_abd, vfa->vfa_buf, zio->io_size);
+
+	kmem_free(vfa, sizeof (vdev_file_aio_t));
+
+	zio->io_error = error;
 	if (resid != 0 && zio->io_error == 0)
 		zio->io_error = ENOSPC;
 
 	zio_interrupt(zio);
 }
 
+static int
+vdev_file_aio_start(zio_t *zio)
+{
+	vdev_file_t *vf = zio->io_vd->vdev_tsd;
+	vdev_file_aio_t *vfa;
+	int error;
+
+	vfa = kmem_alloc(sizeof (vdev_file_aio_t), KM_PUSHPAGE);
+	vfa->vfa_zio = zio;
+
+	if (zio->io_type == ZIO_TYPE_READ)
+		vfa->vfa_buf = abd_borrow_buf(zio->io_abd, zio->io_size);
+	else
+		vfa->vfa_buf = abd_borrow_buf_copy(zio->io_abd, zio->io_size);
+
+	error = vn_aio_rdwr(zio->io_type == ZIO_TYPE_READ ?
+	    UIO_READ : UIO_WRITE, vf->vf_vnode, vfa->vfa_buf, zio->io_size,
+	    zio->io_offset, vdev_file_aio_done, vfa);
+	if (error != 0) {
+		if (zio->io_type == ZIO_TYPE_READ)
+			abd_return_buf_copy(zio->io_abd, vfa->vfa_buf,
+			    zio->io_size);
+		else
+			abd_return_buf(zio->io_abd, vfa->vfa_buf,
+			    zio->io_size);
+		kmem_free(vfa, sizeof (vdev_file_aio_t));
+	}
+
+	return (error);
+}
+#endif /* !_KERNEL */
+
+/*
+ * Punch a hole over a freed range so the file system beneath the file
+ * can release its blocks.
+ */
+static void
+vdev_file_io_trim(void *arg)
+{
+	zio_t *zio = (zio_t *)arg;
+	vdev_t *vd = zio->io_vd;
+	vdev_file_t *vf = vd->vdev_tsd;
+#ifdef VOP_SPACE
+	struct flock flck;
+
+	bzero(&flck, sizeof (flck));
+	flck.l_type = F_FREESP;
+	flck.l_start = zio->io_offset;
+	flck.l_len = zio->io_size;
+	flck.l_whence = 0;
+
+	zio->io_error = VOP_SPACE(vf->vf_vnode, F_FREESP, &flck,
+	    0, 0, kcred, NULL);
+#else
+	zio->io_error = ENOTSUP;
+#endif
+	if (zio->io_error == EOPNOTSUPP || zio->io_error == ENOTSUP) {
+		zio->io_error = ENOTSUP;
+		vd->vdev_notrim = B_TRUE;
+	}
+
+	zio_interrupt(zio);
+}
+
 static int
 vdev_file_io_start(zio_t *zio)
 {
@@ -178,6 +292,15 @@ vdev_file_io_start(zio_t *zio)
 			zio->io_error = VOP_FSYNC(vf->vf_vnode, FSYNC | FDSYNC,
 			    kcred, NULL);
 			break;
+		case DKIOCFREE:
+			if (vd->vdev_notrim) {
+				zio->io_error = ENOTSUP;
+				break;
+			}
+			spa_taskq_dispatch_ent(spa, ZIO_TYPE_FREE,
+			    ZIO_TASKQ_ISSUE, vdev_file_io_trim, zio, 0,
+			    &zio->io_tqent);
+			return (ZIO_PIPELINE_STOP);
 		default:
 			zio->io_error = ENOTSUP;
 		}
@@ -185,6 +308,11 @@ vdev_file_io_start(zio_t *zio)
 		return (ZIO_PIPELINE_CONTINUE);
 	}
 
+#ifndef _KERNEL
+	if (vdev_file_aio_start(zio) == 0)
+		return (ZIO_PIPELINE_STOP);
+#endif
+
 	spa_taskq_dispatch_ent(spa, ZIO_TYPE_FREE, ZIO_TASKQ_ISSUE,
 	    vdev_file_io_strategy, zio, 0, &zio->io_tqent);
 
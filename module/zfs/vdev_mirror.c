@@ -41,7 +41,7 @@ typedef struct mirror_child {
 	vdev_t		*mc_vd;
 	uint64_t	mc_offset;
 	int		mc_error;
-	int		mc_pending;
+	int		mc_load;
 	uint8_t		mc_tried;
 	uint8_t		mc_skipped;
 	uint8_t		mc_speculative;
@@ -56,22 +56,25 @@ typedef struct mirror_map {
 } mirror_map_t;
 
 /*
- * When the children are equally busy queue incoming requests to a single
- * child for N microseconds.  This is done to maximize the likelihood that
- * the Linux elevator will be able to merge requests while it is plugged.
- * Otherwise, requests are queued to the least busy device.
+ * Reads from a mirror are sent to the child with the lowest expected
+ * completion time.  The estimate starts from the number of i/os already
+ * queued or issued to the child and adds a penalty for the seek the read
+ * would cost.  A read which begins where the child's last issued i/o
+ * ended costs little on any kind of device.  A seek on a rotational disk
+ * is expensive, and is charged half as much when it stays within
+ * zfs_vdev_mirror_rotating_seek_offset bytes of the head.  Non-rotational
+ * devices are charged a small increment for seeks too, since sequential
+ * reads can still be aggregated into fewer commands.
  *
- * For rotational disks the Linux elevator will plug for 10ms which is
- * why zfs_vdev_mirror_switch_us is set to 10ms by default.  For non-
- * rotational disks the elevator will not plug, but 10ms is still a small
- * enough value that the requests will get spread over all the children.
- *
- * For fast SSDs it may make sense to decrease zfs_vdev_mirror_switch_us
- * significantly to bound the worst case latencies.  It would probably be
- * ideal to calculate a decaying average of the last observed latencies and
- * use that to dynamically adjust the zfs_vdev_mirror_switch_us time.
+ * With the defaults an idle HDD only takes a random read once the SSD
+ * beside it has five more i/os outstanding, so a mixed SSD+HDD mirror
+ * serves nearly all of its reads from the SSD.
  */
-int zfs_vdev_mirror_switch_us = 10000;
+int zfs_vdev_mirror_rotating_inc = 0;
+int zfs_vdev_mirror_rotating_seek_inc = 5;
+int zfs_vdev_mirror_rotating_seek_offset = 1 * 1024 * 1024;
+int zfs_vdev_mirror_non_rotating_inc = 0;
+int zfs_vdev_mirror_non_rotating_seek_inc = 1;
 
 static void
 vdev_mirror_map_free(zio_t *zio)
@@ -87,9 +90,49 @@ static const zio_vsd_ops_t vdev_mirror_vsd_ops = {
 };
 
 static int
-vdev_mirror_pending(vdev_t *vd)
+vdev_mirror_load(vdev_t *vd, uint64_t offset)
 {
-	return avl_numnodes(&vd->vdev_queue.vq_pending_tree);
+	uint64_t next_offset;
+	int c, load;
+
+	/*
+	 * A replacing or spare vdev beneath the mirror is as fast as the
+	 * best of its readable children.
+	 */
+	if (!vd->vdev_ops->vdev_op_leaf) {
+		load = INT_MAX;
+		for (c = 0; c < vd->vdev_children; c++) {
+			vdev_t *cvd = vd->vdev_child[c];
+
+			if (vdev_readable(cvd))
+				load = MIN(load, vdev_mirror_load(cvd, offset));
+		}
+		return (load);
+	}
+
+	/*
+	 * The queue tracks physical leaf offsets, which begin after the
+	 * front labels.
+	 */
+	offset += VDEV_LABEL_START_SIZE;
+	load = vdev_queue_length(vd);
+	next_offset = vdev_queue_next_offset(vd);
+
+	if (vd->vdev_nonrot) {
+		if (offset == next_offset)
+			return (load + zfs_vdev_mirror_non_rotating_inc);
+
+		return (load + zfs_vdev_mirror_non_rotating_seek_inc);
+	}
+
+	if (offset == next_offset)
+		return (load + zfs_vdev_mirror_rotating_inc);
+
+	if (MAX(offset, next_offset) - MIN(offset, next_offset) <
+	    zfs_vdev_mirror_rotating_seek_offset)
+		return (load + zfs_vdev_mirror_rotating_seek_inc / 2);
+
+	return (load + zfs_vdev_mirror_rotating_seek_inc);
 }
 
 static mirror_map_t *
@@ -131,8 +174,8 @@ vdev_mirror_map_alloc(zio_t *zio)
 			mc->mc_offset = DVA_GET_OFFSET(&dva[c]);
 		}
 	} else {
-		int lowest_pending = INT_MAX;
-		int lowest_nr = 1;
+		int lowest_load = INT_MAX;
+		int lowest_nr = 0;
 
 		c = vd->vdev_children;
 
@@ -155,27 +198,29 @@ vdev_mirror_map_alloc(zio_t *zio)
 				mc->mc_error = ENXIO;
 				mc->mc_tried = 1;
 				mc->mc_skipped = 1;
-				mc->mc_pending = INT_MAX;
+				mc->mc_load = INT_MAX;
 				continue;
 			}
 
-			mc->mc_pending = vdev_mirror_pending(mc->mc_vd);
-			if (mc->mc_pending < lowest_pending) {
-				lowest_pending = mc->mc_pending;
+			mc->mc_load = vdev_mirror_load(mc->mc_vd,
+			    mc->mc_offset);
+			if (mc->mc_load < lowest_load) {
+				lowest_load = mc->mc_load;
 				lowest_nr = 1;
-			} else if (mc->mc_pending == lowest_pending) {
+			} else if (mc->mc_load == lowest_load) {
 				lowest_nr++;
 			}
 		}
 
-		d = gethrtime() / (NSEC_PER_USEC * zfs_vdev_mirror_switch_us);
-		d = (d % lowest_nr) + 1;
-
-		for (c = 0; c < mm->mm_children; c++) {
-			mc = &mm->mm_child[c];
+		/*
+		 * Spread the reads evenly over equally loaded children.
+		 */
+		if (lowest_nr > 0) {
+			d = spa_get_random(lowest_nr) + 1;
 
-			if (mm->mm_child[c].mc_pending == lowest_pending) {
-				if (--d == 0) {
+			for (c = 0; c < mm->mm_children; c++) {
+				if (mm->mm_child[c].mc_load == lowest_load &&
+				    --d == 0) {
 					mm->mm_preferred = c;
 					break;
 				}
@@ -256,13 +301,13 @@ vdev_mirror_scrub_done(zio_t *zio)
 		while ((pio = zio_walk_parents(zio)) != NULL) {
 			mutex_enter(&pio->io_lock);
 			ASSERT3U(zio->io_size, >=, pio->io_size);
-			bcopy(zio->io_data, pio->io_data, pio->io_size);
+			abd_copy(pio->io_abd, zio->io_abd, pio->io_size);
 			mutex_exit(&pio->io_lock);
 		}
 		mutex_exit(&zio->io_lock);
 	}
 
-	zio_buf_free(zio->io_data, zio->io_size);
+	abd_free(zio->io_abd);
 
 	mc->mc_error = zio->io_error;
 	mc->mc_tried = 1;
@@ -336,13 +381,14 @@ vdev_mirror_io_start(zio_t *zio)
 			 * For scrubbing reads we need to allocate a read
 			 * buffer for each child and issue reads to all
 			 * children.  If any child succeeds, it will copy its
-			 * data into zio->io_data in vdev_mirror_scrub_done.
+			 * data into zio->io_abd in vdev_mirror_scrub_done.
 			 */
 			for (c = 0; c < mm->mm_children; c++) {
 				mc = &mm->mm_child[c];
 				zio_nowait(zio_vdev_child_io(zio, zio->io_bp,
 				    mc->mc_vd, mc->mc_offset,
-				    zio_buf_alloc(zio->io_size), zio->io_size,
+				    abd_alloc_sametype(zio->io_abd,
+				    zio->io_size), zio->io_size,
 				    zio->io_type, zio->io_priority, 0,
 				    vdev_mirror_scrub_done, mc));
 			}
@@ -366,7 +412,7 @@ vdev_mirror_io_start(zio_t *zio)
 	while (children--) {
 		mc = &mm->mm_child[c];
 		zio_nowait(zio_vdev_child_io(zio, zio->io_bp,
-		    mc->mc_vd, mc->mc_offset, zio->io_data, zio->io_size,
+		    mc->mc_vd, mc->mc_offset, zio->io_abd, zio->io_size,
 		    zio->io_type, zio->io_priority, 0,
 		    vdev_mirror_child_done, mc));
 		c++;
@@ -451,7 +497,7 @@ vdev_mirror_io_done(zio_t *zio)
 		mc = &mm->mm_child[c];
 		zio_vdev_io_redone(zio);
 		zio_nowait(zio_vdev_child_io(zio, zio->io_bp,
-		    mc->mc_vd, mc->mc_offset, zio->io_data, zio->io_size,
+		    mc->mc_vd, mc->mc_offset, zio->io_abd, zio->io_size,
 		    ZIO_TYPE_READ, zio->io_priority, 0,
 		    vdev_mirror_child_done, mc));
 		return;
@@ -492,7 +538,7 @@ vdev_mirror_io_done(zio_t *zio)
 
 			zio_nowait(zio_vdev_child_io(zio, zio->io_bp,
 			    mc->mc_vd, mc->mc_offset,
-			    zio->io_data, zio->io_size,
+			    zio->io_abd, zio->io_size,
 			    ZIO_TYPE_WRITE, zio->io_priority,
 			    ZIO_FLAG_IO_REPAIR | (unexpected_errors ?
 			    ZIO_FLAG_SELF_HEAL : 0), NULL, NULL));
@@ -552,6 +598,23 @@ vdev_ops_t vdev_spare_ops = {
 };
 
 #if defined(_KERNEL) && defined(HAVE_SPL)
-module_param(zfs_vdev_mirror_switch_us, int, 0644);
-MODULE_PARM_DESC(zfs_vdev_mirror_switch_us, "Switch mirrors every N usecs");
+module_param(zfs_vdev_mirror_rotating_inc, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_mirror_rotating_inc,
+	"Rotating media load increment for sequential I/Os");
+
+module_param(zfs_vdev_mirror_rotating_seek_inc, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_mirror_rotating_seek_inc,
+	"Rotating media load increment for seeking I/Os");
+
+module_param(zfs_vdev_mirror_rotating_seek_offset, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_mirror_rotating_seek_offset,
+	"Offset in bytes from the last I/O within which a seek costs half");
+
+module_param(zfs_vdev_mirror_non_rotating_inc, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_mirror_non_rotating_inc,
+	"Non-rotating media load increment for sequential I/Os");
+
+module_param(zfs_vdev_mirror_non_rotating_seek_inc, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_mirror_non_rotating_seek_inc,
+	"Non-rotating media load increment for seeking I/Os");
 #endif
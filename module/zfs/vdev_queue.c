@@ -31,27 +31,135 @@
 #include <sys/vdev_impl.h>
 #include <sys/zio.h>
 #include <sys/avl.h>
+#include <sys/spa_impl.h>
+#include <sys/dsl_pool.h>
+#if defined(_KERNEL) && defined(HAVE_BLK_PLUG)
+#include <linux/blkdev.h>
+#endif
 
 /*
- * These tunables are for performance analysis.
+ * ZFS I/O Scheduler
+ * ---------------
+ *
+ * ZFS issues I/O operations to leaf vdevs to satisfy and complete zios.  The
+ * I/O scheduler determines when and in what order those operations are
+ * issued.  The I/O scheduler divides operations into five I/O classes
+ * prioritized in the following order: sync read, sync write, async read,
+ * async write, and scrub/resilver.  Each queue defines the minimum and
+ * maximum number of concurrent operations that may be issued to the device.
+ * In addition, the device has an aggregate maximum, zfs_vdev_max_active.
+ * Note that the sum of the per-queue minimums must not exceed the aggregate
+ * maximum.  If the sum of the per-queue maximums exceeds the aggregate
+ * maximum, then the number of active i/os may reach zfs_vdev_max_active, in
+ * which case no further i/os will be issued regardless of whether all
+ * per-queue minimums have been met.
+ *
+ * For many physical devices, throughput increases with the number of
+ * concurrent operations, but latency typically suffers.  Further, physical
+ * devices typically have a limit at which more concurrent operations have
+ * no effect on throughput or can actually cause it to decrease.
+ *
+ * The scheduler selects the next operation to issue by first looking for an
+ * I/O class whose minimum has not been satisfied.  Once all are satisfied
+ * and the aggregate maximum has not been hit, the scheduler looks for
+ * classes whose maximum has not been satisfied.  Iteration through the I/O
+ * classes is done in the order specified above.  No further operations are
+ * issued if the aggregate maximum number of concurrent operations has been
+ * hit or if there are no operations queued for an I/O class that has not
+ * hit its maximum.  Every time an i/o is queued or an operation completes,
+ * the I/O scheduler looks for new operations to issue.
+ *
+ * All I/O classes have a fixed maximum number of outstanding operations
+ * except for the async write class.  Asynchronous writes represent the data
+ * that is committed to stable storage during the syncing stage for
+ * transaction groups (see txg.c).  Transaction groups enter the syncing
+ * state periodically so the number of queued async writes will quickly
+ * burst up and then bleed down to zero.  Rather than servicing them as
+ * quickly as possible, the I/O scheduler changes the maximum number of
+ * active async write i/os according to the amount of dirty data in the
+ * pool (see dsl_pool_dirty_pct()).  Since both throughput and latency
+ * typically increase with the number of concurrent operations issued to
+ * physical devices, reducing the burstiness in the number of concurrent
+ * operations also stabilizes the response time of operations from other
+ * -- and in particular synchronous -- queues.  In broad strokes, the I/O
+ * scheduler will issue more concurrent operations from the async write
+ * queue as there's more dirty data in the pool.
+ *
+ * Async Writes
+ *
+ * The number of concurrent operations issued for the async write I/O class
+ * follows a piece-wise linear function defined by a few adjustable points.
+ *
+ *        |                   o---------| <-- zfs_vdev_async_write_max_active
+ *   ^    |                  /^         |
+ *   |    |                 / |         |
+ * active |                /  |         |
+ *  I/O   |               /   |         |
+ * count  |              /    |         |
+ *        |             /     |         |
+ *        |------------o      |         | <-- zfs_vdev_async_write_min_active
+ *       0|____________^______|_________|
+ *        0%           |      |       100% of the txg write limit
+ *                     |      |
+ *                     |      `-- zfs_vdev_async_write_active_max_dirty_percent
+ *                     `--------- zfs_vdev_async_write_active_min_dirty_percent
+ *
+ * Until the amount of dirty data exceeds a minimum percentage of the write
+ * limit, the I/O scheduler will limit the number of concurrent operations
+ * to the minimum.  As that threshold is crossed, the number of concurrent
+ * operations issued increases linearly to the maximum at the specified
+ * maximum percentage of the write limit.
+ *
+ * Ideally, the amount of dirty data on a busy pool will stay in the sloped
+ * part of the function between zfs_vdev_async_write_active_min_dirty_percent
+ * and zfs_vdev_async_write_active_max_dirty_percent.  If it exceeds the
+ * maximum percentage, the write throttle in dsl_pool_tempreserve_space()
+ * will start holding back new writes.
  */
+
 /*
- * zfs_vdev_max_pending is the maximum number of i/os concurrently
- * pending to each device.  zfs_vdev_min_pending is the initial number
- * of i/os pending to each device (before it starts ramping up to
- * max_pending).
+ * The maximum number of i/os active to each device.  Ideally, this will be
+ * >= the sum of each queue's max_active.  It must be at least the sum of each
+ * queue's min_active.
  */
-int zfs_vdev_max_pending = 10;
-int zfs_vdev_min_pending = 4;
+uint32_t zfs_vdev_max_active = 1000;
 
 /*
- * The deadlines are grouped into buckets based on zfs_vdev_time_shift:
- * deadline = pri + gethrtime() >> time_shift)
+ * Per-queue limits on the number of i/os active to each device.  If the
+ * sum of the queue's max_active is < zfs_vdev_max_active, then the
+ * min_active comes into play.  We will send min_active from each queue,
+ * and then select from queues in the order defined by zio_priority_t.
+ *
+ * In general, smaller max_active's will lead to lower latency of synchronous
+ * operations.  Larger max_active's may lead to higher overall throughput,
+ * depending on underlying storage.
+ *
+ * The ratio of the queues' max_actives determines the balance of performance
+ * between reads, writes, and scrubs.  E.g., increasing
+ * zfs_vdev_scrub_max_active will cause the scrub or resilver to complete
+ * more quickly, but reads and writes to have higher latency and lower
+ * throughput.
  */
-int zfs_vdev_time_shift = 29; /* each bucket is 0.537 seconds */
+uint32_t zfs_vdev_sync_read_min_active = 10;
+uint32_t zfs_vdev_sync_read_max_active = 10;
+uint32_t zfs_vdev_sync_write_min_active = 10;
+uint32_t zfs_vdev_sync_write_max_active = 10;
+uint32_t zfs_vdev_async_read_min_active = 1;
+uint32_t zfs_vdev_async_read_max_active = 3;
+uint32_t zfs_vdev_async_write_min_active = 1;
+uint32_t zfs_vdev_async_write_max_active = 10;
+uint32_t zfs_vdev_scrub_min_active = 1;
+uint32_t zfs_vdev_scrub_max_active = 2;
 
-/* exponential I/O issue ramp-up rate */
-int zfs_vdev_ramp_rate = 2;
+/*
+ * When the pool has less than zfs_vdev_async_write_active_min_dirty_percent
+ * dirty data, use zfs_vdev_async_write_min_active.  When it has more than
+ * zfs_vdev_async_write_active_max_dirty_percent, use
+ * zfs_vdev_async_write_max_active.  The value is linearly interpolated
+ * between min and max.
+ */
+int zfs_vdev_async_write_active_min_dirty_percent = 30;
+int zfs_vdev_async_write_active_max_dirty_percent = 60;
 
 /*
  * To reduce IOPs, we aggregate small adjacent I/Os into one large I/O.
@@ -64,19 +172,24 @@ int zfs_vdev_read_gap_limit = 32 << 10;
 int zfs_vdev_write_gap_limit = 4 << 10;
 
 /*
- * Virtual device vector for disk I/O scheduling.
+ * Every leaf vdev keeps log2 histograms of the time i/os spend in its
+ * queue and on the device, and of i/o sizes before and after aggregation,
+ * for each i/o class (see vdev_stat_ex_t).  They are updated under vq_lock
+ * as i/os are issued and completed, and are exported in the pool config
+ * for "zpool iostat -w" and as the named kstat zfs:0:vdev_histo-<guid>.
  */
+static const char *vdev_queue_class_name[ZIO_PRIORITY_NUM_QUEUEABLE] = {
+	"sync_read", "sync_write", "async_read", "async_write", "scrub"
+};
+
+#define	VDEV_QUEUE_KSTAT_NDATA	(sizeof (vdev_stat_ex_t) / sizeof (uint64_t))
+
 int
-vdev_queue_deadline_compare(const void *x1, const void *x2)
+vdev_queue_offset_compare(const void *x1, const void *x2)
 {
 	const zio_t *z1 = x1;
 	const zio_t *z2 = x2;
 
-	if (z1->io_deadline < z2->io_deadline)
-		return (-1);
-	if (z1->io_deadline > z2->io_deadline)
-		return (1);
-
 	if (z1->io_offset < z2->io_offset)
 		return (-1);
 	if (z1->io_offset > z2->io_offset)
@@ -90,73 +203,172 @@ vdev_queue_deadline_compare(const void *x1, const void *x2)
 	return (0);
 }
 
-int
-vdev_queue_offset_compare(const void *x1, const void *x2)
+static int
+vdev_queue_kstat_update(kstat_t *ksp, int rw)
 {
-	const zio_t *z1 = x1;
-	const zio_t *z2 = x2;
+	vdev_queue_t *vq = ksp->ks_private;
+	kstat_named_t *ks = ksp->ks_data;
+	uint64_t *histo = (uint64_t *)&vq->vq_stat_ex;
+	int i;
 
-	if (z1->io_offset < z2->io_offset)
-		return (-1);
-	if (z1->io_offset > z2->io_offset)
-		return (1);
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
 
-	if (z1 < z2)
-		return (-1);
-	if (z1 > z2)
-		return (1);
+	mutex_enter(&vq->vq_lock);
+	for (i = 0; i < VDEV_QUEUE_KSTAT_NDATA; i++)
+		ks[i].value.ui64 = histo[i];
+	mutex_exit(&vq->vq_lock);
 
 	return (0);
 }
 
+/*
+ * The named entries mirror the layout of vdev_stat_ex_t, each named after
+ * the class, the histogram and the lower bound of the bucket (in ns for
+ * the latency histograms, in bytes for the size histograms).
+ */
+static void
+vdev_queue_kstat_init(vdev_queue_t *vq)
+{
+	static const struct {
+		const char *name;
+		int buckets;
+	} histos[] = {
+		{ "wait", VDEV_L_HISTO_BUCKETS },
+		{ "disk", VDEV_L_HISTO_BUCKETS },
+		{ "ind", VDEV_RQ_HISTO_BUCKETS },
+		{ "agg", VDEV_RQ_HISTO_BUCKETS },
+	};
+	char name[KSTAT_STRLEN];
+	kstat_named_t *ks;
+	int h, p, b;
+
+	(void) snprintf(name, KSTAT_STRLEN, "vdev_histo-%llx",
+	    (u_longlong_t)vq->vq_vdev->vdev_guid);
+
+	vq->vq_ksp = kstat_create("zfs", 0, name, "misc", KSTAT_TYPE_NAMED,
+	    VDEV_QUEUE_KSTAT_NDATA, KSTAT_FLAG_VIRTUAL);
+	if (vq->vq_ksp == NULL)
+		return;
+
+	ks = kmem_zalloc(VDEV_QUEUE_KSTAT_NDATA * sizeof (kstat_named_t),
+	    KM_PUSHPAGE);
+	for (h = 0; h < sizeof (histos) / sizeof (histos[0]); h++) {
+		for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+			for (b = 0; b < histos[h].buckets; b++, ks++) {
+				ks->data_type = KSTAT_DATA_UINT64;
+				(void) snprintf(ks->name, KSTAT_STRLEN,
+				    "%s_%s_%llu", vdev_queue_class_name[p],
+				    histos[h].name, 1ULL << b);
+			}
+		}
+	}
+
+	vq->vq_ksp->ks_data = ks - VDEV_QUEUE_KSTAT_NDATA;
+	vq->vq_ksp->ks_data_size =
+	    VDEV_QUEUE_KSTAT_NDATA * sizeof (kstat_named_t);
+	vq->vq_ksp->ks_private = vq;
+	vq->vq_ksp->ks_update = vdev_queue_kstat_update;
+	kstat_install(vq->vq_ksp);
+}
+
+static void
+vdev_queue_kstat_fini(vdev_queue_t *vq)
+{
+	if (vq->vq_ksp == NULL)
+		return;
+
+	kmem_free(vq->vq_ksp->ks_data, vq->vq_ksp->ks_data_size);
+	kstat_delete(vq->vq_ksp);
+	vq->vq_ksp = NULL;
+}
+
+static void
+vdev_queue_histo_add(uint64_t *histo, int buckets, uint64_t val)
+{
+	int b = 0;
+
+	if (val >> 32)
+		b = highbit((ulong_t)(val >> 32)) + 31;
+	else if (val != 0)
+		b = highbit((ulong_t)val) - 1;
+
+	histo[MIN(b, buckets - 1)]++;
+}
+
+/*
+ * Account for a queued i/o leaving the queue to be issued, either on its
+ * own or as part of an aggregate.
+ */
+static void
+vdev_queue_stat_dequeue(vdev_queue_t *vq, zio_t *zio, hrtime_t now)
+{
+	vdev_stat_ex_t *vsx = &vq->vq_stat_ex;
+	zio_priority_t p = zio->io_priority;
+
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+	vdev_queue_histo_add(vsx->vsx_queue_histo[p], VDEV_L_HISTO_BUCKETS,
+	    now - zio->io_queued_timestamp);
+	vdev_queue_histo_add(vsx->vsx_ind_histo[p], VDEV_RQ_HISTO_BUCKETS,
+	    zio->io_size);
+}
+
+/*
+ * Add the histograms of a leaf vdev into vsx.
+ */
 void
-vdev_queue_init(vdev_t *vd)
+vdev_queue_add_stats_ex(vdev_t *vd, vdev_stat_ex_t *vsx)
 {
 	vdev_queue_t *vq = &vd->vdev_queue;
+	uint64_t *src = (uint64_t *)&vq->vq_stat_ex;
+	uint64_t *dst = (uint64_t *)vsx;
 	int i;
 
-	mutex_init(&vq->vq_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_enter(&vq->vq_lock);
+	for (i = 0; i < VDEV_QUEUE_KSTAT_NDATA; i++)
+		dst[i] += src[i];
+	mutex_exit(&vq->vq_lock);
+}
 
-	avl_create(&vq->vq_deadline_tree, vdev_queue_deadline_compare,
-	    sizeof (zio_t), offsetof(struct zio, io_deadline_node));
+void
+vdev_queue_init(vdev_t *vd)
+{
+	vdev_queue_t *vq = &vd->vdev_queue;
+	zio_priority_t p;
 
-	avl_create(&vq->vq_read_tree, vdev_queue_offset_compare,
-	    sizeof (zio_t), offsetof(struct zio, io_offset_node));
+	mutex_init(&vq->vq_lock, NULL, MUTEX_DEFAULT, NULL);
+	vq->vq_vdev = vd;
 
-	avl_create(&vq->vq_write_tree, vdev_queue_offset_compare,
-	    sizeof (zio_t), offsetof(struct zio, io_offset_node));
+	avl_create(&vq->vq_active_tree, vdev_queue_offset_compare,
+	    sizeof (zio_t), offsetof(struct zio, io_queue_node));
 
-	avl_create(&vq->vq_pending_tree, vdev_queue_offset_compare,
-	    sizeof (zio_t), offsetof(struct zio, io_offset_node));
+	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+		vq->vq_class[p].vqc_active = 0;
+		avl_create(&vq->vq_class[p].vqc_queued_tree,
+		    vdev_queue_offset_compare, sizeof (zio_t),
+		    offsetof(struct zio, io_queue_node));
+	}
 
-	/*
-	 * A list of buffers which can be used for aggregate I/O, this
-	 * avoids the need to allocate them on demand when memory is low.
-	 */
-	list_create(&vq->vq_io_list, sizeof (vdev_io_t),
-	    offsetof(vdev_io_t, vi_node));
+	vq->vq_last_offset = 0;
+	vq->vq_next_offset = 0;
+	bzero(&vq->vq_stat_ex, sizeof (vq->vq_stat_ex));
 
-	for (i = 0; i < zfs_vdev_max_pending; i++)
-		list_insert_tail(&vq->vq_io_list, zio_vdev_alloc());
+	vq->vq_ksp = NULL;
+	if (vd->vdev_ops->vdev_op_leaf)
+		vdev_queue_kstat_init(vq);
 }
 
 void
 vdev_queue_fini(vdev_t *vd)
 {
 	vdev_queue_t *vq = &vd->vdev_queue;
-	vdev_io_t *vi;
+	zio_priority_t p;
 
-	avl_destroy(&vq->vq_deadline_tree);
-	avl_destroy(&vq->vq_read_tree);
-	avl_destroy(&vq->vq_write_tree);
-	avl_destroy(&vq->vq_pending_tree);
+	vdev_queue_kstat_fini(vq);
 
-	while ((vi = list_head(&vq->vq_io_list)) != NULL) {
-		list_remove(&vq->vq_io_list, vi);
-		zio_vdev_free(vi);
-	}
-
-	list_destroy(&vq->vq_io_list);
+	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++)
+		avl_destroy(&vq->vq_class[p].vqc_queued_tree);
+	avl_destroy(&vq->vq_active_tree);
 
 	mutex_destroy(&vq->vq_lock);
 }
@@ -164,32 +376,157 @@ vdev_queue_fini(vdev_t *vd)
 static void
 vdev_queue_io_add(vdev_queue_t *vq, zio_t *zio)
 {
-	avl_add(&vq->vq_deadline_tree, zio);
-	avl_add(zio->io_vdev_tree, zio);
+	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
+	avl_add(&vq->vq_class[zio->io_priority].vqc_queued_tree, zio);
 }
 
 static void
 vdev_queue_io_remove(vdev_queue_t *vq, zio_t *zio)
 {
-	avl_remove(&vq->vq_deadline_tree, zio);
-	avl_remove(zio->io_vdev_tree, zio);
+	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
+	avl_remove(&vq->vq_class[zio->io_priority].vqc_queued_tree, zio);
 }
 
 static void
-vdev_queue_agg_io_done(zio_t *aio)
+vdev_queue_pending_add(vdev_queue_t *vq, zio_t *zio)
 {
-	vdev_queue_t *vq = &aio->io_vd->vdev_queue;
-	vdev_io_t *vi = aio->io_data;
-	zio_t *pio;
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
+	vq->vq_class[zio->io_priority].vqc_active++;
+	avl_add(&vq->vq_active_tree, zio);
 
-	while ((pio = zio_walk_parents(aio)) != NULL)
-		if (aio->io_type == ZIO_TYPE_READ)
-			bcopy((char *)aio->io_data + (pio->io_offset -
-			    aio->io_offset), pio->io_data, pio->io_size);
+	zio->io_timestamp = gethrtime();
+	vdev_queue_histo_add(vq->vq_stat_ex.vsx_agg_histo[zio->io_priority],
+	    VDEV_RQ_HISTO_BUCKETS, zio->io_size);
+}
 
-	mutex_enter(&vq->vq_lock);
-	list_insert_tail(&vq->vq_io_list, vi);
-	mutex_exit(&vq->vq_lock);
+static void
+vdev_queue_pending_remove(vdev_queue_t *vq, zio_t *zio)
+{
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
+	vq->vq_class[zio->io_priority].vqc_active--;
+	avl_remove(&vq->vq_active_tree, zio);
+}
+
+static int
+vdev_queue_class_min_active(zio_priority_t p)
+{
+	switch (p) {
+	case ZIO_PRIORITY_SYNC_READ:
+		return (zfs_vdev_sync_read_min_active);
+	case ZIO_PRIORITY_SYNC_WRITE:
+		return (zfs_vdev_sync_write_min_active);
+	case ZIO_PRIORITY_ASYNC_READ:
+		return (zfs_vdev_async_read_min_active);
+	case ZIO_PRIORITY_ASYNC_WRITE:
+		return (zfs_vdev_async_write_min_active);
+	case ZIO_PRIORITY_SCRUB:
+		return (zfs_vdev_scrub_min_active);
+	default:
+		panic("invalid priority %u", p);
+		return (0);
+	}
+}
+
+static int
+vdev_queue_max_async_writes(spa_t *spa)
+{
+	int writes;
+	uint64_t dirty;
+	uint64_t min_pct = zfs_vdev_async_write_active_min_dirty_percent;
+	uint64_t max_pct = zfs_vdev_async_write_active_max_dirty_percent;
+
+	if (spa->spa_dsl_pool == NULL)
+		return (zfs_vdev_async_write_min_active);
+
+	dirty = dsl_pool_dirty_pct(spa->spa_dsl_pool);
+	if (dirty < min_pct)
+		return (zfs_vdev_async_write_min_active);
+	if (dirty > max_pct || max_pct <= min_pct)
+		return (zfs_vdev_async_write_max_active);
+
+	/*
+	 * linear interpolation:
+	 * slope = (max_writes - min_writes) / (max_pct - min_pct)
+	 * move right by min_pct
+	 * move up by min_writes
+	 */
+	writes = (dirty - min_pct) *
+	    (zfs_vdev_async_write_max_active -
+	    zfs_vdev_async_write_min_active) /
+	    (max_pct - min_pct) +
+	    zfs_vdev_async_write_min_active;
+	ASSERT3U(writes, >=, zfs_vdev_async_write_min_active);
+	ASSERT3U(writes, <=, zfs_vdev_async_write_max_active);
+	return (writes);
+}
+
+static int
+vdev_queue_class_max_active(spa_t *spa, zio_priority_t p)
+{
+	switch (p) {
+	case ZIO_PRIORITY_SYNC_READ:
+		return (zfs_vdev_sync_read_max_active);
+	case ZIO_PRIORITY_SYNC_WRITE:
+		return (zfs_vdev_sync_write_max_active);
+	case ZIO_PRIORITY_ASYNC_READ:
+		return (zfs_vdev_async_read_max_active);
+	case ZIO_PRIORITY_ASYNC_WRITE:
+		return (vdev_queue_max_async_writes(spa));
+	case ZIO_PRIORITY_SCRUB:
+		return (zfs_vdev_scrub_max_active);
+	default:
+		panic("invalid priority %u", p);
+		return (0);
+	}
+}
+
+/*
+ * Return the i/o class to issue from, or ZIO_PRIORITY_NUM_QUEUEABLE if
+ * there is no eligible class.
+ */
+static zio_priority_t
+vdev_queue_class_to_issue(vdev_queue_t *vq)
+{
+	spa_t *spa = vq->vq_vdev->vdev_spa;
+	zio_priority_t p;
+
+	if (avl_numnodes(&vq->vq_active_tree) >= zfs_vdev_max_active)
+		return (ZIO_PRIORITY_NUM_QUEUEABLE);
+
+	/* find a queue that has not reached its minimum # outstanding i/os */
+	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+		if (avl_numnodes(&vq->vq_class[p].vqc_queued_tree) > 0 &&
+		    vq->vq_class[p].vqc_active <
+		    vdev_queue_class_min_active(p))
+			return (p);
+	}
+
+	/*
+	 * If we haven't found a queue, look for one that hasn't reached its
+	 * maximum # outstanding i/os.
+	 */
+	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+		if (avl_numnodes(&vq->vq_class[p].vqc_queued_tree) > 0 &&
+		    vq->vq_class[p].vqc_active <
+		    vdev_queue_class_max_active(spa, p))
+			return (p);
+	}
+
+	/* No eligible queued i/os */
+	return (ZIO_PRIORITY_NUM_QUEUEABLE);
+}
+
+/*
+ * The aggregate's gang ABD is made of views of its children's buffers,
+ * so read data has already landed where it belongs.  All that is left is
+ * to release the gang, along with any read gap and zero fill buffers.
+ */
+static void
+vdev_queue_agg_io_done(zio_t *aio)
+{
+	abd_free(aio->io_abd);
 }
 
 /*
@@ -202,163 +539,208 @@ vdev_queue_agg_io_done(zio_t *aio)
 #define	IO_GAP(fio, lio) (-IO_SPAN(lio, fio))
 
 static zio_t *
-vdev_queue_io_to_issue(vdev_queue_t *vq, uint64_t pending_limit)
+vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 {
-	zio_t *fio, *lio, *aio, *dio, *nio, *mio;
+	zio_t *first, *last, *aio, *dio, *mandatory, *nio;
 	avl_tree_t *t;
-	vdev_io_t *vi;
 	int flags;
 	uint64_t maxspan = MIN(zfs_vdev_aggregation_limit, SPA_MAXBLOCKSIZE);
-	uint64_t maxgap;
-	int stretch;
+	uint64_t maxgap = 0;
+	uint64_t size;
+	hrtime_t now;
+	boolean_t stretch = B_FALSE;
 
-again:
 	ASSERT(MUTEX_HELD(&vq->vq_lock));
 
-	if (avl_numnodes(&vq->vq_pending_tree) >= pending_limit ||
-	    avl_numnodes(&vq->vq_deadline_tree) == 0)
+	if (zio->io_flags & ZIO_FLAG_DONT_AGGREGATE)
 		return (NULL);
 
-	fio = lio = avl_first(&vq->vq_deadline_tree);
+	first = last = zio;
+	t = &vq->vq_class[zio->io_priority].vqc_queued_tree;
+	flags = zio->io_flags & ZIO_FLAG_AGG_INHERIT;
+
+	if (zio->io_type == ZIO_TYPE_READ)
+		maxgap = zfs_vdev_read_gap_limit;
+
+	/*
+	 * We can aggregate I/Os that are sufficiently adjacent and of
+	 * the same flavor, as expressed by the AGG_INHERIT flags.
+	 * The latter requirement is necessary so that certain
+	 * attributes of the I/O, such as whether it's a normal I/O
+	 * or a scrub/resilver, can be preserved in the aggregate.
+	 * We can include optional I/Os, but don't allow them
+	 * to begin a range as they add no benefit in that situation.
+	 * Only I/Os of the same class are candidates, so each class
+	 * tree holds I/Os of a single type.
+	 */
 
-	t = fio->io_vdev_tree;
-	flags = fio->io_flags & ZIO_FLAG_AGG_INHERIT;
-	maxgap = (t == &vq->vq_read_tree) ? zfs_vdev_read_gap_limit : 0;
+	/*
+	 * We keep track of the last non-optional I/O.
+	 */
+	mandatory = (first->io_flags & ZIO_FLAG_OPTIONAL) ? NULL : first;
 
-	vi = list_head(&vq->vq_io_list);
-	if (vi == NULL) {
-		vi = zio_vdev_alloc();
-		list_insert_head(&vq->vq_io_list, vi);
+	/*
+	 * Walk backwards through sufficiently contiguous I/Os
+	 * recording the last non-option I/O.
+	 */
+	while ((dio = AVL_PREV(t, first)) != NULL &&
+	    (dio->io_flags & ZIO_FLAG_AGG_INHERIT) == flags &&
+	    IO_SPAN(dio, last) <= maxspan &&
+	    IO_GAP(dio, first) <= maxgap) {
+		first = dio;
+		if (mandatory == NULL &&
+		    !(first->io_flags & ZIO_FLAG_OPTIONAL))
+			mandatory = first;
 	}
 
-	if (!(flags & ZIO_FLAG_DONT_AGGREGATE)) {
-		/*
-		 * We can aggregate I/Os that are sufficiently adjacent and of
-		 * the same flavor, as expressed by the AGG_INHERIT flags.
-		 * The latter requirement is necessary so that certain
-		 * attributes of the I/O, such as whether it's a normal I/O
-		 * or a scrub/resilver, can be preserved in the aggregate.
-		 * We can include optional I/Os, but don't allow them
-		 * to begin a range as they add no benefit in that situation.
-		 */
-
-		/*
-		 * We keep track of the last non-optional I/O.
-		 */
-		mio = (fio->io_flags & ZIO_FLAG_OPTIONAL) ? NULL : fio;
-
-		/*
-		 * Walk backwards through sufficiently contiguous I/Os
-		 * recording the last non-option I/O.
-		 */
-		while ((dio = AVL_PREV(t, fio)) != NULL &&
-		    (dio->io_flags & ZIO_FLAG_AGG_INHERIT) == flags &&
-		    IO_SPAN(dio, lio) <= maxspan &&
-		    IO_GAP(dio, fio) <= maxgap) {
-			fio = dio;
-			if (mio == NULL && !(fio->io_flags & ZIO_FLAG_OPTIONAL))
-				mio = fio;
-		}
+	/*
+	 * Skip any initial optional I/Os.
+	 */
+	while ((first->io_flags & ZIO_FLAG_OPTIONAL) && first != last) {
+		first = AVL_NEXT(t, first);
+		ASSERT(first != NULL);
+	}
 
-		/*
-		 * Skip any initial optional I/Os.
-		 */
-		while ((fio->io_flags & ZIO_FLAG_OPTIONAL) && fio != lio) {
-			fio = AVL_NEXT(t, fio);
-			ASSERT(fio != NULL);
+	/*
+	 * Walk forward through sufficiently contiguous I/Os.
+	 */
+	while ((dio = AVL_NEXT(t, last)) != NULL &&
+	    (dio->io_flags & ZIO_FLAG_AGG_INHERIT) == flags &&
+	    IO_SPAN(first, dio) <= maxspan &&
+	    IO_GAP(last, dio) <= maxgap) {
+		last = dio;
+		if (!(last->io_flags & ZIO_FLAG_OPTIONAL))
+			mandatory = last;
+	}
+
+	/*
+	 * Now that we've established the range of the I/O aggregation
+	 * we must decide what to do with trailing optional I/Os.
+	 * For reads, there's nothing to do. While we are unable to
+	 * aggregate further, it's possible that a trailing optional
+	 * I/O would allow the underlying device to aggregate with
+	 * subsequent I/Os. We must therefore determine if the next
+	 * non-optional I/O is close enough to make aggregation
+	 * worthwhile.
+	 */
+	if (zio->io_type == ZIO_TYPE_WRITE && mandatory != NULL) {
+		nio = last;
+		while ((dio = AVL_NEXT(t, nio)) != NULL &&
+		    IO_GAP(nio, dio) == 0 &&
+		    IO_GAP(mandatory, dio) <= zfs_vdev_write_gap_limit) {
+			nio = dio;
+			if (!(nio->io_flags & ZIO_FLAG_OPTIONAL)) {
+				stretch = B_TRUE;
+				break;
+			}
 		}
+	}
 
-		/*
-		 * Walk forward through sufficiently contiguous I/Os.
-		 */
-		while ((dio = AVL_NEXT(t, lio)) != NULL &&
-		    (dio->io_flags & ZIO_FLAG_AGG_INHERIT) == flags &&
-		    IO_SPAN(fio, dio) <= maxspan &&
-		    IO_GAP(lio, dio) <= maxgap) {
-			lio = dio;
-			if (!(lio->io_flags & ZIO_FLAG_OPTIONAL))
-				mio = lio;
+	if (stretch) {
+		/* This may be a no-op. */
+		dio = AVL_NEXT(t, last);
+		dio->io_flags &= ~ZIO_FLAG_OPTIONAL;
+	} else {
+		while (last != mandatory && last != first) {
+			ASSERT(last->io_flags & ZIO_FLAG_OPTIONAL);
+			last = AVL_PREV(t, last);
+			ASSERT(last != NULL);
 		}
+	}
 
-		/*
-		 * Now that we've established the range of the I/O aggregation
-		 * we must decide what to do with trailing optional I/Os.
-		 * For reads, there's nothing to do. While we are unable to
-		 * aggregate further, it's possible that a trailing optional
-		 * I/O would allow the underlying device to aggregate with
-		 * subsequent I/Os. We must therefore determine if the next
-		 * non-optional I/O is close enough to make aggregation
-		 * worthwhile.
-		 */
-		stretch = B_FALSE;
-		if (t != &vq->vq_read_tree && mio != NULL) {
-			nio = lio;
-			while ((dio = AVL_NEXT(t, nio)) != NULL &&
-			    IO_GAP(nio, dio) == 0 &&
-			    IO_GAP(mio, dio) <= zfs_vdev_write_gap_limit) {
-				nio = dio;
-				if (!(nio->io_flags & ZIO_FLAG_OPTIONAL)) {
-					stretch = B_TRUE;
-					break;
-				}
-			}
+	if (first == last)
+		return (NULL);
+
+	size = IO_SPAN(first, last);
+	ASSERT3U(size, <=, maxspan);
+
+	aio = zio_vdev_delegated_io(first->io_vd, first->io_offset,
+	    abd_alloc_gang(), size, first->io_type, zio->io_priority,
+	    flags | ZIO_FLAG_DONT_CACHE | ZIO_FLAG_DONT_QUEUE,
+	    vdev_queue_agg_io_done, NULL);
+	now = gethrtime();
+
+	/*
+	 * Rather than copying each child's data into (or out of) a bounce
+	 * buffer, chain views of the child buffers into the aggregate's gang
+	 * ABD.  The same buffer may be queued on several leaves at once (for
+	 * instance by a mirror), hence a private view for each.  Gaps between
+	 * reads are filled with scratch buffers, and optional writes which
+	 * carry no data are written from the shared zero ABD.
+	 */
+	nio = first;
+	do {
+		uint64_t next_offset = first->io_offset + aio->io_abd->abd_size;
+
+		dio = nio;
+		nio = AVL_NEXT(t, dio);
+		ASSERT3U(dio->io_type, ==, aio->io_type);
+		ASSERT3U(dio->io_offset, >=, next_offset);
+
+		if (dio->io_offset != next_offset) {
+			ASSERT3U(dio->io_type, ==, ZIO_TYPE_READ);
+			abd_gang_add(aio->io_abd, abd_alloc_for_io(
+			    dio->io_offset - next_offset, B_TRUE));
 		}
 
-		if (stretch) {
-			/* This may be a no-op. */
-			VERIFY((dio = AVL_NEXT(t, lio)) != NULL);
-			dio->io_flags &= ~ZIO_FLAG_OPTIONAL;
+		if (dio->io_flags & ZIO_FLAG_NODATA) {
+			ASSERT3U(dio->io_type, ==, ZIO_TYPE_WRITE);
+			abd_gang_add(aio->io_abd, abd_get_zeros(dio->io_size));
 		} else {
-			while (lio != mio && lio != fio) {
-				ASSERT(lio->io_flags & ZIO_FLAG_OPTIONAL);
-				lio = AVL_PREV(t, lio);
-				ASSERT(lio != NULL);
-			}
+			abd_gang_add(aio->io_abd,
+			    abd_get_offset_size(dio->io_abd, 0, dio->io_size));
 		}
-	}
 
-	if (fio != lio) {
-		uint64_t size = IO_SPAN(fio, lio);
-		ASSERT(size <= maxspan);
-		ASSERT(vi != NULL);
-
-		aio = zio_vdev_delegated_io(fio->io_vd, fio->io_offset,
-		    vi, size, fio->io_type, ZIO_PRIORITY_AGG,
-		    flags | ZIO_FLAG_DONT_CACHE | ZIO_FLAG_DONT_QUEUE,
-		    vdev_queue_agg_io_done, NULL);
-		aio->io_timestamp = fio->io_timestamp;
-
-		nio = fio;
-		do {
-			dio = nio;
-			nio = AVL_NEXT(t, dio);
-			ASSERT(dio->io_type == aio->io_type);
-			ASSERT(dio->io_vdev_tree == t);
-
-			if (dio->io_flags & ZIO_FLAG_NODATA) {
-				ASSERT(dio->io_type == ZIO_TYPE_WRITE);
-				bzero((char *)aio->io_data + (dio->io_offset -
-				    aio->io_offset), dio->io_size);
-			} else if (dio->io_type == ZIO_TYPE_WRITE) {
-				bcopy(dio->io_data, (char *)aio->io_data +
-				    (dio->io_offset - aio->io_offset),
-				    dio->io_size);
-			}
+		zio_add_child(dio, aio);
+		vdev_queue_stat_dequeue(vq, dio, now);
+		vdev_queue_io_remove(vq, dio);
+		zio_vdev_io_bypass(dio);
+		zio_execute(dio);
+	} while (dio != last);
+
+	ASSERT3U(aio->io_abd->abd_size, ==, size);
 
-			zio_add_child(dio, aio);
-			vdev_queue_io_remove(vq, dio);
-			zio_vdev_io_bypass(dio);
-			zio_execute(dio);
-		} while (dio != lio);
+	return (aio);
+}
+
+static zio_t *
+vdev_queue_io_to_issue(vdev_queue_t *vq)
+{
+	zio_t *zio, *aio;
+	zio_priority_t p;
+	avl_index_t idx;
+	avl_tree_t *tree;
+	zio_t search;
+
+again:
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
 
-		avl_add(&vq->vq_pending_tree, aio);
-		list_remove(&vq->vq_io_list, vi);
+	p = vdev_queue_class_to_issue(vq);
 
-		return (aio);
+	if (p == ZIO_PRIORITY_NUM_QUEUEABLE) {
+		/* No eligible queued i/os */
+		return (NULL);
 	}
 
-	ASSERT(fio->io_vdev_tree == t);
-	vdev_queue_io_remove(vq, fio);
+	/*
+	 * Every class is kept in LBA (offset) order, which is also what
+	 * aggregation needs.  Issue the i/o which follows the most recently
+	 * issued i/o, wrapping around to the lowest offset.
+	 */
+	tree = &vq->vq_class[p].vqc_queued_tree;
+	search.io_timestamp = 0;
+	search.io_offset = vq->vq_last_offset + 1;
+	VERIFY3P(avl_find(tree, &search, &idx), ==, NULL);
+	zio = avl_nearest(tree, idx, AVL_AFTER);
+	if (zio == NULL)
+		zio = avl_first(tree);
+	ASSERT3U(zio->io_priority, ==, p);
+
+	aio = vdev_queue_aggregate(vq, zio);
+	if (aio != NULL)
+		zio = aio;
+	else
+		vdev_queue_io_remove(vq, zio);
 
 	/*
 	 * If the I/O is or was optional and therefore has no data, we need to
@@ -366,17 +748,21 @@ again:
 	 * deadlock that we could encounter since this I/O will complete
 	 * immediately.
 	 */
-	if (fio->io_flags & ZIO_FLAG_NODATA) {
+	if (zio->io_flags & ZIO_FLAG_NODATA) {
 		mutex_exit(&vq->vq_lock);
-		zio_vdev_io_bypass(fio);
-		zio_execute(fio);
+		zio_vdev_io_bypass(zio);
+		zio_execute(zio);
 		mutex_enter(&vq->vq_lock);
 		goto again;
 	}
 
-	avl_add(&vq->vq_pending_tree, fio);
+	if (aio == NULL)
+		vdev_queue_stat_dequeue(vq, zio, gethrtime());
+	vdev_queue_pending_add(vq, zio);
+	vq->vq_last_offset = zio->io_offset;
+	vq->vq_next_offset = zio->io_offset + zio->io_size;
 
-	return (fio);
+	return (zio);
 }
 
 zio_t *
@@ -390,23 +776,28 @@ vdev_queue_io(zio_t *zio)
 	if (zio->io_flags & ZIO_FLAG_DONT_QUEUE)
 		return (zio);
 
-	zio->io_flags |= ZIO_FLAG_DONT_CACHE | ZIO_FLAG_DONT_QUEUE;
+	/*
+	 * Children i/os inherit their parent's priority, which might
+	 * not match the child's i/o type.  Fix it up here.
+	 */
+	if (zio->io_type == ZIO_TYPE_READ) {
+		if (zio->io_priority != ZIO_PRIORITY_SYNC_READ &&
+		    zio->io_priority != ZIO_PRIORITY_ASYNC_READ &&
+		    zio->io_priority != ZIO_PRIORITY_SCRUB)
+			zio->io_priority = ZIO_PRIORITY_ASYNC_READ;
+	} else {
+		ASSERT(zio->io_type == ZIO_TYPE_WRITE);
+		if (zio->io_priority != ZIO_PRIORITY_SYNC_WRITE &&
+		    zio->io_priority != ZIO_PRIORITY_ASYNC_WRITE)
+			zio->io_priority = ZIO_PRIORITY_ASYNC_WRITE;
+	}
 
-	if (zio->io_type == ZIO_TYPE_READ)
-		zio->io_vdev_tree = &vq->vq_read_tree;
-	else
-		zio->io_vdev_tree = &vq->vq_write_tree;
+	zio->io_flags |= ZIO_FLAG_DONT_CACHE | ZIO_FLAG_DONT_QUEUE;
 
 	mutex_enter(&vq->vq_lock);
-
-	zio->io_timestamp = gethrtime();
-	zio->io_deadline = (zio->io_timestamp >> zfs_vdev_time_shift) +
-	    zio->io_priority;
-
+	zio->io_queued_timestamp = gethrtime();
 	vdev_queue_io_add(vq, zio);
-
-	nio = vdev_queue_io_to_issue(vq, zfs_vdev_min_pending);
-
+	nio = vdev_queue_io_to_issue(vq);
 	mutex_exit(&vq->vq_lock);
 
 	if (nio == NULL)
@@ -424,23 +815,34 @@ void
 vdev_queue_io_done(zio_t *zio)
 {
 	vdev_queue_t *vq = &zio->io_vd->vdev_queue;
-	int i;
+	zio_t *nio;
+#if defined(_KERNEL) && defined(HAVE_BLK_PLUG)
+	struct blk_plug plug;
+#endif
 
 	if (zio_injection_enabled)
 		delay(SEC_TO_TICK(zio_handle_io_delay(zio)));
 
 	mutex_enter(&vq->vq_lock);
 
-	avl_remove(&vq->vq_pending_tree, zio);
+	vdev_queue_pending_remove(vq, zio);
 
-	zio->io_delta = gethrtime() - zio->io_timestamp;
 	vq->vq_io_complete_ts = gethrtime();
-	vq->vq_io_delta_ts = vq->vq_io_complete_ts - zio->io_timestamp;
+	zio->io_delta = vq->vq_io_complete_ts - zio->io_timestamp;
+	vq->vq_io_delta_ts = zio->io_delta;
+	vdev_queue_histo_add(vq->vq_stat_ex.vsx_disk_histo[zio->io_priority],
+	    VDEV_L_HISTO_BUCKETS, zio->io_delta);
+
+#if defined(_KERNEL) && defined(HAVE_BLK_PLUG)
+	/*
+	 * Every zio issued below is started synchronously in this thread,
+	 * so plugging the block layer lets the whole batch reach the device
+	 * driver at once rather than one bio at a time.
+	 */
+	blk_start_plug(&plug);
+#endif
 
-	for (i = 0; i < zfs_vdev_ramp_rate; i++) {
-		zio_t *nio = vdev_queue_io_to_issue(vq, zfs_vdev_max_pending);
-		if (nio == NULL)
-			break;
+	while ((nio = vdev_queue_io_to_issue(vq)) != NULL) {
 		mutex_exit(&vq->vq_lock);
 		if (nio->io_done == vdev_queue_agg_io_done) {
 			zio_nowait(nio);
@@ -452,27 +854,97 @@ vdev_queue_io_done(zio_t *zio)
 	}
 
 	mutex_exit(&vq->vq_lock);
+
+#if defined(_KERNEL) && defined(HAVE_BLK_PLUG)
+	blk_finish_plug(&plug);
+#endif
 }
 
-#if defined(_KERNEL) && defined(HAVE_SPL)
-module_param(zfs_vdev_max_pending, int, 0644);
-MODULE_PARM_DESC(zfs_vdev_max_pending, "Max pending per-vdev I/Os");
+/*
+ * The number of i/os queued or issued to a leaf vdev.  This is sampled
+ * without vq_lock by the mirror read selection, so it is only a hint.
+ */
+int
+vdev_queue_length(vdev_t *vd)
+{
+	vdev_queue_t *vq = &vd->vdev_queue;
+	int length = avl_numnodes(&vq->vq_active_tree);
+	zio_priority_t p;
 
-module_param(zfs_vdev_min_pending, int, 0644);
-MODULE_PARM_DESC(zfs_vdev_min_pending, "Min pending per-vdev I/Os");
+	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++)
+		length += avl_numnodes(&vq->vq_class[p].vqc_queued_tree);
 
-module_param(zfs_vdev_aggregation_limit, int, 0644);
-MODULE_PARM_DESC(zfs_vdev_aggregation_limit, "Max vdev I/O aggregation size");
+	return (length);
+}
 
-module_param(zfs_vdev_time_shift, int, 0644);
-MODULE_PARM_DESC(zfs_vdev_time_shift, "Deadline time shift for vdev I/O");
+/*
+ * The offset just past the most recently issued i/o, i.e. where the head
+ * of a rotational device will be once that i/o completes.
+ */
+uint64_t
+vdev_queue_next_offset(vdev_t *vd)
+{
+	return (vd->vdev_queue.vq_next_offset);
+}
 
-module_param(zfs_vdev_ramp_rate, int, 0644);
-MODULE_PARM_DESC(zfs_vdev_ramp_rate, "Exponential I/O issue ramp-up rate");
+#if defined(_KERNEL) && defined(HAVE_SPL)
+module_param(zfs_vdev_aggregation_limit, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_aggregation_limit, "Max vdev I/O aggregation size");
 
 module_param(zfs_vdev_read_gap_limit, int, 0644);
 MODULE_PARM_DESC(zfs_vdev_read_gap_limit, "Aggregate read I/O over gap");
 
 module_param(zfs_vdev_write_gap_limit, int, 0644);
 MODULE_PARM_DESC(zfs_vdev_write_gap_limit, "Aggregate write I/O over gap");
+
+module_param(zfs_vdev_max_active, uint, 0644);
+MODULE_PARM_DESC(zfs_vdev_max_active, "Maximum number of active I/Os per vdev");
+
+module_param(zfs_vdev_async_write_active_max_dirty_percent, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_async_write_active_max_dirty_percent,
+	"Async write concurrency max threshold");
+
+module_param(zfs_vdev_async_write_active_min_dirty_percent, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_async_write_active_min_dirty_percent,
+	"Async write concurrency min threshold");
+
+module_param(zfs_vdev_async_read_max_active, uint, 0644);
+MODULE_PARM_DESC(zfs_vdev_async_read_max_active,
+	"Max active async read I/Os per vdev");
+
+module_param(zfs_vdev_async_read_min_active, uint, 0644);
+MODULE_PARM_DESC(zfs_vdev_async_read_min_active,
+	"Min active async read I/Os per vdev");
+
+module_param(zfs_vdev_async_write_max_active, uint, 0644);
+MODULE_PARM_DESC(zfs_vdev_async_write_max_active,
+	"Max active async write I/Os per vdev");
+
+module_param(zfs_vdev_async_write_min_active, uint, 0644);
+MODULE_PARM_DESC(zfs_vdev_async_write_min_active,
+	"Min active async write I/Os per vdev");
+
+module_param(zfs_vdev_scrub_max_active, uint, 0644);
+MODULE_PARM_DESC(zfs_vdev_scrub_max_active,
+	"Max active scrub I/Os per vdev");
+
+module_param(zfs_vdev_scrub_min_active, uint, 0644);
+MODULE_PARM_DESC(zfs_vdev_scrub_min_active,
+	"Min active scrub I/Os per vdev");
+
+module_param(zfs_vdev_sync_read_max_active, uint, 0644);
+MODULE_PARM_DESC(zfs_vdev_sync_read_max_active,
+	"Max active sync read I/Os per vdev");
+
+module_param(zfs_vdev_sync_read_min_active, uint, 0644);
+MODULE_PARM_DESC(zfs_vdev_sync_read_min_active,
+	"Min active sync read I/Os per vdev");
+
+module_param(zfs_vdev_sync_write_max_active, uint, 0644);
+MODULE_PARM_DESC(zfs_vdev_sync_write_max_active,
+	"Max active sync write I/Os per vdev");
+
+module_param(zfs_vdev_sync_write_min_active, uint, 0644);
+MODULE_PARM_DESC(zfs_vdev_sync_write_min_active,
+	"Min active sync write I/Os per vdev");
 #endif
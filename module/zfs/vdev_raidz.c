@@ -27,6 +27,7 @@
 #include <sys/zfs_context.h>
 #include <sys/spa.h>
 #include <sys/vdev_impl.h>
+#include <sys/vdev_raidz.h>
 #include <sys/zio.h>
 #include <sys/zio_checksum.h>
 #include <sys/fs/zfs.h>
@@ -102,7 +103,7 @@ typedef struct raidz_col {
 	uint64_t rc_devidx;		/* child device index for I/O */
 	uint64_t rc_offset;		/* device offset */
 	uint64_t rc_size;		/* I/O size */
-	void *rc_data;			/* I/O data */
+	abd_t *rc_abd;			/* I/O data */
 	void *rc_gdata;			/* used to store the "good" version */
 	int rc_error;			/* I/O error for this device */
 	uint8_t rc_tried;		/* Did we attempt this I/O column? */
@@ -119,10 +120,11 @@ typedef struct raidz_map {
 	uint64_t rm_firstdatacol;	/* First data column/parity count */
 	uint64_t rm_nskip;		/* Skipped sectors for padding */
 	uint64_t rm_skipstart;	/* Column index of padding start */
-	void *rm_datacopy;		/* rm_asize-buffer of copied data */
+	abd_t *rm_abd_copy;		/* rm_asize-buffer of copied data */
 	uintptr_t rm_reports;		/* # of referencing checksum reports */
 	uint8_t	rm_freed;		/* map no longer has referencing ZIO */
 	uint8_t	rm_ecksuminjected;	/* checksum error was injected */
+	const raidz_math_ops_t *rm_ops;	/* parity math implementation */
 	raidz_col_t rm_col[1];		/* Flexible array of I/O columns */
 } raidz_map_t;
 
@@ -130,29 +132,6 @@ typedef struct raidz_map {
 #define	VDEV_RAIDZ_Q		1
 #define	VDEV_RAIDZ_R		2
 
-#define	VDEV_RAIDZ_MUL_2(x)	(((x) << 1) ^ (((x) & 0x80) ? 0x1d : 0))
-#define	VDEV_RAIDZ_MUL_4(x)	(VDEV_RAIDZ_MUL_2(VDEV_RAIDZ_MUL_2(x)))
-
-/*
- * We provide a mechanism to perform the field multiplication operation on a
- * 64-bit value all at once rather than a byte at a time. This works by
- * creating a mask from the top bit in each byte and using that to
- * conditionally apply the XOR of 0x1d.
- */
-#define	VDEV_RAIDZ_64MUL_2(x, mask) \
-{ \
-	(mask) = (x) & 0x8080808080808080ULL; \
-	(mask) = ((mask) << 1) - ((mask) >> 7); \
-	(x) = (((x) << 1) & 0xfefefefefefefefeULL) ^ \
-	    ((mask) & 0x1d1d1d1d1d1d1d1dULL); \
-}
-
-#define	VDEV_RAIDZ_64MUL_4(x, mask) \
-{ \
-	VDEV_RAIDZ_64MUL_2((x), mask); \
-	VDEV_RAIDZ_64MUL_2((x), mask); \
-}
-
 /*
  * Force reconstruction to use the general purpose method.
  */
@@ -259,7 +238,7 @@ vdev_raidz_map_free(raidz_map_t *rm)
 	size_t size;
 
 	for (c = 0; c < rm->rm_firstdatacol; c++) {
-		zio_buf_free(rm->rm_col[c].rc_data, rm->rm_col[c].rc_size);
+		abd_free(rm->rm_col[c].rc_abd);
 
 		if (rm->rm_col[c].rc_gdata != NULL)
 			zio_buf_free(rm->rm_col[c].rc_gdata,
@@ -267,11 +246,13 @@ vdev_raidz_map_free(raidz_map_t *rm)
 	}
 
 	size = 0;
-	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++)
+	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
+		abd_put(rm->rm_col[c].rc_abd);
 		size += rm->rm_col[c].rc_size;
+	}
 
-	if (rm->rm_datacopy != NULL)
-		zio_buf_free(rm->rm_datacopy, size);
+	if (rm->rm_abd_copy != NULL)
+		abd_free(rm->rm_abd_copy);
 
 	kmem_free(rm, offsetof(raidz_map_t, rm_col[rm->rm_scols]));
 }
@@ -308,7 +289,7 @@ vdev_raidz_cksum_finish(zio_cksum_report_t *zcr, const void *good_data)
 	size_t x;
 
 	const char *good = NULL;
-	const char *bad = rm->rm_col[c].rc_data;
+	char *bad;
 
 	if (good_data == NULL) {
 		zfs_ereport_finish_checksum(zcr, NULL, NULL, B_FALSE);
@@ -322,8 +303,9 @@ vdev_raidz_cksum_finish(zio_cksum_report_t *zcr, const void *good_data)
 		 * data never changes for a given logical ZIO)
 		 */
 		if (rm->rm_col[0].rc_gdata == NULL) {
-			char *bad_parity[VDEV_RAIDZ_MAXPARITY];
+			abd_t *bad_parity[VDEV_RAIDZ_MAXPARITY];
 			char *buf;
+			uint64_t offset;
 
 			/*
 			 * Set up the rm_col[]s to generate the parity for
@@ -331,15 +313,20 @@ vdev_raidz_cksum_finish(zio_cksum_report_t *zcr, const void *good_data)
 			 * replacing them with buffers to hold the result.
 			 */
 			for (x = 0; x < rm->rm_firstdatacol; x++) {
-				bad_parity[x] = rm->rm_col[x].rc_data;
-				rm->rm_col[x].rc_data = rm->rm_col[x].rc_gdata =
+				bad_parity[x] = rm->rm_col[x].rc_abd;
+				rm->rm_col[x].rc_gdata =
 				    zio_buf_alloc(rm->rm_col[x].rc_size);
+				rm->rm_col[x].rc_abd =
+				    abd_get_from_buf(rm->rm_col[x].rc_gdata,
+				    rm->rm_col[x].rc_size);
 			}
 
 			/* fill in the data columns from good_data */
 			buf = (char *)good_data;
 			for (; x < rm->rm_cols; x++) {
-				rm->rm_col[x].rc_data = buf;
+				abd_put(rm->rm_col[x].rc_abd);
+				rm->rm_col[x].rc_abd = abd_get_from_buf(buf,
+				    rm->rm_col[x].rc_size);
 				buf += rm->rm_col[x].rc_size;
 			}
 
@@ -349,13 +336,18 @@ vdev_raidz_cksum_finish(zio_cksum_report_t *zcr, const void *good_data)
 			vdev_raidz_generate_parity(rm);
 
 			/* restore everything back to its original state */
-			for (x = 0; x < rm->rm_firstdatacol; x++)
-				rm->rm_col[x].rc_data = bad_parity[x];
+			for (x = 0; x < rm->rm_firstdatacol; x++) {
+				abd_put(rm->rm_col[x].rc_abd);
+				rm->rm_col[x].rc_abd = bad_parity[x];
+			}
 
-			buf = rm->rm_datacopy;
+			offset = 0;
 			for (x = rm->rm_firstdatacol; x < rm->rm_cols; x++) {
-				rm->rm_col[x].rc_data = buf;
-				buf += rm->rm_col[x].rc_size;
+				abd_put(rm->rm_col[x].rc_abd);
+				rm->rm_col[x].rc_abd = abd_get_offset_size(
+				    rm->rm_abd_copy, offset,
+				    rm->rm_col[x].rc_size);
+				offset += rm->rm_col[x].rc_size;
 			}
 		}
 
@@ -370,7 +362,9 @@ vdev_raidz_cksum_finish(zio_cksum_report_t *zcr, const void *good_data)
 	}
 
 	/* we drop the ereport if it ends up that the data was good */
+	bad = abd_borrow_buf_copy(rm->rm_col[c].rc_abd, rm->rm_col[c].rc_size);
 	zfs_ereport_finish_checksum(zcr, good, bad, B_TRUE);
+	abd_return_buf(rm->rm_col[c].rc_abd, bad, rm->rm_col[c].rc_size);
 }
 
 /*
@@ -383,7 +377,7 @@ static void
 vdev_raidz_cksum_report(zio_t *zio, zio_cksum_report_t *zcr, void *arg)
 {
 	size_t c = (size_t)(uintptr_t)arg;
-	caddr_t buf;
+	uint64_t offset;
 
 	raidz_map_t *rm = zio->io_vsd;
 	size_t size;
@@ -397,7 +391,7 @@ vdev_raidz_cksum_report(zio_t *zio, zio_cksum_report_t *zcr, void *arg)
 	rm->rm_reports++;
 	ASSERT3U(rm->rm_reports, >, 0);
 
-	if (rm->rm_datacopy != NULL)
+	if (rm->rm_abd_copy != NULL)
 		return;
 
 	/*
@@ -413,17 +407,21 @@ vdev_raidz_cksum_report(zio_t *zio, zio_cksum_report_t *zcr, void *arg)
 	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++)
 		size += rm->rm_col[c].rc_size;
 
-	buf = rm->rm_datacopy = zio_buf_alloc(size);
+	rm->rm_abd_copy = abd_alloc_sametype(
+	    rm->rm_col[rm->rm_firstdatacol].rc_abd, size);
 
-	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
+	for (offset = 0, c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
 		raidz_col_t *col = &rm->rm_col[c];
+		abd_t *tmp = abd_get_offset_size(rm->rm_abd_copy, offset,
+		    col->rc_size);
 
-		bcopy(col->rc_data, buf, col->rc_size);
-		col->rc_data = buf;
+		abd_copy(tmp, col->rc_abd, col->rc_size);
+		abd_put(col->rc_abd);
+		col->rc_abd = tmp;
 
-		buf += col->rc_size;
+		offset += col->rc_size;
 	}
-	ASSERT3P(buf - (caddr_t)rm->rm_datacopy, ==, size);
+	ASSERT3U(offset, ==, size);
 }
 
 static const zio_vsd_ops_t vdev_raidz_vsd_ops = {
@@ -441,6 +439,7 @@ vdev_raidz_map_alloc(zio_t *zio, uint64_t unit_shift, uint64_t dcols,
 	uint64_t f = b % dcols;
 	uint64_t o = (b / dcols) << unit_shift;
 	uint64_t q, r, c, bc, col, acols, scols, coff, devidx, asize, tot;
+	uint64_t off = 0;
 
 	q = s / (dcols - nparity);
 	r = s - q * (dcols - nparity);
@@ -466,10 +465,11 @@ vdev_raidz_map_alloc(zio_t *zio, uint64_t unit_shift, uint64_t dcols,
 	rm->rm_missingdata = 0;
 	rm->rm_missingparity = 0;
 	rm->rm_firstdatacol = nparity;
-	rm->rm_datacopy = NULL;
+	rm->rm_abd_copy = NULL;
 	rm->rm_reports = 0;
 	rm->rm_freed = 0;
 	rm->rm_ecksuminjected = 0;
+	rm->rm_ops = vdev_raidz_math_get();
 
 	asize = 0;
 
@@ -482,7 +482,7 @@ vdev_raidz_map_alloc(zio_t *zio, uint64_t unit_shift, uint64_t dcols,
 		}
 		rm->rm_col[c].rc_devidx = col;
 		rm->rm_col[c].rc_offset = coff;
-		rm->rm_col[c].rc_data = NULL;
+		rm->rm_col[c].rc_abd = NULL;
 		rm->rm_col[c].rc_gdata = NULL;
 		rm->rm_col[c].rc_error = 0;
 		rm->rm_col[c].rc_tried = 0;
@@ -504,14 +504,20 @@ vdev_raidz_map_alloc(zio_t *zio, uint64_t unit_shift, uint64_t dcols,
 	ASSERT3U(rm->rm_asize - asize, ==, rm->rm_nskip << unit_shift);
 	ASSERT3U(rm->rm_nskip, <=, nparity);
 
+	/*
+	 * The parity columns are small and are operated on directly by the
+	 * parity routines, so keep them linear.  The data columns are views
+	 * of the (possibly scattered) zio buffer and are never copied.
+	 */
 	for (c = 0; c < rm->rm_firstdatacol; c++)
-		rm->rm_col[c].rc_data = zio_buf_alloc(rm->rm_col[c].rc_size);
-
-	rm->rm_col[c].rc_data = zio->io_data;
+		rm->rm_col[c].rc_abd =
+		    abd_alloc_linear(rm->rm_col[c].rc_size, B_TRUE);
 
-	for (c = c + 1; c < acols; c++)
-		rm->rm_col[c].rc_data = (char *)rm->rm_col[c - 1].rc_data +
-		    rm->rm_col[c - 1].rc_size;
+	for (c = rm->rm_firstdatacol; c < acols; c++) {
+		rm->rm_col[c].rc_abd = abd_get_offset_size(zio->io_abd, off,
+		    rm->rm_col[c].rc_size);
+		off += rm->rm_col[c].rc_size;
+	}
 
 	/*
 	 * If all data stored spans all columns, there's a danger that parity
@@ -553,29 +559,86 @@ vdev_raidz_map_alloc(zio_t *zio, uint64_t unit_shift, uint64_t dcols,
 	return (rm);
 }
 
+/*
+ * The parity columns are always linear, but the data columns may be
+ * scattered, so parity is accumulated by iterating over each contiguous
+ * segment of a data column.  The pqr_struct carries the parity pointers
+ * from one segment to the next.
+ */
+struct pqr_struct {
+	const raidz_math_ops_t *ops;
+	uint64_t *p;
+	uint64_t *q;
+	uint64_t *r;
+};
+
+static int
+vdev_raidz_p_func(void *buf, size_t size, void *private)
+{
+	struct pqr_struct *pqr = private;
+	int cnt = size / sizeof (pqr->p[0]);
+
+	ASSERT(pqr->p && !pqr->q && !pqr->r);
+
+	vdev_raidz_xor(pqr->ops, pqr->p, buf, size);
+	pqr->p += cnt;
+
+	return (0);
+}
+
+static int
+vdev_raidz_pq_func(void *buf, size_t size, void *private)
+{
+	struct pqr_struct *pqr = private;
+	int cnt = size / sizeof (pqr->p[0]);
+
+	ASSERT(pqr->p && pqr->q && !pqr->r);
+
+	vdev_raidz_gen_pq(pqr->ops, pqr->p, pqr->q, buf, size);
+	pqr->p += cnt;
+	pqr->q += cnt;
+
+	return (0);
+}
+
+static int
+vdev_raidz_pqr_func(void *buf, size_t size, void *private)
+{
+	struct pqr_struct *pqr = private;
+	int cnt = size / sizeof (pqr->p[0]);
+
+	ASSERT(pqr->p && pqr->q && pqr->r);
+
+	vdev_raidz_gen_pqr(pqr->ops, pqr->p, pqr->q, pqr->r, buf, size);
+	pqr->p += cnt;
+	pqr->q += cnt;
+	pqr->r += cnt;
+
+	return (0);
+}
+
 static void
 vdev_raidz_generate_parity_p(raidz_map_t *rm)
 {
-	uint64_t *p, *src, pcount, ccount, i;
+	uint64_t *p;
 	int c;
-
-	pcount = rm->rm_col[VDEV_RAIDZ_P].rc_size / sizeof (src[0]);
+	abd_t *src;
 
 	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
-		src = rm->rm_col[c].rc_data;
-		p = rm->rm_col[VDEV_RAIDZ_P].rc_data;
-		ccount = rm->rm_col[c].rc_size / sizeof (src[0]);
+		src = rm->rm_col[c].rc_abd;
+		p = abd_to_buf(rm->rm_col[VDEV_RAIDZ_P].rc_abd);
 
 		if (c == rm->rm_firstdatacol) {
-			ASSERT(ccount == pcount);
-			for (i = 0; i < ccount; i++, src++, p++) {
-				*p = *src;
-			}
+			ASSERT3U(rm->rm_col[c].rc_size, ==,
+			    rm->rm_col[VDEV_RAIDZ_P].rc_size);
+			abd_copy_to_buf(p, src, rm->rm_col[c].rc_size);
 		} else {
-			ASSERT(ccount <= pcount);
-			for (i = 0; i < ccount; i++, src++, p++) {
-				*p ^= *src;
-			}
+			struct pqr_struct pqr = { rm->rm_ops, p, NULL, NULL };
+
+			ASSERT3U(rm->rm_col[c].rc_size, <=,
+			    rm->rm_col[VDEV_RAIDZ_P].rc_size);
+			(void) abd_iterate_func(src, 0, rm->rm_col[c].rc_size,
+			    vdev_raidz_p_func, &pqr);
 		}
 	}
 }
@@ -583,50 +646,48 @@ vdev_raidz_generate_parity_p(raidz_map_t *rm)
 static void
 vdev_raidz_generate_parity_pq(raidz_map_t *rm)
 {
-	uint64_t *p, *q, *src, pcnt, ccnt, mask, i;
+	uint64_t *p, *q, pcnt, ccnt, mask, i;
 	int c;
+	abd_t *src;
 
-	pcnt = rm->rm_col[VDEV_RAIDZ_P].rc_size / sizeof (src[0]);
+	pcnt = rm->rm_col[VDEV_RAIDZ_P].rc_size / sizeof (p[0]);
 	ASSERT(rm->rm_col[VDEV_RAIDZ_P].rc_size ==
 	    rm->rm_col[VDEV_RAIDZ_Q].rc_size);
 
 	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
-		src = rm->rm_col[c].rc_data;
-		p = rm->rm_col[VDEV_RAIDZ_P].rc_data;
-		q = rm->rm_col[VDEV_RAIDZ_Q].rc_data;
+		src = rm->rm_col[c].rc_abd;
+		p = abd_to_buf(rm->rm_col[VDEV_RAIDZ_P].rc_abd);
+		q = abd_to_buf(rm->rm_col[VDEV_RAIDZ_Q].rc_abd);
 
-		ccnt = rm->rm_col[c].rc_size / sizeof (src[0]);
+		ccnt = rm->rm_col[c].rc_size / sizeof (p[0]);
 
 		if (c == rm->rm_firstdatacol) {
 			ASSERT(ccnt == pcnt || ccnt == 0);
-			for (i = 0; i < ccnt; i++, src++, p++, q++) {
-				*p = *src;
-				*q = *src;
-			}
-			for (; i < pcnt; i++, src++, p++, q++) {
-				*p = 0;
-				*q = 0;
+			abd_copy_to_buf(p, src, rm->rm_col[c].rc_size);
+			(void) memcpy(q, p, rm->rm_col[c].rc_size);
+
+			for (i = ccnt; i < pcnt; i++) {
+				p[i] = 0;
+				q[i] = 0;
 			}
 		} else {
+			struct pqr_struct pqr = { rm->rm_ops, p, q, NULL };
+
 			ASSERT(ccnt <= pcnt);
 
 			/*
 			 * Apply the algorithm described above by multiplying
 			 * the previous result and adding in the new value.
 			 */
-			for (i = 0; i < ccnt; i++, src++, p++, q++) {
-				*p ^= *src;
-
-				VDEV_RAIDZ_64MUL_2(*q, mask);
-				*q ^= *src;
-			}
+			(void) abd_iterate_func(src, 0, rm->rm_col[c].rc_size,
+			    vdev_raidz_pq_func, &pqr);
 
 			/*
 			 * Treat short columns as though they are full of 0s.
 			 * Note that there's therefore nothing needed for P.
 			 */
-			for (; i < pcnt; i++, q++) {
-				VDEV_RAIDZ_64MUL_2(*q, mask);
+			for (i = ccnt; i < pcnt; i++) {
+				VDEV_RAIDZ_64MUL_2(q[i], mask);
 			}
 		}
 	}
@@ -635,59 +696,54 @@ vdev_raidz_generate_parity_pq(raidz_map_t *rm)
 static void
 vdev_raidz_generate_parity_pqr(raidz_map_t *rm)
 {
-	uint64_t *p, *q, *r, *src, pcnt, ccnt, mask, i;
+	uint64_t *p, *q, *r, pcnt, ccnt, mask, i;
 	int c;
+	abd_t *src;
 
-	pcnt = rm->rm_col[VDEV_RAIDZ_P].rc_size / sizeof (src[0]);
+	pcnt = rm->rm_col[VDEV_RAIDZ_P].rc_size / sizeof (p[0]);
 	ASSERT(rm->rm_col[VDEV_RAIDZ_P].rc_size ==
 	    rm->rm_col[VDEV_RAIDZ_Q].rc_size);
 	ASSERT(rm->rm_col[VDEV_RAIDZ_P].rc_size ==
 	    rm->rm_col[VDEV_RAIDZ_R].rc_size);
 
 	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
-		src = rm->rm_col[c].rc_data;
-		p = rm->rm_col[VDEV_RAIDZ_P].rc_data;
-		q = rm->rm_col[VDEV_RAIDZ_Q].rc_data;
-		r = rm->rm_col[VDEV_RAIDZ_R].rc_data;
+		src = rm->rm_col[c].rc_abd;
+		p = abd_to_buf(rm->rm_col[VDEV_RAIDZ_P].rc_abd);
+		q = abd_to_buf(rm->rm_col[VDEV_RAIDZ_Q].rc_abd);
+		r = abd_to_buf(rm->rm_col[VDEV_RAIDZ_R].rc_abd);
 
-		ccnt = rm->rm_col[c].rc_size / sizeof (src[0]);
+		ccnt = rm->rm_col[c].rc_size / sizeof (p[0]);
 
 		if (c == rm->rm_firstdatacol) {
 			ASSERT(ccnt == pcnt || ccnt == 0);
-			for (i = 0; i < ccnt; i++, src++, p++, q++, r++) {
-				*p = *src;
-				*q = *src;
-				*r = *src;
-			}
-			for (; i < pcnt; i++, src++, p++, q++, r++) {
-				*p = 0;
-				*q = 0;
-				*r = 0;
+			abd_copy_to_buf(p, src, rm->rm_col[c].rc_size);
+			(void) memcpy(q, p, rm->rm_col[c].rc_size);
+			(void) memcpy(r, p, rm->rm_col[c].rc_size);
+
+			for (i = ccnt; i < pcnt; i++) {
+				p[i] = 0;
+				q[i] = 0;
+				r[i] = 0;
 			}
 		} else {
+			struct pqr_struct pqr = { rm->rm_ops, p, q, r };
+
 			ASSERT(ccnt <= pcnt);
 
 			/*
 			 * Apply the algorithm described above by multiplying
 			 * the previous result and adding in the new value.
 			 */
-			for (i = 0; i < ccnt; i++, src++, p++, q++, r++) {
-				*p ^= *src;
-
-				VDEV_RAIDZ_64MUL_2(*q, mask);
-				*q ^= *src;
-
-				VDEV_RAIDZ_64MUL_4(*r, mask);
-				*r ^= *src;
-			}
+			(void) abd_iterate_func(src, 0, rm->rm_col[c].rc_size,
+			    vdev_raidz_pqr_func, &pqr);
 
 			/*
 			 * Treat short columns as though they are full of 0s.
 			 * Note that there's therefore nothing needed for P.
 			 */
-			for (; i < pcnt; i++, q++, r++) {
-				VDEV_RAIDZ_64MUL_2(*q, mask);
-				VDEV_RAIDZ_64MUL_4(*r, mask);
+			for (i = ccnt; i < pcnt; i++) {
+				VDEV_RAIDZ_64MUL_2(q[i], mask);
+				VDEV_RAIDZ_64MUL_4(r[i], mask);
 			}
 		}
 	}
@@ -718,7 +774,8 @@ vdev_raidz_generate_parity(raidz_map_t *rm)
 static int
 vdev_raidz_reconstruct_p(raidz_map_t *rm, int *tgts, int ntgts)
 {
-	uint64_t *dst, *src, xcount, ccount, count, i;
+	uint64_t *src, xcount, ccount, count;
+	void *xbuf, *cbuf;
 	int x = tgts[0];
 	int c;
 
@@ -730,27 +787,35 @@ vdev_raidz_reconstruct_p(raidz_map_t *rm, int *tgts, int ntgts)
 	ASSERT(xcount <= rm->rm_col[VDEV_RAIDZ_P].rc_size / sizeof (src[0]));
 	ASSERT(xcount > 0);
 
-	src = rm->rm_col[VDEV_RAIDZ_P].rc_data;
-	dst = rm->rm_col[x].rc_data;
-	for (i = 0; i < xcount; i++, dst++, src++) {
-		*dst = *src;
-	}
+	/*
+	 * The parity column is always linear; data columns which are
+	 * scattered are borrowed as contiguous buffers for the duration.
+	 */
+	xbuf = abd_borrow_buf(rm->rm_col[x].rc_abd, rm->rm_col[x].rc_size);
 
-	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
-		src = rm->rm_col[c].rc_data;
-		dst = rm->rm_col[x].rc_data;
+	src = abd_to_buf(rm->rm_col[VDEV_RAIDZ_P].rc_abd);
+	bcopy(src, xbuf, xcount * sizeof (src[0]));
 
+	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
 		if (c == x)
 			continue;
 
+		cbuf = abd_borrow_buf_copy(rm->rm_col[c].rc_abd,
+		    rm->rm_col[c].rc_size);
+
 		ccount = rm->rm_col[c].rc_size / sizeof (src[0]);
 		count = MIN(ccount, xcount);
 
-		for (i = 0; i < count; i++, dst++, src++) {
-			*dst ^= *src;
-		}
+		vdev_raidz_xor(rm->rm_ops, xbuf, cbuf,
+		    count * sizeof (src[0]));
+
+		abd_return_buf(rm->rm_col[c].rc_abd, cbuf,
+		    rm->rm_col[c].rc_size);
 	}
 
+	abd_return_buf_copy(rm->rm_col[x].rc_abd, xbuf,
+	    rm->rm_col[x].rc_size);
+
 	return (1 << VDEV_RAIDZ_P);
 }
 
@@ -758,23 +823,30 @@ static int
 vdev_raidz_reconstruct_q(raidz_map_t *rm, int *tgts, int ntgts)
 {
 	uint64_t *dst, *src, xcount, ccount, count, mask, i;
-	uint8_t *b;
+	void *xbuf, *cbuf;
 	int x = tgts[0];
-	int c, j, exp;
+	int c, exp;
 
 	ASSERT(ntgts == 1);
 
 	xcount = rm->rm_col[x].rc_size / sizeof (src[0]);
 	ASSERT(xcount <= rm->rm_col[VDEV_RAIDZ_Q].rc_size / sizeof (src[0]));
 
+	xbuf = abd_borrow_buf(rm->rm_col[x].rc_abd, rm->rm_col[x].rc_size);
+
 	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
-		src = rm->rm_col[c].rc_data;
-		dst = rm->rm_col[x].rc_data;
+		cbuf = NULL;
+		src = NULL;
+		dst = xbuf;
 
-		if (c == x)
+		if (c == x) {
 			ccount = 0;
-		else
+		} else {
+			cbuf = abd_borrow_buf_copy(rm->rm_col[c].rc_abd,
+			    rm->rm_col[c].rc_size);
+			src = cbuf;
 			ccount = rm->rm_col[c].rc_size / sizeof (src[0]);
+		}
 
 		count = MIN(ccount, xcount);
 
@@ -787,27 +859,30 @@ vdev_raidz_reconstruct_q(raidz_map_t *rm, int *tgts, int ntgts)
 			}
 
 		} else {
-			for (i = 0; i < count; i++, dst++, src++) {
-				VDEV_RAIDZ_64MUL_2(*dst, mask);
-				*dst ^= *src;
-			}
+			vdev_raidz_mul2_xor(rm->rm_ops, dst, src,
+			    count * sizeof (src[0]));
+			dst += count;
 
-			for (; i < xcount; i++, dst++) {
+			for (i = count; i < xcount; i++, dst++) {
 				VDEV_RAIDZ_64MUL_2(*dst, mask);
 			}
 		}
+
+		if (cbuf != NULL) {
+			abd_return_buf(rm->rm_col[c].rc_abd, cbuf,
+			    rm->rm_col[c].rc_size);
+		}
 	}
 
-	src = rm->rm_col[VDEV_RAIDZ_Q].rc_data;
-	dst = rm->rm_col[x].rc_data;
+	src = abd_to_buf(rm->rm_col[VDEV_RAIDZ_Q].rc_abd);
 	exp = 255 - (rm->rm_cols - 1 - x);
 
-	for (i = 0; i < xcount; i++, dst++, src++) {
-		*dst ^= *src;
-		for (j = 0, b = (uint8_t *)dst; j < 8; j++, b++) {
-			*b = vdev_raidz_exp2(*b, exp);
-		}
-	}
+	vdev_raidz_xor(rm->rm_ops, xbuf, src, xcount * sizeof (src[0]));
+	vdev_raidz_mul(rm->rm_ops, xbuf, xbuf, vdev_raidz_pow2[exp],
+	    xcount * sizeof (src[0]));
+
+	abd_return_buf_copy(rm->rm_col[x].rc_abd, xbuf,
+	    rm->rm_col[x].rc_size);
 
 	return (1 << VDEV_RAIDZ_Q);
 }
@@ -816,8 +891,9 @@ static int
 vdev_raidz_reconstruct_pq(raidz_map_t *rm, int *tgts, int ntgts)
 {
 	uint8_t *p, *q, *pxy, *qxy, *xd, *yd, tmp, a, b, aexp, bexp;
-	void *pdata, *qdata;
-	uint64_t xsize, ysize, i;
+	abd_t *pdata, *qdata;
+	void *xbuf, *ybuf;
+	uint64_t xsize, ysize;
 	int x = tgts[0];
 	int y = tgts[1];
 
@@ -835,15 +911,15 @@ vdev_raidz_reconstruct_pq(raidz_map_t *rm, int *tgts, int ntgts)
 	 * parity so we make those columns appear to be full of zeros by
 	 * setting their lengths to zero.
 	 */
-	pdata = rm->rm_col[VDEV_RAIDZ_P].rc_data;
-	qdata = rm->rm_col[VDEV_RAIDZ_Q].rc_data;
+	pdata = rm->rm_col[VDEV_RAIDZ_P].rc_abd;
+	qdata = rm->rm_col[VDEV_RAIDZ_Q].rc_abd;
 	xsize = rm->rm_col[x].rc_size;
 	ysize = rm->rm_col[y].rc_size;
 
-	rm->rm_col[VDEV_RAIDZ_P].rc_data =
-	    zio_buf_alloc(rm->rm_col[VDEV_RAIDZ_P].rc_size);
-	rm->rm_col[VDEV_RAIDZ_Q].rc_data =
-	    zio_buf_alloc(rm->rm_col[VDEV_RAIDZ_Q].rc_size);
+	rm->rm_col[VDEV_RAIDZ_P].rc_abd =
+	    abd_alloc_linear(rm->rm_col[VDEV_RAIDZ_P].rc_size, B_TRUE);
+	rm->rm_col[VDEV_RAIDZ_Q].rc_abd =
+	    abd_alloc_linear(rm->rm_col[VDEV_RAIDZ_Q].rc_size, B_TRUE);
 	rm->rm_col[x].rc_size = 0;
 	rm->rm_col[y].rc_size = 0;
 
@@ -852,12 +928,15 @@ vdev_raidz_reconstruct_pq(raidz_map_t *rm, int *tgts, int ntgts)
 	rm->rm_col[x].rc_size = xsize;
 	rm->rm_col[y].rc_size = ysize;
 
-	p = pdata;
-	q = qdata;
-	pxy = rm->rm_col[VDEV_RAIDZ_P].rc_data;
-	qxy = rm->rm_col[VDEV_RAIDZ_Q].rc_data;
-	xd = rm->rm_col[x].rc_data;
-	yd = rm->rm_col[y].rc_data;
+	xbuf = abd_borrow_buf(rm->rm_col[x].rc_abd, xsize);
+	ybuf = abd_borrow_buf(rm->rm_col[y].rc_abd, ysize);
+
+	p = abd_to_buf(pdata);
+	q = abd_to_buf(qdata);
+	pxy = abd_to_buf(rm->rm_col[VDEV_RAIDZ_P].rc_abd);
+	qxy = abd_to_buf(rm->rm_col[VDEV_RAIDZ_Q].rc_abd);
+	xd = xbuf;
+	yd = ybuf;
 
 	/*
 	 * We now have:
@@ -881,24 +960,29 @@ vdev_raidz_reconstruct_pq(raidz_map_t *rm, int *tgts, int ntgts)
 	aexp = vdev_raidz_log2[vdev_raidz_exp2(a, tmp)];
 	bexp = vdev_raidz_log2[vdev_raidz_exp2(b, tmp)];
 
-	for (i = 0; i < xsize; i++, p++, q++, pxy++, qxy++, xd++, yd++) {
-		*xd = vdev_raidz_exp2(*p ^ *pxy, aexp) ^
-		    vdev_raidz_exp2(*q ^ *qxy, bexp);
+	/*
+	 * Pxy and Qxy are scratch columns, so accumulate P + Pxy and
+	 * Q + Qxy in place and then combine them a whole column at a time.
+	 */
+	vdev_raidz_xor(rm->rm_ops, pxy, p, xsize);
+	vdev_raidz_xor(rm->rm_ops, qxy, q, xsize);
+	vdev_raidz_mul(rm->rm_ops, xd, pxy, vdev_raidz_pow2[aexp], xsize);
+	vdev_raidz_mul_xor(rm->rm_ops, xd, qxy, vdev_raidz_pow2[bexp], xsize);
 
-		if (i < ysize)
-			*yd = *p ^ *pxy ^ *xd;
-	}
+	bcopy(pxy, yd, ysize);
+	vdev_raidz_xor(rm->rm_ops, yd, xd, ysize);
 
-	zio_buf_free(rm->rm_col[VDEV_RAIDZ_P].rc_data,
-	    rm->rm_col[VDEV_RAIDZ_P].rc_size);
-	zio_buf_free(rm->rm_col[VDEV_RAIDZ_Q].rc_data,
-	    rm->rm_col[VDEV_RAIDZ_Q].rc_size);
+	abd_return_buf_copy(rm->rm_col[x].rc_abd, xbuf, xsize);
+	abd_return_buf_copy(rm->rm_col[y].rc_abd, ybuf, ysize);
+
+	abd_free(rm->rm_col[VDEV_RAIDZ_P].rc_abd);
+	abd_free(rm->rm_col[VDEV_RAIDZ_Q].rc_abd);
 
 	/*
 	 * Restore the saved parity data.
 	 */
-	rm->rm_col[VDEV_RAIDZ_P].rc_data = pdata;
-	rm->rm_col[VDEV_RAIDZ_Q].rc_data = qdata;
+	rm->rm_col[VDEV_RAIDZ_P].rc_abd = pdata;
+	rm->rm_col[VDEV_RAIDZ_Q].rc_abd = qdata;
 
 	return ((1 << VDEV_RAIDZ_P) | (1 << VDEV_RAIDZ_Q));
 }
@@ -1185,29 +1269,15 @@ static void
 vdev_raidz_matrix_reconstruct(raidz_map_t *rm, int n, int nmissing,
     int *missing, uint8_t **invrows, const uint8_t *used)
 {
-	int i, j, x, cc, c;
+	int i, j, cc, c;
 	uint8_t *src;
-	uint64_t ccount;
+	uint64_t ccount, count;
 	uint8_t *dst[VDEV_RAIDZ_MAXPARITY];
 	uint64_t dcount[VDEV_RAIDZ_MAXPARITY];
-	uint8_t log = 0, val;
-	int ll;
-	uint8_t *invlog[VDEV_RAIDZ_MAXPARITY];
-	uint8_t *p, *pp;
-	size_t psize;
-
-	psize = sizeof (invlog[0][0]) * n * nmissing;
-	p = kmem_alloc(psize, KM_PUSHPAGE);
-
-	for (pp = p, i = 0; i < nmissing; i++) {
-		invlog[i] = pp;
-		pp += n;
-	}
 
 	for (i = 0; i < nmissing; i++) {
 		for (j = 0; j < n; j++) {
 			ASSERT3U(invrows[i][j], !=, 0);
-			invlog[i][j] = vdev_raidz_log2[invrows[i][j]];
 		}
 	}
 
@@ -1215,7 +1285,7 @@ vdev_raidz_matrix_reconstruct(raidz_map_t *rm, int n, int nmissing,
 		c = used[i];
 		ASSERT3U(c, <, rm->rm_cols);
 
-		src = rm->rm_col[c].rc_data;
+		src = abd_to_buf(rm->rm_col[c].rc_abd);
 		ccount = rm->rm_col[c].rc_size;
 		for (j = 0; j < nmissing; j++) {
 			cc = missing[j] + rm->rm_firstdatacol;
@@ -1223,37 +1293,28 @@ vdev_raidz_matrix_reconstruct(raidz_map_t *rm, int n, int nmissing,
 			ASSERT3U(cc, <, rm->rm_cols);
 			ASSERT3U(cc, !=, c);
 
-			dst[j] = rm->rm_col[cc].rc_data;
+			dst[j] = abd_to_buf(rm->rm_col[cc].rc_abd);
 			dcount[j] = rm->rm_col[cc].rc_size;
 		}
 
 		ASSERT(ccount >= rm->rm_col[missing[0]].rc_size || i > 0);
 
-		for (x = 0; x < ccount; x++, src++) {
-			if (*src != 0)
-				log = vdev_raidz_log2[*src];
-
-			for (cc = 0; cc < nmissing; cc++) {
-				if (x >= dcount[cc])
-					continue;
-
-				if (*src == 0) {
-					val = 0;
-				} else {
-					if ((ll = log + invlog[cc][i]) >= 255)
-						ll -= 255;
-					val = vdev_raidz_pow2[ll];
-				}
+		/*
+		 * Each missing column accumulates the product of this
+		 * column with its coefficient from the inverted matrix.
+		 */
+		for (cc = 0; cc < nmissing; cc++) {
+			count = MIN(ccount, dcount[cc]);
 
-				if (i == 0)
-					dst[cc][x] = val;
-				else
-					dst[cc][x] ^= val;
+			if (i == 0) {
+				vdev_raidz_mul(rm->rm_ops, dst[cc], src,
+				    invrows[cc][i], count);
+			} else {
+				vdev_raidz_mul_xor(rm->rm_ops, dst[cc], src,
+				    invrows[cc][i], count);
 			}
 		}
 	}
-
-	kmem_free(p, psize);
 }
 
 static int
@@ -1271,8 +1332,25 @@ vdev_raidz_reconstruct_general(raidz_map_t *rm, int *tgts, int ntgts)
 	uint8_t *invrows[VDEV_RAIDZ_MAXPARITY];
 	uint8_t *used;
 
+	abd_t **bufs = NULL;
+
 	int code = 0;
 
+	/*
+	 * Matrix reconstruction can't use scatter ABDs yet, so we allocate
+	 * temporary linear ABDs for the data columns.
+	 */
+	if (!abd_is_linear(rm->rm_col[rm->rm_firstdatacol].rc_abd)) {
+		bufs = kmem_alloc(rm->rm_cols * sizeof (abd_t *), KM_PUSHPAGE);
+
+		for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
+			raidz_col_t *col = &rm->rm_col[c];
+
+			bufs[c] = col->rc_abd;
+			col->rc_abd = abd_alloc_linear(col->rc_size, B_TRUE);
+			abd_copy(col->rc_abd, bufs[c], col->rc_size);
+		}
+	}
 
 	n = rm->rm_cols - rm->rm_firstdatacol;
 
@@ -1359,6 +1437,20 @@ vdev_raidz_reconstruct_general(raidz_map_t *rm, int *tgts, int ntgts)
 
 	kmem_free(p, psize);
 
+	/*
+	 * Copy back from the temporary linear ABDs and free them.
+	 */
+	if (bufs) {
+		for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
+			raidz_col_t *col = &rm->rm_col[c];
+
+			abd_copy(bufs[c], col->rc_abd, col->rc_size);
+			abd_free(col->rc_abd);
+			col->rc_abd = bufs[c];
+		}
+		kmem_free(bufs, rm->rm_cols * sizeof (abd_t *));
+	}
+
 	return (code);
 }
 
@@ -1441,6 +1533,142 @@ vdev_raidz_reconstruct(raidz_map_t *rm, int *t, int nt)
 	return (code);
 }
 
+/*
+ * Exercise the parity implementation called name against the scalar one
+ * on a block of size bytes at offset, laid out over dcols children with
+ * nparity parity columns.  The block is filled from seed, so a given set
+ * of arguments always tests the same data.  Parity generation must match
+ * the scalar result bit for bit, and every combination of up to nparity
+ * failed columns including at least one data column must be rebuilt
+ * exactly by both the optimized and the general reconstruction routines.
+ * Returns ENOTSUP if the implementation cannot run here and EIO on any
+ * mismatch.
+ */
+int
+vdev_raidz_math_verify(const char *name, uint64_t nparity, uint64_t dcols,
+    uint64_t ashift, uint64_t offset, uint64_t size, uint64_t seed)
+{
+	const raidz_math_ops_t *ops = vdev_raidz_math_find(name);
+	const raidz_math_ops_t *ref_ops = vdev_raidz_math_find("scalar");
+	raidz_map_t *rm, *ref;
+	zio_t *zio;
+	abd_t *orig;
+	uint64_t *buf;
+	int tgts[VDEV_RAIDZ_MAXPARITY];
+	int ntgts, nt, i, c, pass;
+	int error = 0;
+
+	if (ops == NULL)
+		return (ENOTSUP);
+
+	ASSERT3U(nparity, >=, 1);
+	ASSERT3U(nparity, <=, VDEV_RAIDZ_MAXPARITY);
+	ASSERT3U(dcols, >, nparity);
+	ASSERT3U(size, >, 0);
+	ASSERT3U(size, <=, SPA_MAXBLOCKSIZE);
+	ASSERT0(P2PHASE(size, 1ULL << ashift));
+	ASSERT0(P2PHASE(offset, 1ULL << ashift));
+
+	zio = kmem_zalloc(sizeof (zio_t), KM_SLEEP);
+	zio->io_abd = abd_alloc(size, B_FALSE);
+	zio->io_size = size;
+	zio->io_offset = offset;
+
+	/* splitmix64 */
+	buf = zio_buf_alloc(size);
+	for (i = 0; i < size / sizeof (uint64_t); i++) {
+		uint64_t x = (seed += 0x9e3779b97f4a7c15ULL);
+
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		buf[i] = x ^ (x >> 31);
+	}
+	abd_copy_from_buf(zio->io_abd, buf, size);
+	zio_buf_free(buf, size);
+
+	orig = abd_alloc_sametype(zio->io_abd, size);
+	abd_copy(orig, zio->io_abd, size);
+
+	ref = vdev_raidz_map_alloc(zio, ashift, dcols, nparity);
+	ref->rm_ops = ref_ops;
+	rm = vdev_raidz_map_alloc(zio, ashift, dcols, nparity);
+	rm->rm_ops = ops;
+
+	vdev_raidz_generate_parity(ref);
+	vdev_raidz_generate_parity(rm);
+
+	for (c = 0; c < rm->rm_firstdatacol; c++) {
+		if (abd_cmp(rm->rm_col[c].rc_abd, ref->rm_col[c].rc_abd,
+		    rm->rm_col[c].rc_size) != 0)
+			error = EIO;
+	}
+
+	/*
+	 * Walk every sorted set of ntgts failed columns, clobbering the
+	 * targets, rebuilding them and restoring the map before moving on.
+	 */
+	for (ntgts = 1; ntgts <= nparity && error == 0; ntgts++) {
+		if (ntgts > rm->rm_cols)
+			break;
+
+		for (i = 0; i < ntgts; i++)
+			tgts[i] = i;
+
+		for (;;) {
+			if (tgts[ntgts - 1] < rm->rm_firstdatacol)
+				goto next;
+
+			for (pass = 0; pass < 2 && error == 0; pass++) {
+				for (i = 0; i < ntgts; i++) {
+					raidz_col_t *rc = &rm->rm_col[tgts[i]];
+
+					abd_zero(rc->rc_abd, rc->rc_size);
+				}
+
+				if (pass == 0)
+					(void) vdev_raidz_reconstruct(rm, tgts,
+					    ntgts);
+				else
+					(void) vdev_raidz_reconstruct_general(
+					    rm, tgts, ntgts);
+
+				if (abd_cmp(zio->io_abd, orig, size) != 0)
+					error = EIO;
+
+				abd_copy(zio->io_abd, orig, size);
+				for (c = 0; c < rm->rm_firstdatacol; c++) {
+					abd_copy(rm->rm_col[c].rc_abd,
+					    ref->rm_col[c].rc_abd,
+					    rm->rm_col[c].rc_size);
+				}
+			}
+
+			if (error != 0)
+				break;
+next:
+			/* advance to the next combination */
+			for (nt = ntgts - 1; nt >= 0; nt--) {
+				if (tgts[nt] < rm->rm_cols - ntgts + nt)
+					break;
+			}
+			if (nt < 0)
+				break;
+
+			tgts[nt]++;
+			for (i = nt + 1; i < ntgts; i++)
+				tgts[i] = tgts[i - 1] + 1;
+		}
+	}
+
+	vdev_raidz_map_free(rm);
+	vdev_raidz_map_free(ref);
+	abd_free(orig);
+	abd_free(zio->io_abd);
+	kmem_free(zio, sizeof (zio_t));
+
+	return (error);
+}
+
 static int
 vdev_raidz_open(vdev_t *vd, uint64_t *asize, uint64_t *max_asize,
     uint64_t *ashift)
@@ -1510,6 +1738,34 @@ vdev_raidz_asize(vdev_t *vd, uint64_t psize)
 	return (asize);
 }
 
+/*
+ * Translate the range [*start, *end) of a RAID-Z vdev into the range it
+ * occupies on child c.  As in vdev_raidz_map_alloc(), sector b of the vdev
+ * lives on child (b % dcols) at sector (b / dcols), so the child's part of
+ * the range is the sectors j with start <= j * dcols + c < end.  Every
+ * sector of an allocated block lies within the block's asize, so when the
+ * whole range is free so is every child sector mapped from it.
+ */
+void
+vdev_raidz_child_range(vdev_t *vd, uint64_t c, uint64_t *start,
+    uint64_t *end)
+{
+	uint64_t ashift = vd->vdev_top->vdev_ashift;
+	uint64_t dcols = vd->vdev_children;
+	uint64_t b = *start >> ashift;
+	uint64_t e = *end >> ashift;
+
+	ASSERT3U(c, <, dcols);
+	ASSERT0(P2PHASE(*start, 1ULL << ashift));
+	ASSERT0(P2PHASE(*end, 1ULL << ashift));
+
+	b = (b > c) ? (b - c + dcols - 1) / dcols : 0;
+	e = (e > c) ? (e - c + dcols - 1) / dcols : 0;
+
+	*start = b << ashift;
+	*end = e << ashift;
+}
+
 static void
 vdev_raidz_child_done(zio_t *zio)
 {
@@ -1542,7 +1798,7 @@ vdev_raidz_io_start(zio_t *zio)
 			rc = &rm->rm_col[c];
 			cvd = vd->vdev_child[rc->rc_devidx];
 			zio_nowait(zio_vdev_child_io(zio, NULL, cvd,
-			    rc->rc_offset, rc->rc_data, rc->rc_size,
+			    rc->rc_offset, rc->rc_abd, rc->rc_size,
 			    zio->io_type, zio->io_priority, 0,
 			    vdev_raidz_child_done, rc));
 		}
@@ -1598,7 +1854,7 @@ vdev_raidz_io_start(zio_t *zio)
 		if (c >= rm->rm_firstdatacol || rm->rm_missingdata > 0 ||
 		    (zio->io_flags & (ZIO_FLAG_SCRUB | ZIO_FLAG_RESILVER))) {
 			zio_nowait(zio_vdev_child_io(zio, NULL, cvd,
-			    rc->rc_offset, rc->rc_data, rc->rc_size,
+			    rc->rc_offset, rc->rc_abd, rc->rc_size,
 			    zio->io_type, zio->io_priority, 0,
 			    vdev_raidz_child_done, rc));
 		}
@@ -1619,6 +1875,7 @@ raidz_checksum_error(zio_t *zio, raidz_col_t *rc, void *bad_data)
 	if (!(zio->io_flags & ZIO_FLAG_SPECULATIVE)) {
 		zio_bad_cksum_t zbc;
 		raidz_map_t *rm = zio->io_vsd;
+		void *buf;
 
 		mutex_enter(&vd->vdev_stat_lock);
 		vd->vdev_stat.vs_checksum_errors++;
@@ -1627,9 +1884,11 @@ raidz_checksum_error(zio_t *zio, raidz_col_t *rc, void *bad_data)
 		zbc.zbc_has_cksum = 0;
 		zbc.zbc_injected = rm->rm_ecksuminjected;
 
+		buf = abd_borrow_buf_copy(rc->rc_abd, rc->rc_size);
 		zfs_ereport_post_checksum(zio->io_spa, vd, zio,
-		    rc->rc_offset, rc->rc_size, rc->rc_data, bad_data,
+		    rc->rc_offset, rc->rc_size, buf, bad_data,
 		    &zbc);
+		abd_return_buf(rc->rc_abd, buf, rc->rc_size);
 	}
 }
 
@@ -1671,7 +1930,7 @@ raidz_parity_verify(zio_t *zio, raidz_map_t *rm)
 		if (!rc->rc_tried || rc->rc_error != 0)
 			continue;
 		orig[c] = zio_buf_alloc(rc->rc_size);
-		bcopy(rc->rc_data, orig[c], rc->rc_size);
+		abd_copy_to_buf(orig[c], rc->rc_abd, rc->rc_size);
 	}
 
 	vdev_raidz_generate_parity(rm);
@@ -1680,7 +1939,7 @@ raidz_parity_verify(zio_t *zio, raidz_map_t *rm)
 		rc = &rm->rm_col[c];
 		if (!rc->rc_tried || rc->rc_error != 0)
 			continue;
-		if (bcmp(orig[c], rc->rc_data, rc->rc_size) != 0) {
+		if (abd_cmp_buf(rc->rc_abd, orig[c], rc->rc_size) != 0) {
 			raidz_checksum_error(zio, rc, orig[c]);
 			rc->rc_error = ECKSUM;
 			ret++;
@@ -1788,7 +2047,8 @@ vdev_raidz_combrec(zio_t *zio, int total_errors, int data_errors)
 				ASSERT3S(c, >=, 0);
 				ASSERT3S(c, <, rm->rm_cols);
 				rc = &rm->rm_col[c];
-				bcopy(rc->rc_data, orig[i], rc->rc_size);
+				abd_copy_to_buf(orig[i], rc->rc_abd,
+				    rc->rc_size);
 			}
 
 			/*
@@ -1819,7 +2079,8 @@ vdev_raidz_combrec(zio_t *zio, int total_errors, int data_errors)
 			for (i = 0; i < n; i++) {
 				c = tgts[i];
 				rc = &rm->rm_col[c];
-				bcopy(orig[i], rc->rc_data, rc->rc_size);
+				abd_copy_from_buf(rc->rc_abd, orig[i],
+				    rc->rc_size);
 			}
 
 			do {
@@ -2039,7 +2300,7 @@ vdev_raidz_io_done(zio_t *zio)
 				continue;
 			zio_nowait(zio_vdev_child_io(zio, NULL,
 			    vd->vdev_child[rc->rc_devidx],
-			    rc->rc_offset, rc->rc_data, rc->rc_size,
+			    rc->rc_offset, rc->rc_abd, rc->rc_size,
 			    zio->io_type, zio->io_priority, 0,
 			    vdev_raidz_child_done, rc));
 		} while (++c < rm->rm_cols);
@@ -2119,7 +2380,7 @@ done:
 				continue;
 
 			zio_nowait(zio_vdev_child_io(zio, NULL, cvd,
-			    rc->rc_offset, rc->rc_data, rc->rc_size,
+			    rc->rc_offset, rc->rc_abd, rc->rc_size,
 			    ZIO_TYPE_WRITE, zio->io_priority,
 			    ZIO_FLAG_IO_REPAIR | (unexpected_errors ?
 			    ZIO_FLAG_SELF_HEAL : 0), NULL, NULL));
@@ -0,0 +1,544 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/vdev_raidz.h>
+
+/*
+ * RAID-Z parity generation and reconstruction reduce to a handful of
+ * operations on whole columns in GF(2^8): adding a column, multiplying
+ * a column by 2 (and 4) while adding another, and multiplying a column
+ * by an arbitrary constant.  This file holds the scalar versions of
+ * those operations and picks, when the module is loaded, the fastest
+ * implementation that returns the same results as the scalar one.
+ *
+ * Each raidz map records the implementation in use when it was created,
+ * so changing zfs_vdev_raidz_impl never mixes two implementations within
+ * one I/O.  The benchmark results and the current choice are exported
+ * in zfs:0:vdev_raidz_bench.
+ */
+
+uint8_t vdev_raidz_mul_lt[256][32];
+
+static uint8_t
+vdev_raidz_gf_mul(uint8_t a, uint8_t b)
+{
+	uint8_t p = 0;
+
+	for (; b != 0; b >>= 1) {
+		if (b & 1)
+			p ^= a;
+		a = VDEV_RAIDZ_MUL_2(a);
+	}
+
+	return (p);
+}
+
+static void
+vdev_raidz_scalar_xor(void *dst, const void *src, size_t size)
+{
+	uint64_t *d = dst;
+	const uint64_t *s = src;
+	size_t i, cnt = size / sizeof (uint64_t);
+
+	for (i = 0; i < cnt; i++)
+		d[i] ^= s[i];
+}
+
+static void
+vdev_raidz_scalar_mul2_xor(void *dst, const void *src, size_t size)
+{
+	uint64_t *d = dst;
+	const uint64_t *s = src;
+	uint64_t mask;
+	size_t i, cnt = size / sizeof (uint64_t);
+
+	for (i = 0; i < cnt; i++) {
+		VDEV_RAIDZ_64MUL_2(d[i], mask);
+		d[i] ^= s[i];
+	}
+}
+
+static void
+vdev_raidz_scalar_gen_pq(void *p, void *q, const void *src, size_t size)
+{
+	uint64_t *pp = p, *qq = q;
+	const uint64_t *s = src;
+	uint64_t mask;
+	size_t i, cnt = size / sizeof (uint64_t);
+
+	for (i = 0; i < cnt; i++) {
+		pp[i] ^= s[i];
+		VDEV_RAIDZ_64MUL_2(qq[i], mask);
+		qq[i] ^= s[i];
+	}
+}
+
+static void
+vdev_raidz_scalar_gen_pqr(void *p, void *q, void *r, const void *src,
+    size_t size)
+{
+	uint64_t *pp = p, *qq = q, *rr = r;
+	const uint64_t *s = src;
+	uint64_t mask;
+	size_t i, cnt = size / sizeof (uint64_t);
+
+	for (i = 0; i < cnt; i++) {
+		pp[i] ^= s[i];
+		VDEV_RAIDZ_64MUL_2(qq[i], mask);
+		qq[i] ^= s[i];
+		VDEV_RAIDZ_64MUL_4(rr[i], mask);
+		rr[i] ^= s[i];
+	}
+}
+
+static void
+vdev_raidz_scalar_mul(void *dst, const void *src, uint8_t c, size_t size)
+{
+	const uint8_t *lt = vdev_raidz_mul_lt[c];
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		d[i] = lt[s[i] & 0x0f] ^ lt[16 + (s[i] >> 4)];
+}
+
+static void
+vdev_raidz_scalar_mul_xor(void *dst, const void *src, uint8_t c,
+    size_t size)
+{
+	const uint8_t *lt = vdev_raidz_mul_lt[c];
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		d[i] ^= lt[s[i] & 0x0f] ^ lt[16 + (s[i] >> 4)];
+}
+
+static boolean_t
+vdev_raidz_scalar_valid(void)
+{
+	return (B_TRUE);
+}
+
+static const raidz_math_ops_t vdev_raidz_scalar_ops = {
+	.xor_buf = vdev_raidz_scalar_xor,
+	.mul2_xor = vdev_raidz_scalar_mul2_xor,
+	.gen_pq = vdev_raidz_scalar_gen_pq,
+	.gen_pqr = vdev_raidz_scalar_gen_pqr,
+	.mul = vdev_raidz_scalar_mul,
+	.mul_xor = vdev_raidz_scalar_mul_xor,
+	.valid = vdev_raidz_scalar_valid,
+	.blocksize = sizeof (uint64_t),
+	.name = "scalar"
+};
+
+static const raidz_math_ops_t *vdev_raidz_impls[] = {
+	&vdev_raidz_scalar_ops,
+#if defined(__x86_64) && defined(HAVE_SSSE3)
+	&vdev_raidz_ssse3_ops,
+#endif
+#if defined(__x86_64) && defined(HAVE_AVX2)
+	&vdev_raidz_avx2_ops,
+#endif
+#if defined(__x86_64) && defined(HAVE_AVX512BW)
+	&vdev_raidz_avx512bw_ops,
+#endif
+};
+
+#define	VDEV_RAIDZ_NIMPLS	\
+	(sizeof (vdev_raidz_impls) / sizeof (vdev_raidz_impls[0]))
+
+/*
+ * vdev_raidz_impl is the implementation in use.  vdev_raidz_fastest is
+ * the benchmark winner, used unless the user selected a specific one.
+ */
+static const raidz_math_ops_t *vdev_raidz_impl = &vdev_raidz_scalar_ops;
+static const raidz_math_ops_t *vdev_raidz_fastest = &vdev_raidz_scalar_ops;
+static boolean_t vdev_raidz_impl_user = B_FALSE;
+
+const raidz_math_ops_t *
+vdev_raidz_math_get(void)
+{
+	return (vdev_raidz_impl);
+}
+
+/*
+ * The wrappers below run the bulk of a buffer through the given
+ * implementation and the remainder, if any, through the scalar code.
+ */
+void
+vdev_raidz_xor(const raidz_math_ops_t *ops, void *dst, const void *src,
+    size_t size)
+{
+	size_t bulk = P2ALIGN(size, ops->blocksize);
+
+	if (bulk != 0)
+		ops->xor_buf(dst, src, bulk);
+	if (bulk != size)
+		vdev_raidz_scalar_xor((char *)dst + bulk,
+		    (const char *)src + bulk, size - bulk);
+}
+
+void
+vdev_raidz_mul2_xor(const raidz_math_ops_t *ops, void *dst, const void *src,
+    size_t size)
+{
+	size_t bulk = P2ALIGN(size, ops->blocksize);
+
+	if (bulk != 0)
+		ops->mul2_xor(dst, src, bulk);
+	if (bulk != size)
+		vdev_raidz_scalar_mul2_xor((char *)dst + bulk,
+		    (const char *)src + bulk, size - bulk);
+}
+
+void
+vdev_raidz_gen_pq(const raidz_math_ops_t *ops, void *p, void *q,
+    const void *src, size_t size)
+{
+	size_t bulk = P2ALIGN(size, ops->blocksize);
+
+	if (bulk != 0)
+		ops->gen_pq(p, q, src, bulk);
+	if (bulk != size)
+		vdev_raidz_scalar_gen_pq((char *)p + bulk, (char *)q + bulk,
+		    (const char *)src + bulk, size - bulk);
+}
+
+void
+vdev_raidz_gen_pqr(const raidz_math_ops_t *ops, void *p, void *q, void *r,
+    const void *src, size_t size)
+{
+	size_t bulk = P2ALIGN(size, ops->blocksize);
+
+	if (bulk != 0)
+		ops->gen_pqr(p, q, r, src, bulk);
+	if (bulk != size)
+		vdev_raidz_scalar_gen_pqr((char *)p + bulk, (char *)q + bulk,
+		    (char *)r + bulk, (const char *)src + bulk, size - bulk);
+}
+
+void
+vdev_raidz_mul(const raidz_math_ops_t *ops, void *dst, const void *src,
+    uint8_t c, size_t size)
+{
+	size_t bulk = P2ALIGN(size, ops->blocksize);
+
+	if (bulk != 0)
+		ops->mul(dst, src, c, bulk);
+	if (bulk != size)
+		vdev_raidz_scalar_mul((char *)dst + bulk,
+		    (const char *)src + bulk, c, size - bulk);
+}
+
+void
+vdev_raidz_mul_xor(const raidz_math_ops_t *ops, void *dst, const void *src,
+    uint8_t c, size_t size)
+{
+	size_t bulk = P2ALIGN(size, ops->blocksize);
+
+	if (bulk != 0)
+		ops->mul_xor(dst, src, c, bulk);
+	if (bulk != size)
+		vdev_raidz_scalar_mul_xor((char *)dst + bulk,
+		    (const char *)src + bulk, c, size - bulk);
+}
+
+/*
+ * Return the implementation called name, or NULL if there is no such
+ * implementation or it is not usable on this CPU.
+ */
+const raidz_math_ops_t *
+vdev_raidz_math_find(const char *name)
+{
+	size_t len;
+	int i;
+
+	/* module parameters arrive with a trailing newline */
+	len = strlen(name);
+	while (len > 0 && (name[len - 1] == '\n' || name[len - 1] == ' '))
+		len--;
+
+	if (len == strlen("fastest") && strncmp(name, "fastest", len) == 0)
+		return (vdev_raidz_fastest);
+
+	for (i = 0; i < VDEV_RAIDZ_NIMPLS; i++) {
+		const raidz_math_ops_t *ops = vdev_raidz_impls[i];
+
+		if (len == strlen(ops->name) &&
+		    strncmp(name, ops->name, len) == 0)
+			return (ops->valid() ? ops : NULL);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Select the implementation by name, "fastest" reverting to the
+ * benchmark winner.  Before vdev_raidz_math_init() has run the choice
+ * is only recorded.
+ */
+int
+vdev_raidz_impl_set(const char *name)
+{
+	const raidz_math_ops_t *ops = vdev_raidz_math_find(name);
+
+	if (ops == NULL)
+		return (EINVAL);
+
+	vdev_raidz_impl_user = (strncmp(name, "fastest", 7) != 0);
+	vdev_raidz_impl = ops;
+	return (0);
+}
+
+#define	VDEV_RAIDZ_BENCH_SIZE	(64 * 1024)
+#define	VDEV_RAIDZ_BENCH_NS	(1000 * 1000)	/* 1ms per operation */
+#define	VDEV_RAIDZ_CHECK_SIZE	(4096 + 3 * sizeof (uint64_t))
+
+static kstat_t *vdev_raidz_ksp;
+static kstat_named_t vdev_raidz_kstat_data[2 * VDEV_RAIDZ_NIMPLS + 1];
+
+static int
+vdev_raidz_kstat_update(kstat_t *ksp, int rw)
+{
+	kstat_named_t *ks = &vdev_raidz_kstat_data[2 * VDEV_RAIDZ_NIMPLS];
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	(void) strlcpy(ks->value.c, vdev_raidz_impl->name,
+	    sizeof (ks->value.c));
+
+	return (0);
+}
+
+/*
+ * Check every operation of an implementation against the scalar code,
+ * using a size which is not a multiple of any block size so the
+ * remainder handling is covered as well.  buf holds seven check buffers.
+ */
+static boolean_t
+vdev_raidz_math_check(const raidz_math_ops_t *ops, uint8_t *buf)
+{
+	const size_t size = VDEV_RAIDZ_CHECK_SIZE;
+	uint8_t *src = buf;
+	uint8_t *e[3], *a[3];
+	size_t j;
+	int i, c;
+
+	for (i = 0; i < 3; i++) {
+		e[i] = buf + (1 + i) * size;
+		a[i] = buf + (4 + i) * size;
+	}
+
+#define	VDEV_RAIDZ_CHECK(n)						\
+	for (i = 0; i < (n); i++) {					\
+		if (bcmp(e[i], a[i], size) != 0)			\
+			return (B_FALSE);				\
+	}
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < size; j++)
+			e[i][j] = src[(j + 37 * (i + 1)) % size];
+		bcopy(e[i], a[i], size);
+	}
+
+	vdev_raidz_gen_pqr(&vdev_raidz_scalar_ops, e[0], e[1], e[2], src, size);
+	vdev_raidz_gen_pqr(ops, a[0], a[1], a[2], src, size);
+	VDEV_RAIDZ_CHECK(3);
+
+	vdev_raidz_gen_pq(&vdev_raidz_scalar_ops, e[0], e[1], src, size);
+	vdev_raidz_gen_pq(ops, a[0], a[1], src, size);
+	VDEV_RAIDZ_CHECK(2);
+
+	vdev_raidz_mul2_xor(&vdev_raidz_scalar_ops, e[0], src, size);
+	vdev_raidz_mul2_xor(ops, a[0], src, size);
+	VDEV_RAIDZ_CHECK(1);
+
+	vdev_raidz_xor(&vdev_raidz_scalar_ops, e[0], e[1], size);
+	vdev_raidz_xor(ops, a[0], a[1], size);
+	VDEV_RAIDZ_CHECK(1);
+
+	for (c = 0; c < 256; c++) {
+		vdev_raidz_mul(&vdev_raidz_scalar_ops, e[1], e[0], c, size);
+		vdev_raidz_mul(ops, a[1], a[0], c, size);
+		vdev_raidz_mul_xor(&vdev_raidz_scalar_ops, e[0], e[1], c, size);
+		vdev_raidz_mul_xor(ops, a[0], a[1], c, size);
+		VDEV_RAIDZ_CHECK(2);
+	}
+
+#undef	VDEV_RAIDZ_CHECK
+
+	return (B_TRUE);
+}
+
+/*
+ * Measure parity generation (P, Q and R from one data column) and
+ * reconstruction (multiply-accumulate of one column), in MB/s of data.
+ */
+static uint64_t
+vdev_raidz_math_bench(const raidz_math_ops_t *ops, uint8_t *buf,
+    boolean_t gen)
+{
+	const size_t size = VDEV_RAIDZ_BENCH_SIZE;
+	uint64_t bytes = 0;
+	hrtime_t start, elapsed;
+	int i;
+
+	start = gethrtime();
+	do {
+		for (i = 0; i < 4; i++) {
+			if (gen) {
+				ops->gen_pqr(buf + size, buf + 2 * size,
+				    buf + 3 * size, buf, size);
+			} else {
+				ops->mul_xor(buf + size, buf, 0x8e + i, size);
+			}
+		}
+		bytes += 4 * size;
+		elapsed = gethrtime() - start;
+	} while (elapsed < VDEV_RAIDZ_BENCH_NS);
+
+	return ((bytes * 1000) / elapsed);
+}
+
+void
+vdev_raidz_math_init(void)
+{
+	const raidz_math_ops_t *fastest = &vdev_raidz_scalar_ops;
+	uint64_t gen, rec, score, fastest_score = 0;
+	size_t bufsize;
+	kstat_named_t *ks;
+	uint8_t *buf;
+	int i, c;
+
+	for (c = 0; c < 256; c++) {
+		for (i = 0; i < 16; i++) {
+			vdev_raidz_mul_lt[c][i] = vdev_raidz_gf_mul(c, i);
+			vdev_raidz_mul_lt[c][16 + i] =
+			    vdev_raidz_gf_mul(c, i << 4);
+		}
+	}
+
+	bufsize = MAX(4 * VDEV_RAIDZ_BENCH_SIZE, 7 * VDEV_RAIDZ_CHECK_SIZE);
+	buf = kmem_alloc(bufsize, KM_SLEEP);
+	for (i = 0; i < bufsize; i++)
+		buf[i] = (uint8_t)((i * 2654435761U) >> 13);
+
+	for (i = 0; i < VDEV_RAIDZ_NIMPLS; i++) {
+		const raidz_math_ops_t *ops = vdev_raidz_impls[i];
+
+		ks = &vdev_raidz_kstat_data[2 * i];
+		ks[0].data_type = KSTAT_DATA_UINT64;
+		ks[1].data_type = KSTAT_DATA_UINT64;
+		(void) snprintf(ks[0].name, KSTAT_STRLEN, "%s_gen", ops->name);
+		(void) snprintf(ks[1].name, KSTAT_STRLEN, "%s_rec", ops->name);
+		ks[0].value.ui64 = ks[1].value.ui64 = 0;
+
+		if (!ops->valid())
+			continue;
+
+		if (!vdev_raidz_math_check(ops, buf)) {
+			cmn_err(CE_WARN, "raidz %s implementation returned "
+			    "incorrect results, disabled", ops->name);
+			continue;
+		}
+
+		gen = vdev_raidz_math_bench(ops, buf, B_TRUE);
+		rec = vdev_raidz_math_bench(ops, buf, B_FALSE);
+		ks[0].value.ui64 = gen;
+		ks[1].value.ui64 = rec;
+
+		/* rank by the combined rate of generation and reconstruction */
+		score = (gen + rec == 0) ? 0 : (gen * rec) / (gen + rec);
+		if (score > fastest_score) {
+			fastest_score = score;
+			fastest = ops;
+		}
+	}
+
+	kmem_free(buf, bufsize);
+
+	vdev_raidz_fastest = fastest;
+	if (!vdev_raidz_impl_user)
+		vdev_raidz_impl = fastest;
+
+	ks = &vdev_raidz_kstat_data[2 * VDEV_RAIDZ_NIMPLS];
+	ks->data_type = KSTAT_DATA_CHAR;
+	(void) strlcpy(ks->name, "selected", KSTAT_STRLEN);
+
+	vdev_raidz_ksp = kstat_create("zfs", 0, "vdev_raidz_bench", "misc",
+	    KSTAT_TYPE_NAMED, 0, KSTAT_FLAG_VIRTUAL);
+	if (vdev_raidz_ksp != NULL) {
+		vdev_raidz_ksp->ks_data = vdev_raidz_kstat_data;
+		vdev_raidz_ksp->ks_ndata = 2 * VDEV_RAIDZ_NIMPLS + 1;
+		vdev_raidz_ksp->ks_data_size = sizeof (vdev_raidz_kstat_data);
+		vdev_raidz_ksp->ks_update = vdev_raidz_kstat_update;
+		kstat_install(vdev_raidz_ksp);
+	}
+}
+
+void
+vdev_raidz_math_fini(void)
+{
+	if (vdev_raidz_ksp != NULL) {
+		kstat_delete(vdev_raidz_ksp);
+		vdev_raidz_ksp = NULL;
+	}
+
+	vdev_raidz_impl = vdev_raidz_fastest = &vdev_raidz_scalar_ops;
+	vdev_raidz_impl_user = B_FALSE;
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+static int
+vdev_raidz_impl_param_set(const char *val, struct kernel_param *kp)
+{
+	return (-vdev_raidz_impl_set(val));
+}
+
+static int
+vdev_raidz_impl_param_get(char *buffer, struct kernel_param *kp)
+{
+	int i, cnt = 0;
+
+	cnt += sprintf(buffer + cnt, vdev_raidz_impl_user ?
+	    "fastest " : "[fastest] ");
+	for (i = 0; i < VDEV_RAIDZ_NIMPLS; i++) {
+		const raidz_math_ops_t *ops = vdev_raidz_impls[i];
+
+		if (!ops->valid())
+			continue;
+		cnt += sprintf(buffer + cnt,
+		    (vdev_raidz_impl_user && ops == vdev_raidz_impl) ?
+		    "[%s] " : "%s ", ops->name);
+	}
+
+	return (cnt);
+}
+
+module_param_call(zfs_vdev_raidz_impl, vdev_raidz_impl_param_set,
+    vdev_raidz_impl_param_get, NULL, 0644);
+MODULE_PARM_DESC(zfs_vdev_raidz_impl, "Select raidz parity implementation");
+#endif
@@ -0,0 +1,223 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AVX2 RAID-Z math, 32 bytes per loop iteration.  The algorithms are
+ * those of the SSSE3 version; vpshufb looks up within each 128-bit half
+ * so the nibble tables are broadcast to both halves.
+ */
+
+#if defined(__x86_64) && defined(HAVE_AVX2)
+
+#include <sys/zfs_context.h>
+#include <sys/vdev_raidz.h>
+#include <linux/simd_x86.h>
+
+static const uint8_t raidz_avx2_1d = 0x1d;
+static const uint8_t raidz_avx2_0f = 0x0f;
+
+/* x = 2 * x, using t as scratch; %ymm15 holds the 0x1d bytes */
+#define	AVX2_MUL2(x, t)							\
+	"vpxor	%%" t ", %%" t ", %%" t "\n"				\
+	"vpcmpgtb %%" x ", %%" t ", %%" t "\n"				\
+	"vpaddb	%%" x ", %%" x ", %%" x "\n"				\
+	"vpand	%%ymm15, %%" t ", %%" t "\n"				\
+	"vpxor	%%" t ", %%" x ", %%" x "\n"
+
+#define	AVX2_LOOP							\
+	"add	$32, %[i]\n"						\
+	"cmp	%[n], %[i]\n"						\
+	"jb	1b\n"							\
+	"vzeroupper\n"
+
+/*
+ * %ymm2 = c * %ymm0, with the nibble tables in %ymm11 and %ymm12 and
+ * the 0x0f bytes in %ymm13.
+ */
+#define	AVX2_MULC							\
+	"vpsrlw	$4, %%ymm0, %%ymm1\n"					\
+	"vpand	%%ymm13, %%ymm0, %%ymm0\n"				\
+	"vpand	%%ymm13, %%ymm1, %%ymm1\n"				\
+	"vpshufb %%ymm0, %%ymm11, %%ymm2\n"				\
+	"vpshufb %%ymm1, %%ymm12, %%ymm3\n"				\
+	"vpxor	%%ymm3, %%ymm2, %%ymm2\n"
+
+#define	AVX2_MULC_LOAD							\
+	"vbroadcasti128 (%[lt]), %%ymm11\n"				\
+	"vbroadcasti128 16(%[lt]), %%ymm12\n"				\
+	"vpbroadcastb (%[c0f]), %%ymm13\n"
+
+static void
+vdev_raidz_avx2_xor(void *dst, const void *src, size_t size)
+{
+	size_t i = 0;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "1:\n"
+	    "vmovdqu (%[src],%[i]), %%ymm0\n"
+	    "vpxor	(%[dst],%[i]), %%ymm0, %%ymm0\n"
+	    "vmovdqu %%ymm0, (%[dst],%[i])\n"
+	    AVX2_LOOP
+	    : [i] "+r" (i)
+	    : [dst] "r" (dst), [src] "r" (src), [n] "r" (size)
+	    : "cc", "memory", "xmm0");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_avx2_mul2_xor(void *dst, const void *src, size_t size)
+{
+	size_t i = 0;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "vpbroadcastb (%[c1d]), %%ymm15\n"
+	    "1:\n"
+	    "vmovdqu (%[dst],%[i]), %%ymm1\n"
+	    AVX2_MUL2("ymm1", "ymm4")
+	    "vpxor	(%[src],%[i]), %%ymm1, %%ymm1\n"
+	    "vmovdqu %%ymm1, (%[dst],%[i])\n"
+	    AVX2_LOOP
+	    : [i] "+r" (i)
+	    : [dst] "r" (dst), [src] "r" (src), [n] "r" (size),
+	    [c1d] "r" (&raidz_avx2_1d)
+	    : "cc", "memory", "xmm1", "xmm4", "xmm15");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_avx2_gen_pq(void *p, void *q, const void *src, size_t size)
+{
+	size_t i = 0;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "vpbroadcastb (%[c1d]), %%ymm15\n"
+	    "1:\n"
+	    "vmovdqu (%[src],%[i]), %%ymm0\n"
+	    "vpxor	(%[p],%[i]), %%ymm0, %%ymm1\n"
+	    "vmovdqu (%[q],%[i]), %%ymm2\n"
+	    AVX2_MUL2("ymm2", "ymm4")
+	    "vpxor	%%ymm0, %%ymm2, %%ymm2\n"
+	    "vmovdqu %%ymm1, (%[p],%[i])\n"
+	    "vmovdqu %%ymm2, (%[q],%[i])\n"
+	    AVX2_LOOP
+	    : [i] "+r" (i)
+	    : [p] "r" (p), [q] "r" (q), [src] "r" (src), [n] "r" (size),
+	    [c1d] "r" (&raidz_avx2_1d)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm4", "xmm15");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_avx2_gen_pqr(void *p, void *q, void *r, const void *src,
+    size_t size)
+{
+	size_t i = 0;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "vpbroadcastb (%[c1d]), %%ymm15\n"
+	    "1:\n"
+	    "vmovdqu (%[src],%[i]), %%ymm0\n"
+	    "vpxor	(%[p],%[i]), %%ymm0, %%ymm1\n"
+	    "vmovdqu (%[q],%[i]), %%ymm2\n"
+	    "vmovdqu (%[r],%[i]), %%ymm3\n"
+	    AVX2_MUL2("ymm2", "ymm4")
+	    "vpxor	%%ymm0, %%ymm2, %%ymm2\n"
+	    AVX2_MUL2("ymm3", "ymm5")
+	    AVX2_MUL2("ymm3", "ymm5")
+	    "vpxor	%%ymm0, %%ymm3, %%ymm3\n"
+	    "vmovdqu %%ymm1, (%[p],%[i])\n"
+	    "vmovdqu %%ymm2, (%[q],%[i])\n"
+	    "vmovdqu %%ymm3, (%[r],%[i])\n"
+	    AVX2_LOOP
+	    : [i] "+r" (i)
+	    : [p] "r" (p), [q] "r" (q), [r] "r" (r), [src] "r" (src),
+	    [n] "r" (size), [c1d] "r" (&raidz_avx2_1d)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+	    "xmm15");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_avx2_mul(void *dst, const void *src, uint8_t c, size_t size)
+{
+	size_t i = 0;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    AVX2_MULC_LOAD
+	    "1:\n"
+	    "vmovdqu (%[src],%[i]), %%ymm0\n"
+	    AVX2_MULC
+	    "vmovdqu %%ymm2, (%[dst],%[i])\n"
+	    AVX2_LOOP
+	    : [i] "+r" (i)
+	    : [dst] "r" (dst), [src] "r" (src), [n] "r" (size),
+	    [lt] "r" (vdev_raidz_mul_lt[c]), [c0f] "r" (&raidz_avx2_0f)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm11",
+	    "xmm12", "xmm13");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_avx2_mul_xor(void *dst, const void *src, uint8_t c, size_t size)
+{
+	size_t i = 0;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    AVX2_MULC_LOAD
+	    "1:\n"
+	    "vmovdqu (%[src],%[i]), %%ymm0\n"
+	    AVX2_MULC
+	    "vpxor	(%[dst],%[i]), %%ymm2, %%ymm2\n"
+	    "vmovdqu %%ymm2, (%[dst],%[i])\n"
+	    AVX2_LOOP
+	    : [i] "+r" (i)
+	    : [dst] "r" (dst), [src] "r" (src), [n] "r" (size),
+	    [lt] "r" (vdev_raidz_mul_lt[c]), [c0f] "r" (&raidz_avx2_0f)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm11",
+	    "xmm12", "xmm13");
+	kfpu_end();
+}
+
+static boolean_t
+vdev_raidz_avx2_valid(void)
+{
+	return (zfs_avx2_available());
+}
+
+const raidz_math_ops_t vdev_raidz_avx2_ops = {
+	.xor_buf = vdev_raidz_avx2_xor,
+	.mul2_xor = vdev_raidz_avx2_mul2_xor,
+	.gen_pq = vdev_raidz_avx2_gen_pq,
+	.gen_pqr = vdev_raidz_avx2_gen_pqr,
+	.mul = vdev_raidz_avx2_mul,
+	.mul_xor = vdev_raidz_avx2_mul_xor,
+	.valid = vdev_raidz_avx2_valid,
+	.blocksize = 32,
+	.name = "avx2"
+};
+
+#endif /* __x86_64 && HAVE_AVX2 */
@@ -0,0 +1,238 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AVX-512BW RAID-Z math, 64 bytes per loop iteration.  AVX-512 byte
+ * compares only produce mask registers, so multiplication by 2 instead
+ * looks up the reduction term from each byte's high nibble: it is 0x1d
+ * for nibbles 8-15 and 0 otherwise.  Multiplication by a constant is as
+ * in the SSSE3 and AVX2 versions.
+ */
+
+#if defined(__x86_64) && defined(HAVE_AVX512BW)
+
+#include <sys/zfs_context.h>
+#include <sys/vdev_raidz.h>
+#include <linux/simd_x86.h>
+
+static const uint8_t raidz_avx512_top[16] = {
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d
+};
+static const uint8_t raidz_avx512_0f = 0x0f;
+
+/*
+ * x = 2 * x, using t as scratch; %zmm13 holds the 0x0f bytes and %zmm14
+ * the reduction table.
+ */
+#define	AVX512_MUL2(x, t)						\
+	"vpsrlw	$4, %%" x ", %%" t "\n"					\
+	"vpandq	%%zmm13, %%" t ", %%" t "\n"				\
+	"vpshufb %%" t ", %%zmm14, %%" t "\n"				\
+	"vpaddb	%%" x ", %%" x ", %%" x "\n"				\
+	"vpxorq	%%" t ", %%" x ", %%" x "\n"
+
+#define	AVX512_MUL2_LOAD						\
+	"vpbroadcastb (%[c0f]), %%zmm13\n"				\
+	"vbroadcasti32x4 (%[top]), %%zmm14\n"
+
+#define	AVX512_LOOP							\
+	"add	$64, %[i]\n"						\
+	"cmp	%[n], %[i]\n"						\
+	"jb	1b\n"							\
+	"vzeroupper\n"
+
+/*
+ * %zmm2 = c * %zmm0, with the nibble tables in %zmm11 and %zmm12 and
+ * the 0x0f bytes in %zmm13.
+ */
+#define	AVX512_MULC							\
+	"vpsrlw	$4, %%zmm0, %%zmm1\n"					\
+	"vpandq	%%zmm13, %%zmm0, %%zmm0\n"				\
+	"vpandq	%%zmm13, %%zmm1, %%zmm1\n"				\
+	"vpshufb %%zmm0, %%zmm11, %%zmm2\n"				\
+	"vpshufb %%zmm1, %%zmm12, %%zmm3\n"				\
+	"vpxorq	%%zmm3, %%zmm2, %%zmm2\n"
+
+#define	AVX512_MULC_LOAD						\
+	"vbroadcasti32x4 (%[lt]), %%zmm11\n"				\
+	"vbroadcasti32x4 16(%[lt]), %%zmm12\n"				\
+	"vpbroadcastb (%[c0f]), %%zmm13\n"
+
+static void
+vdev_raidz_avx512bw_xor(void *dst, const void *src, size_t size)
+{
+	size_t i = 0;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "1:\n"
+	    "vmovdqu64 (%[src],%[i]), %%zmm0\n"
+	    "vpxorq	(%[dst],%[i]), %%zmm0, %%zmm0\n"
+	    "vmovdqu64 %%zmm0, (%[dst],%[i])\n"
+	    AVX512_LOOP
+	    : [i] "+r" (i)
+	    : [dst] "r" (dst), [src] "r" (src), [n] "r" (size)
+	    : "cc", "memory", "xmm0");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_avx512bw_mul2_xor(void *dst, const void *src, size_t size)
+{
+	size_t i = 0;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    AVX512_MUL2_LOAD
+	    "1:\n"
+	    "vmovdqu64 (%[dst],%[i]), %%zmm1\n"
+	    AVX512_MUL2("zmm1", "zmm4")
+	    "vpxorq	(%[src],%[i]), %%zmm1, %%zmm1\n"
+	    "vmovdqu64 %%zmm1, (%[dst],%[i])\n"
+	    AVX512_LOOP
+	    : [i] "+r" (i)
+	    : [dst] "r" (dst), [src] "r" (src), [n] "r" (size),
+	    [c0f] "r" (&raidz_avx512_0f), [top] "r" (raidz_avx512_top)
+	    : "cc", "memory", "xmm1", "xmm4", "xmm13", "xmm14");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_avx512bw_gen_pq(void *p, void *q, const void *src, size_t size)
+{
+	size_t i = 0;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    AVX512_MUL2_LOAD
+	    "1:\n"
+	    "vmovdqu64 (%[src],%[i]), %%zmm0\n"
+	    "vpxorq	(%[p],%[i]), %%zmm0, %%zmm1\n"
+	    "vmovdqu64 (%[q],%[i]), %%zmm2\n"
+	    AVX512_MUL2("zmm2", "zmm4")
+	    "vpxorq	%%zmm0, %%zmm2, %%zmm2\n"
+	    "vmovdqu64 %%zmm1, (%[p],%[i])\n"
+	    "vmovdqu64 %%zmm2, (%[q],%[i])\n"
+	    AVX512_LOOP
+	    : [i] "+r" (i)
+	    : [p] "r" (p), [q] "r" (q), [src] "r" (src), [n] "r" (size),
+	    [c0f] "r" (&raidz_avx512_0f), [top] "r" (raidz_avx512_top)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm4", "xmm13",
+	    "xmm14");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_avx512bw_gen_pqr(void *p, void *q, void *r, const void *src,
+    size_t size)
+{
+	size_t i = 0;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    AVX512_MUL2_LOAD
+	    "1:\n"
+	    "vmovdqu64 (%[src],%[i]), %%zmm0\n"
+	    "vpxorq	(%[p],%[i]), %%zmm0, %%zmm1\n"
+	    "vmovdqu64 (%[q],%[i]), %%zmm2\n"
+	    "vmovdqu64 (%[r],%[i]), %%zmm3\n"
+	    AVX512_MUL2("zmm2", "zmm4")
+	    "vpxorq	%%zmm0, %%zmm2, %%zmm2\n"
+	    AVX512_MUL2("zmm3", "zmm5")
+	    AVX512_MUL2("zmm3", "zmm5")
+	    "vpxorq	%%zmm0, %%zmm3, %%zmm3\n"
+	    "vmovdqu64 %%zmm1, (%[p],%[i])\n"
+	    "vmovdqu64 %%zmm2, (%[q],%[i])\n"
+	    "vmovdqu64 %%zmm3, (%[r],%[i])\n"
+	    AVX512_LOOP
+	    : [i] "+r" (i)
+	    : [p] "r" (p), [q] "r" (q), [r] "r" (r), [src] "r" (src),
+	    [n] "r" (size), [c0f] "r" (&raidz_avx512_0f),
+	    [top] "r" (raidz_avx512_top)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+	    "xmm13", "xmm14");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_avx512bw_mul(void *dst, const void *src, uint8_t c, size_t size)
+{
+	size_t i = 0;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    AVX512_MULC_LOAD
+	    "1:\n"
+	    "vmovdqu64 (%[src],%[i]), %%zmm0\n"
+	    AVX512_MULC
+	    "vmovdqu64 %%zmm2, (%[dst],%[i])\n"
+	    AVX512_LOOP
+	    : [i] "+r" (i)
+	    : [dst] "r" (dst), [src] "r" (src), [n] "r" (size),
+	    [lt] "r" (vdev_raidz_mul_lt[c]), [c0f] "r" (&raidz_avx512_0f)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm11",
+	    "xmm12", "xmm13");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_avx512bw_mul_xor(void *dst, const void *src, uint8_t c,
+    size_t size)
+{
+	size_t i = 0;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    AVX512_MULC_LOAD
+	    "1:\n"
+	    "vmovdqu64 (%[src],%[i]), %%zmm0\n"
+	    AVX512_MULC
+	    "vpxorq	(%[dst],%[i]), %%zmm2, %%zmm2\n"
+	    "vmovdqu64 %%zmm2, (%[dst],%[i])\n"
+	    AVX512_LOOP
+	    : [i] "+r" (i)
+	    : [dst] "r" (dst), [src] "r" (src), [n] "r" (size),
+	    [lt] "r" (vdev_raidz_mul_lt[c]), [c0f] "r" (&raidz_avx512_0f)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm11",
+	    "xmm12", "xmm13");
+	kfpu_end();
+}
+
+static boolean_t
+vdev_raidz_avx512bw_valid(void)
+{
+	return (zfs_avx512f_available() && zfs_avx512bw_available());
+}
+
+const raidz_math_ops_t vdev_raidz_avx512bw_ops = {
+	.xor_buf = vdev_raidz_avx512bw_xor,
+	.mul2_xor = vdev_raidz_avx512bw_mul2_xor,
+	.gen_pq = vdev_raidz_avx512bw_gen_pq,
+	.gen_pqr = vdev_raidz_avx512bw_gen_pqr,
+	.mul = vdev_raidz_avx512bw_mul,
+	.mul_xor = vdev_raidz_avx512bw_mul_xor,
+	.valid = vdev_raidz_avx512bw_valid,
+	.blocksize = 64,
+	.name = "avx512bw"
+};
+
+#endif /* __x86_64 && HAVE_AVX512BW */
@@ -0,0 +1,238 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SSSE3 RAID-Z math, 16 bytes per loop iteration.  Multiplication by 2
+ * doubles every byte with paddb and applies the 0x1d reduction to the
+ * bytes whose top bit was set, found with a signed compare against
+ * zero.  Multiplication by an arbitrary constant looks up the products
+ * of the low and high nibbles with pshufb and adds them.
+ */
+
+#if defined(__x86_64) && defined(HAVE_SSSE3)
+
+#include <sys/zfs_context.h>
+#include <sys/vdev_raidz.h>
+#include <linux/simd_x86.h>
+
+static const uint8_t raidz_sse_1d[16] = {
+	0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d,
+	0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d
+};
+
+static const uint8_t raidz_sse_0f[16] = {
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f
+};
+
+/* x = 2 * x, using t as scratch; %xmm15 holds the 0x1d bytes */
+#define	SSE_MUL2(x, t)							\
+	"pxor	%%" t ", %%" t "\n"					\
+	"pcmpgtb %%" x ", %%" t "\n"					\
+	"paddb	%%" x ", %%" x "\n"					\
+	"pand	%%xmm15, %%" t "\n"					\
+	"pxor	%%" t ", %%" x "\n"
+
+#define	SSE_LOOP							\
+	"add	$16, %[i]\n"						\
+	"cmp	%[n], %[i]\n"						\
+	"jb	1b\n"
+
+/*
+ * %xmm2 = c * %xmm0, with the nibble tables in %xmm11 and %xmm12 and
+ * the 0x0f bytes in %xmm13.
+ */
+#define	SSE_MULC							\
+	"movdqa	%%xmm0, %%xmm1\n"					\
+	"psrlw	$4, %%xmm1\n"						\
+	"pand	%%xmm13, %%xmm0\n"					\
+	"pand	%%xmm13, %%xmm1\n"					\
+	"movdqa	%%xmm11, %%xmm2\n"					\
+	"pshufb	%%xmm0, %%xmm2\n"					\
+	"movdqa	%%xmm12, %%xmm3\n"					\
+	"pshufb	%%xmm1, %%xmm3\n"					\
+	"pxor	%%xmm3, %%xmm2\n"
+
+static void
+vdev_raidz_ssse3_xor(void *dst, const void *src, size_t size)
+{
+	size_t i = 0;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "1:\n"
+	    "movdqu	(%[src],%[i]), %%xmm0\n"
+	    "movdqu	(%[dst],%[i]), %%xmm1\n"
+	    "pxor	%%xmm0, %%xmm1\n"
+	    "movdqu	%%xmm1, (%[dst],%[i])\n"
+	    SSE_LOOP
+	    : [i] "+r" (i)
+	    : [dst] "r" (dst), [src] "r" (src), [n] "r" (size)
+	    : "cc", "memory", "xmm0", "xmm1");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_ssse3_mul2_xor(void *dst, const void *src, size_t size)
+{
+	size_t i = 0;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "movdqu	(%[c1d]), %%xmm15\n"
+	    "1:\n"
+	    "movdqu	(%[dst],%[i]), %%xmm1\n"
+	    SSE_MUL2("xmm1", "xmm4")
+	    "movdqu	(%[src],%[i]), %%xmm0\n"
+	    "pxor	%%xmm0, %%xmm1\n"
+	    "movdqu	%%xmm1, (%[dst],%[i])\n"
+	    SSE_LOOP
+	    : [i] "+r" (i)
+	    : [dst] "r" (dst), [src] "r" (src), [n] "r" (size),
+	    [c1d] "r" (raidz_sse_1d)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm4", "xmm15");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_ssse3_gen_pq(void *p, void *q, const void *src, size_t size)
+{
+	size_t i = 0;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "movdqu	(%[c1d]), %%xmm15\n"
+	    "1:\n"
+	    "movdqu	(%[src],%[i]), %%xmm0\n"
+	    "movdqu	(%[p],%[i]), %%xmm1\n"
+	    "movdqu	(%[q],%[i]), %%xmm2\n"
+	    "pxor	%%xmm0, %%xmm1\n"
+	    SSE_MUL2("xmm2", "xmm4")
+	    "pxor	%%xmm0, %%xmm2\n"
+	    "movdqu	%%xmm1, (%[p],%[i])\n"
+	    "movdqu	%%xmm2, (%[q],%[i])\n"
+	    SSE_LOOP
+	    : [i] "+r" (i)
+	    : [p] "r" (p), [q] "r" (q), [src] "r" (src), [n] "r" (size),
+	    [c1d] "r" (raidz_sse_1d)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm4", "xmm15");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_ssse3_gen_pqr(void *p, void *q, void *r, const void *src,
+    size_t size)
+{
+	size_t i = 0;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "movdqu	(%[c1d]), %%xmm15\n"
+	    "1:\n"
+	    "movdqu	(%[src],%[i]), %%xmm0\n"
+	    "movdqu	(%[p],%[i]), %%xmm1\n"
+	    "movdqu	(%[q],%[i]), %%xmm2\n"
+	    "movdqu	(%[r],%[i]), %%xmm3\n"
+	    "pxor	%%xmm0, %%xmm1\n"
+	    SSE_MUL2("xmm2", "xmm4")
+	    "pxor	%%xmm0, %%xmm2\n"
+	    SSE_MUL2("xmm3", "xmm5")
+	    SSE_MUL2("xmm3", "xmm5")
+	    "pxor	%%xmm0, %%xmm3\n"
+	    "movdqu	%%xmm1, (%[p],%[i])\n"
+	    "movdqu	%%xmm2, (%[q],%[i])\n"
+	    "movdqu	%%xmm3, (%[r],%[i])\n"
+	    SSE_LOOP
+	    : [i] "+r" (i)
+	    : [p] "r" (p), [q] "r" (q), [r] "r" (r), [src] "r" (src),
+	    [n] "r" (size), [c1d] "r" (raidz_sse_1d)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+	    "xmm15");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_ssse3_mul(void *dst, const void *src, uint8_t c, size_t size)
+{
+	size_t i = 0;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "movdqu	(%[lt]), %%xmm11\n"
+	    "movdqu	16(%[lt]), %%xmm12\n"
+	    "movdqu	(%[c0f]), %%xmm13\n"
+	    "1:\n"
+	    "movdqu	(%[src],%[i]), %%xmm0\n"
+	    SSE_MULC
+	    "movdqu	%%xmm2, (%[dst],%[i])\n"
+	    SSE_LOOP
+	    : [i] "+r" (i)
+	    : [dst] "r" (dst), [src] "r" (src), [n] "r" (size),
+	    [lt] "r" (vdev_raidz_mul_lt[c]), [c0f] "r" (raidz_sse_0f)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm11",
+	    "xmm12", "xmm13");
+	kfpu_end();
+}
+
+static void
+vdev_raidz_ssse3_mul_xor(void *dst, const void *src, uint8_t c, size_t size)
+{
+	size_t i = 0;
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "movdqu	(%[lt]), %%xmm11\n"
+	    "movdqu	16(%[lt]), %%xmm12\n"
+	    "movdqu	(%[c0f]), %%xmm13\n"
+	    "1:\n"
+	    "movdqu	(%[src],%[i]), %%xmm0\n"
+	    SSE_MULC
+	    "movdqu	(%[dst],%[i]), %%xmm4\n"
+	    "pxor	%%xmm4, %%xmm2\n"
+	    "movdqu	%%xmm2, (%[dst],%[i])\n"
+	    SSE_LOOP
+	    : [i] "+r" (i)
+	    : [dst] "r" (dst), [src] "r" (src), [n] "r" (size),
+	    [lt] "r" (vdev_raidz_mul_lt[c]), [c0f] "r" (raidz_sse_0f)
+	    : "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm11",
+	    "xmm12", "xmm13");
+	kfpu_end();
+}
+
+static boolean_t
+vdev_raidz_ssse3_valid(void)
+{
+	return (zfs_sse2_available() && zfs_ssse3_available());
+}
+
+const raidz_math_ops_t vdev_raidz_ssse3_ops = {
+	.xor_buf = vdev_raidz_ssse3_xor,
+	.mul2_xor = vdev_raidz_ssse3_mul2_xor,
+	.gen_pq = vdev_raidz_ssse3_gen_pq,
+	.gen_pqr = vdev_raidz_ssse3_gen_pqr,
+	.mul = vdev_raidz_ssse3_mul,
+	.mul_xor = vdev_raidz_ssse3_mul_xor,
+	.valid = vdev_raidz_ssse3_valid,
+	.blocksize = 16,
+	.name = "ssse3"
+};
+
+#endif /* __x86_64 && HAVE_SSSE3 */
@@ -164,4 +164,13 @@ zpool_feature_init(void)
 	zfeature_register(SPA_FEATURE_LZ4_COMPRESS,
 	    "org.illumos:lz4_compress", "lz4_compress",
 	    "LZ4 compression algorithm support.", B_FALSE, B_FALSE, NULL);
+	zfeature_register(SPA_FEATURE_SHA512,
+	    "org.illumos:sha512", "sha512",
+	    "SHA-512/256 hash algorithm.", B_FALSE, B_FALSE, NULL);
+	zfeature_register(SPA_FEATURE_SKEIN,
+	    "org.illumos:skein", "skein",
+	    "Skein hash algorithm.", B_FALSE, B_FALSE, NULL);
+	zfeature_register(SPA_FEATURE_ZSTD_COMPRESS,
+	    "org.zfsonlinux:zstd_compress", "zstd_compress",
+	    "zstd compression algorithm support.", B_FALSE, B_FALSE, NULL);
 }
@@ -290,6 +290,37 @@ zfs_is_bootfs(const char *name)
 	return (B_FALSE);
 }
 
+/*
+ * Return the pool feature needed by a compression property value, or NULL
+ * if it needs none.
+ */
+static zfeature_info_t *
+zfs_compress_feature(uint64_t intval)
+{
+	if (intval == ZIO_COMPRESS_LZ4)
+		return (&spa_feature_table[SPA_FEATURE_LZ4_COMPRESS]);
+	if (ZIO_COMPRESS_IS_ZSTD(intval))
+		return (&spa_feature_table[SPA_FEATURE_ZSTD_COMPRESS]);
+	return (NULL);
+}
+
+/*
+ * Return the pool feature needed by a checksum or dedup property value,
+ * or NULL if it needs none.
+ */
+static zfeature_info_t *
+zfs_checksum_feature(uint64_t intval)
+{
+	switch (intval & ZIO_CHECKSUM_MASK) {
+	case ZIO_CHECKSUM_SHA512:
+		return (&spa_feature_table[SPA_FEATURE_SHA512]);
+	case ZIO_CHECKSUM_SKEIN:
+		return (&spa_feature_table[SPA_FEATURE_SKEIN]);
+	default:
+		return (NULL);
+	}
+}
+
 /*
  * zfs_earlier_version
  *
@@ -1582,6 +1613,31 @@ zfs_ioc_pool_tryimport(zfs_cmd_t *zc)
 	return (error);
 }
 
+/*
+ * inputs:
+ * zc_name              name of the pool
+ * zc_cookie            1 to start trimming, 0 to stop
+ * zc_obj               rate limit in bytes/sec, 0 for no limit
+ */
+static int
+zfs_ioc_pool_trim(zfs_cmd_t *zc)
+{
+	spa_t *spa;
+	int error;
+
+	if ((error = spa_open(zc->zc_name, &spa, FTAG)) != 0)
+		return (error);
+
+	if (zc->zc_cookie)
+		error = spa_trim(spa, zc->zc_obj);
+	else
+		error = spa_trim_stop(spa);
+
+	spa_close(spa, FTAG);
+
+	return (error);
+}
+
 /*
  * inputs:
  * zc_name              name of the pool
@@ -2373,17 +2429,17 @@ zfs_prop_set_special(const char *dsname, zprop_source_t source,
 	}
 	case ZFS_PROP_COMPRESSION:
 	{
-		if (intval == ZIO_COMPRESS_LZ4) {
-			zfeature_info_t *feature =
-			    &spa_feature_table[SPA_FEATURE_LZ4_COMPRESS];
+		zfeature_info_t *feature = zfs_compress_feature(intval);
+
+		if (feature != NULL) {
 			spa_t *spa;
 
 			if ((err = spa_open(dsname, &spa, FTAG)) != 0)
 				return (err);
 
 			/*
-			 * Setting the LZ4 compression algorithm activates
-			 * the feature.
+			 * Setting the LZ4 or zstd compression algorithm
+			 * activates the feature.
 			 */
 			if (!spa_feature_is_active(spa, feature)) {
 				if ((err = zfs_prop_activate_feature(spa,
@@ -2402,6 +2458,31 @@ zfs_prop_set_special(const char *dsname, zprop_source_t source,
 		err = -1;
 		break;
 	}
+	case ZFS_PROP_CHECKSUM:
+	case ZFS_PROP_DEDUP:
+	{
+		zfeature_info_t *feature = zfs_checksum_feature(intval);
+		spa_t *spa;
+
+		if (feature != NULL) {
+			if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+				return (err);
+
+			/*
+			 * Setting a checksum algorithm which needs a feature
+			 * activates the feature.
+			 */
+			err = 0;
+			if (!spa_feature_is_active(spa, feature))
+				err = zfs_prop_activate_feature(spa, feature);
+
+			spa_close(spa, FTAG);
+			if (err != 0)
+				return (err);
+		}
+		err = -1;
+		break;
+	}
 
 	default:
 		err = -1;
@@ -3632,6 +3713,8 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 		 */
 		if (nvpair_type(pair) == DATA_TYPE_UINT64 &&
 		    nvpair_value_uint64(pair, &intval) == 0) {
+			zfeature_info_t *feature;
+
 			if (intval >= ZIO_COMPRESS_GZIP_1 &&
 			    intval <= ZIO_COMPRESS_GZIP_9 &&
 			    zfs_earlier_version(dsname,
@@ -3644,10 +3727,8 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 			    SPA_VERSION_ZLE_COMPRESSION))
 				return (ENOTSUP);
 
-			if (intval == ZIO_COMPRESS_LZ4) {
-				zfeature_info_t *feature =
-				    &spa_feature_table[
-				    SPA_FEATURE_LZ4_COMPRESS];
+			feature = zfs_compress_feature(intval);
+			if (feature != NULL) {
 				spa_t *spa;
 
 				if ((err = spa_open(dsname, &spa, FTAG)) != 0)
@@ -3679,9 +3760,36 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 			return (ENOTSUP);
 		break;
 
+	case ZFS_PROP_CHECKSUM:
 	case ZFS_PROP_DEDUP:
-		if (zfs_earlier_version(dsname, SPA_VERSION_DEDUP))
+		if (prop == ZFS_PROP_DEDUP &&
+		    zfs_earlier_version(dsname, SPA_VERSION_DEDUP))
 			return (ENOTSUP);
+
+		/*
+		 * Checksums added by pool features need the feature enabled,
+		 * and cannot be read by the boot loader.
+		 */
+		if (nvpair_type(pair) == DATA_TYPE_UINT64 &&
+		    nvpair_value_uint64(pair, &intval) == 0) {
+			zfeature_info_t *feature = zfs_checksum_feature(intval);
+			spa_t *spa;
+
+			if (feature == NULL)
+				break;
+
+			if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+				return (err);
+
+			if (!spa_feature_is_enabled(spa, feature)) {
+				spa_close(spa, FTAG);
+				return (ENOTSUP);
+			}
+			spa_close(spa, FTAG);
+
+			if (zfs_is_bootfs(dsname))
+				return (ERANGE);
+		}
 		break;
 
 	case ZFS_PROP_SHARESMB:
@@ -3732,6 +3840,17 @@ zfs_prop_activate_feature_sync(void *arg, dmu_tx_t *tx)
 	zfeature_info_t *feature = arg;
 
 	spa_feature_incr(spa, feature, tx);
+
+	/*
+	 * Pools created before the checksum salt existed only hold one in
+	 * memory, so write it out before the first salted checksum is used.
+	 */
+	if (feature == &spa_feature_table[SPA_FEATURE_SKEIN]) {
+		VERIFY3U(0, ==, zap_update(spa->spa_meta_objset,
+		    DMU_POOL_DIRECTORY_OBJECT, DMU_POOL_CHECKSUM_SALT, 1,
+		    sizeof (spa->spa_cksum_salt.zcs_bytes),
+		    spa->spa_cksum_salt.zcs_bytes, tx));
+	}
 }
 
 /*
@@ -5295,6 +5414,8 @@ zfs_ioctl_init(void)
 	    zfs_ioc_vdev_split);
 	zfs_ioctl_register_pool_modify(ZFS_IOC_POOL_REGUID,
 	    zfs_ioc_pool_reguid);
+	zfs_ioctl_register_pool_modify(ZFS_IOC_POOL_TRIM,
+	    zfs_ioc_pool_trim);
 
 	zfs_ioctl_register_pool_meta(ZFS_IOC_POOL_CONFIGS,
 	    zfs_ioc_pool_configs, zfs_secpolicy_none);
@@ -33,30 +33,11 @@
 #include <sys/zio_impl.h>
 #include <sys/zio_compress.h>
 #include <sys/zio_checksum.h>
+#include <sys/sha256.h>
 #include <sys/dmu_objset.h>
 #include <sys/arc.h>
 #include <sys/ddt.h>
 
-/*
- * ==========================================================================
- * I/O priority table
- * ==========================================================================
- */
-uint8_t zio_priority_table[ZIO_PRIORITY_TABLE_SIZE] = {
-	0,	/* ZIO_PRIORITY_NOW		*/
-	0,	/* ZIO_PRIORITY_SYNC_READ	*/
-	0,	/* ZIO_PRIORITY_SYNC_WRITE	*/
-	0,	/* ZIO_PRIORITY_LOG_WRITE	*/
-	1,	/* ZIO_PRIORITY_CACHE_FILL	*/
-	1,	/* ZIO_PRIORITY_AGG		*/
-	4,	/* ZIO_PRIORITY_FREE		*/
-	4,	/* ZIO_PRIORITY_ASYNC_WRITE	*/
-	6,	/* ZIO_PRIORITY_ASYNC_READ	*/
-	10,	/* ZIO_PRIORITY_RESILVER	*/
-	20,	/* ZIO_PRIORITY_SCRUB		*/
-	2,	/* ZIO_PRIORITY_DDT_PREFETCH	*/
-};
-
 /*
  * ==========================================================================
  * I/O type descriptions
@@ -73,7 +54,7 @@ char *zio_type_name[ZIO_TYPES] = {
  */
 kmem_cache_t *zio_cache;
 kmem_cache_t *zio_link_cache;
-kmem_cache_t *zio_vdev_cache;
+kmem_cache_t *zio_trace_cache;
 kmem_cache_t *zio_buf_cache[SPA_MAXBLOCKSIZE >> SPA_MINBLOCKSHIFT];
 kmem_cache_t *zio_data_buf_cache[SPA_MAXBLOCKSIZE >> SPA_MINBLOCKSHIFT];
 int zio_bulk_flags = 0;
@@ -105,6 +86,14 @@ int zfs_sync_pass_rewrite = 2; /* rewrite new bps starting in this pass */
 
 int zio_requeue_io_start_cut_in_line = 1;
 
+/*
+ * Time each pipeline stage of the zios created while zio_trace_stages is
+ * set (see zio_trace_stage()).  The number of slowest zios remembered,
+ * zio_trace_slow_entries, is only read when the module is loaded.
+ */
+int zio_trace_stages = 0;
+int zio_trace_slow_entries = 16;
+
 #ifdef ZFS_DEBUG
 int zio_buf_debug_limit = 16384;
 #else
@@ -112,6 +101,8 @@ int zio_buf_debug_limit = 0;
 #endif
 
 static inline void __zio_execute(zio_t *zio);
+static void zio_trace_init(void);
+static void zio_trace_fini(void);
 
 static int
 zio_cons(void *arg, void *unused, int kmflag)
@@ -152,8 +143,8 @@ zio_init(void)
 	    zio_cons, zio_dest, NULL, NULL, NULL, KMC_KMEM);
 	zio_link_cache = kmem_cache_create("zio_link_cache",
 	    sizeof (zio_link_t), 0, NULL, NULL, NULL, NULL, NULL, KMC_KMEM);
-	zio_vdev_cache = kmem_cache_create("zio_vdev_cache", sizeof(vdev_io_t),
-	    PAGESIZE, NULL, NULL, NULL, NULL, NULL, KMC_VMEM);
+	zio_trace_cache = kmem_cache_create("zio_trace_cache",
+	    sizeof (zio_trace_t), 0, NULL, NULL, NULL, NULL, NULL, KMC_KMEM);
 
 	/*
 	 * For small buffers, we want a cache for each multiple of
@@ -221,7 +212,11 @@ zio_init(void)
 
 	zio_inject_init();
 
+	zio_trace_init();
+
 	lz4_init();
+
+	zstd_init();
 }
 
 void
@@ -245,13 +240,17 @@ zio_fini(void)
 		zio_data_buf_cache[c] = NULL;
 	}
 
-	kmem_cache_destroy(zio_vdev_cache);
+	kmem_cache_destroy(zio_trace_cache);
 	kmem_cache_destroy(zio_link_cache);
 	kmem_cache_destroy(zio_cache);
 
 	zio_inject_fini();
 
+	zio_trace_fini();
+
 	lz4_fini();
+
+	zstd_fini();
 }
 
 /*
@@ -313,36 +312,18 @@ zio_data_buf_free(void *buf, size_t size)
 	kmem_cache_free(zio_data_buf_cache[c], buf);
 }
 
-/*
- * Dedicated I/O buffers to ensure that memory fragmentation never prevents
- * or significantly delays the issuing of a zio.   These buffers are used
- * to aggregate I/O and could be used for raidz stripes.
- */
-void *
-zio_vdev_alloc(void)
-{
-	return (kmem_cache_alloc(zio_vdev_cache, KM_PUSHPAGE));
-}
-
-void
-zio_vdev_free(void *buf)
-{
-	kmem_cache_free(zio_vdev_cache, buf);
-
-}
-
 /*
  * ==========================================================================
  * Push and pop I/O transform buffers
  * ==========================================================================
  */
 static void
-zio_push_transform(zio_t *zio, void *data, uint64_t size, uint64_t bufsize,
+zio_push_transform(zio_t *zio, abd_t *data, uint64_t size, uint64_t bufsize,
 	zio_transform_func_t *transform)
 {
 	zio_transform_t *zt = kmem_alloc(sizeof (zio_transform_t), KM_PUSHPAGE);
 
-	zt->zt_orig_data = zio->io_data;
+	zt->zt_orig_abd = zio->io_abd;
 	zt->zt_orig_size = zio->io_size;
 	zt->zt_bufsize = bufsize;
 	zt->zt_transform = transform;
@@ -350,7 +331,7 @@ zio_push_transform(zio_t *zio, void *data, uint64_t size, uint64_t bufsize,
 	zt->zt_next = zio->io_transform_stack;
 	zio->io_transform_stack = zt;
 
-	zio->io_data = data;
+	zio->io_abd = data;
 	zio->io_size = size;
 }
 
@@ -362,12 +343,12 @@ zio_pop_transforms(zio_t *zio)
 	while ((zt = zio->io_transform_stack) != NULL) {
 		if (zt->zt_transform != NULL)
 			zt->zt_transform(zio,
-			    zt->zt_orig_data, zt->zt_orig_size);
+			    zt->zt_orig_abd, zt->zt_orig_size);
 
 		if (zt->zt_bufsize != 0)
-			zio_buf_free(zio->io_data, zt->zt_bufsize);
+			abd_free(zio->io_abd);
 
-		zio->io_data = zt->zt_orig_data;
+		zio->io_abd = zt->zt_orig_abd;
 		zio->io_size = zt->zt_orig_size;
 		zio->io_transform_stack = zt->zt_next;
 
@@ -381,21 +362,26 @@ zio_pop_transforms(zio_t *zio)
  * ==========================================================================
  */
 static void
-zio_subblock(zio_t *zio, void *data, uint64_t size)
+zio_subblock(zio_t *zio, abd_t *data, uint64_t size)
 {
 	ASSERT(zio->io_size > size);
 
 	if (zio->io_type == ZIO_TYPE_READ)
-		bcopy(zio->io_data, data, size);
+		abd_copy(data, zio->io_abd, size);
 }
 
 static void
-zio_decompress(zio_t *zio, void *data, uint64_t size)
+zio_decompress(zio_t *zio, abd_t *data, uint64_t size)
 {
-	if (zio->io_error == 0 &&
-	    zio_decompress_data(BP_GET_COMPRESS(zio->io_bp),
-	    zio->io_data, data, zio->io_size, size) != 0)
-		zio->io_error = EIO;
+	if (zio->io_error == 0) {
+		void *tmp = abd_borrow_buf(data, size);
+		int ret = zio_decompress_data(BP_GET_COMPRESS(zio->io_bp),
+		    zio->io_abd, tmp, zio->io_size, size);
+		abd_return_buf_copy(data, tmp, size);
+
+		if (ret != 0)
+			zio->io_error = EIO;
+	}
 }
 
 /*
@@ -561,8 +547,8 @@ zio_inherit_child_errors(zio_t *zio, enum zio_child c)
  */
 static zio_t *
 zio_create(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
-    void *data, uint64_t size, zio_done_func_t *done, void *private,
-    zio_type_t type, int priority, enum zio_flag flags,
+    abd_t *data, uint64_t size, zio_done_func_t *done, void *private,
+    zio_type_t type, zio_priority_t priority, enum zio_flag flags,
     vdev_t *vd, uint64_t offset, const zbookmark_t *zb,
     enum zio_stage stage, enum zio_stage pipeline)
 {
@@ -618,11 +604,11 @@ zio_create(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
 	zio->io_vsd = NULL;
 	zio->io_vsd_ops = NULL;
 	zio->io_offset = offset;
-	zio->io_deadline = 0;
+	zio->io_queued_timestamp = 0;
 	zio->io_timestamp = 0;
 	zio->io_delta = 0;
 	zio->io_delay = 0;
-	zio->io_orig_data = zio->io_data = data;
+	zio->io_orig_abd = zio->io_abd = data;
 	zio->io_orig_size = zio->io_size = size;
 	zio->io_orig_flags = zio->io_flags = flags;
 	zio->io_orig_stage = zio->io_stage = stage;
@@ -644,6 +630,16 @@ zio_create(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
 	zio->io_cksum_report = NULL;
 	zio->io_ena = 0;
 	bzero(zio->io_child_error, sizeof (int) * ZIO_CHILD_TYPES);
+	zio->io_trace = NULL;
+	if (zio_trace_stages) {
+		zio_trace_t *zt;
+
+		zt = kmem_cache_alloc(zio_trace_cache, KM_PUSHPAGE);
+		zt->zt_start = zt->zt_last = gethrtime();
+		zt->zt_stage = zt->zt_visited = ZIO_STAGE_OPEN;
+		bzero(zt->zt_ns, sizeof (zt->zt_ns));
+		zio->io_trace = zt;
+	}
 	bzero(zio->io_children,
 	    sizeof (uint64_t) * ZIO_CHILD_TYPES * ZIO_WAIT_TYPES);
 	bzero(&zio->io_bookmark, sizeof (zbookmark_t));
@@ -670,6 +666,8 @@ zio_create(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
 static void
 zio_destroy(zio_t *zio)
 {
+	if (zio->io_trace != NULL)
+		kmem_cache_free(zio_trace_cache, zio->io_trace);
 	kmem_cache_free(zio_cache, zio);
 }
 
@@ -694,8 +692,8 @@ zio_root(spa_t *spa, zio_done_func_t *done, void *private, enum zio_flag flags)
 
 zio_t *
 zio_read(zio_t *pio, spa_t *spa, const blkptr_t *bp,
-    void *data, uint64_t size, zio_done_func_t *done, void *private,
-    int priority, enum zio_flag flags, const zbookmark_t *zb)
+    abd_t *data, uint64_t size, zio_done_func_t *done, void *private,
+    zio_priority_t priority, enum zio_flag flags, const zbookmark_t *zb)
 {
 	zio_t *zio;
 
@@ -710,9 +708,9 @@ zio_read(zio_t *pio, spa_t *spa, const blkptr_t *bp,
 
 zio_t *
 zio_write(zio_t *pio, spa_t *spa, uint64_t txg, blkptr_t *bp,
-    void *data, uint64_t size, const zio_prop_t *zp,
+    abd_t *data, uint64_t size, const zio_prop_t *zp,
     zio_done_func_t *ready, zio_done_func_t *done, void *private,
-    int priority, enum zio_flag flags, const zbookmark_t *zb)
+    zio_priority_t priority, enum zio_flag flags, const zbookmark_t *zb)
 {
 	zio_t *zio;
 
@@ -739,9 +737,9 @@ zio_write(zio_t *pio, spa_t *spa, uint64_t txg, blkptr_t *bp,
 }
 
 zio_t *
-zio_rewrite(zio_t *pio, spa_t *spa, uint64_t txg, blkptr_t *bp, void *data,
-    uint64_t size, zio_done_func_t *done, void *private, int priority,
-    enum zio_flag flags, zbookmark_t *zb)
+zio_rewrite(zio_t *pio, spa_t *spa, uint64_t txg, blkptr_t *bp,
+    abd_t *data, uint64_t size, zio_done_func_t *done, void *private,
+    zio_priority_t priority, enum zio_flag flags, zbookmark_t *zb)
 {
 	zio_t *zio;
 
@@ -789,7 +787,7 @@ zio_free_sync(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
 	metaslab_check_free(spa, bp);
 
 	zio = zio_create(pio, spa, txg, bp, NULL, BP_GET_PSIZE(bp),
-	    NULL, NULL, ZIO_TYPE_FREE, ZIO_PRIORITY_FREE, flags,
+	    NULL, NULL, ZIO_TYPE_FREE, ZIO_PRIORITY_NOW, flags,
 	    NULL, 0, NULL, ZIO_STAGE_OPEN, ZIO_FREE_PIPELINE);
 
 	return (zio);
@@ -826,7 +824,8 @@ zio_claim(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
 
 zio_t *
 zio_ioctl(zio_t *pio, spa_t *spa, vdev_t *vd, int cmd,
-    zio_done_func_t *done, void *private, int priority, enum zio_flag flags)
+    zio_done_func_t *done, void *private, zio_priority_t priority,
+    enum zio_flag flags)
 {
 	zio_t *zio;
 	int c;
@@ -848,10 +847,54 @@ zio_ioctl(zio_t *pio, spa_t *spa, vdev_t *vd, int cmd,
 	return (zio);
 }
 
+/*
+ * Discard [offset, offset + size) of vd's allocatable space on every leaf
+ * beneath it.  Mirror children share the parent's address space, while
+ * RAID-Z stripes it over its children, so each child gets the part of the
+ * range that lands on it.  The leaf zios carry the range in io_offset and
+ * io_size without a buffer, so they are not bound by SPA_MAXBLOCKSIZE.
+ */
+zio_t *
+zio_trim(zio_t *pio, spa_t *spa, vdev_t *vd, uint64_t offset, uint64_t size,
+    zio_done_func_t *done, void *private, enum zio_flag flags)
+{
+	zio_t *zio;
+	uint64_t c;
+
+	if (vd->vdev_children == 0) {
+		if (vd->vdev_notrim)
+			return (zio_null(pio, spa, NULL, NULL, NULL, flags));
+
+		zio = zio_create(pio, spa, 0, NULL, NULL, 0, done, private,
+		    ZIO_TYPE_IOCTL, ZIO_PRIORITY_NOW, flags, vd,
+		    offset + VDEV_LABEL_START_SIZE, NULL,
+		    ZIO_STAGE_OPEN, ZIO_IOCTL_PIPELINE);
+
+		zio->io_cmd = DKIOCFREE;
+		zio->io_size = size;
+	} else {
+		zio = zio_null(pio, spa, NULL, NULL, NULL, flags);
+
+		for (c = 0; c < vd->vdev_children; c++) {
+			uint64_t start = offset;
+			uint64_t end = offset + size;
+
+			if (vd->vdev_ops == &vdev_raidz_ops)
+				vdev_raidz_child_range(vd, c, &start, &end);
+
+			if (end > start)
+				zio_nowait(zio_trim(zio, spa, vd->vdev_child[c],
+				    start, end - start, done, private, flags));
+		}
+	}
+
+	return (zio);
+}
+
 zio_t *
 zio_read_phys(zio_t *pio, vdev_t *vd, uint64_t offset, uint64_t size,
-    void *data, int checksum, zio_done_func_t *done, void *private,
-    int priority, enum zio_flag flags, boolean_t labels)
+    abd_t *data, int checksum, zio_done_func_t *done, void *private,
+    zio_priority_t priority, enum zio_flag flags, boolean_t labels)
 {
 	zio_t *zio;
 
@@ -871,8 +914,8 @@ zio_read_phys(zio_t *pio, vdev_t *vd, uint64_t offset, uint64_t size,
 
 zio_t *
 zio_write_phys(zio_t *pio, vdev_t *vd, uint64_t offset, uint64_t size,
-    void *data, int checksum, zio_done_func_t *done, void *private,
-    int priority, enum zio_flag flags, boolean_t labels)
+    abd_t *data, int checksum, zio_done_func_t *done, void *private,
+    zio_priority_t priority, enum zio_flag flags, boolean_t labels)
 {
 	zio_t *zio;
 
@@ -894,8 +937,8 @@ zio_write_phys(zio_t *pio, vdev_t *vd, uint64_t offset, uint64_t size,
 		 * Therefore, we must make a local copy in case the data is
 		 * being written to multiple places in parallel.
 		 */
-		void *wbuf = zio_buf_alloc(size);
-		bcopy(data, wbuf, size);
+		abd_t *wbuf = abd_alloc_sametype(data, size);
+		abd_copy(wbuf, data, size);
 		zio_push_transform(zio, wbuf, size, size, NULL);
 	}
 
@@ -907,8 +950,8 @@ zio_write_phys(zio_t *pio, vdev_t *vd, uint64_t offset, uint64_t size,
  */
 zio_t *
 zio_vdev_child_io(zio_t *pio, blkptr_t *bp, vdev_t *vd, uint64_t offset,
-	void *data, uint64_t size, int type, int priority, enum zio_flag flags,
-	zio_done_func_t *done, void *private)
+	abd_t *data, uint64_t size, int type, zio_priority_t priority,
+	enum zio_flag flags, zio_done_func_t *done, void *private)
 {
 	enum zio_stage pipeline = ZIO_VDEV_CHILD_PIPELINE;
 	zio_t *zio;
@@ -947,8 +990,8 @@ zio_vdev_child_io(zio_t *pio, blkptr_t *bp, vdev_t *vd, uint64_t offset,
 }
 
 zio_t *
-zio_vdev_delegated_io(vdev_t *vd, uint64_t offset, void *data, uint64_t size,
-	int type, int priority, enum zio_flag flags,
+zio_vdev_delegated_io(vdev_t *vd, uint64_t offset, abd_t *data,
+	uint64_t size, int type, zio_priority_t priority, enum zio_flag flags,
 	zio_done_func_t *done, void *private)
 {
 	zio_t *zio;
@@ -1004,7 +1047,7 @@ zio_read_bp_init(zio_t *zio)
 	    zio->io_child_type == ZIO_CHILD_LOGICAL &&
 	    !(zio->io_flags & ZIO_FLAG_RAW)) {
 		uint64_t psize = BP_GET_PSIZE(bp);
-		void *cbuf = zio_buf_alloc(psize);
+		abd_t *cbuf = abd_alloc_for_io(psize, B_TRUE);
 
 		zio_push_transform(zio, cbuf, psize, psize, zio_decompress);
 	}
@@ -1093,13 +1136,16 @@ zio_write_bp_init(zio_t *zio)
 
 	if (compress != ZIO_COMPRESS_OFF) {
 		void *cbuf = zio_buf_alloc(lsize);
-		psize = zio_compress_data(compress, zio->io_data, cbuf, lsize);
+		psize = zio_compress_data(compress, zio->io_abd, cbuf, lsize);
 		if (psize == 0 || psize == lsize) {
 			compress = ZIO_COMPRESS_OFF;
 			zio_buf_free(cbuf, lsize);
 		} else {
+			abd_t *cdata = abd_get_from_buf(cbuf, lsize);
+
+			abd_take_ownership_of_buf(cdata, B_TRUE);
 			ASSERT(psize < lsize);
-			zio_push_transform(zio, cbuf, psize, lsize, NULL);
+			zio_push_transform(zio, cdata, psize, lsize, NULL);
 		}
 	}
 
@@ -1163,6 +1209,24 @@ zio_free_bp_init(zio_t *zio)
  * ==========================================================================
  */
 
+static void zio_checksum_batch_task_done(spa_t *spa);
+
+/*
+ * Writes queued on the write issue taskq are counted in
+ * spa_write_issue_queued until a thread picks them up, which tells
+ * zio_checksum_generate() whether more writes are on their way.
+ */
+static void
+zio_write_issue_execute(void *arg)
+{
+	zio_t *zio = arg;
+	spa_t *spa = zio->io_spa;
+
+	atomic_dec_64(&spa->spa_write_issue_queued);
+	zio_execute(zio);
+	zio_checksum_batch_task_done(spa);
+}
+
 static void
 zio_taskq_dispatch(zio_t *zio, zio_taskq_type_t q, boolean_t cutinline)
 {
@@ -1200,6 +1264,12 @@ zio_taskq_dispatch(zio_t *zio, zio_taskq_type_t q, boolean_t cutinline)
 	 * to dispatch the zio to another taskq at the same time.
 	 */
 	ASSERT(taskq_empty_ent(&zio->io_tqent));
+	if (t == ZIO_TYPE_WRITE && q == ZIO_TASKQ_ISSUE) {
+		atomic_inc_64(&spa->spa_write_issue_queued);
+		spa_taskq_dispatch_ent(spa, t, q, zio_write_issue_execute, zio,
+		    flags, &zio->io_tqent);
+		return;
+	}
 	spa_taskq_dispatch_ent(spa, t, q, (task_func_t *)zio_execute, zio,
 	    flags, &zio->io_tqent);
 }
@@ -1252,6 +1322,277 @@ zio_interrupt(zio_t *zio)
  */
 static zio_pipe_stage_t *zio_pipeline[];
 
+/*
+ * ==========================================================================
+ * Stage latency tracing
+ * ==========================================================================
+ */
+
+/*
+ * A traced zio charges the time from entering a stage until it moves on
+ * to the next one to that stage, including any time spent parked waiting
+ * for children, a taskq thread or the device.  When the zio completes the
+ * stage times are added to log2 histograms (in ns) kept for each zio type
+ * and exported as the named kstats zfs:0:zio_stages-<type>.  The stage
+ * breakdowns of the slowest zios seen are kept in zfs:0:zio_slow, which
+ * is cleared by writing to it.
+ */
+#define	ZIO_TRACE_HISTO_BUCKETS	VDEV_L_HISTO_BUCKETS
+
+static const char *zio_stage_name[ZIO_STAGES] = {
+	"open", "read_bp_init", "free_bp_init", "issue_async",
+	"write_bp_init", "checksum_generate", "ddt_read_start",
+	"ddt_read_done", "ddt_write", "ddt_free", "gang_assemble",
+	"gang_issue", "dva_allocate", "dva_free", "dva_claim", "ready",
+	"vdev_io_start", "vdev_io_done", "vdev_io_assess",
+	"checksum_verify", "done"
+};
+
+static const char *zio_trace_type_name[ZIO_TYPES] = {
+	"null", "read", "write", "free", "claim", "ioctl"
+};
+
+typedef struct zio_trace_rec {
+	hrtime_t	ztr_total;
+	zio_type_t	ztr_type;
+	uint64_t	ztr_size;
+	zbookmark_t	ztr_bookmark;
+	hrtime_t	ztr_ns[ZIO_STAGES];
+} zio_trace_rec_t;
+
+#define	ZIO_TRACE_REC_NDATA	(7 + ZIO_STAGES)
+
+static uint64_t
+    zio_trace_histo[ZIO_TYPES][ZIO_STAGES][ZIO_TRACE_HISTO_BUCKETS];
+static kstat_t *zio_trace_histo_ksp[ZIO_TYPES];
+
+static kmutex_t zio_trace_slow_lock;
+static zio_trace_rec_t *zio_trace_slow;
+static int zio_trace_slow_nrecs;
+static int zio_trace_slow_minidx;	/* fastest of the slow zios */
+static hrtime_t zio_trace_slow_min;
+static kstat_t *zio_trace_slow_ksp;
+
+static void
+zio_trace_stage(zio_t *zio, enum zio_stage stage)
+{
+	zio_trace_t *zt = zio->io_trace;
+	hrtime_t now = gethrtime();
+
+	zt->zt_ns[highbit(zt->zt_stage) - 1] += now - zt->zt_last;
+	zt->zt_last = now;
+	zt->zt_stage = stage;
+	zt->zt_visited |= stage;
+}
+
+static void
+zio_trace_done(zio_t *zio)
+{
+	zio_trace_t *zt = zio->io_trace;
+	zio_trace_rec_t *ztr;
+	hrtime_t total;
+	int s, b, i;
+
+	zio_trace_stage(zio, ZIO_STAGE_DONE);
+	total = zt->zt_last - zt->zt_start;
+
+	for (s = 0; s < ZIO_STAGES; s++) {
+		hrtime_t ns = zt->zt_ns[s];
+
+		if (!(zt->zt_visited & (1 << s)))
+			continue;
+
+		if (ns >> 32)
+			b = highbit((ulong_t)(ns >> 32)) + 31;
+		else if (ns != 0)
+			b = highbit((ulong_t)ns) - 1;
+		else
+			b = 0;
+
+		atomic_inc_64(&zio_trace_histo[zio->io_type][s]
+		    [MIN(b, ZIO_TRACE_HISTO_BUCKETS - 1)]);
+	}
+
+	if (zio_trace_slow == NULL || total <= zio_trace_slow_min)
+		return;
+
+	mutex_enter(&zio_trace_slow_lock);
+	if (total > zio_trace_slow_min) {
+		ztr = &zio_trace_slow[zio_trace_slow_minidx];
+		ztr->ztr_total = total;
+		ztr->ztr_type = zio->io_type;
+		ztr->ztr_size = zio->io_size;
+		ztr->ztr_bookmark = zio->io_bookmark;
+		bcopy(zt->zt_ns, ztr->ztr_ns, sizeof (ztr->ztr_ns));
+
+		for (i = 0; i < zio_trace_slow_nrecs; i++) {
+			if (zio_trace_slow[i].ztr_total <
+			    zio_trace_slow[zio_trace_slow_minidx].ztr_total)
+				zio_trace_slow_minidx = i;
+		}
+		zio_trace_slow_min =
+		    zio_trace_slow[zio_trace_slow_minidx].ztr_total;
+	}
+	mutex_exit(&zio_trace_slow_lock);
+}
+
+static int
+zio_trace_histo_update(kstat_t *ksp, int rw)
+{
+	uint64_t *histo = ksp->ks_private;
+	kstat_named_t *ks = ksp->ks_data;
+	int i;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	for (i = 0; i < ZIO_STAGES * ZIO_TRACE_HISTO_BUCKETS; i++)
+		ks[i].value.ui64 = histo[i];
+
+	return (0);
+}
+
+static int
+zio_trace_slow_update(kstat_t *ksp, int rw)
+{
+	kstat_named_t *ks = ksp->ks_data;
+	int i, s;
+
+	mutex_enter(&zio_trace_slow_lock);
+	if (rw == KSTAT_WRITE) {
+		bzero(zio_trace_slow,
+		    zio_trace_slow_nrecs * sizeof (zio_trace_rec_t));
+		zio_trace_slow_minidx = 0;
+		zio_trace_slow_min = 0;
+		mutex_exit(&zio_trace_slow_lock);
+		return (0);
+	}
+
+	for (i = 0; i < zio_trace_slow_nrecs; i++) {
+		zio_trace_rec_t *ztr = &zio_trace_slow[i];
+
+		ks[0].value.ui64 = ztr->ztr_total;
+		ks[1].value.ui64 = ztr->ztr_type;
+		ks[2].value.ui64 = ztr->ztr_size;
+		ks[3].value.ui64 = ztr->ztr_bookmark.zb_objset;
+		ks[4].value.ui64 = ztr->ztr_bookmark.zb_object;
+		ks[5].value.ui64 = ztr->ztr_bookmark.zb_level;
+		ks[6].value.ui64 = ztr->ztr_bookmark.zb_blkid;
+		for (s = 0; s < ZIO_STAGES; s++)
+			ks[7 + s].value.ui64 = ztr->ztr_ns[s];
+		ks += ZIO_TRACE_REC_NDATA;
+	}
+	mutex_exit(&zio_trace_slow_lock);
+
+	return (0);
+}
+
+static kstat_t *
+zio_trace_kstat_create(const char *name, int ndata,
+    int (*update)(kstat_t *, int), void *private)
+{
+	kstat_t *ksp;
+
+	ksp = kstat_create("zfs", 0, (char *)name, "misc", KSTAT_TYPE_NAMED,
+	    ndata, KSTAT_FLAG_VIRTUAL | KSTAT_FLAG_WRITABLE);
+	if (ksp == NULL)
+		return (NULL);
+
+	ksp->ks_data = kmem_zalloc(ndata * sizeof (kstat_named_t), KM_SLEEP);
+	ksp->ks_data_size = ndata * sizeof (kstat_named_t);
+	ksp->ks_private = private;
+	ksp->ks_update = update;
+
+	return (ksp);
+}
+
+static void
+zio_trace_init(void)
+{
+	static const char *fields[] = { "total", "type", "size", "objset",
+	    "object", "level", "blkid" };
+	char name[KSTAT_STRLEN];
+	kstat_named_t *ks;
+	int t, s, b, i;
+
+	mutex_init(&zio_trace_slow_lock, NULL, MUTEX_DEFAULT, NULL);
+
+	for (t = 0; t < ZIO_TYPES; t++) {
+		(void) snprintf(name, KSTAT_STRLEN, "zio_stages-%s",
+		    zio_trace_type_name[t]);
+		zio_trace_histo_ksp[t] = zio_trace_kstat_create(name,
+		    ZIO_STAGES * ZIO_TRACE_HISTO_BUCKETS,
+		    zio_trace_histo_update, zio_trace_histo[t]);
+		if (zio_trace_histo_ksp[t] == NULL)
+			continue;
+
+		ks = zio_trace_histo_ksp[t]->ks_data;
+		for (s = 0; s < ZIO_STAGES; s++) {
+			for (b = 0; b < ZIO_TRACE_HISTO_BUCKETS; b++, ks++) {
+				ks->data_type = KSTAT_DATA_UINT64;
+				(void) snprintf(ks->name, KSTAT_STRLEN,
+				    "%s_%llu", zio_stage_name[s], 1ULL << b);
+			}
+		}
+		kstat_install(zio_trace_histo_ksp[t]);
+	}
+
+	if (zio_trace_slow_entries <= 0)
+		return;
+
+	zio_trace_slow_nrecs = zio_trace_slow_entries;
+	zio_trace_slow = kmem_zalloc(zio_trace_slow_nrecs *
+	    sizeof (zio_trace_rec_t), KM_SLEEP);
+
+	zio_trace_slow_ksp = zio_trace_kstat_create("zio_slow",
+	    zio_trace_slow_nrecs * ZIO_TRACE_REC_NDATA,
+	    zio_trace_slow_update, NULL);
+	if (zio_trace_slow_ksp == NULL)
+		return;
+
+	ks = zio_trace_slow_ksp->ks_data;
+	for (i = 0; i < zio_trace_slow_nrecs; i++) {
+		for (s = 0; s < ZIO_TRACE_REC_NDATA; s++, ks++) {
+			ks->data_type = KSTAT_DATA_UINT64;
+			(void) snprintf(ks->name, KSTAT_STRLEN, "%d_%s", i,
+			    s < 7 ? fields[s] : zio_stage_name[s - 7]);
+		}
+	}
+	kstat_install(zio_trace_slow_ksp);
+}
+
+static void
+zio_trace_kstat_destroy(kstat_t *ksp)
+{
+	if (ksp == NULL)
+		return;
+
+	kmem_free(ksp->ks_data, ksp->ks_data_size);
+	kstat_delete(ksp);
+}
+
+static void
+zio_trace_fini(void)
+{
+	int t;
+
+	for (t = 0; t < ZIO_TYPES; t++) {
+		zio_trace_kstat_destroy(zio_trace_histo_ksp[t]);
+		zio_trace_histo_ksp[t] = NULL;
+	}
+
+	zio_trace_kstat_destroy(zio_trace_slow_ksp);
+	zio_trace_slow_ksp = NULL;
+
+	if (zio_trace_slow != NULL) {
+		kmem_free(zio_trace_slow,
+		    zio_trace_slow_nrecs * sizeof (zio_trace_rec_t));
+		zio_trace_slow = NULL;
+	}
+
+	mutex_destroy(&zio_trace_slow_lock);
+}
+
 /*
  * zio_execute() is a wrapper around the static function
  * __zio_execute() so that we can force  __zio_execute() to be
@@ -1325,6 +1666,9 @@ __zio_execute(zio_t *zio)
 		}
 #endif
 
+		if (zio->io_trace != NULL)
+			zio_trace_stage(zio, stage);
+
 		zio->io_stage = stage;
 		rv = zio_pipeline[highbit(stage) - 1](zio);
 
@@ -1570,26 +1914,41 @@ zio_resume_wait(spa_t *spa)
  * ==========================================================================
  */
 
+/*
+ * Each gang child zio is handed its own ABD view of the gang leader's data
+ * (or of the gang header); release it once the child completes.
+ */
+static void
+zio_gang_issue_func_done(zio_t *zio)
+{
+	abd_put(zio->io_abd);
+}
+
 static zio_t *
-zio_read_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, void *data)
+zio_read_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, abd_t *data,
+    uint64_t offset)
 {
 	if (gn != NULL)
 		return (pio);
 
-	return (zio_read(pio, pio->io_spa, bp, data, BP_GET_PSIZE(bp),
-	    NULL, NULL, pio->io_priority, ZIO_GANG_CHILD_FLAGS(pio),
-	    &pio->io_bookmark));
+	return (zio_read(pio, pio->io_spa, bp, abd_get_offset(data, offset),
+	    BP_GET_PSIZE(bp), zio_gang_issue_func_done, NULL,
+	    pio->io_priority, ZIO_GANG_CHILD_FLAGS(pio), &pio->io_bookmark));
 }
 
 zio_t *
-zio_rewrite_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, void *data)
+zio_rewrite_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, abd_t *data,
+    uint64_t offset)
 {
 	zio_t *zio;
 
 	if (gn != NULL) {
+		abd_t *gbh_abd =
+		    abd_get_from_buf(gn->gn_gbh, SPA_GANGBLOCKSIZE);
 		zio = zio_rewrite(pio, pio->io_spa, pio->io_txg, bp,
-		    gn->gn_gbh, SPA_GANGBLOCKSIZE, NULL, NULL, pio->io_priority,
-		    ZIO_GANG_CHILD_FLAGS(pio), &pio->io_bookmark);
+		    gbh_abd, SPA_GANGBLOCKSIZE, zio_gang_issue_func_done, NULL,
+		    pio->io_priority, ZIO_GANG_CHILD_FLAGS(pio),
+		    &pio->io_bookmark);
 		/*
 		 * As we rewrite each gang header, the pipeline will compute
 		 * a new gang block header checksum for it; but no one will
@@ -1600,8 +1959,12 @@ zio_rewrite_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, void *data)
 		 * this is just good hygiene.)
 		 */
 		if (gn != pio->io_gang_leader->io_gang_tree) {
+			abd_t *buf = abd_get_offset(data, offset);
+
 			zio_checksum_compute(zio, BP_GET_CHECKSUM(bp),
-			    data, BP_GET_PSIZE(bp));
+			    buf, BP_GET_PSIZE(bp));
+
+			abd_put(buf);
 		}
 		/*
 		 * If we are here to damage data for testing purposes,
@@ -1611,7 +1974,8 @@ zio_rewrite_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, void *data)
 			zio->io_pipeline &= ~ZIO_VDEV_IO_STAGES;
 	} else {
 		zio = zio_rewrite(pio, pio->io_spa, pio->io_txg, bp,
-		    data, BP_GET_PSIZE(bp), NULL, NULL, pio->io_priority,
+		    abd_get_offset(data, offset), BP_GET_PSIZE(bp),
+		    zio_gang_issue_func_done, NULL, pio->io_priority,
 		    ZIO_GANG_CHILD_FLAGS(pio), &pio->io_bookmark);
 	}
 
@@ -1620,7 +1984,8 @@ zio_rewrite_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, void *data)
 
 /* ARGSUSED */
 zio_t *
-zio_free_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, void *data)
+zio_free_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, abd_t *data,
+    uint64_t offset)
 {
 	return (zio_free_sync(pio, pio->io_spa, pio->io_txg, bp,
 	    ZIO_GANG_CHILD_FLAGS(pio)));
@@ -1628,7 +1993,8 @@ zio_free_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, void *data)
 
 /* ARGSUSED */
 zio_t *
-zio_claim_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, void *data)
+zio_claim_gang(zio_t *pio, blkptr_t *bp, zio_gang_node_t *gn, abd_t *data,
+    uint64_t offset)
 {
 	return (zio_claim(pio, pio->io_spa, pio->io_txg, bp,
 	    NULL, NULL, ZIO_GANG_CHILD_FLAGS(pio)));
@@ -1696,7 +2062,8 @@ zio_gang_tree_assemble(zio_t *gio, blkptr_t *bp, zio_gang_node_t **gnpp)
 	ASSERT(gio->io_gang_leader == gio);
 	ASSERT(BP_IS_GANG(bp));
 
-	zio_nowait(zio_read(gio, gio->io_spa, bp, gn->gn_gbh,
+	zio_nowait(zio_read(gio, gio->io_spa, bp,
+	    abd_get_from_buf(gn->gn_gbh, SPA_GANGBLOCKSIZE),
 	    SPA_GANGBLOCKSIZE, zio_gang_tree_assemble_done, gn,
 	    gio->io_priority, ZIO_GANG_CHILD_FLAGS(gio), &gio->io_bookmark));
 }
@@ -1712,13 +2079,18 @@ zio_gang_tree_assemble_done(zio_t *zio)
 	ASSERT(gio == zio_unique_parent(zio));
 	ASSERT(zio->io_child_count == 0);
 
-	if (zio->io_error)
+	if (zio->io_error) {
+		abd_put(zio->io_abd);
 		return;
+	}
+
+	ASSERT3P(abd_to_buf(zio->io_abd), ==, gn->gn_gbh);
 
 	if (BP_SHOULD_BYTESWAP(bp))
-		byteswap_uint64_array(zio->io_data, zio->io_size);
+		byteswap_uint64_array(gn->gn_gbh, zio->io_size);
+
+	abd_put(zio->io_abd);
 
-	ASSERT(zio->io_data == gn->gn_gbh);
 	ASSERT(zio->io_size == SPA_GANGBLOCKSIZE);
 	ASSERT(gn->gn_gbh->zg_tail.zec_magic == ZEC_MAGIC);
 
@@ -1731,7 +2103,8 @@ zio_gang_tree_assemble_done(zio_t *zio)
 }
 
 static void
-zio_gang_tree_issue(zio_t *pio, zio_gang_node_t *gn, blkptr_t *bp, void *data)
+zio_gang_tree_issue(zio_t *pio, zio_gang_node_t *gn, blkptr_t *bp, abd_t *data,
+    uint64_t offset)
 {
 	zio_t *gio = pio->io_gang_leader;
 	zio_t *zio;
@@ -1745,7 +2118,7 @@ zio_gang_tree_issue(zio_t *pio, zio_gang_node_t *gn, blkptr_t *bp, void *data)
 	 * If you're a gang header, your data is in gn->gn_gbh.
 	 * If you're a gang member, your data is in 'data' and gn == NULL.
 	 */
-	zio = zio_gang_issue_func[gio->io_type](pio, bp, gn, data);
+	zio = zio_gang_issue_func[gio->io_type](pio, bp, gn, data, offset);
 
 	if (gn != NULL) {
 		ASSERT(gn->gn_gbh->zg_tail.zec_magic == ZEC_MAGIC);
@@ -1754,13 +2127,14 @@ zio_gang_tree_issue(zio_t *pio, zio_gang_node_t *gn, blkptr_t *bp, void *data)
 			blkptr_t *gbp = &gn->gn_gbh->zg_blkptr[g];
 			if (BP_IS_HOLE(gbp))
 				continue;
-			zio_gang_tree_issue(zio, gn->gn_child[g], gbp, data);
-			data = (char *)data + BP_GET_PSIZE(gbp);
+			zio_gang_tree_issue(zio, gn->gn_child[g], gbp, data,
+			    offset);
+			offset += BP_GET_PSIZE(gbp);
 		}
 	}
 
 	if (gn == gio->io_gang_tree)
-		ASSERT3P((char *)gio->io_data + gio->io_size, ==, data);
+		ASSERT3U(gio->io_size, ==, offset);
 
 	if (zio != pio)
 		zio_nowait(zio);
@@ -1793,7 +2167,8 @@ zio_gang_issue(zio_t *zio)
 	ASSERT(zio->io_child_type > ZIO_CHILD_GANG);
 
 	if (zio->io_child_error[ZIO_CHILD_GANG] == 0)
-		zio_gang_tree_issue(zio, zio->io_gang_tree, bp, zio->io_data);
+		zio_gang_tree_issue(zio, zio->io_gang_tree, bp, zio->io_abd,
+		    0);
 	else
 		zio_gang_tree_free(&zio->io_gang_tree);
 
@@ -1872,8 +2247,10 @@ zio_write_gang_block(zio_t *pio)
 	/*
 	 * Create the gang header.
 	 */
-	zio = zio_rewrite(pio, spa, txg, bp, gbh, SPA_GANGBLOCKSIZE, NULL, NULL,
-	    pio->io_priority, ZIO_GANG_CHILD_FLAGS(pio), &pio->io_bookmark);
+	zio = zio_rewrite(pio, spa, txg, bp,
+	    abd_get_from_buf(gbh, SPA_GANGBLOCKSIZE), SPA_GANGBLOCKSIZE,
+	    zio_gang_issue_func_done, NULL, pio->io_priority,
+	    ZIO_GANG_CHILD_FLAGS(pio), &pio->io_bookmark);
 
 	/*
 	 * Create and nowait the gang children.
@@ -1892,8 +2269,9 @@ zio_write_gang_block(zio_t *pio)
 		zp.zp_dedup_verify = 0;
 
 		zio_nowait(zio_write(zio, spa, txg, &gbh->zg_blkptr[g],
-		    (char *)pio->io_data + (pio->io_size - resid), lsize, &zp,
-		    zio_write_gang_member_ready, NULL, &gn->gn_child[g],
+		    abd_get_offset_size(pio->io_abd, pio->io_size - resid,
+		    lsize), lsize, &zp, zio_write_gang_member_ready,
+		    zio_gang_issue_func_done, &gn->gn_child[g],
 		    pio->io_priority, ZIO_GANG_CHILD_FLAGS(pio),
 		    &pio->io_bookmark));
 	}
@@ -1930,10 +2308,10 @@ zio_ddt_child_read_done(zio_t *zio)
 	ddp = ddt_phys_select(dde, bp);
 	if (zio->io_error == 0)
 		ddt_phys_clear(ddp);	/* this ddp doesn't need repair */
-	if (zio->io_error == 0 && dde->dde_repair_data == NULL)
-		dde->dde_repair_data = zio->io_data;
+	if (zio->io_error == 0 && dde->dde_repair_abd == NULL)
+		dde->dde_repair_abd = zio->io_abd;
 	else
-		zio_buf_free(zio->io_data, zio->io_size);
+		abd_free(zio->io_abd);
 	mutex_exit(&pio->io_lock);
 }
 
@@ -1966,8 +2344,8 @@ zio_ddt_read_start(zio_t *zio)
 			ddt_bp_create(ddt->ddt_checksum, &dde->dde_key, ddp,
 			    &blk);
 			zio_nowait(zio_read(zio, zio->io_spa, &blk,
-			    zio_buf_alloc(zio->io_size), zio->io_size,
-			    zio_ddt_child_read_done, dde, zio->io_priority,
+			    abd_alloc_for_io(zio->io_size, B_TRUE),
+			    zio->io_size, zio_ddt_child_read_done, dde, zio->io_priority,
 			    ZIO_DDT_CHILD_FLAGS(zio) | ZIO_FLAG_DONT_PROPAGATE,
 			    &zio->io_bookmark));
 		}
@@ -1975,7 +2353,7 @@ zio_ddt_read_start(zio_t *zio)
 	}
 
 	zio_nowait(zio_read(zio, zio->io_spa, bp,
-	    zio->io_data, zio->io_size, NULL, NULL, zio->io_priority,
+	    zio->io_abd, zio->io_size, NULL, NULL, zio->io_priority,
 	    ZIO_DDT_CHILD_FLAGS(zio), &zio->io_bookmark));
 
 	return (ZIO_PIPELINE_CONTINUE);
@@ -2005,8 +2383,9 @@ zio_ddt_read_done(zio_t *zio)
 			zio_taskq_dispatch(zio, ZIO_TASKQ_ISSUE, B_FALSE);
 			return (ZIO_PIPELINE_STOP);
 		}
-		if (dde->dde_repair_data != NULL) {
-			bcopy(dde->dde_repair_data, zio->io_data, zio->io_size);
+		if (dde->dde_repair_abd != NULL) {
+			abd_copy(zio->io_abd, dde->dde_repair_abd,
+			    zio->io_size);
 			zio->io_child_error[ZIO_CHILD_DDT] = 0;
 		}
 		ddt_repair_done(ddt, dde);
@@ -2035,7 +2414,7 @@ zio_ddt_collision(zio_t *zio, ddt_t *ddt, ddt_entry_t *dde)
 
 		if (lio != NULL) {
 			return (lio->io_orig_size != zio->io_orig_size ||
-			    bcmp(zio->io_orig_data, lio->io_orig_data,
+			    abd_cmp(zio->io_orig_abd, lio->io_orig_abd,
 			    zio->io_orig_size) != 0);
 		}
 	}
@@ -2060,7 +2439,7 @@ zio_ddt_collision(zio_t *zio, ddt_t *ddt, ddt_entry_t *dde)
 
 			if (error == 0) {
 				if (arc_buf_size(abuf) != zio->io_orig_size ||
-				    bcmp(abuf->b_data, zio->io_orig_data,
+				    abd_cmp_buf(zio->io_orig_abd, abuf->b_data,
 				    zio->io_orig_size) != 0)
 					error = EEXIST;
 				VERIFY(arc_buf_remove_ref(abuf, &abuf));
@@ -2220,12 +2599,12 @@ zio_ddt_write(zio_t *zio)
 			return (ZIO_PIPELINE_CONTINUE);
 		}
 
-		dio = zio_write(zio, spa, txg, bp, zio->io_orig_data,
+		dio = zio_write(zio, spa, txg, bp, zio->io_orig_abd,
 		    zio->io_orig_size, &czp, NULL,
 		    zio_ddt_ditto_write_done, dde, zio->io_priority,
 		    ZIO_DDT_CHILD_FLAGS(zio), &zio->io_bookmark);
 
-		zio_push_transform(dio, zio->io_data, zio->io_size, 0, NULL);
+		zio_push_transform(dio, zio->io_abd, zio->io_size, 0, NULL);
 		dde->dde_lead_zio[DDT_PHYS_DITTO] = dio;
 	}
 
@@ -2242,12 +2621,12 @@ zio_ddt_write(zio_t *zio)
 		ddt_phys_fill(ddp, bp);
 		ddt_phys_addref(ddp);
 	} else {
-		cio = zio_write(zio, spa, txg, bp, zio->io_orig_data,
+		cio = zio_write(zio, spa, txg, bp, zio->io_orig_abd,
 		    zio->io_orig_size, zp, zio_ddt_child_write_ready,
 		    zio_ddt_child_write_done, dde, zio->io_priority,
 		    ZIO_DDT_CHILD_FLAGS(zio), &zio->io_bookmark);
 
-		zio_push_transform(cio, zio->io_data, zio->io_size, 0, NULL);
+		zio_push_transform(cio, zio->io_abd, zio->io_size, 0, NULL);
 		dde->dde_lead_zio[p] = cio;
 	}
 
@@ -2321,8 +2700,12 @@ zio_dva_allocate(zio_t *zio)
 	flags |= (zio->io_flags & ZIO_FLAG_GANG_CHILD) ?
 	    METASLAB_GANG_CHILD : 0;
 	flags |= (zio->io_flags & ZIO_FLAG_FASTWRITE) ? METASLAB_FASTWRITE : 0;
+	flags |= (zio->io_priority == ZIO_PRIORITY_ASYNC_WRITE) ?
+	    METASLAB_ASYNC_ALLOC : 0;
 	error = metaslab_alloc(spa, mc, zio->io_size, bp,
 	    zio->io_prop.zp_copies, zio->io_txg, NULL, flags);
+	if (error == 0 && (flags & METASLAB_ASYNC_ALLOC))
+		zio->io_flags |= ZIO_FLAG_IO_ALLOCATING;
 
 	if (error) {
 		spa_dbgmsg(spa, "%s: metaslab allocation failure: zio %p, "
@@ -2485,11 +2868,12 @@ zio_vdev_io_start(zio_t *zio)
 
 	if (P2PHASE(zio->io_size, align) != 0) {
 		uint64_t asize = P2ROUNDUP(zio->io_size, align);
-		char *abuf = zio_buf_alloc(asize);
+		abd_t *abuf = abd_alloc_sametype(zio->io_abd, asize);
 		ASSERT(vd == vd->vdev_top);
 		if (zio->io_type == ZIO_TYPE_WRITE) {
-			bcopy(zio->io_data, abuf, zio->io_size);
-			bzero(abuf + zio->io_size, asize - zio->io_size);
+			abd_copy(abuf, zio->io_abd, zio->io_size);
+			abd_zero_off(abuf, zio->io_size,
+			    asize - zio->io_size);
 		}
 		zio_push_transform(zio, abuf, asize, asize, zio_subblock);
 	}
@@ -2551,6 +2935,16 @@ zio_vdev_io_done(zio_t *zio)
 
 	ASSERT(zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE);
 
+	/*
+	 * All copies of a newly allocated block have been written, release
+	 * its slots in the allocation throttle.
+	 */
+	if (zio->io_flags & ZIO_FLAG_IO_ALLOCATING) {
+		ASSERT(vd == NULL);
+		metaslab_alloc_throttle_done(zio->io_spa, zio->io_bp);
+		zio->io_flags &= ~ZIO_FLAG_IO_ALLOCATING;
+	}
+
 	if (vd != NULL && vd->vdev_ops->vdev_op_leaf) {
 
 		vdev_queue_io_done(zio);
@@ -2600,7 +2994,7 @@ zio_vsd_default_cksum_report(zio_t *zio, zio_cksum_report_t *zcr, void *ignored)
 {
 	void *buf = zio_buf_alloc(zio->io_size);
 
-	bcopy(zio->io_data, buf, zio->io_size);
+	abd_copy_to_buf(buf, zio->io_abd, zio->io_size);
 
 	zcr->zcr_cbinfo = zio->io_size;
 	zcr->zcr_cbdata = buf;
@@ -2701,6 +3095,86 @@ zio_vdev_io_bypass(zio_t *zio)
  * Generate and verify checksums
  * ==========================================================================
  */
+
+/*
+ * When multi-buffer SHA-256 is faster than hashing one buffer at a time,
+ * async writes reaching zio_checksum_generate() in a write issue thread
+ * while more writes are queued behind them are parked in spa_cksum_batch
+ * rather than hashed.  The batch is hashed once it is full, once the
+ * write issue queue runs dry, or once as many write issue tasks have
+ * finished as were queued when its first write was parked.  A steady
+ * stream of other writes therefore cannot hold a parked write back for
+ * longer than it takes to get through the queue it found.  Parked writes
+ * then resume in the issue taskq.
+ */
+static void
+zio_checksum_batch_run(zio_t **zios, int n, zio_t *self)
+{
+	int i;
+
+	zio_checksum_compute_batch(zios, n);
+
+	for (i = 0; i < n; i++) {
+		if (zios[i] != self)
+			zio_taskq_dispatch(zios[i], ZIO_TASKQ_ISSUE, B_TRUE);
+	}
+}
+
+/*
+ * Called as each write issue task finishes, including the one which
+ * parked a write, to hash the batch once its wait is over.
+ */
+static void
+zio_checksum_batch_task_done(spa_t *spa)
+{
+	zio_t *zios[ZIO_CHECKSUM_BATCH_MAX];
+	int n = 0;
+
+	if (spa->spa_cksum_batch_count == 0)
+		return;
+
+	mutex_enter(&spa->spa_cksum_batch_lock);
+	if (spa->spa_cksum_batch_count != 0 &&
+	    (--spa->spa_cksum_batch_wait == 0 ||
+	    spa->spa_write_issue_queued == 0)) {
+		n = spa->spa_cksum_batch_count;
+		bcopy(spa->spa_cksum_batch, zios, n * sizeof (zio_t *));
+		spa->spa_cksum_batch_count = 0;
+	}
+	mutex_exit(&spa->spa_cksum_batch_lock);
+
+	if (n != 0)
+		zio_checksum_batch_run(zios, n, NULL);
+}
+
+static int
+zio_checksum_batch(zio_t *zio)
+{
+	spa_t *spa = zio->io_spa;
+	zio_t *zios[ZIO_CHECKSUM_BATCH_MAX];
+	int n, width;
+
+	width = MIN(sha256_mb_width(), ZIO_CHECKSUM_BATCH_MAX);
+
+	mutex_enter(&spa->spa_cksum_batch_lock);
+	n = spa->spa_cksum_batch_count;
+	if (n == 0)
+		spa->spa_cksum_batch_wait = spa->spa_write_issue_queued + 1;
+	spa->spa_cksum_batch[n++] = zio;
+	if (n < width && spa->spa_write_issue_queued != 0) {
+		spa->spa_cksum_batch_count = n;
+		mutex_exit(&spa->spa_cksum_batch_lock);
+		return (ZIO_PIPELINE_STOP);
+	}
+	bcopy(spa->spa_cksum_batch, zios, n * sizeof (zio_t *));
+	spa->spa_cksum_batch_count = 0;
+	mutex_exit(&spa->spa_cksum_batch_lock);
+
+	zio_checksum_batch_run(zios, n, zio);
+
+	return (ZIO_PIPELINE_CONTINUE);
+}
+
 static int
 zio_checksum_generate(zio_t *zio)
 {
@@ -2725,9 +3199,15 @@ zio_checksum_generate(zio_t *zio)
 		} else {
 			checksum = BP_GET_CHECKSUM(bp);
 		}
+
+		if (checksum == ZIO_CHECKSUM_SHA256 &&
+		    zio->io_priority == ZIO_PRIORITY_ASYNC_WRITE &&
+		    sha256_mb_width() > 1 &&
+		    zio_taskq_member(zio, ZIO_TASKQ_ISSUE))
+			return (zio_checksum_batch(zio));
 	}
 
-	zio_checksum_compute(zio, checksum, zio->io_data, zio->io_size);
+	zio_checksum_compute(zio, checksum, zio->io_abd, zio->io_size);
 
 	return (ZIO_PIPELINE_CONTINUE);
 }
@@ -2849,7 +3329,7 @@ zio_ready(zio_t *zio)
 		if (BP_IS_GANG(bp)) {
 			zio->io_flags &= ~ZIO_FLAG_NODATA;
 		} else {
-			ASSERT((uintptr_t)zio->io_data < SPA_MAXBLOCKSIZE);
+			ASSERT3P(zio->io_abd, ==, NULL);
 			zio->io_pipeline &= ~ZIO_VDEV_IO_STAGES;
 		}
 	}
@@ -2881,6 +3361,15 @@ zio_done(zio_t *zio)
 		for (w = 0; w < ZIO_WAIT_TYPES; w++)
 			ASSERT(zio->io_children[c][w] == 0);
 
+	/*
+	 * The block was allocated but never written, e.g. because of an
+	 * error, so release its allocation throttle slots here.
+	 */
+	if (zio->io_flags & ZIO_FLAG_IO_ALLOCATING) {
+		metaslab_alloc_throttle_done(zio->io_spa, zio->io_bp);
+		zio->io_flags &= ~ZIO_FLAG_IO_ALLOCATING;
+	}
+
 	if (zio->io_bp != NULL) {
 		ASSERT(zio->io_bp->blk_pad[0] == 0);
 		ASSERT(zio->io_bp->blk_pad[1] == 0);
@@ -2912,12 +3401,20 @@ zio_done(zio_t *zio)
 			zio_cksum_report_t *zcr = zio->io_cksum_report;
 			uint64_t align = zcr->zcr_align;
 			uint64_t asize = P2ROUNDUP(zio->io_size, align);
-			char *abuf = zio->io_data;
+			char *abuf;
 
-			if (asize != zio->io_size) {
+			/*
+			 * A logical i/o without data of its own, such as the
+			 * claim of a gang block, has no good copy to report.
+			 */
+			if (zio->io_abd == NULL) {
+				abuf = NULL;
+			} else if (asize != zio->io_size) {
 				abuf = zio_buf_alloc(asize);
-				bcopy(zio->io_data, abuf, zio->io_size);
+				abd_copy_to_buf(abuf, zio->io_abd, zio->io_size);
 				bzero(abuf + zio->io_size, asize - zio->io_size);
+			} else {
+				abuf = abd_borrow_buf_copy(zio->io_abd, asize);
 			}
 
 			zio->io_cksum_report = zcr->zcr_next;
@@ -2925,8 +3422,12 @@ zio_done(zio_t *zio)
 			zcr->zcr_finish(zcr, abuf);
 			zfs_ereport_free_checksum(zcr);
 
+			if (abuf == NULL)
+				continue;
 			if (asize != zio->io_size)
 				zio_buf_free(abuf, asize);
+			else
+				abd_return_buf(zio->io_abd, abuf, asize);
 		}
 	}
 
@@ -3125,6 +3626,9 @@ zio_done(zio_t *zio)
 	if (zio->io_done)
 		zio->io_done(zio);
 
+	if (zio->io_trace != NULL)
+		zio_trace_done(zio);
+
 	mutex_enter(&zio->io_lock);
 	zio->io_state[ZIO_WAIT_DONE] = 1;
 	mutex_exit(&zio->io_lock);
@@ -3228,7 +3732,6 @@ EXPORT_SYMBOL(zio_clear_fault);
 EXPORT_SYMBOL(zio_handle_fault_injection);
 EXPORT_SYMBOL(zio_handle_device_injection);
 EXPORT_SYMBOL(zio_handle_label_injection);
-EXPORT_SYMBOL(zio_priority_table);
 EXPORT_SYMBOL(zio_type_name);
 
 module_param(zio_bulk_flags, int, 0644);
@@ -3240,6 +3743,13 @@ MODULE_PARM_DESC(zio_delay_max, "Max zio millisec delay before posting event");
 module_param(zio_requeue_io_start_cut_in_line, int, 0644);
 MODULE_PARM_DESC(zio_requeue_io_start_cut_in_line, "Prioritize requeued I/O");
 
+module_param(zio_trace_stages, int, 0644);
+MODULE_PARM_DESC(zio_trace_stages, "Time each stage of newly created zios");
+
+module_param(zio_trace_slow_entries, int, 0444);
+MODULE_PARM_DESC(zio_trace_slow_entries,
+	"Number of slowest traced zios kept in zio_slow");
+
 module_param(zfs_sync_pass_deferred_free, int, 0644);
 MODULE_PARM_DESC(zfs_sync_pass_deferred_free,
     "defer frees starting in this pass");
@@ -24,9 +24,12 @@
 
 #include <sys/zfs_context.h>
 #include <sys/spa.h>
+#include <sys/spa_impl.h>
 #include <sys/zio.h>
 #include <sys/zio_checksum.h>
 #include <sys/zil.h>
+#include <sys/sha512.h>
+#include <sys/skein.h>
 #include <zfs_fletcher.h>
 
 /*
@@ -61,22 +64,205 @@
 
 /*ARGSUSED*/
 static void
-zio_checksum_off(const void *buf, uint64_t size, zio_cksum_t *zcp)
+abd_checksum_off(abd_t *abd, uint64_t size, const void *ctx_template,
+    zio_cksum_t *zcp)
 {
 	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
 }
 
+/*
+ * The fletcher checksums are computed incrementally over each contiguous
+ * segment of the ABD, so a scattered buffer never needs to be linearized.
+ */
+static int
+abd_fletcher_2_native_cb(void *buf, size_t size, void *private)
+{
+	fletcher_2_incremental_native(buf, size, private);
+	return (0);
+}
+
+/*ARGSUSED*/
+static void
+abd_fletcher_2_native(abd_t *abd, uint64_t size, const void *ctx_template,
+    zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	(void) abd_iterate_func(abd, 0, size, abd_fletcher_2_native_cb, zcp);
+}
+
+static int
+abd_fletcher_2_byteswap_cb(void *buf, size_t size, void *private)
+{
+	fletcher_2_incremental_byteswap(buf, size, private);
+	return (0);
+}
+
+/*ARGSUSED*/
+static void
+abd_fletcher_2_byteswap(abd_t *abd, uint64_t size, const void *ctx_template,
+    zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	(void) abd_iterate_func(abd, 0, size, abd_fletcher_2_byteswap_cb, zcp);
+}
+
+static int
+abd_fletcher_4_native_cb(void *buf, size_t size, void *private)
+{
+	fletcher_4_incremental_native(buf, size, private);
+	return (0);
+}
+
+/*ARGSUSED*/
+static void
+abd_fletcher_4_native(abd_t *abd, uint64_t size, const void *ctx_template,
+    zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	(void) abd_iterate_func(abd, 0, size, abd_fletcher_4_native_cb, zcp);
+}
+
+static int
+abd_fletcher_4_byteswap_cb(void *buf, size_t size, void *private)
+{
+	fletcher_4_incremental_byteswap(buf, size, private);
+	return (0);
+}
+
+/*ARGSUSED*/
+static void
+abd_fletcher_4_byteswap(abd_t *abd, uint64_t size, const void *ctx_template,
+    zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	(void) abd_iterate_func(abd, 0, size, abd_fletcher_4_byteswap_cb, zcp);
+}
+
+/*ARGSUSED*/
+static void
+abd_checksum_SHA256(abd_t *abd, uint64_t size, const void *ctx_template,
+    zio_cksum_t *zcp)
+{
+	void *buf = abd_borrow_buf_copy(abd, size);
+
+	zio_checksum_SHA256(buf, size, zcp);
+	abd_return_buf(abd, buf, size);
+}
+
+/*
+ * SHA-512/256 and Skein are fed each contiguous segment of the ABD in turn.
+ * Their 32 byte digests are stored in the checksum as they come out of the
+ * hash, so the byteswap variants only need to swap the words afterwards.
+ */
+static int
+abd_sha512_cb(void *buf, size_t size, void *private)
+{
+	sha512_update(private, buf, size);
+	return (0);
+}
+
+/*ARGSUSED*/
+static void
+abd_checksum_SHA512_native(abd_t *abd, uint64_t size,
+    const void *ctx_template, zio_cksum_t *zcp)
+{
+	sha512_ctx_t ctx;
+
+	sha512_256_init(&ctx);
+	(void) abd_iterate_func(abd, 0, size, abd_sha512_cb, &ctx);
+	sha512_256_final(&ctx, zcp);
+}
+
+static void
+abd_checksum_SHA512_byteswap(abd_t *abd, uint64_t size,
+    const void *ctx_template, zio_cksum_t *zcp)
+{
+	zio_cksum_t tmp;
+
+	abd_checksum_SHA512_native(abd, size, ctx_template, &tmp);
+	ZIO_SET_CHECKSUM(zcp, BSWAP_64(tmp.zc_word[0]),
+	    BSWAP_64(tmp.zc_word[1]), BSWAP_64(tmp.zc_word[2]),
+	    BSWAP_64(tmp.zc_word[3]));
+}
+
+/*
+ * Skein is keyed with the pool's salt.  The context template holds the
+ * state after the key and configuration blocks, ready for the message.
+ */
+static void *
+abd_checksum_skein_tmpl_init(const zio_cksum_salt_t *salt)
+{
+	skein_ctx_t *ctx = kmem_alloc(sizeof (*ctx), KM_SLEEP);
+
+	skein_512_256_init(ctx, salt->zcs_bytes, sizeof (salt->zcs_bytes));
+	return (ctx);
+}
+
+static void
+abd_checksum_skein_tmpl_free(void *ctx_template)
+{
+	kmem_free(ctx_template, sizeof (skein_ctx_t));
+}
+
+static int
+abd_skein_cb(void *buf, size_t size, void *private)
+{
+	skein_512_update(private, buf, size);
+	return (0);
+}
+
+static void
+abd_checksum_skein_native(abd_t *abd, uint64_t size,
+    const void *ctx_template, zio_cksum_t *zcp)
+{
+	skein_ctx_t ctx;
+
+	ASSERT(ctx_template != NULL);
+	bcopy(ctx_template, &ctx, sizeof (ctx));
+	(void) abd_iterate_func(abd, 0, size, abd_skein_cb, &ctx);
+	skein_512_256_final(&ctx, zcp);
+}
+
+static void
+abd_checksum_skein_byteswap(abd_t *abd, uint64_t size,
+    const void *ctx_template, zio_cksum_t *zcp)
+{
+	zio_cksum_t tmp;
+
+	abd_checksum_skein_native(abd, size, ctx_template, &tmp);
+	ZIO_SET_CHECKSUM(zcp, BSWAP_64(tmp.zc_word[0]),
+	    BSWAP_64(tmp.zc_word[1]), BSWAP_64(tmp.zc_word[2]),
+	    BSWAP_64(tmp.zc_word[3]));
+}
+
 zio_checksum_info_t zio_checksum_table[ZIO_CHECKSUM_FUNCTIONS] = {
-	{{NULL,			NULL},			0, 0, 0, "inherit"},
-	{{NULL,			NULL},			0, 0, 0, "on"},
-	{{zio_checksum_off,	zio_checksum_off},	0, 0, 0, "off"},
-	{{zio_checksum_SHA256,	zio_checksum_SHA256},	1, 1, 0, "label"},
-	{{zio_checksum_SHA256,	zio_checksum_SHA256},	1, 1, 0, "gang_header"},
-	{{fletcher_2_native,	fletcher_2_byteswap},	0, 1, 0, "zilog"},
-	{{fletcher_2_native,	fletcher_2_byteswap},	0, 0, 0, "fletcher2"},
-	{{fletcher_4_native,	fletcher_4_byteswap},	1, 0, 0, "fletcher4"},
-	{{zio_checksum_SHA256,	zio_checksum_SHA256},	1, 0, 1, "sha256"},
-	{{fletcher_4_native,	fletcher_4_byteswap},	0, 1, 0, "zilog2"},
+	{{NULL,			NULL},
+	    NULL, NULL, 0, 0, 0, "inherit"},
+	{{NULL,			NULL},
+	    NULL, NULL, 0, 0, 0, "on"},
+	{{abd_checksum_off,	abd_checksum_off},
+	    NULL, NULL, 0, 0, 0, "off"},
+	{{abd_checksum_SHA256,	abd_checksum_SHA256},
+	    NULL, NULL, 1, 1, 0, "label"},
+	{{abd_checksum_SHA256,	abd_checksum_SHA256},
+	    NULL, NULL, 1, 1, 0, "gang_header"},
+	{{abd_fletcher_2_native, abd_fletcher_2_byteswap},
+	    NULL, NULL, 0, 1, 0, "zilog"},
+	{{abd_fletcher_2_native, abd_fletcher_2_byteswap},
+	    NULL, NULL, 0, 0, 0, "fletcher2"},
+	{{abd_fletcher_4_native, abd_fletcher_4_byteswap},
+	    NULL, NULL, 1, 0, 0, "fletcher4"},
+	{{abd_checksum_SHA256,	abd_checksum_SHA256},
+	    NULL, NULL, 1, 0, 1, "sha256"},
+	{{abd_fletcher_4_native, abd_fletcher_4_byteswap},
+	    NULL, NULL, 0, 1, 0, "zilog2"},
+	{{abd_checksum_off,	abd_checksum_off},
+	    NULL, NULL, 0, 0, 0, "noparity"},
+	{{abd_checksum_SHA512_native, abd_checksum_SHA512_byteswap},
+	    NULL, NULL, 1, 0, 1, "sha512"},
+	{{abd_checksum_skein_native, abd_checksum_skein_byteswap},
+	    abd_checksum_skein_tmpl_init, abd_checksum_skein_tmpl_free,
+	    1, 0, 1, "skein"},
 };
 
 enum zio_checksum
@@ -145,43 +331,127 @@ zio_checksum_label_verifier(zio_cksum_t *zcp, uint64_t offset)
 }
 
 /*
- * Generate the checksum.
+ * Make sure the pool has a context template for a salted checksum.  The
+ * template is built the first time the checksum is used and kept until
+ * the pool is unloaded.
+ */
+void
+zio_checksum_template_init(enum zio_checksum checksum, spa_t *spa)
+{
+	zio_checksum_info_t *ci = &zio_checksum_table[checksum];
+
+	if (ci->ci_tmpl_init == NULL)
+		return;
+	if (spa->spa_cksum_tmpls[checksum] != NULL)
+		return;
+
+	mutex_enter(&spa->spa_cksum_tmpls_lock);
+	if (spa->spa_cksum_tmpls[checksum] == NULL) {
+		spa->spa_cksum_tmpls[checksum] =
+		    ci->ci_tmpl_init(&spa->spa_cksum_salt);
+		VERIFY(spa->spa_cksum_tmpls[checksum] != NULL);
+	}
+	mutex_exit(&spa->spa_cksum_tmpls_lock);
+}
+
+void
+zio_checksum_templates_free(spa_t *spa)
+{
+	enum zio_checksum checksum;
+
+	for (checksum = 0; checksum < ZIO_CHECKSUM_FUNCTIONS; checksum++) {
+		if (spa->spa_cksum_tmpls[checksum] != NULL) {
+			zio_checksum_info_t *ci = &zio_checksum_table[checksum];
+
+			ci->ci_tmpl_free(spa->spa_cksum_tmpls[checksum]);
+			spa->spa_cksum_tmpls[checksum] = NULL;
+		}
+	}
+}
+
+/*
+ * Generate the checksum.  Embedded checksums are read and updated through
+ * a local copy of the zio_eck_t, so the data may be scattered.
  */
 void
 zio_checksum_compute(zio_t *zio, enum zio_checksum checksum,
-	void *data, uint64_t size)
+	abd_t *abd, uint64_t size)
 {
 	blkptr_t *bp = zio->io_bp;
 	uint64_t offset = zio->io_offset;
+	spa_t *spa = zio->io_spa;
 	zio_checksum_info_t *ci = &zio_checksum_table[checksum];
 	zio_cksum_t cksum;
+	void *tmpl;
 
 	ASSERT((uint_t)checksum < ZIO_CHECKSUM_FUNCTIONS);
 	ASSERT(ci->ci_func[0] != NULL);
 
+	zio_checksum_template_init(checksum, spa);
+	tmpl = spa->spa_cksum_tmpls[checksum];
+
 	if (ci->ci_eck) {
-		zio_eck_t *eck;
+		zio_eck_t eck;
+		size_t eck_offset;
 
 		if (checksum == ZIO_CHECKSUM_ZILOG2) {
-			zil_chain_t *zilc = data;
+			zil_chain_t zilc;
 
-			size = P2ROUNDUP_TYPED(zilc->zc_nused, ZIL_MIN_BLKSZ,
+			abd_copy_to_buf(&zilc, abd, sizeof (zil_chain_t));
+			size = P2ROUNDUP_TYPED(zilc.zc_nused, ZIL_MIN_BLKSZ,
 			    uint64_t);
-			eck = &zilc->zc_eck;
+			eck_offset = offsetof(zil_chain_t, zc_eck);
 		} else {
-			eck = (zio_eck_t *)((char *)data + size) - 1;
+			eck_offset = size - sizeof (zio_eck_t);
 		}
+		abd_copy_to_buf_off(&eck, abd, eck_offset, sizeof (zio_eck_t));
+
 		if (checksum == ZIO_CHECKSUM_GANG_HEADER)
-			zio_checksum_gang_verifier(&eck->zec_cksum, bp);
+			zio_checksum_gang_verifier(&eck.zec_cksum, bp);
 		else if (checksum == ZIO_CHECKSUM_LABEL)
-			zio_checksum_label_verifier(&eck->zec_cksum, offset);
+			zio_checksum_label_verifier(&eck.zec_cksum, offset);
 		else
-			bp->blk_cksum = eck->zec_cksum;
-		eck->zec_magic = ZEC_MAGIC;
-		ci->ci_func[0](data, size, &cksum);
-		eck->zec_cksum = cksum;
+			bp->blk_cksum = eck.zec_cksum;
+		eck.zec_magic = ZEC_MAGIC;
+		abd_copy_from_buf_off(abd, &eck, eck_offset, sizeof (zio_eck_t));
+
+		ci->ci_func[0](abd, size, tmpl, &cksum);
+
+		eck.zec_cksum = cksum;
+		abd_copy_from_buf_off(abd, &eck, eck_offset, sizeof (zio_eck_t));
 	} else {
-		ci->ci_func[0](data, size, &bp->blk_cksum);
+		ci->ci_func[0](abd, size, tmpl, &bp->blk_cksum);
+	}
+}
+
+/*
+ * Generate the SHA-256 block checksums of several writes at once.  Each
+ * zio must be one zio_checksum_compute() would give a plain SHA-256
+ * checksum of its whole buffer.
+ */
+void
+zio_checksum_compute_batch(zio_t **zios, int n)
+{
+	void *bufs[ZIO_CHECKSUM_BATCH_MAX];
+	uint64_t sizes[ZIO_CHECKSUM_BATCH_MAX];
+	zio_cksum_t zcps[ZIO_CHECKSUM_BATCH_MAX];
+	int i;
+
+	ASSERT3S(n, <=, ZIO_CHECKSUM_BATCH_MAX);
+
+	for (i = 0; i < n; i++) {
+		zio_t *zio = zios[i];
+
+		ASSERT3U(BP_GET_CHECKSUM(zio->io_bp), ==, ZIO_CHECKSUM_SHA256);
+		sizes[i] = zio->io_size;
+		bufs[i] = abd_borrow_buf_copy(zio->io_abd, sizes[i]);
+	}
+
+	zio_checksum_SHA256_multi(bufs, sizes, zcps, n);
+
+	for (i = 0; i < n; i++) {
+		zios[i]->io_bp->blk_cksum = zcps[i];
+		abd_return_buf(zios[i]->io_abd, bufs[i], sizes[i]);
 	}
 }
 
@@ -196,25 +466,33 @@ zio_checksum_error(zio_t *zio, zio_bad_cksum_t *info)
 	uint64_t size = (bp == NULL ? zio->io_size :
 	    (BP_IS_GANG(bp) ? SPA_GANGBLOCKSIZE : BP_GET_PSIZE(bp)));
 	uint64_t offset = zio->io_offset;
-	void *data = zio->io_data;
+	abd_t *abd = zio->io_abd;
 	zio_checksum_info_t *ci = &zio_checksum_table[checksum];
 	zio_cksum_t actual_cksum, expected_cksum, verifier;
+	void *tmpl;
 
 	if (checksum >= ZIO_CHECKSUM_FUNCTIONS || ci->ci_func[0] == NULL)
 		return (EINVAL);
 
+	zio_checksum_template_init(checksum, zio->io_spa);
+	tmpl = zio->io_spa->spa_cksum_tmpls[checksum];
+
 	if (ci->ci_eck) {
-		zio_eck_t *eck;
+		zio_eck_t eck;
+		size_t eck_offset;
 
 		if (checksum == ZIO_CHECKSUM_ZILOG2) {
-			zil_chain_t *zilc = data;
+			zil_chain_t zilc;
 			uint64_t nused;
 
-			eck = &zilc->zc_eck;
-			if (eck->zec_magic == ZEC_MAGIC)
-				nused = zilc->zc_nused;
-			else if (eck->zec_magic == BSWAP_64(ZEC_MAGIC))
-				nused = BSWAP_64(zilc->zc_nused);
+			abd_copy_to_buf(&zilc, abd, sizeof (zil_chain_t));
+
+			eck = zilc.zc_eck;
+			eck_offset = offsetof(zil_chain_t, zc_eck);
+			if (eck.zec_magic == ZEC_MAGIC)
+				nused = zilc.zc_nused;
+			else if (eck.zec_magic == BSWAP_64(ZEC_MAGIC))
+				nused = BSWAP_64(zilc.zc_nused);
 			else
 				return (ECKSUM);
 
@@ -223,7 +501,9 @@ zio_checksum_error(zio_t *zio, zio_bad_cksum_t *info)
 
 			size = P2ROUNDUP_TYPED(nused, ZIL_MIN_BLKSZ, uint64_t);
 		} else {
-			eck = (zio_eck_t *)((char *)data + size) - 1;
+			eck_offset = size - sizeof (zio_eck_t);
+			abd_copy_to_buf_off(&eck, abd, eck_offset,
+			    sizeof (zio_eck_t));
 		}
 
 		if (checksum == ZIO_CHECKSUM_GANG_HEADER)
@@ -233,15 +513,20 @@ zio_checksum_error(zio_t *zio, zio_bad_cksum_t *info)
 		else
 			verifier = bp->blk_cksum;
 
-		byteswap = (eck->zec_magic == BSWAP_64(ZEC_MAGIC));
+		byteswap = (eck.zec_magic == BSWAP_64(ZEC_MAGIC));
 
 		if (byteswap)
 			byteswap_uint64_array(&verifier, sizeof (zio_cksum_t));
 
-		expected_cksum = eck->zec_cksum;
-		eck->zec_cksum = verifier;
-		ci->ci_func[byteswap](data, size, &actual_cksum);
-		eck->zec_cksum = expected_cksum;
+		expected_cksum = eck.zec_cksum;
+
+		abd_copy_from_buf_off(abd, &verifier,
+		    eck_offset + offsetof(zio_eck_t, zec_cksum),
+		    sizeof (zio_cksum_t));
+		ci->ci_func[byteswap](abd, size, tmpl, &actual_cksum);
+		abd_copy_from_buf_off(abd, &expected_cksum,
+		    eck_offset + offsetof(zio_eck_t, zec_cksum),
+		    sizeof (zio_cksum_t));
 
 		if (byteswap)
 			byteswap_uint64_array(&expected_cksum,
@@ -250,7 +535,7 @@ zio_checksum_error(zio_t *zio, zio_bad_cksum_t *info)
 		ASSERT(!BP_IS_GANG(bp));
 		byteswap = BP_SHOULD_BYTESWAP(bp);
 		expected_cksum = bp->blk_cksum;
-		ci->ci_func[byteswap](data, size, &actual_cksum);
+		ci->ci_func[byteswap](abd, size, tmpl, &actual_cksum);
 	}
 
 	info->zbc_expected = expected_cksum;
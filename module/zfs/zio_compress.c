@@ -54,6 +54,25 @@ zio_compress_info_t zio_compress_table[ZIO_COMPRESS_FUNCTIONS] = {
 	{gzip_compress,		gzip_decompress,	9,	"gzip-9"},
 	{zle_compress,		zle_decompress,		64,	"zle"},
 	{lz4_compress,		lz4_decompress,		0,	"lz4"},
+	{zstd_compress,		zstd_decompress,	1,	"zstd-1"},
+	{zstd_compress,		zstd_decompress,	2,	"zstd-2"},
+	{zstd_compress,		zstd_decompress,	3,	"zstd-3"},
+	{zstd_compress,		zstd_decompress,	4,	"zstd-4"},
+	{zstd_compress,		zstd_decompress,	5,	"zstd-5"},
+	{zstd_compress,		zstd_decompress,	6,	"zstd-6"},
+	{zstd_compress,		zstd_decompress,	7,	"zstd-7"},
+	{zstd_compress,		zstd_decompress,	8,	"zstd-8"},
+	{zstd_compress,		zstd_decompress,	9,	"zstd-9"},
+	{zstd_compress,		zstd_decompress,	10,	"zstd-10"},
+	{zstd_compress,		zstd_decompress,	11,	"zstd-11"},
+	{zstd_compress,		zstd_decompress,	12,	"zstd-12"},
+	{zstd_compress,		zstd_decompress,	13,	"zstd-13"},
+	{zstd_compress,		zstd_decompress,	14,	"zstd-14"},
+	{zstd_compress,		zstd_decompress,	15,	"zstd-15"},
+	{zstd_compress,		zstd_decompress,	16,	"zstd-16"},
+	{zstd_compress,		zstd_decompress,	17,	"zstd-17"},
+	{zstd_compress,		zstd_decompress,	18,	"zstd-18"},
+	{zstd_compress,		zstd_decompress,	19,	"zstd-19"},
 };
 
 enum zio_compress
@@ -72,12 +91,26 @@ zio_compress_select(enum zio_compress child, enum zio_compress parent)
 	return (child);
 }
 
+/*ARGSUSED*/
+static int
+zio_compress_zeroed_cb(void *data, size_t len, void *private)
+{
+	uint64_t *end = (uint64_t *)((char *)data + len);
+	uint64_t *word;
+
+	for (word = data; word < end; word++)
+		if (*word != 0)
+			return (1);
+
+	return (0);
+}
+
 size_t
-zio_compress_data(enum zio_compress c, void *src, void *dst, size_t s_len)
+zio_compress_data(enum zio_compress c, abd_t *src, void *dst, size_t s_len)
 {
-	uint64_t *word, *word_end;
 	size_t c_len, d_len, r_len;
 	zio_compress_info_t *ci = &zio_compress_table[c];
+	void *tmp;
 
 	ASSERT((uint_t)c < ZIO_COMPRESS_FUNCTIONS);
 	ASSERT((uint_t)c == ZIO_COMPRESS_EMPTY || ci->ci_compress != NULL);
@@ -86,12 +119,7 @@ zio_compress_data(enum zio_compress c, void *src, void *dst, size_t s_len)
 	 * If the data is all zeroes, we don't even need to allocate
 	 * a block for it.  We indicate this by returning zero size.
 	 */
-	word_end = (uint64_t *)((char *)src + s_len);
-	for (word = src; word < word_end; word++)
-		if (*word != 0)
-			break;
-
-	if (word == word_end)
+	if (abd_iterate_func(src, 0, s_len, zio_compress_zeroed_cb, NULL) == 0)
 		return (0);
 
 	if (c == ZIO_COMPRESS_EMPTY)
@@ -102,7 +130,10 @@ zio_compress_data(enum zio_compress c, void *src, void *dst, size_t s_len)
 	if (d_len == 0)
 		return (s_len);
 
-	c_len = ci->ci_compress(src, dst, s_len, d_len, ci->ci_level);
+	/* No compression algorithms can read from ABDs directly */
+	tmp = abd_borrow_buf_copy(src, s_len);
+	c_len = ci->ci_compress(tmp, dst, s_len, d_len, ci->ci_level);
+	abd_return_buf(src, tmp, s_len);
 
 	if (c_len > d_len)
 		return (s_len);
@@ -124,7 +155,7 @@ zio_compress_data(enum zio_compress c, void *src, void *dst, size_t s_len)
 }
 
 int
-zio_decompress_data(enum zio_compress c, void *src, void *dst,
+zio_decompress_data_buf(enum zio_compress c, void *src, void *dst,
     size_t s_len, size_t d_len)
 {
 	zio_compress_info_t *ci = &zio_compress_table[c];
@@ -134,3 +165,14 @@ zio_decompress_data(enum zio_compress c, void *src, void *dst,
 
 	return (ci->ci_decompress(src, dst, s_len, d_len, ci->ci_level));
 }
+
+int
+zio_decompress_data(enum zio_compress c, abd_t *src, void *dst,
+    size_t s_len, size_t d_len)
+{
+	void *tmp = abd_borrow_buf_copy(src, s_len);
+	int ret = zio_decompress_data_buf(c, tmp, dst, s_len, d_len);
+	abd_return_buf(src, tmp, s_len);
+
+	return (ret);
+}
@@ -0,0 +1,260 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Zstandard compression.
+ *
+ * Every zstd level has its own compress value in the block pointer, as
+ * gzip levels do, so the level a block was written with is always known.
+ * The library never allocates memory itself.  It works in workspaces
+ * taken from one kmem cache per level, each big enough for any block size
+ * at that level, and from a cache of decompression contexts.
+ *
+ * The "zstdstats" kstat reports, per level, how many bytes went through
+ * the compressor and decompressor and at what rate, which is what one
+ * needs to pick a level for a dataset.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/zio.h>
+#include <sys/zio_compress.h>
+
+#define	ZSTD_STATIC_LINKING_ONLY
+#include "zstd/zstd.h"
+
+#define	ZSTD_LEVELS	(ZIO_COMPRESS_ZSTD_19 - ZIO_COMPRESS_ZSTD_1 + 1)
+
+typedef struct zstd_level_stats {
+	uint64_t	zls_compress_bytes;	/* uncompressed bytes in */
+	uint64_t	zls_compressed_bytes;	/* bytes out, if it shrank */
+	uint64_t	zls_compress_time;	/* nanoseconds */
+	uint64_t	zls_decompress_bytes;	/* decompressed bytes out */
+	uint64_t	zls_decompress_time;	/* nanoseconds */
+} zstd_level_stats_t;
+
+static const char *zstd_stat_names[] = {
+	"compress_bytes", "compressed_bytes", "compress_time",
+	"compress_MBps", "decompress_bytes", "decompress_time",
+	"decompress_MBps"
+};
+
+#define	ZSTD_STAT_NDATA	\
+	(sizeof (zstd_stat_names) / sizeof (zstd_stat_names[0]))
+
+static kmem_cache_t *zstd_cctx_cache[ZSTD_LEVELS];
+static size_t zstd_cctx_size[ZSTD_LEVELS];
+static kmem_cache_t *zstd_dctx_cache;
+static size_t zstd_dctx_size;
+
+static zstd_level_stats_t zstd_stats[ZSTD_LEVELS];
+static kstat_t *zstd_ksp;
+
+size_t
+zstd_compress(void *s_start, void *d_start, size_t s_len, size_t d_len, int n)
+{
+	zstd_level_stats_t *zls = &zstd_stats[n - 1];
+	ZSTD_CCtx *cctx;
+	void *ws;
+	size_t c_len;
+	hrtime_t start;
+
+	ASSERT3S(n, >=, 1);
+	ASSERT3S(n, <=, ZSTD_LEVELS);
+
+	ws = kmem_cache_alloc(zstd_cctx_cache[n - 1], KM_PUSHPAGE);
+	cctx = ZSTD_initStaticCCtx(ws, zstd_cctx_size[n - 1]);
+	ASSERT(cctx != NULL);
+
+	start = gethrtime();
+	c_len = ZSTD_compressCCtx(cctx, d_start, d_len, s_start, s_len, n);
+	atomic_add_64(&zls->zls_compress_time, gethrtime() - start);
+	atomic_add_64(&zls->zls_compress_bytes, s_len);
+
+	kmem_cache_free(zstd_cctx_cache[n - 1], ws);
+
+	if (ZSTD_isError(c_len)) {
+		if (d_len != s_len)
+			return (s_len);
+
+		bcopy(s_start, d_start, s_len);
+		return (s_len);
+	}
+
+	atomic_add_64(&zls->zls_compressed_bytes, c_len);
+	return (c_len);
+}
+
+int
+zstd_decompress(void *s_start, void *d_start, size_t s_len, size_t d_len,
+    int n)
+{
+	zstd_level_stats_t *zls = &zstd_stats[n - 1];
+	ZSTD_DCtx *dctx;
+	void *ws;
+	size_t f_len, r_len;
+	hrtime_t start;
+
+	ASSERT3S(n, >=, 1);
+	ASSERT3S(n, <=, ZSTD_LEVELS);
+
+	/*
+	 * The compressed frame is followed by the zeroes that pad the block
+	 * out to a whole sector, which the decoder must not see.
+	 */
+	f_len = ZSTD_findFrameCompressedSize(s_start, s_len);
+	if (ZSTD_isError(f_len))
+		return (-1);
+
+	ws = kmem_cache_alloc(zstd_dctx_cache, KM_PUSHPAGE);
+	dctx = ZSTD_initStaticDCtx(ws, zstd_dctx_size);
+	ASSERT(dctx != NULL);
+
+	start = gethrtime();
+	r_len = ZSTD_decompressDCtx(dctx, d_start, d_len, s_start, f_len);
+	atomic_add_64(&zls->zls_decompress_time, gethrtime() - start);
+
+	kmem_cache_free(zstd_dctx_cache, ws);
+
+	if (ZSTD_isError(r_len))
+		return (-1);
+
+	atomic_add_64(&zls->zls_decompress_bytes, r_len);
+	return (0);
+}
+
+static uint64_t
+zstd_rate(uint64_t bytes, uint64_t ns)
+{
+	return (ns == 0 ? 0 : (bytes >> 20) * NANOSEC / ns);
+}
+
+static int
+zstd_kstat_update(kstat_t *ksp, int rw)
+{
+	kstat_named_t *ks = ksp->ks_data;
+	int i;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	for (i = 0; i < ZSTD_LEVELS; i++) {
+		zstd_level_stats_t *zls = &zstd_stats[i];
+
+		ks[0].value.ui64 = zls->zls_compress_bytes;
+		ks[1].value.ui64 = zls->zls_compressed_bytes;
+		ks[2].value.ui64 = zls->zls_compress_time;
+		ks[3].value.ui64 = zstd_rate(zls->zls_compress_bytes,
+		    zls->zls_compress_time);
+		ks[4].value.ui64 = zls->zls_decompress_bytes;
+		ks[5].value.ui64 = zls->zls_decompress_time;
+		ks[6].value.ui64 = zstd_rate(zls->zls_decompress_bytes,
+		    zls->zls_decompress_time);
+		ks += ZSTD_STAT_NDATA;
+	}
+
+	return (0);
+}
+
+/*
+ * Size a compression workspace for every block size at this level.  The
+ * library trims its tables to the input size, so a small block can end up
+ * with different parameters than a large one.
+ */
+static size_t
+zstd_cctx_workspace_size(int level)
+{
+	size_t size, max = 0;
+	uint64_t blksz;
+
+	for (blksz = SPA_MINBLOCKSIZE; blksz <= SPA_MAXBLOCKSIZE; blksz <<= 1) {
+		size = ZSTD_estimateCCtxSize_usingCParams(
+		    ZSTD_getCParams(level, blksz, 0));
+		max = MAX(max, size);
+	}
+
+	return (max);
+}
+
+void
+zstd_init(void)
+{
+	char name[KSTAT_STRLEN];
+	kstat_named_t *ks;
+	int i, s;
+
+	for (i = 0; i < ZSTD_LEVELS; i++) {
+		zstd_cctx_size[i] = zstd_cctx_workspace_size(i + 1);
+		(void) snprintf(name, sizeof (name), "zstd_cctx_%d", i + 1);
+		zstd_cctx_cache[i] = kmem_cache_create(name,
+		    zstd_cctx_size[i], 0, NULL, NULL, NULL, NULL, NULL, 0);
+	}
+
+	zstd_dctx_size = ZSTD_estimateDCtxSize();
+	zstd_dctx_cache = kmem_cache_create("zstd_dctx", zstd_dctx_size, 0,
+	    NULL, NULL, NULL, NULL, NULL, 0);
+
+	zstd_ksp = kstat_create("zfs", 0, "zstdstats", "misc",
+	    KSTAT_TYPE_NAMED, ZSTD_LEVELS * ZSTD_STAT_NDATA,
+	    KSTAT_FLAG_VIRTUAL);
+	if (zstd_ksp == NULL)
+		return;
+
+	zstd_ksp->ks_data = kmem_zalloc(ZSTD_LEVELS * ZSTD_STAT_NDATA *
+	    sizeof (kstat_named_t), KM_SLEEP);
+	zstd_ksp->ks_data_size = ZSTD_LEVELS * ZSTD_STAT_NDATA *
+	    sizeof (kstat_named_t);
+	zstd_ksp->ks_update = zstd_kstat_update;
+
+	ks = zstd_ksp->ks_data;
+	for (i = 0; i < ZSTD_LEVELS; i++) {
+		for (s = 0; s < ZSTD_STAT_NDATA; s++, ks++) {
+			ks->data_type = KSTAT_DATA_UINT64;
+			(void) snprintf(ks->name, KSTAT_STRLEN, "%d_%s",
+			    i + 1, zstd_stat_names[s]);
+		}
+	}
+	kstat_install(zstd_ksp);
+}
+
+void
+zstd_fini(void)
+{
+	int i;
+
+	if (zstd_ksp != NULL) {
+		kmem_free(zstd_ksp->ks_data, zstd_ksp->ks_data_size);
+		kstat_delete(zstd_ksp);
+		zstd_ksp = NULL;
+	}
+
+	for (i = 0; i < ZSTD_LEVELS; i++) {
+		if (zstd_cctx_cache[i] != NULL) {
+			kmem_cache_destroy(zstd_cctx_cache[i]);
+			zstd_cctx_cache[i] = NULL;
+		}
+	}
+
+	if (zstd_dctx_cache != NULL) {
+		kmem_cache_destroy(zstd_dctx_cache);
+		zstd_dctx_cache = NULL;
+	}
+}
@@ -112,7 +112,7 @@ zpios_survey_pending() {
 	print_header ${TEST_NAME}
 
 	${ZFS_SH} ${VERBOSE_FLAG}                  \
-		zfs="zfs_vdev_max_pending=1024" | \
+		zfs="zfs_vdev_max_active=1024" | \
 		tee -a ${ZPIOS_SURVEY_LOG}
 	${ZPIOS_SH} ${VERBOSE_FLAG} -c ${ZPOOL_CONFIG} -t ${ZPIOS_TEST} | \
 		tee -a ${ZPIOS_SURVEY_LOG}
@@ -152,7 +152,7 @@ zpios_survey_all() {
 	print_header ${TEST_NAME}
 
 	${ZFS_SH} ${VERBOSE_FLAG}                \  
-		zfs="zfs_vdev_max_pending=1024" \
+		zfs="zfs_vdev_max_active=1024" \
 		zfs="zio_bulk_flags=0x100" |    \
 		tee -a ${ZPIOS_SURVEY_LOG}
 	${ZPIOS_SH} ${VERBOSE_FLAG} -c ${ZPOOL_CONFIG} -t ${ZPIOS_TEST} \